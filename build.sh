@@ -1,2 +1,2 @@
-cc main.c -o rocknation-cli -lcurl -lpcre -luriparser -Ofast
+cc main.c -o rocknation-cli -pthread -lcurl -lpcre2-8 -luriparser -Ofast
 ./rocknation-cli
@@ -0,0 +1,99 @@
+// rocknation_alloc.h
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rocknation_platform.h"
+
+typedef struct
+{
+    size_t allocations;   // Calls to rn_malloc, rn_calloc and rn_strdup
+    size_t reallocations; // Calls to rn_realloc
+    size_t bytes;         // Bytes requested by all of them
+} RocknationAllocStats;
+
+// Updated atomically, allocations are made from every thread of every translation unit
+RN_SHARED RocknationAllocStats rocknation_alloc = {0, 0, 0};
+
+RN_API void *rn_malloc(size_t size);
+RN_API void *rn_calloc(size_t count, size_t size);
+RN_API void *rn_realloc(void *ptr, size_t size);
+RN_API char *rn_strdup(const char *text);
+RN_API void print_alloc_stats(void);
+
+RN_API void *rn_malloc(size_t size)
+{
+    /*
+     * Function  : void *rn_malloc(size_t size)
+     * Input     : size - number of bytes to allocate
+     * Output    : Returns a pointer to the allocated memory, or NULL on failure
+     * Procedure : This function is malloc with a counter. Every heap allocation made by the library goes through rn_malloc, rn_calloc, rn_realloc or rn_strdup, so the number of allocations a command needs can be reported with --timings (see print_alloc_stats). Memory is released with the usual free. The counters are updated atomically, so every thread can allocate through it.
+     */
+
+    RN_ATOMIC_ADD(rocknation_alloc.allocations, 1);
+    RN_ATOMIC_ADD(rocknation_alloc.bytes, size);
+    return malloc(size);
+}
+
+RN_API void *rn_calloc(size_t count, size_t size)
+{
+    /*
+     * Function  : void *rn_calloc(size_t count, size_t size)
+     * Input     : count - number of elements
+     *             size - size of each element
+     * Output    : Returns a pointer to the zeroed memory, or NULL on failure
+     * Procedure : This function is calloc with a counter, see rn_malloc.
+     */
+
+    RN_ATOMIC_ADD(rocknation_alloc.allocations, 1);
+    RN_ATOMIC_ADD(rocknation_alloc.bytes, count * size);
+    return calloc(count, size);
+}
+
+RN_API void *rn_realloc(void *ptr, size_t size)
+{
+    /*
+     * Function  : void *rn_realloc(void *ptr, size_t size)
+     * Input     : ptr - pointer to the memory to resize, or NULL
+     *             size - new size in bytes
+     * Output    : Returns a pointer to the resized memory, or NULL on failure
+     * Procedure : This function is realloc with a counter, see rn_malloc. Resizing is counted apart from fresh allocations.
+     */
+
+    RN_ATOMIC_ADD(rocknation_alloc.reallocations, 1);
+    RN_ATOMIC_ADD(rocknation_alloc.bytes, size);
+    return realloc(ptr, size);
+}
+
+RN_API char *rn_strdup(const char *text)
+{
+    /*
+     * Function  : char *rn_strdup(const char *text)
+     * Input     : text - pointer to the string to copy
+     * Output    : Returns a newly allocated copy of text, or NULL on failure
+     * Procedure : This function is strdup with a counter, see rn_malloc.
+     */
+
+    size_t length = strlen(text) + 1;
+    char *copy = rn_malloc(length);
+
+    if (copy != NULL)
+    {
+        memcpy(copy, text, length);
+    }
+
+    return copy;
+}
+
+RN_API void print_alloc_stats(void)
+{
+    /*
+     * Function  : void print_alloc_stats(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints to stderr how many heap allocations and reallocations were made through the counting allocator, and how many bytes they requested.
+     */
+
+    fprintf(stderr, "[memory] %zu allocations, %zu reallocations, %.1f KB requested\n",
+            rocknation_alloc.allocations, rocknation_alloc.reallocations, rocknation_alloc.bytes / 1024.0);
+}
@@ -0,0 +1,228 @@
+// rocknation_arena.h
+#pragma once
+#include "rocknation_alloc.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next; // Block allocated before this one
+    size_t used;             // Bytes handed out from data
+    size_t capacity;         // Bytes available in data
+    _Alignas(ARENA_ALIGNMENT) char data[];
+} ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *blocks; // Current block first
+    size_t block_size;  // Size of a regular block
+    size_t allocated;   // Bytes handed out so far
+    void *last;         // Most recent allocation, the only one that can grow in place
+    size_t last_size;   // Size of the most recent allocation
+} Arena;
+
+RN_API void arena_init(Arena *arena, size_t block_size);
+RN_API void *arena_alloc(Arena *arena, size_t size);
+RN_API void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+RN_API void *arena_reserve(Arena *arena, void *items, int *capacity, int count, size_t item_size);
+RN_API char *arena_strndup(Arena *arena, const char *text, size_t length);
+RN_API void arena_free(Arena *arena);
+
+RN_API void arena_init(Arena *arena, size_t block_size)
+{
+    /*
+     * Function  : void arena_init(Arena *arena, size_t block_size)
+     * Input     : arena - pointer to the Arena structure to initialize
+     *             block_size - size of the blocks the arena carves allocations from
+     * Output    : None
+     * Procedure : This function prepares an empty arena. No memory is taken until the first allocation.
+     */
+
+    arena->blocks = NULL;
+    arena->block_size = block_size > 0 ? block_size : ARENA_BLOCK_SIZE;
+    arena->allocated = 0;
+    arena->last = NULL;
+    arena->last_size = 0;
+}
+
+RN_API void *arena_alloc(Arena *arena, size_t size)
+{
+    /*
+     * Function  : void *arena_alloc(Arena *arena, size_t size)
+     * Input     : arena - pointer to the Arena structure
+     *             size - number of bytes to allocate
+     * Output    : Returns a pointer to the memory (aligned to ARENA_ALIGNMENT), or NULL on failure
+     * Procedure : This function hands out memory from the current block of the arena, taking a new block from the heap when it is full. A request bigger than a block gets a block of its own, linked behind the current block so the room left in that one is still used by the next allocations; one too big for a block header to be added to it fails. Memory from an arena is never freed on its own: everything is released at once by arena_free, so a whole command can build its records and strings without a malloc or free per item.
+     */
+
+    if (size > SIZE_MAX - sizeof(ArenaBlock) - ARENA_ALIGNMENT)
+    {
+        return NULL;
+    }
+
+    size_t rounded = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    ArenaBlock *block = arena->blocks;
+
+    if (block != NULL && rounded > arena->block_size)
+    {
+        // An oversize block is full from the start, it goes behind the current block and isn't grown in place
+        ArenaBlock *oversize = rn_malloc(sizeof(ArenaBlock) + rounded);
+        if (oversize == NULL)
+        {
+            return NULL;
+        }
+
+        oversize->used = rounded;
+        oversize->capacity = rounded;
+        oversize->next = block->next;
+        block->next = oversize;
+        arena->allocated += rounded;
+
+        return oversize->data;
+    }
+
+    if (block == NULL || block->capacity - block->used < rounded)
+    {
+        size_t capacity = rounded > arena->block_size ? rounded : arena->block_size;
+
+        block = rn_malloc(sizeof(ArenaBlock) + capacity);
+        if (block == NULL)
+        {
+            return NULL;
+        }
+
+        block->used = 0;
+        block->capacity = capacity;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += rounded;
+    arena->allocated += rounded;
+    arena->last = ptr;
+    arena->last_size = rounded;
+
+    return ptr;
+}
+
+RN_API void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    /*
+     * Function  : void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size)
+     * Input     : arena - pointer to the Arena structure
+     *             ptr - pointer to memory from the arena, or NULL
+     *             old_size - size of that memory
+     *             new_size - size it needs now
+     * Output    : Returns a pointer to at least new_size bytes holding the old contents, or NULL on failure
+     * Procedure : This function is the arena's realloc. If ptr is the most recent allocation and its block has room, it simply grows in place; otherwise the contents are copied to a new allocation and the old one is left to be released with the arena.
+     */
+
+    if (new_size > SIZE_MAX - sizeof(ArenaBlock) - ARENA_ALIGNMENT)
+    {
+        return NULL;
+    }
+
+    if (ptr != NULL && ptr == arena->last)
+    {
+        ArenaBlock *block = arena->blocks;
+        size_t rounded = (new_size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+        size_t start = (size_t)((char *)ptr - block->data);
+
+        if (rounded <= arena->last_size)
+        {
+            return ptr;
+        }
+        if (start + rounded <= block->capacity)
+        {
+            block->used = start + rounded;
+            arena->allocated += rounded - arena->last_size;
+            arena->last_size = rounded;
+            return ptr;
+        }
+    }
+
+    void *grown = arena_alloc(arena, new_size);
+    if (grown != NULL && ptr != NULL)
+    {
+        memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    }
+
+    return grown;
+}
+
+RN_API void *arena_reserve(Arena *arena, void *items, int *capacity, int count, size_t item_size)
+{
+    /*
+     * Function  : void *arena_reserve(Arena *arena, void *items, int *capacity, int count, size_t item_size)
+     * Input     : arena - pointer to the Arena structure
+     *             items - pointer to the array of a list, or NULL
+     *             capacity - pointer to the number of items the array can hold, updated if it grows
+     *             count - number of items in the array
+     *             item_size - size of an item
+     * Output    : Returns the array, grown if needed so one more item fits, or NULL on failure
+     * Procedure : This function makes room for one more item in a growable list, doubling its array when it is full so appending stays amortized O(1).
+     */
+
+    if (count < *capacity)
+    {
+        return items;
+    }
+
+    int grown_capacity = *capacity > 0 ? *capacity * 2 : 16;
+    void *grown = arena_grow(arena, items, (size_t)*capacity * item_size, (size_t)grown_capacity * item_size);
+
+    if (grown != NULL)
+    {
+        *capacity = grown_capacity;
+    }
+
+    return grown;
+}
+
+RN_API char *arena_strndup(Arena *arena, const char *text, size_t length)
+{
+    /*
+     * Function  : char *arena_strndup(Arena *arena, const char *text, size_t length)
+     * Input     : arena - pointer to the Arena structure
+     *             text - pointer to the text to copy
+     *             length - number of bytes to copy
+     * Output    : Returns a null-terminated copy of the text in the arena, or NULL on failure
+     * Procedure : This function copies length bytes of text into the arena and null-terminates them.
+     */
+
+    char *copy = arena_alloc(arena, length + 1);
+
+    if (copy != NULL)
+    {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+
+    return copy;
+}
+
+RN_API void arena_free(Arena *arena)
+{
+    /*
+     * Function  : void arena_free(Arena *arena)
+     * Input     : arena - pointer to the Arena structure
+     * Output    : None
+     * Procedure : This function releases every block of the arena, and with them everything allocated from it. The arena is left empty and can be used again.
+     */
+
+    ArenaBlock *block = arena->blocks;
+
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->blocks = NULL;
+    arena->allocated = 0;
+    arena->last = NULL;
+    arena->last_size = 0;
+}
@@ -0,0 +1,430 @@
+// rocknation_cache.h
+#pragma once
+#include "rocknation_types.h"
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#define CACHE_MAGIC "RNCACHE 1"
+#define MAX_PATH_LENGTH 1024
+#define MAX_VALIDATOR_LENGTH 256
+// Longest URL or POST body a page is cached for, and longest header line of a cache file ("post " + key + "\n")
+#define MAX_CACHE_KEY_LENGTH MAX_URL_LENGTH
+#define CACHE_LINE_LENGTH (MAX_CACHE_KEY_LENGTH + 8)
+
+typedef struct
+{
+    int enabled;    // Look up and store catalog pages in the cache
+    int offline;    // Never touch the network, answer from the cache only
+    long ttl;       // Seconds a stored page is used without revalidating it
+    char dir[MAX_PATH_LENGTH];
+    int hits;        // Pages answered from the cache without a request
+    int revalidated; // Pages confirmed unchanged by a 304 answer
+    int misses;      // Pages that had to be downloaded
+} RocknationCache;
+
+typedef struct
+{
+    char etag[MAX_VALIDATOR_LENGTH];
+    char last_modified[MAX_VALIDATOR_LENGTH];
+} CacheValidators;
+
+typedef struct
+{
+    MemoryStruct body;          // Stored page
+    CacheValidators validators; // Validators sent back to revalidate the page
+    time_t stored;              // When the page was stored or last revalidated
+} CacheEntry;
+
+// Cache of the threads that haven't bound a client (see rocknation_client.h)
+static RocknationCache rocknation_cache = {1, 0, 0, "", 0, 0, 0};
+static RN_THREAD_LOCAL RocknationCache *bound_cache = NULL;
+
+static size_t CacheHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata);
+static int make_directory(const char *path);
+RN_API RocknationCache *get_cache(void);
+RN_API const char *cache_dir(void);
+RN_API void cache_path(const char *url, const char *postdata, char *path, size_t path_size);
+RN_API int cache_load(const char *url, const char *postdata, CacheEntry *entry);
+RN_API int cache_store(const char *url, const char *postdata, const char *body, size_t size, const CacheValidators *validators);
+RN_API void print_cache_stats(void);
+
+static size_t CacheHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    /* Function  : static size_t CacheHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+     * Input     : buffer - pointer to one response header line (not null-terminated)
+     *             size, nitems - size of the header line
+     *             userdata - pointer to a CacheValidators structure
+     * Output    : Returns the size of the header line
+     * Procedure : This function is used as CURLOPT_HEADERFUNCTION for catalog requests. It keeps the ETag and Last-Modified headers of the response so the page can be revalidated later with If-None-Match and If-Modified-Since.
+     */
+
+    size_t real_size = size * nitems;
+    CacheValidators *validators = (CacheValidators *)userdata;
+    char line[MAX_VALIDATOR_LENGTH + 32];
+
+    if (real_size >= sizeof(line))
+    {
+        return real_size;
+    }
+
+    memcpy(line, buffer, real_size);
+    line[real_size] = '\0';
+
+    // Strip the line ending
+    size_t length = real_size;
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == '\n'))
+    {
+        line[--length] = '\0';
+    }
+
+    char *colon = strchr(line, ':');
+    if (colon == NULL)
+    {
+        // Status line: a new response (e.g. after a redirect) starts without validators
+        if (strncmp(line, "HTTP/", 5) == 0)
+        {
+            validators->etag[0] = '\0';
+            validators->last_modified[0] = '\0';
+        }
+        return real_size;
+    }
+
+    *colon = '\0';
+    char *value = colon + 1;
+    while (*value == ' ' || *value == '\t')
+    {
+        value++;
+    }
+
+    for (char *p = line; *p; p++)
+    {
+        *p = tolower((unsigned char)*p);
+    }
+
+    // A validator that doesn't fit is dropped: sent back cut short it would never match
+    if (strcmp(line, "etag") == 0 &&
+        snprintf(validators->etag, sizeof(validators->etag), "%s", value) >= (int)sizeof(validators->etag))
+    {
+        validators->etag[0] = '\0';
+    }
+    else if (strcmp(line, "last-modified") == 0 &&
+             snprintf(validators->last_modified, sizeof(validators->last_modified), "%s", value) >= (int)sizeof(validators->last_modified))
+    {
+        validators->last_modified[0] = '\0';
+    }
+
+    return real_size;
+}
+
+static int make_directory(const char *path)
+{
+    /* Function  : static int make_directory(const char *path)
+     * Input     : path - pointer to the path of the directory
+     * Output    : Returns 0 if the directory exists afterwards, -1 otherwise
+     * Procedure : This function creates a directory and any missing parent directories, like "mkdir -p".
+     */
+
+    char partial[MAX_PATH_LENGTH];
+    snprintf(partial, sizeof(partial), "%s", path);
+
+    for (char *p = partial + 1; *p; p++)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+#ifdef _WIN32
+            _mkdir(partial);
+#else
+            mkdir(partial, 0755);
+#endif
+            *p = '/';
+        }
+    }
+
+#ifdef _WIN32
+    _mkdir(partial);
+#else
+    mkdir(partial, 0755);
+#endif
+
+    FILE *probe = NULL;
+    char probe_path[MAX_PATH_LENGTH + 16];
+    snprintf(probe_path, sizeof(probe_path), "%s/.probe", partial);
+    probe = fopen(probe_path, "wb");
+    if (probe == NULL)
+    {
+        return -1;
+    }
+    fclose(probe);
+    remove(probe_path);
+
+    return 0;
+}
+
+RN_API RocknationCache *get_cache(void)
+{
+    /*
+     * Function  : RocknationCache *get_cache(void)
+     * Input     : None
+     * Output    : Returns a pointer to the cache settings and counters of the calling thread
+     * Procedure : This function returns the cache of the client bound to the calling thread, or the default one if the thread hasn't bound a client.
+     */
+
+    return bound_cache != NULL ? bound_cache : &rocknation_cache;
+}
+
+RN_API const char *cache_dir(void)
+{
+    /*
+     * Function  : const char *cache_dir(void)
+     * Input     : None
+     * Output    : Returns a pointer to the path of the cache directory
+     * Procedure : This function picks the cache directory the first time it is called: $ROCKNATION_CACHE_DIR if set, otherwise $XDG_CACHE_HOME/rocknation, otherwise $HOME/.cache/rocknation (the current directory as a last resort). The directory is created if it doesn't exist. Each client picks its own, from the same variables.
+     */
+
+    RocknationCache *cache = get_cache();
+
+    if (cache->dir[0] == '\0')
+    {
+        const char *env = getenv("ROCKNATION_CACHE_DIR");
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+
+        if (env != NULL && env[0] != '\0')
+        {
+            snprintf(cache->dir, sizeof(cache->dir), "%s", env);
+        }
+        else if (xdg != NULL && xdg[0] != '\0')
+        {
+            snprintf(cache->dir, sizeof(cache->dir), "%s/rocknation", xdg);
+        }
+        else if (home != NULL && home[0] != '\0')
+        {
+            snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/rocknation", home);
+        }
+        else
+        {
+            snprintf(cache->dir, sizeof(cache->dir), ".rocknation-cache");
+        }
+
+        make_directory(cache->dir);
+    }
+
+    return cache->dir;
+}
+
+RN_API void cache_path(const char *url, const char *postdata, char *path, size_t path_size)
+{
+    /*
+     * Function  : void cache_path(const char *url, const char *postdata, char *path, size_t path_size)
+     * Input     : url - pointer to the URL of the page
+     *             postdata - pointer to the body of a POST request, or NULL for a GET request
+     *             path - pointer to the buffer receiving the path of the cache file
+     *             path_size - size of the path buffer
+     * Output    : Writes the path of the cache file into path
+     * Procedure : This function derives the name of the cache file of a request from a 64-bit FNV-1a hash of its URL and POST body. The URL and body are also stored inside the file, so a hash collision is detected when loading it.
+     */
+
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const char *p = url; *p; p++)
+    {
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+
+    hash = (hash ^ '\n') * 1099511628211ULL;
+
+    for (const char *p = postdata != NULL ? postdata : ""; *p; p++)
+    {
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ULL;
+    }
+
+    snprintf(path, path_size, "%s/%016llx.html", cache_dir(), (unsigned long long)hash);
+}
+
+RN_API int cache_load(const char *url, const char *postdata, CacheEntry *entry)
+{
+    /*
+     * Function  : int cache_load(const char *url, const char *postdata, CacheEntry *entry)
+     * Input     : url - pointer to the URL of the page
+     *             postdata - pointer to the body of a POST request, or NULL for a GET request
+     *             entry - pointer to the CacheEntry receiving the stored page
+     * Output    : Returns 0 if the page was found in the cache, -1 otherwise
+     * Procedure : This function reads the cache file of a request. The file starts with a small text header (magic, URL, POST body, time stored, ETag and Last-Modified) followed by an empty line and the page itself. On success entry->body holds the page and must be freed by the caller.
+     */
+
+    char path[MAX_PATH_LENGTH + 32];
+    cache_path(url, postdata, path, sizeof(path));
+
+    entry->body.memory = NULL;
+    entry->body.size = 0;
+    entry->body.capacity = 0;
+    entry->validators.etag[0] = '\0';
+    entry->validators.last_modified[0] = '\0';
+    entry->stored = 0;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    char line[CACHE_LINE_LENGTH];
+    int valid = 0;
+
+    if (fgets(line, sizeof(line), file) != NULL && strncmp(line, CACHE_MAGIC, strlen(CACHE_MAGIC)) == 0)
+    {
+        valid = 1;
+
+        while (fgets(line, sizeof(line), file) != NULL)
+        {
+            size_t length = strcspn(line, "\n");
+            if (line[length] != '\n')
+            {
+                // Longer than any line cache_store writes: not an entry this reader can trust
+                valid = 0;
+                break;
+            }
+            line[length] = '\0';
+
+            if (line[0] == '\0')
+            {
+                break; // End of the header, the page follows
+            }
+            else if (strncmp(line, "url ", 4) == 0)
+            {
+                valid &= strcmp(line + 4, url) == 0;
+            }
+            else if (strncmp(line, "post ", 5) == 0)
+            {
+                valid &= strcmp(line + 5, postdata != NULL ? postdata : "") == 0;
+            }
+            else if (strncmp(line, "stored ", 7) == 0)
+            {
+                entry->stored = (time_t)strtoll(line + 7, NULL, 10);
+            }
+            else if (strncmp(line, "etag ", 5) == 0)
+            {
+                valid &= snprintf(entry->validators.etag, sizeof(entry->validators.etag), "%s", line + 5) < (int)sizeof(entry->validators.etag);
+            }
+            else if (strncmp(line, "last-modified ", 14) == 0)
+            {
+                valid &= snprintf(entry->validators.last_modified, sizeof(entry->validators.last_modified), "%s", line + 14) < (int)sizeof(entry->validators.last_modified);
+            }
+        }
+    }
+
+    if (valid)
+    {
+        long start = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, start, SEEK_SET);
+
+        entry->body.size = end > start ? (size_t)(end - start) : 0;
+        entry->body.memory = rn_malloc(entry->body.size + 1);
+        entry->body.capacity = entry->body.size + 1;
+
+        if (entry->body.memory == NULL || fread(entry->body.memory, 1, entry->body.size, file) != entry->body.size)
+        {
+            free(entry->body.memory);
+            entry->body.memory = NULL;
+            valid = 0;
+        }
+        else
+        {
+            entry->body.memory[entry->body.size] = '\0';
+        }
+    }
+
+    fclose(file);
+    return valid ? 0 : -1;
+}
+
+RN_API int cache_store(const char *url, const char *postdata, const char *body, size_t size, const CacheValidators *validators)
+{
+    /*
+     * Function  : int cache_store(const char *url, const char *postdata, const char *body, size_t size, const CacheValidators *validators)
+     * Input     : url - pointer to the URL of the page
+     *             postdata - pointer to the body of a POST request, or NULL for a GET request
+     *             body - pointer to the page
+     *             size - size of the page in bytes
+     *             validators - pointer to the ETag and Last-Modified of the page
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function writes a page to its cache file, stamped with the current time. The file is written under a temporary name of its own (see make_temp_path) and renamed into place, so a concurrent reader never sees a half-written entry and concurrent writers don't trample each other.
+     */
+
+    char path[MAX_PATH_LENGTH + 32];
+    char temp_path[MAX_PATH_LENGTH + 96];
+    cache_path(url, postdata, path, sizeof(path));
+    make_temp_path(path, temp_path, sizeof(temp_path));
+
+    // Values containing line breaks, or too long for cache_load to read back whole, can't be stored in the header
+    if (strchr(url, '\n') != NULL || strlen(url) > MAX_CACHE_KEY_LENGTH ||
+        (postdata != NULL && (strchr(postdata, '\n') != NULL || strlen(postdata) > MAX_CACHE_KEY_LENGTH)))
+    {
+        return -1;
+    }
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(file, "%s\nurl %s\npost %s\nstored %lld\n", CACHE_MAGIC, url, postdata != NULL ? postdata : "", (long long)time(NULL));
+    if (validators->etag[0] != '\0')
+    {
+        fprintf(file, "etag %s\n", validators->etag);
+    }
+    if (validators->last_modified[0] != '\0')
+    {
+        fprintf(file, "last-modified %s\n", validators->last_modified);
+    }
+    fputc('\n', file);
+
+    size_t written = fwrite(body, 1, size, file);
+
+    if (fclose(file) != 0 || written != size)
+    {
+        remove(temp_path);
+        return -1;
+    }
+
+#ifdef _WIN32
+    remove(path); // rename() doesn't replace existing files on Windows
+#endif
+    if (rename(temp_path, path) != 0)
+    {
+        remove(temp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+RN_API void print_cache_stats(void)
+{
+    /*
+     * Function  : void print_cache_stats(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints to stderr how many catalog pages were answered from the cache, revalidated with a 304 answer or downloaded.
+     */
+
+    RocknationCache *cache = get_cache();
+
+    if (cache->hits + cache->revalidated + cache->misses == 0)
+    {
+        return;
+    }
+
+    fprintf(stderr, "[cache] %d hits, %d revalidated, %d downloaded (%s)\n",
+            cache->hits, cache->revalidated, cache->misses, cache_dir());
+}
@@ -0,0 +1,199 @@
+// rocknation_catalog.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_utils.h"
+
+#define STRING_POOL_INITIAL_SIZE (16 * 1024)
+#define STRING_POOL_INITIAL_SLOTS 256
+
+// Interned strings, referred to by their offset in text
+typedef struct
+{
+    char *text;          // Every string, null-terminated, back to back
+    size_t size;         // Bytes used in text
+    size_t capacity;     // Bytes allocated for text
+    uint32_t *slots;     // Open-addressing hash table of offset + 1, 0 when empty
+    size_t slot_count;   // Always a power of two
+    size_t interned;     // Strings in the hash table
+} StringPool;
+
+RN_API void string_pool_init(StringPool *pool);
+RN_API void string_pool_free(StringPool *pool);
+RN_API int string_pool_add(StringPool *pool, const char *text, size_t length, uint32_t *id);
+RN_API int string_pool_intern(StringPool *pool, const char *text, size_t length, uint32_t *id);
+
+static uint32_t hash_string(const char *text, size_t length)
+{
+    /* Function  : static uint32_t hash_string(const char *text, size_t length)
+     * Input     : text - pointer to the text to hash
+     *             length - length of the text
+     * Output    : Returns the 32-bit FNV-1a hash of the text
+     * Procedure : This function hashes a string for the hash table of a StringPool.
+     */
+
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+RN_API void string_pool_init(StringPool *pool)
+{
+    /*
+     * Function  : void string_pool_init(StringPool *pool)
+     * Input     : pool - pointer to the StringPool structure to initialize
+     * Output    : None
+     * Procedure : This function prepares an empty string pool. Nothing is allocated until the first string is added.
+     */
+
+    pool->text = NULL;
+    pool->size = 0;
+    pool->capacity = 0;
+    pool->slots = NULL;
+    pool->slot_count = 0;
+    pool->interned = 0;
+}
+
+RN_API void string_pool_free(StringPool *pool)
+{
+    /*
+     * Function  : void string_pool_free(StringPool *pool)
+     * Input     : pool - pointer to the StringPool structure to release
+     * Output    : None
+     * Procedure : This function releases the text and hash table of the pool and leaves it empty.
+     */
+
+    free(pool->text);
+    free(pool->slots);
+    string_pool_init(pool);
+}
+
+RN_API int string_pool_add(StringPool *pool, const char *text, size_t length, uint32_t *id)
+{
+    /*
+     * Function  : int string_pool_add(StringPool *pool, const char *text, size_t length, uint32_t *id)
+     * Input     : pool - pointer to the StringPool structure
+     *             text - pointer to the text to store
+     *             length - length of the text
+     *             id - pointer receiving the id of the stored string
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function appends a string to the pool without looking for an existing copy, for strings that are known to be unique such as file names. The text buffer doubles when it is full; ids are offsets, so they stay valid when it moves.
+     */
+
+    if (pool->size + length + 1 > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    if (pool->size + length + 1 > pool->capacity)
+    {
+        size_t capacity = pool->capacity > 0 ? pool->capacity : STRING_POOL_INITIAL_SIZE;
+        while (capacity < pool->size + length + 1)
+        {
+            capacity *= 2;
+        }
+
+        char *grown = rn_realloc(pool->text, capacity);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        pool->text = grown;
+        pool->capacity = capacity;
+    }
+
+    memcpy(pool->text + pool->size, text, length);
+    pool->text[pool->size + length] = '\0';
+    *id = (uint32_t)pool->size;
+    pool->size += length + 1;
+
+    return 0;
+}
+
+static int string_pool_rehash(StringPool *pool, size_t slot_count)
+{
+    /* Function  : static int string_pool_rehash(StringPool *pool, size_t slot_count)
+     * Input     : pool - pointer to the StringPool structure
+     *             slot_count - new size of the hash table, a power of two
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function moves every interned string into a new hash table of slot_count slots.
+     */
+
+    uint32_t *slots = rn_calloc(slot_count, sizeof(uint32_t));
+    if (slots == NULL)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < pool->slot_count; i++)
+    {
+        if (pool->slots[i] == 0)
+        {
+            continue;
+        }
+
+        const char *text = pool->text + pool->slots[i] - 1;
+        size_t slot = hash_string(text, strlen(text)) & (slot_count - 1);
+        while (slots[slot] != 0)
+        {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = pool->slots[i];
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slot_count = slot_count;
+
+    return 0;
+}
+
+RN_API int string_pool_intern(StringPool *pool, const char *text, size_t length, uint32_t *id)
+{
+    /*
+     * Function  : int string_pool_intern(StringPool *pool, const char *text, size_t length, uint32_t *id)
+     * Input     : pool - pointer to the StringPool structure
+     *             text - pointer to the text to intern
+     *             length - length of the text
+     *             id - pointer receiving the id of the string
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function returns the id of the copy of the string already in the pool, adding it first if there is none, so equal strings are stored once and can be compared by id. Lookups go through an open-addressing hash table kept at most half full.
+     */
+
+    if (pool->interned + 1 > pool->slot_count / 2)
+    {
+        size_t slot_count = pool->slot_count > 0 ? pool->slot_count * 2 : STRING_POOL_INITIAL_SLOTS;
+        if (string_pool_rehash(pool, slot_count) != 0)
+        {
+            return -1;
+        }
+    }
+
+    size_t slot = hash_string(text, length) & (pool->slot_count - 1);
+
+    while (pool->slots[slot] != 0)
+    {
+        const char *candidate = pool->text + pool->slots[slot] - 1;
+        if (strncmp(candidate, text, length) == 0 && candidate[length] == '\0')
+        {
+            *id = pool->slots[slot] - 1;
+            return 0;
+        }
+        slot = (slot + 1) & (pool->slot_count - 1);
+    }
+
+    if (string_pool_add(pool, text, length, id) != 0)
+    {
+        return -1;
+    }
+
+    pool->slots[slot] = *id + 1;
+    pool->interned++;
+
+    return 0;
+}
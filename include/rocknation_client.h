@@ -0,0 +1,190 @@
+// rocknation_client.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_curl.h"
+
+/*
+ * A client owns everything a lookup touches besides its arguments: the curl session (easy and share
+ * handles), the page cache settings and counters, the compiled extraction patterns with their match
+ * data, the local catalog store and the name cache. Threads that don't use a client share one default
+ * instance of each, which is what the command line tool does (one per translation unit, see
+ * rocknation_platform.h).
+ *
+ * Thread safety:
+ * - A client is used by one thread at a time. Different threads can each drive their own client at the
+ *   same time with no locking: nothing mutable is shared between clients.
+ * - rn_client_bind makes the calling thread use a client for every library call it makes afterwards
+ *   from the same translation unit (search_band, get_albums, get_songs...); the rn_* functions below
+ *   bind the client they are given for the duration of the call, so they work from any translation
+ *   unit. A client can move to another thread once it is unbound.
+ * - The default instances are not safe to use from several threads at once.
+ * - libcurl is initialized once for the whole process (see session_global_init), whichever translation
+ *   unit gets there first, and heap counters are atomic (see rn_malloc). The worker pool and the disk
+ *   writer are shared by every client and every translation unit.
+ * - Clients whose cache directory is the same share files, not memory: cached pages, snapshots and
+ *   the name cache are written under temporary names of their own and renamed into place, and store
+ *   records are appended in single writes, as for concurrent runs of the tool. A client only sees the
+ *   store records added by others when it is created.
+ * - Callbacks (BandCallback, SongCallback) run on the calling thread.
+ */
+
+typedef struct RocknationClient
+{
+    RocknationSession session;
+    RocknationCache cache;
+    CompiledPattern patterns[PATTERN_COUNT];
+    RocknationStore store;
+    NameCache names;
+} RocknationClient;
+
+static RN_THREAD_LOCAL RocknationClient *bound_client = NULL;
+
+RN_API RocknationClient *rn_client_create(void);
+RN_API void rn_client_destroy(RocknationClient *client);
+RN_API RocknationClient *rn_client_bind(RocknationClient *client);
+RN_API void rn_search_band(RocknationClient *client, const char *search_text, BandInfoList *band_list);
+RN_API int rn_get_albums(RocknationClient *client, const char *band_url, AlbumInfoList *album_list);
+RN_API void rn_get_albums_by_name(RocknationClient *client, const char *band_name, AlbumInfoList *album_list);
+RN_API void rn_get_songs(RocknationClient *client, const char *album_url, SongInfoList *song_list);
+
+RN_API RocknationClient *rn_client_create(void)
+{
+    /*
+     * Function  : RocknationClient *rn_client_create(void)
+     * Input     : None
+     * Output    : Returns a pointer to a new client, or NULL if it can't be allocated
+     * Procedure : This function creates a client with the settings (page cache, offline mode, --refresh, timings) of the calling thread's client or of the default instances, so the command line options carry over to the clients a command starts. Its handles, patterns, store and name cache are opened lazily on first use, like the default ones. libcurl is initialized here if it wasn't yet, before the client can be handed to another thread.
+     */
+
+    RocknationClient *client = rn_calloc(1, sizeof(RocknationClient));
+    if (client == NULL)
+    {
+        return NULL;
+    }
+
+    rn_once(&rocknation_curl_once, session_global_init);
+
+    RocknationCache *cache = get_cache();
+    client->cache.enabled = cache->enabled;
+    client->cache.offline = cache->offline;
+    client->cache.ttl = cache->ttl;
+    client->session.timings = current_session()->timings;
+    client->store.refresh = current_store()->refresh;
+    client->names.refresh = current_name_cache()->refresh;
+    client->names.ttl = current_name_cache()->ttl;
+    init_patterns(client->patterns);
+
+    return client;
+}
+
+RN_API void rn_client_destroy(RocknationClient *client)
+{
+    /*
+     * Function  : void rn_client_destroy(RocknationClient *client)
+     * Input     : client - pointer to the client, or NULL
+     * Output    : None
+     * Procedure : This function prints the summary of the client if timings were requested, writes back its name cache and store snapshot if needed and releases everything it owns. The client must not be in use by another thread; if the calling thread had bound it, the thread goes back to the default instances.
+     */
+
+    if (client == NULL)
+    {
+        return;
+    }
+
+    RocknationClient *previous = rn_client_bind(client);
+
+    session_cleanup();
+    name_cache_close();
+    store_close();
+    free_patterns();
+
+    rn_client_bind(previous != client ? previous : NULL);
+    free(client);
+}
+
+RN_API RocknationClient *rn_client_bind(RocknationClient *client)
+{
+    /*
+     * Function  : RocknationClient *rn_client_bind(RocknationClient *client)
+     * Input     : client - pointer to the client the calling thread uses from now on, or NULL for the default instances
+     * Output    : Returns the client the thread was using before, or NULL
+     * Procedure : This function points every part of the library at the session, cache, patterns, store and name cache of a client for the calling thread only. Binding is cheap, so it can be done around every call, and the previous client returned lets calls nest.
+     */
+
+    RocknationClient *previous = bound_client;
+
+    bound_client = client;
+    bound_session = client != NULL ? &client->session : NULL;
+    bound_cache = client != NULL ? &client->cache : NULL;
+    bound_patterns = client != NULL ? client->patterns : NULL;
+    bound_store = client != NULL ? &client->store : NULL;
+    bound_names = client != NULL ? &client->names : NULL;
+
+    return previous;
+}
+
+RN_API void rn_search_band(RocknationClient *client, const char *search_text, BandInfoList *band_list)
+{
+    /*
+     * Function  : void rn_search_band(RocknationClient *client, const char *search_text, BandInfoList *band_list)
+     * Input     : client - pointer to the client making the request
+     *             search_text - pointer to the text to search for
+     *             band_list - pointer to the BandInfoList structure to store band information
+     * Output    : Updates the band_list with band information
+     * Procedure : This function is search_band through a given client.
+     */
+
+    RocknationClient *previous = rn_client_bind(client);
+    search_band(search_text, band_list);
+    rn_client_bind(previous);
+}
+
+RN_API int rn_get_albums(RocknationClient *client, const char *band_url, AlbumInfoList *album_list)
+{
+    /*
+     * Function  : int rn_get_albums(RocknationClient *client, const char *band_url, AlbumInfoList *album_list)
+     * Input     : client - pointer to the client making the requests
+     *             band_url - pointer to the URL of the band
+     *             album_list - pointer to the AlbumInfoList structure to store album information
+     * Output    : Updates the album_list with album information. Returns what get_albums returns
+     * Procedure : This function is get_albums through a given client.
+     */
+
+    RocknationClient *previous = rn_client_bind(client);
+    int status = get_albums(band_url, album_list);
+    rn_client_bind(previous);
+
+    return status;
+}
+
+RN_API void rn_get_albums_by_name(RocknationClient *client, const char *band_name, AlbumInfoList *album_list)
+{
+    /*
+     * Function  : void rn_get_albums_by_name(RocknationClient *client, const char *band_name, AlbumInfoList *album_list)
+     * Input     : client - pointer to the client making the requests
+     *             band_name - pointer to the name of the band
+     *             album_list - pointer to the AlbumInfoList structure to store album information
+     * Output    : Updates the album_list with album information
+     * Procedure : This function is get_albums_by_name through a given client.
+     */
+
+    RocknationClient *previous = rn_client_bind(client);
+    get_albums_by_name(band_name, album_list);
+    rn_client_bind(previous);
+}
+
+RN_API void rn_get_songs(RocknationClient *client, const char *album_url, SongInfoList *song_list)
+{
+    /*
+     * Function  : void rn_get_songs(RocknationClient *client, const char *album_url, SongInfoList *song_list)
+     * Input     : client - pointer to the client making the request
+     *             album_url - pointer to the URL of the album
+     *             song_list - pointer to the SongInfoList structure to store song information
+     * Output    : Updates the song_list with song information
+     * Procedure : This function is get_songs through a given client.
+     */
+
+    RocknationClient *previous = rn_client_bind(client);
+    get_songs(album_url, song_list);
+    rn_client_bind(previous);
+}
@@ -0,0 +1,777 @@
+// rocknation_crawl.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_utils.h"
+#include "rocknation_curl.h"
+#include "rocknation_loop.h"
+
+#define CRAWL_MAGIC "RNCRAWL 1"
+#define CRAWL_CHECKPOINT_FILE "crawl.checkpoint"
+#define CRAWL_MAX_WORKERS 32
+#define CRAWL_MAX_HOSTS 16
+#define CRAWL_PER_HOST 4     // Requests in flight to the same host
+#define CRAWL_RATE 2.0       // Requests started per second
+#define CRAWL_BURST 4.0      // Requests that can be started at once after an idle period
+#define CRAWL_RETRIES 3      // Attempts of a page before its band is given up
+#define CRAWL_BACKOFF 5.0    // Seconds every request waits after the server answered 429 or 503
+#define CRAWL_BAND_ARENA_SIZE (16 * 1024)
+
+typedef struct
+{
+    int jobs;     // Requests in flight at the same time
+    int per_host; // Requests in flight to the same host
+    double rate;  // Requests started per second (0 for no limit)
+    double burst; // Requests that can be started at once
+} CrawlOptions;
+
+typedef struct
+{
+    double rate;
+    double burst;
+    double tokens;
+    double updated; // Time the tokens were last topped up
+} TokenBucket;
+
+typedef struct
+{
+    int id;             // Band id, 0 while the slot is free
+    int next_page;      // Next page of the discography to request
+    int pending;        // Tasks of the band queued or in flight
+    int discography;    // Set once every page of the discography has been seen
+    int failed;         // Set when a page of the band couldn't be fetched
+    int songs;          // Songs found so far
+    char url[MAX_BASE_URL_LENGTH + 32]; // Discography URL, built from base_url
+    Arena arena;        // Holds the albums and songs of the band until it is finished
+    AlbumInfoList albums;
+} CrawlBand;
+
+typedef struct
+{
+    int band;     // Slot of the band in Crawl.bands
+    int page;     // Page of the discography, or 0 for an album page
+    int album;    // Index of the album in the album list of the band
+    int attempts; // Times the task was started
+} CrawlTask;
+
+typedef struct Crawl Crawl;
+
+typedef struct
+{
+    Crawl *crawl;
+    CURL *curl;
+    CrawlTask task;
+    int host;           // Index of the host in Crawl.hosts
+    MemoryStruct chunk; // Raw HTML of the page while it is in flight
+} CrawlWorker;
+
+typedef struct
+{
+    char name[256]; // Host and port
+    int in_flight;
+} CrawlHost;
+
+struct Crawl
+{
+    CrawlOptions options;
+    EventLoop loop;
+    TokenBucket bucket;
+    double paused_until; // Nothing is started before this time after a 429 or 503
+
+    int first_id;
+    int last_id;
+    int next_id;             // Next band to admit
+    unsigned char *finished; // One bit per band id in [first_id, last_id], set for bands in the checkpoint
+    FILE *checkpoint;
+
+    CrawlBand *bands;
+    int band_slots;
+    int active_bands;
+
+    CrawlTask *queue; // Ring buffer of tasks waiting for a worker
+    int queue_head;
+    int queue_count;
+    int queue_capacity;
+
+    CrawlWorker workers[CRAWL_MAX_WORKERS];
+    int in_flight;
+    CrawlHost hosts[CRAWL_MAX_HOSTS];
+    int host_count;
+
+    long requests;
+    long retries;
+    long throttled;
+    long bands_done;
+    long bands_skipped;
+    long bands_failed;
+    long albums;
+    long songs;
+};
+
+static void token_bucket_init(TokenBucket *bucket, double rate, double burst);
+static double token_bucket_take(TokenBucket *bucket, double now);
+static int crawl_host(Crawl *crawl, const char *url);
+static int crawl_push(Crawl *crawl, CrawlTask task, int front);
+static int crawl_pop(Crawl *crawl, CrawlTask *task);
+static void crawl_load_checkpoint(Crawl *crawl, const char *path);
+static void crawl_add_albums(Crawl *crawl, int slot, int from);
+static int crawl_admit(Crawl *crawl);
+static void crawl_release_band(Crawl *crawl, int slot);
+static int crawl_start(Crawl *crawl, CrawlWorker *worker, CrawlTask task);
+static void crawl_finish(CURL *curl, CURLcode result, void *userdata);
+RN_API int crawl_catalog(int first_id, int last_id, const CrawlOptions *options);
+
+static void token_bucket_init(TokenBucket *bucket, double rate, double burst)
+{
+    /* Function  : static void token_bucket_init(TokenBucket *bucket, double rate, double burst)
+     * Input     : bucket - pointer to the TokenBucket to initialize
+     *             rate - tokens added per second (0 for no limit)
+     *             burst - most tokens the bucket holds
+     * Output    : None
+     * Procedure : This function starts the bucket full, so the first burst requests go out at once.
+     */
+
+    bucket->rate = rate;
+    bucket->burst = burst >= 1.0 ? burst : 1.0;
+    bucket->tokens = bucket->burst;
+    bucket->updated = rn_clock();
+}
+
+static double token_bucket_take(TokenBucket *bucket, double now)
+{
+    /* Function  : static double token_bucket_take(TokenBucket *bucket, double now)
+     * Input     : bucket - pointer to the TokenBucket
+     *             now - current time, from rn_clock
+     * Output    : Returns 0 if a token was taken, otherwise the seconds until the next one is available
+     * Procedure : This function tops the bucket up with the tokens earned since it was last used (never above burst) and takes one if there is one. Requests therefore average rate per second and never exceed burst at once.
+     */
+
+    if (bucket->rate <= 0)
+    {
+        return 0;
+    }
+
+    bucket->tokens += (now - bucket->updated) * bucket->rate;
+    if (bucket->tokens > bucket->burst)
+    {
+        bucket->tokens = bucket->burst;
+    }
+    bucket->updated = now;
+
+    if (bucket->tokens >= 1.0)
+    {
+        bucket->tokens -= 1.0;
+        return 0;
+    }
+
+    return (1.0 - bucket->tokens) / bucket->rate;
+}
+
+static int crawl_host(Crawl *crawl, const char *url)
+{
+    /* Function  : static int crawl_host(Crawl *crawl, const char *url)
+     * Input     : crawl - pointer to the Crawl
+     *             url - pointer to the URL about to be requested
+     * Output    : Returns the index of the host of the URL in crawl->hosts
+     * Procedure : This function finds the host (and port) of a URL among the hosts seen so far, adding it if it is new. Once the table is full the remaining hosts share its last entry, which only makes their limit stricter.
+     */
+
+    const char *start = strstr(url, "://");
+    start = start != NULL ? start + 3 : url;
+    size_t length = strcspn(start, "/?#");
+    if (length >= sizeof(crawl->hosts[0].name))
+    {
+        length = sizeof(crawl->hosts[0].name) - 1;
+    }
+
+    for (int i = 0; i < crawl->host_count; i++)
+    {
+        if (strncmp(crawl->hosts[i].name, start, length) == 0 && crawl->hosts[i].name[length] == '\0')
+        {
+            return i;
+        }
+    }
+
+    if (crawl->host_count == CRAWL_MAX_HOSTS)
+    {
+        return CRAWL_MAX_HOSTS - 1;
+    }
+
+    CrawlHost *host = &crawl->hosts[crawl->host_count];
+    memcpy(host->name, start, length);
+    host->name[length] = '\0';
+    host->in_flight = 0;
+    return crawl->host_count++;
+}
+
+static int crawl_push(Crawl *crawl, CrawlTask task, int front)
+{
+    /* Function  : static int crawl_push(Crawl *crawl, CrawlTask task, int front)
+     * Input     : crawl - pointer to the Crawl
+     *             task - task to queue
+     *             front - nonzero to queue the task before every other one
+     * Output    : Returns 0 on success, -1 if the queue can't grow
+     * Procedure : This function adds a task to either end of the ring buffer of waiting tasks, doubling it (and unwrapping its contents) when it is full.
+     */
+
+    if (crawl->queue_count == crawl->queue_capacity)
+    {
+        int capacity = crawl->queue_capacity > 0 ? crawl->queue_capacity * 2 : 64;
+        CrawlTask *queue = rn_malloc((size_t)capacity * sizeof(CrawlTask));
+        if (queue == NULL)
+        {
+            return -1;
+        }
+
+        for (int i = 0; i < crawl->queue_count; i++)
+        {
+            queue[i] = crawl->queue[(crawl->queue_head + i) % crawl->queue_capacity];
+        }
+
+        free(crawl->queue);
+        crawl->queue = queue;
+        crawl->queue_head = 0;
+        crawl->queue_capacity = capacity;
+    }
+
+    if (front)
+    {
+        crawl->queue_head = (crawl->queue_head + crawl->queue_capacity - 1) % crawl->queue_capacity;
+        crawl->queue[crawl->queue_head] = task;
+    }
+    else
+    {
+        crawl->queue[(crawl->queue_head + crawl->queue_count) % crawl->queue_capacity] = task;
+    }
+    crawl->queue_count++;
+    return 0;
+}
+
+static int crawl_pop(Crawl *crawl, CrawlTask *task)
+{
+    /* Function  : static int crawl_pop(Crawl *crawl, CrawlTask *task)
+     * Input     : crawl - pointer to the Crawl
+     *             task - pointer to the CrawlTask receiving the oldest waiting task
+     * Output    : Returns 0 if a task was taken, -1 if the queue is empty
+     * Procedure : This function takes the task at the head of the ring buffer.
+     */
+
+    if (crawl->queue_count == 0)
+    {
+        return -1;
+    }
+
+    *task = crawl->queue[crawl->queue_head];
+    crawl->queue_head = (crawl->queue_head + 1) % crawl->queue_capacity;
+    crawl->queue_count--;
+    return 0;
+}
+
+static void crawl_load_checkpoint(Crawl *crawl, const char *path)
+{
+    /* Function  : static void crawl_load_checkpoint(Crawl *crawl, const char *path)
+     * Input     : crawl - pointer to the Crawl
+     *             path - pointer to the path of the checkpoint file
+     * Output    : None
+     * Procedure : This function marks the bands listed in the checkpoint file as finished, so a crawl that was interrupted carries on where it stopped, and opens the file to append the bands finished from now on. Each band is written on its own line as soon as all of its albums and songs are in the catalog store; a line cut short by a crash doesn't parse and is ignored, and is ended with a mark that keeps it from parsing before anything is appended, so it can't run into the next band. A file without the expected header is started over.
+     */
+
+    FILE *file = fopen(path, "rb");
+    char line[64];
+    int valid = 0;
+    int cut_short = 0; // The last line has no newline
+
+    if (file != NULL)
+    {
+        valid = fgets(line, sizeof(line), file) != NULL && strncmp(line, CRAWL_MAGIC "\n", sizeof(CRAWL_MAGIC)) == 0;
+
+        while (valid && fgets(line, sizeof(line), file) != NULL)
+        {
+            cut_short = strchr(line, '\n') == NULL;
+
+            char *end;
+            long id = strtol(line, &end, 10);
+            if (end != line && *end == '\n' && id >= crawl->first_id && id <= crawl->last_id)
+            {
+                long bit = id - crawl->first_id;
+                crawl->finished[bit / 8] |= (unsigned char)(1u << (bit % 8));
+            }
+        }
+
+        fclose(file);
+    }
+
+    crawl->checkpoint = fopen(path, valid ? "ab" : "wb");
+    if (crawl->checkpoint != NULL && (!valid || cut_short))
+    {
+        fputs(valid ? "-\n" : CRAWL_MAGIC "\n", crawl->checkpoint);
+        fflush(crawl->checkpoint);
+    }
+}
+
+static void crawl_add_albums(Crawl *crawl, int slot, int from)
+{
+    /* Function  : static void crawl_add_albums(Crawl *crawl, int slot, int from)
+     * Input     : crawl - pointer to the Crawl
+     *             slot - slot of the band in crawl->bands
+     *             from - index of the first album of the band to queue
+     * Output    : None
+     * Procedure : This function queues a request for every album page of a band from the given index on, except the albums whose songs are already in the catalog store (unless --refresh was given). They go in front of the queue, in album order, so the bands already started are finished before new ones get going and a checkpoint is written as early as possible.
+     */
+
+    CrawlBand *band = &crawl->bands[slot];
+
+    for (int i = band->albums.count - 1; i >= from; i--)
+    {
+        SongInfoList songs;
+        init_song_list(&songs, &band->arena);
+        crawl->albums++;
+
+        if (store_songs(band->albums.albums[i].url, &songs, NULL, NULL) == 0)
+        {
+            band->songs += songs.count;
+            crawl->songs += songs.count;
+            continue;
+        }
+
+        CrawlTask task = {slot, 0, i, 0};
+        if (crawl_push(crawl, task, 1) == 0)
+        {
+            band->pending++;
+        }
+        else
+        {
+            band->failed = 1;
+        }
+    }
+}
+
+static int crawl_admit(Crawl *crawl)
+{
+    /* Function  : static int crawl_admit(Crawl *crawl)
+     * Input     : crawl - pointer to the Crawl
+     * Output    : Returns 0 if a band was admitted, -1 if there is no free slot or no band left
+     * Procedure : This function starts crawling the next band that isn't in the checkpoint. A discography already in the catalog store only needs its album pages; otherwise its first page is queued. Bands are admitted a few at a time so the memory used stays bounded however long the range is.
+     */
+
+    if (crawl->active_bands == crawl->band_slots)
+    {
+        return -1;
+    }
+
+    while (crawl->next_id <= crawl->last_id)
+    {
+        int id = crawl->next_id++;
+        long bit = (long)id - crawl->first_id;
+
+        if (crawl->finished[bit / 8] & (1u << (bit % 8)))
+        {
+            crawl->bands_skipped++;
+            continue;
+        }
+
+        int slot = 0;
+        while (crawl->bands[slot].id != 0)
+        {
+            slot++;
+        }
+
+        CrawlBand *band = &crawl->bands[slot];
+        memset(band, 0, sizeof(*band));
+        band->id = id;
+        band->next_page = 1;
+        snprintf(band->url, sizeof(band->url), "%s" STORE_BAND_PATH "%d", base_url(), id);
+        arena_init(&band->arena, CRAWL_BAND_ARENA_SIZE);
+        init_album_list(&band->albums, &band->arena);
+        crawl->active_bands++;
+
+        if (store_albums(band->url, &band->albums) == 0)
+        {
+            band->discography = 1;
+            crawl_add_albums(crawl, slot, 0);
+        }
+        else
+        {
+            CrawlTask task = {slot, band->next_page++, 0, 0};
+            if (crawl_push(crawl, task, 0) == 0)
+            {
+                band->pending++;
+            }
+            else
+            {
+                band->failed = 1;
+            }
+        }
+
+        if (band->pending == 0)
+        {
+            crawl_release_band(crawl, slot);
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+static void crawl_release_band(Crawl *crawl, int slot)
+{
+    /* Function  : static void crawl_release_band(Crawl *crawl, int slot)
+     * Input     : crawl - pointer to the Crawl
+     *             slot - slot of the band in crawl->bands
+     * Output    : None
+     * Procedure : This function is called once a band has no task left. A complete band is written to the checkpoint (and flushed, so it survives an interrupted crawl); a band with a page that failed isn't, so the next run tries it again. The slot and the memory of the band are released.
+     */
+
+    CrawlBand *band = &crawl->bands[slot];
+
+    if (band->failed || !band->discography)
+    {
+        crawl->bands_failed++;
+        fprintf(stderr, "[!] band-%d: gave up, it will be retried on the next run\n", band->id);
+    }
+    else
+    {
+        crawl->bands_done++;
+        if (band->albums.count > 0)
+        {
+            printf("[*] band-%d: %d albums, %d songs\n", band->id, band->albums.count, band->songs);
+        }
+
+        if (crawl->checkpoint != NULL)
+        {
+            fprintf(crawl->checkpoint, "%d\n", band->id);
+            fflush(crawl->checkpoint);
+        }
+    }
+
+    arena_free(&band->arena);
+    band->id = 0;
+    crawl->active_bands--;
+}
+
+static int crawl_start(Crawl *crawl, CrawlWorker *worker, CrawlTask task)
+{
+    /* Function  : static int crawl_start(Crawl *crawl, CrawlWorker *worker, CrawlTask task)
+     * Input     : crawl - pointer to the Crawl
+     *             worker - pointer to an idle CrawlWorker
+     *             task - task to run
+     * Output    : Returns 0 if the request was added to the loop, -1 otherwise
+     * Procedure : This function prepares an easy handle that fetches the page of a task into memory and adds it to the event loop of the crawl, which hands it to crawl_finish once it is over. The handle joins the session's connection pool. Pages are fetched without the page cache: the crawl needs the status and Retry-After of every answer to pace itself.
+     */
+
+    CrawlBand *band = &crawl->bands[task.band];
+    char url[MAX_URL_LENGTH];
+
+    if (task.page > 0)
+    {
+        snprintf(url, sizeof(url), "%s/%d", band->url, task.page);
+    }
+    else
+    {
+        snprintf(url, sizeof(url), "%s", band->albums.albums[task.album].url);
+    }
+
+    worker->crawl = crawl;
+    worker->task = task;
+    worker->host = crawl_host(crawl, url);
+    init_memory_struct(&worker->chunk);
+    worker->curl = curl_easy_init();
+
+    if (worker->curl == NULL || worker->chunk.memory == NULL)
+    {
+        if (worker->curl != NULL)
+        {
+            curl_easy_cleanup(worker->curl);
+            worker->curl = NULL;
+        }
+        free(worker->chunk.memory);
+        worker->chunk.memory = NULL;
+        return -1;
+    }
+
+    session_attach(worker->curl);
+    curl_easy_setopt(worker->curl, CURLOPT_URL, url);
+    curl_easy_setopt(worker->curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+    curl_easy_setopt(worker->curl, CURLOPT_WRITEDATA, (void *)&worker->chunk);
+    curl_easy_setopt(worker->curl, CURLOPT_ACCEPT_ENCODING, ""); // HTML compresses well
+
+    if (loop_add(&crawl->loop, worker->curl, crawl_finish, worker) != 0)
+    {
+        curl_easy_cleanup(worker->curl);
+        worker->curl = NULL;
+        free(worker->chunk.memory);
+        worker->chunk.memory = NULL;
+        return -1;
+    }
+
+    crawl->hosts[worker->host].in_flight++;
+    crawl->in_flight++;
+    crawl->requests++;
+    return 0;
+}
+
+static void crawl_finish(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void crawl_finish(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - pointer to the easy handle of the request (unused, it is in the worker)
+     *             result - result of the transfer
+     *             userdata - pointer to the CrawlWorker whose request is done
+     * Output    : None
+     * Procedure : This function handles a finished request and releases its easy handle. A page of the discography is parsed with parse_albums: if it has albums their pages and the next page of the discography are queued, otherwise (or on 404) the discography is complete and added to the catalog store. An album page is parsed with parse_songs and its songs are added to the store. Transfer errors and 5xx answers are retried up to CRAWL_RETRIES times, holding every request back one more second after each attempt; a 429 or 503 holds them back for the Retry-After the server asked for instead (CRAWL_BACKOFF seconds if it didn't say).
+     */
+
+    (void)curl;
+
+    CrawlWorker *worker = (CrawlWorker *)userdata;
+    Crawl *crawl = worker->crawl;
+    CrawlTask task = worker->task;
+    CrawlBand *band = &crawl->bands[task.band];
+    long status = 0;
+    curl_off_t retry_after = 0;
+    char *url = NULL;
+
+    curl_easy_getinfo(worker->curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(worker->curl, CURLINFO_RETRY_AFTER, &retry_after);
+    curl_easy_getinfo(worker->curl, CURLINFO_EFFECTIVE_URL, &url);
+    session_record_timings(worker->curl, url != NULL ? url : band->url);
+    session_record_page_size(worker->curl, worker->chunk.size);
+
+    curl_easy_cleanup(worker->curl);
+    worker->curl = NULL;
+    crawl->hosts[worker->host].in_flight--;
+    crawl->in_flight--;
+
+    if (status == 429 || status == 503)
+    {
+        double backoff = retry_after > 0 ? (double)retry_after : CRAWL_BACKOFF;
+        crawl->paused_until = rn_clock() + backoff;
+        crawl->throttled++;
+    }
+
+    if (result != CURLE_OK || status == 429 || status >= 500)
+    {
+        task.attempts++;
+        double resume = rn_clock() + task.attempts; // Back off a little more after each failure
+        if (crawl->paused_until < resume)
+        {
+            crawl->paused_until = resume;
+        }
+        if (task.attempts < CRAWL_RETRIES && crawl_push(crawl, task, 0) == 0)
+        {
+            crawl->retries++;
+        }
+        else
+        {
+            band->failed = 1;
+            band->pending--;
+        }
+    }
+    else if (task.page > 0)
+    {
+        int found = 0;
+        int from = band->albums.count;
+
+        if (status == 200)
+        {
+            found = parse_albums(worker->chunk.memory, worker->chunk.size, &band->albums);
+        }
+
+        if (found > 0)
+        {
+            crawl_add_albums(crawl, task.band, from);
+            CrawlTask next = {task.band, band->next_page++, 0, 0};
+            if (crawl_push(crawl, next, 1) == 0)
+            {
+                band->pending++;
+            }
+            else
+            {
+                band->failed = 1;
+            }
+        }
+        else if (status == 200 || status == 404)
+        {
+            // Past the end of the discography
+            band->discography = 1;
+            if (band->albums.count > 0)
+            {
+                store_put_albums(band->url, &band->albums);
+            }
+        }
+        else
+        {
+            band->failed = 1;
+        }
+        band->pending--;
+    }
+    else
+    {
+        if (status == 200)
+        {
+            SongInfoList songs;
+            init_song_list(&songs, &band->arena);
+            parse_songs(worker->chunk.memory, worker->chunk.size, &songs);
+
+            if (songs.count > 0)
+            {
+                store_put_songs(band->albums.albums[task.album].url, &songs);
+                band->songs += songs.count;
+                crawl->songs += songs.count;
+            }
+        }
+        else if (status != 404)
+        {
+            band->failed = 1;
+        }
+        band->pending--;
+    }
+
+    free(worker->chunk.memory);
+    worker->chunk.memory = NULL;
+    worker->chunk.capacity = 0;
+
+    if (band->pending == 0)
+    {
+        crawl_release_band(crawl, task.band);
+    }
+}
+
+RN_API int crawl_catalog(int first_id, int last_id, const CrawlOptions *options)
+{
+    /*
+     * Function  : int crawl_catalog(int first_id, int last_id, const CrawlOptions *options)
+     * Input     : first_id - id of the first band to crawl
+     *             last_id - id of the last band to crawl
+     *             options - pointer to the limits of the crawl
+     * Output    : Returns the number of bands that couldn't be crawled, or -1 if the crawl couldn't start
+     * Procedure : This function builds the local catalog store (see rocknation_store.h) for a range of band ids by walking each band's discography pages and then its album pages, reusing the extraction of get_albums and get_songs. Requests run on an event loop (see rocknation_loop.h) with at most options->jobs in flight, at most options->per_host of them to the same host, and are started no faster than a token bucket of options->rate per second allows. Only a few bands are in progress at a time; each one is written to a checkpoint file next to the page cache once it is complete, and bands found in the checkpoint are skipped, so an interrupted crawl is resumed by running the same command again. Whatever is already in the store isn't fetched again, unless --refresh was given.
+     */
+
+    if (first_id < 1 || last_id < first_id)
+    {
+        return -1;
+    }
+
+    Crawl crawl;
+    memset(&crawl, 0, sizeof(crawl));
+    crawl.options = *options;
+    crawl.options.jobs = options->jobs < 1 ? 1 : options->jobs > CRAWL_MAX_WORKERS ? CRAWL_MAX_WORKERS : options->jobs;
+    crawl.options.per_host = options->per_host < 1 ? CRAWL_PER_HOST : options->per_host;
+    crawl.first_id = first_id;
+    crawl.last_id = last_id;
+    crawl.next_id = first_id;
+    crawl.band_slots = crawl.options.jobs * 2 + 2;
+
+    size_t range = (size_t)last_id - (size_t)first_id + 1;
+    crawl.finished = rn_calloc(range / 8 + 1, 1);
+    crawl.bands = rn_calloc((size_t)crawl.band_slots, sizeof(CrawlBand));
+    int looping = loop_init(&crawl.loop) == 0;
+
+    if (crawl.finished == NULL || crawl.bands == NULL || !looping || get_session() == NULL)
+    {
+        free(crawl.finished);
+        free(crawl.bands);
+        if (looping)
+        {
+            loop_free(&crawl.loop);
+        }
+        return -1;
+    }
+
+    curl_multi_setopt(crawl.loop.multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)crawl.options.per_host);
+    token_bucket_init(&crawl.bucket, crawl.options.rate, crawl.options.burst);
+
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", cache_dir(), CRAWL_CHECKPOINT_FILE);
+    crawl_load_checkpoint(&crawl, path);
+
+    double started = rn_clock();
+
+    while (1)
+    {
+        // Admit bands until there is enough work queued to keep every worker busy
+        while (crawl.queue_count < crawl.options.jobs && crawl_admit(&crawl) == 0)
+        {
+        }
+
+        // Start waiting tasks on idle workers, within the host and rate limits
+        double wait = 0;
+        int skipped = 0;
+        for (int i = 0; i < crawl.options.jobs && crawl.queue_count > 0 && skipped < crawl.queue_count; i++)
+        {
+            CrawlWorker *worker = &crawl.workers[i];
+            if (worker->curl != NULL)
+            {
+                continue;
+            }
+
+            double now = rn_clock();
+            if (now < crawl.paused_until)
+            {
+                wait = crawl.paused_until - now;
+                break;
+            }
+
+            CrawlTask task;
+            crawl_pop(&crawl, &task);
+            CrawlBand *band = &crawl.bands[task.band];
+            const char *url = task.page > 0 ? band->url : band->albums.albums[task.album].url;
+
+            if (crawl.hosts[crawl_host(&crawl, url)].in_flight >= crawl.options.per_host)
+            {
+                // Its host is busy: put it at the back and look at the next one
+                crawl_push(&crawl, task, 0);
+                skipped++;
+                i--;
+                continue;
+            }
+
+            wait = token_bucket_take(&crawl.bucket, now);
+            if (wait > 0)
+            {
+                // Still first in line once the bucket has a token again
+                crawl_push(&crawl, task, 1);
+                break;
+            }
+
+            if (crawl_start(&crawl, worker, task) != 0)
+            {
+                band->failed = 1;
+                band->pending--;
+                if (band->pending == 0)
+                {
+                    crawl_release_band(&crawl, task.band);
+                }
+            }
+        }
+
+        if (crawl.in_flight == 0 && crawl.queue_count == 0 && crawl.active_bands == 0 && crawl.next_id > crawl.last_id)
+        {
+            break;
+        }
+
+        // Sleep until a transfer needs attention or a token is available, whichever comes first;
+        // finished requests are settled by crawl_finish from in here
+        int timeout = 1000;
+        if (wait > 0 && wait * 1000 < timeout)
+        {
+            timeout = (int)(wait * 1000) + 1;
+        }
+        loop_run_once(&crawl.loop, timeout);
+    }
+
+    double elapsed = rn_clock() - started;
+    printf("Crawl: %ld bands (%ld already done, %ld failed), %ld albums, %ld songs, %ld requests (%ld retried, %ld throttled) in %.1f s\n",
+           crawl.bands_done, crawl.bands_skipped, crawl.bands_failed, crawl.albums, crawl.songs,
+           crawl.requests, crawl.retries, crawl.throttled, elapsed);
+
+    if (crawl.checkpoint != NULL)
+    {
+        fclose(crawl.checkpoint);
+    }
+    loop_free(&crawl.loop);
+    free(crawl.queue);
+    free(crawl.bands);
+    free(crawl.finished);
+
+    return (int)crawl.bands_failed;
+}
@@ -2,13 +2,73 @@
 #pragma once
 #include "rocknation_types.h"
 #include "rocknation_utils.h"
+#include "rocknation_session.h"
+#include "rocknation_regex.h"
+#include "rocknation_store.h"
+#include "rocknation_names.h"
+#include "rocknation_pool.h"
+#include "rocknation_disk.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+    BandInfoList *list;
+    BandCallback callback; // Called with every band as soon as it is parsed, may be NULL
+    void *userdata;
+} BandSink;
+
+typedef struct
+{
+    SongInfoList *list;
+    SongCallback callback; // Called with every song as soon as it is parsed, may be NULL
+    void *userdata;
+} SongSink;
+
+typedef struct FileWrite
+{
+    DiskRequest request; // Write of the buffer, or preallocation of the response when buffer is NULL
+    FileStruct *out;
+    char *buffer;        // Full staging buffer, given back to out once written
+    struct FileWrite *next; // In the backlog of out
+} FileWrite;
 
 static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp);
-void search_band(const char *search_text, BandInfoList *band_list);
-void get_albums(char *band_url, AlbumInfoList *album_list);
-void get_albums_by_name(char *band_name, AlbumInfoList *album_list);
-void get_songs(const char *album_url, SongInfoList *song_list);
-int download_file(const char *url, char *output_file);
+static size_t WriteFileCallback(void *contents, size_t size, size_t nmemb, void *userp);
+static int flush_file_buffer(FileStruct *out);
+static void file_request_done(long result, void *userdata);
+static void submit_file_request(FileStruct *out, FileWrite *request);
+static void preallocate_file_struct(FileStruct *out);
+static int queue_file_buffer(FileStruct *out);
+static int drain_file_buffers(FileStruct *out);
+static void attach_disk_writer(FileStruct *out, struct DiskWriter *disk);
+static size_t ContentRangeHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata);
+static size_t DownloadHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata);
+static int open_file_struct(FileStruct *out, const char *output_file);
+static int truncate_file_struct(FileStruct *out);
+static void release_file_struct(FileStruct *out);
+static void close_file_struct(FileStruct *out, int complete);
+static void setup_resume(CURL *curl, FileStruct *out);
+static int check_resumed_transfer(CURL *curl, CURLcode res, FileStruct *out);
+static int add_band_match(const char *html, const PCRE2_SIZE *ovector, void *userdata);
+static int add_album_match(const char *html, const PCRE2_SIZE *ovector, void *userdata);
+static int add_song_match(const char *html, const PCRE2_SIZE *ovector, void *userdata);
+static int add_song_ref_match(const char *html, const PCRE2_SIZE *ovector, void *userdata);
+RN_API int parse_bands(const char *html, size_t size, BandInfoList *band_list);
+RN_API void search_band(const char *search_text, BandInfoList *band_list);
+RN_API void search_band_streaming(const char *search_text, BandInfoList *band_list, BandCallback on_band, void *userdata);
+RN_API int parse_albums(const char *html, size_t size, AlbumInfoList *album_list);
+RN_API int get_albums(const char *band_url, AlbumInfoList *album_list);
+RN_API void get_albums_by_name(const char *band_name, AlbumInfoList *album_list);
+RN_API int parse_songs(const char *html, size_t size, SongInfoList *song_list);
+RN_API void get_songs(const char *album_url, SongInfoList *song_list);
+RN_API void get_songs_streaming(const char *album_url, SongInfoList *song_list, SongCallback on_song, void *userdata);
+RN_API int get_song_page(const char *album_url, SongPage *song_page);
+RN_API void free_song_page(SongPage *song_page);
+RN_API int download_file(const char *url, const char *output_file);
 
 static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp)
 {
@@ -18,23 +78,33 @@ static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, voi
      *             nmemb - number of data elements
      *             userp - pointer to a MemoryStruct structure
      * Output    : Returns the total size of the received data (in bytes)
-     * Procedure : This function is a callback used with libcurl to handle the received data. It is designed to be used as the write callback for CURLOPT_WRITEFUNCTION option. The function reallocates memory to store the received data and updates the MemoryStruct structure accordingly. If a memory allocation error occurs, an error message is printed to stderr.
+     * Procedure : This function is a callback used with libcurl to handle the received data. It is designed to be used as the write callback for CURLOPT_WRITEFUNCTION option. The function appends the received data to the buffer, doubling its capacity when it is full, and updates the MemoryStruct structure accordingly. If a memory allocation error occurs, an error message is printed to stderr.
      */
 
     size_t real_size = size * nmemb;
     MemoryStruct *mem = (MemoryStruct *)userp;
 
-    // Reallocate memory to accommodate new data
-    char *ptr = realloc(mem->memory, mem->size + real_size + 1);
-    if (ptr == NULL)
+    // Grow the buffer geometrically, so a page costs a handful of reallocations however it is chunked
+    if (mem->size + real_size + 1 > mem->capacity)
     {
-        // Error: Memory allocation failure
-        fprintf(stderr, "Error de asignación de memoria\n");
-        return 0;
-    }
+        size_t capacity = mem->capacity > 0 ? mem->capacity : PAGE_BUFFER_SIZE;
+        while (capacity < mem->size + real_size + 1)
+        {
+            capacity *= 2;
+        }
 
-    // Update MemoryStruct with the new memory block
-    mem->memory = ptr;
+        char *ptr = rn_realloc(mem->memory, capacity);
+        if (ptr == NULL)
+        {
+            // Error: Memory allocation failure
+            fprintf(stderr, "Error de asignación de memoria\n");
+            return 0;
+        }
+
+        // Update MemoryStruct with the new memory block
+        mem->memory = ptr;
+        mem->capacity = capacity;
+    }
 
     // Copy the received data to the allocated memory
     memcpy(&(mem->memory[mem->size]), contents, real_size);
@@ -49,362 +119,1155 @@ static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, voi
     return real_size;
 }
 
-void search_band(const char *search_text, BandInfoList *band_list)
+static int flush_file_buffer(FileStruct *out)
+{
+    /* Function  : static int flush_file_buffer(FileStruct *out)
+     * Input     : out - pointer to a FileStruct structure
+     * Output    : Returns 0 on success, -1 if the staged data couldn't be written
+     * Procedure : This function writes whatever is staged in the fixed-size buffer of the FileStruct to its file and empties the buffer. On a short write the error flag of the FileStruct is set. When the disk writer writes the buffers of the file, the staged data is handed to it too and the function returns once every buffer is written.
+     */
+
+    if (out->disk != NULL)
+    {
+        if (out->used > 0 && queue_file_buffer(out) != 0)
+        {
+            drain_file_buffers(out);
+            return -1;
+        }
+        return drain_file_buffers(out);
+    }
+
+    if (out->used == 0)
+    {
+        return 0;
+    }
+
+    size_t bytes_written = fwrite(out->buffer, 1, out->used, out->file);
+    out->total += bytes_written;
+
+    if (bytes_written != out->used)
+    {
+        out->error = 1;
+        return -1;
+    }
+
+    out->used = 0;
+    return 0;
+}
+
+static void file_request_done(long result, void *userdata)
+{
+    /* Function  : static void file_request_done(long result, void *userdata)
+     * Input     : result - bytes written, or a negative errno if the request failed
+     *             userdata - pointer to the FileWrite of the request, released here
+     * Output    : None
+     * Procedure : This function is the completion callback of the writes and the preallocation of a download, called by the disk writer. A written buffer goes back to the spare buffers of the FileStruct and the thread receiving the data is woken if it waits for one; a short or failed write sets the error flag. A failed preallocation is no error, the file just isn't reserved. With the pool, the next request of the backlog is then handed to the writer, so the file is written in order; after an error the backlog is dropped instead, as writing past a failed write would leave a hole that a resumed download takes for data.
+     */
+
+    FileWrite *write = (FileWrite *)userdata;
+    FileStruct *out = write->out;
+    FileWrite *next;
+
+    rn_mutex_lock(&out->lock);
+    if (write->buffer != NULL)
+    {
+        out->total += result > 0 ? (size_t)result : 0;
+        if (result != (long)write->request.length)
+        {
+            // Also the cancel flag of the requests of the file the ring still holds, read from its thread
+            RN_ATOMIC_STORE(out->error, 1);
+        }
+        out->spare[out->spare_count++] = write->buffer;
+    }
+    out->pending--;
+
+    while ((next = out->backlog) != NULL && out->error)
+    {
+        out->backlog = next->next;
+        if (next->buffer != NULL)
+        {
+            out->spare[out->spare_count++] = next->buffer;
+        }
+        out->pending--;
+        free(next);
+    }
+    if (next != NULL)
+    {
+        out->backlog = next->next;
+    }
+    if (out->backlog == NULL)
+    {
+        out->backlog_tail = NULL;
+    }
+    out->writing = next != NULL;
+    struct DiskWriter *disk = out->disk;
+
+    rn_cond_broadcast(&out->written);
+    rn_mutex_unlock(&out->lock);
+
+    free(write);
+
+    // Still counted in pending, so out can't be released before it completes
+    if (next != NULL)
+    {
+        disk_submit(disk, &next->request);
+    }
+}
+
+static void submit_file_request(FileStruct *out, FileWrite *request)
+{
+    /* Function  : static void submit_file_request(FileStruct *out, FileWrite *request)
+     * Input     : out - pointer to a FileStruct written by the disk writer
+     *             request - pointer to a write or preallocation of the file, ready to be queued
+     * Output    : None
+     * Procedure : This function hands a request of the file to the disk writer. The ring carries out the requests of a file in order, chaining those queued together (see disk_ring_main), and skips them once the error flag of the file is set, so nothing is ever written past a failed write. Pool tasks run side by side, so with the pool the request is appended to the backlog of the file while an earlier one is carried out (see file_request_done) and only one request per file is in flight. Either way the part file grows in order and its size after a crash is still the number of bytes received before it.
+     */
+
+    request->next = NULL;
+    request->request.cancel = &out->error;
+
+    rn_mutex_lock(&out->lock);
+    out->pending++;
+    int busy = out->writing && !out->disk->ring;
+    if (busy)
+    {
+        if (out->backlog_tail != NULL)
+        {
+            out->backlog_tail->next = request;
+        }
+        else
+        {
+            out->backlog = request;
+        }
+        out->backlog_tail = request;
+    }
+    out->writing = 1;
+    rn_mutex_unlock(&out->lock);
+
+    if (!busy)
+    {
+        disk_submit(out->disk, &request->request);
+    }
+}
+
+static void preallocate_file_struct(FileStruct *out)
+{
+    /* Function  : static void preallocate_file_struct(FileStruct *out)
+     * Input     : out - pointer to a FileStruct written by the disk writer, about to hand it its first buffer
+     * Output    : None
+     * Procedure : This function asks the disk writer to reserve the space of the response (its Content-Length, from where the part file ends) before the first buffer is written, so the file system can lay the file out in one piece. The size of the file is kept, so an interrupted download is still resumed from the bytes actually written. Small, unknown or implausibly large sizes are not reserved.
+     */
+
+    out->allocated = 1;
+
+    if (out->expected_size <= (curl_off_t)out->used || out->expected_size > DISK_MAX_PREALLOCATION)
+    {
+        return;
+    }
+
+    FileWrite *allocate = rn_calloc(1, sizeof(FileWrite));
+    if (allocate == NULL)
+    {
+        return;
+    }
+
+    allocate->out = out;
+    allocate->request.operation = DISK_ALLOCATE;
+    allocate->request.fd = out->fd;
+    allocate->request.offset = out->resume_from + out->queued;
+    allocate->request.length = (size_t)out->expected_size;
+    allocate->request.done = file_request_done;
+    allocate->request.userdata = allocate;
+
+    submit_file_request(out, allocate);
+}
+
+static int queue_file_buffer(FileStruct *out)
+{
+    /* Function  : static int queue_file_buffer(FileStruct *out)
+     * Input     : out - pointer to a FileStruct structure with data staged
+     * Output    : Returns 0 on success, -1 if the data couldn't be written
+     * Procedure : This function gets the staged data of a full buffer on its way to disk. Without the disk writer it is written at once (see flush_file_buffer). With it, the buffer is handed to the writer (one request of the file at a time, see submit_file_request) and staging continues in a spare buffer; only when all FILE_WRITE_BUFFERS buffers are waiting to be written does the caller wait, which bounds the memory of a download. The first buffer of a response is preceded by the preallocation of the file. A failed earlier write is reported here, so the transfer stops.
+     */
+
+    if (out->disk == NULL)
+    {
+        return flush_file_buffer(out);
+    }
+
+    if (!out->allocated)
+    {
+        preallocate_file_struct(out);
+    }
+
+    FileWrite *write = rn_calloc(1, sizeof(FileWrite));
+    if (write == NULL)
+    {
+        return -1;
+    }
+
+    rn_mutex_lock(&out->lock);
+    int hurried = out->spare_count == 0 && !out->error;
+    if (hurried)
+    {
+        rn_mutex_unlock(&out->lock);
+        disk_hurry(out->disk);
+        rn_mutex_lock(&out->lock);
+    }
+    while (out->spare_count == 0 && !out->error)
+    {
+        rn_cond_wait(&out->written, &out->lock);
+    }
+    int error = out->error;
+    char *spare = error ? NULL : out->spare[--out->spare_count];
+    rn_mutex_unlock(&out->lock);
+
+    if (hurried)
+    {
+        disk_hurry_done(out->disk);
+    }
+    if (error)
+    {
+        free(write);
+        return -1;
+    }
+
+    write->out = out;
+    write->buffer = out->buffer;
+    write->request.operation = DISK_WRITE;
+    write->request.fd = out->fd;
+    write->request.buffer = out->buffer;
+    write->request.length = out->used;
+    write->request.offset = out->resume_from + out->queued;
+    write->request.done = file_request_done;
+    write->request.userdata = write;
+
+    out->queued += out->used;
+    out->buffer = spare;
+    out->used = 0;
+
+    submit_file_request(out, write);
+
+    return 0;
+}
+
+static int drain_file_buffers(FileStruct *out)
+{
+    /* Function  : static int drain_file_buffers(FileStruct *out)
+     * Input     : out - pointer to a FileStruct structure written by the disk writer
+     * Output    : Returns 0 if every buffer handed to the writer was written, -1 otherwise
+     * Procedure : This function waits until the disk writer has completed every request of the download, after which total and error can be read without the lock.
+     */
+
+    rn_mutex_lock(&out->lock);
+    int hurried = out->pending > 0;
+    if (hurried)
+    {
+        rn_mutex_unlock(&out->lock);
+        disk_hurry(out->disk);
+        rn_mutex_lock(&out->lock);
+    }
+    while (out->pending > 0)
+    {
+        rn_cond_wait(&out->written, &out->lock);
+    }
+    int error = out->error;
+    rn_mutex_unlock(&out->lock);
+
+    if (hurried)
+    {
+        disk_hurry_done(out->disk);
+    }
+
+    return error ? -1 : 0;
+}
+
+static void attach_disk_writer(FileStruct *out, struct DiskWriter *disk)
+{
+    /* Function  : static void attach_disk_writer(FileStruct *out, struct DiskWriter *disk)
+     * Input     : out - pointer to a FileStruct opened with open_file_struct, nothing received yet
+     *             disk - pointer to the writer writing the buffers, or NULL
+     * Output    : None
+     * Procedure : This function makes the disk writer write the full buffers of a download (see rocknation_disk.h), so the thread receiving the data of many transfers only waits for the disk when every buffer of a download is queued (see queue_file_buffer) and for the last writes of a finished one (see flush_file_buffer). It opens a second descriptor on the part file for positioned writes (the stream is opened for appending, which ignores positions) and allocates the spare buffers. Where that isn't possible (no writer, no pwrite on Windows, out of memory) the buffers keep being written inline.
+     */
+
+#ifndef _WIN32
+    if (disk == NULL || out->file == NULL)
+    {
+        return;
+    }
+
+    out->fd = open(out->part_file, O_WRONLY);
+    if (out->fd < 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < FILE_WRITE_BUFFERS - 1; i++)
+    {
+        char *buffer = rn_malloc(DOWNLOAD_BUFFER_SIZE);
+        if (buffer == NULL)
+        {
+            break;
+        }
+        out->spare[out->spare_count++] = buffer;
+    }
+
+    if (out->spare_count == 0)
+    {
+        close(out->fd);
+        out->fd = -1;
+        return;
+    }
+
+    rn_mutex_init(&out->lock);
+    rn_cond_init(&out->written);
+    out->disk = disk;
+#else
+    (void)out;
+    (void)disk;
+#endif
+}
+
+static size_t WriteFileCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    /* Function  : static size_t WriteFileCallback(void *contents, size_t size, size_t nmemb, void *userp)
+     * Input     : contents - pointer to the received data
+     *             size - size of each data element
+     *             nmemb - number of data elements
+     *             userp - pointer to a FileStruct structure
+     * Output    : Returns the total size of the received data (in bytes), or 0 to abort the transfer on a write error
+     * Procedure : This function is a callback used with libcurl to stream the received data straight to disk. Data is staged in the fixed-size buffer of the FileStruct and flushed to the file whenever it fills up (by the disk writer if one is attached, see queue_file_buffer), so memory usage stays constant no matter how large the downloaded file is.
+     */
+
+    size_t real_size = size * nmemb;
+    FileStruct *out = (FileStruct *)userp;
+    const char *data = (const char *)contents;
+    size_t remaining = real_size;
+
+    while (remaining > 0)
+    {
+        // Copy as much as fits in the staging buffer
+        size_t room = out->capacity - out->used;
+        size_t n = remaining < room ? remaining : room;
+
+        memcpy(out->buffer + out->used, data, n);
+        out->used += n;
+        data += n;
+        remaining -= n;
+
+        // Buffer is full, write it out before taking more data
+        if (out->used == out->capacity && queue_file_buffer(out) != 0)
+        {
+            fprintf(stderr, "Error writing to file\n");
+            return 0;
+        }
+    }
+
+    return real_size;
+}
+
+static size_t ContentRangeHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    /* Function  : static size_t ContentRangeHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+     * Input     : buffer - pointer to one response header line (not null-terminated)
+     *             size, nitems - size of the header line
+     *             userdata - pointer to a curl_off_t receiving the complete size of the resource
+     * Output    : Returns the size of the header line
+     * Procedure : This function is used as CURLOPT_HEADERFUNCTION for ranged requests. It looks for a "Content-Range: bytes a-b/total" header (the range is a lone asterisk on a 416 answer) and stores the total size of the resource.
+     */
+
+    size_t real_size = size * nitems;
+    curl_off_t *total = (curl_off_t *)userdata;
+    char line[256];
+
+    if (real_size < sizeof(line) && real_size > 14)
+    {
+        memcpy(line, buffer, real_size);
+        line[real_size] = '\0';
+
+        // Header names are case-insensitive
+        for (int i = 0; i < 14; i++)
+        {
+            line[i] = tolower((unsigned char)line[i]);
+        }
+
+        if (strncmp(line, "content-range:", 14) != 0)
+        {
+            return real_size;
+        }
+
+        char *slash = strchr(line, '/');
+        if (slash != NULL && isdigit((unsigned char)slash[1]))
+        {
+            *total = (curl_off_t)strtoll(slash + 1, NULL, 10);
+        }
+    }
+
+    return real_size;
+}
+
+static size_t DownloadHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    /* Function  : static size_t DownloadHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+     * Input     : buffer - pointer to one response header line (not null-terminated)
+     *             size, nitems - size of the header line
+     *             userdata - pointer to the FileStruct of the download
+     * Output    : Returns the size of the header line
+     * Procedure : This function is used as CURLOPT_HEADERFUNCTION for downloads. Besides the complete size from Content-Range (see ContentRangeHeaderCallback), it keeps the Content-Length of the response, which the file is preallocated with; the status line of every response (a redirect comes first) forgets the length of the previous one.
+     */
+
+    size_t real_size = size * nitems;
+    FileStruct *out = (FileStruct *)userdata;
+    char line[64];
+
+    if (real_size >= 5 && strncmp(buffer, "HTTP/", 5) == 0)
+    {
+        out->expected_size = -1;
+    }
+    else if (real_size < sizeof(line) && real_size > 15)
+    {
+        memcpy(line, buffer, real_size);
+        line[real_size] = '\0';
+
+        // Header names are case-insensitive
+        for (int i = 0; i < 15; i++)
+        {
+            line[i] = tolower((unsigned char)line[i]);
+        }
+
+        if (strncmp(line, "content-length:", 15) == 0)
+        {
+            out->expected_size = (curl_off_t)strtoll(line + 15, NULL, 10);
+        }
+    }
+
+    return ContentRangeHeaderCallback(buffer, size, nitems, &out->remote_size);
+}
+
+static int open_file_struct(FileStruct *out, const char *output_file)
+{
+    /* Function  : static int open_file_struct(FileStruct *out, const char *output_file)
+     * Input     : out - pointer to the FileStruct structure to initialize
+     *             output_file - pointer to the name of the file to download to
+     * Output    : Returns 0 on success, -1 if the file or the staging buffer couldn't be set up
+     * Procedure : This function opens "<output_file>.part" for appending and allocates the fixed-size staging buffer used by WriteFileCallback. If the part file is left over from an interrupted download, resume_from is set to its size so the transfer can continue where it stopped. The FileStruct must be released with close_file_struct even when this function fails.
+     */
+
+    out->buffer = rn_malloc(DOWNLOAD_BUFFER_SIZE);
+    out->capacity = DOWNLOAD_BUFFER_SIZE;
+    out->used = 0;
+    out->total = 0;
+    out->error = 0;
+    out->output_file = output_file;
+    out->resume_from = 0;
+    out->remote_size = -1;
+    out->expected_size = -1;
+    out->file = NULL;
+    out->disk = NULL;
+    out->fd = -1;
+    out->queued = 0;
+    out->allocated = 0;
+    out->spare_count = 0;
+    out->pending = 0;
+    out->writing = 0;
+    out->backlog = NULL;
+    out->backlog_tail = NULL;
+    out->part_file = rn_malloc(strlen(output_file) + sizeof(".part"));
+
+    if (out->part_file == NULL || out->buffer == NULL)
+    {
+        return -1;
+    }
+
+    sprintf(out->part_file, "%s.part", output_file);
+    out->file = fopen(out->part_file, "ab");
+
+    if (out->file == NULL)
+    {
+        return -1;
+    }
+
+    // Whatever an earlier attempt left behind doesn't have to be downloaded again
+    fseek(out->file, 0, SEEK_END);
+    long existing = ftell(out->file);
+    out->resume_from = existing > 0 ? (curl_off_t)existing : 0;
+
+    return 0;
+}
+
+static int truncate_file_struct(FileStruct *out)
+{
+    /* Function  : static int truncate_file_struct(FileStruct *out)
+     * Input     : out - pointer to an open FileStruct structure
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function throws away the contents of the part file so the download can start over from the first byte. It is used when the server doesn't honour the Range request of a resumed download. Requests the disk writer is still carrying out are waited for first, and the new response gets preallocated again.
+     */
+
+    if (out->disk != NULL)
+    {
+        drain_file_buffers(out);
+        out->queued = 0;
+        out->allocated = 0;
+    }
+
+    out->used = 0;
+    out->total = 0;
+    RN_ATOMIC_STORE(out->error, 0);
+    out->resume_from = 0;
+    out->remote_size = -1;
+
+    out->file = freopen(out->part_file, "wb", out->file);
+    return out->file != NULL ? 0 : -1;
+}
+
+static void release_file_struct(FileStruct *out)
+{
+    /* Function  : static void release_file_struct(FileStruct *out)
+     * Input     : out - pointer to a FileStruct whose part file is closed or handed over
+     * Output    : None
+     * Procedure : This function frees the buffers of the FileStruct and, if the disk writer wrote them, closes the descriptor of its positioned writes (unless a commit took it over) and destroys its lock.
+     */
+
+    if (out->disk != NULL)
+    {
+#ifndef _WIN32
+        if (out->fd >= 0)
+        {
+            close(out->fd);
+        }
+#endif
+        out->fd = -1;
+        while (out->spare_count > 0)
+        {
+            free(out->spare[--out->spare_count]);
+        }
+        rn_cond_destroy(&out->written);
+        rn_mutex_destroy(&out->lock);
+        out->disk = NULL;
+    }
+
+    free(out->part_file);
+    out->part_file = NULL;
+    free(out->buffer);
+    out->buffer = NULL;
+}
+
+static void close_file_struct(FileStruct *out, int complete)
+{
+    /* Function  : static void close_file_struct(FileStruct *out, int complete)
+     * Input     : out - pointer to the FileStruct structure to release
+     *             complete - non-zero if the whole file was downloaded
+     * Output    : None
+     * Procedure : This function writes out whatever is still staged in the buffer, closes the part file and frees the FileStruct. A complete download is flushed to disk with fsync and renamed from "<output_file>.part" to its final name, so a file with the final name is always complete, even after a crash; an incomplete one is kept as it is so the next attempt can resume it, unless nothing was received at all. commit_file_struct (see rocknation_loop.h) does the same for a complete download without waiting for the fsync and rename.
+     */
+
+    if (out->file != NULL)
+    {
+        flush_file_buffer(out);
+
+#ifndef _WIN32
+        if (complete && !out->error && (fflush(out->file) != 0 || fsync(fileno(out->file)) != 0))
+        {
+            out->error = 1;
+        }
+#endif
+
+        if (fclose(out->file) != 0)
+        {
+            out->error = 1;
+        }
+        out->file = NULL;
+
+        if (!complete && out->resume_from == 0 && out->total == 0)
+        {
+            // Nothing was received, don't leave an empty part file behind
+            remove(out->part_file);
+        }
+        else if (complete && !out->error)
+        {
+#ifdef _WIN32
+            remove(out->output_file); // rename() doesn't replace existing files on Windows
+#endif
+            if (rename(out->part_file, out->output_file) != 0)
+            {
+                out->error = 1;
+            }
+        }
+    }
+
+    release_file_struct(out);
+}
+
+static void setup_resume(CURL *curl, FileStruct *out)
+{
+    /* Function  : static void setup_resume(CURL *curl, FileStruct *out)
+     * Input     : curl - pointer to the easy handle of the download
+     *             out - pointer to the open FileStruct of the download
+     * Output    : None
+     * Procedure : This function sets the options that let a download continue a part file: a "Range: bytes=<size>-" request when there is something to resume, and error responses are not written into the file (a "416 Range Not Satisfiable" body would otherwise be appended to it). Response headers go to DownloadHeaderCallback.
+     */
+
+    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, out->resume_from);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, DownloadHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)out);
+}
+
+static int check_resumed_transfer(CURL *curl, CURLcode res, FileStruct *out)
+{
+    /* Function  : static int check_resumed_transfer(CURL *curl, CURLcode res, FileStruct *out)
+     * Input     : curl - pointer to the easy handle of the finished download
+     *             res - result code reported by curl for the transfer
+     *             out - pointer to the FileStruct of the download
+     * Output    : Returns 0 if the file is complete, 1 if the download must start over from the first byte, -1 on failure
+     * Procedure : This function decides the outcome of a download that may have been resumed. A part file that was already complete gets a "416 Range Not Satisfiable" whose Content-Range matches its size, which counts as success: part files are only written by download_file and the transfers of the event loop, in order from the first byte and one write at a time (see submit_file_request), so their size is the number of bytes received (download_file_segmented writes its ranges into a separate ".seg" file). If the server ignored the Range header, the part file is truncated and 1 is returned so the caller downloads the whole file again.
+     */
+
+    if (res == CURLE_OK)
+    {
+        return out->error ? -1 : 0;
+    }
+
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+    if (out->resume_from > 0 && res == CURLE_HTTP_RETURNED_ERROR && response_code == 416 && out->remote_size == out->resume_from)
+    {
+        // Nothing left to download
+        return 0;
+    }
+
+    if (out->resume_from > 0 && (res == CURLE_RANGE_ERROR || (res == CURLE_HTTP_RETURNED_ERROR && response_code == 416)))
+    {
+        // The server won't continue this part file, start from scratch
+        return truncate_file_struct(out) == 0 ? 1 : -1;
+    }
+
+    return -1;
+}
+
+static int add_band_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+{
+    /* Function  : static int add_band_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+     * Input     : html - pointer to the page the match was found in
+     *             ovector - pointer to the offsets of the match
+     *             userdata - pointer to a BandSink structure
+     * Output    : Returns non-zero if the band could not be stored
+     * Procedure : This function turns a match of the band pattern into a BandInfo, appends it to the list and hands it to the callback of the sink, if any.
+     */
+
+    BandSink *sink = (BandSink *)userdata;
+    Arena *arena = sink->list->arena;
+    BandInfo *band = append_band(sink->list);
+
+    if (band == NULL)
+    {
+        return 1;
+    }
+
+    band->url = dup_group(arena, base_url(), html, ovector, 1);
+    band->name = dup_group(arena, NULL, html, ovector, 2);
+    band->genre = dup_group(arena, NULL, html, ovector, 3);
+    if (band->url == NULL || band->name == NULL || band->genre == NULL)
+    {
+        sink->list->count--;
+        return 1;
+    }
+
+    if (sink->callback != NULL)
+    {
+        sink->callback(band, sink->userdata);
+    }
+
+    return 0;
+}
+
+static int add_album_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+{
+    /* Function  : static int add_album_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+     * Input     : html - pointer to the page the match was found in
+     *             ovector - pointer to the offsets of the match
+     *             userdata - pointer to an AlbumInfoList structure
+     * Output    : Returns non-zero if the album could not be stored
+     * Procedure : This function turns a match of the album pattern into an AlbumInfo and appends it to the list.
+     */
+
+    AlbumInfoList *album_list = (AlbumInfoList *)userdata;
+    Arena *arena = album_list->arena;
+    AlbumInfo *album = append_album(album_list);
+
+    if (album == NULL)
+    {
+        return 1;
+    }
+
+    album->url = dup_group(arena, base_url(), html, ovector, 1);
+    album->year = dup_group(arena, NULL, html, ovector, 2);
+    album->name = dup_group(arena, NULL, html, ovector, 3);
+    if (album->url == NULL || album->year == NULL || album->name == NULL)
+    {
+        album_list->count--;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int add_song_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+{
+    /* Function  : static int add_song_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+     * Input     : html - pointer to the page the match was found in
+     *             ovector - pointer to the offsets of the match
+     *             userdata - pointer to a SongSink structure
+     * Output    : Returns non-zero if the song could not be stored
+     * Procedure : This function turns a match of the song pattern into a SongInfo (URL-decoding the song name straight into the arena), appends it to the list and hands it to the callback of the sink, if any.
+     */
+
+    SongSink *sink = (SongSink *)userdata;
+    Arena *arena = sink->list->arena;
+    SongInfo *song = append_song(sink->list);
+    TextSpan name = {ovector[10], ovector[11] - ovector[10]};
+
+    if (song == NULL)
+    {
+        return 1;
+    }
+
+    song->url = dup_group(arena, NULL, html, ovector, 1);
+    song->artist = dup_group(arena, NULL, html, ovector, 2);
+    song->year = dup_group(arena, NULL, html, ovector, 3);
+    song->album = dup_group(arena, NULL, html, ovector, 4);
+    // Decoding never makes the name longer
+    song->name = arena_alloc(arena, name.length + 1);
+    if (song->url == NULL || song->artist == NULL || song->year == NULL || song->album == NULL || song->name == NULL)
+    {
+        sink->list->count--;
+        return 1;
+    }
+    span_decode(html, name, song->name, name.length + 1);
+
+    if (sink->callback != NULL)
+    {
+        sink->callback(song, sink->userdata);
+    }
+
+    return 0;
+}
+
+static int add_song_ref_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+{
+    /* Function  : static int add_song_ref_match(const char *html, const PCRE2_SIZE *ovector, void *userdata)
+     * Input     : html - pointer to the page the match was found in
+     *             ovector - pointer to the offsets of the match
+     *             userdata - pointer to a SongPage structure
+     * Output    : Returns non-zero if the song could not be stored
+     * Procedure : This function records where the fields of a match of the song pattern are in the page, without copying or decoding anything.
+     */
+
+    (void)html;
+    SongRef *song = append_song_ref((SongPage *)userdata);
+
+    if (song == NULL)
+    {
+        return 1;
+    }
+
+    song->url = (TextSpan){ovector[2], ovector[3] - ovector[2]};
+    song->artist = (TextSpan){ovector[4], ovector[5] - ovector[4]};
+    song->year = (TextSpan){ovector[6], ovector[7] - ovector[6]};
+    song->album = (TextSpan){ovector[8], ovector[9] - ovector[8]};
+    song->name = (TextSpan){ovector[10], ovector[11] - ovector[10]};
+
+    return 0;
+}
+
+RN_API int parse_bands(const char *html, size_t size, BandInfoList *band_list)
+{
+    /*
+     * Function  : int parse_bands(const char *html, size_t size, BandInfoList *band_list)
+     * Input     : html - pointer to the HTML of a search results page
+     *             size - size of the HTML in bytes
+     *             band_list - pointer to the BandInfoList structure the bands are appended to
+     * Output    : Returns the number of bands added to band_list
+     * Procedure : This function scans a complete search results page with the precompiled band pattern (see rocknation_regex.h) and appends every band it finds to band_list.
+     */
+
+    BandSink sink = {band_list, NULL, NULL};
+    StreamExtractor extractor;
+    extractor_init(&extractor, PATTERN_BAND, add_band_match, &sink);
+
+    return extractor_feed(&extractor, html, size, 1);
+}
+
+RN_API void search_band(const char *search_text, BandInfoList *band_list)
 {
     /*
      * Function  : void search_band(const char *search_text, BandInfoList *band_list)
      * Input     : search_text - pointer to the text used for band search
      *             band_list - pointer to the BandInfoList structure to store search results
      * Output    : Updates the band_list with search results
-     * Procedure : This function searches for bands on rocknation.su based on the provided search_text. It uses libcurl to perform an HTTP request, processes the HTML response using PCRE regular expressions, and populates the BandInfoList structure with the found bands.
+     * Procedure : This function searches for bands on rocknation.su based on the provided search_text, see search_band_streaming.
      */
 
-    CURL *curl;
-    CURLcode res;
+    search_band_streaming(search_text, band_list, NULL, NULL);
+}
 
-    MemoryStruct chunk;
-    chunk.memory = malloc(1);
-    chunk.size = 0;
+RN_API void search_band_streaming(const char *search_text, BandInfoList *band_list, BandCallback on_band, void *userdata)
+{
+    /*
+     * Function  : void search_band_streaming(const char *search_text, BandInfoList *band_list, BandCallback on_band, void *userdata)
+     * Input     : search_text - pointer to the text used for band search
+     *             band_list - pointer to the BandInfoList structure to store search results
+     *             on_band - function called with every band as soon as it is parsed, or NULL
+     *             userdata - pointer passed to on_band
+     * Output    : Updates the band_list with search results
+     * Procedure : This function searches for bands on rocknation.su based on the provided search_text. A text searched before is answered from the local catalog store (see rocknation_store.h) without a request. Otherwise it performs the HTTP request through the pooled session (see fetch_page_streaming) and extracts the bands while the results page is downloading, so on_band sees the first band before the page is complete, and the results are added to the store.
+     */
 
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Host: rocknation.su");
-    // Add other headers here
+    band_list->count = 0;
 
-    curl = curl_easy_init();
-    if (curl)
+    if (store_search(search_text, band_list, on_band, userdata) == 0)
     {
-        char url[] = "https://rocknation.su/mp3/searchresult/";
-        char postdata[MAX_URL_LENGTH];
-        snprintf(postdata, sizeof(postdata), "text_mp3=%s&enter_mp3=Search", url_encode_spaces(search_text));
-        printf("DEBUG: %s\n", url_encode_spaces(postdata)); // DEBUG
+        return;
+    }
 
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postdata);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+    MemoryStruct chunk;
+    init_memory_struct(&chunk);
 
-        res = curl_easy_perform(curl);
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s/mp3/searchresult/", base_url());
+    char postdata[MAX_URL_LENGTH];
+    char encoded_text[MAX_URL_LENGTH - sizeof("text_mp3=&enter_mp3=Search") + 1]; // Leaves room for the rest of postdata
+    url_encode_spaces_into(search_text, strlen(search_text), encoded_text, sizeof(encoded_text));
+    snprintf(postdata, sizeof(postdata), "text_mp3=%s&enter_mp3=Search", encoded_text);
 
-        if (res == CURLE_OK)
-        {
-            const char *pattern = "<a href=\"(\\/mp3\\/band-[0-9]+)\">([a-zA-Z0-9 \\/]+)<\\/a><\\/td><td>([a-zA-Z0-9 ]+)<\\/td>";
-            const int options = PCRE_CASELESS;
+    BandSink sink = {band_list, on_band, userdata};
+    StreamExtractor extractor;
+    extractor_init(&extractor, PATTERN_BAND, add_band_match, &sink);
 
-            pcre *re;
-            const char *error;
-            int erroffset;
+    if (fetch_page_streaming(url, postdata, &chunk, &extractor) == 0 && band_list->count > 0)
+    {
+        store_put_search(search_text, band_list);
+    }
 
-            re = pcre_compile(pattern, options, &error, &erroffset, NULL);
-            if (re != NULL)
-            {
-                int ovector[30];
-                int rc;
-                band_list->count = 0; // Counter for bands found
+    free(chunk.memory);
+}
 
-                rc = pcre_exec(re, NULL, chunk.memory, chunk.size, 0, 0, ovector, 30);
-                while (rc >= 0 && band_list->count < 10)
-                {
-                    char *band_url;
-                    char *band_name;
-                    char *genre;
-
-                    pcre_get_substring(chunk.memory, ovector, rc, 1, &band_url);
-                    pcre_get_substring(chunk.memory, ovector, rc, 2, &band_name);
-                    pcre_get_substring(chunk.memory, ovector, rc, 3, &genre);
-
-                    snprintf(band_list->bands[band_list->count].url, sizeof(band_list->bands[band_list->count].url),
-                             "https://rocknation.su%s", band_url);
-                    strncpy(band_list->bands[band_list->count].name, band_name,
-                            sizeof(band_list->bands[band_list->count].name) - 1);
-                    band_list->bands[band_list->count].name[sizeof(band_list->bands[band_list->count].name) - 1] = '\0';
-                    strncpy(band_list->bands[band_list->count].genre, genre,
-                            sizeof(band_list->bands[band_list->count].genre) - 1);
-                    band_list->bands[band_list->count].genre[sizeof(band_list->bands[band_list->count].genre) - 1] = '\0';
-
-                    pcre_free_substring(band_url);
-                    pcre_free_substring(band_name);
-                    pcre_free_substring(genre);
-
-                    rc = pcre_exec(re, NULL, chunk.memory, chunk.size, ovector[1], 0, ovector, 30);
-                    band_list->count++;
-                }
+RN_API int parse_albums(const char *html, size_t size, AlbumInfoList *album_list)
+{
+    /*
+     * Function  : int parse_albums(const char *html, size_t size, AlbumInfoList *album_list)
+     * Input     : html - pointer to the HTML of a band page
+     *             size - size of the HTML in bytes
+     *             album_list - pointer to the AlbumInfoList structure the albums are appended to
+     * Output    : Returns the number of albums found on the page (0 means the page is past the last one)
+     * Procedure : This function scans one complete page of a band's discography with the precompiled album pattern (see rocknation_regex.h) and appends every album it finds to album_list.
+     */
 
-                pcre_free(re);
-            }
-        }
+    StreamExtractor extractor;
+    extractor_init(&extractor, PATTERN_ALBUM, add_album_match, album_list);
 
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        free(chunk.memory);
-    }
+    return extractor_feed(&extractor, html, size, 1);
 }
 
-void get_albums(char *band_url, AlbumInfoList *album_list)
+RN_API int get_albums(const char *band_url, AlbumInfoList *album_list)
 {
     /*
-     * Function  : void get_albums(char *band_url, AlbumInfoList *album_list)
+     * Function  : int get_albums(const char *band_url, AlbumInfoList *album_list)
      * Input     : band_url - pointer to the URL of the band
      *             album_list - pointer to the AlbumInfoList structure to store album information
-     * Output    : Updates the album_list with album information
-     * Procedure : This function retrieves the list of albums for a given band from rocknation.su. It performs HTTP requests to each page of the band's albums, processes the HTML response using PCRE regular expressions, and populates the AlbumInfoList structure with the found albums.
+     * Output    : Updates the album_list with album information. Returns 0 if the whole discography was read (or answered from the store), -1 if a page couldn't be fetched
+     * Procedure : This function retrieves the list of albums for a given band from rocknation.su. It requests each page of the band's albums in sequence through the pooled session (see fetch_page_streaming), so every page after the first reuses the same connection, and extracts the albums of each page while it downloads until a page without albums is found. Only a page fetched with status 200 ends the discography: an error page or a failed transfer stops the walk, and the albums found so far are returned without being stored. A complete discography is added to the local catalog store, and answered from it next time (see rocknation_store.h). See get_albums_parallel for the concurrent variant.
      */
 
     int page_index = 1; // Índice de la página
     album_list->count = 0;
 
+    if (store_albums(band_url, album_list) == 0)
+    {
+        return 0;
+    }
+
     while (1)
     {
         char page_url[MAX_URL_LENGTH];
         snprintf(page_url, sizeof(page_url), "%s/%d", band_url, page_index);
 
-        CURL *curl;
-        CURLcode res;
-
         MemoryStruct chunk;
-        chunk.memory = malloc(1);
-        chunk.size = 0;
+        init_memory_struct(&chunk);
 
-        struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Host: rocknation.su");
+        StreamExtractor extractor;
+        extractor_init(&extractor, PATTERN_ALBUM, add_album_match, album_list);
 
-        curl = curl_easy_init();
-        if (curl)
+        int status = fetch_page_streaming(page_url, NULL, &chunk, &extractor);
+        free(chunk.memory);
+
+        if (status != 0)
         {
-            curl_easy_setopt(curl, CURLOPT_URL, page_url);
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+            return -1;
+        }
 
-            res = curl_easy_perform(curl);
+        int found = extractor.matches;
 
-            if (res == CURLE_OK)
+        if (found == 0)
+        {
+            // No more albums on this page, stop paginating
+            if (album_list->count > 0)
             {
-                const char *pattern = "<a href=\"(\\/mp3\\/album-[0-9]+)\">([0-9]+) - (.*?)<\\/a>";
-                const int options = PCRE_CASELESS;
-
-                pcre *re;
-                const char *error;
-                int erroffset;
-
-                re = pcre_compile(pattern, options, &error, &erroffset, NULL);
-                if (re != NULL)
-                {
-                    int ovector[30];
-                    int rc;
-
-                    rc = pcre_exec(re, NULL, chunk.memory, chunk.size, 0, 0, ovector, 30);
-                    if (rc == -1)
-                    {
-                        break;
-                    }
-
-                    while (rc >= 0)
-                    {
-                        char *album_url;
-                        char *album_name;
-                        char *album_year;
-
-                        pcre_get_substring(chunk.memory, ovector, rc, 1, &album_url);
-                        pcre_get_substring(chunk.memory, ovector, rc, 2, &album_year);
-                        pcre_get_substring(chunk.memory, ovector, rc, 3, &album_name);
-
-                        snprintf(album_list->albums[album_list->count].url, sizeof(album_list->albums[album_list->count].url),
-                                 "https://rocknation.su%s", album_url);
-                        strncpy(album_list->albums[album_list->count].name, album_name,
-                                sizeof(album_list->albums[album_list->count].name) - 1);
-                        album_list->albums[album_list->count].name[sizeof(album_list->albums[album_list->count].name) - 1] = '\0';
-                        strncpy(album_list->albums[album_list->count].year, album_year,
-                                sizeof(album_list->albums[album_list->count].year) - 1);
-                        album_list->albums[album_list->count].year[sizeof(album_list->albums[album_list->count].year) - 1] = '\0';
-
-                        pcre_free_substring(album_url);
-                        pcre_free_substring(album_year);
-                        pcre_free_substring(album_name);
-
-                        rc = pcre_exec(re, NULL, chunk.memory, chunk.size, ovector[1], 0, ovector, 30);
-                        album_list->count++;
-                    }
-
-                    pcre_free(re);
-                }
+                store_put_albums(band_url, album_list);
             }
-
-            curl_easy_cleanup(curl);
-            curl_slist_free_all(headers);
-            free(chunk.memory);
+            return 0;
         }
 
         page_index++;
     }
 }
 
-void get_albums_by_name(char *band_name, AlbumInfoList *album_list)
+RN_API void get_albums_by_name(const char *band_name, AlbumInfoList *album_list)
 {
+    /*
+     * Function  : void get_albums_by_name(const char *band_name, AlbumInfoList *album_list)
+     * Input     : band_name - pointer to the name of the band
+     *             album_list - pointer to the AlbumInfoList structure to store album information
+     * Output    : Updates the album_list with album information
+     * Procedure : This function retrieves the albums of the first band found for a name. A name resolved before is taken from the name cache (see rocknation_names.h) without a search. A cached URL whose discography was read to its end without any album is forgotten and the band searched again; one whose pages couldn't be fetched (network error, offline mode, error page) is kept, as nothing says it is wrong.
+     */
+
+    char band_url[MAX_URL_LENGTH];
+
+    if (name_cache_lookup(band_name, band_url, sizeof(band_url)) == 0)
+    {
+        if (get_albums(band_url, album_list) != 0 || album_list->count > 0)
+        {
+            return;
+        }
+        name_cache_forget(band_name);
+    }
+
     BandInfoList band_list;
+    init_band_list(&band_list, album_list->arena);
     search_band(band_name, &band_list);
 
     if (band_list.count > 0)
     {
+        name_cache_put(band_name, band_list.bands[0].url);
         get_albums(band_list.bands[0].url, album_list);
     }
 }
 
-void get_songs(const char *album_url, SongInfoList *song_list)
+RN_API int parse_songs(const char *html, size_t size, SongInfoList *song_list)
+{
+    /*
+     * Function  : int parse_songs(const char *html, size_t size, SongInfoList *song_list)
+     * Input     : html - pointer to the HTML of an album page
+     *             size - size of the HTML in bytes
+     *             song_list - pointer to the SongInfoList structure the songs are appended to
+     * Output    : Returns the number of songs added to song_list
+     * Procedure : This function scans a complete album page with the precompiled song pattern (see rocknation_regex.h) and appends every song it finds to song_list.
+     */
+
+    SongSink sink = {song_list, NULL, NULL};
+    StreamExtractor extractor;
+    extractor_init(&extractor, PATTERN_SONG, add_song_match, &sink);
+
+    return extractor_feed(&extractor, html, size, 1);
+}
+
+RN_API void get_songs(const char *album_url, SongInfoList *song_list)
 {
     /*
      * Function  : void get_songs(const char *album_url, SongInfoList *song_list)
      * Input     : album_url - pointer to the URL of the album
      *             song_list - pointer to the SongInfoList structure to store song information
      * Output    : Updates the song_list with song information
-     * Procedure : This function retrieves the list of songs for a given album from rocknation.su. It performs an HTTP request to the album page, processes the HTML response using PCRE regular expressions, and populates the SongInfoList structure with the found songs.
+     * Procedure : This function retrieves the list of songs for a given album from rocknation.su, see get_songs_streaming.
      */
 
-    CURL *curl;
-    CURLcode res;
+    get_songs_streaming(album_url, song_list, NULL, NULL);
+}
 
-    MemoryStruct chunk;
-    chunk.memory = malloc(1);
-    chunk.size = 0;
+RN_API void get_songs_streaming(const char *album_url, SongInfoList *song_list, SongCallback on_song, void *userdata)
+{
+    /*
+     * Function  : void get_songs_streaming(const char *album_url, SongInfoList *song_list, SongCallback on_song, void *userdata)
+     * Input     : album_url - pointer to the URL of the album
+     *             song_list - pointer to the SongInfoList structure to store song information
+     *             on_song - function called with every song as soon as it is parsed, or NULL
+     *             userdata - pointer passed to on_song
+     * Output    : Updates the song_list with song information
+     * Procedure : This function retrieves the list of songs for a given album from rocknation.su. An album fetched before is answered from the local catalog store (see rocknation_store.h). Otherwise it requests the album page through the pooled session (see fetch_page_streaming) and extracts the songs while the page is downloading, so on_song sees the first song before the page is complete, and the songs are added to the store.
+     */
 
     song_list->count = 0;
 
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Host: rocknation.su");
+    if (store_songs(album_url, song_list, on_song, userdata) == 0)
+    {
+        return;
+    }
 
-    curl = curl_easy_init();
-    if (curl)
+    MemoryStruct chunk;
+    init_memory_struct(&chunk);
+
+    SongSink sink = {song_list, on_song, userdata};
+    StreamExtractor extractor;
+    extractor_init(&extractor, PATTERN_SONG, add_song_match, &sink);
+
+    if (fetch_page_streaming(album_url, NULL, &chunk, &extractor) == 0 && song_list->count > 0)
     {
-        curl_easy_setopt(curl, CURLOPT_URL, album_url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+        store_put_songs(album_url, song_list);
+    }
 
-        res = curl_easy_perform(curl);
+    free(chunk.memory);
+}
 
-        if (res == CURLE_OK)
-        {
-            const char *pattern = "(http:\\/\\/rocknation.su\\/upload\\/mp3\\/([a-zA-Z0-9 %]+)\\/([0-9]{4}) - ([a-zA-Z0-9 %]+)\\/([a-zA-Z0-9 %\\.]+))";
-            pcre *re;
-            const char *error;
-            int erroffset;
+RN_API int get_song_page(const char *album_url, SongPage *song_page)
+{
+    /*
+     * Function  : int get_song_page(const char *album_url, SongPage *song_page)
+     * Input     : album_url - pointer to the URL of the album
+     *             song_page - pointer to the SongPage structure to fill
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function fetches an album page (see fetch_page_streaming) and keeps it, recording for every song where its fields are in the page instead of copying them out. Fields are read with span_copy, or span_decode for the song name, only when they are used, so listing an album costs the page buffer and nothing per song. The songs are also added to the local catalog store. The song_page must have been prepared with init_song_page, and the page must be released with free_song_page.
+     */
 
-            re = pcre_compile(pattern, NULL, &error, &erroffset, NULL);
-            if (re != NULL)
-            {
-                int ovector[30];
-                int rc;
+    song_page->count = 0;
 
-                rc = pcre_exec(re, NULL, chunk.memory, chunk.size, 0, 0, ovector, 30);
-                while (rc >= 0)
-                {
-                    char *mp3_url;
-                    char *artist;
-                    char *year;
-                    char *album;
-                    char *song_name;
-
-                    pcre_get_substring(chunk.memory, ovector, rc, 1, &mp3_url);
-                    pcre_get_substring(chunk.memory, ovector, rc, 2, &artist);
-                    pcre_get_substring(chunk.memory, ovector, rc, 3, &year);
-                    pcre_get_substring(chunk.memory, ovector, rc, 4, &album);
-                    pcre_get_substring(chunk.memory, ovector, rc, 5, &song_name);
-
-                    SongInfo *song = &song_list->songs[song_list->count];
-                    strncpy(song->url, mp3_url, sizeof(song->url) - 1);
-                    song->url[sizeof(song->url) - 1] = '\0';
-                    strncpy(song->artist, artist, sizeof(song->artist) - 1);
-                    song->artist[sizeof(song->artist) - 1] = '\0';
-                    strncpy(song->year, year, sizeof(song->year) - 1);
-                    song->year[sizeof(song->year) - 1] = '\0';
-                    strncpy(song->album, album, sizeof(song->album) - 1);
-                    song->album[sizeof(song->album) - 1] = '\0';
-                    strncpy(song->name, url_decode(song_name), sizeof(song->name) - 1);
-                    song->name[sizeof(song->name) - 1] = '\0';
-
-                    pcre_free_substring(mp3_url);
-                    pcre_free_substring(artist);
-                    pcre_free_substring(year);
-                    pcre_free_substring(album);
-                    pcre_free_substring(song_name);
-
-                    rc = pcre_exec(re, NULL, chunk.memory, chunk.size, ovector[1], 0, ovector, 30);
-                    song_list->count++;
-                }
+    if (init_memory_struct(&song_page->page) != 0)
+    {
+        return -1;
+    }
 
-                pcre_free(re);
-            }
-        }
+    StreamExtractor extractor;
+    extractor_init(&extractor, PATTERN_SONG, add_song_ref_match, song_page);
 
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        free(chunk.memory);
+    int status = fetch_page_streaming(album_url, NULL, &song_page->page, &extractor);
+    if (status == 0 && song_page->count > 0)
+    {
+        store_put_song_page(album_url, song_page);
     }
+
+    return status;
+}
+
+RN_API void free_song_page(SongPage *song_page)
+{
+    /*
+     * Function  : void free_song_page(SongPage *song_page)
+     * Input     : song_page - pointer to the SongPage structure to release
+     * Output    : None
+     * Procedure : This function releases the page kept by get_song_page; the spans of its songs are no longer valid afterwards. The array of songs belongs to the arena of the page and goes away with it.
+     */
+
+    free(song_page->page.memory);
+    song_page->page.memory = NULL;
+    song_page->page.size = 0;
+    song_page->page.capacity = 0;
+    song_page->songs = NULL;
+    song_page->count = 0;
+    song_page->capacity = 0;
 }
 
-int download_file(const char *url, char *output_file)
+RN_API int download_file(const char *url, const char *output_file)
 {
     /*
-     * Function  : int download_file(const char *url, char *output_file)
+     * Function  : int download_file(const char *url, const char *output_file)
      * Input     : url - pointer to the URL of the file to download
      *             output_file - pointer to the name of the file to save the downloaded content
      * Output    : Downloads the file and returns 0 on success, -1 on failure
-     * Procedure : This function downloads a file from the given URL using libcurl. It writes the content to the specified output file. If the output_file is NULL, the function attempts to derive the filename from the URL. The function returns 0 on success and -1 on failure.
+     * Procedure : This function downloads a file from the given URL using libcurl. The content is streamed through a fixed-size buffer into "<output_file>.part" as it arrives, and the part file is flushed to disk and renamed to output_file only once the download is complete; full buffers are written by the disk writer (see attach_disk_writer) while the next ones arrive. If a part file from an interrupted attempt exists, only the missing bytes are requested with a Range header. If the output_file is NULL, the function attempts to derive the filename from the URL. On success the transfer size and average speed are reported. The function returns 0 on success and -1 on failure.
      */
 
     CURL *curl;
     CURLcode res;
+    int result = -1;
+    char *derived_name = NULL;
 
-    MemoryStruct chunk;
-    chunk.memory = malloc(1);
-    chunk.size = 0;
+    if (output_file == NULL)
+    {
+        derived_name = get_filename_from_url(url);
+        output_file = derived_name;
+    }
 
     if (output_file == NULL)
     {
-        output_file = get_filename_from_url(url);
+        printf("Couldn't derive a file name from the url\n");
+        return -1;
     }
 
-    url = replace_http(url);
+    char *https_url = replace_http(url);
+
+    FileStruct out;
 
-    curl = curl_easy_init();
-    if (curl)
+    if (open_file_struct(&out, output_file) != 0 || https_url == NULL)
+    {
+        printf("Error opening file for writing\n");
+    }
+    else
     {
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+        curl = curl_easy_init();
+        if (curl)
+        {
+            int status;
 
-        res = curl_easy_perform(curl);
+            attach_disk_writer(&out, get_disk_writer());
 
-        if (res == CURLE_OK)
-        {
-            FILE *file = fopen(output_file, "wb");
-            if (file)
+            do
             {
-                size_t bytes_written = fwrite(chunk.memory, 1, chunk.size, file);
-                fclose(file);
-
-                if (bytes_written == chunk.size)
-                {
-                    printf("File downloaded successfully: %s\n", output_file);
-                }
-                else
+                if (out.resume_from > 0)
                 {
-                    printf("Error writing file\n");
+                    printf("Resuming %s at %" CURL_FORMAT_CURL_OFF_T " bytes\n", output_file, out.resume_from);
                 }
+
+                curl_easy_reset(curl);
+                session_attach(curl);
+                curl_easy_setopt(curl, CURLOPT_URL, https_url);
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteFileCallback);
+                curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&out);
+                curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, (long)DOWNLOAD_BUFFER_SIZE);
+                setup_resume(curl, &out);
+
+                res = curl_easy_perform(curl);
+                session_record_timings(curl, https_url);
+
+                // Write out whatever is still staged in the buffer
+                flush_file_buffer(&out);
+                status = check_resumed_transfer(curl, res, &out);
+            } while (status == 1);
+
+            if (status == 0)
+            {
+                curl_off_t speed = 0;
+                double total_time = 0;
+                curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+                curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total_time);
+
+                printf("File downloaded successfully: %s (%zu bytes in %.2fs, %.1f KB/s)\n", output_file, out.total, total_time, (double)speed / 1024.0);
+                result = 0;
+            }
+            else if (out.error)
+            {
+                printf("Error writing file\n");
             }
             else
             {
-                printf("Error opening file for writing\n");
+                printf("curl_easy_perform failed: %s\n", curl_easy_strerror(res));
             }
+
+            curl_easy_cleanup(curl);
         }
-        else
-        {
-            printf("curl_easy_perform failed: %s\n", curl_easy_strerror(res));
-        }
+    }
 
-        curl_easy_cleanup(curl);
-        free(chunk.memory);
+    // Incomplete downloads stay in the part file so the next attempt can resume them
+    close_file_struct(&out, result == 0);
+    if (result == 0 && out.error)
+    {
+        printf("Error renaming %s.part\n", output_file);
+        result = -1;
     }
 
-    return 0;
+    free(https_url);
+    free(derived_name);
+
+    return result;
 }
@@ -0,0 +1,1255 @@
+// rocknation_disk.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_pool.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/falloc.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && !defined(RN_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#define DISK_URING
+#endif
+#endif
+
+#define DISK_RING_ENTRIES 128                      // Submission queue entries of the ring, and the most operations it has in flight
+#define DISK_MAX_PREALLOCATION ((int64_t)1 << 30)  // Larger Content-Lengths aren't trusted enough to reserve that much disk
+#define DISK_RING_BATCH 16                         // Most requests a turn gathering them waits for
+#define DISK_RING_BATCH_US 1000                    // Longest a turn of the ring waits while requests are gathered for the next one
+
+/*
+ * The disk writer takes the file system calls of downloads off the threads receiving them. Any thread
+ * can queue a request: write a buffer at a position, preallocate a range (fallocate, keeping the size of
+ * the file so an interrupted download still resumes from it), or commit a finished part file (fsync,
+ * rename to its final name, close). On Linux the requests go through an io_uring, set up with raw system
+ * calls, owned by one thread: every turn it puts all the requests queued since the last one in the
+ * submission queue and hands them to the kernel with a single io_uring_enter, which also waits for the
+ * completions. While chains are in flight it lets the requests of the threads writing at once gather for
+ * a short while (DISK_RING_BATCH_US), so one call carries the buffers of many downloads instead of one
+ * call per buffer. The requests of one file are linked into a chain the kernel runs in order, while the
+ * chains of different files run side by side; the fsyncs of files finishing together are submitted as one
+ * batch and run in parallel in the kernel. Where io_uring isn't available (other systems, old kernels, seccomp filters refusing it,
+ * ROCKNATION_IO_URING=0) the same requests run as tasks of the default pool, one system call each.
+ * Completion callbacks run on the thread of the ring or on a pool worker, so they should only hand the
+ * result on to the thread waiting for it.
+ */
+
+typedef void (*DiskDoneFunction)(long result, void *userdata);
+
+typedef enum
+{
+    DISK_WRITE,
+    DISK_ALLOCATE,
+    DISK_COMMIT,
+    DISK_OPERATIONS
+} DiskOperation;
+
+typedef enum
+{
+    DISK_STAGE_SYNC,
+    DISK_STAGE_RENAME,
+    DISK_STAGE_CLOSE
+} DiskStage;
+
+typedef struct DiskWriter DiskWriter;
+
+typedef struct DiskRequest
+{
+    DiskOperation operation;
+    int fd;                // File written, preallocated or committed; a commit closes it
+    const char *buffer;    // Data of a write
+    size_t length;         // Bytes to write or to preallocate
+    int64_t offset;        // Position of the write or of the preallocated range
+    const char *path;      // Part file renamed by a commit
+    const char *target;    // Name the part file gets
+    DiskDoneFunction done; // Called with the bytes written or 0, or a negative errno on failure
+    void *userdata;
+    const int *cancel;     // Optional, read atomically by the ring before it starts the request: when it is set the request fails with -ECANCELED instead (a commit still closes its file); written with RN_ATOMIC_STORE
+
+    // Used by the writer
+    DiskWriter *writer;
+    size_t written;   // Bytes of a write done so far
+    DiskStage stage;  // Step of a commit in progress
+    long result;
+    double submitted; // Time the request was queued, from rn_clock
+    unsigned long sequence; // Order the request was queued in, which the ring keeps for the requests of a file
+    struct DiskRequest *next;
+} DiskRequest;
+
+struct DiskWriter
+{
+    int ring;       // Set when requests go through the io_uring, otherwise they are tasks of pool
+    WorkPool *pool;
+
+#ifdef DISK_URING
+    int ring_fd;
+    int wake_fd;         // eventfd written when a request is queued while the thread of the ring waits
+    uint64_t wake_value; // Target of the read kept armed on wake_fd
+    int wake_armed;
+    int batch_wait;      // Set when io_uring_enter takes a timeout (IORING_FEAT_EXT_ARG), so a turn can wait for every chain in flight
+    int in_flight;       // Operations handed to the kernel and not completed, wake read excluded
+    int busy[DISK_RING_ENTRIES]; // File of each of those operations
+    int sync_fds[DISK_RING_ENTRIES]; // Files with an fsync among them, the last operation of their chain
+    int syncs;
+    unsigned long sequence;      // Sequence of the next request queued, guarded by lock
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    RnThread thread;
+#endif
+
+    // Guarded by lock
+    RnMutex lock;
+    RnCond idle;             // Signalled when the last pending request has completed
+    DiskRequest *queue;      // Requests not handed to the ring yet
+    DiskRequest *queue_tail;
+    int sleeping;            // Set while the thread of the ring waits with nothing queued, and has to be woken for a new request
+    int gathering;           // Requests that end the wait of the thread of the ring while it gathers them, 0 when it doesn't
+    int gathered;            // Requests queued during that wait
+    int waiters;             // Threads waiting for requests they queued, see disk_hurry
+    int stopping;
+    int running;             // Set between disk_start and disk_stop
+    long pending;            // Requests queued and not completed
+    long requests[DISK_OPERATIONS];
+    long failed;
+    long calls;              // System calls made on behalf of the requests
+    double bytes;            // Bytes written
+    long write_histogram[POOL_LATENCY_BUCKETS];  // From queueing a write to its completion
+    long commit_histogram[POOL_LATENCY_BUCKETS]; // From queueing a commit to the file having its final name
+    long writes;
+    long commits;
+    double write_max;
+    double commit_max;
+};
+
+// Writer shared by the whole process, started on first use
+RN_SHARED DiskWriter rocknation_disk = {0};
+RN_SHARED RnOnce rocknation_disk_once = RN_ONCE_INIT;
+
+#ifdef DISK_URING
+static int disk_ring_setup(DiskWriter *writer);
+static void disk_ring_teardown(DiskWriter *writer);
+static struct io_uring_sqe *disk_ring_prepare(DiskWriter *writer, DiskRequest *request);
+static int disk_ring_advance(DiskRequest *request, int result);
+static int disk_ring_listed(const int *fds, int count, int fd);
+static void disk_ring_requeue(DiskRequest **ready, DiskRequest **ready_tail, DiskRequest *request);
+static void disk_ring_chain(DiskWriter *writer, DiskRequest **link);
+static int disk_ring_shortest(DiskWriter *writer);
+static int disk_ring_syncing(DiskWriter *writer);
+static int disk_ring_files(DiskWriter *writer);
+static void disk_ring_wake(DiskWriter *writer);
+static void disk_ring_main(void *argument);
+#endif
+static void disk_run(void *argument);
+static void disk_complete(DiskWriter *writer, DiskRequest *request);
+static void start_default_disk(void);
+static void stop_default_disk(void);
+RN_API int disk_start(DiskWriter *writer, int use_ring);
+RN_API void disk_stop(DiskWriter *writer);
+RN_API DiskWriter *get_disk_writer(void);
+RN_API void disk_submit(DiskWriter *writer, DiskRequest *request);
+RN_API void disk_hurry(DiskWriter *writer);
+RN_API void disk_hurry_done(DiskWriter *writer);
+RN_API void disk_wait(DiskWriter *writer);
+RN_API void print_disk_stats(void);
+
+#ifdef DISK_URING
+static int disk_ring_setup(DiskWriter *writer)
+{
+    /* Function  : static int disk_ring_setup(DiskWriter *writer)
+     * Input     : writer - pointer to the DiskWriter
+     * Output    : Returns 0 on success, -1 if the ring can't be used
+     * Procedure : This function creates the io_uring with io_uring_setup and maps its submission queue, completion queue and submission entries, the way liburing does. The kernel is asked which operations it supports; a ring missing one of those the writer needs (renameat came in Linux 5.11) is given up, as is one that can't be created at all.
+     */
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    writer->ring_fd = (int)syscall(__NR_io_uring_setup, DISK_RING_ENTRIES, &params);
+    writer->wake_fd = -1;
+    writer->sq_ring = MAP_FAILED;
+    writer->cq_ring = MAP_FAILED;
+    writer->sqes = MAP_FAILED;
+
+    if (writer->ring_fd < 0)
+    {
+        return -1;
+    }
+
+    int supported = 0;
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = rn_calloc(1, probe_size);
+
+    if (probe != NULL && syscall(__NR_io_uring_register, writer->ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        const int needed[] = {IORING_OP_WRITE, IORING_OP_READ, IORING_OP_FALLOCATE, IORING_OP_FSYNC, IORING_OP_RENAMEAT, IORING_OP_CLOSE};
+        supported = 1;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++)
+        {
+            if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+            {
+                supported = 0;
+            }
+        }
+    }
+    free(probe);
+
+    if (!supported)
+    {
+        disk_ring_teardown(writer);
+        return -1;
+    }
+
+    writer->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    writer->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && writer->cq_ring_size > writer->sq_ring_size)
+    {
+        writer->sq_ring_size = writer->cq_ring_size;
+    }
+
+    writer->sq_ring = mmap(NULL, writer->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, writer->ring_fd, IORING_OFF_SQ_RING);
+    if (writer->sq_ring == MAP_FAILED)
+    {
+        disk_ring_teardown(writer);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        writer->cq_ring = writer->sq_ring;
+    }
+    else
+    {
+        writer->cq_ring = mmap(NULL, writer->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, writer->ring_fd, IORING_OFF_CQ_RING);
+    }
+
+    writer->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    writer->sqes = mmap(NULL, writer->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, writer->ring_fd, IORING_OFF_SQES);
+    writer->wake_fd = eventfd(0, EFD_CLOEXEC);
+
+    if (writer->cq_ring == MAP_FAILED || writer->sqes == MAP_FAILED || writer->wake_fd < 0)
+    {
+        disk_ring_teardown(writer);
+        return -1;
+    }
+
+    char *sq = (char *)writer->sq_ring;
+    char *cq = (char *)writer->cq_ring;
+    writer->sq_head = (unsigned *)(sq + params.sq_off.head);
+    writer->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    writer->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    writer->sq_array = (unsigned *)(sq + params.sq_off.array);
+    writer->cq_head = (unsigned *)(cq + params.cq_off.head);
+    writer->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    writer->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    writer->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    writer->wake_armed = 0;
+    writer->batch_wait = (params.features & IORING_FEAT_EXT_ARG) != 0;
+    writer->in_flight = 0;
+    writer->syncs = 0;
+
+    return 0;
+}
+
+static void disk_ring_teardown(DiskWriter *writer)
+{
+    /* Function  : static void disk_ring_teardown(DiskWriter *writer)
+     * Input     : writer - pointer to the DiskWriter
+     * Output    : None
+     * Procedure : This function unmaps the queues of the ring and closes it and its eventfd. Closing the ring cancels the read still armed on the eventfd.
+     */
+
+    if (writer->sqes != MAP_FAILED)
+    {
+        munmap(writer->sqes, writer->sqes_size);
+    }
+    if (writer->cq_ring != MAP_FAILED && writer->cq_ring != writer->sq_ring)
+    {
+        munmap(writer->cq_ring, writer->cq_ring_size);
+    }
+    if (writer->sq_ring != MAP_FAILED)
+    {
+        munmap(writer->sq_ring, writer->sq_ring_size);
+    }
+    if (writer->wake_fd >= 0)
+    {
+        close(writer->wake_fd);
+    }
+    if (writer->ring_fd >= 0)
+    {
+        close(writer->ring_fd);
+    }
+
+    writer->sqes = MAP_FAILED;
+    writer->cq_ring = MAP_FAILED;
+    writer->sq_ring = MAP_FAILED;
+    writer->wake_fd = -1;
+    writer->ring_fd = -1;
+}
+
+static struct io_uring_sqe *disk_ring_prepare(DiskWriter *writer, DiskRequest *request)
+{
+    /* Function  : static struct io_uring_sqe *disk_ring_prepare(DiskWriter *writer, DiskRequest *request)
+     * Input     : writer - pointer to the DiskWriter
+     *             request - pointer to the request whose next operation is submitted, or NULL for the read on the eventfd
+     * Output    : Returns the entry filled, whose flags can still be changed until the next io_uring_enter
+     * Procedure : This function fills the next submission queue entry with the next operation of a request: the rest of a write, a preallocation, or the fsync, rename or close of a commit. The entry is published by moving the tail of the queue; the kernel only sees it at the next io_uring_enter.
+     */
+
+    unsigned tail = *writer->sq_tail;
+    unsigned index = tail & *writer->sq_mask;
+    struct io_uring_sqe *sqe = &writer->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)(uintptr_t)request;
+
+    if (request == NULL)
+    {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = writer->wake_fd;
+        sqe->addr = (uint64_t)(uintptr_t)&writer->wake_value;
+        sqe->len = sizeof(writer->wake_value);
+        sqe->off = (uint64_t)-1;
+    }
+    else if (request->operation == DISK_WRITE)
+    {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = request->fd;
+        sqe->addr = (uint64_t)(uintptr_t)(request->buffer + request->written);
+        sqe->len = (uint32_t)(request->length - request->written);
+        sqe->off = (uint64_t)(request->offset + request->written);
+    }
+    else if (request->operation == DISK_ALLOCATE)
+    {
+        sqe->opcode = IORING_OP_FALLOCATE;
+        sqe->fd = request->fd;
+        sqe->off = (uint64_t)request->offset;
+        sqe->addr = (uint64_t)request->length;
+        sqe->len = FALLOC_FL_KEEP_SIZE;
+    }
+    else if (request->stage == DISK_STAGE_SYNC)
+    {
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = request->fd;
+    }
+    else if (request->stage == DISK_STAGE_RENAME)
+    {
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)request->path;
+        sqe->len = (uint32_t)AT_FDCWD;
+        sqe->addr2 = (uint64_t)(uintptr_t)request->target;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = request->fd;
+    }
+
+    writer->sq_array[index] = index;
+    __atomic_store_n(writer->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+static int disk_ring_advance(DiskRequest *request, int result)
+{
+    /* Function  : static int disk_ring_advance(DiskRequest *request, int result)
+     * Input     : request - pointer to the request one of whose operations completed
+     *             result - result of the operation as reported in its completion queue entry
+     * Output    : Returns 1 if the request has another operation to submit, 0 if it is complete
+     * Procedure : This function moves a request on after one of its operations. A short write is continued from where it stopped. A commit goes from fsync to rename to close; a failed fsync skips the rename, so a file that may not be on disk never gets its final name, but the descriptor is always closed. The first error is the result of the request.
+     */
+
+    if (request->operation == DISK_WRITE)
+    {
+        if (result > 0)
+        {
+            request->written += (size_t)result;
+            if (request->written < request->length)
+            {
+                return 1;
+            }
+        }
+        request->result = result < 0 ? result : (long)request->written;
+        return 0;
+    }
+
+    if (request->operation == DISK_ALLOCATE)
+    {
+        request->result = result;
+        return 0;
+    }
+
+    if (result < 0 && request->result == 0)
+    {
+        request->result = result;
+    }
+
+    if (request->stage == DISK_STAGE_CLOSE)
+    {
+        return 0;
+    }
+
+    request->stage = request->result < 0 ? DISK_STAGE_CLOSE : request->stage + 1;
+    return 1;
+}
+
+static int disk_ring_listed(const int *fds, int count, int fd)
+{
+    /* Function  : static int disk_ring_listed(const int *fds, int count, int fd)
+     * Input     : fds - pointer to the files listed
+     *             count - number of files listed
+     *             fd - file looked for
+     * Output    : Returns 1 if fd is listed, 0 otherwise
+     * Procedure : This function looks a file up in the busy, chained or broken files of disk_ring_main. There are at most DISK_RING_ENTRIES of them, so they are simply scanned.
+     */
+
+    for (int i = 0; i < count; i++)
+    {
+        if (fds[i] == fd)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void disk_ring_requeue(DiskRequest **ready, DiskRequest **ready_tail, DiskRequest *request)
+{
+    /* Function  : static void disk_ring_requeue(DiskRequest **ready, DiskRequest **ready_tail, DiskRequest *request)
+     * Input     : ready - pointer to the head of the requests of disk_ring_main waiting to be submitted
+     *             ready_tail - pointer to the last of them
+     *             request - pointer to a request with an operation left to submit
+     * Output    : None
+     * Procedure : This function puts a request back among those waiting to be submitted, ahead of every request of the same file queued after it, so the requests of a file keep the order they were queued in.
+     */
+
+    DiskRequest **link = ready;
+    while (*link != NULL && ((*link)->fd != request->fd || (*link)->sequence < request->sequence))
+    {
+        link = &(*link)->next;
+    }
+
+    request->next = *link;
+    *link = request;
+    if (request->next == NULL)
+    {
+        *ready_tail = request;
+    }
+}
+
+static void disk_ring_chain(DiskWriter *writer, DiskRequest **link)
+{
+    /* Function  : static void disk_ring_chain(DiskWriter *writer, DiskRequest **link)
+     * Input     : writer - pointer to the DiskWriter
+     *             link - pointer to the link to the first waiting request of a file with nothing in flight
+     * Output    : None
+     * Procedure : This function submits the waiting requests of one file, from the one at link on, as a single chain of consecutive entries linked with IOSQE_IO_LINK, so the kernel starts each one when the one before it is done, while the chains of other files run beside it. A preallocation is hard linked, as a failed one must not stop the writes behind it. The chain ends with a commit, whose next step is only submitted once this one completes, or when the ring is full; the requests left wait for the chain to complete. A request whose cancel flag is set when it comes up fails without being submitted, except that a commit still closes its file. The chained requests are taken out of the waiting list, whose tail the caller finds again.
+     */
+
+    int fd = (*link)->fd;
+    struct io_uring_sqe *previous = NULL;
+    DiskOperation previous_operation = DISK_WRITE;
+
+    while (*link != NULL && writer->in_flight < DISK_RING_ENTRIES - 1)
+    {
+        DiskRequest *request = *link;
+        if (request->fd != fd)
+        {
+            link = &request->next;
+            continue;
+        }
+
+        *link = request->next;
+        request->next = NULL;
+
+        if (request->cancel != NULL && RN_ATOMIC_LOAD(*request->cancel) && request->written == 0 && request->stage == DISK_STAGE_SYNC && request->result == 0)
+        {
+            if (!disk_ring_advance(request, -ECANCELED))
+            {
+                disk_complete(writer, request);
+                continue;
+            }
+        }
+
+        struct io_uring_sqe *sqe = disk_ring_prepare(writer, request);
+        writer->busy[writer->in_flight++] = fd;
+        if (request->operation == DISK_COMMIT && request->stage == DISK_STAGE_SYNC)
+        {
+            writer->sync_fds[writer->syncs++] = fd;
+        }
+
+        if (previous != NULL)
+        {
+            previous->flags |= previous_operation == DISK_ALLOCATE ? IOSQE_IO_HARDLINK : IOSQE_IO_LINK;
+        }
+        previous = sqe;
+        previous_operation = request->operation;
+
+        if (request->operation == DISK_COMMIT)
+        {
+            break;
+        }
+    }
+}
+
+static int disk_ring_shortest(DiskWriter *writer)
+{
+    /* Function  : static int disk_ring_shortest(DiskWriter *writer)
+     * Input     : writer - pointer to the DiskWriter, with operations in flight
+     * Output    : Returns the operations in flight of the file that has the fewest
+     * Procedure : This function gives the completions the thread of the ring can wait for before any chain in flight can be over. There are at most DISK_RING_ENTRIES operations in flight, so they are simply counted.
+     */
+
+    int shortest = writer->in_flight;
+
+    for (int i = 0; i < writer->in_flight; i++)
+    {
+        int count = 0;
+        for (int j = 0; j < writer->in_flight; j++)
+        {
+            count += writer->busy[j] == writer->busy[i];
+        }
+        if (count < shortest)
+        {
+            shortest = count;
+        }
+    }
+
+    return shortest > 0 ? shortest : 1;
+}
+
+static int disk_ring_syncing(DiskWriter *writer)
+{
+    /* Function  : static int disk_ring_syncing(DiskWriter *writer)
+     * Input     : writer - pointer to the DiskWriter
+     * Output    : Returns 1 if an fsync may be running, 0 otherwise
+     * Procedure : This function tells whether the next completion of the ring may be a long time coming: an fsync is only started once the rest of its chain is done, so it is running when it is the last operation its file has in flight.
+     */
+
+    for (int i = 0; i < writer->syncs; i++)
+    {
+        int count = 0;
+        for (int j = 0; j < writer->in_flight; j++)
+        {
+            count += writer->busy[j] == writer->sync_fds[i];
+        }
+        if (count == 1)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int disk_ring_files(DiskWriter *writer)
+{
+    /* Function  : static int disk_ring_files(DiskWriter *writer)
+     * Input     : writer - pointer to the DiskWriter
+     * Output    : Returns the number of files with operations in flight
+     * Procedure : This function counts the files of the chains in flight, each once. There are at most DISK_RING_ENTRIES operations in flight, so they are simply scanned.
+     */
+
+    int files = 0;
+
+    for (int i = 0; i < writer->in_flight; i++)
+    {
+        files += !disk_ring_listed(writer->busy, i, writer->busy[i]);
+    }
+
+    return files;
+}
+
+static void disk_ring_wake(DiskWriter *writer)
+{
+    /* Function  : static void disk_ring_wake(DiskWriter *writer)
+     * Input     : writer - pointer to the DiskWriter
+     * Output    : None
+     * Procedure : This function wakes the thread of the ring up from its wait by writing the eventfd its armed read waits on.
+     */
+
+    uint64_t value = 1;
+    if (write(writer->wake_fd, &value, sizeof(value)) < 0)
+    {
+        // The counter is already non-zero, the thread will wake up anyway
+    }
+}
+
+static void disk_ring_main(void *argument)
+{
+    /* Function  : static void disk_ring_main(void *argument)
+     * Input     : argument - pointer to the DiskWriter
+     * Output    : None
+     * Procedure : This function is the thread owning the ring. Every turn it takes all the queued requests and submits those of every file with nothing in flight as one linked chain (see disk_ring_chain), then makes one io_uring_enter that submits them all and, when there is nothing else to do, waits for a completion. A read is kept armed on the eventfd, so queueing a request wakes it up from that wait. With chains in flight and nothing queued it gathers instead: the call waits for every chain and for as many requests as there are files in flight (up to DISK_RING_BATCH) to be queued, for at most DISK_RING_BATCH_US (only for the chains while a thread waits for its requests, see disk_hurry), so the next turn submits the buffers of every file written meanwhile together. The requests of a file are carried out in the order they were queued: those arriving while its chain is in flight wait for the next turn after it completes, and so do requests beyond what the ring holds. The next step of a request goes back ahead of the requests of its file queued after it. A short write breaks its chain and the kernel cancels the rest; once the chain is over the cancelled requests are queued again, behind the rest of the write. When a chain is broken by a failure instead, its cancelled requests fail with -ECANCELED. It returns once the writer is stopping and nothing is left in flight.
+     */
+
+    DiskWriter *writer = (DiskWriter *)argument;
+    DiskRequest *ready = NULL; // Requests with an operation to submit, in order
+    DiskRequest *ready_tail = NULL;
+    DiskRequest *cancelled = NULL; // Requests cancelled with their chain, until the chain is over
+    int broken[DISK_RING_ENTRIES]; // Files whose chain in flight was broken by a short write
+    int broken_count = 0;
+    long calls = 0;
+
+    while (1)
+    {
+        rn_mutex_lock(&writer->lock);
+        if (writer->queue != NULL)
+        {
+            if (ready_tail != NULL)
+            {
+                ready_tail->next = writer->queue;
+            }
+            else
+            {
+                ready = writer->queue;
+            }
+            ready_tail = writer->queue_tail;
+            writer->queue = NULL;
+            writer->queue_tail = NULL;
+        }
+        writer->calls += calls;
+        calls = 0;
+        writer->sleeping = 0;
+        writer->gathering = 0;
+        writer->gathered = 0;
+        int stop = writer->stopping && ready == NULL && writer->in_flight == 0;
+        rn_mutex_unlock(&writer->lock);
+
+        if (stop)
+        {
+            break;
+        }
+
+        // One chain for every file without one in flight; the requests of the others stay in ready, in order
+        DiskRequest **link = &ready;
+        while (*link != NULL && writer->in_flight < DISK_RING_ENTRIES - 1)
+        {
+            if (disk_ring_listed(writer->busy, writer->in_flight, (*link)->fd))
+            {
+                link = &(*link)->next;
+                continue;
+            }
+            disk_ring_chain(writer, link);
+        }
+
+        ready_tail = NULL;
+        for (DiskRequest *request = ready; request != NULL; request = request->next)
+        {
+            ready_tail = request;
+        }
+
+        if (!writer->wake_armed)
+        {
+            disk_ring_prepare(writer, NULL);
+            writer->wake_armed = 1;
+        }
+
+        // Wait when what is left waits for a free entry or a busy file, or when nothing was queued in the
+        // meantime. Requests queued during the wait are picked up after the next completion, as long as that
+        // comes soon: with nothing in flight, or an fsync that may take a while, a new request wakes the thread
+        // up through the eventfd instead, unless the ring is full and it couldn't be submitted anyway. Waiting
+        // for a single completion only makes sense when it lets something new in: with every file left busy
+        // the wait lasts until a chain can be over, and with the ring full until a quarter of it is free
+        int full = writer->in_flight >= DISK_RING_ENTRIES - 1;
+        unsigned wait = ready != NULL ? 1 : 0;
+        rn_mutex_lock(&writer->lock);
+        if (writer->queue == NULL)
+        {
+            writer->sleeping = !full && (writer->in_flight == 0 || disk_ring_syncing(writer));
+            wait = 1;
+        }
+        if (writer->queue == NULL && !writer->sleeping && ready != NULL)
+        {
+            wait = full ? DISK_RING_ENTRIES / 4 : (unsigned)disk_ring_shortest(writer);
+        }
+        // Downloads queue their buffers one at a time, so a turn per completion would submit one request per
+        // io_uring_enter. With chains in flight and nothing queued, the turn rather gathers: it waits for every
+        // chain in flight and for the wake read, which fires once a request per file in flight is queued, for at
+        // most DISK_RING_BATCH_US. A thread waiting for its requests won't queue more, so while one does (see
+        // disk_hurry) the turn only waits for the chains. The next turn then submits the requests of every file at
+        // once; a single download still has its next buffer submitted as soon as it is queued. A commit in flight
+        // is waited for like before, as finished downloads wait for their final name
+        int gather = writer->batch_wait && !full && writer->queue == NULL && writer->in_flight > 0 && writer->syncs == 0;
+        if (gather)
+        {
+            int files = disk_ring_files(writer);
+            writer->sleeping = 0;
+            writer->gathering = files < DISK_RING_BATCH ? files : DISK_RING_BATCH;
+            wait = (unsigned)writer->in_flight + (writer->waiters == 0 ? 1 : 0);
+        }
+        rn_mutex_unlock(&writer->lock);
+
+        struct __kernel_timespec timeout = {0, DISK_RING_BATCH_US * 1000L};
+        struct io_uring_getevents_arg deadline = {0, 0, 0, (uint64_t)(uintptr_t)&timeout};
+        unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+        if (gather)
+        {
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+
+        // Everything the kernel hasn't taken yet, in case an earlier call was interrupted
+        unsigned to_submit = *writer->sq_tail - __atomic_load_n(writer->sq_head, __ATOMIC_ACQUIRE);
+
+        if (syscall(__NR_io_uring_enter, writer->ring_fd, to_submit, wait, flags, gather ? (void *)&deadline : NULL, gather ? sizeof(deadline) : 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME)
+        {
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(errno));
+        }
+        calls++;
+
+        unsigned head = *writer->cq_head;
+        unsigned tail = __atomic_load_n(writer->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &writer->cqes[head & *writer->cq_mask];
+            DiskRequest *request = (DiskRequest *)(uintptr_t)cqe->user_data;
+            int result = cqe->res;
+            head++;
+
+            if (request == NULL)
+            {
+                writer->wake_armed = 0;
+                continue;
+            }
+
+            int fd = request->fd;
+            for (int i = 0; request->operation == DISK_COMMIT && request->stage == DISK_STAGE_SYNC && i < writer->syncs; i++)
+            {
+                if (writer->sync_fds[i] == fd)
+                {
+                    writer->sync_fds[i] = writer->sync_fds[--writer->syncs];
+                    break;
+                }
+            }
+            for (int i = 0; i < writer->in_flight; i++)
+            {
+                if (writer->busy[i] == fd)
+                {
+                    writer->busy[i] = writer->busy[--writer->in_flight];
+                    break;
+                }
+            }
+            int chained = disk_ring_listed(writer->busy, writer->in_flight, fd);
+
+            if (result == -ECANCELED)
+            {
+                // Settled once the chain is over, when it is known what broke it
+                request->next = cancelled;
+                cancelled = request;
+            }
+            else if (disk_ring_advance(request, result))
+            {
+                if (chained && request->operation == DISK_WRITE && !disk_ring_listed(broken, broken_count, fd))
+                {
+                    broken[broken_count++] = fd;
+                }
+                disk_ring_requeue(&ready, &ready_tail, request);
+            }
+            else
+            {
+                disk_complete(writer, request);
+            }
+
+            if (chained)
+            {
+                continue;
+            }
+
+            int short_write = 0;
+            for (int i = 0; i < broken_count; i++)
+            {
+                if (broken[i] == fd)
+                {
+                    broken[i] = broken[--broken_count];
+                    short_write = 1;
+                    break;
+                }
+            }
+
+            DiskRequest **from = &cancelled;
+            while (*from != NULL)
+            {
+                DiskRequest *again = *from;
+                if (again->fd != fd)
+                {
+                    from = &again->next;
+                    continue;
+                }
+
+                *from = again->next;
+                if (short_write || disk_ring_advance(again, -ECANCELED))
+                {
+                    disk_ring_requeue(&ready, &ready_tail, again);
+                }
+                else
+                {
+                    disk_complete(writer, again);
+                }
+            }
+        }
+
+        __atomic_store_n(writer->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    rn_mutex_lock(&writer->lock);
+    writer->calls += calls;
+    rn_mutex_unlock(&writer->lock);
+}
+#endif
+
+static void disk_run(void *argument)
+{
+    /* Function  : static void disk_run(void *argument)
+     * Input     : argument - pointer to the DiskRequest
+     * Output    : None
+     * Procedure : This function is the pool task carrying out a request without a ring, with one system call per step: positioned writes until the buffer is written, fallocate keeping the size of the file (Linux only, elsewhere the space isn't reserved), or fsync, rename and close for a commit. Errors are reported as negative errno values like the ring does.
+     */
+
+    DiskRequest *request = (DiskRequest *)argument;
+    DiskWriter *writer = request->writer;
+    long calls = 0;
+
+#ifndef _WIN32
+    if (request->operation == DISK_WRITE)
+    {
+        while (request->written < request->length)
+        {
+            ssize_t n = pwrite(request->fd, request->buffer + request->written, request->length - request->written, (off_t)(request->offset + request->written));
+            calls++;
+            if (n <= 0)
+            {
+                break;
+            }
+            request->written += (size_t)n;
+        }
+        request->result = request->written == request->length ? (long)request->written : -(long)EIO;
+    }
+    else if (request->operation == DISK_ALLOCATE)
+    {
+#if defined(__linux__) && defined(__LP64__)
+        request->result = syscall(SYS_fallocate, request->fd, FALLOC_FL_KEEP_SIZE, (off_t)request->offset, (off_t)request->length) == 0 ? 0 : -(long)errno;
+        calls++;
+#else
+        request->result = -(long)EOPNOTSUPP;
+#endif
+    }
+    else
+    {
+        // A file that may not be on disk doesn't get its final name
+        calls++;
+        if (fsync(request->fd) != 0)
+        {
+            request->result = -(long)errno;
+        }
+        else
+        {
+            calls++;
+            if (rename(request->path, request->target) != 0)
+            {
+                request->result = -(long)errno;
+            }
+        }
+
+        calls++;
+        if (close(request->fd) != 0 && request->result == 0)
+        {
+            request->result = -(long)errno;
+        }
+    }
+#endif
+
+    rn_mutex_lock(&writer->lock);
+    writer->calls += calls;
+    rn_mutex_unlock(&writer->lock);
+
+    disk_complete(writer, request);
+}
+
+static void disk_complete(DiskWriter *writer, DiskRequest *request)
+{
+    /* Function  : static void disk_complete(DiskWriter *writer, DiskRequest *request)
+     * Input     : writer - pointer to the DiskWriter
+     *             request - pointer to the completed request, which belongs to the caller again once done is called
+     * Output    : None
+     * Procedure : This function records the latency of a completed request and hands its result to its callback. The request only stops counting as pending after the callback has returned, so disk_wait also waits for the callbacks.
+     */
+
+    double elapsed = rn_clock() - request->submitted;
+    DiskOperation operation = request->operation;
+    long result = request->result;
+    DiskDoneFunction done = request->done;
+    void *userdata = request->userdata;
+
+    rn_mutex_lock(&writer->lock);
+    if (result < 0)
+    {
+        writer->failed++;
+    }
+    if (operation == DISK_WRITE)
+    {
+        writer->write_histogram[latency_bucket(elapsed)]++;
+        writer->writes++;
+        writer->bytes += result > 0 ? (double)result : 0.0;
+        if (elapsed > writer->write_max)
+        {
+            writer->write_max = elapsed;
+        }
+    }
+    else if (operation == DISK_COMMIT)
+    {
+        writer->commit_histogram[latency_bucket(elapsed)]++;
+        writer->commits++;
+        if (elapsed > writer->commit_max)
+        {
+            writer->commit_max = elapsed;
+        }
+    }
+    rn_mutex_unlock(&writer->lock);
+
+    if (done != NULL)
+    {
+        done(result, userdata);
+    }
+
+    rn_mutex_lock(&writer->lock);
+    if (--writer->pending == 0)
+    {
+        rn_cond_broadcast(&writer->idle);
+    }
+    rn_mutex_unlock(&writer->lock);
+}
+
+static void start_default_disk(void)
+{
+    /* Function  : static void start_default_disk(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function starts the default writer, on an io_uring unless ROCKNATION_IO_URING is set to 0, and registers its stop with atexit.
+     */
+
+    const char *env = getenv("ROCKNATION_IO_URING");
+    int use_ring = env == NULL || strcmp(env, "0") != 0;
+
+    if (disk_start(&rocknation_disk, use_ring) == 0)
+    {
+        atexit(stop_default_disk);
+    }
+}
+
+static void stop_default_disk(void)
+{
+    /* Function  : static void stop_default_disk(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function stops the default writer at exit, once every request queued so far has completed. Its lock is kept, so print_disk_stats can still run from a later exit handler.
+     */
+
+    disk_stop(&rocknation_disk);
+}
+
+RN_API int disk_start(DiskWriter *writer, int use_ring)
+{
+    /*
+     * Function  : int disk_start(DiskWriter *writer, int use_ring)
+     * Input     : writer - pointer to a zeroed DiskWriter
+     *             use_ring - non-zero to try an io_uring first
+     * Output    : Returns 0 on success, -1 if neither an io_uring nor the default pool can carry out the requests
+     * Procedure : This function sets up a writer: on Linux it tries to create an io_uring and start the thread owning it, otherwise (or if that fails) the requests will run on the default pool. There is no writer on Windows, where downloads write their buffers themselves.
+     */
+
+#ifdef _WIN32
+    (void)writer;
+    (void)use_ring;
+    return -1;
+#else
+    rn_mutex_init(&writer->lock);
+    rn_cond_init(&writer->idle);
+    writer->ring = 0;
+
+#ifdef DISK_URING
+    if (use_ring && disk_ring_setup(writer) == 0)
+    {
+        if (rn_thread_start(&writer->thread, disk_ring_main, writer) == 0)
+        {
+            writer->ring = 1;
+        }
+        else
+        {
+            disk_ring_teardown(writer);
+        }
+    }
+#else
+    (void)use_ring;
+#endif
+
+    if (!writer->ring)
+    {
+        writer->pool = get_pool();
+        if (writer->pool == NULL)
+        {
+            rn_cond_destroy(&writer->idle);
+            rn_mutex_destroy(&writer->lock);
+            return -1;
+        }
+    }
+
+    writer->running = 1;
+    return 0;
+#endif
+}
+
+RN_API void disk_stop(DiskWriter *writer)
+{
+    /*
+     * Function  : void disk_stop(DiskWriter *writer)
+     * Input     : writer - pointer to a started DiskWriter
+     * Output    : None
+     * Procedure : This function waits until every request queued so far has completed, then stops the thread of the ring and releases the ring. A writer on the pool has nothing else to stop.
+     */
+
+    if (!writer->running)
+    {
+        return;
+    }
+
+    disk_wait(writer);
+
+#ifdef DISK_URING
+    if (writer->ring)
+    {
+        rn_mutex_lock(&writer->lock);
+        writer->stopping = 1;
+        rn_mutex_unlock(&writer->lock);
+
+        uint64_t value = 1;
+        if (write(writer->wake_fd, &value, sizeof(value)) < 0)
+        {
+            // The counter is already non-zero, the thread will wake up anyway
+        }
+
+        rn_thread_join(writer->thread);
+        disk_ring_teardown(writer);
+    }
+#endif
+
+    rn_mutex_lock(&writer->lock);
+    writer->running = 0;
+    rn_mutex_unlock(&writer->lock);
+}
+
+RN_API DiskWriter *get_disk_writer(void)
+{
+    /*
+     * Function  : DiskWriter *get_disk_writer(void)
+     * Input     : None
+     * Output    : Returns a pointer to the default writer, or NULL if there is none
+     * Procedure : This function returns the writer shared by the whole process, starting it the first time. Like the pool, it can be used from any number of threads at once.
+     */
+
+    rn_once(&rocknation_disk_once, start_default_disk);
+
+    return rocknation_disk.running ? &rocknation_disk : NULL;
+}
+
+RN_API void disk_submit(DiskWriter *writer, DiskRequest *request)
+{
+    /*
+     * Function  : void disk_submit(DiskWriter *writer, DiskRequest *request)
+     * Input     : writer - pointer to a started DiskWriter
+     *             request - pointer to a request with operation, fd, done and the fields of its operation set; it must stay valid until done is called
+     * Output    : None
+     * Procedure : This function queues a request. With a ring it is appended to the queue taken by the next turn of its thread, which is woken through the eventfd only if it sleeps, or once enough requests are queued while it gathers (see disk_ring_main); otherwise it becomes a pool task, run on the calling thread if the pool can't take it. done is called exactly once, from the thread of the ring or a pool worker. The ring carries out the requests of a file one at a time, in the order they were queued, chaining those queued together (see disk_ring_main); pool tasks run side by side, so with the pool a file must only have one request queued at a time, as submit_file_request does for downloads. The cancel flag of a request is only read by the ring.
+     */
+
+    request->writer = writer;
+    request->written = 0;
+    request->stage = DISK_STAGE_SYNC;
+    request->result = 0;
+    request->submitted = rn_clock();
+    request->next = NULL;
+
+    rn_mutex_lock(&writer->lock);
+    writer->pending++;
+    writer->requests[request->operation]++;
+
+    if (!writer->ring)
+    {
+        rn_mutex_unlock(&writer->lock);
+        if (pool_submit(writer->pool, disk_run, request) != 0)
+        {
+            disk_run(request);
+        }
+        return;
+    }
+
+#ifdef DISK_URING
+    request->sequence = writer->sequence++;
+    if (writer->queue_tail != NULL)
+    {
+        writer->queue_tail->next = request;
+    }
+    else
+    {
+        writer->queue = request;
+    }
+    writer->queue_tail = request;
+
+    int wake = writer->sleeping || (writer->gathering > 0 && ++writer->gathered == writer->gathering);
+    writer->sleeping = 0;
+    if (wake)
+    {
+        writer->gathering = 0;
+    }
+    rn_mutex_unlock(&writer->lock);
+
+    if (wake)
+    {
+        disk_ring_wake(writer);
+    }
+#endif
+}
+
+RN_API void disk_hurry(DiskWriter *writer)
+{
+    /*
+     * Function  : void disk_hurry(DiskWriter *writer)
+     * Input     : writer - pointer to a started DiskWriter
+     * Output    : None
+     * Procedure : This function is called by a thread about to wait for requests it queued, and disk_hurry_done once the wait is over. Meanwhile the thread of the ring doesn't gather requests (see disk_ring_main), as the caller won't queue any more and the wait would last until the deadline; if it is gathering already, it is woken up to reap the completions and submit what is queued at once.
+     */
+
+#ifdef DISK_URING
+    if (!writer->ring)
+    {
+        return;
+    }
+
+    rn_mutex_lock(&writer->lock);
+    writer->waiters++;
+    int wake = writer->gathering > 0;
+    writer->gathering = 0;
+    rn_mutex_unlock(&writer->lock);
+
+    if (wake)
+    {
+        disk_ring_wake(writer);
+    }
+#else
+    (void)writer;
+#endif
+}
+
+RN_API void disk_hurry_done(DiskWriter *writer)
+{
+    /*
+     * Function  : void disk_hurry_done(DiskWriter *writer)
+     * Input     : writer - pointer to a started DiskWriter
+     * Output    : None
+     * Procedure : This function ends the wait started by disk_hurry, so the thread of the ring may gather requests again.
+     */
+
+#ifdef DISK_URING
+    if (!writer->ring)
+    {
+        return;
+    }
+
+    rn_mutex_lock(&writer->lock);
+    writer->waiters--;
+    rn_mutex_unlock(&writer->lock);
+#else
+    (void)writer;
+#endif
+}
+
+RN_API void disk_wait(DiskWriter *writer)
+{
+    /*
+     * Function  : void disk_wait(DiskWriter *writer)
+     * Input     : writer - pointer to a started DiskWriter
+     * Output    : None
+     * Procedure : This function waits until every request queued so far, by any thread, has completed and its callback has returned. It must not be called from a callback.
+     */
+
+    disk_hurry(writer);
+
+    rn_mutex_lock(&writer->lock);
+    while (writer->pending > 0)
+    {
+        rn_cond_wait(&writer->idle, &writer->lock);
+    }
+    rn_mutex_unlock(&writer->lock);
+
+    disk_hurry_done(writer);
+}
+
+RN_API void print_disk_stats(void)
+{
+    /*
+     * Function  : void print_disk_stats(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints to stderr what the default writer did: the writes, preallocations and commits it carried out, the system calls they took and how many failed, then the median, 99th percentile and maximum time from queueing a write to its completion, and from queueing a commit to the file having its final name. Percentiles come from power-of-two buckets, so they are upper bounds.
+     */
+
+    DiskWriter *writer = &rocknation_disk;
+    long total = 0;
+
+    if (!writer->ring && writer->pool == NULL)
+    {
+        return;
+    }
+
+    rn_mutex_lock(&writer->lock);
+
+    for (int i = 0; i < DISK_OPERATIONS; i++)
+    {
+        total += writer->requests[i];
+    }
+
+    if (total == 0)
+    {
+        rn_mutex_unlock(&writer->lock);
+        return;
+    }
+
+    fprintf(stderr, "[disk] %s: %ld writes (%.1f MB), %ld preallocations, %ld commits in %ld system calls (%.1f requests per call), %ld failed\n",
+            writer->ring ? "io_uring" : "pool", writer->requests[DISK_WRITE], writer->bytes / (1024.0 * 1024.0), writer->requests[DISK_ALLOCATE],
+            writer->requests[DISK_COMMIT], writer->calls, writer->calls > 0 ? (double)total / writer->calls : 0.0, writer->failed);
+    fprintf(stderr, "[disk] write p50 %.3f ms, p99 %.3f ms, max %.3f ms; commit p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            latency_percentile(writer->write_histogram, writer->writes, 0.5, writer->write_max) * 1000.0,
+            latency_percentile(writer->write_histogram, writer->writes, 0.99, writer->write_max) * 1000.0, writer->write_max * 1000.0,
+            latency_percentile(writer->commit_histogram, writer->commits, 0.5, writer->commit_max) * 1000.0,
+            latency_percentile(writer->commit_histogram, writer->commits, 0.99, writer->commit_max) * 1000.0, writer->commit_max * 1000.0);
+
+    rn_mutex_unlock(&writer->lock);
+}
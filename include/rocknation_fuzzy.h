@@ -0,0 +1,810 @@
+// rocknation_fuzzy.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_catalog.h"
+
+#define FUZZY_MAX_LENGTH 128      // Names are compared on their first bytes only
+#define FUZZY_MAX_GRAMS (FUZZY_MAX_LENGTH + 2)
+#define FUZZY_CANDIDATES 256      // Best trigram matches reranked by edit distance
+#define FUZZY_INITIAL_ENTRIES 1024
+#define FUZZY_INITIAL_SLOTS 4096
+
+typedef struct
+{
+    int band_id;
+    uint32_t name;   // Normalized name in the string pool of the index
+    uint16_t length; // Length of the normalized name
+    uint16_t grams;  // Distinct trigrams of the normalized name
+    int dead;        // Replaced by a newer entry for the same band
+} BandIndexEntry;
+
+typedef struct
+{
+    uint32_t gram;     // Three bytes of a normalized name
+    uint32_t *entries; // Entries containing the trigram, in the order they were added
+    uint32_t count;
+    uint32_t capacity;
+} TrigramPostings;
+
+// Trigram index over band names for fuzzy, typo-tolerant search. Names are normalized
+// (lowercase, punctuation folded to spaces) and split into overlapping three-byte grams,
+// padded so that the start of a name is its own gram and prefixes match too.
+typedef struct
+{
+    StringPool names;
+    BandIndexEntry *entries;
+    int count;
+    int capacity;
+    TrigramPostings *postings;
+    int posting_count;
+    int posting_capacity;
+    uint32_t *gram_slots;  // Open-addressing hash table of posting index + 1, 0 when empty
+    size_t gram_slot_count;
+    uint32_t *id_slots;    // Open-addressing hash table of the latest entry of a band + 1
+    size_t id_slot_count;
+    int id_used;
+    uint16_t *hits;        // Per-entry scratch counters of a query, all zero between queries
+    uint32_t *touched;     // Entries whose counter a query raised
+    int scratch_capacity;
+} BandIndex;
+
+typedef struct
+{
+    int band_id;
+    int distance; // Edit distance between the normalized query and name
+    double score; // Higher is better
+} FuzzyMatch;
+
+RN_API void band_index_init(BandIndex *index);
+RN_API void band_index_free(BandIndex *index);
+RN_API size_t fuzzy_normalize(const char *text, size_t length, char *dest, size_t dest_size);
+static int fuzzy_trigrams(const char *name, size_t length, uint32_t *grams);
+static TrigramPostings *band_index_postings(BandIndex *index, uint32_t gram, int create);
+static int band_index_entry(const BandIndex *index, int band_id);
+static int band_index_set_entry(BandIndex *index, int band_id, int entry);
+RN_API int band_index_add(BandIndex *index, int band_id, const char *name);
+static int fuzzy_distance(const char *a, size_t a_length, const char *b, size_t b_length, int limit);
+static void fuzzy_sift_down(FuzzyMatch *heap, int count, int position);
+static int fuzzy_compare_postings(const void *a, const void *b);
+static int fuzzy_compare_matches(const void *a, const void *b);
+RN_API int band_index_search(BandIndex *index, const char *query, FuzzyMatch *matches, int k);
+
+RN_API void band_index_init(BandIndex *index)
+{
+    /*
+     * Function  : void band_index_init(BandIndex *index)
+     * Input     : index - pointer to the BandIndex structure to initialize
+     * Output    : None
+     * Procedure : This function prepares an empty band index. Nothing is allocated until the first name is added.
+     */
+
+    memset(index, 0, sizeof(*index));
+    string_pool_init(&index->names);
+}
+
+RN_API void band_index_free(BandIndex *index)
+{
+    /*
+     * Function  : void band_index_free(BandIndex *index)
+     * Input     : index - pointer to the BandIndex structure to release
+     * Output    : None
+     * Procedure : This function releases the names, postings and hash tables of the index and leaves it empty.
+     */
+
+    string_pool_free(&index->names);
+    for (int i = 0; i < index->posting_count; i++)
+    {
+        free(index->postings[i].entries);
+    }
+    free(index->entries);
+    free(index->postings);
+    free(index->gram_slots);
+    free(index->id_slots);
+    free(index->hits);
+    free(index->touched);
+    band_index_init(index);
+}
+
+RN_API size_t fuzzy_normalize(const char *text, size_t length, char *dest, size_t dest_size)
+{
+    /*
+     * Function  : size_t fuzzy_normalize(const char *text, size_t length, char *dest, size_t dest_size)
+     * Input     : text - pointer to a band name or query
+     *             length - length of the text
+     *             dest - pointer to the buffer receiving the normalized text
+     *             dest_size - size of the buffer
+     * Output    : Returns the length of the normalized text written to dest
+     * Procedure : This function brings a name into the form the index compares: ASCII letters and Cyrillic capitals are lowercased, runs of ASCII punctuation and spaces become a single space, and other bytes (the rest of UTF-8) are kept as they are, so "AC/DC" and "ac dc" are the same name.
+     */
+
+    size_t used = 0;
+    int space = 1; // Drops leading spaces
+
+    for (size_t i = 0; i < length && used + 2 < dest_size; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+
+        if (c < 0x80)
+        {
+            if (isalnum(c))
+            {
+                dest[used++] = (char)tolower(c);
+                space = 0;
+            }
+            else if (!space)
+            {
+                dest[used++] = ' ';
+                space = 1;
+            }
+            continue;
+        }
+
+        if (c == 0xD0 && i + 1 < length)
+        {
+            unsigned char next = (unsigned char)text[i + 1];
+            if (next >= 0x90 && next <= 0x9F) // А-П
+            {
+                dest[used++] = (char)0xD0;
+                dest[used++] = (char)(next + 0x20);
+            }
+            else if (next >= 0xA0 && next <= 0xAF) // Р-Я
+            {
+                dest[used++] = (char)0xD1;
+                dest[used++] = (char)(next - 0x20);
+            }
+            else if (next == 0x81) // Ё
+            {
+                dest[used++] = (char)0xD1;
+                dest[used++] = (char)0x91;
+            }
+            else
+            {
+                dest[used++] = (char)c;
+                dest[used++] = (char)next;
+            }
+            i++;
+        }
+        else
+        {
+            dest[used++] = (char)c;
+        }
+        space = 0;
+    }
+
+    if (used > 0 && dest[used - 1] == ' ')
+    {
+        used--;
+    }
+    dest[used] = '\0';
+
+    return used;
+}
+
+static int fuzzy_trigrams(const char *name, size_t length, uint32_t *grams)
+{
+    /* Function  : static int fuzzy_trigrams(const char *name, size_t length, uint32_t *grams)
+     * Input     : name - pointer to a normalized name, at most FUZZY_MAX_LENGTH bytes
+     *             length - length of the name
+     *             grams - pointer to room for FUZZY_MAX_GRAMS trigrams
+     * Output    : Returns the number of distinct trigrams written to grams
+     * Procedure : This function splits a name, padded with two spaces in front and one behind, into its distinct three-byte grams. The padding makes "  i" and " ir" grams of "iron", so a query matches the start of a name more strongly than the middle.
+     */
+
+    int count = 0;
+
+    for (size_t i = 0; i + 2 < length + 3; i++)
+    {
+        uint32_t gram = 0;
+        for (size_t j = i; j < i + 3; j++)
+        {
+            unsigned char c = j >= 2 && j - 2 < length ? (unsigned char)name[j - 2] : ' ';
+            gram = (gram << 8) | c;
+        }
+
+        int seen = 0;
+        for (int j = 0; j < count && !seen; j++)
+        {
+            seen = grams[j] == gram;
+        }
+        if (!seen)
+        {
+            grams[count++] = gram;
+        }
+    }
+
+    return count;
+}
+
+static TrigramPostings *band_index_postings(BandIndex *index, uint32_t gram, int create)
+{
+    /* Function  : static TrigramPostings *band_index_postings(BandIndex *index, uint32_t gram, int create)
+     * Input     : index - pointer to the BandIndex structure
+     *             gram - trigram to look up
+     *             create - add an empty posting list if the trigram has none yet
+     * Output    : Returns the posting list of the trigram, or NULL
+     * Procedure : This function finds the entries containing a trigram through an open-addressing hash table, rebuilding the table twice as big when it would be more than half full.
+     */
+
+    if (create && (size_t)(index->posting_count + 1) * 2 > index->gram_slot_count)
+    {
+        size_t slot_count = index->gram_slot_count > 0 ? index->gram_slot_count * 2 : FUZZY_INITIAL_SLOTS;
+        uint32_t *slots = rn_calloc(slot_count, sizeof(uint32_t));
+        if (slots == NULL)
+        {
+            return NULL;
+        }
+
+        for (int i = 0; i < index->posting_count; i++)
+        {
+            size_t slot = (index->postings[i].gram * 2654435761u) & (slot_count - 1);
+            while (slots[slot] != 0)
+            {
+                slot = (slot + 1) & (slot_count - 1);
+            }
+            slots[slot] = (uint32_t)i + 1;
+        }
+
+        free(index->gram_slots);
+        index->gram_slots = slots;
+        index->gram_slot_count = slot_count;
+    }
+
+    if (index->gram_slot_count == 0)
+    {
+        return NULL;
+    }
+
+    size_t slot = (gram * 2654435761u) & (index->gram_slot_count - 1);
+    while (index->gram_slots[slot] != 0)
+    {
+        TrigramPostings *postings = &index->postings[index->gram_slots[slot] - 1];
+        if (postings->gram == gram)
+        {
+            return postings;
+        }
+        slot = (slot + 1) & (index->gram_slot_count - 1);
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    if (index->posting_count == index->posting_capacity)
+    {
+        int capacity = index->posting_capacity > 0 ? index->posting_capacity * 2 : FUZZY_INITIAL_SLOTS / 2;
+        TrigramPostings *grown = rn_realloc(index->postings, capacity * sizeof(TrigramPostings));
+        if (grown == NULL)
+        {
+            return NULL;
+        }
+        index->postings = grown;
+        index->posting_capacity = capacity;
+    }
+
+    TrigramPostings *postings = &index->postings[index->posting_count];
+    postings->gram = gram;
+    postings->entries = NULL;
+    postings->count = 0;
+    postings->capacity = 0;
+    index->gram_slots[slot] = (uint32_t)++index->posting_count;
+
+    return postings;
+}
+
+static int band_index_entry(const BandIndex *index, int band_id)
+{
+    /* Function  : static int band_index_entry(const BandIndex *index, int band_id)
+     * Input     : index - pointer to the BandIndex structure
+     *             band_id - id of a band
+     * Output    : Returns the latest entry of the band, or -1
+     * Procedure : This function looks a band up in the id hash table of the index.
+     */
+
+    if (index->id_slot_count == 0)
+    {
+        return -1;
+    }
+
+    size_t slot = ((unsigned)band_id * 2654435761u) & (index->id_slot_count - 1);
+    while (index->id_slots[slot] != 0)
+    {
+        int entry = (int)index->id_slots[slot] - 1;
+        if (index->entries[entry].band_id == band_id)
+        {
+            return entry;
+        }
+        slot = (slot + 1) & (index->id_slot_count - 1);
+    }
+
+    return -1;
+}
+
+static int band_index_set_entry(BandIndex *index, int band_id, int entry)
+{
+    /* Function  : static int band_index_set_entry(BandIndex *index, int band_id, int entry)
+     * Input     : index - pointer to the BandIndex structure
+     *             band_id - id of a band
+     *             entry - new latest entry of the band, already in entries
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function points the id hash table at the latest entry of a band, growing the table when it would be more than half full.
+     */
+
+    if ((size_t)(index->id_used + 1) * 2 > index->id_slot_count)
+    {
+        size_t slot_count = index->id_slot_count > 0 ? index->id_slot_count * 2 : FUZZY_INITIAL_SLOTS;
+        uint32_t *slots = rn_calloc(slot_count, sizeof(uint32_t));
+        if (slots == NULL)
+        {
+            return -1;
+        }
+
+        for (size_t i = 0; i < index->id_slot_count; i++)
+        {
+            if (index->id_slots[i] == 0)
+            {
+                continue;
+            }
+            size_t slot = ((unsigned)index->entries[index->id_slots[i] - 1].band_id * 2654435761u) & (slot_count - 1);
+            while (slots[slot] != 0)
+            {
+                slot = (slot + 1) & (slot_count - 1);
+            }
+            slots[slot] = index->id_slots[i];
+        }
+
+        free(index->id_slots);
+        index->id_slots = slots;
+        index->id_slot_count = slot_count;
+    }
+
+    size_t slot = ((unsigned)band_id * 2654435761u) & (index->id_slot_count - 1);
+    while (index->id_slots[slot] != 0 && index->entries[index->id_slots[slot] - 1].band_id != band_id)
+    {
+        slot = (slot + 1) & (index->id_slot_count - 1);
+    }
+
+    if (index->id_slots[slot] == 0)
+    {
+        index->id_used++;
+    }
+    index->id_slots[slot] = (uint32_t)entry + 1;
+
+    return 0;
+}
+
+RN_API int band_index_add(BandIndex *index, int band_id, const char *name)
+{
+    /*
+     * Function  : int band_index_add(BandIndex *index, int band_id, const char *name)
+     * Input     : index - pointer to the BandIndex structure
+     *             band_id - id of the band
+     *             name - pointer to the name of the band
+     * Output    : Returns 0 on success (or if the band is already indexed under that name), -1 on failure
+     * Procedure : This function adds a band to the index as it is discovered: its normalized name is stored and appended to the posting list of each of its trigrams. A band indexed before under another name gets a new entry and the old one is marked dead, so searches skip it.
+     */
+
+    char normalized[FUZZY_MAX_LENGTH + 1];
+    size_t length = fuzzy_normalize(name, strlen(name), normalized, sizeof(normalized));
+
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    int previous = band_index_entry(index, band_id);
+    if (previous >= 0)
+    {
+        const BandIndexEntry *old = &index->entries[previous];
+        if (old->length == length && memcmp(index->names.text + old->name, normalized, length) == 0)
+        {
+            return 0;
+        }
+    }
+
+    if (index->count == index->capacity)
+    {
+        int capacity = index->capacity > 0 ? index->capacity * 2 : FUZZY_INITIAL_ENTRIES;
+        BandIndexEntry *grown = rn_realloc(index->entries, capacity * sizeof(BandIndexEntry));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        index->entries = grown;
+        index->capacity = capacity;
+    }
+
+    uint32_t grams[FUZZY_MAX_GRAMS];
+    int gram_count = fuzzy_trigrams(normalized, length, grams);
+    BandIndexEntry *entry = &index->entries[index->count];
+
+    if (string_pool_add(&index->names, normalized, length, &entry->name) != 0)
+    {
+        return -1;
+    }
+    entry->band_id = band_id;
+    entry->length = (uint16_t)length;
+    entry->grams = (uint16_t)gram_count;
+    entry->dead = 0;
+
+    for (int i = 0; i < gram_count; i++)
+    {
+        TrigramPostings *postings = band_index_postings(index, grams[i], 1);
+        if (postings == NULL)
+        {
+            return -1;
+        }
+
+        if (postings->count == postings->capacity)
+        {
+            uint32_t capacity = postings->capacity > 0 ? postings->capacity * 2 : 4;
+            uint32_t *grown = rn_realloc(postings->entries, capacity * sizeof(uint32_t));
+            if (grown == NULL)
+            {
+                return -1;
+            }
+            postings->entries = grown;
+            postings->capacity = capacity;
+        }
+        postings->entries[postings->count++] = (uint32_t)index->count;
+    }
+
+    if (band_index_set_entry(index, band_id, index->count) != 0)
+    {
+        return -1;
+    }
+    if (previous >= 0)
+    {
+        index->entries[previous].dead = 1;
+    }
+    index->count++;
+
+    return 0;
+}
+
+static int fuzzy_distance(const char *a, size_t a_length, const char *b, size_t b_length, int limit)
+{
+    /* Function  : static int fuzzy_distance(const char *a, size_t a_length, const char *b, size_t b_length, int limit)
+     * Input     : a, b - pointers to two normalized names, at most FUZZY_MAX_LENGTH bytes
+     *             a_length, b_length - their lengths
+     *             limit - largest distance the caller still cares about
+     * Output    : Returns the Levenshtein distance between the names, in bytes, or limit + 1 if it is larger than limit
+     * Procedure : This function computes the edit distance of two names with the two-row dynamic programming algorithm. The smallest value of a row never decreases from one row to the next, so it stops as soon as a whole row is above limit.
+     */
+
+    uint16_t previous[FUZZY_MAX_LENGTH + 1];
+    uint16_t current[FUZZY_MAX_LENGTH + 1];
+
+    for (size_t j = 0; j <= b_length; j++)
+    {
+        previous[j] = (uint16_t)j;
+    }
+
+    for (size_t i = 1; i <= a_length; i++)
+    {
+        uint16_t smallest = current[0] = (uint16_t)i;
+        for (size_t j = 1; j <= b_length; j++)
+        {
+            uint16_t substitute = previous[j - 1] + (a[i - 1] != b[j - 1]);
+            uint16_t remove = previous[j] + 1;
+            uint16_t insert = current[j - 1] + 1;
+            uint16_t best = substitute < remove ? substitute : remove;
+            current[j] = best < insert ? best : insert;
+            smallest = current[j] < smallest ? current[j] : smallest;
+        }
+        if (smallest > limit)
+        {
+            return limit + 1;
+        }
+        memcpy(previous, current, (b_length + 1) * sizeof(uint16_t));
+    }
+
+    return previous[b_length];
+}
+
+static void fuzzy_sift_down(FuzzyMatch *heap, int count, int position)
+{
+    /* Function  : static void fuzzy_sift_down(FuzzyMatch *heap, int count, int position)
+     * Input     : heap - pointer to a min-heap of candidates ordered by score
+     *             count - number of candidates in the heap
+     *             position - position of a candidate that may be bigger than its children
+     * Output    : None
+     * Procedure : This function restores the heap property below position, so the weakest candidate stays on top.
+     */
+
+    for (;;)
+    {
+        int smallest = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+
+        if (left < count && heap[left].score < heap[smallest].score)
+        {
+            smallest = left;
+        }
+        if (right < count && heap[right].score < heap[smallest].score)
+        {
+            smallest = right;
+        }
+        if (smallest == position)
+        {
+            return;
+        }
+
+        FuzzyMatch swap = heap[position];
+        heap[position] = heap[smallest];
+        heap[smallest] = swap;
+        position = smallest;
+    }
+}
+
+static int fuzzy_compare_postings(const void *a, const void *b)
+{
+    /* Function  : static int fuzzy_compare_postings(const void *a, const void *b)
+     * Input     : a, b - pointers to pointers to two posting lists
+     * Output    : Returns a negative, zero or positive value to sort the shorter list first
+     * Procedure : This function orders the posting lists of a query from the rarest trigram to the most common one.
+     */
+
+    uint32_t first = (*(const TrigramPostings *const *)a)->count;
+    uint32_t second = (*(const TrigramPostings *const *)b)->count;
+
+    return (first > second) - (first < second);
+}
+
+static int fuzzy_compare_matches(const void *a, const void *b)
+{
+    /* Function  : static int fuzzy_compare_matches(const void *a, const void *b)
+     * Input     : a, b - pointers to two matches
+     * Output    : Returns a negative, zero or positive value to sort the better match first
+     * Procedure : This function orders matches by score, then by edit distance and band id so the order is stable.
+     */
+
+    const FuzzyMatch *first = (const FuzzyMatch *)a;
+    const FuzzyMatch *second = (const FuzzyMatch *)b;
+
+    if (first->score != second->score)
+    {
+        return first->score > second->score ? -1 : 1;
+    }
+    if (first->distance != second->distance)
+    {
+        return first->distance - second->distance;
+    }
+
+    return (first->band_id > second->band_id) - (first->band_id < second->band_id);
+}
+
+RN_API int band_index_search(BandIndex *index, const char *query, FuzzyMatch *matches, int k)
+{
+    /*
+     * Function  : int band_index_search(BandIndex *index, const char *query, FuzzyMatch *matches, int k)
+     * Input     : index - pointer to the BandIndex structure
+     *             query - pointer to the (possibly misspelled or partial) band name
+     *             matches - pointer to room for k matches
+     *             k - maximum number of matches
+     * Output    : Returns the number of matches written to matches, best first, or -1 on failure
+     * Procedure : This function ranks the indexed bands against a query. Shared trigrams are counted from the query's posting lists: the rarest lists, which hold every name sharing at least a third of the query, bring in the candidates and the most common ones are only probed for them, so a common trigram like " th" costs little. The FUZZY_CANDIDATES candidates with the highest trigram similarity (Jaccard) are kept in a min-heap and reranked by a mix of trigram similarity and edit distance, with a bonus for names starting with the query, and the best k are returned. If the rarest lists bring in fewer than k names, every name sharing a trigram is considered instead.
+     */
+
+    char normalized[FUZZY_MAX_LENGTH + 1];
+    size_t length = fuzzy_normalize(query, strlen(query), normalized, sizeof(normalized));
+
+    if (length == 0 || k <= 0 || index->count == 0)
+    {
+        return 0;
+    }
+
+    if (index->scratch_capacity < index->count)
+    {
+        int capacity = index->capacity;
+        uint16_t *hits = rn_realloc(index->hits, capacity * sizeof(uint16_t));
+        if (hits != NULL)
+        {
+            index->hits = hits;
+        }
+        uint32_t *touched = rn_realloc(index->touched, capacity * sizeof(uint32_t));
+        if (touched != NULL)
+        {
+            index->touched = touched;
+        }
+        if (hits == NULL || touched == NULL)
+        {
+            return -1;
+        }
+        memset(index->hits + index->scratch_capacity, 0, (capacity - index->scratch_capacity) * sizeof(uint16_t));
+        index->scratch_capacity = capacity;
+    }
+
+    uint32_t grams[FUZZY_MAX_GRAMS];
+    const TrigramPostings *lists[FUZZY_MAX_GRAMS];
+    int gram_count = fuzzy_trigrams(normalized, length, grams);
+    int list_count = 0;
+
+    for (int i = 0; i < gram_count; i++)
+    {
+        const TrigramPostings *postings = band_index_postings(index, grams[i], 0);
+        if (postings != NULL)
+        {
+            lists[list_count++] = postings;
+        }
+    }
+    qsort(lists, list_count, sizeof(lists[0]), fuzzy_compare_postings);
+
+    FuzzyMatch heap[FUZZY_CANDIDATES];
+    int heap_count = 0;
+    int threshold = gram_count > 3 ? (gram_count + 2) / 3 : 1;
+
+    for (;;)
+    {
+        // A name sharing threshold grams with the query is in at least one of the shortest
+        // list_count - threshold + 1 lists, so only those bring in candidates
+        int seed_count = list_count - threshold + 1;
+        int touched_count = 0;
+
+        for (int i = 0; i < seed_count; i++)
+        {
+            for (uint32_t j = 0; j < lists[i]->count; j++)
+            {
+                uint32_t entry = lists[i]->entries[j];
+                if (index->hits[entry]++ == 0)
+                {
+                    index->touched[touched_count++] = entry;
+                }
+            }
+        }
+
+        // The longest lists only add to the counts of candidates already seen. Entries are
+        // appended in order, so a list is sorted and can be probed by binary search.
+        for (int i = seed_count > 0 ? seed_count : list_count; i < list_count; i++)
+        {
+            const TrigramPostings *postings = lists[i];
+
+            if ((size_t)touched_count * 16 < postings->count)
+            {
+                for (int j = 0; j < touched_count; j++)
+                {
+                    uint32_t entry = index->touched[j];
+                    uint32_t low = 0;
+                    uint32_t high = postings->count;
+                    while (low < high)
+                    {
+                        uint32_t middle = low + (high - low) / 2;
+                        if (postings->entries[middle] < entry)
+                        {
+                            low = middle + 1;
+                        }
+                        else
+                        {
+                            high = middle;
+                        }
+                    }
+                    index->hits[entry] += low < postings->count && postings->entries[low] == entry;
+                }
+            }
+            else
+            {
+                for (uint32_t j = 0; j < postings->count; j++)
+                {
+                    uint32_t entry = postings->entries[j];
+                    index->hits[entry] += index->hits[entry] != 0;
+                }
+            }
+        }
+
+        heap_count = 0;
+        for (int i = 0; i < touched_count; i++)
+        {
+            uint32_t entry = index->touched[i];
+            int shared = index->hits[entry];
+            index->hits[entry] = 0;
+
+            // Every name brought in is ranked, whether it shares threshold grams or not, so a query shared by
+            // few names doesn't need another pass. A name has at least the grams it shares, so it scores at most
+            // shared / gram_count: once the heap is full, most names are dropped without reading their entry
+            if ((heap_count == FUZZY_CANDIDATES && shared <= heap[0].score * gram_count) || index->entries[entry].dead)
+            {
+                continue;
+            }
+
+            FuzzyMatch candidate;
+            candidate.band_id = (int)entry; // Entry for now, the band id is filled in after reranking
+            candidate.distance = 0;
+            candidate.score = (double)shared / (gram_count + index->entries[entry].grams - shared);
+
+            if (heap_count < FUZZY_CANDIDATES)
+            {
+                // Build the heap bottom-up once it is full
+                heap[heap_count++] = candidate;
+                if (heap_count == FUZZY_CANDIDATES)
+                {
+                    for (int j = FUZZY_CANDIDATES / 2 - 1; j >= 0; j--)
+                    {
+                        fuzzy_sift_down(heap, heap_count, j);
+                    }
+                }
+            }
+            else if (candidate.score > heap[0].score)
+            {
+                heap[0] = candidate;
+                fuzzy_sift_down(heap, heap_count, 0);
+            }
+        }
+
+        // Fewer than k names in the rarest lists: take anything sharing a trigram
+        if (heap_count >= k || threshold == 1)
+        {
+            break;
+        }
+        threshold = 1;
+    }
+
+    // Rerank the most similar names first: once k names are reranked, a name that can't score as
+    // well as the k-th best is dropped, at the latest when its edit distance grows past what it can afford
+    qsort(heap, heap_count, sizeof(FuzzyMatch), fuzzy_compare_matches);
+
+    FuzzyMatch best[FUZZY_CANDIDATES]; // Min-heap of the best k scores so far
+    int best_size = k < FUZZY_CANDIDATES ? k : FUZZY_CANDIDATES;
+    int best_count = 0;
+    int kept = 0;
+
+    for (int i = 0; i < heap_count; i++)
+    {
+        const BandIndexEntry *entry = &index->entries[heap[i].band_id];
+        const char *name = index->names.text + entry->name;
+        double similarity = heap[i].score;
+        double longest = (double)(length > entry->length ? length : entry->length);
+        double bonus = entry->length >= length && memcmp(name, normalized, length) == 0 ? 0.25 : 0.0;
+        int limit = (int)longest;
+
+        if (best_count == best_size)
+        {
+            // Largest distance still scoring as well as the k-th best, plus one for rounding
+            double room = (1.0 - 2.0 * (best[0].score - 0.5 * similarity - bonus)) * longest;
+            if (room < -1.0)
+            {
+                continue;
+            }
+            limit = room < longest ? (int)room + 1 : limit;
+        }
+        if ((length > entry->length ? length - entry->length : entry->length - length) > (size_t)limit)
+        {
+            continue;
+        }
+
+        int distance = fuzzy_distance(normalized, length, name, entry->length, limit);
+        if (distance > limit)
+        {
+            continue;
+        }
+
+        FuzzyMatch *match = &heap[kept++];
+        match->band_id = entry->band_id;
+        match->distance = distance;
+        match->score = 0.5 * similarity + 0.5 * (1.0 - distance / longest) + bonus;
+
+        if (best_count < best_size)
+        {
+            best[best_count++] = *match;
+            if (best_count == best_size)
+            {
+                for (int j = best_size / 2 - 1; j >= 0; j--)
+                {
+                    fuzzy_sift_down(best, best_count, j);
+                }
+            }
+        }
+        else if (match->score > best[0].score)
+        {
+            best[0] = *match;
+            fuzzy_sift_down(best, best_count, 0);
+        }
+    }
+
+    qsort(heap, kept, sizeof(FuzzyMatch), fuzzy_compare_matches);
+
+    int count = kept < k ? kept : k;
+    memcpy(matches, heap, count * sizeof(FuzzyMatch));
+
+    return count;
+}
@@ -0,0 +1,1120 @@
+// rocknation_loop.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_utils.h"
+#include "rocknation_curl.h"
+
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define LOOP_EPOLL
+#endif
+
+#define LOOP_MAX_EVENTS 64 // Socket events handled per turn of the loop
+
+/*
+ * An EventLoop drives any number of transfers from one thread with curl_multi_socket_action. curl tells
+ * the loop which sockets to watch (LoopSocketCallback) and when it wants to be called back next
+ * (LoopTimerCallback); every turn of the loop waits for either and hands curl only the sockets that are
+ * ready, where curl_multi_perform would look at every transfer in flight. The cost of a turn then
+ * depends on the transfers with something to do, not on how many there are. Sockets are watched with
+ * epoll on Linux; elsewhere the loop falls back to curl_multi_poll and curl_multi_perform behind the
+ * same functions.
+ *
+ * A transfer is an easy handle added with loop_add together with a completion callback. The callback
+ * runs on the thread running the loop, after the handle has left the loop, so it can clean the handle
+ * up, add it back to retry or start other transfers. download_file_async and fetch_page_async are
+ * download_file and fetch_page as such transfers. A loop belongs to the thread running it; loop_wakeup
+ * and loop_post are the only functions other threads can call. loop_post delivers a completion
+ * reserved with loop_hold, so work done elsewhere (a file committed by the disk writer, see
+ * loop_commit_file) is settled on the loop's thread like a transfer.
+ */
+
+typedef void (*LoopDoneFunction)(CURL *curl, CURLcode result, void *userdata);
+typedef void (*DownloadDoneFunction)(const char *output_file, int result, void *userdata);
+typedef void (*PageDoneFunction)(MemoryStruct *chunk, long status, void *userdata);
+
+typedef struct LoopTransfer
+{
+    CURL *curl; // NULL for a completion queued with loop_defer or loop_hold
+    LoopDoneFunction done;
+    void *userdata;
+    CURLcode result;           // Result handed to done by a deferred or posted completion
+    struct LoopTransfer *next; // Next deferred or posted completion
+} LoopTransfer;
+
+typedef struct
+{
+    CURLM *multi;
+    int epoll_fd;    // -1 when the loop runs on curl_multi_poll
+    int wake_fd;     // eventfd written by loop_wakeup, -1 without epoll
+    int timer_set;   // Set while curl waits to be called back
+    double deadline; // Time curl wants to be called back, from rn_clock
+    int running;     // Transfers curl is still driving
+    int active;      // Transfers added, and deferred or held completions not delivered yet
+    LoopTransfer *deferred;
+    LoopTransfer *deferred_tail;
+    RnMutex posted_lock;   // Guards posted, which other threads append to
+    LoopTransfer *posted;  // Completions posted and not moved to deferred yet
+    LoopTransfer *posted_tail;
+
+    long turns;     // Times the loop waited
+    long events;    // Socket events handed to curl
+    long timeouts;  // Timeouts handed to curl
+    long completed; // Completions delivered
+} EventLoop;
+
+typedef struct
+{
+    EventLoop *loop;
+    CURL *curl;
+    char *https_url;
+    char *output_file;
+    FileStruct out;
+    DownloadDoneFunction done;
+    void *userdata;
+} AsyncDownload;
+
+typedef struct
+{
+    EventLoop *loop;
+    LoopTransfer *transfer; // Completion held on loop until the file is committed
+} LoopCommit;
+
+typedef struct
+{
+    DiskRequest request;
+    char *part_file;   // Taken over from the FileStruct
+    char *output_file; // Copy of the final name
+    DiskDoneFunction done;
+    void *userdata;
+} FileCommit;
+
+typedef struct
+{
+    CURL *curl; // NULL when the page was answered from the cache
+    char *url;
+    char *postdata;
+    PageRequest request;
+    long status;
+    PageDoneFunction done;
+    void *userdata;
+} AsyncPage;
+
+#ifdef LOOP_EPOLL
+static int LoopSocketCallback(CURL *easy, curl_socket_t socket, int what, void *userp, void *socketp);
+static int LoopTimerCallback(CURLM *multi, long timeout_ms, void *userp);
+#endif
+static void loop_deliver(EventLoop *loop);
+RN_API int loop_init(EventLoop *loop);
+RN_API void loop_free(EventLoop *loop);
+RN_API int loop_add(EventLoop *loop, CURL *curl, LoopDoneFunction done, void *userdata);
+RN_API void loop_remove(EventLoop *loop, CURL *curl);
+RN_API int loop_defer(EventLoop *loop, LoopDoneFunction done, void *userdata);
+RN_API void loop_cancel_deferred(EventLoop *loop, void *userdata);
+RN_API LoopTransfer *loop_hold(EventLoop *loop, LoopDoneFunction done, void *userdata);
+RN_API void loop_post(EventLoop *loop, LoopTransfer *transfer, CURLcode result);
+static void file_committed(long result, void *userdata);
+static int commit_file_struct(FileStruct *out, DiskDoneFunction done, void *userdata);
+static void loop_file_committed(long result, void *userdata);
+RN_API int loop_commit_file(EventLoop *loop, FileStruct *out, LoopDoneFunction done, void *userdata);
+RN_API int loop_run_once(EventLoop *loop, int timeout_ms);
+RN_API void loop_run(EventLoop *loop);
+RN_API void loop_wakeup(EventLoop *loop);
+static void configure_async_download(AsyncDownload *download);
+static void release_async_download(AsyncDownload *download, int outcome);
+static void async_download_committed(CURL *curl, CURLcode result, void *userdata);
+static void finish_async_download(CURL *curl, CURLcode result, void *userdata);
+RN_API int download_file_async(EventLoop *loop, const char *url, const char *output_file, DownloadDoneFunction done, void *userdata);
+static void finish_async_page(CURL *curl, CURLcode result, void *userdata);
+RN_API AsyncPage *fetch_page_async(EventLoop *loop, const char *url, const char *postdata, MemoryStruct *chunk, PageDoneFunction done, void *userdata);
+RN_API void fetch_page_cancel(EventLoop *loop, AsyncPage *page);
+
+#ifdef LOOP_EPOLL
+static int LoopSocketCallback(CURL *easy, curl_socket_t socket, int what, void *userp, void *socketp)
+{
+    /* Function  : static int LoopSocketCallback(CURL *easy, curl_socket_t socket, int what, void *userp, void *socketp)
+     * Input     : easy - pointer to the easy handle using the socket (unused)
+     *             socket - socket curl wants watched
+     *             what - CURL_POLL_IN, CURL_POLL_OUT, CURL_POLL_INOUT or CURL_POLL_REMOVE
+     *             userp - pointer to the EventLoop
+     *             socketp - non-NULL if the socket is already registered with epoll
+     * Output    : Returns 0
+     * Procedure : This function is the CURLMOPT_SOCKETFUNCTION of the loop. It adds the socket to the epoll set, changes the events it is watched for, or removes it, and marks it registered with curl_multi_assign so the next call knows which one to do.
+     */
+
+    (void)easy;
+
+    EventLoop *loop = (EventLoop *)userp;
+
+    if (what == CURL_POLL_REMOVE)
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+        curl_multi_assign(loop->multi, socket, NULL);
+        return 0;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+    event.data.fd = socket;
+
+    if (socketp == NULL)
+    {
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, socket, &event) != 0 && errno == EEXIST)
+        {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, socket, &event);
+        }
+        curl_multi_assign(loop->multi, socket, (void *)loop);
+    }
+    else
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, socket, &event);
+    }
+
+    return 0;
+}
+
+static int LoopTimerCallback(CURLM *multi, long timeout_ms, void *userp)
+{
+    /* Function  : static int LoopTimerCallback(CURLM *multi, long timeout_ms, void *userp)
+     * Input     : multi - pointer to the multi handle (unused)
+     *             timeout_ms - milliseconds until curl wants to be called back, -1 to cancel the timer
+     *             userp - pointer to the EventLoop
+     * Output    : Returns 0
+     * Procedure : This function is the CURLMOPT_TIMERFUNCTION of the loop. It records when curl wants curl_multi_socket_action to be called with CURL_SOCKET_TIMEOUT; the next turn of the loop waits no longer than that.
+     */
+
+    (void)multi;
+
+    EventLoop *loop = (EventLoop *)userp;
+
+    if (timeout_ms < 0)
+    {
+        loop->timer_set = 0;
+    }
+    else
+    {
+        loop->timer_set = 1;
+        loop->deadline = rn_clock() + timeout_ms / 1000.0;
+    }
+
+    return 0;
+}
+#endif
+
+static void loop_deliver(EventLoop *loop)
+{
+    /* Function  : static void loop_deliver(EventLoop *loop)
+     * Input     : loop - pointer to the EventLoop
+     * Output    : None
+     * Procedure : This function hands every finished transfer to its completion callback, one at a time and after removing its handle from the loop, then the completions queued with loop_defer or posted by other threads. Messages are read one by one because a callback may remove other transfers, whose messages then disappear with them.
+     */
+
+    CURLMsg *msg;
+    int msgs_left;
+
+    while ((msg = curl_multi_info_read(loop->multi, &msgs_left)) != NULL)
+    {
+        if (msg->msg != CURLMSG_DONE)
+        {
+            continue;
+        }
+
+        // msg is no longer valid once the handle is removed
+        CURL *curl = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        LoopTransfer *transfer = NULL;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&transfer);
+        curl_multi_remove_handle(loop->multi, curl);
+        loop->active--;
+        loop->completed++;
+
+        if (transfer != NULL)
+        {
+            LoopDoneFunction done = transfer->done;
+            void *userdata = transfer->userdata;
+            free(transfer);
+            done(curl, result, userdata);
+        }
+    }
+
+    rn_mutex_lock(&loop->posted_lock);
+    if (loop->posted != NULL)
+    {
+        if (loop->deferred_tail != NULL)
+        {
+            loop->deferred_tail->next = loop->posted;
+        }
+        else
+        {
+            loop->deferred = loop->posted;
+        }
+        loop->deferred_tail = loop->posted_tail;
+        loop->posted = NULL;
+        loop->posted_tail = NULL;
+    }
+    rn_mutex_unlock(&loop->posted_lock);
+
+    // Completions deferred while delivering are left for the next turn
+    LoopTransfer *deferred = loop->deferred;
+    loop->deferred = NULL;
+    loop->deferred_tail = NULL;
+
+    while (deferred != NULL)
+    {
+        LoopTransfer *next = deferred->next;
+        loop->active--;
+        loop->completed++;
+        deferred->done(NULL, deferred->result, deferred->userdata);
+        free(deferred);
+        deferred = next;
+    }
+}
+
+RN_API int loop_init(EventLoop *loop)
+{
+    /*
+     * Function  : int loop_init(EventLoop *loop)
+     * Input     : loop - pointer to the EventLoop to initialize
+     * Output    : Returns 0 on success, -1 if the multi handle can't be created
+     * Procedure : This function creates the multi handle of the loop. On Linux it also creates the epoll set and the eventfd loop_wakeup writes to, and hands curl the socket and timer callbacks; if either can't be created the loop runs on curl_multi_poll instead.
+     */
+
+    memset(loop, 0, sizeof(EventLoop));
+    loop->epoll_fd = -1;
+    loop->wake_fd = -1;
+    loop->multi = curl_multi_init();
+
+    if (loop->multi == NULL)
+    {
+        return -1;
+    }
+
+    rn_mutex_init(&loop->posted_lock);
+
+#ifdef LOOP_EPOLL
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = loop->wake_fd;
+
+    if (loop->epoll_fd < 0 || loop->wake_fd < 0 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) != 0)
+    {
+        if (loop->epoll_fd >= 0)
+        {
+            close(loop->epoll_fd);
+        }
+        if (loop->wake_fd >= 0)
+        {
+            close(loop->wake_fd);
+        }
+        loop->epoll_fd = -1;
+        loop->wake_fd = -1;
+        return 0;
+    }
+
+    curl_multi_setopt(loop->multi, CURLMOPT_SOCKETFUNCTION, LoopSocketCallback);
+    curl_multi_setopt(loop->multi, CURLMOPT_SOCKETDATA, (void *)loop);
+    curl_multi_setopt(loop->multi, CURLMOPT_TIMERFUNCTION, LoopTimerCallback);
+    curl_multi_setopt(loop->multi, CURLMOPT_TIMERDATA, (void *)loop);
+#endif
+
+    return 0;
+}
+
+RN_API void loop_free(EventLoop *loop)
+{
+    /*
+     * Function  : void loop_free(EventLoop *loop)
+     * Input     : loop - pointer to an initialized EventLoop
+     * Output    : None
+     * Procedure : This function releases the loop. Transfers should have completed or been removed first, and held completions posted; completions still deferred are dropped without being delivered. posted_lock is held while the loop is torn down, so a thread still finishing loop_post (see there) is done with it first.
+     */
+
+    while (loop->deferred != NULL)
+    {
+        LoopTransfer *next = loop->deferred->next;
+        free(loop->deferred);
+        loop->deferred = next;
+    }
+
+    if (loop->multi == NULL)
+    {
+        return;
+    }
+
+    rn_mutex_lock(&loop->posted_lock);
+
+    while (loop->posted != NULL)
+    {
+        LoopTransfer *next = loop->posted->next;
+        free(loop->posted);
+        loop->posted = next;
+    }
+    loop->posted_tail = NULL;
+
+    curl_multi_cleanup(loop->multi);
+    loop->multi = NULL;
+
+#ifdef LOOP_EPOLL
+    if (loop->epoll_fd >= 0)
+    {
+        close(loop->epoll_fd);
+        close(loop->wake_fd);
+    }
+#endif
+    loop->epoll_fd = -1;
+    loop->wake_fd = -1;
+
+    rn_mutex_unlock(&loop->posted_lock);
+    rn_mutex_destroy(&loop->posted_lock);
+}
+
+RN_API int loop_add(EventLoop *loop, CURL *curl, LoopDoneFunction done, void *userdata)
+{
+    /*
+     * Function  : int loop_add(EventLoop *loop, CURL *curl, LoopDoneFunction done, void *userdata)
+     * Input     : loop - pointer to the EventLoop
+     *             curl - pointer to a configured easy handle
+     *             done - function called with the handle, the result and userdata once the transfer is over
+     *             userdata - pointer handed to done
+     * Output    : Returns 0 if the transfer was added, -1 otherwise (done is then never called)
+     * Procedure : This function starts a transfer on the loop. The loop keeps its own record in CURLOPT_PRIVATE, so the caller finds its state through userdata instead. Nothing happens until the loop runs; done is called exactly once, from loop_run_once, unless the transfer is removed with loop_remove first.
+     */
+
+    LoopTransfer *transfer = rn_malloc(sizeof(LoopTransfer));
+    if (transfer == NULL)
+    {
+        return -1;
+    }
+
+    transfer->curl = curl;
+    transfer->done = done;
+    transfer->userdata = userdata;
+    transfer->next = NULL;
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)transfer);
+
+    if (curl_multi_add_handle(loop->multi, curl) != CURLM_OK)
+    {
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+        free(transfer);
+        return -1;
+    }
+
+    loop->active++;
+    return 0;
+}
+
+RN_API void loop_remove(EventLoop *loop, CURL *curl)
+{
+    /*
+     * Function  : void loop_remove(EventLoop *loop, CURL *curl)
+     * Input     : loop - pointer to the EventLoop
+     *             curl - pointer to an easy handle added with loop_add and not completed yet
+     * Output    : None
+     * Procedure : This function cancels a transfer: its handle leaves the loop and its completion callback is never called. The handle stays with the caller.
+     */
+
+    LoopTransfer *transfer = NULL;
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&transfer);
+
+    if (transfer == NULL)
+    {
+        return;
+    }
+
+    curl_multi_remove_handle(loop->multi, curl);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+    free(transfer);
+    loop->active--;
+}
+
+RN_API int loop_defer(EventLoop *loop, LoopDoneFunction done, void *userdata)
+{
+    /*
+     * Function  : int loop_defer(EventLoop *loop, LoopDoneFunction done, void *userdata)
+     * Input     : loop - pointer to the EventLoop
+     *             done - function called with a NULL handle, CURLE_OK and userdata
+     *             userdata - pointer handed to done
+     * Output    : Returns 0 if the completion was queued, -1 otherwise
+     * Procedure : This function queues a completion that needs no transfer (a page answered from the cache), so it is delivered by the next turn of the loop like any other instead of from inside the call that started it.
+     */
+
+    LoopTransfer *transfer = rn_malloc(sizeof(LoopTransfer));
+    if (transfer == NULL)
+    {
+        return -1;
+    }
+
+    transfer->curl = NULL;
+    transfer->done = done;
+    transfer->userdata = userdata;
+    transfer->result = CURLE_OK;
+    transfer->next = NULL;
+
+    if (loop->deferred_tail != NULL)
+    {
+        loop->deferred_tail->next = transfer;
+    }
+    else
+    {
+        loop->deferred = transfer;
+    }
+    loop->deferred_tail = transfer;
+    loop->active++;
+
+    return 0;
+}
+
+RN_API void loop_cancel_deferred(EventLoop *loop, void *userdata)
+{
+    /*
+     * Function  : void loop_cancel_deferred(EventLoop *loop, void *userdata)
+     * Input     : loop - pointer to the EventLoop
+     *             userdata - pointer given to loop_defer
+     * Output    : None
+     * Procedure : This function drops a completion queued with loop_defer and not delivered yet, so its callback is never called.
+     */
+
+    LoopTransfer *previous = NULL;
+
+    for (LoopTransfer *transfer = loop->deferred; transfer != NULL; previous = transfer, transfer = transfer->next)
+    {
+        if (transfer->userdata != userdata)
+        {
+            continue;
+        }
+
+        if (previous != NULL)
+        {
+            previous->next = transfer->next;
+        }
+        else
+        {
+            loop->deferred = transfer->next;
+        }
+        if (loop->deferred_tail == transfer)
+        {
+            loop->deferred_tail = previous;
+        }
+
+        free(transfer);
+        loop->active--;
+        return;
+    }
+}
+
+RN_API LoopTransfer *loop_hold(EventLoop *loop, LoopDoneFunction done, void *userdata)
+{
+    /*
+     * Function  : LoopTransfer *loop_hold(EventLoop *loop, LoopDoneFunction done, void *userdata)
+     * Input     : loop - pointer to the EventLoop
+     *             done - function called with a NULL handle, the result given to loop_post and userdata
+     *             userdata - pointer handed to done
+     * Output    : Returns the held completion, to be given to loop_post, or NULL if it couldn't be allocated
+     * Procedure : This function reserves a completion that another thread will deliver with loop_post once its work is done. It counts as active until then, so loop_run doesn't return while the work is still going on. It must be called from the thread running the loop.
+     */
+
+    LoopTransfer *transfer = rn_malloc(sizeof(LoopTransfer));
+    if (transfer == NULL)
+    {
+        return NULL;
+    }
+
+    transfer->curl = NULL;
+    transfer->done = done;
+    transfer->userdata = userdata;
+    transfer->result = CURLE_OK;
+    transfer->next = NULL;
+    loop->active++;
+
+    return transfer;
+}
+
+RN_API void loop_post(EventLoop *loop, LoopTransfer *transfer, CURLcode result)
+{
+    /*
+     * Function  : void loop_post(EventLoop *loop, LoopTransfer *transfer, CURLcode result)
+     * Input     : loop - pointer to the EventLoop
+     *             transfer - pointer to a completion returned by loop_hold
+     *             result - result handed to its callback
+     * Output    : None
+     * Procedure : This function delivers a held completion from any thread: it is appended to the posted completions and the loop is woken up, so the next turn hands it to its callback on the loop's thread. The loop is woken up before posted_lock is let go: once the loop can see the completion it may deliver the last one, return from loop_run and be freed, and loop_free takes the same lock before closing what loop_wakeup writes to.
+     */
+
+    transfer->result = result;
+
+    rn_mutex_lock(&loop->posted_lock);
+    if (loop->posted_tail != NULL)
+    {
+        loop->posted_tail->next = transfer;
+    }
+    else
+    {
+        loop->posted = transfer;
+    }
+    loop->posted_tail = transfer;
+    loop_wakeup(loop);
+    rn_mutex_unlock(&loop->posted_lock);
+}
+
+static void file_committed(long result, void *userdata)
+{
+    /* Function  : static void file_committed(long result, void *userdata)
+     * Input     : result - 0 once the file has its final name, a negative errno otherwise
+     *             userdata - pointer to the FileCommit, released here
+     * Output    : None
+     * Procedure : This function is the completion callback of a commit, called by the disk writer. It hands the result to the callback given to commit_file_struct and frees the names.
+     */
+
+    FileCommit *commit = (FileCommit *)userdata;
+
+    commit->done(result, commit->userdata);
+
+    free(commit->part_file);
+    free(commit->output_file);
+    free(commit);
+}
+
+static int commit_file_struct(FileStruct *out, DiskDoneFunction done, void *userdata)
+{
+    /* Function  : static int commit_file_struct(FileStruct *out, DiskDoneFunction done, void *userdata)
+     * Input     : out - pointer to the FileStruct of a complete download written by the disk writer
+     *             done - function called with 0 or a negative errno and userdata once the file has its final name
+     *             userdata - pointer handed to done
+     * Output    : Returns 0 if the file was handed to the disk writer, -1 if it wasn't (the caller closes it with close_file_struct instead)
+     * Procedure : This function is close_file_struct for a complete download whose fsync and rename don't hold up the caller. It waits like flush_file_buffer for the writes of the file still queued (at most FILE_WRITE_BUFFERS buffers, chained on the ring), then queues the fsync, the rename to the final name and the close of the part file together on the disk writer, which batches them with those of the other files finishing at the same time, and returns without waiting for them. The FileStruct is released at once; done is called from the thread of the writer, not the caller's.
+     */
+
+    if (out->disk == NULL || out->file == NULL || out->error || flush_file_buffer(out) != 0)
+    {
+        return -1;
+    }
+
+    FileCommit *commit = rn_calloc(1, sizeof(FileCommit));
+    char *output_file = rn_strdup(out->output_file);
+
+    if (commit == NULL || output_file == NULL)
+    {
+        free(commit);
+        free(output_file);
+        return -1;
+    }
+
+    // Everything went through the descriptor of the writer, the stream has nothing to write
+    fclose(out->file);
+    out->file = NULL;
+
+    struct DiskWriter *disk = out->disk;
+    commit->part_file = out->part_file;
+    commit->output_file = output_file;
+    commit->done = done;
+    commit->userdata = userdata;
+    commit->request.operation = DISK_COMMIT;
+    commit->request.fd = out->fd;
+    commit->request.path = commit->part_file;
+    commit->request.target = commit->output_file;
+    commit->request.done = file_committed;
+    commit->request.userdata = commit;
+
+    out->part_file = NULL;
+    out->fd = -1;
+    release_file_struct(out);
+
+    disk_submit(disk, &commit->request);
+    return 0;
+}
+
+static void loop_file_committed(long result, void *userdata)
+{
+    /* Function  : static void loop_file_committed(long result, void *userdata)
+     * Input     : result - 0 once the file has its final name, a negative errno otherwise
+     *             userdata - pointer to the LoopCommit, released here
+     * Output    : None
+     * Procedure : This function is the commit callback of loop_commit_file, called by the disk writer. It posts the held completion to the loop with CURLE_OK, or CURLE_WRITE_ERROR if the file couldn't be flushed or renamed.
+     */
+
+    LoopCommit *commit = (LoopCommit *)userdata;
+
+    loop_post(commit->loop, commit->transfer, result < 0 ? CURLE_WRITE_ERROR : CURLE_OK);
+    free(commit);
+}
+
+RN_API int loop_commit_file(EventLoop *loop, FileStruct *out, LoopDoneFunction done, void *userdata)
+{
+    /*
+     * Function  : int loop_commit_file(EventLoop *loop, FileStruct *out, LoopDoneFunction done, void *userdata)
+     * Input     : loop - pointer to the EventLoop
+     *             out - pointer to the FileStruct of a complete download
+     *             done - function called with a NULL handle, CURLE_OK or CURLE_WRITE_ERROR, and userdata
+     *             userdata - pointer handed to done
+     * Output    : Returns 0 if the file is being committed, -1 if it wasn't touched (the caller closes it with close_file_struct instead)
+     * Procedure : This function finishes a complete download without making the loop wait for its fsync and rename: once the writes of the file still queued are done (the loop waits for those, see commit_file_struct), the fsync and rename of the part file are queued on the disk writer and done is called from a later turn of the loop once the file has its final name. The FileStruct is released at once.
+     */
+
+    LoopCommit *commit = rn_malloc(sizeof(LoopCommit));
+    if (commit == NULL)
+    {
+        return -1;
+    }
+
+    commit->loop = loop;
+    commit->transfer = loop_hold(loop, done, userdata);
+
+    if (commit->transfer == NULL || commit_file_struct(out, loop_file_committed, commit) != 0)
+    {
+        if (commit->transfer != NULL)
+        {
+            free(commit->transfer);
+            loop->active--;
+        }
+        free(commit);
+        return -1;
+    }
+
+    return 0;
+}
+
+RN_API int loop_run_once(EventLoop *loop, int timeout_ms)
+{
+    /*
+     * Function  : int loop_run_once(EventLoop *loop, int timeout_ms)
+     * Input     : loop - pointer to the EventLoop
+     *             timeout_ms - longest time to wait for something to happen, in milliseconds
+     * Output    : Returns the number of completions delivered
+     * Procedure : This function runs one turn of the loop. It waits until a socket is ready, curl's timer expires, loop_wakeup is called or timeout_ms has passed, whichever comes first (not at all if completions are waiting), lets curl act on the ready sockets and the expired timer, and delivers the transfers that finished to their completion callbacks.
+     */
+
+    long completed = loop->completed;
+
+    if (loop->deferred != NULL)
+    {
+        timeout_ms = 0;
+    }
+
+    loop->turns++;
+
+#ifdef LOOP_EPOLL
+    if (loop->epoll_fd >= 0)
+    {
+        if (loop->timer_set)
+        {
+            double remaining = (loop->deadline - rn_clock()) * 1000.0;
+            int timer_ms = remaining > 0 ? (int)remaining + 1 : 0;
+            if (timer_ms < timeout_ms)
+            {
+                timeout_ms = timer_ms;
+            }
+        }
+
+        struct epoll_event events[LOOP_MAX_EVENTS];
+        int count = epoll_wait(loop->epoll_fd, events, LOOP_MAX_EVENTS, timeout_ms);
+
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.fd == loop->wake_fd)
+            {
+                uint64_t value;
+                while (read(loop->wake_fd, &value, sizeof(value)) > 0)
+                {
+                }
+                continue;
+            }
+
+            int flags = 0;
+            if (events[i].events & EPOLLIN)
+            {
+                flags |= CURL_CSELECT_IN;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                flags |= CURL_CSELECT_OUT;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                flags |= CURL_CSELECT_ERR;
+            }
+
+            curl_multi_socket_action(loop->multi, events[i].data.fd, flags, &loop->running);
+            loop->events++;
+        }
+
+        if (loop->timer_set && rn_clock() >= loop->deadline)
+        {
+            // curl sets a new timer from inside the call if it needs one
+            loop->timer_set = 0;
+            curl_multi_socket_action(loop->multi, CURL_SOCKET_TIMEOUT, 0, &loop->running);
+            loop->timeouts++;
+        }
+
+        loop_deliver(loop);
+        return (int)(loop->completed - completed);
+    }
+#endif
+
+    curl_multi_poll(loop->multi, NULL, 0, timeout_ms, NULL);
+    curl_multi_perform(loop->multi, &loop->running);
+
+    loop_deliver(loop);
+    return (int)(loop->completed - completed);
+}
+
+RN_API void loop_run(EventLoop *loop)
+{
+    /*
+     * Function  : void loop_run(EventLoop *loop)
+     * Input     : loop - pointer to the EventLoop
+     * Output    : None
+     * Procedure : This function runs the loop until every transfer has completed, including those started by completion callbacks.
+     */
+
+    while (loop->active > 0)
+    {
+        loop_run_once(loop, 1000);
+    }
+}
+
+RN_API void loop_wakeup(EventLoop *loop)
+{
+    /*
+     * Function  : void loop_wakeup(EventLoop *loop)
+     * Input     : loop - pointer to the EventLoop
+     * Output    : None
+     * Procedure : This function makes the loop return from the turn it is waiting in, or not wait in its next one. It can be called from any thread, so a thread handing work to the loop's thread doesn't have to wait for a transfer or the timeout to be noticed.
+     */
+
+#ifdef LOOP_EPOLL
+    if (loop->wake_fd >= 0)
+    {
+        uint64_t value = 1;
+        if (write(loop->wake_fd, &value, sizeof(value)) < 0)
+        {
+            // The counter is already non-zero, the loop will wake up anyway
+        }
+        return;
+    }
+#endif
+
+    curl_multi_wakeup(loop->multi);
+}
+
+static void configure_async_download(AsyncDownload *download)
+{
+    /* Function  : static void configure_async_download(AsyncDownload *download)
+     * Input     : download - pointer to the AsyncDownload
+     * Output    : None
+     * Procedure : This function (re)sets the options of the easy handle of an asynchronous download like download_file does: the body streams into the part file through WriteFileCallback, continuing whatever an earlier attempt left in it.
+     */
+
+    curl_easy_reset(download->curl);
+    session_attach(download->curl);
+    curl_easy_setopt(download->curl, CURLOPT_URL, download->https_url);
+    curl_easy_setopt(download->curl, CURLOPT_WRITEFUNCTION, WriteFileCallback);
+    curl_easy_setopt(download->curl, CURLOPT_WRITEDATA, (void *)&download->out);
+    curl_easy_setopt(download->curl, CURLOPT_BUFFERSIZE, (long)DOWNLOAD_BUFFER_SIZE);
+    setup_resume(download->curl, &download->out);
+}
+
+static void release_async_download(AsyncDownload *download, int outcome)
+{
+    /* Function  : static void release_async_download(AsyncDownload *download, int outcome)
+     * Input     : download - pointer to the AsyncDownload, released here
+     *             outcome - 0 if the file is there, -1 if the download failed
+     * Output    : None
+     * Procedure : This function calls the callback of the caller of download_file_async with the outcome of the download and frees it.
+     */
+
+    if (download->done != NULL)
+    {
+        download->done(download->output_file, outcome, download->userdata);
+    }
+
+    free(download->https_url);
+    free(download->output_file);
+    free(download);
+}
+
+static void async_download_committed(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void async_download_committed(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - NULL, the handle of the download is gone already
+     *             result - CURLE_OK once the file has its final name, CURLE_WRITE_ERROR otherwise
+     *             userdata - pointer to the AsyncDownload
+     * Output    : None
+     * Procedure : This function is called by the loop once the disk writer has committed the file of a download (see loop_commit_file), and settles the download.
+     */
+
+    (void)curl;
+
+    AsyncDownload *download = (AsyncDownload *)userdata;
+
+    if (result != CURLE_OK)
+    {
+        printf("Error renaming %s.part\n", download->output_file);
+    }
+
+    release_async_download(download, result == CURLE_OK ? 0 : -1);
+}
+
+static void finish_async_download(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void finish_async_download(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - pointer to the easy handle of the download
+     *             result - result of the transfer
+     *             userdata - pointer to the AsyncDownload
+     * Output    : None
+     * Procedure : This function is the completion callback of download_file_async. It settles the transfer like download_file: if the server refused to continue the part file the download starts over on the same loop, otherwise the result is reported and the callback of the caller is called before everything is released. A complete part file is committed by the disk writer in the meantime, so the loop goes on with the other transfers until it has its final name.
+     */
+
+    AsyncDownload *download = (AsyncDownload *)userdata;
+
+    session_record_timings(curl, download->https_url);
+
+    // Write out whatever is still staged in the buffer
+    flush_file_buffer(&download->out);
+    int status = check_resumed_transfer(curl, result, &download->out);
+    int outcome = -1;
+
+    if (status == 0)
+    {
+        curl_off_t speed = 0;
+        double total_time = 0;
+        curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total_time);
+
+        printf("File downloaded successfully: %s (%zu bytes in %.2fs, %.1f KB/s)\n", download->output_file, download->out.total, total_time, (double)speed / 1024.0);
+        outcome = 0;
+    }
+    else if (status == 1)
+    {
+        printf("Server can't resume %s, starting over\n", download->output_file);
+    }
+    else if (download->out.error)
+    {
+        printf("Error writing file\n");
+    }
+    else
+    {
+        printf("Download of %s failed: %s\n", download->output_file, curl_easy_strerror(result));
+    }
+
+    if (status == 1)
+    {
+        configure_async_download(download);
+        if (loop_add(download->loop, curl, finish_async_download, download) == 0)
+        {
+            return;
+        }
+    }
+
+    curl_easy_cleanup(curl);
+
+    if (outcome == 0 && loop_commit_file(download->loop, &download->out, async_download_committed, download) == 0)
+    {
+        return;
+    }
+
+    // Incomplete downloads stay in the part file so the next attempt can resume them
+    close_file_struct(&download->out, outcome == 0);
+    if (outcome == 0 && download->out.error)
+    {
+        printf("Error renaming %s.part\n", download->output_file);
+        outcome = -1;
+    }
+
+    release_async_download(download, outcome);
+}
+
+RN_API int download_file_async(EventLoop *loop, const char *url, const char *output_file, DownloadDoneFunction done, void *userdata)
+{
+    /*
+     * Function  : int download_file_async(EventLoop *loop, const char *url, const char *output_file, DownloadDoneFunction done, void *userdata)
+     * Input     : loop - pointer to the EventLoop running the download
+     *             url - pointer to the URL of the file to download
+     *             output_file - pointer to the name of the file to save the downloaded content, or NULL to derive it from the URL
+     *             done - function called with the name of the file, 0 on success or -1 on failure, and userdata; or NULL
+     *             userdata - pointer handed to done
+     * Output    : Returns 0 if the download was started, -1 otherwise (done is then never called)
+     * Procedure : This function starts download_file as a transfer of the loop and returns at once. The file is streamed into "<output_file>.part", resuming an interrupted earlier attempt with a Range header, and flushed and renamed once it is complete; its buffers, the fsync and the rename go through the disk writer (see attach_disk_writer and loop_commit_file). The loop only waits for the disk when the buffers of a download are all queued, and at the end of a download for its last few writes, never for the fsync and rename. done is called from the loop once the file is there or the download failed.
+     */
+
+    AsyncDownload *download = rn_calloc(1, sizeof(AsyncDownload));
+    if (download == NULL)
+    {
+        return -1;
+    }
+
+    download->loop = loop;
+    download->done = done;
+    download->userdata = userdata;
+    download->output_file = output_file != NULL ? rn_strdup(output_file) : get_filename_from_url(url);
+
+    if (download->output_file == NULL)
+    {
+        printf("Couldn't derive a file name from the url\n");
+        free(download);
+        return -1;
+    }
+
+    download->https_url = replace_http(url);
+
+    if (open_file_struct(&download->out, download->output_file) != 0 || download->https_url == NULL)
+    {
+        printf("Error opening file for writing: %s\n", download->output_file);
+        close_file_struct(&download->out, 0);
+        free(download->https_url);
+        free(download->output_file);
+        free(download);
+        return -1;
+    }
+
+    download->curl = curl_easy_init();
+    if (download->curl != NULL)
+    {
+        attach_disk_writer(&download->out, get_disk_writer());
+        configure_async_download(download);
+
+        if (download->out.resume_from > 0)
+        {
+            printf("Resuming %s at %" CURL_FORMAT_CURL_OFF_T " bytes\n", download->output_file, download->out.resume_from);
+        }
+
+        if (loop_add(loop, download->curl, finish_async_download, download) == 0)
+        {
+            return 0;
+        }
+
+        curl_easy_cleanup(download->curl);
+    }
+
+    close_file_struct(&download->out, 0);
+    free(download->https_url);
+    free(download->output_file);
+    free(download);
+    return -1;
+}
+
+static void finish_async_page(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void finish_async_page(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - pointer to the easy handle of the request, or NULL if the page was answered from the cache
+     *             result - result of the transfer
+     *             userdata - pointer to the AsyncPage
+     * Output    : None
+     * Procedure : This function is the completion callback of fetch_page_async. It settles the cache with page_request_finish, hands the page and its status to the callback of the caller and releases the request.
+     */
+
+    AsyncPage *page = (AsyncPage *)userdata;
+
+    if (curl != NULL)
+    {
+        if (result != CURLE_OK)
+        {
+            fprintf(stderr, "Request for %s failed: %s\n", page->url, curl_easy_strerror(result));
+        }
+
+        page->status = page_request_finish(&page->request, curl, result);
+        curl_easy_cleanup(curl);
+    }
+
+    page->done(page->request.stream.chunk, page->status < 0 ? 0 : page->status, page->userdata);
+
+    free(page->url);
+    free(page->postdata);
+    free(page);
+}
+
+RN_API AsyncPage *fetch_page_async(EventLoop *loop, const char *url, const char *postdata, MemoryStruct *chunk, PageDoneFunction done, void *userdata)
+{
+    /*
+     * Function  : AsyncPage *fetch_page_async(EventLoop *loop, const char *url, const char *postdata, MemoryStruct *chunk, PageDoneFunction done, void *userdata)
+     * Input     : loop - pointer to the EventLoop running the request
+     *             url - pointer to the URL of the page to fetch
+     *             postdata - pointer to the body of a POST request, or NULL for a GET request
+     *             chunk - pointer to an initialized MemoryStruct that receives the page, which must stay in place until done is called
+     *             done - function called with chunk, the HTTP status of the page (200 when it comes from the cache, 0 if it couldn't be fetched) and userdata
+     *             userdata - pointer handed to done
+     * Output    : Returns the request, valid until done is called or it is cancelled with fetch_page_cancel, or NULL if it couldn't be started (done is then never called)
+     * Procedure : This function starts fetch_page as a transfer of the loop on an easy handle of its own, sharing the connection pool of the session, and returns at once. The page goes through the on-disk cache exactly like fetch_page (see page_request_begin); a page answered from the cache without a request is delivered by the next turn of the loop.
+     */
+
+    AsyncPage *page = rn_calloc(1, sizeof(AsyncPage));
+    if (page == NULL)
+    {
+        return NULL;
+    }
+
+    page->done = done;
+    page->userdata = userdata;
+    page->url = rn_strdup(url);
+    page->postdata = postdata != NULL ? rn_strdup(postdata) : NULL;
+    page->curl = curl_easy_init();
+
+    int status = -1;
+    if (page->url != NULL && (postdata == NULL || page->postdata != NULL))
+    {
+        status = page_request_begin(&page->request, page->curl, page->url, page->postdata, chunk, NULL);
+    }
+
+    if (status == 1)
+    {
+        // Answered from the cache, no transfer needed
+        curl_easy_cleanup(page->curl);
+        page->curl = NULL;
+        page->status = 200;
+
+        if (loop_defer(loop, finish_async_page, page) == 0)
+        {
+            return page;
+        }
+    }
+    else if (status == 0)
+    {
+        if (loop_add(loop, page->curl, finish_async_page, page) == 0)
+        {
+            return page;
+        }
+        page_request_cancel(&page->request);
+    }
+
+    if (page->curl != NULL)
+    {
+        curl_easy_cleanup(page->curl);
+    }
+    free(page->url);
+    free(page->postdata);
+    free(page);
+    return NULL;
+}
+
+RN_API void fetch_page_cancel(EventLoop *loop, AsyncPage *page)
+{
+    /*
+     * Function  : void fetch_page_cancel(EventLoop *loop, AsyncPage *page)
+     * Input     : loop - pointer to the EventLoop running the request
+     *             page - pointer to a request returned by fetch_page_async whose callback hasn't been called yet
+     * Output    : None
+     * Procedure : This function abandons a page request: its transfer is stopped, its callback is never called and the request is released. Whatever already arrived stays in the buffer of the caller; nothing is cached.
+     */
+
+    if (page->curl != NULL)
+    {
+        loop_remove(loop, page->curl);
+        curl_easy_cleanup(page->curl);
+        page_request_cancel(&page->request);
+    }
+    else
+    {
+        loop_cancel_deferred(loop, page);
+    }
+
+    free(page->url);
+    free(page->postdata);
+    free(page);
+}
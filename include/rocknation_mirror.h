@@ -0,0 +1,1016 @@
+// rocknation_mirror.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_utils.h"
+#include "rocknation_curl.h"
+#include "rocknation_client.h"
+#include "rocknation_loop.h"
+
+#define MIRROR_BAND_QUEUE 1         // Resolved band URLs waiting for their discography to be paginated
+#define MIRROR_ALBUM_QUEUE 8        // Albums waiting for their page to be parsed
+#define MIRROR_SONG_QUEUE 64        // Songs waiting for a download slot
+#define MIRROR_PARSERS 2            // Album pages fetched and parsed at the same time
+#define MIRROR_MAX_DOWNLOADERS 32
+#define MIRROR_REPORT_INTERVAL 2.0 // Seconds between two progress lines
+
+/*
+ * mirror_band runs the four steps of mirroring a band as a pipeline, each stage on its own threads and
+ * with its own client (see rocknation_client.h):
+ *
+ *   resolve -> [bands] -> paginate -> [albums] -> parse (MIRROR_PARSERS) -> [songs] -> download (--jobs)
+ *
+ * A stage hands every item to the next one as soon as it has it: the albums of a discography page are
+ * queued before the next page is requested, and the songs of an album before the next album page is
+ * fetched, so the first downloads start while the rest of the discography is still being read. Queues
+ * are bounded, so a stage that runs ahead of the next one waits instead of piling items up in memory.
+ * The download stage is a single thread keeping --jobs downloads in flight on an event loop (see
+ * rocknation_loop.h); instead of blocking on the song queue, it has the queue wake its loop up.
+ */
+
+typedef struct
+{
+    const char *name;
+    void **items;
+    int capacity;
+    int head;      // Index of the oldest item
+    int count;     // Items waiting
+    int producers; // Producers still running; the queue is closed once none is left
+    int cancelled; // Set when the pipeline is stopped, items are no longer accepted or handed out
+    EventLoop *waiter; // Loop of a consumer polling the queue with mirror_queue_try_pop, woken up when an item arrives or the queue closes
+    RnMutex lock;
+    RnCond not_empty;
+    RnCond not_full;
+
+    long passed;       // Items that went through the queue
+    int max_depth;     // Most items waiting at once
+    double depth_area; // Items waiting integrated over time, for the average depth
+    double changed;    // Time count last changed
+    double opened;     // Time the queue was created
+    double full_time;  // Seconds producers spent waiting for room, summed over producers
+    double empty_time; // Seconds consumers spent waiting for an item, summed over consumers (over download slots for the songs)
+} MirrorQueue;
+
+typedef struct
+{
+    char url[MAX_URL_LENGTH];
+    char folder[MAX_PATH_LENGTH];
+} MirrorAlbum;
+
+typedef struct Mirror Mirror;
+
+typedef struct
+{
+    char url[3 * MAX_URL_LENGTH]; // Spaces already encoded
+    char path[MAX_PATH_LENGTH];
+    Mirror *mirror; // Set by the download stage
+} MirrorSong;
+
+typedef struct
+{
+    Mirror *mirror;
+    RocknationClient *client;
+    RnThreadFunction stage;
+    RnThread thread;
+    int started;
+} MirrorWorker;
+
+struct Mirror
+{
+    const char *band;          // Name or URL the pipeline starts from
+    const char *output_folder;
+    MirrorQueue bands;
+    MirrorQueue albums;
+    MirrorQueue songs;
+    MirrorWorker workers[MIRROR_PARSERS + 3];
+    int worker_count;
+    int downloaders; // Songs downloaded at the same time
+    int downloading; // Downloads in flight, used by the download stage only
+
+    // Guarded by lock
+    RnMutex lock;
+    RnCond finished;
+    int running; // Workers that haven't returned yet
+    long album_count;
+    long song_count;
+    long downloaded;
+    long skipped; // Songs already in the output folder
+    long failed;
+    long long bytes;
+    double started;
+    double first_download; // Time the first download started, 0 until then
+};
+
+static int mirror_queue_init(MirrorQueue *queue, const char *name, int capacity, int producers);
+static void mirror_queue_free(MirrorQueue *queue);
+static void mirror_queue_account(MirrorQueue *queue, double now);
+static int mirror_queue_push(MirrorQueue *queue, void *item);
+static void *mirror_queue_pop(MirrorQueue *queue);
+static int mirror_queue_try_pop(MirrorQueue *queue, void **item);
+static void mirror_queue_done(MirrorQueue *queue);
+static void mirror_queue_cancel(MirrorQueue *queue);
+static int mirror_queue_depth(MirrorQueue *queue);
+static void mirror_file_name(const char *name, char *dest, size_t dest_size);
+static void mirror_resolve(void *argument);
+static int mirror_push_albums(Mirror *mirror, const AlbumInfoList *album_list, int first);
+static void mirror_paginate(void *argument);
+static void mirror_parse(void *argument);
+static void mirror_downloaded(const char *output_file, int result, void *userdata);
+static void mirror_download(void *argument);
+static void mirror_worker_done(Mirror *mirror);
+static void mirror_report(Mirror *mirror, double now);
+static void mirror_print_queue(MirrorQueue *queue, double now);
+RN_API int mirror_band(const char *band, const char *output_folder, int downloaders);
+
+static int mirror_queue_init(MirrorQueue *queue, const char *name, int capacity, int producers)
+{
+    /* Function  : static int mirror_queue_init(MirrorQueue *queue, const char *name, int capacity, int producers)
+     * Input     : queue - pointer to the MirrorQueue to initialize
+     *             name - pointer to the name of the queue in reports
+     *             capacity - most items the queue holds
+     *             producers - number of threads pushing to the queue
+     * Output    : Returns 0 on success, -1 if the queue can't be allocated
+     * Procedure : This function prepares an empty bounded queue. It stays open until each of its producers has called mirror_queue_done.
+     */
+
+    memset(queue, 0, sizeof(*queue));
+    queue->items = rn_calloc(capacity, sizeof(void *));
+    if (queue->items == NULL)
+    {
+        return -1;
+    }
+
+    queue->name = name;
+    queue->capacity = capacity;
+    queue->producers = producers;
+    queue->opened = rn_clock();
+    queue->changed = queue->opened;
+    rn_mutex_init(&queue->lock);
+    rn_cond_init(&queue->not_empty);
+    rn_cond_init(&queue->not_full);
+
+    return 0;
+}
+
+static void mirror_queue_free(MirrorQueue *queue)
+{
+    /* Function  : static void mirror_queue_free(MirrorQueue *queue)
+     * Input     : queue - pointer to a MirrorQueue no thread uses anymore
+     * Output    : None
+     * Procedure : This function releases the queue and any item still in it, which is only the case when the pipeline was cancelled.
+     */
+
+    if (queue->items == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < queue->count; i++)
+    {
+        free(queue->items[(queue->head + i) % queue->capacity]);
+    }
+
+    free(queue->items);
+    queue->items = NULL;
+    rn_cond_destroy(&queue->not_full);
+    rn_cond_destroy(&queue->not_empty);
+    rn_mutex_destroy(&queue->lock);
+}
+
+static void mirror_queue_account(MirrorQueue *queue, double now)
+{
+    /* Function  : static void mirror_queue_account(MirrorQueue *queue, double now)
+     * Input     : queue - pointer to the MirrorQueue, locked by the caller
+     *             now - current time, from rn_clock
+     * Output    : None
+     * Procedure : This function adds the time since the depth last changed, weighted by that depth, to the area the average depth is taken from. It is called right before the depth changes.
+     */
+
+    queue->depth_area += queue->count * (now - queue->changed);
+    queue->changed = now;
+}
+
+static int mirror_queue_push(MirrorQueue *queue, void *item)
+{
+    /* Function  : static int mirror_queue_push(MirrorQueue *queue, void *item)
+     * Input     : queue - pointer to the MirrorQueue
+     *             item - pointer to the item, owned by the queue once pushed
+     * Output    : Returns 0 if the item was queued, -1 if the pipeline was cancelled (the item stays with the caller)
+     * Procedure : This function appends an item to the queue, waiting while it is full, and wakes a consumer (or the loop of a polling one).
+     */
+
+    rn_mutex_lock(&queue->lock);
+
+    if (queue->count == queue->capacity && !queue->cancelled)
+    {
+        double waited = rn_clock();
+        while (queue->count == queue->capacity && !queue->cancelled)
+        {
+            rn_cond_wait(&queue->not_full, &queue->lock);
+        }
+        queue->full_time += rn_clock() - waited;
+    }
+
+    if (queue->cancelled)
+    {
+        rn_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    mirror_queue_account(queue, rn_clock());
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    queue->passed++;
+    if (queue->count > queue->max_depth)
+    {
+        queue->max_depth = queue->count;
+    }
+
+    rn_cond_signal(&queue->not_empty);
+    if (queue->waiter != NULL)
+    {
+        loop_wakeup(queue->waiter);
+    }
+    rn_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+static void *mirror_queue_pop(MirrorQueue *queue)
+{
+    /* Function  : static void *mirror_queue_pop(MirrorQueue *queue)
+     * Input     : queue - pointer to the MirrorQueue
+     * Output    : Returns the oldest item, owned by the caller, or NULL once the queue is closed and empty or the pipeline was cancelled
+     * Procedure : This function takes the oldest item of the queue, waiting while it is empty and still has producers, and wakes a producer.
+     */
+
+    void *item = NULL;
+
+    rn_mutex_lock(&queue->lock);
+
+    if (queue->count == 0 && queue->producers > 0 && !queue->cancelled)
+    {
+        double waited = rn_clock();
+        while (queue->count == 0 && queue->producers > 0 && !queue->cancelled)
+        {
+            rn_cond_wait(&queue->not_empty, &queue->lock);
+        }
+        queue->empty_time += rn_clock() - waited;
+    }
+
+    if (queue->count > 0 && !queue->cancelled)
+    {
+        mirror_queue_account(queue, rn_clock());
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        rn_cond_signal(&queue->not_full);
+    }
+
+    rn_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+static int mirror_queue_try_pop(MirrorQueue *queue, void **item)
+{
+    /* Function  : static int mirror_queue_try_pop(MirrorQueue *queue, void **item)
+     * Input     : queue - pointer to the MirrorQueue
+     *             item - pointer to where the oldest item is stored, owned by the caller
+     * Output    : Returns 1 if an item was taken, 0 if the queue is empty for now, -1 once it is closed and empty or the pipeline was cancelled
+     * Procedure : This function is mirror_queue_pop for a consumer that can't block, such as a thread running an event loop: it never waits. Such a consumer sets the waiter of the queue to its loop, so it is woken up when trying again is worth it.
+     */
+
+    int status = 0;
+    *item = NULL;
+
+    rn_mutex_lock(&queue->lock);
+
+    if (queue->count > 0 && !queue->cancelled)
+    {
+        mirror_queue_account(queue, rn_clock());
+        *item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        rn_cond_signal(&queue->not_full);
+        status = 1;
+    }
+    else if (queue->cancelled || queue->producers <= 0)
+    {
+        status = -1;
+    }
+
+    rn_mutex_unlock(&queue->lock);
+
+    return status;
+}
+
+static void mirror_queue_done(MirrorQueue *queue)
+{
+    /* Function  : static void mirror_queue_done(MirrorQueue *queue)
+     * Input     : queue - pointer to the MirrorQueue
+     * Output    : None
+     * Procedure : This function records that one producer of the queue has finished. When the last one has, every waiting consumer is woken so it can drain the queue and stop.
+     */
+
+    rn_mutex_lock(&queue->lock);
+    queue->producers--;
+    if (queue->producers <= 0)
+    {
+        rn_cond_broadcast(&queue->not_empty);
+        if (queue->waiter != NULL)
+        {
+            loop_wakeup(queue->waiter);
+        }
+    }
+    rn_mutex_unlock(&queue->lock);
+}
+
+static void mirror_queue_cancel(MirrorQueue *queue)
+{
+    /* Function  : static void mirror_queue_cancel(MirrorQueue *queue)
+     * Input     : queue - pointer to the MirrorQueue
+     * Output    : None
+     * Procedure : This function stops the queue: producers and consumers waiting on it return at once, and it accepts and hands out nothing afterwards.
+     */
+
+    rn_mutex_lock(&queue->lock);
+    queue->cancelled = 1;
+    rn_cond_broadcast(&queue->not_empty);
+    rn_cond_broadcast(&queue->not_full);
+    if (queue->waiter != NULL)
+    {
+        loop_wakeup(queue->waiter);
+    }
+    rn_mutex_unlock(&queue->lock);
+}
+
+static int mirror_queue_depth(MirrorQueue *queue)
+{
+    /* Function  : static int mirror_queue_depth(MirrorQueue *queue)
+     * Input     : queue - pointer to the MirrorQueue
+     * Output    : Returns the number of items waiting in the queue
+     * Procedure : This function reads the depth of the queue under its lock, for progress reports.
+     */
+
+    rn_mutex_lock(&queue->lock);
+    int depth = queue->count;
+    rn_mutex_unlock(&queue->lock);
+
+    return depth;
+}
+
+static void mirror_file_name(const char *name, char *dest, size_t dest_size)
+{
+    /* Function  : static void mirror_file_name(const char *name, char *dest, size_t dest_size)
+     * Input     : name - pointer to an album or song name
+     *             dest - pointer to the buffer receiving the file name
+     *             dest_size - size of the buffer
+     * Output    : Writes a name that is safe to use as a single path component into dest
+     * Procedure : This function copies the name, replacing path separators and the characters Windows doesn't allow in file names with '_'. A name that would be empty or a relative directory becomes "_".
+     */
+
+    size_t length = 0;
+
+    for (const char *p = name; *p != '\0' && length + 1 < dest_size; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        dest[length++] = (c < 0x20 || strchr("/\\:*?\"<>|", c) != NULL) ? '_' : (char)c;
+    }
+    dest[length] = '\0';
+
+    if (length == 0 || strcmp(dest, ".") == 0 || strcmp(dest, "..") == 0)
+    {
+        snprintf(dest, dest_size, "_");
+    }
+}
+
+static void mirror_resolve(void *argument)
+{
+    /* Function  : static void mirror_resolve(void *argument)
+     * Input     : argument - pointer to the MirrorWorker of the stage
+     * Output    : None
+     * Procedure : This function is the first stage. It turns the band given to the command into the URL of its discography: a URL is used as is, a name is taken from the name cache or searched for (see get_albums_by_name), and the URL is queued for the pagination stage.
+     */
+
+    MirrorWorker *worker = (MirrorWorker *)argument;
+    Mirror *mirror = worker->mirror;
+    rn_client_bind(worker->client);
+
+    char *band_url = rn_malloc(MAX_URL_LENGTH);
+
+    if (band_url != NULL && is_site_url(mirror->band))
+    {
+        snprintf(band_url, MAX_URL_LENGTH, "%s", mirror->band);
+    }
+    else if (band_url != NULL && name_cache_lookup(mirror->band, band_url, MAX_URL_LENGTH) != 0)
+    {
+        Arena arena;
+        arena_init(&arena, ARENA_BLOCK_SIZE);
+        BandInfoList band_list;
+        init_band_list(&band_list, &arena);
+        search_band(mirror->band, &band_list);
+
+        if (band_list.count > 0)
+        {
+            name_cache_put(mirror->band, band_list.bands[0].url);
+            snprintf(band_url, MAX_URL_LENGTH, "%s", band_list.bands[0].url);
+        }
+        else
+        {
+            printf("[!] No band found for '%s'.\n", mirror->band);
+            free(band_url);
+            band_url = NULL;
+        }
+
+        arena_free(&arena);
+    }
+
+    if (band_url != NULL)
+    {
+        printf("[?] Mirroring %s\n", band_url);
+        fflush(stdout);
+
+        if (mirror_queue_push(&mirror->bands, band_url) != 0)
+        {
+            free(band_url);
+        }
+    }
+
+    mirror_queue_done(&mirror->bands);
+    rn_client_bind(NULL);
+    mirror_worker_done(mirror);
+}
+
+static int mirror_push_albums(Mirror *mirror, const AlbumInfoList *album_list, int first)
+{
+    /* Function  : static int mirror_push_albums(Mirror *mirror, const AlbumInfoList *album_list, int first)
+     * Input     : mirror - pointer to the Mirror
+     *             album_list - pointer to the albums of the band found so far
+     *             first - index of the first album not queued yet
+     * Output    : Returns 0 on success, -1 if the pipeline was cancelled
+     * Procedure : This function queues the albums from first on for the parsing stage, each with the folder its songs go to ("<output folder>/<year> - <album>"). An album whose folder doesn't fit MAX_PATH_LENGTH is counted as failed instead.
+     */
+
+    for (int i = first; i < album_list->count; i++)
+    {
+        const AlbumInfo *album = &album_list->albums[i];
+        MirrorAlbum *item = rn_malloc(sizeof(MirrorAlbum));
+        if (item == NULL)
+        {
+            return -1;
+        }
+
+        char title[MAX_NAME_LENGTH];
+        char folder_name[MAX_NAME_LENGTH];
+        snprintf(title, sizeof(title), "%s - %s", album->year, album->name);
+        mirror_file_name(title, folder_name, sizeof(folder_name));
+
+        snprintf(item->url, sizeof(item->url), "%s", album->url);
+        int too_long = snprintf(item->folder, sizeof(item->folder), "%s/%s", mirror->output_folder, folder_name) >= (int)sizeof(item->folder);
+
+        rn_mutex_lock(&mirror->lock);
+        mirror->album_count++;
+        mirror->failed += too_long;
+        rn_mutex_unlock(&mirror->lock);
+
+        // A cut folder name could be another album's, so the album is left out and the mirror reported incomplete
+        if (too_long)
+        {
+            printf("[!] Path too long for the album %s in %s\n", folder_name, mirror->output_folder);
+            free(item);
+            continue;
+        }
+
+        if (mirror_queue_push(&mirror->albums, item) != 0)
+        {
+            free(item);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void mirror_paginate(void *argument)
+{
+    /* Function  : static void mirror_paginate(void *argument)
+     * Input     : argument - pointer to the MirrorWorker of the stage
+     * Output    : None
+     * Procedure : This function is the second stage. For every band URL it walks the pages of the discography like get_albums does, but queues the albums of each page as soon as the page is parsed instead of once the last page is read. A discography in the local catalog store is queued at once, and a complete one, ended by an empty page fetched with status 200 (see fetch_page_streaming), is added to it. A page that can't be fetched ends the walk and counts as a failure, as the albums after it are unknown.
+     */
+
+    MirrorWorker *worker = (MirrorWorker *)argument;
+    Mirror *mirror = worker->mirror;
+    rn_client_bind(worker->client);
+
+    char *band_url;
+
+    while ((band_url = mirror_queue_pop(&mirror->bands)) != NULL)
+    {
+        Arena arena;
+        arena_init(&arena, ARENA_BLOCK_SIZE);
+        AlbumInfoList album_list;
+        init_album_list(&album_list, &arena);
+
+        if (store_albums(band_url, &album_list) == 0)
+        {
+            mirror_push_albums(mirror, &album_list, 0);
+        }
+        else
+        {
+            for (int page_index = 1;; page_index++)
+            {
+                char page_url[MAX_URL_LENGTH];
+                snprintf(page_url, sizeof(page_url), "%s/%d", band_url, page_index);
+
+                MemoryStruct chunk;
+                init_memory_struct(&chunk);
+
+                StreamExtractor extractor;
+                extractor_init(&extractor, PATTERN_ALBUM, add_album_match, &album_list);
+
+                int first = album_list.count;
+                int status = fetch_page_streaming(page_url, NULL, &chunk, &extractor);
+                free(chunk.memory);
+
+                if (status != 0)
+                {
+                    // The rest of the discography is unknown, so the mirror can't be complete
+                    printf("[!] Couldn't fetch %s, the discography is incomplete\n", page_url);
+                    rn_mutex_lock(&mirror->lock);
+                    mirror->failed++;
+                    rn_mutex_unlock(&mirror->lock);
+                    break;
+                }
+
+                if (mirror_push_albums(mirror, &album_list, first) != 0)
+                {
+                    break;
+                }
+
+                if (extractor.matches == 0)
+                {
+                    // No more albums on this page, the discography is complete
+                    if (album_list.count > 0)
+                    {
+                        store_put_albums(band_url, &album_list);
+                    }
+                    break;
+                }
+            }
+        }
+
+        if (album_list.count == 0)
+        {
+            printf("[!] No albums found at %s\n", band_url);
+        }
+
+        arena_free(&arena);
+        free(band_url);
+    }
+
+    mirror_queue_done(&mirror->albums);
+    rn_client_bind(NULL);
+    mirror_worker_done(mirror);
+}
+
+static void mirror_parse(void *argument)
+{
+    /* Function  : static void mirror_parse(void *argument)
+     * Input     : argument - pointer to the MirrorWorker of the stage
+     * Output    : None
+     * Procedure : This function is the third stage, run by MIRROR_PARSERS threads. Each takes an album, fetches and parses its page (see get_songs, which also answers from the local catalog store), creates its folder and queues the songs that aren't in it yet for download, each once however many times the page links it. An album without any song (its page couldn't be fetched, or is an error page) counts as a failure, and a song whose path doesn't fit MAX_PATH_LENGTH is counted as failed rather than written under a cut name.
+     */
+
+    MirrorWorker *worker = (MirrorWorker *)argument;
+    Mirror *mirror = worker->mirror;
+    rn_client_bind(worker->client);
+
+    MirrorAlbum *album;
+    int cancelled = 0;
+
+    while (!cancelled && (album = mirror_queue_pop(&mirror->albums)) != NULL)
+    {
+        Arena arena;
+        arena_init(&arena, ARENA_BLOCK_SIZE);
+        SongInfoList song_list;
+        init_song_list(&song_list, &arena);
+
+        get_songs(album->url, &song_list);
+
+        long failed = 0;
+
+        if (song_list.count == 0)
+        {
+            // A failed fetch or an error page, the songs of the album are missing from the mirror
+            printf("[!] No songs found at %s\n", album->url);
+            failed++;
+        }
+        else if (make_directory(album->folder) != 0)
+        {
+            printf("[!] Error creating the directory %s\n", album->folder);
+            song_list.count = 0;
+            failed++;
+        }
+
+        long skipped = 0;
+        long too_long = 0;
+        long repeated = 0;
+
+        for (int i = 0; i < song_list.count && !cancelled; i++)
+        {
+            const SongInfo *song = &song_list.songs[i];
+
+            // Album pages link every song twice, and two downloads of one file would race for its part file
+            int seen = 0;
+            for (int j = 0; j < i && !seen; j++)
+            {
+                seen = strcmp(song_list.songs[j].url, song->url) == 0;
+            }
+            if (seen)
+            {
+                repeated++;
+                continue;
+            }
+
+            char file_name[MAX_SONG_NAME_LENGTH];
+            mirror_file_name(song->name, file_name, sizeof(file_name));
+
+            MirrorSong *item = rn_malloc(sizeof(MirrorSong));
+            if (item == NULL)
+            {
+                cancelled = 1;
+                break;
+            }
+            if (snprintf(item->path, sizeof(item->path), "%s/%s", album->folder, file_name) >= (int)sizeof(item->path))
+            {
+                printf("[!] Path too long for %s in %s\n", file_name, album->folder);
+                free(item);
+                too_long++;
+                continue;
+            }
+
+            // Files only get their final name once complete, so these are done already
+            FILE *existing = fopen(item->path, "rb");
+            if (existing != NULL)
+            {
+                fclose(existing);
+                free(item);
+                skipped++;
+                continue;
+            }
+
+            url_encode_spaces_into(song->url, strlen(song->url), item->url, sizeof(item->url));
+
+            if (mirror_queue_push(&mirror->songs, item) != 0)
+            {
+                free(item);
+                cancelled = 1;
+            }
+        }
+
+        rn_mutex_lock(&mirror->lock);
+        mirror->song_count += song_list.count - repeated;
+        mirror->skipped += skipped;
+        mirror->failed += failed + too_long;
+        rn_mutex_unlock(&mirror->lock);
+
+        arena_free(&arena);
+        free(album);
+    }
+
+    mirror_queue_done(&mirror->songs);
+    rn_client_bind(NULL);
+    mirror_worker_done(mirror);
+}
+
+static void mirror_downloaded(const char *output_file, int result, void *userdata)
+{
+    /* Function  : static void mirror_downloaded(const char *output_file, int result, void *userdata)
+     * Input     : output_file - pointer to the path of the song
+     *             result - 0 if the song was downloaded, -1 otherwise
+     *             userdata - pointer to the MirrorSong
+     * Output    : None
+     * Procedure : This function is the completion callback of a download of the last stage. It adds the size of the song to the totals and frees its download slot.
+     */
+
+    MirrorSong *song = (MirrorSong *)userdata;
+    Mirror *mirror = song->mirror;
+
+    long long size = 0;
+    if (result == 0)
+    {
+        FILE *file = fopen(output_file, "rb");
+        if (file != NULL)
+        {
+            fseek(file, 0, SEEK_END);
+            size = ftell(file);
+            fclose(file);
+        }
+    }
+
+    rn_mutex_lock(&mirror->lock);
+    if (result == 0)
+    {
+        mirror->downloaded++;
+        mirror->bytes += size;
+    }
+    else
+    {
+        mirror->failed++;
+    }
+    rn_mutex_unlock(&mirror->lock);
+
+    mirror->downloading--;
+    free(song);
+}
+
+static void mirror_download(void *argument)
+{
+    /* Function  : static void mirror_download(void *argument)
+     * Input     : argument - pointer to the MirrorWorker of the stage
+     * Output    : None
+     * Procedure : This function is the last stage. It keeps up to --jobs songs downloading at once on an event loop, each with download_file_async (resuming a part file left by an interrupted run) over the connections of its client, and takes the next song from the queue as soon as a download finishes. While download slots are free and the queue is empty, the free slots count as waiting for the queue.
+     */
+
+    MirrorWorker *worker = (MirrorWorker *)argument;
+    Mirror *mirror = worker->mirror;
+    rn_client_bind(worker->client);
+
+    EventLoop loop;
+    int closed = loop_init(&loop) != 0;
+
+    if (closed)
+    {
+        fprintf(stderr, "Couldn't start the download loop\n");
+        mirror_queue_cancel(&mirror->songs);
+        mirror_queue_cancel(&mirror->albums);
+        mirror_queue_cancel(&mirror->bands);
+    }
+    else
+    {
+        rn_mutex_lock(&mirror->songs.lock);
+        mirror->songs.waiter = &loop;
+        rn_mutex_unlock(&mirror->songs.lock);
+    }
+
+    while (!closed || mirror->downloading > 0)
+    {
+        int empty = 0;
+
+        while (!closed && mirror->downloading < mirror->downloaders)
+        {
+            MirrorSong *song;
+            int status = mirror_queue_try_pop(&mirror->songs, (void **)&song);
+            if (status <= 0)
+            {
+                closed = status < 0;
+                empty = status == 0;
+                break;
+            }
+
+            rn_mutex_lock(&mirror->lock);
+            if (mirror->first_download == 0)
+            {
+                mirror->first_download = rn_clock();
+            }
+            rn_mutex_unlock(&mirror->lock);
+
+            song->mirror = mirror;
+            if (download_file_async(&loop, song->url, song->path, mirror_downloaded, song) == 0)
+            {
+                mirror->downloading++;
+                continue;
+            }
+
+            rn_mutex_lock(&mirror->lock);
+            mirror->failed++;
+            rn_mutex_unlock(&mirror->lock);
+            free(song);
+        }
+
+        if (closed && mirror->downloading == 0)
+        {
+            break;
+        }
+
+        // Finished downloads are settled by mirror_downloaded from in here
+        int idle = mirror->downloaders - mirror->downloading;
+        double waited = rn_clock();
+        loop_run_once(&loop, 1000);
+
+        if (empty)
+        {
+            rn_mutex_lock(&mirror->songs.lock);
+            mirror->songs.empty_time += (rn_clock() - waited) * idle;
+            rn_mutex_unlock(&mirror->songs.lock);
+        }
+    }
+
+    rn_mutex_lock(&mirror->songs.lock);
+    mirror->songs.waiter = NULL;
+    rn_mutex_unlock(&mirror->songs.lock);
+    loop_free(&loop);
+
+    rn_client_bind(NULL);
+    mirror_worker_done(mirror);
+}
+
+static void mirror_worker_done(Mirror *mirror)
+{
+    /* Function  : static void mirror_worker_done(Mirror *mirror)
+     * Input     : mirror - pointer to the Mirror
+     * Output    : None
+     * Procedure : This function records that a worker has returned and wakes the thread waiting for the pipeline to finish.
+     */
+
+    rn_mutex_lock(&mirror->lock);
+    mirror->running--;
+    rn_cond_broadcast(&mirror->finished);
+    rn_mutex_unlock(&mirror->lock);
+}
+
+static void mirror_report(Mirror *mirror, double now)
+{
+    /* Function  : static void mirror_report(Mirror *mirror, double now)
+     * Input     : mirror - pointer to the Mirror, locked by the caller
+     *             now - current time, from rn_clock
+     * Output    : None
+     * Procedure : This function prints a progress line with the depth of every queue and the throughput so far.
+     */
+
+    double elapsed = now - mirror->started;
+
+    printf("[~] %.1fs: queued %d band(s), %d/%d albums, %d/%d songs; %ld/%ld songs downloaded, %.2f MB/s\n",
+           elapsed, mirror_queue_depth(&mirror->bands), mirror_queue_depth(&mirror->albums), mirror->albums.capacity,
+           mirror_queue_depth(&mirror->songs), mirror->songs.capacity, mirror->downloaded,
+           mirror->song_count - mirror->skipped, elapsed > 0 ? (double)mirror->bytes / elapsed / (1024.0 * 1024.0) : 0.0);
+    fflush(stdout);
+}
+
+static void mirror_print_queue(MirrorQueue *queue, double now)
+{
+    /* Function  : static void mirror_print_queue(MirrorQueue *queue, double now)
+     * Input     : queue - pointer to a MirrorQueue no thread uses anymore
+     *             now - time the pipeline finished, from rn_clock
+     * Output    : None
+     * Procedure : This function prints one line of the queue summary. A queue that was often full points at a slow stage after it, one that was often empty at a slow stage before it.
+     */
+
+    mirror_queue_account(queue, now);
+    double lifetime = now - queue->opened;
+
+    printf("\t%-8s %8d %8ld %10d %10.2f %9.2fs %9.2fs\n", queue->name, queue->capacity, queue->passed, queue->max_depth,
+           lifetime > 0 ? queue->depth_area / lifetime : 0.0, queue->full_time, queue->empty_time);
+}
+
+RN_API int mirror_band(const char *band, const char *output_folder, int downloaders)
+{
+    /*
+     * Function  : int mirror_band(const char *band, const char *output_folder, int downloaders)
+     * Input     : band - pointer to the name or URL of the band
+     *             output_folder - pointer to the folder the albums are written to, one folder per album
+     *             downloaders - songs downloaded at the same time (at most MIRROR_MAX_DOWNLOADERS)
+     * Output    : Returns 0 if every song of the band is in output_folder afterwards, -1 otherwise
+     * Procedure : This function mirrors the discography of a band with the pipeline described at the top of this header. The clients of the workers are created on the calling thread, so they carry its settings (cache, offline mode, --refresh). While the pipeline runs, a progress line with the depth of every queue is printed every MIRROR_REPORT_INTERVAL seconds; at the end the totals, the end-to-end throughput and a summary of every queue are printed. Songs already in output_folder are skipped, so running the command again resumes an interrupted mirror.
+     */
+
+    Mirror *mirror = rn_calloc(1, sizeof(Mirror));
+    if (mirror == NULL)
+    {
+        fprintf(stderr, "Not enough memory to mirror the band\n");
+        return -1;
+    }
+
+    if (downloaders < 1)
+    {
+        downloaders = 1;
+    }
+    if (downloaders > MIRROR_MAX_DOWNLOADERS)
+    {
+        downloaders = MIRROR_MAX_DOWNLOADERS;
+    }
+
+    mirror->band = band;
+    mirror->output_folder = output_folder;
+    mirror->downloaders = downloaders;
+    rn_mutex_init(&mirror->lock);
+    rn_cond_init(&mirror->finished);
+
+    int result = -1;
+
+    if (make_directory(output_folder) != 0)
+    {
+        printf("[!] Error creating the directory %s\n", output_folder);
+    }
+    else if (mirror_queue_init(&mirror->bands, "bands", MIRROR_BAND_QUEUE, 1) != 0 ||
+             mirror_queue_init(&mirror->albums, "albums", MIRROR_ALBUM_QUEUE, 1) != 0 ||
+             mirror_queue_init(&mirror->songs, "songs", MIRROR_SONG_QUEUE, MIRROR_PARSERS) != 0)
+    {
+        fprintf(stderr, "Not enough memory to mirror the band\n");
+    }
+    else
+    {
+        mirror->workers[mirror->worker_count++].stage = mirror_resolve;
+        mirror->workers[mirror->worker_count++].stage = mirror_paginate;
+        for (int i = 0; i < MIRROR_PARSERS; i++)
+        {
+            mirror->workers[mirror->worker_count++].stage = mirror_parse;
+        }
+        mirror->workers[mirror->worker_count++].stage = mirror_download;
+
+        int ready = 1;
+        for (int i = 0; i < mirror->worker_count && ready; i++)
+        {
+            mirror->workers[i].mirror = mirror;
+            mirror->workers[i].client = rn_client_create();
+            ready = mirror->workers[i].client != NULL;
+        }
+        if (!ready)
+        {
+            fprintf(stderr, "Not enough memory to mirror the band\n");
+        }
+
+        mirror->started = rn_clock();
+        mirror->running = mirror->worker_count;
+
+        for (int i = 0; i < mirror->worker_count; i++)
+        {
+            MirrorWorker *worker = &mirror->workers[i];
+            worker->started = ready && rn_thread_start(&worker->thread, worker->stage, worker) == 0;
+            if (!worker->started)
+            {
+                // A missing stage would leave the others waiting, so the whole pipeline stops
+                if (ready)
+                {
+                    fprintf(stderr, "Couldn't start the mirror threads\n");
+                    ready = 0;
+                }
+                mirror_worker_done(mirror);
+                mirror_queue_cancel(&mirror->bands);
+                mirror_queue_cancel(&mirror->albums);
+                mirror_queue_cancel(&mirror->songs);
+            }
+        }
+
+        rn_mutex_lock(&mirror->lock);
+        double reported = mirror->started;
+        while (mirror->running > 0)
+        {
+            double now = rn_clock();
+            if (now - reported >= MIRROR_REPORT_INTERVAL)
+            {
+                mirror_report(mirror, now);
+                reported = now;
+            }
+            rn_cond_timed_wait(&mirror->finished, &mirror->lock, reported + MIRROR_REPORT_INTERVAL - now);
+        }
+        rn_mutex_unlock(&mirror->lock);
+
+        for (int i = 0; i < mirror->worker_count; i++)
+        {
+            if (mirror->workers[i].started)
+            {
+                rn_thread_join(mirror->workers[i].thread);
+            }
+        }
+
+        double finished = rn_clock();
+        double elapsed = finished - mirror->started;
+
+        if (ready)
+        {
+            printf("[?] %ld albums, %ld songs: %ld downloaded, %ld already there, %ld failed.\n", mirror->album_count,
+                   mirror->song_count, mirror->downloaded, mirror->skipped, mirror->failed);
+            printf("[?] %.2f MB in %.2fs end to end (%.2f MB/s, %.2f songs/s)", (double)mirror->bytes / (1024.0 * 1024.0), elapsed,
+                   elapsed > 0 ? (double)mirror->bytes / elapsed / (1024.0 * 1024.0) : 0.0,
+                   elapsed > 0 ? (double)mirror->downloaded / elapsed : 0.0);
+            if (mirror->first_download > 0)
+            {
+                printf(", first download after %.2fs", mirror->first_download - mirror->started);
+            }
+            printf("\n");
+            printf("[?] Queues:\n\t%-8s %8s %8s %10s %10s %10s %10s\n", "queue", "capacity", "passed", "max depth", "avg depth",
+                   "full for", "empty for");
+            mirror_print_queue(&mirror->bands, finished);
+            mirror_print_queue(&mirror->albums, finished);
+            mirror_print_queue(&mirror->songs, finished);
+
+            result = mirror->album_count > 0 && mirror->failed == 0 && mirror->downloaded + mirror->skipped == mirror->song_count ? 0 : -1;
+        }
+    }
+
+    for (int i = 0; i < mirror->worker_count; i++)
+    {
+        rn_client_destroy(mirror->workers[i].client);
+    }
+
+    mirror_queue_free(&mirror->songs);
+    mirror_queue_free(&mirror->albums);
+    mirror_queue_free(&mirror->bands);
+    rn_cond_destroy(&mirror->finished);
+    rn_mutex_destroy(&mirror->lock);
+    free(mirror);
+
+    return result;
+}
@@ -0,0 +1,1089 @@
+// rocknation_multi.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_utils.h"
+#include "rocknation_curl.h"
+#include "rocknation_loop.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#define MAX_PARALLEL_JOBS 32
+#define MIN_SEGMENT_SIZE (256 * 1024)
+
+typedef struct
+{
+    const char *url;         // URL of the file to download
+    const char *output_file; // Path the file is written to
+    const char *label;       // Name shown in progress output
+} DownloadJob;
+
+typedef struct DownloadBatch DownloadBatch;
+
+typedef struct
+{
+    CURL *curl;
+    DownloadJob *job;
+    char *https_url;
+    FileStruct out;
+    int index;        // Position of the job in the job list (1-based, for display)
+    int last_percent; // Last progress step printed for this transfer
+    DownloadBatch *batch;
+} TransferState;
+
+struct DownloadBatch
+{
+    EventLoop loop; // Drives every transfer of the batch
+    int job_count;
+    int failed;     // Downloads that failed so far
+};
+
+typedef struct
+{
+    DownloadBatch *batch;
+    DownloadJob *job;
+    int index;
+} TransferCommit;
+
+typedef struct PageBatch PageBatch;
+
+typedef struct
+{
+    MemoryStruct chunk;   // Raw HTML of the page, released once parsed
+    Arena arena;          // Holds the albums of the page until they are merged
+    AlbumInfoList albums;
+    int found;            // Albums found on the page
+    int parsed;           // Set by the task once the page is parsed, guarded by the lock of the batch
+    PageBatch *batch;
+} PageParse;
+
+typedef struct
+{
+    int page;           // Page number (1-based)
+    int done;           // Set once the page has been fetched
+    MemoryStruct chunk; // Raw HTML of the page while it is in flight
+    AsyncPage *fetch;   // Request of the page while it is in flight
+    PageParse *parse;   // Albums found on the page, merged in page order at the end; NULL if the page failed
+    int parsing;        // Set while the page is being parsed by the pool
+    PageBatch *batch;
+} PageState;
+
+struct PageBatch
+{
+    EventLoop loop; // Woken up when a page is parsed
+    RnMutex lock;
+    WorkPool *pool;
+    PageState **pages; // Pages requested so far, by page number
+    int next_page;
+    int last_page;  // Last page that can still have albums
+    int complete;   // last_page is known because the page after it came back empty
+    int in_flight;  // Pages requested and not fetched yet
+    int parsing;    // Pages handed to the pool and not parsed yet
+};
+
+typedef struct
+{
+    CURL *curl;
+    int fd;             // Preallocated output file shared by every segment
+    curl_off_t start;   // First byte of the range
+    curl_off_t end;     // Last byte of the range (inclusive)
+    curl_off_t offset;  // Position the next received byte is written to
+    int error;          // Set when a positioned write failed or the range didn't arrive complete
+    int finished;       // Set once the transfer of the range is over
+} SegmentState;
+
+static int TransferProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+static void configure_transfer(TransferState *state);
+static int start_transfer(DownloadBatch *batch, TransferState *state, DownloadJob *job, int index);
+static int finish_transfer(TransferState *state, CURLcode res);
+static void transfer_done(CURL *curl, CURLcode result, void *userdata);
+static void transfer_committed(CURL *curl, CURLcode result, void *userdata);
+RN_API int download_files_parallel(DownloadJob *jobs, int job_count, int max_jobs);
+static int start_page(PageBatch *batch, PageState *state, const char *band_url, int page);
+static void release_page(PageBatch *batch, PageState *state);
+static void cancel_pages(PageBatch *batch);
+static void page_fetched(MemoryStruct *chunk, long status, void *userdata);
+static void parse_page(void *argument);
+static int page_parsed(PageState *state);
+RN_API int get_albums_parallel(const char *band_url, AlbumInfoList *album_list, int window);
+RN_API void get_albums_by_name_parallel(const char *band_name, AlbumInfoList *album_list, int window);
+static size_t WriteSegmentCallback(void *contents, size_t size, size_t nmemb, void *userp);
+static void segment_done(CURL *curl, CURLcode result, void *userdata);
+static size_t ProbeWriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+static curl_off_t probe_range_support(const char *url);
+RN_API int download_file_segmented(const char *url, const char *output_file, int segments);
+
+static int TransferProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    /* Function  : static int TransferProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+     * Input     : clientp - pointer to the TransferState of the transfer
+     *             dltotal - total number of bytes expected to be downloaded (0 if unknown)
+     *             dlnow - number of bytes downloaded so far
+     *             ultotal, ulnow - upload counters (unused)
+     * Output    : Returns 0 to let the transfer continue
+     * Procedure : This function is used as CURLOPT_XFERINFOFUNCTION for concurrent downloads. It prints a progress line for the track every time it crosses another 25% of its size, so interleaved transfers stay readable.
+     */
+
+    (void)ultotal;
+    (void)ulnow;
+
+    TransferState *state = (TransferState *)clientp;
+
+    if (dltotal <= 0)
+    {
+        return 0;
+    }
+
+    int percent = (int)((dlnow * 100) / dltotal);
+    int step = (percent / 25) * 25;
+
+    if (step > state->last_percent && step < 100)
+    {
+        state->last_percent = step;
+        printf("[%d] %3d%% %s\n", state->index, step, state->job->label);
+        fflush(stdout);
+    }
+
+    return 0;
+}
+
+static void configure_transfer(TransferState *state)
+{
+    /* Function  : static void configure_transfer(TransferState *state)
+     * Input     : state - pointer to the TransferState of the transfer
+     * Output    : None
+     * Procedure : This function (re)sets the options of the easy handle of a transfer so it streams into the part file of its job through WriteFileCallback, continuing whatever an earlier attempt left in it.
+     */
+
+    curl_easy_reset(state->curl);
+    session_attach(state->curl);
+    curl_easy_setopt(state->curl, CURLOPT_URL, state->https_url);
+    curl_easy_setopt(state->curl, CURLOPT_WRITEFUNCTION, WriteFileCallback);
+    curl_easy_setopt(state->curl, CURLOPT_WRITEDATA, (void *)&state->out);
+    curl_easy_setopt(state->curl, CURLOPT_BUFFERSIZE, (long)DOWNLOAD_BUFFER_SIZE);
+    curl_easy_setopt(state->curl, CURLOPT_XFERINFOFUNCTION, TransferProgressCallback);
+    curl_easy_setopt(state->curl, CURLOPT_XFERINFODATA, (void *)state);
+    curl_easy_setopt(state->curl, CURLOPT_NOPROGRESS, 0L);
+    setup_resume(state->curl, &state->out);
+}
+
+static int start_transfer(DownloadBatch *batch, TransferState *state, DownloadJob *job, int index)
+{
+    /* Function  : static int start_transfer(DownloadBatch *batch, TransferState *state, DownloadJob *job, int index)
+     * Input     : batch - pointer to the DownloadBatch whose loop drives the downloads
+     *             state - pointer to a free TransferState slot
+     *             job - pointer to the DownloadJob to start
+     *             index - 1-based position of the job, used in progress output
+     * Output    : Returns 0 if the transfer was added to the loop, -1 otherwise
+     * Procedure : This function opens the part file of the job, prepares an easy handle that streams into it through WriteFileCallback (resuming a previous attempt if there is one) and adds it to the loop, which hands it to finish_transfer once it is over. Its buffers are written by the disk writer (see attach_disk_writer).
+     */
+
+    state->batch = batch;
+    state->job = job;
+    state->index = index;
+    state->last_percent = 0;
+    state->https_url = replace_http(job->url);
+    state->curl = NULL;
+
+    if (open_file_struct(&state->out, job->output_file) != 0 || state->https_url == NULL)
+    {
+        printf("[%d] Error opening file for writing: %s\n", index, job->output_file);
+        close_file_struct(&state->out, 0);
+        free(state->https_url);
+        state->https_url = NULL;
+        state->job = NULL;
+        return -1;
+    }
+
+    state->curl = curl_easy_init();
+    if (state->curl == NULL)
+    {
+        close_file_struct(&state->out, 0);
+        free(state->https_url);
+        state->https_url = NULL;
+        state->job = NULL;
+        return -1;
+    }
+
+    // The thread driving every transfer shouldn't wait for the disk
+    attach_disk_writer(&state->out, get_disk_writer());
+
+    configure_transfer(state);
+    if (loop_add(&batch->loop, state->curl, transfer_done, state) != 0)
+    {
+        curl_easy_cleanup(state->curl);
+        state->curl = NULL;
+        close_file_struct(&state->out, 0);
+        free(state->https_url);
+        state->https_url = NULL;
+        state->job = NULL;
+        return -1;
+    }
+
+    if (state->out.resume_from > 0)
+    {
+        printf("[%d] Resuming %s at %" CURL_FORMAT_CURL_OFF_T " bytes\n", index, job->label, state->out.resume_from);
+    }
+    else
+    {
+        printf("[%d] Started %s\n", index, job->label);
+    }
+
+    return 0;
+}
+
+static int finish_transfer(TransferState *state, CURLcode res)
+{
+    /* Function  : static int finish_transfer(TransferState *state, CURLcode res)
+     * Input     : state - pointer to the TransferState of the completed transfer, whose handle has left the loop
+     *             res - result code reported by curl for the transfer
+     * Output    : Returns 0 if the file was downloaded successfully, 1 if the transfer was restarted from the first byte, -1 otherwise
+     * Procedure : This function settles a completed transfer. If the server refused to continue the part file, the transfer is restarted from scratch in the same slot. Otherwise it reports the result, releases the easy handle, hands a complete part file to the disk writer to be flushed and renamed to its final name (an incomplete one is kept for the next run) and frees the slot for the next job. A file that then can't be committed is counted as failed by transfer_committed.
+     */
+
+    int job_count = state->batch->job_count;
+
+    session_record_timings(state->curl, state->https_url);
+
+    // Write out whatever is still staged in the buffer
+    flush_file_buffer(&state->out);
+    int status = check_resumed_transfer(state->curl, res, &state->out);
+    if (status == 1)
+    {
+        printf("[%d] Server can't resume %s, starting over\n", state->index, state->job->label);
+        configure_transfer(state);
+        if (loop_add(&state->batch->loop, state->curl, transfer_done, state) == 0)
+        {
+            return 1;
+        }
+        status = -1;
+    }
+
+    int result = -1;
+
+    if (status == 0)
+    {
+        curl_off_t speed = 0;
+        curl_easy_getinfo(state->curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+
+        printf("[%d/%d] Done %s (%zu bytes, %.1f KB/s)\n", state->index, job_count, state->job->output_file, state->out.total, (double)speed / 1024.0);
+        result = 0;
+    }
+    else if (state->out.error)
+    {
+        printf("[%d/%d] Error writing file %s\n", state->index, job_count, state->job->output_file);
+    }
+    else
+    {
+        printf("[%d/%d] Failed %s: %s\n", state->index, job_count, state->job->label, curl_easy_strerror(res));
+    }
+
+    curl_easy_cleanup(state->curl);
+    state->curl = NULL;
+
+    TransferCommit *commit = result == 0 ? rn_malloc(sizeof(TransferCommit)) : NULL;
+    if (commit != NULL)
+    {
+        commit->batch = state->batch;
+        commit->job = state->job;
+        commit->index = state->index;
+        if (loop_commit_file(&state->batch->loop, &state->out, transfer_committed, commit) != 0)
+        {
+            free(commit);
+            commit = NULL;
+        }
+    }
+
+    if (commit == NULL)
+    {
+        close_file_struct(&state->out, result == 0);
+        if (result == 0 && state->out.error)
+        {
+            printf("[%d/%d] Error renaming %s.part\n", state->index, job_count, state->job->output_file);
+            result = -1;
+        }
+    }
+
+    free(state->https_url);
+    state->https_url = NULL;
+    state->job = NULL;
+
+    return result;
+}
+
+static void transfer_done(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void transfer_done(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - pointer to the easy handle of the transfer (unused, it is in the state)
+     *             result - result code reported by curl for the transfer
+     *             userdata - pointer to the TransferState of the transfer
+     * Output    : None
+     * Procedure : This function is the completion callback of the transfers of download_files_parallel. It settles the transfer with finish_transfer and counts it if it failed.
+     */
+
+    (void)curl;
+
+    TransferState *state = (TransferState *)userdata;
+
+    if (finish_transfer(state, result) == -1)
+    {
+        state->batch->failed++;
+    }
+}
+
+static void transfer_committed(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void transfer_committed(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - NULL, the handle of the transfer is gone already
+     *             result - CURLE_OK once the file has its final name, CURLE_WRITE_ERROR otherwise
+     *             userdata - pointer to the TransferCommit, released here
+     * Output    : None
+     * Procedure : This function is called by the loop once the disk writer has committed the file of a finished transfer (see loop_commit_file). A file that couldn't be flushed or renamed is reported and counted as failed.
+     */
+
+    (void)curl;
+
+    TransferCommit *commit = (TransferCommit *)userdata;
+
+    if (result != CURLE_OK)
+    {
+        printf("[%d/%d] Error renaming %s.part\n", commit->index, commit->batch->job_count, commit->job->output_file);
+        commit->batch->failed++;
+    }
+
+    free(commit);
+}
+
+RN_API int download_files_parallel(DownloadJob *jobs, int job_count, int max_jobs)
+{
+    /*
+     * Function  : int download_files_parallel(DownloadJob *jobs, int job_count, int max_jobs)
+     * Input     : jobs - pointer to an array of DownloadJob structures
+     *             job_count - number of jobs in the array
+     *             max_jobs - maximum number of transfers to run at the same time
+     * Output    : Returns the number of downloads that failed
+     * Procedure : This function downloads several files concurrently on an event loop (see rocknation_loop.h). Up to max_jobs transfers run at once, each streaming into its own part file and resuming an interrupted earlier attempt exactly like download_file does; as soon as one finishes the next pending job is started. Progress is printed per track.
+     */
+
+    if (max_jobs < 1)
+    {
+        max_jobs = 1;
+    }
+    if (max_jobs > MAX_PARALLEL_JOBS)
+    {
+        max_jobs = MAX_PARALLEL_JOBS;
+    }
+
+    DownloadBatch batch;
+    if (loop_init(&batch.loop) != 0)
+    {
+        return job_count;
+    }
+    batch.job_count = job_count;
+    batch.failed = 0;
+
+    TransferState slots[MAX_PARALLEL_JOBS];
+    memset(slots, 0, sizeof(slots));
+
+    int next_job = 0;
+
+    while (1)
+    {
+        // Fill every free slot with the next pending job
+        for (int i = 0; i < max_jobs && next_job < job_count; i++)
+        {
+            if (slots[i].job == NULL)
+            {
+                if (start_transfer(&batch, &slots[i], &jobs[next_job], next_job + 1) != 0)
+                {
+                    batch.failed++;
+                    i--; // Retry the same slot with the following job
+                }
+                next_job++;
+            }
+        }
+
+        if (batch.loop.active == 0 && next_job >= job_count)
+        {
+            break;
+        }
+
+        // Finished transfers are settled by transfer_done from in here
+        loop_run_once(&batch.loop, 1000);
+    }
+
+    loop_free(&batch.loop);
+
+    return batch.failed;
+}
+
+static int start_page(PageBatch *batch, PageState *state, const char *band_url, int page)
+{
+    /* Function  : static int start_page(PageBatch *batch, PageState *state, const char *band_url, int page)
+     * Input     : batch - pointer to the PageBatch whose loop drives the page requests
+     *             state - pointer to the PageState of the page
+     *             band_url - pointer to the URL of the band
+     *             page - page number to request
+     * Output    : Returns 0 if the request was started, -1 otherwise
+     * Procedure : This function starts fetching one page of a band's discography into memory with fetch_page_async, so the page goes through the cache like with get_albums. page_fetched is called once it is there.
+     */
+
+    char page_url[MAX_URL_LENGTH];
+    snprintf(page_url, sizeof(page_url), "%s/%d", band_url, page);
+
+    state->page = page;
+    state->done = 0;
+    state->parse = NULL;
+    state->parsing = 0;
+    state->batch = batch;
+    state->fetch = NULL;
+    init_memory_struct(&state->chunk);
+
+    if (state->chunk.memory == NULL)
+    {
+        return -1;
+    }
+
+    state->fetch = fetch_page_async(&batch->loop, page_url, NULL, &state->chunk, page_fetched, state);
+    return state->fetch != NULL ? 0 : -1;
+}
+
+static void release_page(PageBatch *batch, PageState *state)
+{
+    /* Function  : static void release_page(PageBatch *batch, PageState *state)
+     * Input     : batch - pointer to the PageBatch whose loop drives the page requests
+     *             state - pointer to the PageState of the page
+     * Output    : None
+     * Procedure : This function cancels the request of a page if it is still in flight and frees its buffer. The parsed albums live in the arena of the page and are kept until they are merged.
+     */
+
+    if (state->fetch != NULL)
+    {
+        fetch_page_cancel(&batch->loop, state->fetch);
+        state->fetch = NULL;
+    }
+
+    free(state->chunk.memory);
+    state->chunk.memory = NULL;
+    state->chunk.capacity = 0;
+}
+
+static void cancel_pages(PageBatch *batch)
+{
+    /* Function  : static void cancel_pages(PageBatch *batch)
+     * Input     : batch - pointer to the PageBatch
+     * Output    : None
+     * Procedure : This function cancels the pages after the last one that can have albums that are still in flight, once the end of the discography (or a failed page) has been found.
+     */
+
+    for (int i = batch->last_page + 1; i < batch->next_page; i++)
+    {
+        PageState *state = batch->pages[i - 1];
+        if (!state->done && state->fetch != NULL)
+        {
+            release_page(batch, state);
+            batch->in_flight--;
+        }
+    }
+}
+
+static void page_fetched(MemoryStruct *chunk, long status, void *userdata)
+{
+    /* Function  : static void page_fetched(MemoryStruct *chunk, long status, void *userdata)
+     * Input     : chunk - pointer to the buffer of the page (unused, it is in the state)
+     *             status - HTTP status of the page, 0 if it couldn't be fetched
+     *             userdata - pointer to the PageState of the page
+     * Output    : None
+     * Procedure : This function is the completion callback of a discography page. A page fetched with status 200 (or answered from the cache) is handed to the default pool to be parsed (see rocknation_pool.h), or parsed right away if there is no pool. A failed page, or any other status, ends the discography before it and leaves it incomplete, so it isn't stored: every page after it is cancelled, since nothing after it can be trusted.
+     */
+
+    (void)chunk;
+
+    PageState *state = (PageState *)userdata;
+    PageBatch *batch = state->batch;
+
+    state->fetch = NULL;
+    state->done = 1;
+    batch->in_flight--;
+
+    // An error page has no albums either, and must not pass for the end of the discography
+    if (status == 200)
+    {
+        state->parse = rn_calloc(1, sizeof(PageParse));
+    }
+    if (state->parse != NULL)
+    {
+        // The page is handed over to its parse task
+        state->parse->chunk = state->chunk;
+        state->parse->batch = batch;
+        arena_init(&state->parse->arena, ARENA_BLOCK_SIZE);
+        init_album_list(&state->parse->albums, &state->parse->arena);
+        state->chunk.memory = NULL;
+        state->parsing = 1;
+        batch->parsing++;
+
+        if (batch->pool == NULL || pool_submit(batch->pool, parse_page, state->parse) != 0)
+        {
+            parse_page(state->parse);
+        }
+    }
+
+    release_page(batch, state);
+
+    if (state->parse == NULL && state->page - 1 < batch->last_page)
+    {
+        batch->last_page = state->page - 1;
+        batch->complete = 0;
+        cancel_pages(batch);
+    }
+}
+
+static void parse_page(void *argument)
+{
+    /* Function  : static void parse_page(void *argument)
+     * Input     : argument - pointer to the PageParse of a fetched page
+     * Output    : None
+     * Procedure : This function is the pool task parsing one discography page into the arena of the page. It releases the HTML, marks the page parsed and wakes the event loop waiting for it.
+     */
+
+    PageParse *parse = (PageParse *)argument;
+
+    parse->found = parse_albums(parse->chunk.memory, parse->chunk.size, &parse->albums);
+    free(parse->chunk.memory);
+    parse->chunk.memory = NULL;
+
+    // The loop may release the page and the batch as soon as it sees it parsed, so nothing is touched after the unlock
+    PageBatch *batch = parse->batch;
+    rn_mutex_lock(&batch->lock);
+    parse->parsed = 1;
+    loop_wakeup(&batch->loop);
+    rn_mutex_unlock(&batch->lock);
+}
+
+static int page_parsed(PageState *state)
+{
+    /* Function  : static int page_parsed(PageState *state)
+     * Input     : state - pointer to the PageState of a page handed to the pool
+     * Output    : Returns 1 if the pool has parsed the page, 0 otherwise
+     * Procedure : This function checks whether the parse task of a page has finished; once it returns 1, the albums of the page can be read without the lock.
+     */
+
+    rn_mutex_lock(&state->parse->batch->lock);
+    int parsed = state->parse->parsed;
+    rn_mutex_unlock(&state->parse->batch->lock);
+
+    return parsed;
+}
+
+RN_API int get_albums_parallel(const char *band_url, AlbumInfoList *album_list, int window)
+{
+    /*
+     * Function  : int get_albums_parallel(const char *band_url, AlbumInfoList *album_list, int window)
+     * Input     : band_url - pointer to the URL of the band
+     *             album_list - pointer to the AlbumInfoList structure to store album information
+     *             window - maximum number of pages requested at the same time
+     * Output    : Updates the album_list with album information. Returns 0 if the whole discography was read (or answered from the store), -1 otherwise, like get_albums
+     * Procedure : This function retrieves the same albums as get_albums, but speculatively keeps up to window pages of the discography in flight on an event loop (see rocknation_loop.h), each going through the page cache like with get_albums. The number of pages isn't known in advance, so as soon as one page comes back empty (or fails) every page after it is cancelled and no more pages are started. The albums of each page are parsed by the default pool as it arrives (see rocknation_pool.h), so the loop keeps serving the other pages meanwhile, and merged into album_list in page order once all pages up to the last one are done. Like get_albums, it answers from and adds to the local catalog store.
+     */
+
+    album_list->count = 0;
+
+    if (store_albums(band_url, album_list) == 0)
+    {
+        return 0;
+    }
+
+    if (window < 1)
+    {
+        window = 1;
+    }
+    if (window > MAX_PARALLEL_JOBS)
+    {
+        window = MAX_PARALLEL_JOBS;
+    }
+
+    PageBatch batch;
+    if (loop_init(&batch.loop) != 0)
+    {
+        return -1;
+    }
+    rn_mutex_init(&batch.lock);
+    batch.pool = get_pool();
+    batch.next_page = 1;
+    batch.last_page = INT_MAX;
+    batch.complete = 0;
+    batch.in_flight = 0;
+    batch.parsing = 0;
+
+    int capacity = 16;
+    batch.pages = rn_calloc(capacity, sizeof(PageState *));
+
+    while (batch.pages != NULL)
+    {
+        // Keep the window full while pages can still have albums; a page waiting for the pool still holds its place,
+        // or a slow pool would let the loop start pages far past the end of the discography
+        while (batch.in_flight + batch.parsing < window && batch.next_page <= batch.last_page)
+        {
+            if (batch.next_page > capacity)
+            {
+                PageState **grown = rn_realloc(batch.pages, capacity * 2 * sizeof(PageState *));
+                if (grown == NULL)
+                {
+                    batch.last_page = batch.next_page - 1;
+                    break;
+                }
+                memset(grown + capacity, 0, capacity * sizeof(PageState *));
+                batch.pages = grown;
+                capacity *= 2;
+            }
+
+            PageState *state = rn_calloc(1, sizeof(PageState));
+            if (state == NULL || start_page(&batch, state, band_url, batch.next_page) != 0)
+            {
+                if (state != NULL)
+                {
+                    release_page(&batch, state);
+                    free(state);
+                }
+                batch.last_page = batch.next_page - 1;
+                break;
+            }
+
+            batch.pages[batch.next_page - 1] = state;
+            batch.in_flight++;
+            batch.next_page++;
+        }
+
+        if (batch.in_flight == 0 && batch.parsing == 0)
+        {
+            break;
+        }
+
+        // Fetched pages are handed to the pool by page_fetched from in here
+        loop_run_once(&batch.loop, 1000);
+
+        // Settle the pages the pool has parsed since the last round
+        for (int i = 0; i < batch.next_page - 1; i++)
+        {
+            PageState *state = batch.pages[i];
+            if (!state->parsing || !page_parsed(state))
+            {
+                continue;
+            }
+
+            state->parsing = 0;
+            batch.parsing--;
+
+            if (state->parse->found == 0 && state->page - 1 < batch.last_page)
+            {
+                // Past the end of the discography: cancel every page after this one
+                batch.last_page = state->page - 1;
+                batch.complete = 1;
+                cancel_pages(&batch);
+            }
+        }
+    }
+
+    // Merge the pages in order, copying the albums out of the arenas of the pages
+    for (int i = 0; batch.pages != NULL && i < batch.next_page - 1; i++)
+    {
+        PageParse *parse = batch.pages[i]->parse;
+
+        for (int j = 0; parse != NULL && i < batch.last_page && j < parse->albums.count; j++)
+        {
+            const AlbumInfo *source = &parse->albums.albums[j];
+            AlbumInfo *album = append_album(album_list);
+            if (album == NULL)
+            {
+                break;
+            }
+            album->url = arena_strndup(album_list->arena, source->url, strlen(source->url));
+            album->year = arena_strndup(album_list->arena, source->year, strlen(source->year));
+            album->name = arena_strndup(album_list->arena, source->name, strlen(source->name));
+            if (album->url == NULL || album->year == NULL || album->name == NULL)
+            {
+                album_list->count--;
+                break;
+            }
+        }
+
+        if (parse != NULL)
+        {
+            arena_free(&parse->arena);
+            free(parse);
+        }
+        free(batch.pages[i]);
+    }
+
+    free(batch.pages);
+    loop_free(&batch.loop);
+    rn_mutex_destroy(&batch.lock);
+
+    if (batch.complete && album_list->count > 0)
+    {
+        store_put_albums(band_url, album_list);
+    }
+
+    return batch.complete ? 0 : -1;
+}
+
+RN_API void get_albums_by_name_parallel(const char *band_name, AlbumInfoList *album_list, int window)
+{
+    /*
+     * Function  : void get_albums_by_name_parallel(const char *band_name, AlbumInfoList *album_list, int window)
+     * Input     : band_name - pointer to the name of the band
+     *             album_list - pointer to the AlbumInfoList structure to store album information
+     *             window - maximum number of pages requested at the same time
+     * Output    : Updates the album_list with album information
+     * Procedure : This function searches the band by name and retrieves the albums of the first result with get_albums_parallel. A name resolved before is taken from the name cache without a search, see get_albums_by_name.
+     */
+
+    char band_url[MAX_URL_LENGTH];
+
+    album_list->count = 0;
+
+    if (name_cache_lookup(band_name, band_url, sizeof(band_url)) == 0)
+    {
+        if (get_albums_parallel(band_url, album_list, window) != 0 || album_list->count > 0)
+        {
+            return;
+        }
+        name_cache_forget(band_name);
+    }
+
+    BandInfoList band_list;
+    init_band_list(&band_list, album_list->arena);
+    search_band(band_name, &band_list);
+
+    if (band_list.count > 0)
+    {
+        name_cache_put(band_name, band_list.bands[0].url);
+        get_albums_parallel(band_list.bands[0].url, album_list, window);
+    }
+}
+
+static size_t WriteSegmentCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    /* Function  : static size_t WriteSegmentCallback(void *contents, size_t size, size_t nmemb, void *userp)
+     * Input     : contents - pointer to the received data
+     *             size - size of each data element
+     *             nmemb - number of data elements
+     *             userp - pointer to the SegmentState of the range
+     * Output    : Returns the total size of the received data (in bytes), or 0 to abort the transfer
+     * Procedure : This function is a callback used with libcurl to write the data of one byte range straight into its place in the preallocated output file with positioned writes, so segments arriving in any order never need to be buffered or reassembled. Data past the end of the requested range (a server ignoring the Range header) aborts the transfer.
+     */
+
+    size_t real_size = size * nmemb;
+    SegmentState *segment = (SegmentState *)userp;
+
+#ifndef _WIN32
+    if (segment->offset + (curl_off_t)real_size > segment->end + 1)
+    {
+        segment->error = 1;
+        return 0;
+    }
+
+    const char *data = (const char *)contents;
+    size_t remaining = real_size;
+
+    while (remaining > 0)
+    {
+        ssize_t written = pwrite(segment->fd, data, remaining, (off_t)segment->offset);
+        if (written < 0)
+        {
+            segment->error = 1;
+            return 0;
+        }
+
+        data += written;
+        remaining -= written;
+        segment->offset += written;
+    }
+
+    return real_size;
+#else
+    (void)contents;
+    segment->error = 1;
+    return 0;
+#endif
+}
+
+static void segment_done(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void segment_done(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - pointer to the easy handle of the range
+     *             result - result code reported by curl for the transfer
+     *             userdata - pointer to the SegmentState of the range
+     * Output    : None
+     * Procedure : This function is the completion callback of a range of download_file_segmented. Every segment must be a complete 206 answer for its own range, anything else marks it failed.
+     */
+
+    SegmentState *segment = (SegmentState *)userdata;
+    long response_code = 0;
+    char *url = NULL;
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+    session_record_timings(curl, url != NULL ? url : "");
+
+    segment->finished = 1;
+    if (result != CURLE_OK || response_code != 206 || segment->offset != segment->end + 1)
+    {
+        segment->error = 1;
+    }
+}
+
+static size_t ProbeWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    /* Function  : static size_t ProbeWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+     * Input     : contents - pointer to the received data
+     *             size - size of each data element
+     *             nmemb - number of data elements
+     *             userp - pointer to the number of bytes received so far
+     * Output    : Returns the total size of the received data (in bytes), or 0 to abort the transfer
+     * Procedure : This function is a callback used with libcurl for the range probe. The data is thrown away; only the single byte asked for is accepted, so a server that ignores the Range header and sends the whole file with a 200 aborts the probe at once instead of downloading the file for nothing.
+     */
+
+    (void)contents;
+
+    size_t real_size = size * nmemb;
+    size_t *received = (size_t *)userp;
+
+    *received += real_size;
+    if (*received > 1)
+    {
+        return 0;
+    }
+
+    return real_size;
+}
+
+static curl_off_t probe_range_support(const char *url)
+{
+    /* Function  : static curl_off_t probe_range_support(const char *url)
+     * Input     : url - pointer to the URL of the file
+     * Output    : Returns the size of the file if the server supports byte ranges, -1 otherwise
+     * Procedure : This function requests the first byte of the file with a Range header and aborts as soon as more than that byte arrives (see ProbeWriteCallback). A "206 Partial Content" answer with a Content-Range header tells both that ranges are supported and how large the whole file is; anything else means the file has to be downloaded as a single stream.
+     */
+
+    CURL *curl = curl_easy_init();
+    if (curl == NULL)
+    {
+        return -1;
+    }
+
+    curl_off_t total = -1;
+    size_t received = 0;
+
+    session_attach(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_RANGE, "0-0");
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, ContentRangeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&total);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ProbeWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&received);
+
+    CURLcode res = curl_easy_perform(curl);
+    session_record_timings(curl, url);
+
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+    if (res != CURLE_OK || response_code != 206)
+    {
+        total = -1;
+    }
+
+    curl_easy_cleanup(curl);
+
+    return total;
+}
+
+RN_API int download_file_segmented(const char *url, const char *output_file, int segments)
+{
+    /*
+     * Function  : int download_file_segmented(const char *url, const char *output_file, int segments)
+     * Input     : url - pointer to the URL of the file to download
+     *             output_file - pointer to the name of the file to save the downloaded content (NULL to derive it from the URL)
+     *             segments - number of byte ranges to download in parallel
+     * Output    : Downloads the file and returns 0 on success, -1 on failure
+     * Procedure : This function downloads one large file over several connections at once. It first probes the server for byte range support and the size of the file, preallocates "<output_file>.seg" to that size and then fetches the given number of ranges in parallel on an event loop (see rocknation_loop.h), each one written into place with positioned writes; the segment file is flushed to disk and renamed to output_file once every range is in. Segments don't go through "<output_file>.part": download_file resumes a part file from its size, which is only right for a file written in order from the first byte. If the server doesn't support ranges, the file is too small to be worth splitting, a segment fails or a part file from an interrupted single stream download is there to be resumed, it falls back to a single stream with download_file.
+     */
+
+#ifdef _WIN32
+    return download_file(url, output_file);
+#else
+    if (segments > MAX_PARALLEL_JOBS)
+    {
+        segments = MAX_PARALLEL_JOBS;
+    }
+
+    char *derived_name = NULL;
+    if (output_file == NULL)
+    {
+        derived_name = get_filename_from_url(url);
+        output_file = derived_name;
+    }
+
+    char part_file[MAX_URL_LENGTH];
+    char segment_file[MAX_URL_LENGTH];
+    struct stat part_info;
+
+    if (segments < 2 || output_file == NULL ||
+        snprintf(part_file, sizeof(part_file), "%s.part", output_file) >= (int)sizeof(part_file) ||
+        snprintf(segment_file, sizeof(segment_file), "%s.seg", output_file) >= (int)sizeof(segment_file) ||
+        stat(part_file, &part_info) == 0)
+    {
+        // Not split, or an interrupted single stream download that download_file can resume
+        int result = download_file(url, output_file);
+        free(derived_name);
+        return result;
+    }
+
+    char *https_url = replace_http(url);
+    if (https_url == NULL)
+    {
+        free(derived_name);
+        return -1;
+    }
+
+    curl_off_t total = probe_range_support(https_url);
+    if (total < (curl_off_t)segments * MIN_SEGMENT_SIZE)
+    {
+        // No range support (or not worth it): single stream
+        free(https_url);
+        int result = download_file(url, output_file);
+        free(derived_name);
+        return result;
+    }
+
+    // Segments land in the segment file, which only gets the final name once every range is in.
+    // One left over from an interrupted run can't be resumed (which ranges made it isn't known).
+    int fd = open(segment_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        printf("Error opening file for writing\n");
+        free(https_url);
+        free(derived_name);
+        return -1;
+    }
+
+    // Reserve the whole file up front so every segment can write into place
+    if (posix_fallocate(fd, 0, (off_t)total) != 0 && ftruncate(fd, (off_t)total) != 0)
+    {
+        printf("Error preallocating file\n");
+        close(fd);
+        remove(segment_file);
+        free(https_url);
+        free(derived_name);
+        return -1;
+    }
+
+    EventLoop loop;
+    SegmentState parts[MAX_PARALLEL_JOBS];
+    memset(parts, 0, sizeof(parts));
+
+    curl_off_t segment_size = total / segments;
+    int failed = loop_init(&loop) != 0;
+    int started = 0;
+
+    for (int i = 0; i < segments && !failed; i++)
+    {
+        char range[64];
+
+        parts[i].fd = fd;
+        parts[i].start = segment_size * i;
+        parts[i].end = (i == segments - 1) ? total - 1 : segment_size * (i + 1) - 1;
+        parts[i].offset = parts[i].start;
+        parts[i].curl = curl_easy_init();
+
+        if (parts[i].curl == NULL)
+        {
+            failed = 1;
+            break;
+        }
+
+        snprintf(range, sizeof(range), "%" CURL_FORMAT_CURL_OFF_T "-%" CURL_FORMAT_CURL_OFF_T, parts[i].start, parts[i].end);
+
+        session_attach(parts[i].curl);
+        curl_easy_setopt(parts[i].curl, CURLOPT_URL, https_url);
+        curl_easy_setopt(parts[i].curl, CURLOPT_RANGE, range);
+        curl_easy_setopt(parts[i].curl, CURLOPT_WRITEFUNCTION, WriteSegmentCallback);
+        curl_easy_setopt(parts[i].curl, CURLOPT_WRITEDATA, (void *)&parts[i]);
+        curl_easy_setopt(parts[i].curl, CURLOPT_BUFFERSIZE, (long)DOWNLOAD_BUFFER_SIZE);
+
+        if (loop_add(&loop, parts[i].curl, segment_done, &parts[i]) != 0)
+        {
+            failed = 1;
+            break;
+        }
+        started++;
+    }
+
+    struct timeval started_at, finished_at;
+    gettimeofday(&started_at, NULL);
+
+    while (!failed && loop.active > 0)
+    {
+        loop_run_once(&loop, 1000);
+
+        for (int i = 0; i < started; i++)
+        {
+            if (parts[i].error)
+            {
+                failed = 1;
+            }
+        }
+    }
+
+    gettimeofday(&finished_at, NULL);
+
+    for (int i = 0; i < segments; i++)
+    {
+        if (parts[i].curl != NULL)
+        {
+            if (i < started && !parts[i].finished)
+            {
+                loop_remove(&loop, parts[i].curl);
+            }
+            curl_easy_cleanup(parts[i].curl);
+        }
+    }
+
+    loop_free(&loop);
+
+    // The descriptor is closed whatever the sync gives, and the file only renamed once both succeeded
+    int synced = failed || fsync(fd) == 0;
+    int closed = close(fd) == 0;
+    if (!synced || !closed || (!failed && rename(segment_file, output_file) != 0))
+    {
+        failed = 1;
+    }
+
+    free(https_url);
+
+    if (failed)
+    {
+        // Something went wrong with the ranges, start over with a single stream. The
+        // segment file has holes, so it is thrown away rather than resumed.
+        printf("Segmented download failed, falling back to a single stream\n");
+        remove(segment_file);
+
+        int result = download_file(url, output_file);
+        free(derived_name);
+        return result;
+    }
+
+    double elapsed = (finished_at.tv_sec - started_at.tv_sec) + (finished_at.tv_usec - started_at.tv_usec) / 1000000.0;
+    printf("File downloaded successfully: %s (%" CURL_FORMAT_CURL_OFF_T " bytes in %d segments, %.2fs, %.1f KB/s)\n",
+           output_file, total, segments, elapsed, elapsed > 0 ? (double)total / 1024.0 / elapsed : 0.0);
+
+    free(derived_name);
+    return 0;
+#endif
+}
@@ -0,0 +1,490 @@
+// rocknation_names.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_cache.h"
+#include "rocknation_fuzzy.h"
+
+#define NAME_CACHE_MAGIC "RNNAMES 1"
+#define NAME_CACHE_FILE "names.tsv"
+#define NAME_CACHE_CAPACITY 1024                  // Names kept; the least recently used one goes first
+#define NAME_CACHE_SLOTS (NAME_CACHE_CAPACITY * 4) // Size of the hash table, a power of two
+#define NAME_CACHE_TTL (30L * 24 * 60 * 60)       // Seconds a resolved name is trusted
+
+typedef struct
+{
+    char name[MAX_NAME_LENGTH + 1]; // Normalized band name, see fuzzy_normalize
+    char url[MAX_URL_LENGTH];
+    time_t stored; // When the name was resolved
+    int newer;     // Neighbours in the recency list, -1 at the ends
+    int older;
+} NameCacheEntry;
+
+typedef struct
+{
+    int refresh; // --refresh: resolve names with a search again (the result is still cached)
+    int loaded;
+    int dirty;   // Entries or their order changed since the file was read
+    long ttl;    // Seconds a resolved name is trusted, NAME_CACHE_TTL if not set
+    char path[MAX_PATH_LENGTH + 32];
+    NameCacheEntry *entries; // NAME_CACHE_CAPACITY entries, allocated on first use
+    int count;
+    int newest;
+    int oldest;
+    int slots[NAME_CACHE_SLOTS]; // Open-addressing hash table of entry + 1, 0 when empty
+    int hits;      // Names resolved without a search
+    int misses;    // Names that needed a search
+    int expired;   // Misses because the cached URL was older than ttl
+    int evictions; // Entries dropped to make room
+} NameCache;
+
+// Name cache of the threads that haven't bound a client (see rocknation_client.h)
+static NameCache rocknation_names = {0};
+static RN_THREAD_LOCAL NameCache *bound_names = NULL;
+
+static int name_cache_slot(const NameCache *names, const char *name);
+static void name_cache_unlink(NameCache *names, int entry);
+static void name_cache_push(NameCache *names, int entry);
+static void name_cache_remove(NameCache *names, int entry);
+static int name_cache_insert(NameCache *names, const char *name, const char *url, time_t stored);
+static void name_cache_load(NameCache *names);
+static NameCache *current_name_cache(void);
+RN_API void name_cache_close(void);
+static void close_default_name_cache(void);
+RN_API NameCache *get_name_cache(void);
+RN_API int name_cache_lookup(const char *band_name, char *url, size_t url_size);
+RN_API void name_cache_put(const char *band_name, const char *url);
+RN_API void name_cache_forget(const char *band_name);
+RN_API void print_name_cache_stats(void);
+
+static int name_cache_slot(const NameCache *names, const char *name)
+{
+    /* Function  : static int name_cache_slot(const NameCache *names, const char *name)
+     * Input     : names - pointer to the NameCache structure
+     *             name - pointer to a normalized band name
+     * Output    : Returns the slot of the hash table holding the name, or the empty slot where it would go
+     * Procedure : This function looks a name up in the hash table of the cache with linear probing. The table is four times the capacity, so it is never full.
+     */
+
+    size_t slot = hash_string(name, strlen(name)) & (NAME_CACHE_SLOTS - 1);
+
+    while (names->slots[slot] != 0 && strcmp(names->entries[names->slots[slot] - 1].name, name) != 0)
+    {
+        slot = (slot + 1) & (NAME_CACHE_SLOTS - 1);
+    }
+
+    return (int)slot;
+}
+
+static void name_cache_unlink(NameCache *names, int entry)
+{
+    /* Function  : static void name_cache_unlink(NameCache *names, int entry)
+     * Input     : names - pointer to the NameCache structure
+     *             entry - index of an entry in the recency list
+     * Output    : None
+     * Procedure : This function takes an entry out of the recency list.
+     */
+
+    NameCacheEntry *item = &names->entries[entry];
+
+    if (item->newer >= 0)
+    {
+        names->entries[item->newer].older = item->older;
+    }
+    else
+    {
+        names->newest = item->older;
+    }
+
+    if (item->older >= 0)
+    {
+        names->entries[item->older].newer = item->newer;
+    }
+    else
+    {
+        names->oldest = item->newer;
+    }
+
+    item->newer = -1;
+    item->older = -1;
+}
+
+static void name_cache_push(NameCache *names, int entry)
+{
+    /* Function  : static void name_cache_push(NameCache *names, int entry)
+     * Input     : names - pointer to the NameCache structure
+     *             entry - index of an entry that isn't in the recency list
+     * Output    : None
+     * Procedure : This function makes an entry the most recently used one.
+     */
+
+    NameCacheEntry *item = &names->entries[entry];
+
+    item->newer = -1;
+    item->older = names->newest;
+    if (names->newest >= 0)
+    {
+        names->entries[names->newest].newer = entry;
+    }
+    names->newest = entry;
+    if (names->oldest < 0)
+    {
+        names->oldest = entry;
+    }
+}
+
+static void name_cache_remove(NameCache *names, int entry)
+{
+    /* Function  : static void name_cache_remove(NameCache *names, int entry)
+     * Input     : names - pointer to the NameCache structure
+     *             entry - index of the entry to remove
+     * Output    : None
+     * Procedure : This function drops an entry from the cache. The last entry is moved into its place so entries stay contiguous, and the hash table is repaired by re-inserting the entries that followed the removed one in its probe run.
+     */
+
+    int slot = name_cache_slot(names, names->entries[entry].name);
+    int last = names->count - 1;
+
+    name_cache_unlink(names, entry);
+    names->slots[slot] = 0;
+
+    for (int next = (slot + 1) & (NAME_CACHE_SLOTS - 1); names->slots[next] != 0; next = (next + 1) & (NAME_CACHE_SLOTS - 1))
+    {
+        int moved = names->slots[next];
+        names->slots[next] = 0;
+        names->slots[name_cache_slot(names, names->entries[moved - 1].name)] = moved;
+    }
+
+    if (entry != last)
+    {
+        names->entries[entry] = names->entries[last];
+        names->slots[name_cache_slot(names, names->entries[entry].name)] = entry + 1;
+
+        NameCacheEntry *item = &names->entries[entry];
+        if (item->newer >= 0)
+        {
+            names->entries[item->newer].older = entry;
+        }
+        else
+        {
+            names->newest = entry;
+        }
+        if (item->older >= 0)
+        {
+            names->entries[item->older].newer = entry;
+        }
+        else
+        {
+            names->oldest = entry;
+        }
+    }
+
+    names->count--;
+    names->dirty = 1;
+}
+
+static int name_cache_insert(NameCache *names, const char *name, const char *url, time_t stored)
+{
+    /* Function  : static int name_cache_insert(NameCache *names, const char *name, const char *url, time_t stored)
+     * Input     : names - pointer to the NameCache structure
+     *             name - pointer to a normalized band name
+     *             url - pointer to the URL of the band
+     *             stored - when the name was resolved
+     * Output    : Returns the entry of the name, or -1 if the name or URL doesn't fit
+     * Procedure : This function adds or updates a name as the most recently used entry, evicting the least recently used one when the cache is full.
+     */
+
+    if (strlen(name) >= sizeof(names->entries[0].name) || strlen(url) >= sizeof(names->entries[0].url) || name[0] == '\0')
+    {
+        return -1;
+    }
+
+    int slot = name_cache_slot(names, name);
+    int entry = names->slots[slot] - 1;
+
+    if (entry >= 0)
+    {
+        name_cache_unlink(names, entry);
+    }
+    else
+    {
+        if (names->count == NAME_CACHE_CAPACITY)
+        {
+            name_cache_remove(names, names->oldest);
+            names->evictions++;
+            slot = name_cache_slot(names, name);
+        }
+
+        entry = names->count++;
+        snprintf(names->entries[entry].name, sizeof(names->entries[entry].name), "%s", name);
+        names->slots[slot] = entry + 1;
+    }
+
+    snprintf(names->entries[entry].url, sizeof(names->entries[entry].url), "%s", url);
+    names->entries[entry].stored = stored;
+    name_cache_push(names, entry);
+    names->dirty = 1;
+
+    return entry;
+}
+
+static void name_cache_load(NameCache *names)
+{
+    /* Function  : static void name_cache_load(NameCache *names)
+     * Input     : names - pointer to the NameCache structure
+     * Output    : None
+     * Procedure : This function reads the cache file, whose lines are "<name> <url> <stored>" separated by tabs from the least to the most recently used, so inserting them in order restores the recency list.
+     */
+
+    FILE *file = fopen(names->path, "rb");
+    char line[MAX_NAME_LENGTH + MAX_URL_LENGTH + 64];
+
+    if (file == NULL)
+    {
+        return;
+    }
+
+    if (fgets(line, sizeof(line), file) == NULL || strcmp(line, NAME_CACHE_MAGIC "\n") != 0)
+    {
+        fclose(file);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char *url = strchr(line, '\t');
+        char *stored = url != NULL ? strchr(url + 1, '\t') : NULL;
+        if (stored == NULL)
+        {
+            continue;
+        }
+        *url++ = '\0';
+        *stored++ = '\0';
+
+        name_cache_insert(names, line, url, (time_t)strtoll(stored, NULL, 10));
+    }
+
+    fclose(file);
+    names->dirty = 0;
+}
+
+static NameCache *current_name_cache(void)
+{
+    /* Function  : static NameCache *current_name_cache(void)
+     * Input     : None
+     * Output    : Returns a pointer to the name cache of the calling thread, opened or not
+     * Procedure : This function returns the name cache of the client bound to the calling thread, or the default one if the thread hasn't bound a client.
+     */
+
+    return bound_names != NULL ? bound_names : &rocknation_names;
+}
+
+RN_API void name_cache_close(void)
+{
+    /*
+     * Function  : void name_cache_close(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function writes the name cache of the calling thread back to its file if anything changed, under a temporary name of its own renamed into place, and releases it. The last client to close wins.
+     */
+
+    NameCache *names = current_name_cache();
+
+    if (!names->loaded)
+    {
+        return;
+    }
+
+    if (names->dirty)
+    {
+        char temp_path[MAX_PATH_LENGTH + 96];
+        make_temp_path(names->path, temp_path, sizeof(temp_path));
+        FILE *file = fopen(temp_path, "wb");
+
+        if (file != NULL)
+        {
+            fputs(NAME_CACHE_MAGIC "\n", file);
+            for (int entry = names->oldest; entry >= 0; entry = names->entries[entry].newer)
+            {
+                const NameCacheEntry *item = &names->entries[entry];
+                fprintf(file, "%s\t%s\t%lld\n", item->name, item->url, (long long)item->stored);
+            }
+
+            if (fclose(file) != 0)
+            {
+                remove(temp_path);
+            }
+            else
+            {
+#ifdef _WIN32
+                remove(names->path); // rename() doesn't replace existing files on Windows
+#endif
+                if (rename(temp_path, names->path) != 0)
+                {
+                    remove(temp_path);
+                }
+            }
+        }
+    }
+
+    free(names->entries);
+    names->entries = NULL;
+    names->count = 0;
+    names->loaded = 0;
+    names->dirty = 0;
+}
+
+static void close_default_name_cache(void)
+{
+    /* Function  : static void close_default_name_cache(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function closes the default name cache. It is registered with atexit when that cache is first used.
+     */
+
+    bound_names = NULL;
+    name_cache_close();
+}
+
+RN_API NameCache *get_name_cache(void)
+{
+    /*
+     * Function  : NameCache *get_name_cache(void)
+     * Input     : None
+     * Output    : Returns a pointer to the name cache of the calling thread, or NULL if it can't be allocated
+     * Procedure : This function lazily opens the cache of band names resolved to URLs the first time it is called by a client (or by a thread without one). The cache file lives next to the page cache (see cache_dir).
+     */
+
+    NameCache *names = current_name_cache();
+
+    if (!names->loaded)
+    {
+        names->entries = rn_malloc(NAME_CACHE_CAPACITY * sizeof(NameCacheEntry));
+        if (names->entries == NULL)
+        {
+            return NULL;
+        }
+
+        names->loaded = 1;
+        names->ttl = names->ttl > 0 ? names->ttl : NAME_CACHE_TTL;
+        names->count = 0;
+        names->newest = -1;
+        names->oldest = -1;
+        memset(names->slots, 0, sizeof(names->slots));
+        snprintf(names->path, sizeof(names->path), "%s/%s", cache_dir(), NAME_CACHE_FILE);
+        name_cache_load(names);
+
+        static int registered = 0;
+        if (names == &rocknation_names && !registered)
+        {
+            atexit(close_default_name_cache);
+            registered = 1;
+        }
+    }
+
+    return names;
+}
+
+RN_API int name_cache_lookup(const char *band_name, char *url, size_t url_size)
+{
+    /*
+     * Function  : int name_cache_lookup(const char *band_name, char *url, size_t url_size)
+     * Input     : band_name - pointer to the name of a band, as typed
+     *             url - pointer to the buffer receiving the URL of the band
+     *             url_size - size of the buffer
+     * Output    : Returns 0 if the name was resolved from the cache, -1 if it needs a search
+     * Procedure : This function resolves a band name to its URL without a search, unless --refresh was given. Names are compared normalized, so "iron  maiden" and "Iron Maiden" share an entry. An entry older than ttl is dropped and counted as expired.
+     */
+
+    NameCache *names = get_name_cache();
+    char name[MAX_NAME_LENGTH + 1];
+    fuzzy_normalize(band_name, strlen(band_name), name, sizeof(name));
+
+    if (names == NULL || names->refresh || names->count == 0)
+    {
+        current_name_cache()->misses++;
+        return -1;
+    }
+
+    int entry = names->slots[name_cache_slot(names, name)] - 1;
+    if (entry < 0)
+    {
+        names->misses++;
+        return -1;
+    }
+
+    if (time(NULL) - names->entries[entry].stored > names->ttl)
+    {
+        name_cache_remove(names, entry);
+        names->expired++;
+        names->misses++;
+        return -1;
+    }
+
+    snprintf(url, url_size, "%s", names->entries[entry].url);
+    name_cache_unlink(names, entry);
+    name_cache_push(names, entry);
+    names->dirty = 1;
+    names->hits++;
+
+    return 0;
+}
+
+RN_API void name_cache_put(const char *band_name, const char *url)
+{
+    /*
+     * Function  : void name_cache_put(const char *band_name, const char *url)
+     * Input     : band_name - pointer to the name of a band, as typed
+     *             url - pointer to the URL the name was resolved to
+     * Output    : None
+     * Procedure : This function remembers what a band name resolved to, as the most recently used entry.
+     */
+
+    NameCache *names = get_name_cache();
+    char name[MAX_NAME_LENGTH + 1];
+    fuzzy_normalize(band_name, strlen(band_name), name, sizeof(name));
+
+    if (names != NULL && strchr(url, '\t') == NULL && strchr(url, '\n') == NULL)
+    {
+        name_cache_insert(names, name, url, time(NULL));
+    }
+}
+
+RN_API void name_cache_forget(const char *band_name)
+{
+    /*
+     * Function  : void name_cache_forget(const char *band_name)
+     * Input     : band_name - pointer to the name of a band, as typed
+     * Output    : None
+     * Procedure : This function drops a name whose cached URL turned out to be useless (the band page has no albums any more), so the next lookup searches again.
+     */
+
+    NameCache *names = get_name_cache();
+    char name[MAX_NAME_LENGTH + 1];
+    fuzzy_normalize(band_name, strlen(band_name), name, sizeof(name));
+
+    int entry = names != NULL ? names->slots[name_cache_slot(names, name)] - 1 : -1;
+    if (entry >= 0)
+    {
+        name_cache_remove(names, entry);
+    }
+}
+
+RN_API void print_name_cache_stats(void)
+{
+    /*
+     * Function  : void print_name_cache_stats(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints to stderr how many band names were resolved from the name cache and how many needed a search.
+     */
+
+    NameCache *names = current_name_cache();
+
+    if (names->hits + names->misses == 0)
+    {
+        return;
+    }
+
+    fprintf(stderr, "[names] %d resolved locally, %d searched (%d expired, %d evicted)\n",
+            names->hits, names->misses, names->expired, names->evictions);
+}
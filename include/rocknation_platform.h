@@ -0,0 +1,441 @@
+// rocknation_platform.h
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+
+/*
+ * Every function of the library is defined in its header, with internal linkage, so the headers can be
+ * included from any number of translation units of the same program. Each translation unit then has its
+ * own copy of the functions, of the default instances used by threads without a client and of the client
+ * bound by rn_client_bind (see rocknation_client.h); clients themselves can be passed freely between
+ * translation units, and the rn_* functions taking one work from any of them.
+ *
+ * What belongs to the whole process (the initialization of libcurl, the worker pool, the disk writer, the
+ * base URL and the heap counters) is declared with RN_SHARED instead: every translation unit has a weak
+ * definition of it, and the linker keeps one for the program. Compilers without weak definitions fall back
+ * to a copy per translation unit.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define RN_API static __attribute__((unused))
+#define RN_SHARED __attribute__((weak))
+#elif defined(_MSC_VER)
+#define RN_API static
+#define RN_SHARED __declspec(selectany)
+#else
+#define RN_API static
+#define RN_SHARED static
+#endif
+
+// Vector instructions used by the text scanners: AVX2 or SSE2 when the compiler targets them, none when
+// built with ROCKNATION_NO_SIMD (the byte-by-byte code then runs everywhere, e.g. to compare against it)
+#if !defined(ROCKNATION_NO_SIMD) && defined(__AVX2__)
+#define RN_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(ROCKNATION_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define RN_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define RN_THREAD_LOCAL __declspec(thread)
+#else
+#define RN_THREAD_LOCAL _Thread_local
+#endif
+
+// Adds value to a counter updated from several threads and yields its previous value
+#if defined(__GNUC__) || defined(__clang__)
+#define RN_ATOMIC_ADD(target, value) __atomic_fetch_add(&(target), (value), __ATOMIC_RELAXED)
+#elif defined(_MSC_VER) && defined(_WIN64)
+#define RN_ATOMIC_ADD(target, value) _InterlockedExchangeAdd64((volatile __int64 *)&(target), (__int64)(value))
+#elif defined(_MSC_VER)
+#define RN_ATOMIC_ADD(target, value) _InterlockedExchangeAdd((volatile long *)&(target), (long)(value))
+#else
+#define RN_ATOMIC_ADD(target, value) ((target) += (value), (target) - (value))
+#endif
+
+// Reads and writes an int flag shared between threads, ordering what the writer did before it
+#if defined(__GNUC__) || defined(__clang__)
+#define RN_ATOMIC_LOAD(target) __atomic_load_n(&(target), __ATOMIC_ACQUIRE)
+#define RN_ATOMIC_STORE(target, value) __atomic_store_n(&(target), (value), __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#define RN_ATOMIC_LOAD(target) _InterlockedOr((volatile long *)&(target), 0)
+#define RN_ATOMIC_STORE(target, value) _InterlockedExchange((volatile long *)&(target), (long)(value))
+#else
+#define RN_ATOMIC_LOAD(target) (target)
+#define RN_ATOMIC_STORE(target, value) ((target) = (value))
+#endif
+
+#ifdef _WIN32
+typedef INIT_ONCE RnOnce;
+#define RN_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+typedef pthread_once_t RnOnce;
+#define RN_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+#ifdef _WIN32
+typedef SRWLOCK RnMutex;
+typedef CONDITION_VARIABLE RnCond;
+typedef HANDLE RnThread;
+#else
+typedef pthread_mutex_t RnMutex;
+typedef pthread_cond_t RnCond;
+typedef pthread_t RnThread;
+#endif
+
+typedef void (*RnThreadFunction)(void *argument);
+
+typedef struct
+{
+    RnThreadFunction function;
+    void *argument;
+} RnThreadStart;
+
+#ifdef _WIN32
+static BOOL CALLBACK rn_once_callback(PINIT_ONCE once, PVOID parameter, PVOID *context);
+static unsigned __stdcall rn_thread_main(void *start);
+#else
+static void *rn_thread_main(void *start);
+#endif
+RN_API void rn_once(RnOnce *once, void (*function)(void));
+RN_API void make_temp_path(const char *path, char *temp_path, size_t temp_size);
+RN_API double rn_clock(void);
+RN_API void rn_mutex_init(RnMutex *mutex);
+RN_API void rn_mutex_destroy(RnMutex *mutex);
+RN_API void rn_mutex_lock(RnMutex *mutex);
+RN_API void rn_mutex_unlock(RnMutex *mutex);
+RN_API void rn_cond_init(RnCond *cond);
+RN_API void rn_cond_destroy(RnCond *cond);
+RN_API void rn_cond_wait(RnCond *cond, RnMutex *mutex);
+RN_API void rn_cond_timed_wait(RnCond *cond, RnMutex *mutex, double seconds);
+RN_API void rn_cond_signal(RnCond *cond);
+RN_API void rn_cond_broadcast(RnCond *cond);
+RN_API int rn_thread_start(RnThread *thread, RnThreadFunction function, void *argument);
+RN_API void rn_thread_join(RnThread thread);
+
+#ifdef _WIN32
+static BOOL CALLBACK rn_once_callback(PINIT_ONCE once, PVOID parameter, PVOID *context)
+{
+    /* Function  : static BOOL CALLBACK rn_once_callback(PINIT_ONCE once, PVOID parameter, PVOID *context)
+     * Input     : once - pointer to the INIT_ONCE being run
+     *             parameter - the function given to rn_once
+     *             context - unused
+     * Output    : Returns TRUE
+     * Procedure : This function adapts a plain initialization function to InitOnceExecuteOnce.
+     */
+
+    (void)once;
+    (void)context;
+    ((void (*)(void))parameter)();
+    return TRUE;
+}
+#endif
+
+RN_API void rn_once(RnOnce *once, void (*function)(void))
+{
+    /*
+     * Function  : void rn_once(RnOnce *once, void (*function)(void))
+     * Input     : once - pointer to a flag initialized with RN_ONCE_INIT
+     *             function - pointer to the function to run
+     * Output    : None
+     * Procedure : This function runs function exactly once for a given flag however many threads call it at the same time; the callers that lose the race wait until it has returned.
+     */
+
+#ifdef _WIN32
+    InitOnceExecuteOnce(once, rn_once_callback, (PVOID)function, NULL);
+#else
+    pthread_once(once, function);
+#endif
+}
+
+RN_API void make_temp_path(const char *path, char *temp_path, size_t temp_size)
+{
+    /*
+     * Function  : void make_temp_path(const char *path, char *temp_path, size_t temp_size)
+     * Input     : path - pointer to the path of the file about to be replaced
+     *             temp_path - pointer to the buffer receiving the temporary path
+     *             temp_size - size of the buffer
+     * Output    : Writes a path next to path into temp_path
+     * Procedure : This function names the temporary file a file is written to before it is renamed into place. The name carries the process id and a counter, so processes and threads replacing the same file at the same time each write their own temporary file and the last rename wins.
+     */
+
+    static unsigned long counter = 0;
+    unsigned long serial = RN_ATOMIC_ADD(counter, 1);
+
+#ifdef _WIN32
+    long pid = (long)_getpid();
+#else
+    long pid = (long)getpid();
+#endif
+
+    snprintf(temp_path, temp_size, "%s.%ld-%lx-%lu.tmp", path, pid, (unsigned long)(uintptr_t)&counter, serial);
+}
+
+RN_API double rn_clock(void)
+{
+    /*
+     * Function  : double rn_clock(void)
+     * Input     : None
+     * Output    : Returns a monotonic time in seconds
+     * Procedure : This function reads a clock that doesn't jump when the system time is changed, for rate limits, backoffs and throughput figures.
+     */
+
+#ifdef _WIN32
+    return (double)GetTickCount64() / 1000.0;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+RN_API void rn_mutex_init(RnMutex *mutex)
+{
+    /*
+     * Function  : void rn_mutex_init(RnMutex *mutex)
+     * Input     : mutex - pointer to the mutex to initialize
+     * Output    : None
+     * Procedure : This function prepares a mutex (a slim reader/writer lock on Windows) for rn_mutex_lock.
+     */
+
+#ifdef _WIN32
+    InitializeSRWLock(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+RN_API void rn_mutex_destroy(RnMutex *mutex)
+{
+    /*
+     * Function  : void rn_mutex_destroy(RnMutex *mutex)
+     * Input     : mutex - pointer to an unlocked mutex
+     * Output    : None
+     * Procedure : This function releases a mutex; slim locks on Windows need nothing.
+     */
+
+#ifdef _WIN32
+    (void)mutex;
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+RN_API void rn_mutex_lock(RnMutex *mutex)
+{
+    /*
+     * Function  : void rn_mutex_lock(RnMutex *mutex)
+     * Input     : mutex - pointer to the mutex
+     * Output    : None
+     * Procedure : This function waits until the calling thread holds the mutex.
+     */
+
+#ifdef _WIN32
+    AcquireSRWLockExclusive(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+RN_API void rn_mutex_unlock(RnMutex *mutex)
+{
+    /*
+     * Function  : void rn_mutex_unlock(RnMutex *mutex)
+     * Input     : mutex - pointer to a mutex held by the calling thread
+     * Output    : None
+     * Procedure : This function releases the mutex.
+     */
+
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+RN_API void rn_cond_init(RnCond *cond)
+{
+    /*
+     * Function  : void rn_cond_init(RnCond *cond)
+     * Input     : cond - pointer to the condition variable to initialize
+     * Output    : None
+     * Procedure : This function prepares a condition variable for rn_cond_wait.
+     */
+
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+RN_API void rn_cond_destroy(RnCond *cond)
+{
+    /*
+     * Function  : void rn_cond_destroy(RnCond *cond)
+     * Input     : cond - pointer to a condition variable no thread waits on
+     * Output    : None
+     * Procedure : This function releases a condition variable; Windows ones need nothing.
+     */
+
+#ifdef _WIN32
+    (void)cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+}
+
+RN_API void rn_cond_wait(RnCond *cond, RnMutex *mutex)
+{
+    /*
+     * Function  : void rn_cond_wait(RnCond *cond, RnMutex *mutex)
+     * Input     : cond - pointer to the condition variable
+     *             mutex - pointer to the mutex held by the calling thread
+     * Output    : None
+     * Procedure : This function releases the mutex until the condition variable is signalled and takes it again before returning. Wakeups can be spurious, so the caller checks its condition in a loop.
+     */
+
+#ifdef _WIN32
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+RN_API void rn_cond_timed_wait(RnCond *cond, RnMutex *mutex, double seconds)
+{
+    /*
+     * Function  : void rn_cond_timed_wait(RnCond *cond, RnMutex *mutex, double seconds)
+     * Input     : cond - pointer to the condition variable
+     *             mutex - pointer to the mutex held by the calling thread
+     *             seconds - longest time to wait
+     * Output    : None
+     * Procedure : This function is rn_cond_wait giving up after the given time.
+     */
+
+#ifdef _WIN32
+    SleepConditionVariableSRW(cond, mutex, (DWORD)(seconds * 1000.0), 0);
+#else
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)seconds;
+    deadline.tv_nsec += (long)((seconds - (double)(time_t)seconds) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, mutex, &deadline);
+#endif
+}
+
+RN_API void rn_cond_signal(RnCond *cond)
+{
+    /*
+     * Function  : void rn_cond_signal(RnCond *cond)
+     * Input     : cond - pointer to the condition variable
+     * Output    : None
+     * Procedure : This function wakes one of the threads waiting on the condition variable, if any.
+     */
+
+#ifdef _WIN32
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+RN_API void rn_cond_broadcast(RnCond *cond)
+{
+    /*
+     * Function  : void rn_cond_broadcast(RnCond *cond)
+     * Input     : cond - pointer to the condition variable
+     * Output    : None
+     * Procedure : This function wakes every thread waiting on the condition variable.
+     */
+
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+#ifdef _WIN32
+static unsigned __stdcall rn_thread_main(void *start)
+#else
+static void *rn_thread_main(void *start)
+#endif
+{
+    /* Function  : static void *rn_thread_main(void *start)
+     * Input     : start - pointer to the RnThreadStart allocated by rn_thread_start
+     * Output    : Returns nothing useful
+     * Procedure : This function adapts a thread function of the library to the signature of the platform and releases its start record.
+     */
+
+    RnThreadStart thread_start = *(RnThreadStart *)start;
+    free(start);
+    thread_start.function(thread_start.argument);
+
+    return 0;
+}
+
+RN_API int rn_thread_start(RnThread *thread, RnThreadFunction function, void *argument)
+{
+    /*
+     * Function  : int rn_thread_start(RnThread *thread, RnThreadFunction function, void *argument)
+     * Input     : thread - pointer to where the handle of the thread is stored
+     *             function - pointer to the function the thread runs
+     *             argument - pointer passed to function
+     * Output    : Returns 0 if the thread was started, -1 otherwise
+     * Procedure : This function starts a thread running function(argument). Every started thread must be waited for with rn_thread_join.
+     */
+
+    RnThreadStart *start = malloc(sizeof(RnThreadStart));
+    if (start == NULL)
+    {
+        return -1;
+    }
+    start->function = function;
+    start->argument = argument;
+
+#ifdef _WIN32
+    *thread = (HANDLE)_beginthreadex(NULL, 0, rn_thread_main, start, 0, NULL);
+    if (*thread == NULL)
+#else
+    if (pthread_create(thread, NULL, rn_thread_main, start) != 0)
+#endif
+    {
+        free(start);
+        return -1;
+    }
+
+    return 0;
+}
+
+RN_API void rn_thread_join(RnThread thread)
+{
+    /*
+     * Function  : void rn_thread_join(RnThread thread)
+     * Input     : thread - handle of a thread started with rn_thread_start
+     * Output    : None
+     * Procedure : This function waits until the thread has returned and releases its handle.
+     */
+
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
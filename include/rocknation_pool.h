@@ -0,0 +1,657 @@
+// rocknation_pool.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_regex.h"
+
+#define POOL_MIN_THREADS 2
+#define POOL_MAX_THREADS 16
+#define POOL_DEQUE_SIZE 64      // Initial slots of a worker's deque, doubled when full
+#define POOL_LATENCY_BUCKETS 32 // Bucket b counts latencies below 2^b microseconds
+
+/*
+ * The pool takes CPU and disk work (parsing a downloaded page, writing a downloaded buffer) off the
+ * threads driving transfers, so a slow task doesn't hold every other transfer back. Every worker has a
+ * deque of tasks: it takes its own newest task first, and when it runs out it steals the oldest task of
+ * another worker. Tasks submitted from outside the pool are spread over the deques in turn, tasks
+ * submitted by a task go to the deque of its worker. Each worker has its own compiled patterns, so
+ * tasks can call parse_albums and friends. Every translation unit including this header has its own
+ * thread-local state (the bound patterns and the current worker), and the shared pool may have been
+ * started by another one, so a task carries the function of the unit that submitted it, which the worker
+ * calls to bind itself in that unit before running the task.
+ */
+
+typedef struct PoolWorker PoolWorker;
+
+typedef void (*PoolTaskFunction)(void *argument);
+typedef void (*PoolBindFunction)(PoolWorker *worker);
+
+typedef struct
+{
+    PoolTaskFunction function;
+    void *argument;
+    PoolBindFunction bind; // Binds the worker in the translation unit that submitted the task
+    double submitted;      // Time the task was submitted, from rn_clock
+} PoolTask;
+
+typedef struct
+{
+    RnMutex lock;
+    PoolTask *tasks;
+    int capacity;
+    int head;  // Index of the oldest task, the one thieves take
+    int count; // Tasks waiting; the newest one is the one the owner takes
+
+    int max_length;    // Most tasks waiting at once
+    double length_sum; // Tasks waiting when a task was pushed, summed, for the average length
+    long pushes;
+} PoolDeque;
+
+typedef struct WorkPool WorkPool;
+
+struct PoolWorker
+{
+    WorkPool *pool;
+    int index;
+    RnThread thread;
+    PoolDeque deque;
+    CompiledPattern patterns[PATTERN_COUNT];
+    unsigned int seed; // State of the generator picking the first worker to steal from
+};
+
+struct WorkPool
+{
+    PoolWorker workers[POOL_MAX_THREADS];
+    int thread_count;
+    unsigned long next; // Deque the next task submitted from outside goes to
+
+    // Guarded by lock
+    RnMutex lock;
+    RnCond work;    // Signalled when a task is submitted or the pool stops
+    RnCond drained; // Signalled when every submitted task has run
+    int running;    // Set between pool_start and pool_stop
+    int stopping;
+    long queued;    // Tasks in the deques, not taken by a worker yet
+    long submitted;
+    long completed;
+    long steals;
+    long wait_histogram[POOL_LATENCY_BUCKETS]; // From submission to start
+    long run_histogram[POOL_LATENCY_BUCKETS];  // From start to end
+    double wait_total;
+    double wait_max;
+    double run_total;
+    double run_max;
+};
+
+// Pool of the threads that don't start their own, shared by the whole process and started on first use
+RN_SHARED WorkPool rocknation_pool = {0};
+RN_SHARED RnOnce rocknation_pool_once = RN_ONCE_INIT;
+static RN_THREAD_LOCAL PoolWorker *current_worker = NULL;
+
+static int pool_cpu_count(void);
+static void pool_deque_push(PoolDeque *deque, PoolTask task);
+static int pool_deque_pop(PoolDeque *deque, PoolTask *task);
+static int pool_deque_steal(PoolDeque *deque, PoolTask *task);
+static int pool_take(PoolWorker *worker, PoolTask *task);
+static int latency_bucket(double seconds);
+static double latency_percentile(const long *histogram, long count, double fraction, double max);
+static void pool_bind_worker(PoolWorker *worker);
+static void pool_worker_main(void *argument);
+static void start_default_pool(void);
+static void stop_default_pool(void);
+RN_API int pool_start(WorkPool *pool, int threads);
+RN_API void pool_stop(WorkPool *pool);
+RN_API WorkPool *get_pool(void);
+RN_API int pool_submit(WorkPool *pool, PoolTaskFunction function, void *argument);
+RN_API void pool_wait(WorkPool *pool);
+RN_API void print_pool_stats(void);
+
+static int pool_cpu_count(void)
+{
+    /* Function  : static int pool_cpu_count(void)
+     * Input     : None
+     * Output    : Returns the number of processors online, at least 1
+     * Procedure : This function asks the system how many processors can run the workers of the pool.
+     */
+
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return count > 0 ? count : 1;
+}
+
+static void pool_deque_push(PoolDeque *deque, PoolTask task)
+{
+    /* Function  : static void pool_deque_push(PoolDeque *deque, PoolTask task)
+     * Input     : deque - pointer to the PoolDeque, locked by the caller
+     *             task - the task to add as the newest one
+     * Output    : None
+     * Procedure : This function appends a task to the deque and records the length it found for the statistics. The caller has made room for it, see pool_submit.
+     */
+
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    deque->pushes++;
+    deque->length_sum += deque->count;
+    if (deque->count > deque->max_length)
+    {
+        deque->max_length = deque->count;
+    }
+}
+
+static int pool_deque_pop(PoolDeque *deque, PoolTask *task)
+{
+    /* Function  : static int pool_deque_pop(PoolDeque *deque, PoolTask *task)
+     * Input     : deque - pointer to the PoolDeque of the calling worker
+     *             task - pointer to where the task is stored
+     * Output    : Returns 1 if a task was taken, 0 if the deque is empty
+     * Procedure : This function takes the newest task of the deque. The owner works newest first, so the data a task just produced is still in the cache of its processor when the task it submitted runs.
+     */
+
+    int taken = 0;
+
+    rn_mutex_lock(&deque->lock);
+    if (deque->count > 0)
+    {
+        deque->count--;
+        *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+        taken = 1;
+    }
+    rn_mutex_unlock(&deque->lock);
+
+    return taken;
+}
+
+static int pool_deque_steal(PoolDeque *deque, PoolTask *task)
+{
+    /* Function  : static int pool_deque_steal(PoolDeque *deque, PoolTask *task)
+     * Input     : deque - pointer to the PoolDeque of another worker
+     *             task - pointer to where the task is stored
+     * Output    : Returns 1 if a task was taken, 0 if the deque is empty
+     * Procedure : This function takes the oldest task of the deque, the one its owner would get to last.
+     */
+
+    int taken = 0;
+
+    rn_mutex_lock(&deque->lock);
+    if (deque->count > 0)
+    {
+        *task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+        taken = 1;
+    }
+    rn_mutex_unlock(&deque->lock);
+
+    return taken;
+}
+
+static int pool_take(PoolWorker *worker, PoolTask *task)
+{
+    /* Function  : static int pool_take(PoolWorker *worker, PoolTask *task)
+     * Input     : worker - pointer to the calling PoolWorker
+     *             task - pointer to where the task is stored
+     * Output    : Returns 1 if a task was taken, 0 if every deque was empty
+     * Procedure : This function takes the newest task of the worker's own deque or, if it is empty, steals the oldest task of the other deques, starting from a random one so idle workers don't all go after the same victim.
+     */
+
+    WorkPool *pool = worker->pool;
+    int stolen = 0;
+    int taken = pool_deque_pop(&worker->deque, task);
+
+    if (!taken)
+    {
+        worker->seed = worker->seed * 1103515245u + 12345u;
+        int first = (int)((worker->seed >> 16) % (unsigned int)pool->thread_count);
+
+        for (int i = 0; i < pool->thread_count && !taken; i++)
+        {
+            int victim = (first + i) % pool->thread_count;
+            if (victim != worker->index)
+            {
+                taken = pool_deque_steal(&pool->workers[victim].deque, task);
+                stolen = taken;
+            }
+        }
+    }
+
+    if (taken)
+    {
+        rn_mutex_lock(&pool->lock);
+        pool->queued--;
+        pool->steals += stolen;
+        rn_mutex_unlock(&pool->lock);
+    }
+
+    return taken;
+}
+
+static int latency_bucket(double seconds)
+{
+    /* Function  : static int latency_bucket(double seconds)
+     * Input     : seconds - a latency
+     * Output    : Returns the histogram bucket of the latency
+     * Procedure : This function returns the number of binary digits of the latency in microseconds, so bucket b holds the latencies from 2^(b-1) up to 2^b microseconds.
+     */
+
+    unsigned long long micros = seconds > 0 ? (unsigned long long)(seconds * 1e6) : 0;
+    int bucket = 0;
+
+    while (micros > 0 && bucket < POOL_LATENCY_BUCKETS - 1)
+    {
+        micros >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static double latency_percentile(const long *histogram, long count, double fraction, double max)
+{
+    /* Function  : static double latency_percentile(const long *histogram, long count, double fraction, double max)
+     * Input     : histogram - pointer to POOL_LATENCY_BUCKETS counters
+     *             count - sum of the counters
+     *             fraction - the percentile wanted, 0.5 for the median
+     *             max - largest latency recorded
+     * Output    : Returns an upper bound of the percentile in seconds
+     * Procedure : This function finds the bucket the percentile falls in and returns its upper limit, which is at most twice the real value, or the largest latency if that is lower.
+     */
+
+    long seen = 0;
+
+    for (int bucket = 0; bucket < POOL_LATENCY_BUCKETS; bucket++)
+    {
+        seen += histogram[bucket];
+        if (seen > 0 && seen >= fraction * count)
+        {
+            double bound = (double)(1ULL << bucket) / 1e6;
+            return bound < max ? bound : max;
+        }
+    }
+
+    return max;
+}
+
+static void pool_bind_worker(PoolWorker *worker)
+{
+    /* Function  : static void pool_bind_worker(PoolWorker *worker)
+     * Input     : worker - pointer to the PoolWorker of the calling thread
+     * Output    : None
+     * Procedure : This function makes the worker the current worker of the calling thread, and its patterns the patterns of the thread, as the translation unit it is compiled in sees them. pool_submit hands it to the worker with every task, so the task parses with the patterns of its worker and submits to its deque whichever unit it comes from. The worker stays bound in that unit for the life of the thread: nothing else runs on it.
+     */
+
+    current_worker = worker;
+    bound_patterns = worker->patterns;
+}
+
+static void pool_worker_main(void *argument)
+{
+    /* Function  : static void pool_worker_main(void *argument)
+     * Input     : argument - pointer to the PoolWorker of the thread
+     * Output    : None
+     * Procedure : This function is the loop of a worker: take a task (see pool_take), bind itself in the translation unit that submitted it, run it and record how long it waited and ran; sleep while every deque is empty. It returns once the pool is stopping and no task is left, releasing the patterns it compiled.
+     */
+
+    PoolWorker *worker = (PoolWorker *)argument;
+    WorkPool *pool = worker->pool;
+
+    pool_bind_worker(worker);
+
+    while (1)
+    {
+        PoolTask task;
+
+        if (pool_take(worker, &task))
+        {
+            task.bind(worker);
+
+            double started = rn_clock();
+            task.function(task.argument);
+            double finished = rn_clock();
+
+            double waited = started - task.submitted;
+            double ran = finished - started;
+
+            rn_mutex_lock(&pool->lock);
+            pool->completed++;
+            pool->wait_histogram[latency_bucket(waited)]++;
+            pool->run_histogram[latency_bucket(ran)]++;
+            pool->wait_total += waited;
+            pool->run_total += ran;
+            if (waited > pool->wait_max)
+            {
+                pool->wait_max = waited;
+            }
+            if (ran > pool->run_max)
+            {
+                pool->run_max = ran;
+            }
+            if (pool->completed == pool->submitted)
+            {
+                rn_cond_broadcast(&pool->drained);
+            }
+            rn_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        rn_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stopping)
+        {
+            rn_cond_wait(&pool->work, &pool->lock);
+        }
+        int done = pool->queued == 0 && pool->stopping;
+        rn_mutex_unlock(&pool->lock);
+
+        if (done)
+        {
+            break;
+        }
+    }
+
+    free_patterns();
+    bound_patterns = NULL;
+    current_worker = NULL;
+}
+
+RN_API int pool_start(WorkPool *pool, int threads)
+{
+    /*
+     * Function  : int pool_start(WorkPool *pool, int threads)
+     * Input     : pool - pointer to a zeroed WorkPool
+     *             threads - number of workers, or 0 for one per processor (between POOL_MIN_THREADS and POOL_MAX_THREADS)
+     * Output    : Returns 0 if at least one worker was started, -1 otherwise
+     * Procedure : This function starts the workers of a pool. The pool must be stopped with pool_stop.
+     */
+
+    if (threads <= 0)
+    {
+        threads = pool_cpu_count();
+        if (threads < POOL_MIN_THREADS)
+        {
+            threads = POOL_MIN_THREADS;
+        }
+    }
+    if (threads > POOL_MAX_THREADS)
+    {
+        threads = POOL_MAX_THREADS;
+    }
+
+    rn_mutex_init(&pool->lock);
+    rn_cond_init(&pool->work);
+    rn_cond_init(&pool->drained);
+
+    for (int i = 0; i < threads; i++)
+    {
+        PoolWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->seed = (unsigned int)i * 2654435761u + 1;
+        worker->deque.tasks = rn_calloc(POOL_DEQUE_SIZE, sizeof(PoolTask));
+        worker->deque.capacity = POOL_DEQUE_SIZE;
+        rn_mutex_init(&worker->deque.lock);
+        init_patterns(worker->patterns);
+
+        if (worker->deque.tasks == NULL)
+        {
+            rn_mutex_destroy(&worker->deque.lock);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    // Workers only look at thread_count, so it has to be final before the first one starts
+    int started = 0;
+    for (int i = 0; i < pool->thread_count; i++)
+    {
+        if (rn_thread_start(&pool->workers[i].thread, pool_worker_main, &pool->workers[i]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+
+    if (pool->thread_count == 0 || started < pool->thread_count)
+    {
+        rn_mutex_lock(&pool->lock);
+        pool->stopping = 1;
+        rn_cond_broadcast(&pool->work);
+        rn_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < started; i++)
+        {
+            rn_thread_join(pool->workers[i].thread);
+        }
+        for (int i = 0; i < pool->thread_count; i++)
+        {
+            free(pool->workers[i].deque.tasks);
+            pool->workers[i].deque.tasks = NULL;
+            rn_mutex_destroy(&pool->workers[i].deque.lock);
+        }
+        pool->thread_count = 0;
+        return -1;
+    }
+
+    pool->running = 1;
+    return 0;
+}
+
+RN_API void pool_stop(WorkPool *pool)
+{
+    /*
+     * Function  : void pool_stop(WorkPool *pool)
+     * Input     : pool - pointer to a started WorkPool
+     * Output    : None
+     * Procedure : This function runs every task still waiting, stops the workers and releases their deques. The statistics stay readable afterwards.
+     */
+
+    if (!pool->running)
+    {
+        return;
+    }
+
+    rn_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    rn_cond_broadcast(&pool->work);
+    rn_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++)
+    {
+        rn_thread_join(pool->workers[i].thread);
+    }
+
+    for (int i = 0; i < pool->thread_count; i++)
+    {
+        free(pool->workers[i].deque.tasks);
+        pool->workers[i].deque.tasks = NULL;
+        rn_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+
+    rn_mutex_lock(&pool->lock);
+    pool->running = 0;
+    rn_mutex_unlock(&pool->lock);
+}
+
+static void start_default_pool(void)
+{
+    /* Function  : static void start_default_pool(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function starts the default pool with one worker per processor and registers its stop with atexit.
+     */
+
+    if (pool_start(&rocknation_pool, 0) == 0)
+    {
+        atexit(stop_default_pool);
+    }
+}
+
+static void stop_default_pool(void)
+{
+    /* Function  : static void stop_default_pool(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function stops the default pool at exit. Its lock is kept, so print_pool_stats can still run from a later exit handler.
+     */
+
+    pool_stop(&rocknation_pool);
+}
+
+RN_API WorkPool *get_pool(void)
+{
+    /*
+     * Function  : WorkPool *get_pool(void)
+     * Input     : None
+     * Output    : Returns a pointer to the default pool, or NULL if its workers couldn't be started
+     * Procedure : This function returns the pool shared by the whole process, starting it the first time. Unlike sessions and caches, a pool can be used from any number of threads at once, so clients don't have their own.
+     */
+
+    rn_once(&rocknation_pool_once, start_default_pool);
+
+    return rocknation_pool.running ? &rocknation_pool : NULL;
+}
+
+RN_API int pool_submit(WorkPool *pool, PoolTaskFunction function, void *argument)
+{
+    /*
+     * Function  : int pool_submit(WorkPool *pool, PoolTaskFunction function, void *argument)
+     * Input     : pool - pointer to a started WorkPool
+     *             function - pointer to the function to run on a worker
+     *             argument - pointer passed to function
+     * Output    : Returns 0 if the task was queued, -1 if it couldn't be (the caller runs it itself)
+     * Procedure : This function queues function(argument) on the deque of the calling worker, or on the next deque in turn when called from outside the pool, growing the deque if it is full, and wakes a sleeping worker. Tasks have to report their results themselves; pool_wait only tells that everything ran.
+     */
+
+    PoolDeque *deque;
+
+    if (current_worker != NULL && current_worker->pool == pool)
+    {
+        deque = &current_worker->deque;
+    }
+    else
+    {
+        unsigned long turn = RN_ATOMIC_ADD(pool->next, 1);
+        deque = &pool->workers[turn % (unsigned long)pool->thread_count].deque;
+    }
+
+    PoolTask task = {function, argument, pool_bind_worker, rn_clock()};
+
+    // Counted before a worker can take it, so completed never catches up with submitted while it is in a deque
+    rn_mutex_lock(&pool->lock);
+    pool->queued++;
+    pool->submitted++;
+    rn_mutex_unlock(&pool->lock);
+
+    rn_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity)
+    {
+        PoolTask *grown = rn_malloc(deque->capacity * 2 * sizeof(PoolTask));
+        if (grown == NULL)
+        {
+            rn_mutex_unlock(&deque->lock);
+
+            rn_mutex_lock(&pool->lock);
+            pool->queued--;
+            pool->submitted--;
+            if (pool->completed == pool->submitted)
+            {
+                rn_cond_broadcast(&pool->drained);
+            }
+            rn_mutex_unlock(&pool->lock);
+            return -1;
+        }
+        for (int i = 0; i < deque->count; i++)
+        {
+            grown[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = grown;
+        deque->head = 0;
+        deque->capacity *= 2;
+    }
+    pool_deque_push(deque, task);
+    rn_mutex_unlock(&deque->lock);
+
+    rn_mutex_lock(&pool->lock);
+    rn_cond_signal(&pool->work);
+    rn_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+RN_API void pool_wait(WorkPool *pool)
+{
+    /*
+     * Function  : void pool_wait(WorkPool *pool)
+     * Input     : pool - pointer to a started WorkPool
+     * Output    : None
+     * Procedure : This function waits until every task submitted to the pool so far, by any thread, has run. It must not be called from a task.
+     */
+
+    rn_mutex_lock(&pool->lock);
+    while (pool->completed < pool->submitted)
+    {
+        rn_cond_wait(&pool->drained, &pool->lock);
+    }
+    rn_mutex_unlock(&pool->lock);
+}
+
+RN_API void print_pool_stats(void)
+{
+    /*
+     * Function  : void print_pool_stats(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints to stderr how many tasks the default pool ran and how many were stolen, how long its deques got, and the median, 99th percentile and maximum of the time tasks waited in a deque and ran. Percentiles come from power-of-two buckets, so they are upper bounds.
+     */
+
+    WorkPool *pool = &rocknation_pool;
+
+    if (pool->thread_count == 0)
+    {
+        return;
+    }
+
+    rn_mutex_lock(&pool->lock);
+
+    if (pool->completed > 0)
+    {
+        int max_length = 0;
+        double length_sum = 0;
+        long pushes = 0;
+
+        for (int i = 0; i < pool->thread_count; i++)
+        {
+            // Once the pool is stopped the deque locks are gone, but nothing writes the deques anymore
+            PoolDeque *deque = &pool->workers[i].deque;
+            if (pool->running)
+            {
+                rn_mutex_lock(&deque->lock);
+            }
+            if (deque->max_length > max_length)
+            {
+                max_length = deque->max_length;
+            }
+            length_sum += deque->length_sum;
+            pushes += deque->pushes;
+            if (pool->running)
+            {
+                rn_mutex_unlock(&deque->lock);
+            }
+        }
+
+        fprintf(stderr, "[pool] %d threads, %ld tasks, %ld stolen; queue length avg %.1f, max %d\n",
+                pool->thread_count, pool->completed, pool->steals, pushes > 0 ? length_sum / pushes : 0.0, max_length);
+        fprintf(stderr, "[pool] wait p50 %.3f ms, p99 %.3f ms, max %.3f ms; run p50 %.3f ms, p99 %.3f ms, max %.3f ms, total %.3f s\n",
+                latency_percentile(pool->wait_histogram, pool->completed, 0.5, pool->wait_max) * 1000.0,
+                latency_percentile(pool->wait_histogram, pool->completed, 0.99, pool->wait_max) * 1000.0, pool->wait_max * 1000.0,
+                latency_percentile(pool->run_histogram, pool->completed, 0.5, pool->run_max) * 1000.0,
+                latency_percentile(pool->run_histogram, pool->completed, 0.99, pool->run_max) * 1000.0, pool->run_max * 1000.0,
+                pool->run_total);
+    }
+
+    rn_mutex_unlock(&pool->lock);
+}
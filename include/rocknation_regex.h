@@ -0,0 +1,291 @@
+// rocknation_regex.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_scan.h"
+
+typedef enum
+{
+    PATTERN_BAND,  // Band row of the search results: url, name, genre
+    PATTERN_ALBUM, // Album link of a discography page: url, year, name
+    PATTERN_SONG,  // MP3 link of an album page: url, artist, year, album, file name
+    PATTERN_COUNT
+} PatternId;
+
+typedef struct
+{
+    const char *pattern;
+    uint32_t options;
+    ScanFunction scan;            // Hand-written equivalent used instead of PCRE2 where it is faster (see pattern_match), may be NULL
+    pcre2_code *code;
+    pcre2_match_data *match_data; // Reused by every match of the pattern
+    int jit;                      // Set if the pattern was JIT-compiled
+    PCRE2_SIZE scan_ovector[8];   // Offsets of the last match of the scanner
+} CompiledPattern;
+
+// Called for every match; returning non-zero stops the extraction
+typedef int (*MatchCallback)(const char *subject, const PCRE2_SIZE *ovector, void *userdata);
+
+typedef struct
+{
+    PatternId pattern;
+    size_t offset;         // Where the next search starts; a pending partial match starts here
+    int matches;           // Complete matches found so far
+    int stopped;           // Set once the callback asked to stop
+    MatchCallback on_match;
+    void *userdata;
+} StreamExtractor;
+
+// Patterns of the threads that haven't bound a client (see rocknation_client.h); a client compiles its own copy
+static CompiledPattern pattern_registry[PATTERN_COUNT] = {
+    {"<a href=\"(\\/mp3\\/band-[0-9]+)\">([a-zA-Z0-9 \\/]+)<\\/a><\\/td><td>([a-zA-Z0-9 ]+)<\\/td>", PCRE2_CASELESS, scan_band, NULL, NULL, 0, {0}},
+    {"<a href=\"(\\/mp3\\/album-[0-9]+)\">([0-9]+) - (.*?)<\\/a>", PCRE2_CASELESS, scan_album, NULL, NULL, 0, {0}},
+    {"(http:\\/\\/rocknation.su\\/upload\\/mp3\\/([a-zA-Z0-9 %]+)\\/([0-9]{4}) - ([a-zA-Z0-9 %]+)\\/([a-zA-Z0-9 %\\.]+))", 0, NULL, NULL, NULL, 0, {0}},
+};
+
+static RN_THREAD_LOCAL CompiledPattern *bound_patterns = NULL;
+
+RN_API CompiledPattern *get_patterns(void);
+RN_API void init_patterns(CompiledPattern *patterns);
+RN_API void free_patterns(void);
+static void free_default_patterns(void);
+RN_API CompiledPattern *get_pattern(PatternId id);
+RN_API int pattern_match(PatternId id, const char *subject, size_t length, size_t offset, uint32_t options, PCRE2_SIZE **ovector);
+RN_API char *dup_group(Arena *arena, const char *prefix, const char *subject, const PCRE2_SIZE *ovector, int group);
+RN_API void extractor_init(StreamExtractor *extractor, PatternId pattern, MatchCallback on_match, void *userdata);
+RN_API int extractor_feed(StreamExtractor *extractor, const char *data, size_t size, int final);
+
+RN_API CompiledPattern *get_patterns(void)
+{
+    /*
+     * Function  : CompiledPattern *get_patterns(void)
+     * Input     : None
+     * Output    : Returns a pointer to the PATTERN_COUNT patterns of the calling thread
+     * Procedure : This function returns the patterns of the client bound to the calling thread, or the default registry if the thread hasn't bound a client. A compiled pattern can be matched from several threads, but its match data and scanner offsets can't, so every client has its own.
+     */
+
+    return bound_patterns != NULL ? bound_patterns : pattern_registry;
+}
+
+RN_API void init_patterns(CompiledPattern *patterns)
+{
+    /*
+     * Function  : void init_patterns(CompiledPattern *patterns)
+     * Input     : patterns - pointer to an array of PATTERN_COUNT patterns
+     * Output    : None
+     * Procedure : This function fills a set of patterns with the sources and scanners of the registry, not compiled yet; they are compiled on first use like the registry (see get_pattern).
+     */
+
+    for (int i = 0; i < PATTERN_COUNT; i++)
+    {
+        memset(&patterns[i], 0, sizeof(patterns[i]));
+        patterns[i].pattern = pattern_registry[i].pattern;
+        patterns[i].options = pattern_registry[i].options;
+        patterns[i].scan = pattern_registry[i].scan;
+    }
+}
+
+RN_API void free_patterns(void)
+{
+    /*
+     * Function  : void free_patterns(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function releases the compiled code and match data of every pattern of the calling thread (see get_patterns).
+     */
+
+    CompiledPattern *patterns = get_patterns();
+
+    for (int i = 0; i < PATTERN_COUNT; i++)
+    {
+        pcre2_match_data_free(patterns[i].match_data);
+        pcre2_code_free(patterns[i].code);
+        patterns[i].match_data = NULL;
+        patterns[i].code = NULL;
+    }
+}
+
+static void free_default_patterns(void)
+{
+    /* Function  : static void free_default_patterns(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function releases the default registry. It is registered with atexit the first time one of its patterns is compiled.
+     */
+
+    bound_patterns = NULL;
+    free_patterns();
+}
+
+RN_API CompiledPattern *get_pattern(PatternId id)
+{
+    /*
+     * Function  : CompiledPattern *get_pattern(PatternId id)
+     * Input     : id - identifier of the extraction pattern
+     * Output    : Returns a pointer to the compiled pattern, or NULL if it couldn't be compiled
+     * Procedure : This function compiles an extraction pattern of the calling thread (see get_patterns) with PCRE2 the first time it is needed and keeps it until its client is destroyed or the process exits, so pages are no longer paying a compile per call. The pattern is also JIT-compiled, for both complete and partial matching, when PCRE2 was built with JIT support (matching silently falls back to the interpreter otherwise), and a match data block sized for the pattern is allocated once and reused by every match.
+     */
+
+    CompiledPattern *compiled = &get_patterns()[id];
+
+    if (compiled->code == NULL)
+    {
+        int errorcode;
+        PCRE2_SIZE erroroffset;
+
+        compiled->code = pcre2_compile((PCRE2_SPTR)compiled->pattern, PCRE2_ZERO_TERMINATED, compiled->options, &errorcode, &erroroffset, NULL);
+        if (compiled->code == NULL)
+        {
+            PCRE2_UCHAR message[256];
+            pcre2_get_error_message(errorcode, message, sizeof(message));
+            fprintf(stderr, "Error compiling pattern at offset %zu: %s\n", (size_t)erroroffset, (char *)message);
+            return NULL;
+        }
+
+        compiled->jit = pcre2_jit_compile(compiled->code, PCRE2_JIT_COMPLETE | PCRE2_JIT_PARTIAL_HARD) == 0;
+        compiled->match_data = pcre2_match_data_create_from_pattern(compiled->code, NULL);
+
+        static int registered = 0;
+        if (compiled == &pattern_registry[id] && !registered)
+        {
+            atexit(free_default_patterns);
+            registered = 1;
+        }
+    }
+
+    return compiled;
+}
+
+RN_API int pattern_match(PatternId id, const char *subject, size_t length, size_t offset, uint32_t options, PCRE2_SIZE **ovector)
+{
+    /*
+     * Function  : int pattern_match(PatternId id, const char *subject, size_t length, size_t offset, uint32_t options, PCRE2_SIZE **ovector)
+     * Input     : id - identifier of the extraction pattern
+     *             subject - pointer to the text to search
+     *             length - length of the text in bytes
+     *             offset - position to start searching from
+     *             options - PCRE2 match options (0, or PCRE2_PARTIAL_HARD while the text is still incomplete)
+     *             ovector - pointer receiving the offsets of the match and its groups
+     * Output    : Returns the number of groups matched plus one on a match, PCRE2_ERROR_PARTIAL if the text ends in the middle of a possible match, another negative value otherwise
+     * Procedure : This function looks for the next match of a registered pattern in subject, starting at offset. Patterns that have a hand-written scanner (see rocknation_scan.h) are matched with it, which gives the same results without running the regex engine, when the pattern couldn't be JIT-compiled: they go several times faster than the PCRE2 interpreter, but no faster than the JIT, even with SIMD (test_scan measures the three). Builds with ROCKNATION_REGEX_ONLY never use them. The offsets of the match stay valid until the next call for the same pattern, as they live in storage shared by every match of the pattern in the calling thread's client.
+     */
+
+#ifndef ROCKNATION_REGEX_ONLY
+    CompiledPattern *scanned = &get_patterns()[id];
+    if (scanned->scan != NULL && (get_pattern(id) == NULL || !scanned->jit))
+    {
+        *ovector = scanned->scan_ovector;
+        return scanned->scan(subject, length, offset, !(options & PCRE2_PARTIAL_HARD), scanned->scan_ovector);
+    }
+#endif
+
+    CompiledPattern *compiled = get_pattern(id);
+    if (compiled == NULL || compiled->match_data == NULL)
+    {
+        return PCRE2_ERROR_NOMATCH;
+    }
+
+    int rc = pcre2_match(compiled->code, (PCRE2_SPTR)subject, length, offset, options, compiled->match_data, NULL);
+    *ovector = pcre2_get_ovector_pointer(compiled->match_data);
+
+    return rc;
+}
+
+RN_API char *dup_group(Arena *arena, const char *prefix, const char *subject, const PCRE2_SIZE *ovector, int group)
+{
+    /*
+     * Function  : char *dup_group(Arena *arena, const char *prefix, const char *subject, const PCRE2_SIZE *ovector, int group)
+     * Input     : arena - pointer to the Arena the copy is allocated from
+     *             prefix - text to put in front of the group (e.g. the site address of a relative link), or NULL
+     *             subject - pointer to the text that was searched
+     *             ovector - pointer to the offsets of the match
+     *             group - number of the capture group
+     * Output    : Returns the null-terminated text of the group, or NULL if the arena is out of memory
+     * Procedure : This function copies a capture group straight out of the subject into a string of exactly the right length in the arena, so a field is never truncated and needs no malloc or free of its own.
+     */
+
+    size_t start = ovector[2 * group];
+    size_t end = ovector[2 * group + 1];
+    size_t length = (start == PCRE2_UNSET || end < start) ? 0 : end - start;
+    size_t prefix_length = prefix != NULL ? strlen(prefix) : 0;
+    char *copy = arena_alloc(arena, prefix_length + length + 1);
+
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    if (prefix_length > 0)
+    {
+        memcpy(copy, prefix, prefix_length);
+    }
+    if (length > 0)
+    {
+        memcpy(copy + prefix_length, subject + start, length);
+    }
+    copy[prefix_length + length] = '\0';
+
+    return copy;
+}
+
+RN_API void extractor_init(StreamExtractor *extractor, PatternId pattern, MatchCallback on_match, void *userdata)
+{
+    /*
+     * Function  : void extractor_init(StreamExtractor *extractor, PatternId pattern, MatchCallback on_match, void *userdata)
+     * Input     : extractor - pointer to the StreamExtractor structure to initialize
+     *             pattern - identifier of the pattern to extract
+     *             on_match - function called with every match found
+     *             userdata - pointer passed to on_match
+     * Output    : None
+     * Procedure : This function prepares an extractor to scan a page from its first byte.
+     */
+
+    extractor->pattern = pattern;
+    extractor->offset = 0;
+    extractor->matches = 0;
+    extractor->stopped = 0;
+    extractor->on_match = on_match;
+    extractor->userdata = userdata;
+}
+
+RN_API int extractor_feed(StreamExtractor *extractor, const char *data, size_t size, int final)
+{
+    /*
+     * Function  : int extractor_feed(StreamExtractor *extractor, const char *data, size_t size, int final)
+     * Input     : extractor - pointer to the StreamExtractor structure
+     *             data - pointer to the page received so far
+     *             size - number of bytes received so far
+     *             final - non-zero once the page is complete
+     * Output    : Returns the number of complete matches found so far
+     * Procedure : This function scans the part of the page that arrived since the last call and hands every complete match to the callback right away, so results can be used while the rest of the page is still downloading. data must be the whole page received so far (a growing buffer), not only the last chunk. Until the page is final the search uses PCRE2_PARTIAL_HARD: when the received text ends in the middle of a possible match, the extractor remembers where that match starts and retries it from there on the next call, so matches spanning two chunks are neither lost nor cut short. When nothing can match any more, the scanned text is skipped for good.
+     */
+
+    uint32_t options = final ? 0 : PCRE2_PARTIAL_HARD;
+
+    while (!extractor->stopped && extractor->offset < size)
+    {
+        PCRE2_SIZE *ovector;
+        int rc = pattern_match(extractor->pattern, data, size, extractor->offset, options, &ovector);
+
+        if (rc == PCRE2_ERROR_PARTIAL)
+        {
+            // Wait for the rest of the match
+            extractor->offset = ovector[0];
+            break;
+        }
+        if (rc < 0)
+        {
+            extractor->offset = size;
+            break;
+        }
+
+        extractor->matches++;
+        extractor->offset = ovector[1];
+
+        if (extractor->on_match(data, ovector, extractor->userdata) != 0)
+        {
+            extractor->stopped = 1;
+        }
+    }
+
+    return extractor->matches;
+}
@@ -0,0 +1,317 @@
+// rocknation_scan.h
+#pragma once
+#include "rocknation_types.h"
+
+// Every band and album link starts with this anchor (matched caselessly), followed by the kind of link
+#define SCAN_ANCHOR "<a href=\"/mp3/"
+#define SCAN_ANCHOR_LENGTH 14
+
+// Outcome of reading one token of a candidate
+#define SCAN_FAIL 0
+#define SCAN_OK 1
+#define SCAN_TRUNCATED -1
+
+typedef int (*ScanFunction)(const char *data, size_t size, size_t offset, int final, PCRE2_SIZE *ovector);
+
+static int scan_literal(const char *data, size_t size, size_t *pos, const char *literal);
+static int scan_run(const char *data, size_t size, size_t *pos, const char *class_table);
+static size_t find_anchor(const char *data, size_t size, size_t offset, char kind);
+RN_API int scan_band(const char *data, size_t size, size_t offset, int final, PCRE2_SIZE *ovector);
+RN_API int scan_album(const char *data, size_t size, size_t offset, int final, PCRE2_SIZE *ovector);
+
+// Character classes of the fields, indexed by byte
+static const char scan_digit[256] = {
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1};
+
+#define SCAN_ALNUM_SPACE                                                                                         \
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1, \
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1, \
+    ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1, \
+    ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1,                                           \
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1, \
+    ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1, \
+    ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1, [' '] = 1
+
+static const char scan_genre[256] = {SCAN_ALNUM_SPACE};
+static const char scan_band_name[256] = {SCAN_ALNUM_SPACE, ['/'] = 1};
+
+static int scan_literal(const char *data, size_t size, size_t *pos, const char *literal)
+{
+    /* Function  : static int scan_literal(const char *data, size_t size, size_t *pos, const char *literal)
+     * Input     : data - pointer to the text being scanned
+     *             size - length of the text
+     *             pos - pointer to the current position, moved past the literal on success
+     *             literal - pointer to the expected text, in lowercase
+     * Output    : Returns SCAN_OK, SCAN_FAIL, or SCAN_TRUNCATED if the text ends inside the literal
+     * Procedure : This function compares the text at *pos with literal ignoring ASCII case, like the caseless patterns of rocknation_regex.h do.
+     */
+
+    size_t p = *pos;
+
+    for (; *literal != '\0'; literal++, p++)
+    {
+        if (p >= size)
+        {
+            return SCAN_TRUNCATED;
+        }
+
+        unsigned char c = (unsigned char)data[p];
+        if (c >= 'A' && c <= 'Z')
+        {
+            c += 'a' - 'A';
+        }
+        if (c != (unsigned char)*literal)
+        {
+            return SCAN_FAIL;
+        }
+    }
+
+    *pos = p;
+    return SCAN_OK;
+}
+
+static int scan_run(const char *data, size_t size, size_t *pos, const char *class_table)
+{
+    /* Function  : static int scan_run(const char *data, size_t size, size_t *pos, const char *class_table)
+     * Input     : data - pointer to the text being scanned
+     *             size - length of the text
+     *             pos - pointer to the current position, moved past the run on success
+     *             class_table - table of the bytes that belong to the run
+     * Output    : Returns SCAN_OK, SCAN_FAIL if the run is empty, or SCAN_TRUNCATED if the text ends inside the run
+     * Procedure : This function reads the longest run of bytes of a character class, the equivalent of a greedy [class]+ in the patterns. A run reaching the end of the text may continue in data that hasn't arrived yet.
+     */
+
+    size_t p = *pos;
+
+    while (p < size && class_table[(unsigned char)data[p]])
+    {
+        p++;
+    }
+
+    if (p >= size)
+    {
+        return SCAN_TRUNCATED;
+    }
+    if (p == *pos)
+    {
+        return SCAN_FAIL;
+    }
+
+    *pos = p;
+    return SCAN_OK;
+}
+
+static size_t find_anchor(const char *data, size_t size, size_t offset, char kind)
+{
+    /* Function  : static size_t find_anchor(const char *data, size_t size, size_t offset, char kind)
+     * Input     : data - pointer to the text being scanned
+     *             size - length of the text
+     *             offset - position to start searching from
+     *             kind - first letter of the kind of link, in lowercase ('b' for bands, 'a' for albums)
+     * Output    : Returns the position of the next anchor candidate, or size if there is none
+     * Procedure : This function looks for the next place where SCAN_ANCHOR followed by kind may start. With SSE2 (16 bytes at a time) or AVX2 (32 bytes at a time) it checks three bytes of it against every position of a block at once: the '<' and the second '/', which have no case, and the kind letter, folded to lowercase by setting its 0x20 bit. Only the positions where all three agree are returned, which leaves very few candidates for the caller to check. The end of the text, and builds without SIMD (or with ROCKNATION_NO_SIMD), are handled byte by byte; there a candidate is any '<', including one too close to the end to hold the whole anchor.
+     */
+
+    size_t i = offset;
+
+#if defined(RN_SIMD_AVX2)
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i letter = _mm256_set1_epi8(kind);
+    const __m256i lower = _mm256_set1_epi8(0x20);
+
+    while (i + 32 + SCAN_ANCHOR_LENGTH <= size)
+    {
+        __m256i first = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i last = _mm256_loadu_si256((const __m256i *)(data + i + SCAN_ANCHOR_LENGTH - 1));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(data + i + SCAN_ANCHOR_LENGTH));
+
+        __m256i hits = _mm256_and_si256(_mm256_cmpeq_epi8(first, lt),
+                                        _mm256_and_si256(_mm256_cmpeq_epi8(last, slash),
+                                                         _mm256_cmpeq_epi8(_mm256_or_si256(next, lower), letter)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits);
+
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+        i += 32;
+    }
+#elif defined(RN_SIMD_SSE2)
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i letter = _mm_set1_epi8(kind);
+    const __m128i lower = _mm_set1_epi8(0x20);
+
+    while (i + 16 + SCAN_ANCHOR_LENGTH <= size)
+    {
+        __m128i first = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i last = _mm_loadu_si128((const __m128i *)(data + i + SCAN_ANCHOR_LENGTH - 1));
+        __m128i next = _mm_loadu_si128((const __m128i *)(data + i + SCAN_ANCHOR_LENGTH));
+
+        __m128i hits = _mm_and_si128(_mm_cmpeq_epi8(first, lt),
+                                     _mm_and_si128(_mm_cmpeq_epi8(last, slash),
+                                                   _mm_cmpeq_epi8(_mm_or_si128(next, lower), letter)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+
+        if (mask != 0)
+        {
+#if defined(_MSC_VER)
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return i + bit;
+#else
+            return i + __builtin_ctz(mask);
+#endif
+        }
+        i += 16;
+    }
+#else
+    (void)kind;
+#endif
+
+    if (i >= size)
+    {
+        return size;
+    }
+
+    const char *next = memchr(data + i, '<', size - i);
+    return next != NULL ? (size_t)(next - data) : size;
+}
+
+RN_API int scan_band(const char *data, size_t size, size_t offset, int final, PCRE2_SIZE *ovector)
+{
+    /*
+     * Function  : int scan_band(const char *data, size_t size, size_t offset, int final, PCRE2_SIZE *ovector)
+     * Input     : data - pointer to the HTML of a search results page
+     *             size - length of the HTML
+     *             offset - position to start searching from
+     *             final - non-zero if the page is complete
+     *             ovector - pointer to 8 offsets receiving the match and its 3 groups
+     * Output    : Returns 4 on a match, PCRE2_ERROR_PARTIAL if the page ends inside a possible match (only when it isn't final), PCRE2_ERROR_NOMATCH otherwise
+     * Procedure : This function is a hand-written equivalent of the band pattern of rocknation_regex.h. It finds the anchors with find_anchor and reads the fields directly, giving the same matches, groups and partial matches as PCRE2 (with PCRE2_PARTIAL_HARD when the page isn't final).
+     */
+
+    size_t start = offset;
+
+    while ((start = find_anchor(data, size, start, 'b')) < size)
+    {
+        size_t p = start;
+        size_t url_start = start + 9;
+        size_t name_start, name_end, genre_start, genre_end;
+        int rc;
+
+        if ((rc = scan_literal(data, size, &p, "<a href=\"/mp3/band-")) == SCAN_OK &&
+            (rc = scan_run(data, size, &p, scan_digit)) == SCAN_OK)
+        {
+            size_t url_end = p;
+
+            if ((rc = scan_literal(data, size, &p, "\">")) == SCAN_OK &&
+                (name_start = p, rc = scan_run(data, size, &p, scan_band_name)) == SCAN_OK &&
+                (name_end = p, rc = scan_literal(data, size, &p, "</a></td><td>")) == SCAN_OK &&
+                (genre_start = p, rc = scan_run(data, size, &p, scan_genre)) == SCAN_OK &&
+                (genre_end = p, rc = scan_literal(data, size, &p, "</td>")) == SCAN_OK)
+            {
+                ovector[0] = start;
+                ovector[1] = p;
+                ovector[2] = url_start;
+                ovector[3] = url_end;
+                ovector[4] = name_start;
+                ovector[5] = name_end;
+                ovector[6] = genre_start;
+                ovector[7] = genre_end;
+                return 4;
+            }
+        }
+
+        if (rc == SCAN_TRUNCATED && !final)
+        {
+            ovector[0] = start;
+            ovector[1] = size;
+            return PCRE2_ERROR_PARTIAL;
+        }
+
+        start++;
+    }
+
+    return PCRE2_ERROR_NOMATCH;
+}
+
+RN_API int scan_album(const char *data, size_t size, size_t offset, int final, PCRE2_SIZE *ovector)
+{
+    /*
+     * Function  : int scan_album(const char *data, size_t size, size_t offset, int final, PCRE2_SIZE *ovector)
+     * Input     : data - pointer to the HTML of a discography page
+     *             size - length of the HTML
+     *             offset - position to start searching from
+     *             final - non-zero if the page is complete
+     *             ovector - pointer to 8 offsets receiving the match and its 3 groups
+     * Output    : Returns 4 on a match, PCRE2_ERROR_PARTIAL if the page ends inside a possible match (only when it isn't final), PCRE2_ERROR_NOMATCH otherwise
+     * Procedure : This function is a hand-written equivalent of the album pattern of rocknation_regex.h. It finds the anchors with find_anchor and reads the fields directly; the album name, a lazy (.*?) in the pattern, ends at the first "</a>" and can't span a line, exactly as with PCRE2.
+     */
+
+    size_t start = offset;
+
+    while ((start = find_anchor(data, size, start, 'a')) < size)
+    {
+        size_t p = start;
+        size_t url_start = start + 9;
+        size_t url_end = 0, year_start = 0, year_end = 0, name_start = 0;
+        int rc;
+
+        if ((rc = scan_literal(data, size, &p, "<a href=\"/mp3/album-")) == SCAN_OK &&
+            (rc = scan_run(data, size, &p, scan_digit)) == SCAN_OK &&
+            (url_end = p, rc = scan_literal(data, size, &p, "\">")) == SCAN_OK &&
+            (year_start = p, rc = scan_run(data, size, &p, scan_digit)) == SCAN_OK &&
+            (year_end = p, rc = scan_literal(data, size, &p, " - ")) == SCAN_OK)
+        {
+            name_start = p;
+
+            // Shortest name followed by "</a>", on a single line
+            while (1)
+            {
+                while (p < size && data[p] != '<' && data[p] != '\n')
+                {
+                    p++;
+                }
+
+                size_t name_end = p;
+
+                rc = scan_literal(data, size, &p, "</a>");
+                if (rc == SCAN_OK)
+                {
+                    ovector[0] = start;
+                    ovector[1] = p;
+                    ovector[2] = url_start;
+                    ovector[3] = url_end;
+                    ovector[4] = year_start;
+                    ovector[5] = year_end;
+                    ovector[6] = name_start;
+                    ovector[7] = name_end;
+                    return 4;
+                }
+                if (rc == SCAN_TRUNCATED)
+                {
+                    break;
+                }
+                if (data[p] == '\n')
+                {
+                    rc = SCAN_FAIL;
+                    break;
+                }
+                p++;
+            }
+        }
+
+        if (rc == SCAN_TRUNCATED && !final)
+        {
+            ovector[0] = start;
+            ovector[1] = size;
+            return PCRE2_ERROR_PARTIAL;
+        }
+
+        start++;
+    }
+
+    return PCRE2_ERROR_NOMATCH;
+}
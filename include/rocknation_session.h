@@ -0,0 +1,576 @@
+// rocknation_session.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_cache.h"
+#include "rocknation_regex.h"
+#include "rocknation_store.h"
+#include "rocknation_names.h"
+#include "rocknation_pool.h"
+#include "rocknation_disk.h"
+
+typedef struct
+{
+    CURLSH *share;  // Connection pool, DNS cache and TLS sessions shared by every handle
+    CURL *curl;     // Easy handle reused by the catalog requests
+    int timings;    // Print a timing breakdown for every request
+    int requests;   // Number of requests performed
+    long connects;  // Number of new connections opened (requests - connects = reused)
+    curl_off_t dns_us;      // Time spent resolving names
+    curl_off_t tcp_us;      // Time spent on TCP handshakes
+    curl_off_t tls_us;      // Time spent on TLS handshakes
+    curl_off_t wait_us;     // Time between sending the request and the first byte
+    curl_off_t transfer_us; // Time spent receiving the body
+    curl_off_t total_us;    // Total time of all requests
+    curl_off_t page_wire_bytes;    // Bytes of catalog pages received (compressed)
+    curl_off_t page_decoded_bytes; // Bytes of catalog pages after decompression
+} RocknationSession;
+
+// Session of the threads that haven't bound a client (see rocknation_client.h)
+static RocknationSession rocknation_session = {0};
+static RN_THREAD_LOCAL RocknationSession *bound_session = NULL;
+RN_SHARED RnOnce rocknation_curl_once = RN_ONCE_INIT; // libcurl initialized, see session_global_init
+
+typedef struct
+{
+    MemoryStruct *chunk;        // Buffer the page is accumulated in
+    size_t start;               // Where the page starts in the buffer
+    StreamExtractor *extractor; // Fed with the page as it arrives
+} PageStream;
+
+typedef struct
+{
+    const char *url;
+    const char *postdata;
+    CacheEntry entry;           // Cached copy of the page
+    int cached;                 // Set if entry holds a cached copy
+    struct curl_slist *headers; // Extra request headers, freed once the request is finished
+    CacheValidators validators; // Validators of the response
+    PageStream stream;          // Where the page goes
+} PageRequest;
+
+static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp);
+static RocknationSession *current_session(void);
+static void session_global_init(void);
+RN_API RocknationSession *get_session(void);
+RN_API void session_cleanup(void);
+static void cleanup_default_session(void);
+RN_API void session_attach(CURL *curl);
+RN_API void session_record_timings(CURL *curl, const char *url);
+RN_API void session_record_page_size(CURL *curl, size_t decoded_size);
+RN_API void print_session_timings(void);
+static size_t WriteStreamCallback(void *contents, size_t size, size_t nmemb, void *userp);
+RN_API int fetch_page(const char *url, const char *postdata, MemoryStruct *chunk);
+RN_API void finish_page_stream(StreamExtractor *extractor, MemoryStruct *chunk, size_t start);
+RN_API int fetch_page_streaming(const char *url, const char *postdata, MemoryStruct *chunk, StreamExtractor *extractor);
+RN_API int page_request_begin(PageRequest *request, CURL *curl, const char *url, const char *postdata, MemoryStruct *chunk, StreamExtractor *extractor);
+RN_API long page_request_finish(PageRequest *request, CURL *curl, CURLcode res);
+RN_API void page_request_cancel(PageRequest *request);
+
+static RocknationSession *current_session(void)
+{
+    /* Function  : static RocknationSession *current_session(void)
+     * Input     : None
+     * Output    : Returns a pointer to the session of the calling thread, initialized or not
+     * Procedure : This function returns the session of the client bound to the calling thread, or the default one if the thread hasn't bound a client.
+     */
+
+    return bound_session != NULL ? bound_session : &rocknation_session;
+}
+
+static void session_global_init(void)
+{
+    /* Function  : static void session_global_init(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function initializes libcurl for the whole process. It runs once (see rn_once), before the first handle of any session is created, because curl_global_init must not race with other libcurl calls; the matching curl_global_cleanup runs at exit, after every session has been released.
+     */
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    atexit(curl_global_cleanup);
+}
+
+RN_API RocknationSession *get_session(void)
+{
+    /*
+     * Function  : RocknationSession *get_session(void)
+     * Input     : None
+     * Output    : Returns a pointer to the session of the calling thread
+     * Procedure : This function lazily initializes the long-lived session of the calling thread's client (or the default one) the first time it is called: a share handle that holds the connection pool, DNS cache and TLS session cache, and an easy handle that is reused by every catalog request. Keeping them alive lets consecutive requests to rocknation.su reuse the same keep-alive connection instead of paying a new TCP+TLS handshake each time. The handles are never shared with another client, so the share handle needs no locks. The default session is released automatically at exit.
+     */
+
+    RocknationSession *session = current_session();
+
+    if (session->share == NULL)
+    {
+        rn_once(&rocknation_curl_once, session_global_init);
+
+        session->share = curl_share_init();
+        curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+        session->curl = curl_easy_init();
+
+        static int registered = 0;
+        if (session == &rocknation_session && !registered)
+        {
+            atexit(cleanup_default_session);
+            registered = 1;
+        }
+    }
+
+    return session;
+}
+
+RN_API void session_cleanup(void)
+{
+    /*
+     * Function  : void session_cleanup(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints the timing, cache, store, name cache, pool, disk writer and allocation summary of the calling thread if it was requested and releases the handles owned by its session, closing any connection still kept alive.
+     */
+
+    RocknationSession *session = current_session();
+
+    if (session->share == NULL)
+    {
+        return;
+    }
+
+    if (session->timings)
+    {
+        print_session_timings();
+        print_cache_stats();
+        print_store_stats();
+        print_name_cache_stats();
+        print_pool_stats();
+        print_disk_stats();
+        print_alloc_stats();
+    }
+
+    if (session->curl != NULL)
+    {
+        curl_easy_cleanup(session->curl);
+        session->curl = NULL;
+    }
+
+    curl_share_cleanup(session->share);
+    session->share = NULL;
+}
+
+static void cleanup_default_session(void)
+{
+    /* Function  : static void cleanup_default_session(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function releases the default session. It is registered with atexit when that session is first used.
+     */
+
+    bound_session = NULL;
+    session_cleanup();
+}
+
+RN_API void session_attach(CURL *curl)
+{
+    /*
+     * Function  : void session_attach(CURL *curl)
+     * Input     : curl - pointer to an easy handle
+     * Output    : None
+     * Procedure : This function makes the given easy handle use the connection pool of the session, so downloads started on their own handles can reuse connections opened by earlier requests and vice versa.
+     */
+
+    curl_easy_setopt(curl, CURLOPT_SHARE, get_session()->share);
+}
+
+RN_API void session_record_timings(CURL *curl, const char *url)
+{
+    /*
+     * Function  : void session_record_timings(CURL *curl, const char *url)
+     * Input     : curl - pointer to the easy handle of a finished request
+     *             url - pointer to the URL of the request (for display)
+     * Output    : None
+     * Procedure : This function reads the per-phase timings of a finished request from libcurl and adds them to the session totals. Timings are cumulative from the start of the request, so each phase is the difference with the previous one; a reused connection shows up as zero DNS, TCP and TLS time. If timings were requested, a line with the breakdown of the request is printed to stderr.
+     */
+
+    RocknationSession *session = current_session();
+    curl_off_t namelookup = 0, connect = 0, appconnect = 0, starttransfer = 0, total = 0;
+    long connects = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+    // Phases are cumulative, turn them into durations
+    curl_off_t handshake_end = appconnect > connect ? appconnect : connect;
+    curl_off_t dns = namelookup;
+    curl_off_t tcp = connect > namelookup ? connect - namelookup : 0;
+    curl_off_t tls = appconnect > connect ? appconnect - connect : 0;
+    curl_off_t wait = starttransfer > handshake_end ? starttransfer - handshake_end : 0;
+    curl_off_t transfer = total > starttransfer ? total - starttransfer : 0;
+
+    session->requests++;
+    session->connects += connects;
+    session->dns_us += dns;
+    session->tcp_us += tcp;
+    session->tls_us += tls;
+    session->wait_us += wait;
+    session->transfer_us += transfer;
+    session->total_us += total;
+
+    if (session->timings)
+    {
+        fprintf(stderr, "[timing] %s\n\tdns %.1fms, tcp %.1fms, tls %.1fms, wait %.1fms, transfer %.1fms, total %.1fms (%s connection)\n",
+                url, dns / 1000.0, tcp / 1000.0, tls / 1000.0, wait / 1000.0, transfer / 1000.0, total / 1000.0,
+                connects > 0 ? "new" : "reused");
+    }
+}
+
+RN_API void session_record_page_size(CURL *curl, size_t decoded_size)
+{
+    /*
+     * Function  : void session_record_page_size(CURL *curl, size_t decoded_size)
+     * Input     : curl - pointer to the easy handle of a finished catalog request
+     *             decoded_size - size of the page after decompression
+     * Output    : None
+     * Procedure : This function adds the size of a catalog page as it travelled over the wire (compressed, as counted by libcurl before decoding) and its decompressed size to the session totals.
+     */
+
+    RocknationSession *session = current_session();
+    curl_off_t wire_size = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &wire_size);
+
+    session->page_wire_bytes += wire_size;
+    session->page_decoded_bytes += (curl_off_t)decoded_size;
+}
+
+RN_API void print_session_timings(void)
+{
+    /*
+     * Function  : void print_session_timings(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints the accumulated per-phase timings of every request made through the session to stderr, together with how many requests reused an existing connection and therefore skipped the TCP and TLS handshakes.
+     */
+
+    RocknationSession *session = current_session();
+
+    if (session->requests == 0)
+    {
+        return;
+    }
+
+    long reused = session->requests - session->connects;
+    if (reused < 0)
+    {
+        reused = 0;
+    }
+
+    fprintf(stderr, "[timing] %d requests, %ld new connections, %ld handshakes saved\n", session->requests, session->connects, reused);
+    fprintf(stderr, "\tdns %.1fms, tcp %.1fms, tls %.1fms, wait %.1fms, transfer %.1fms, total %.1fms\n",
+            session->dns_us / 1000.0, session->tcp_us / 1000.0, session->tls_us / 1000.0,
+            session->wait_us / 1000.0, session->transfer_us / 1000.0, session->total_us / 1000.0);
+
+    if (session->page_decoded_bytes > 0)
+    {
+        fprintf(stderr, "\tcatalog pages: %.1fKB on the wire, %.1fKB decompressed (%.0f%% saved)\n",
+                session->page_wire_bytes / 1024.0, session->page_decoded_bytes / 1024.0,
+                100.0 - 100.0 * session->page_wire_bytes / session->page_decoded_bytes);
+    }
+}
+
+RN_API void finish_page_stream(StreamExtractor *extractor, MemoryStruct *chunk, size_t start)
+{
+    /*
+     * Function  : void finish_page_stream(StreamExtractor *extractor, MemoryStruct *chunk, size_t start)
+     * Input     : extractor - pointer to the StreamExtractor fed with the page, or NULL
+     *             chunk - pointer to the MemoryStruct holding the page
+     *             start - position of the page in the buffer
+     * Output    : None
+     * Procedure : This function gives the extractor of a streamed request the complete page, so the matches it was holding back as partial are settled.
+     */
+
+    if (extractor != NULL)
+    {
+        extractor_feed(extractor, chunk->memory + start, chunk->size - start, 1);
+    }
+}
+
+static size_t WriteStreamCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    /* Function  : static size_t WriteStreamCallback(void *contents, size_t size, size_t nmemb, void *userp)
+     * Input     : contents - pointer to the received data
+     *             size - size of each data element
+     *             nmemb - number of data elements
+     *             userp - pointer to a PageStream structure
+     * Output    : Returns the total size of the received data (in bytes)
+     * Procedure : This function is the write callback of streamed catalog requests. It appends the received data to the page buffer like WriteMemoryCallback (the whole page is still needed for the cache) and then lets the extractor scan what arrived, so results are handed out before the page is complete.
+     */
+
+    PageStream *stream = (PageStream *)userp;
+
+    size_t written = WriteMemoryCallback(contents, size, nmemb, stream->chunk);
+    if (written > 0)
+    {
+        extractor_feed(stream->extractor, stream->chunk->memory + stream->start, stream->chunk->size - stream->start, 0);
+    }
+
+    return written;
+}
+
+RN_API int fetch_page(const char *url, const char *postdata, MemoryStruct *chunk)
+{
+    /*
+     * Function  : int fetch_page(const char *url, const char *postdata, MemoryStruct *chunk)
+     * Input     : url - pointer to the URL of the page to fetch
+     *             postdata - pointer to the body of a POST request, or NULL for a GET request
+     *             chunk - pointer to an initialized MemoryStruct that receives the page
+     * Output    : Returns 0 if the page was fetched with status 200 (or answered from the cache), -1 on failure or any other status
+     * Procedure : This function fetches a whole catalog page, see fetch_page_streaming.
+     */
+
+    return fetch_page_streaming(url, postdata, chunk, NULL);
+}
+
+RN_API int fetch_page_streaming(const char *url, const char *postdata, MemoryStruct *chunk, StreamExtractor *extractor)
+{
+    /*
+     * Function  : int fetch_page_streaming(const char *url, const char *postdata, MemoryStruct *chunk, StreamExtractor *extractor)
+     * Input     : url - pointer to the URL of the page to fetch
+     *             postdata - pointer to the body of a POST request, or NULL for a GET request
+     *             chunk - pointer to an initialized MemoryStruct that receives the page
+     *             extractor - pointer to an initialized StreamExtractor fed with the page as it arrives, or NULL
+     * Output    : Returns 0 if the page was fetched with status 200 (or answered from the cache), -1 on failure or any other status
+     * Procedure : This function fetches a catalog page from rocknation.su, going through the on-disk response cache first (see page_request_begin and page_request_finish). Requests go through the reusable easy handle of the session, which is reset between requests but keeps its connection pool, so consecutive calls reuse the same keep-alive connection. If an extractor is given it is fed every time a piece of the body arrives, and once more when the page is complete; a page answered from the cache, or revalidated against a cached copy, is fed in one go.
+     */
+
+    RocknationSession *s = get_session();
+    PageRequest request;
+
+    int status = page_request_begin(&request, s->curl, url, postdata, chunk, extractor);
+    if (status != 0)
+    {
+        return status == 1 ? 0 : -1;
+    }
+
+    CURLcode res = curl_easy_perform(s->curl);
+    if (res != CURLE_OK)
+    {
+        fprintf(stderr, "curl_easy_perform failed: %s\n", curl_easy_strerror(res));
+    }
+
+    long response_code = page_request_finish(&request, s->curl, res);
+    if (response_code != 200)
+    {
+        // An error page must not pass for a real one, e.g. for the empty page past the end of a discography
+        if (response_code > 0)
+        {
+            fprintf(stderr, "%s answered with status %ld\n", url, response_code);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+RN_API int page_request_begin(PageRequest *request, CURL *curl, const char *url, const char *postdata, MemoryStruct *chunk, StreamExtractor *extractor)
+{
+    /*
+     * Function  : int page_request_begin(PageRequest *request, CURL *curl, const char *url, const char *postdata, MemoryStruct *chunk, StreamExtractor *extractor)
+     * Input     : request - pointer to the PageRequest to fill, which must stay in place until page_request_finish
+     *             curl - pointer to the easy handle that will fetch the page, or NULL
+     *             url - pointer to the URL of the page, which must stay valid until page_request_finish
+     *             postdata - pointer to the body of a POST request, or NULL for a GET request
+     *             chunk - pointer to an initialized MemoryStruct that receives the page
+     *             extractor - pointer to an initialized StreamExtractor fed with the page as it arrives, or NULL
+     * Output    : Returns 1 if the page was answered from the cache, 0 if curl is ready to fetch it, -1 on failure
+     * Procedure : This function is the first half of a catalog request, shared by fetch_page_streaming and fetch_page_async. A cached page younger than the cache TTL is used as is; in offline mode only the cache is used. Otherwise the easy handle is reset and set up to fetch the page through the connection pool of the session, revalidating an older cached copy with If-None-Match/If-Modified-Since. Requests advertise every content encoding libcurl supports (gzip, deflate, brotli...) and the page is decompressed on the fly as it arrives. The extractor is fed as the page arrives only when there is no cached copy: otherwise a transfer failing halfway would have handed out matches of a partial page before the cached copy replaces it, so the page is scanned in page_request_finish. Once the transfer is over, page_request_finish must be called with the same request.
+     */
+
+    RocknationCache *cache = get_cache();
+
+    request->url = url;
+    request->postdata = postdata;
+    request->headers = NULL;
+    request->validators.etag[0] = '\0';
+    request->validators.last_modified[0] = '\0';
+    request->stream.chunk = chunk;
+    request->stream.start = chunk->size;
+    request->stream.extractor = extractor;
+    request->cached = cache->enabled && cache_load(url, postdata, &request->entry) == 0;
+
+    if (request->cached && (cache->offline || time(NULL) - request->entry.stored < cache->ttl))
+    {
+        // Fresh enough, no request at all
+        WriteMemoryCallback(request->entry.body.memory, 1, request->entry.body.size, chunk);
+        free(request->entry.body.memory);
+        cache->hits++;
+        finish_page_stream(extractor, chunk, request->stream.start);
+        return 1;
+    }
+
+    if (cache->offline)
+    {
+        fprintf(stderr, "Not in the cache (offline): %s\n", url);
+        return -1;
+    }
+
+    if (curl == NULL)
+    {
+        if (request->cached)
+        {
+            free(request->entry.body.memory);
+        }
+        return -1;
+    }
+
+    if (strcmp(base_url(), DEFAULT_BASE_URL) == 0)
+    {
+        request->headers = curl_slist_append(request->headers, "Host: rocknation.su");
+    }
+
+    if (request->cached)
+    {
+        char header[MAX_VALIDATOR_LENGTH + 32];
+
+        if (request->entry.validators.etag[0] != '\0')
+        {
+            snprintf(header, sizeof(header), "If-None-Match: %s", request->entry.validators.etag);
+            request->headers = curl_slist_append(request->headers, header);
+        }
+        if (request->entry.validators.last_modified[0] != '\0')
+        {
+            snprintf(header, sizeof(header), "If-Modified-Since: %s", request->entry.validators.last_modified);
+            request->headers = curl_slist_append(request->headers, header);
+        }
+    }
+
+    curl_easy_reset(curl);
+    session_attach(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+    if (extractor != NULL && !request->cached)
+    {
+        // With a cached copy to fall back on, the page is only scanned once the transfer is known good
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteStreamCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&request->stream);
+    }
+    else
+    {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
+    }
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, CacheHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&request->validators);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""); // Every encoding libcurl can decode
+
+    if (postdata != NULL)
+    {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postdata);
+    }
+
+    return 0;
+}
+
+RN_API long page_request_finish(PageRequest *request, CURL *curl, CURLcode res)
+{
+    /*
+     * Function  : long page_request_finish(PageRequest *request, CURL *curl, CURLcode res)
+     * Input     : request - pointer to the PageRequest set up by page_request_begin
+     *             curl - pointer to the easy handle that fetched the page
+     *             res - result of the transfer
+     * Output    : Returns the HTTP status of the page (200 when it comes from the cache), or -1 on failure
+     * Procedure : This function is the second half of a catalog request. It records the timings and size of the transfer, and settles the cache: when the server answers "304 Not Modified" the cached copy is used and its TTL restarted, a new 200 page is stored, and when the transfer failed halfway or the server answered with an error (5xx) the stale cached copy is used instead, if there is one. The extractor of the request, if any, is then given the complete page: it has not seen any of it when there was a cached copy (see page_request_begin), and otherwise it settles the matches it was holding back.
+     */
+
+    RocknationCache *cache = get_cache();
+    MemoryStruct *chunk = request->stream.chunk;
+    size_t start = request->stream.start;
+    const char *url = request->url;
+    const char *postdata = request->postdata;
+    CacheEntry *entry = &request->entry;
+    CacheValidators *validators = &request->validators;
+
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    session_record_timings(curl, url);
+    session_record_page_size(curl, chunk->size - start);
+    curl_slist_free_all(request->headers);
+    request->headers = NULL;
+
+    if (res != CURLE_OK || (request->cached && response_code >= 500))
+    {
+        if (!request->cached)
+        {
+            return -1;
+        }
+
+        // Better a stale page than none, or than the error page of a server in trouble
+        fprintf(stderr, "Using the cached copy of %s\n", url);
+        chunk->size = start;
+        WriteMemoryCallback(entry->body.memory, 1, entry->body.size, chunk);
+        free(entry->body.memory);
+        cache->hits++;
+        finish_page_stream(request->stream.extractor, chunk, start);
+        return 200;
+    }
+
+    if (request->cached && response_code == 304)
+    {
+        // Unchanged: use the stored page and restart its TTL
+        if (validators->etag[0] == '\0')
+        {
+            strcpy(validators->etag, entry->validators.etag);
+        }
+        if (validators->last_modified[0] == '\0')
+        {
+            strcpy(validators->last_modified, entry->validators.last_modified);
+        }
+
+        chunk->size = start;
+        WriteMemoryCallback(entry->body.memory, 1, entry->body.size, chunk);
+        cache_store(url, postdata, entry->body.memory, entry->body.size, validators);
+        cache->revalidated++;
+        response_code = 200;
+    }
+    else
+    {
+        cache->misses++;
+
+        if (cache->enabled && response_code == 200)
+        {
+            cache_store(url, postdata, chunk->memory + start, chunk->size - start, validators);
+        }
+    }
+
+    if (request->cached)
+    {
+        free(entry->body.memory);
+    }
+
+    finish_page_stream(request->stream.extractor, chunk, start);
+    return response_code;
+}
+
+RN_API void page_request_cancel(PageRequest *request)
+{
+    /*
+     * Function  : void page_request_cancel(PageRequest *request)
+     * Input     : request - pointer to a PageRequest set up by page_request_begin that won't be finished
+     * Output    : None
+     * Procedure : This function releases what page_request_begin kept for a request whose transfer is abandoned. Neither the cache nor the page buffer is touched.
+     */
+
+    curl_slist_free_all(request->headers);
+    request->headers = NULL;
+
+    if (request->cached)
+    {
+        free(request->entry.body.memory);
+        request->cached = 0;
+    }
+}
@@ -0,0 +1,420 @@
+// rocknation_snapshot.h
+#pragma once
+#include "rocknation_types.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SNAPSHOT_MAGIC "RNSNAP\0"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_FILE "catalog.bin"
+#define SNAPSHOT_NONE UINT32_MAX // String offset of a field that isn't known
+
+/*
+ * A snapshot is the catalog store (see rocknation_store.h) in a form that is used straight from a
+ * memory mapping. After the header come fixed-width record arrays and a string table, each section
+ * aligned to 8 bytes. Strings are referred to by their offset in the string table and are
+ * null-terminated. Bands, albums with songs and searches are sorted, so they are found with a
+ * binary search; the albums of a band and the songs of an album are contiguous.
+ */
+typedef struct
+{
+    char magic[8];            // SNAPSHOT_MAGIC
+    uint32_t version;         // SNAPSHOT_VERSION
+    uint32_t byte_order;      // SNAPSHOT_BYTE_ORDER as written by the machine that built the snapshot
+    uint64_t log_size;        // Bytes of the store file the snapshot was built from
+    uint32_t band_count;      // Sorted by id
+    uint32_t album_count;     // Discography entries
+    uint32_t song_album_count; // Albums whose songs are stored, sorted by id
+    uint32_t song_count;
+    uint32_t search_count;    // Sorted by text
+    uint32_t search_id_count;
+    uint64_t bands;           // Offsets of the sections from the start of the file
+    uint64_t albums;
+    uint64_t song_albums;
+    uint64_t songs;
+    uint64_t searches;
+    uint64_t search_ids;
+    uint64_t strings;
+    uint64_t string_size;
+} SnapshotHeader;
+
+typedef struct
+{
+    uint32_t id;          // N of /mp3/band-N
+    uint32_t name;        // String offsets
+    uint32_t genre;
+    uint32_t first_album; // Index of its first album in the album section
+    int32_t album_count;  // -1 if the discography isn't stored
+} SnapshotBand;
+
+typedef struct
+{
+    uint32_t url;
+    uint32_t year;
+    uint32_t name;
+} SnapshotAlbum;
+
+typedef struct
+{
+    uint32_t id; // N of /mp3/album-N
+    uint32_t first_song;
+    uint32_t song_count;
+} SnapshotSongAlbum;
+
+typedef struct
+{
+    uint32_t url;
+    uint32_t artist;
+    uint32_t year;
+    uint32_t album;
+    uint32_t name;
+} SnapshotSong;
+
+typedef struct
+{
+    uint32_t text;     // Search text, in lowercase
+    uint32_t first_id; // Index of its first band id in the search id section
+    uint32_t count;
+} SnapshotSearch;
+
+typedef struct
+{
+    const char *data; // Mapped file, NULL if there is no usable snapshot
+    size_t size;
+    int mapped;       // data is a memory mapping rather than a heap copy
+    const SnapshotHeader *header;
+    const SnapshotBand *bands;
+    const SnapshotAlbum *albums;
+    const SnapshotSongAlbum *song_albums;
+    const SnapshotSong *songs;
+    const SnapshotSearch *searches;
+    const uint32_t *search_ids;
+    const char *strings;
+} CatalogSnapshot;
+
+RN_API int snapshot_open(const char *path, CatalogSnapshot *snapshot);
+RN_API void snapshot_close(CatalogSnapshot *snapshot);
+static int snapshot_section(const CatalogSnapshot *snapshot, uint64_t offset, uint64_t count, size_t record_size);
+RN_API char *snapshot_string(const CatalogSnapshot *snapshot, uint32_t offset);
+RN_API const SnapshotBand *snapshot_band(const CatalogSnapshot *snapshot, int id);
+RN_API const SnapshotSongAlbum *snapshot_song_album(const CatalogSnapshot *snapshot, int id);
+RN_API const SnapshotSearch *snapshot_search(const CatalogSnapshot *snapshot, const char *text);
+RN_API const SnapshotAlbum *snapshot_albums(const CatalogSnapshot *snapshot, const SnapshotBand *band);
+RN_API const SnapshotSong *snapshot_songs(const CatalogSnapshot *snapshot, const SnapshotSongAlbum *album);
+RN_API const uint32_t *snapshot_search_ids(const CatalogSnapshot *snapshot, const SnapshotSearch *search);
+
+static int snapshot_section(const CatalogSnapshot *snapshot, uint64_t offset, uint64_t count, size_t record_size)
+{
+    /* Function  : static int snapshot_section(const CatalogSnapshot *snapshot, uint64_t offset, uint64_t count, size_t record_size)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             offset - offset of the section in the file
+     *             count - number of records in the section
+     *             record_size - size of a record
+     * Output    : Returns 1 if the section is aligned and lies inside the file, 0 otherwise
+     * Procedure : This function checks a section of the header before it is used, so a damaged snapshot is rejected instead of read out of bounds.
+     */
+
+    return offset % 8 == 0 && offset <= snapshot->size && count <= (snapshot->size - offset) / record_size;
+}
+
+RN_API int snapshot_open(const char *path, CatalogSnapshot *snapshot)
+{
+    /*
+     * Function  : int snapshot_open(const char *path, CatalogSnapshot *snapshot)
+     * Input     : path - pointer to the path of the snapshot file
+     *             snapshot - pointer to the CatalogSnapshot structure to fill
+     * Output    : Returns 0 if the snapshot can be used, -1 otherwise
+     * Procedure : This function maps a snapshot file read-only and checks its header: magic, version, byte order, and that every section lies inside the file. Nothing is parsed or copied; records are read in place by the lookup functions. Where mmap isn't available the file is read into memory instead.
+     */
+
+    memset(snapshot, 0, sizeof(*snapshot));
+
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = size > 0 ? rn_malloc((size_t)size) : NULL;
+    if (data == NULL || fread(data, 1, (size_t)size, file) != (size_t)size)
+    {
+        free(data);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    snapshot->data = data;
+    snapshot->size = (size_t)size;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    snapshot->data = data;
+    snapshot->size = (size_t)info.st_size;
+    snapshot->mapped = 1;
+#endif
+
+    const SnapshotHeader *header = (const SnapshotHeader *)snapshot->data;
+    snapshot->header = header;
+
+    if (snapshot->size < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        !snapshot_section(snapshot, header->bands, header->band_count, sizeof(SnapshotBand)) ||
+        !snapshot_section(snapshot, header->albums, header->album_count, sizeof(SnapshotAlbum)) ||
+        !snapshot_section(snapshot, header->song_albums, header->song_album_count, sizeof(SnapshotSongAlbum)) ||
+        !snapshot_section(snapshot, header->songs, header->song_count, sizeof(SnapshotSong)) ||
+        !snapshot_section(snapshot, header->searches, header->search_count, sizeof(SnapshotSearch)) ||
+        !snapshot_section(snapshot, header->search_ids, header->search_id_count, sizeof(uint32_t)) ||
+        !snapshot_section(snapshot, header->strings, header->string_size, 1) ||
+        header->string_size == 0 || snapshot->data[header->strings + header->string_size - 1] != '\0')
+    {
+        snapshot_close(snapshot);
+        return -1;
+    }
+
+    snapshot->bands = (const SnapshotBand *)(snapshot->data + header->bands);
+    snapshot->albums = (const SnapshotAlbum *)(snapshot->data + header->albums);
+    snapshot->song_albums = (const SnapshotSongAlbum *)(snapshot->data + header->song_albums);
+    snapshot->songs = (const SnapshotSong *)(snapshot->data + header->songs);
+    snapshot->searches = (const SnapshotSearch *)(snapshot->data + header->searches);
+    snapshot->search_ids = (const uint32_t *)(snapshot->data + header->search_ids);
+    snapshot->strings = snapshot->data + header->strings;
+
+    return 0;
+}
+
+RN_API void snapshot_close(CatalogSnapshot *snapshot)
+{
+    /*
+     * Function  : void snapshot_close(CatalogSnapshot *snapshot)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     * Output    : None
+     * Procedure : This function unmaps (or frees) a snapshot. Strings handed out by it are no longer valid afterwards.
+     */
+
+    if (snapshot->data != NULL)
+    {
+#ifdef _WIN32
+        free((void *)snapshot->data);
+#else
+        if (snapshot->mapped)
+        {
+            munmap((void *)snapshot->data, snapshot->size);
+        }
+        else
+        {
+            free((void *)snapshot->data);
+        }
+#endif
+    }
+
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+RN_API char *snapshot_string(const CatalogSnapshot *snapshot, uint32_t offset)
+{
+    /*
+     * Function  : char *snapshot_string(const CatalogSnapshot *snapshot, uint32_t offset)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             offset - offset of the string in the string table
+     * Output    : Returns the string, or "" for an offset outside the table
+     * Procedure : This function resolves a string of the snapshot in place. The memory is read-only; the pointer is not const only so it fits the fields of BandInfo, AlbumInfo and SongInfo.
+     */
+
+    if (offset >= snapshot->header->string_size)
+    {
+        return (char *)"";
+    }
+
+    return (char *)snapshot->strings + offset;
+}
+
+RN_API const SnapshotBand *snapshot_band(const CatalogSnapshot *snapshot, int id)
+{
+    /*
+     * Function  : const SnapshotBand *snapshot_band(const CatalogSnapshot *snapshot, int id)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             id - id of the band
+     * Output    : Returns the band, or NULL if it isn't in the snapshot
+     * Procedure : This function finds a band by binary search over the sorted band records.
+     */
+
+    if (snapshot->data == NULL || id < 0)
+    {
+        return NULL;
+    }
+
+    uint32_t low = 0;
+    uint32_t high = snapshot->header->band_count;
+
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (snapshot->bands[middle].id < (uint32_t)id)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low < snapshot->header->band_count && snapshot->bands[low].id == (uint32_t)id ? &snapshot->bands[low] : NULL;
+}
+
+RN_API const SnapshotSongAlbum *snapshot_song_album(const CatalogSnapshot *snapshot, int id)
+{
+    /*
+     * Function  : const SnapshotSongAlbum *snapshot_song_album(const CatalogSnapshot *snapshot, int id)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             id - id of the album
+     * Output    : Returns the album, or NULL if its songs aren't in the snapshot
+     * Procedure : This function finds the songs of an album by binary search, see snapshot_band.
+     */
+
+    if (snapshot->data == NULL || id < 0)
+    {
+        return NULL;
+    }
+
+    uint32_t low = 0;
+    uint32_t high = snapshot->header->song_album_count;
+
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (snapshot->song_albums[middle].id < (uint32_t)id)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low < snapshot->header->song_album_count && snapshot->song_albums[low].id == (uint32_t)id ? &snapshot->song_albums[low] : NULL;
+}
+
+RN_API const SnapshotSearch *snapshot_search(const CatalogSnapshot *snapshot, const char *text)
+{
+    /*
+     * Function  : const SnapshotSearch *snapshot_search(const CatalogSnapshot *snapshot, const char *text)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             text - pointer to the search text, in lowercase
+     * Output    : Returns the search, or NULL if it isn't in the snapshot
+     * Procedure : This function finds the results of a search by binary search over the searches, which are sorted by text.
+     */
+
+    if (snapshot->data == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t low = 0;
+    uint32_t high = snapshot->header->search_count;
+
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (strcmp(snapshot_string(snapshot, snapshot->searches[middle].text), text) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if (low < snapshot->header->search_count && strcmp(snapshot_string(snapshot, snapshot->searches[low].text), text) == 0)
+    {
+        return &snapshot->searches[low];
+    }
+
+    return NULL;
+}
+
+RN_API const SnapshotAlbum *snapshot_albums(const CatalogSnapshot *snapshot, const SnapshotBand *band)
+{
+    /*
+     * Function  : const SnapshotAlbum *snapshot_albums(const CatalogSnapshot *snapshot, const SnapshotBand *band)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             band - pointer to a band of the snapshot
+     * Output    : Returns the album_count albums of the band, or NULL if its discography isn't stored or lies outside the album section
+     * Procedure : This function resolves the discography of a band in place.
+     */
+
+    if (band->album_count < 0 || band->first_album > snapshot->header->album_count ||
+        (uint32_t)band->album_count > snapshot->header->album_count - band->first_album)
+    {
+        return NULL;
+    }
+
+    return snapshot->albums + band->first_album;
+}
+
+RN_API const SnapshotSong *snapshot_songs(const CatalogSnapshot *snapshot, const SnapshotSongAlbum *album)
+{
+    /*
+     * Function  : const SnapshotSong *snapshot_songs(const CatalogSnapshot *snapshot, const SnapshotSongAlbum *album)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             album - pointer to an album of the snapshot
+     * Output    : Returns the song_count songs of the album, or NULL if they lie outside the song section
+     * Procedure : This function resolves the songs of an album in place.
+     */
+
+    if (album->first_song > snapshot->header->song_count || album->song_count > snapshot->header->song_count - album->first_song)
+    {
+        return NULL;
+    }
+
+    return snapshot->songs + album->first_song;
+}
+
+RN_API const uint32_t *snapshot_search_ids(const CatalogSnapshot *snapshot, const SnapshotSearch *search)
+{
+    /*
+     * Function  : const uint32_t *snapshot_search_ids(const CatalogSnapshot *snapshot, const SnapshotSearch *search)
+     * Input     : snapshot - pointer to the CatalogSnapshot structure
+     *             search - pointer to a search of the snapshot
+     * Output    : Returns the count band ids found by the search, or NULL if they lie outside the search id section
+     * Procedure : This function resolves the results of a search in place.
+     */
+
+    if (search->first_id > snapshot->header->search_id_count || search->count > snapshot->header->search_id_count - search->first_id)
+    {
+        return NULL;
+    }
+
+    return snapshot->search_ids + search->first_id;
+}
@@ -0,0 +1,1556 @@
+// rocknation_store.h
+#pragma once
+#include "rocknation_types.h"
+#include "rocknation_utils.h"
+#include "rocknation_cache.h"
+#include "rocknation_catalog.h"
+#include "rocknation_snapshot.h"
+#include "rocknation_fuzzy.h"
+
+#define STORE_MAGIC "RNSTORE 1"
+#define STORE_FILE "catalog.tsv"
+#define STORE_BAND_PATH "/mp3/band-"
+#define SNAPSHOT_REBUILD_SIZE (256 * 1024) // Bytes of the store file past the snapshot that trigger a rebuild
+
+typedef struct
+{
+    int id;            // N of /mp3/band-N
+    BandInfo band;
+    AlbumInfo *albums; // Discography, in page order
+    int album_count;   // -1 until the discography has been stored
+} StoredBand;
+
+typedef struct
+{
+    int id; // N of /mp3/album-N
+    SongInfo *songs;
+    int song_count;
+} StoredAlbum;
+
+typedef struct
+{
+    char *text; // Search text, in lowercase
+    int *band_ids;
+    int count;
+} StoredSearch;
+
+// Open-addressing hash table from an id to its position in an array, plus one (0 for an empty slot)
+typedef struct
+{
+    int *slots;
+    size_t slot_count; // Always a power of two
+    int used;
+} StoreIndex;
+
+typedef struct
+{
+    int refresh; // --refresh: don't answer from the store, go to the network (results are still stored)
+    int loaded;  // The store file has been read
+    char path[MAX_PATH_LENGTH + 32];
+    char snapshot_path[MAX_PATH_LENGTH + 32];
+    CatalogSnapshot snapshot; // Records up to snapshot.header->log_size, consulted when a record isn't in memory
+    long log_size;            // Bytes of the store file read so far
+    long pending;             // Bytes of the store file not covered by the snapshot, read or appended
+    Arena arena;  // Records loaded or added during this run
+    char *file;   // Contents of the store file past the snapshot, which loaded records point into
+    StoredBand *bands;
+    int band_count;
+    int band_capacity;
+    StoreIndex band_index;
+    StoredAlbum *albums;
+    int album_count;
+    int album_capacity;
+    StoreIndex album_index;
+    StoredSearch *searches;
+    int search_count;
+    int search_capacity;
+    BandIndex names;  // Fuzzy index of every known band name, built on the first fuzzy search
+    int names_ready;
+    int hits;   // Lookups answered from the store
+    int misses; // Lookups that had to go to the network
+} RocknationStore;
+
+// Store of the threads that haven't bound a client (see rocknation_client.h)
+static RocknationStore rocknation_store = {0};
+static RN_THREAD_LOCAL RocknationStore *bound_store = NULL;
+
+static int store_has_prefix(const char *text, const char *prefix);
+RN_API int store_url_id(const char *url, const char *kind);
+static int store_index_find(const StoreIndex *index, const int *ids, size_t stride, int id);
+static int store_index_insert(StoreIndex *index, const void *items, size_t stride, int count, int id, int position);
+static StoredBand *store_band(int id, int create);
+static StoredAlbum *store_album(int id, int create);
+static StoredSearch *store_search_entry(const char *text, int create);
+static char *store_field(char **cursor);
+static long store_load(long from);
+static int store_compare_bands(const void *a, const void *b);
+static int store_compare_albums(const void *a, const void *b);
+static int store_compare_searches(const void *a, const void *b);
+static uint32_t store_intern(StringPool *strings, const char *text, int unique, int *failed);
+static int store_write_section(FILE *file, const void *data, size_t size);
+static int store_write_snapshot(long log_size);
+static void store_reset(void);
+static RocknationStore *current_store(void);
+RN_API void store_close(void);
+static void close_default_store(void);
+RN_API RocknationStore *get_store(void);
+static int store_append(const char *text, size_t length);
+static char *store_copy(const char *text);
+static void store_lowercase(const char *text, char *dest, size_t dest_size);
+static const BandInfo *store_band_info(StoredBand *band);
+static int store_lookup_band(int id, BandInfo *info);
+RN_API int store_search(const char *search_text, BandInfoList *band_list, BandCallback on_band, void *userdata);
+RN_API int store_albums(const char *band_url, AlbumInfoList *album_list);
+RN_API int store_songs(const char *album_url, SongInfoList *song_list, SongCallback on_song, void *userdata);
+RN_API void store_put_search(const char *search_text, const BandInfoList *band_list);
+RN_API void store_put_albums(const char *band_url, const AlbumInfoList *album_list);
+RN_API void store_put_songs(const char *album_url, const SongInfoList *song_list);
+RN_API void store_put_song_page(const char *album_url, const SongPage *song_page);
+RN_API int store_fuzzy_search(const char *text, int k, BandInfoList *band_list);
+RN_API void print_store_stats(void);
+
+static int store_has_prefix(const char *text, const char *prefix)
+{
+    /* Function  : static int store_has_prefix(const char *text, const char *prefix)
+     * Input     : text - pointer to the text to check
+     *             prefix - pointer to a lowercase prefix
+     * Output    : Returns 1 if text starts with prefix in any case, 0 otherwise
+     * Procedure : This function compares the start of a text with a prefix, ignoring the case of ASCII letters.
+     */
+
+    while (*prefix != '\0' && tolower((unsigned char)*text) == *prefix)
+    {
+        text++;
+        prefix++;
+    }
+
+    return *prefix == '\0';
+}
+
+RN_API int store_url_id(const char *url, const char *kind)
+{
+    /*
+     * Function  : int store_url_id(const char *url, const char *kind)
+     * Input     : url - pointer to the URL of a band or album page
+     *             kind - "band-" or "album-"
+     * Output    : Returns N for a URL containing /mp3/<kind>N, -1 otherwise
+     * Procedure : This function extracts the id bands and albums are keyed by in the store. The path is matched in any case, like the links the pages are parsed from ("/MP3/BAND-12"), and page numbers after the id ("/mp3/band-12/2") are ignored.
+     */
+
+    const char *found = strchr(url, '/');
+
+    while (found != NULL && !store_has_prefix(found, "/mp3/"))
+    {
+        found = strchr(found + 1, '/');
+    }
+
+    if (found == NULL || !store_has_prefix(found + 5, kind))
+    {
+        return -1;
+    }
+
+    const char *digits = found + 5 + strlen(kind);
+    if (!isdigit((unsigned char)*digits))
+    {
+        return -1;
+    }
+
+    long id = strtol(digits, NULL, 10);
+    return id <= INT_MAX ? (int)id : -1;
+}
+
+static int store_index_find(const StoreIndex *index, const int *ids, size_t stride, int id)
+{
+    /* Function  : static int store_index_find(const StoreIndex *index, const int *ids, size_t stride, int id)
+     * Input     : index - pointer to the StoreIndex structure
+     *             ids - pointer to the id of the first item of the indexed array
+     *             stride - size of an item of the array, in ints
+     *             id - id to look up
+     * Output    : Returns the position of the item with that id, or -1
+     * Procedure : This function looks an id up in the hash table of an array of stored records.
+     */
+
+    if (index->slot_count == 0)
+    {
+        return -1;
+    }
+
+    size_t slot = ((unsigned)id * 2654435761u) & (index->slot_count - 1);
+
+    while (index->slots[slot] != 0)
+    {
+        int position = index->slots[slot] - 1;
+        if (ids[position * stride] == id)
+        {
+            return position;
+        }
+        slot = (slot + 1) & (index->slot_count - 1);
+    }
+
+    return -1;
+}
+
+static int store_index_insert(StoreIndex *index, const void *items, size_t stride, int count, int id, int position)
+{
+    /* Function  : static int store_index_insert(StoreIndex *index, const void *items, size_t stride, int count, int id, int position)
+     * Input     : index - pointer to the StoreIndex structure
+     *             items - pointer to the indexed array, whose items start with their id
+     *             stride - size of an item of the array, in ints
+     *             count - number of items in the array, including the new one
+     *             id - id of the new item
+     *             position - position of the new item
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function adds an item to the hash table, rebuilding the table twice as big when it would be more than half full.
+     */
+
+    const int *ids = (const int *)items;
+
+    if ((size_t)(index->used + 1) * 2 > index->slot_count)
+    {
+        size_t slot_count = index->slot_count > 0 ? index->slot_count * 2 : 256;
+        int *slots = rn_calloc(slot_count, sizeof(int));
+        if (slots == NULL)
+        {
+            return -1;
+        }
+
+        free(index->slots);
+        index->slots = slots;
+        index->slot_count = slot_count;
+        index->used = 0;
+
+        // Every item but the new one is already in the array
+        for (int i = 0; i < count; i++)
+        {
+            if (i == position)
+            {
+                continue;
+            }
+            size_t slot = ((unsigned)ids[i * stride] * 2654435761u) & (slot_count - 1);
+            while (slots[slot] != 0)
+            {
+                slot = (slot + 1) & (slot_count - 1);
+            }
+            slots[slot] = i + 1;
+            index->used++;
+        }
+    }
+
+    size_t slot = ((unsigned)id * 2654435761u) & (index->slot_count - 1);
+    while (index->slots[slot] != 0)
+    {
+        slot = (slot + 1) & (index->slot_count - 1);
+    }
+    index->slots[slot] = position + 1;
+    index->used++;
+
+    return 0;
+}
+
+static StoredBand *store_band(int id, int create)
+{
+    /* Function  : static StoredBand *store_band(int id, int create)
+     * Input     : id - id of the band
+     *             create - add the band if it isn't in the store yet
+     * Output    : Returns a pointer to the stored band, or NULL
+     * Procedure : This function finds a band of the store by id. A band created here has no name, genre or discography yet.
+     */
+
+    RocknationStore *store = current_store();
+    size_t stride = sizeof(StoredBand) / sizeof(int);
+    int position = store_index_find(&store->band_index, (const int *)store->bands, stride, id);
+
+    if (position >= 0 || !create)
+    {
+        return position >= 0 ? &store->bands[position] : NULL;
+    }
+
+    StoredBand *bands = arena_reserve(&store->arena, store->bands, &store->band_capacity, store->band_count, sizeof(StoredBand));
+    if (bands == NULL)
+    {
+        return NULL;
+    }
+    store->bands = bands;
+
+    position = store->band_count++;
+    StoredBand *band = &bands[position];
+    memset(band, 0, sizeof(*band));
+    band->id = id;
+    band->album_count = -1;
+
+    if (store_index_insert(&store->band_index, bands, stride, store->band_count, id, position) != 0)
+    {
+        store->band_count--;
+        return NULL;
+    }
+
+    return band;
+}
+
+static StoredAlbum *store_album(int id, int create)
+{
+    /* Function  : static StoredAlbum *store_album(int id, int create)
+     * Input     : id - id of the album
+     *             create - add the album if it isn't in the store yet
+     * Output    : Returns a pointer to the stored album, or NULL
+     * Procedure : This function finds an album of the store by id, see store_band.
+     */
+
+    RocknationStore *store = current_store();
+    size_t stride = sizeof(StoredAlbum) / sizeof(int);
+    int position = store_index_find(&store->album_index, (const int *)store->albums, stride, id);
+
+    if (position >= 0 || !create)
+    {
+        return position >= 0 ? &store->albums[position] : NULL;
+    }
+
+    StoredAlbum *albums = arena_reserve(&store->arena, store->albums, &store->album_capacity, store->album_count, sizeof(StoredAlbum));
+    if (albums == NULL)
+    {
+        return NULL;
+    }
+    store->albums = albums;
+
+    position = store->album_count++;
+    StoredAlbum *album = &albums[position];
+    memset(album, 0, sizeof(*album));
+    album->id = id;
+
+    if (store_index_insert(&store->album_index, albums, stride, store->album_count, id, position) != 0)
+    {
+        store->album_count--;
+        return NULL;
+    }
+
+    return album;
+}
+
+static StoredSearch *store_search_entry(const char *text, int create)
+{
+    /* Function  : static StoredSearch *store_search_entry(const char *text, int create)
+     * Input     : text - pointer to the search text, in lowercase
+     *             create - add the search if it isn't in the store yet
+     * Output    : Returns a pointer to the stored search, or NULL
+     * Procedure : This function finds the stored results of a search. There are few distinct searches, so they are simply scanned in order.
+     */
+
+    RocknationStore *store = current_store();
+
+    for (int i = 0; i < store->search_count; i++)
+    {
+        if (strcmp(store->searches[i].text, text) == 0)
+        {
+            return &store->searches[i];
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    StoredSearch *searches = arena_reserve(&store->arena, store->searches, &store->search_capacity, store->search_count, sizeof(StoredSearch));
+    char *copy = arena_strndup(&store->arena, text, strlen(text));
+    if (searches == NULL || copy == NULL)
+    {
+        return NULL;
+    }
+    store->searches = searches;
+
+    StoredSearch *search = &searches[store->search_count++];
+    search->text = copy;
+    search->band_ids = NULL;
+    search->count = 0;
+
+    return search;
+}
+
+static char *store_field(char **cursor)
+{
+    /* Function  : static char *store_field(char **cursor)
+     * Input     : cursor - pointer to the position in the current line, advanced past the field
+     * Output    : Returns the next tab-separated field of the line, null-terminated in place ("" past the end of the line)
+     * Procedure : This function splits a line of the store file into fields without copying them.
+     */
+
+    char *field = *cursor;
+    char *end = field + strcspn(field, "\t");
+
+    if (*end == '\t')
+    {
+        *end = '\0';
+        *cursor = end + 1;
+    }
+    else
+    {
+        *cursor = end;
+    }
+
+    return field;
+}
+
+static long store_load(long from)
+{
+    /* Function  : static long store_load(long from)
+     * Input     : from - offset in the store file to read from, 0 for the whole file or the size covered by the snapshot
+     * Output    : Returns the offset just past the last complete line read, or -1 if the file can't be read from there
+     * Procedure : This function reads the store file into memory. Records point straight into the contents of the file, which are kept for the rest of the run. The file is an append log of tab-separated lines, so a later record replaces an earlier one:
+     *               B <band id> <name> <genre>            a band
+     *               S <search text> <band ids...>         the results of a search, ids separated by spaces
+     *               A <band id> <count>                   the discography of a band, followed by count lines
+     *               a <album url> <year> <name>             one album
+     *               T <album id> <count>                  the songs of an album, followed by count lines
+     *               t <url> <artist> <year> <album> <name>  one song
+     *             A list whose lines were not all written (an interrupted run) is ignored. When a snapshot is in use only the lines appended after it are read; the byte before from must then end a line, or the file isn't the one the snapshot was built from.
+     */
+
+    RocknationStore *store = current_store();
+    FILE *file = fopen(store->path, "rb");
+
+    if (file == NULL)
+    {
+        return from == 0 ? 0 : -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    long start = from > 0 ? from - 1 : 0;
+
+    if (size < from || fseek(file, start, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    store->file = rn_malloc((size_t)(size - start) + 1);
+    if (store->file == NULL || fread(store->file, 1, (size_t)(size - start), file) != (size_t)(size - start))
+    {
+        free(store->file);
+        store->file = NULL;
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    store->file[size - start] = '\0';
+
+    char *line = store->file;
+    char *next = NULL;
+
+    if (from > 0)
+    {
+        if (*line != '\n')
+        {
+            return -1;
+        }
+        line++;
+    }
+    else if (size == 0)
+    {
+        return 0;
+    }
+    else if (strncmp(line, STORE_MAGIC "\n", strlen(STORE_MAGIC) + 1) == 0)
+    {
+        line += strlen(STORE_MAGIC) + 1;
+    }
+    else
+    {
+        return -1; // Not a store file, or a newer format
+    }
+
+    for (; *line != '\0'; line = next)
+    {
+        char *end = strchr(line, '\n');
+        if (end == NULL)
+        {
+            break; // Last line was cut short
+        }
+        *end = '\0';
+        next = end + 1;
+
+        char *cursor = line + 2;
+        if (line[0] == '\0' || line[1] != '\t')
+        {
+            continue;
+        }
+
+        if (line[0] == 'B')
+        {
+            StoredBand *band = store_band(atoi(store_field(&cursor)), 1);
+            if (band != NULL)
+            {
+                band->band.name = store_field(&cursor);
+                band->band.genre = store_field(&cursor);
+                band->band.url = NULL; // Built when the band is first used
+            }
+        }
+        else if (line[0] == 'S')
+        {
+            char *text = store_field(&cursor);
+            char *ids = store_field(&cursor);
+            StoredSearch *search = store_search_entry(text, 1);
+            int count = 0;
+
+            for (char *p = ids; *p != '\0'; p++)
+            {
+                count += *p == ' ';
+            }
+            count += *ids != '\0';
+
+            if (search != NULL)
+            {
+                search->band_ids = arena_alloc(&store->arena, (count > 0 ? count : 1) * sizeof(int));
+                search->count = 0;
+                for (char *p = ids; search->band_ids != NULL && search->count < count; p++)
+                {
+                    search->band_ids[search->count++] = (int)strtol(p, &p, 10);
+                }
+            }
+        }
+        else if (line[0] == 'A' || line[0] == 'T')
+        {
+            char kind = line[0];
+            int id = atoi(store_field(&cursor));
+            int count = atoi(store_field(&cursor));
+            AlbumInfo *albums = kind == 'A' ? arena_alloc(&store->arena, (count > 0 ? count : 1) * sizeof(AlbumInfo)) : NULL;
+            SongInfo *songs = kind == 'T' ? arena_alloc(&store->arena, (count > 0 ? count : 1) * sizeof(SongInfo)) : NULL;
+            int read = 0;
+
+            while (read < count && (albums != NULL || songs != NULL))
+            {
+                char *item_end = strchr(next, '\n');
+                if (item_end == NULL || next[0] != (kind == 'A' ? 'a' : 't') || next[1] != '\t')
+                {
+                    break;
+                }
+                *item_end = '\0';
+                cursor = next + 2;
+                next = item_end + 1;
+
+                if (kind == 'A')
+                {
+                    albums[read].url = store_field(&cursor);
+                    albums[read].year = store_field(&cursor);
+                    albums[read].name = store_field(&cursor);
+                }
+                else
+                {
+                    songs[read].url = store_field(&cursor);
+                    songs[read].artist = store_field(&cursor);
+                    songs[read].year = store_field(&cursor);
+                    songs[read].album = store_field(&cursor);
+                    songs[read].name = store_field(&cursor);
+                }
+                read++;
+            }
+
+            if (read != count)
+            {
+                continue;
+            }
+
+            if (kind == 'A')
+            {
+                StoredBand *band = store_band(id, 1);
+                if (band != NULL)
+                {
+                    band->albums = albums;
+                    band->album_count = count;
+                }
+            }
+            else
+            {
+                StoredAlbum *album = store_album(id, 1);
+                if (album != NULL)
+                {
+                    album->songs = songs;
+                    album->song_count = count;
+                }
+            }
+        }
+    }
+
+    return start + (long)(line - store->file);
+}
+
+static int store_compare_bands(const void *a, const void *b)
+{
+    /* Function  : static int store_compare_bands(const void *a, const void *b)
+     * Input     : a, b - pointers to pointers to stored bands
+     * Output    : Returns a negative, zero or positive value as the id of the first band is smaller, equal or bigger
+     * Procedure : This function orders bands by id for the snapshot.
+     */
+
+    int first = (*(StoredBand *const *)a)->id;
+    int second = (*(StoredBand *const *)b)->id;
+
+    return (first > second) - (first < second);
+}
+
+static int store_compare_albums(const void *a, const void *b)
+{
+    /* Function  : static int store_compare_albums(const void *a, const void *b)
+     * Input     : a, b - pointers to pointers to stored albums
+     * Output    : Returns a negative, zero or positive value as the id of the first album is smaller, equal or bigger
+     * Procedure : This function orders albums by id for the snapshot.
+     */
+
+    int first = (*(StoredAlbum *const *)a)->id;
+    int second = (*(StoredAlbum *const *)b)->id;
+
+    return (first > second) - (first < second);
+}
+
+static int store_compare_searches(const void *a, const void *b)
+{
+    /* Function  : static int store_compare_searches(const void *a, const void *b)
+     * Input     : a, b - pointers to pointers to stored searches
+     * Output    : Returns the order of the texts of the searches, as strcmp
+     * Procedure : This function orders searches by text for the snapshot.
+     */
+
+    return strcmp((*(StoredSearch *const *)a)->text, (*(StoredSearch *const *)b)->text);
+}
+
+static uint32_t store_intern(StringPool *strings, const char *text, int unique, int *failed)
+{
+    /* Function  : static uint32_t store_intern(StringPool *strings, const char *text, int unique, int *failed)
+     * Input     : strings - pointer to the string table of the snapshot being built
+     *             text - pointer to a field, or NULL
+     *             unique - the field is a URL, which no other record shares
+     *             failed - pointer to a flag set if the string can't be added
+     * Output    : Returns the offset of the field in the string table, SNAPSHOT_NONE for NULL
+     * Procedure : This function adds a field to the string table of a snapshot. Other fields than URLs are interned, so the artist, year and album repeated on every song are stored once; URLs are simply appended, which saves the hash lookup.
+     */
+
+    uint32_t offset = SNAPSHOT_NONE;
+
+    if (text != NULL && (unique ? string_pool_add(strings, text, strlen(text), &offset) : string_pool_intern(strings, text, strlen(text), &offset)) != 0)
+    {
+        *failed = 1;
+    }
+
+    return offset;
+}
+
+static int store_write_section(FILE *file, const void *data, size_t size)
+{
+    /* Function  : static int store_write_section(FILE *file, const void *data, size_t size)
+     * Input     : file - pointer to the snapshot file
+     *             data - pointer to the section
+     *             size - size of the section
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function writes a section of a snapshot, padded with zeros to a multiple of 8 bytes.
+     */
+
+    static const char padding[8] = {0};
+
+    if (size > 0 && fwrite(data, 1, size, file) != size)
+    {
+        return -1;
+    }
+
+    size_t pad = (8 - size % 8) % 8;
+    return pad == 0 || fwrite(padding, 1, pad, file) == pad ? 0 : -1;
+}
+
+static int store_write_snapshot(long log_size)
+{
+    /* Function  : static int store_write_snapshot(long log_size)
+     * Input     : log_size - bytes of the store file the records in memory were read from
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function writes every record in memory to the snapshot file (see rocknation_snapshot.h): bands and albums are sorted by id and searches by text, and all fields go to one interned string table. The snapshot is written under a temporary name and renamed into place, so a concurrent run either maps the old snapshot or the new one.
+     */
+
+    RocknationStore *store = current_store();
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.log_size = (uint64_t)log_size;
+
+    for (int i = 0; i < store->band_count; i++)
+    {
+        header.album_count += store->bands[i].album_count > 0 ? (uint32_t)store->bands[i].album_count : 0;
+    }
+    for (int i = 0; i < store->album_count; i++)
+    {
+        header.song_count += (uint32_t)store->albums[i].song_count;
+    }
+    for (int i = 0; i < store->search_count; i++)
+    {
+        header.search_id_count += (uint32_t)store->searches[i].count;
+    }
+    header.band_count = (uint32_t)store->band_count;
+    header.song_album_count = (uint32_t)store->album_count;
+    header.search_count = (uint32_t)store->search_count;
+
+    StringPool strings;
+    string_pool_init(&strings);
+    StoredBand **band_order = rn_malloc((header.band_count + 1) * sizeof(StoredBand *));
+    StoredAlbum **album_order = rn_malloc((header.song_album_count + 1) * sizeof(StoredAlbum *));
+    StoredSearch **search_order = rn_malloc((header.search_count + 1) * sizeof(StoredSearch *));
+    SnapshotBand *bands = rn_calloc(header.band_count + 1, sizeof(SnapshotBand));
+    SnapshotAlbum *albums = rn_calloc(header.album_count + 1, sizeof(SnapshotAlbum));
+    SnapshotSongAlbum *song_albums = rn_calloc(header.song_album_count + 1, sizeof(SnapshotSongAlbum));
+    SnapshotSong *songs = rn_calloc(header.song_count + 1, sizeof(SnapshotSong));
+    SnapshotSearch *searches = rn_calloc(header.search_count + 1, sizeof(SnapshotSearch));
+    uint32_t *search_ids = rn_calloc(header.search_id_count + 1, sizeof(uint32_t));
+    int failed = band_order == NULL || album_order == NULL || search_order == NULL || bands == NULL || albums == NULL ||
+                 song_albums == NULL || songs == NULL || searches == NULL || search_ids == NULL;
+
+    store_intern(&strings, "", 0, &failed); // The string table is never empty
+
+    for (uint32_t i = 0; !failed && i < header.band_count; i++)
+    {
+        band_order[i] = &store->bands[i];
+    }
+    for (uint32_t i = 0; !failed && i < header.song_album_count; i++)
+    {
+        album_order[i] = &store->albums[i];
+    }
+    for (uint32_t i = 0; !failed && i < header.search_count; i++)
+    {
+        search_order[i] = &store->searches[i];
+    }
+
+    if (!failed)
+    {
+        qsort(band_order, header.band_count, sizeof(StoredBand *), store_compare_bands);
+        qsort(album_order, header.song_album_count, sizeof(StoredAlbum *), store_compare_albums);
+        qsort(search_order, header.search_count, sizeof(StoredSearch *), store_compare_searches);
+    }
+
+    uint32_t album_index = 0;
+    for (uint32_t i = 0; !failed && i < header.band_count; i++)
+    {
+        const StoredBand *band = band_order[i];
+        bands[i].id = (uint32_t)band->id;
+        bands[i].name = store_intern(&strings, band->band.name, 0, &failed);
+        bands[i].genre = store_intern(&strings, band->band.genre, 0, &failed);
+        bands[i].first_album = album_index;
+        bands[i].album_count = band->album_count;
+
+        for (int j = 0; j < band->album_count; j++, album_index++)
+        {
+            albums[album_index].url = store_intern(&strings, band->albums[j].url, 1, &failed);
+            albums[album_index].year = store_intern(&strings, band->albums[j].year, 0, &failed);
+            albums[album_index].name = store_intern(&strings, band->albums[j].name, 0, &failed);
+        }
+    }
+
+    uint32_t song_index = 0;
+    for (uint32_t i = 0; !failed && i < header.song_album_count; i++)
+    {
+        const StoredAlbum *album = album_order[i];
+        song_albums[i].id = (uint32_t)album->id;
+        song_albums[i].first_song = song_index;
+        song_albums[i].song_count = (uint32_t)album->song_count;
+
+        for (int j = 0; j < album->song_count; j++, song_index++)
+        {
+            const SongInfo *song = &album->songs[j];
+            songs[song_index].url = store_intern(&strings, song->url, 1, &failed);
+            songs[song_index].artist = store_intern(&strings, song->artist, 0, &failed);
+            songs[song_index].year = store_intern(&strings, song->year, 0, &failed);
+            songs[song_index].album = store_intern(&strings, song->album, 0, &failed);
+            songs[song_index].name = store_intern(&strings, song->name, 0, &failed);
+        }
+    }
+
+    uint32_t id_index = 0;
+    for (uint32_t i = 0; !failed && i < header.search_count; i++)
+    {
+        const StoredSearch *search = search_order[i];
+        searches[i].text = store_intern(&strings, search->text, 0, &failed);
+        searches[i].first_id = id_index;
+        searches[i].count = (uint32_t)search->count;
+
+        for (int j = 0; j < search->count; j++)
+        {
+            search_ids[id_index++] = (uint32_t)search->band_ids[j];
+        }
+    }
+
+    header.string_size = strings.size;
+    header.bands = (sizeof(SnapshotHeader) + 7) & ~(uint64_t)7;
+    header.albums = header.bands + ((header.band_count * (uint64_t)sizeof(SnapshotBand) + 7) & ~(uint64_t)7);
+    header.song_albums = header.albums + ((header.album_count * (uint64_t)sizeof(SnapshotAlbum) + 7) & ~(uint64_t)7);
+    header.songs = header.song_albums + ((header.song_album_count * (uint64_t)sizeof(SnapshotSongAlbum) + 7) & ~(uint64_t)7);
+    header.searches = header.songs + ((header.song_count * (uint64_t)sizeof(SnapshotSong) + 7) & ~(uint64_t)7);
+    header.search_ids = header.searches + ((header.search_count * (uint64_t)sizeof(SnapshotSearch) + 7) & ~(uint64_t)7);
+    header.strings = header.search_ids + ((header.search_id_count * (uint64_t)sizeof(uint32_t) + 7) & ~(uint64_t)7);
+
+    char temp_path[MAX_PATH_LENGTH + 96];
+    make_temp_path(store->snapshot_path, temp_path, sizeof(temp_path));
+    FILE *file = failed ? NULL : fopen(temp_path, "wb");
+
+    if (file != NULL)
+    {
+        failed = store_write_section(file, &header, sizeof(header)) != 0 ||
+                 store_write_section(file, bands, header.band_count * sizeof(SnapshotBand)) != 0 ||
+                 store_write_section(file, albums, header.album_count * sizeof(SnapshotAlbum)) != 0 ||
+                 store_write_section(file, song_albums, header.song_album_count * sizeof(SnapshotSongAlbum)) != 0 ||
+                 store_write_section(file, songs, header.song_count * sizeof(SnapshotSong)) != 0 ||
+                 store_write_section(file, searches, header.search_count * sizeof(SnapshotSearch)) != 0 ||
+                 store_write_section(file, search_ids, header.search_id_count * sizeof(uint32_t)) != 0 ||
+                 store_write_section(file, strings.text, strings.size) != 0;
+        failed = fclose(file) != 0 || failed;
+
+#ifdef _WIN32
+        remove(store->snapshot_path); // rename() doesn't replace existing files on Windows
+#endif
+        if (failed || rename(temp_path, store->snapshot_path) != 0)
+        {
+            remove(temp_path);
+            failed = 1;
+        }
+    }
+    else
+    {
+        failed = 1;
+    }
+
+    string_pool_free(&strings);
+    free(band_order);
+    free(album_order);
+    free(search_order);
+    free(bands);
+    free(albums);
+    free(song_albums);
+    free(songs);
+    free(searches);
+    free(search_ids);
+
+    return failed ? -1 : 0;
+}
+
+static void store_reset(void)
+{
+    /* Function  : static void store_reset(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function drops every record of the store and unmaps the snapshot, keeping only its settings and paths.
+     */
+
+    RocknationStore *store = current_store();
+
+    snapshot_close(&store->snapshot);
+    arena_free(&store->arena);
+    free(store->file);
+    free(store->band_index.slots);
+    free(store->album_index.slots);
+
+    store->file = NULL;
+    store->bands = NULL;
+    store->band_count = 0;
+    store->band_capacity = 0;
+    memset(&store->band_index, 0, sizeof(store->band_index));
+    store->albums = NULL;
+    store->album_count = 0;
+    store->album_capacity = 0;
+    memset(&store->album_index, 0, sizeof(store->album_index));
+    store->searches = NULL;
+    store->search_count = 0;
+    store->search_capacity = 0;
+    band_index_free(&store->names);
+    store->names_ready = 0;
+}
+
+static RocknationStore *current_store(void)
+{
+    /* Function  : static RocknationStore *current_store(void)
+     * Input     : None
+     * Output    : Returns a pointer to the store of the calling thread, loaded or not
+     * Procedure : This function returns the store of the client bound to the calling thread, or the default one if the thread hasn't bound a client.
+     */
+
+    return bound_store != NULL ? bound_store : &rocknation_store;
+}
+
+RN_API void store_close(void)
+{
+    /*
+     * Function  : void store_close(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function releases everything the store of the calling thread loaded or added during the run. If a lot was added to the store file since the snapshot was built, the whole file is read again and a new snapshot is written first, so the next run starts from it.
+     */
+
+    RocknationStore *store = current_store();
+
+    if (!store->loaded)
+    {
+        return;
+    }
+
+    if (store->pending > SNAPSHOT_REBUILD_SIZE)
+    {
+        store_reset();
+        long log_size = store_load(0);
+        if (log_size > 0)
+        {
+            store_write_snapshot(log_size);
+        }
+    }
+
+    store_reset();
+
+    int refresh = store->refresh;
+    memset(store, 0, sizeof(*store));
+    store->refresh = refresh;
+}
+
+static void close_default_store(void)
+{
+    /* Function  : static void close_default_store(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function closes the default store. It is registered with atexit when that store is first used.
+     */
+
+    bound_store = NULL;
+    store_close();
+}
+
+RN_API RocknationStore *get_store(void)
+{
+    /*
+     * Function  : RocknationStore *get_store(void)
+     * Input     : None
+     * Output    : Returns a pointer to the store of the calling thread
+     * Procedure : This function lazily opens the local catalog store the first time it is called by a client (or by a thread without one): the store file lives next to the page cache (see cache_dir). If a snapshot of it exists, the snapshot is mapped and only the part of the file written after it is read; otherwise the whole file is read once per run.
+     */
+
+    RocknationStore *store = current_store();
+
+    if (!store->loaded)
+    {
+        store->loaded = 1;
+        arena_init(&store->arena, ARENA_BLOCK_SIZE);
+        snprintf(store->path, sizeof(store->path), "%s/%s", cache_dir(), STORE_FILE);
+        snprintf(store->snapshot_path, sizeof(store->snapshot_path), "%s/%s", cache_dir(), SNAPSHOT_FILE);
+
+        long from = 0;
+        if (snapshot_open(store->snapshot_path, &store->snapshot) == 0)
+        {
+            from = (long)store->snapshot.header->log_size;
+        }
+
+        store->log_size = store_load(from);
+        if (store->log_size < 0 && from > 0)
+        {
+            // The store file was replaced or cut since the snapshot was built
+            store_reset();
+            remove(store->snapshot_path);
+            from = 0;
+            store->log_size = store_load(0);
+        }
+        store->pending = store->log_size > from ? store->log_size - from : 0;
+
+        static int registered = 0;
+        if (store == &rocknation_store && !registered)
+        {
+            atexit(close_default_store);
+            registered = 1;
+        }
+    }
+
+    return store;
+}
+
+static int store_append(const char *text, size_t length)
+{
+    /* Function  : static int store_append(const char *text, size_t length)
+     * Input     : text - pointer to the lines to add to the store file
+     *             length - length of the lines
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function appends whole records to the store file, writing the magic line first if the file is new, and a line break first if the file ends with a line cut short by an interrupted run, so the cut line doesn't swallow the first record. The file is unbuffered, so the records go out in a single write and records of concurrent runs don't interleave.
+     */
+
+    RocknationStore *store = get_store();
+    FILE *file = fopen(store->path, "a+b");
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0)
+    {
+        fputs(STORE_MAGIC "\n", file);
+    }
+    else if (fseek(file, -1, SEEK_END) == 0 && fgetc(file) != '\n')
+    {
+        fseek(file, 0, SEEK_END);
+        fputc('\n', file);
+    }
+    fseek(file, 0, SEEK_END);
+
+    int result = fwrite(text, 1, length, file) == length ? 0 : -1;
+    fclose(file);
+    store->pending += (long)length;
+
+    return result;
+}
+
+static char *store_copy(const char *text)
+{
+    /* Function  : static char *store_copy(const char *text)
+     * Input     : text - pointer to a field of a record
+     * Output    : Returns a copy of the field in the arena of the store, or NULL
+     * Procedure : This function copies a field into the store, replacing tabs and line breaks with spaces so the field can be written as is to the store file.
+     */
+
+    char *copy = arena_strndup(&current_store()->arena, text, strlen(text));
+
+    for (char *p = copy; p != NULL && *p != '\0'; p++)
+    {
+        if (*p == '\t' || *p == '\n' || *p == '\r')
+        {
+            *p = ' ';
+        }
+    }
+
+    return copy;
+}
+
+static void store_lowercase(const char *text, char *dest, size_t dest_size)
+{
+    /* Function  : static void store_lowercase(const char *text, char *dest, size_t dest_size)
+     * Input     : text - pointer to a search text
+     *             dest - pointer to the buffer receiving the key
+     *             dest_size - size of the buffer
+     * Output    : Writes the search text in lowercase, with tabs and line breaks replaced by spaces, into dest
+     * Procedure : This function turns a search text into the key its results are stored under; the site doesn't tell case apart in searches.
+     */
+
+    size_t i = 0;
+
+    for (; text[i] != '\0' && i + 1 < dest_size; i++)
+    {
+        char c = (char)tolower((unsigned char)text[i]);
+        dest[i] = (c == '\t' || c == '\n' || c == '\r') ? ' ' : c;
+    }
+    dest[i] = '\0';
+}
+
+static const BandInfo *store_band_info(StoredBand *band)
+{
+    /* Function  : static const BandInfo *store_band_info(StoredBand *band)
+     * Input     : band - pointer to a stored band
+     * Output    : Returns the BandInfo of the band, or NULL if its name isn't known
+     * Procedure : This function completes the BandInfo of a stored band, building its URL from its id the first time it is needed.
+     */
+
+    if (band->band.name == NULL)
+    {
+        return NULL;
+    }
+
+    if (band->band.url == NULL)
+    {
+        char url[MAX_URL_LENGTH];
+        snprintf(url, sizeof(url), "%s" STORE_BAND_PATH "%d", base_url(), band->id);
+        band->band.url = arena_strndup(&current_store()->arena, url, strlen(url));
+    }
+
+    return band->band.url != NULL ? &band->band : NULL;
+}
+
+static int store_lookup_band(int id, BandInfo *info)
+{
+    /* Function  : static int store_lookup_band(int id, BandInfo *info)
+     * Input     : id - id of the band
+     *             info - pointer to the BandInfo structure to fill
+     * Output    : Returns 0 if the band is known, -1 otherwise
+     * Procedure : This function finds the name and genre of a band, first among the records read or added during this run and then in the snapshot.
+     */
+
+    RocknationStore *store = current_store();
+    StoredBand *stored = store_band(id, 0);
+    const BandInfo *known = stored != NULL ? store_band_info(stored) : NULL;
+
+    if (known != NULL)
+    {
+        *info = *known;
+        return 0;
+    }
+
+    const SnapshotBand *band = snapshot_band(&store->snapshot, id);
+    if (band == NULL || band->name == SNAPSHOT_NONE)
+    {
+        return -1;
+    }
+
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s" STORE_BAND_PATH "%d", base_url(), id);
+    info->url = arena_strndup(&store->arena, url, strlen(url));
+    info->name = snapshot_string(&store->snapshot, band->name);
+    info->genre = snapshot_string(&store->snapshot, band->genre);
+
+    return info->url != NULL ? 0 : -1;
+}
+
+RN_API int store_search(const char *search_text, BandInfoList *band_list, BandCallback on_band, void *userdata)
+{
+    /*
+     * Function  : int store_search(const char *search_text, BandInfoList *band_list, BandCallback on_band, void *userdata)
+     * Input     : search_text - pointer to the text used for band search
+     *             band_list - pointer to the BandInfoList structure to store search results
+     *             on_band - function called with every band, or NULL
+     *             userdata - pointer passed to on_band
+     * Output    : Returns 0 if the search was answered from the store, -1 if it has to go to the network
+     * Procedure : This function answers a band search with the results stored the last time the same text (in any case) was searched, unless --refresh was given. The bands point into the store and stay valid for the whole run.
+     */
+
+    RocknationStore *store = get_store();
+    char key[MAX_URL_LENGTH];
+    store_lowercase(search_text, key, sizeof(key));
+
+    StoredSearch *search = store->refresh ? NULL : store_search_entry(key, 0);
+    const SnapshotSearch *snapshot_entry = store->refresh || search != NULL ? NULL : snapshot_search(&store->snapshot, key);
+    const uint32_t *snapshot_ids = snapshot_entry != NULL ? snapshot_search_ids(&store->snapshot, snapshot_entry) : NULL;
+    int count = search != NULL ? search->count : snapshot_ids != NULL ? (int)snapshot_entry->count : 0;
+
+    if (count == 0)
+    {
+        store->misses++;
+        return -1;
+    }
+
+    band_list->count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        BandInfo info;
+        int id = search != NULL ? search->band_ids[i] : (int)snapshot_ids[i];
+        BandInfo *band = store_lookup_band(id, &info) == 0 ? append_band(band_list) : NULL;
+
+        if (band == NULL)
+        {
+            continue;
+        }
+
+        *band = info;
+        if (on_band != NULL)
+        {
+            on_band(band, userdata);
+        }
+    }
+
+    store->hits++;
+    return 0;
+}
+
+RN_API int store_albums(const char *band_url, AlbumInfoList *album_list)
+{
+    /*
+     * Function  : int store_albums(const char *band_url, AlbumInfoList *album_list)
+     * Input     : band_url - pointer to the URL of the band
+     *             album_list - pointer to the AlbumInfoList structure to store album information
+     * Output    : Returns 0 if the discography was answered from the store, -1 if it has to go to the network
+     * Procedure : This function answers a discography from the store, unless --refresh was given. A discography read or added during this run wins over the one in the snapshot.
+     */
+
+    RocknationStore *store = get_store();
+    int id = store_url_id(band_url, "band-");
+    StoredBand *band = store->refresh ? NULL : store_band(id, 0);
+
+    if (band == NULL || band->album_count < 0)
+    {
+        band = NULL;
+    }
+
+    const SnapshotBand *snapshot_entry = store->refresh || band != NULL ? NULL : snapshot_band(&store->snapshot, id);
+    const SnapshotAlbum *snapshot_albums_found = snapshot_entry != NULL ? snapshot_albums(&store->snapshot, snapshot_entry) : NULL;
+    int count = band != NULL ? band->album_count : snapshot_albums_found != NULL ? snapshot_entry->album_count : 0;
+
+    if (count <= 0)
+    {
+        store->misses++;
+        return -1;
+    }
+
+    album_list->count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        AlbumInfo *album = append_album(album_list);
+        if (album == NULL)
+        {
+            break;
+        }
+
+        if (band != NULL)
+        {
+            *album = band->albums[i];
+        }
+        else
+        {
+            album->url = snapshot_string(&store->snapshot, snapshot_albums_found[i].url);
+            album->year = snapshot_string(&store->snapshot, snapshot_albums_found[i].year);
+            album->name = snapshot_string(&store->snapshot, snapshot_albums_found[i].name);
+        }
+    }
+
+    store->hits++;
+    return 0;
+}
+
+RN_API int store_songs(const char *album_url, SongInfoList *song_list, SongCallback on_song, void *userdata)
+{
+    /*
+     * Function  : int store_songs(const char *album_url, SongInfoList *song_list, SongCallback on_song, void *userdata)
+     * Input     : album_url - pointer to the URL of the album
+     *             song_list - pointer to the SongInfoList structure to store song information
+     *             on_song - function called with every song, or NULL
+     *             userdata - pointer passed to on_song
+     * Output    : Returns 0 if the songs were answered from the store, -1 if they have to go to the network
+     * Procedure : This function answers the songs of an album from the store, unless --refresh was given. Songs read or added during this run win over those in the snapshot.
+     */
+
+    RocknationStore *store = get_store();
+    int id = store_url_id(album_url, "album-");
+    StoredAlbum *album = store->refresh ? NULL : store_album(id, 0);
+    const SnapshotSongAlbum *snapshot_entry = store->refresh || album != NULL ? NULL : snapshot_song_album(&store->snapshot, id);
+    const SnapshotSong *snapshot_songs_found = snapshot_entry != NULL ? snapshot_songs(&store->snapshot, snapshot_entry) : NULL;
+    int count = album != NULL ? album->song_count : snapshot_songs_found != NULL ? (int)snapshot_entry->song_count : 0;
+
+    if (count <= 0)
+    {
+        store->misses++;
+        return -1;
+    }
+
+    song_list->count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        SongInfo *song = append_song(song_list);
+        if (song == NULL)
+        {
+            break;
+        }
+
+        if (album != NULL)
+        {
+            *song = album->songs[i];
+        }
+        else
+        {
+            const SnapshotSong *stored = &snapshot_songs_found[i];
+            song->url = snapshot_string(&store->snapshot, stored->url);
+            song->artist = snapshot_string(&store->snapshot, stored->artist);
+            song->year = snapshot_string(&store->snapshot, stored->year);
+            song->album = snapshot_string(&store->snapshot, stored->album);
+            song->name = snapshot_string(&store->snapshot, stored->name);
+        }
+
+        if (on_song != NULL)
+        {
+            on_song(song, userdata);
+        }
+    }
+
+    store->hits++;
+    return 0;
+}
+
+RN_API void store_put_search(const char *search_text, const BandInfoList *band_list)
+{
+    /*
+     * Function  : void store_put_search(const char *search_text, const BandInfoList *band_list)
+     * Input     : search_text - pointer to the text used for band search
+     *             band_list - pointer to the results of the search
+     * Output    : None
+     * Procedure : This function records the bands found by a search, and the search itself, in the store and appends them to the store file. Bands without an id in their URL are left out.
+     */
+
+    RocknationStore *store = get_store();
+    char key[MAX_URL_LENGTH];
+    store_lowercase(search_text, key, sizeof(key));
+
+    StoredSearch *search = store_search_entry(key, 1);
+    int *ids = arena_alloc(&store->arena, (band_list->count > 0 ? band_list->count : 1) * sizeof(int));
+    Arena scratch;
+    arena_init(&scratch, ARENA_BLOCK_SIZE);
+    size_t capacity = 64 + strlen(key);
+
+    for (int i = 0; i < band_list->count; i++)
+    {
+        capacity += 32 + strlen(band_list->bands[i].name) + strlen(band_list->bands[i].genre);
+    }
+    char *lines = arena_alloc(&scratch, capacity);
+    size_t size = 0;
+
+    if (search == NULL || ids == NULL || lines == NULL)
+    {
+        arena_free(&scratch);
+        return;
+    }
+
+    int count = 0;
+    for (int i = 0; i < band_list->count; i++)
+    {
+        const BandInfo *info = &band_list->bands[i];
+        int id = store_url_id(info->url, "band-");
+        StoredBand *band = id >= 0 ? store_band(id, 1) : NULL;
+
+        if (band == NULL)
+        {
+            continue;
+        }
+
+        band->band.name = store_copy(info->name);
+        band->band.genre = store_copy(info->genre);
+        band->band.url = NULL;
+        ids[count++] = id;
+        if (store->names_ready && band->band.name != NULL)
+        {
+            band_index_add(&store->names, id, band->band.name);
+        }
+        size += snprintf(lines + size, capacity - size, "B\t%d\t%s\t%s\n", id,
+                               band->band.name != NULL ? band->band.name : "", band->band.genre != NULL ? band->band.genre : "");
+    }
+
+    search->band_ids = ids;
+    search->count = count;
+
+    size += snprintf(lines + size, capacity - size, "S\t%s\t", key);
+    for (int i = 0; i < count; i++)
+    {
+        size += snprintf(lines + size, capacity - size, i > 0 ? " %d" : "%d", ids[i]);
+    }
+    size += snprintf(lines + size, capacity - size, "\n");
+
+    store_append(lines, size);
+    arena_free(&scratch);
+}
+
+RN_API void store_put_albums(const char *band_url, const AlbumInfoList *album_list)
+{
+    /*
+     * Function  : void store_put_albums(const char *band_url, const AlbumInfoList *album_list)
+     * Input     : band_url - pointer to the URL of the band
+     *             album_list - pointer to the complete discography of the band
+     * Output    : None
+     * Procedure : This function records the discography of a band in the store and appends it to the store file.
+     */
+
+    RocknationStore *store = get_store();
+    int id = store_url_id(band_url, "band-");
+    StoredBand *band = id >= 0 ? store_band(id, 1) : NULL;
+    AlbumInfo *albums = arena_alloc(&store->arena, (album_list->count > 0 ? album_list->count : 1) * sizeof(AlbumInfo));
+    Arena scratch;
+    arena_init(&scratch, ARENA_BLOCK_SIZE);
+    size_t capacity = 64;
+
+    for (int i = 0; i < album_list->count; i++)
+    {
+        const AlbumInfo *album = &album_list->albums[i];
+        capacity += 8 + strlen(album->url) + strlen(album->year) + strlen(album->name);
+    }
+    char *lines = arena_alloc(&scratch, capacity);
+
+    if (band == NULL || albums == NULL || lines == NULL)
+    {
+        arena_free(&scratch);
+        return;
+    }
+
+    size_t size = snprintf(lines, capacity, "A\t%d\t%d\n", id, album_list->count);
+    for (int i = 0; i < album_list->count; i++)
+    {
+        albums[i].url = store_copy(album_list->albums[i].url);
+        albums[i].year = store_copy(album_list->albums[i].year);
+        albums[i].name = store_copy(album_list->albums[i].name);
+        if (albums[i].url == NULL || albums[i].year == NULL || albums[i].name == NULL)
+        {
+            arena_free(&scratch);
+            return;
+        }
+        size += snprintf(lines + size, capacity - size, "a\t%s\t%s\t%s\n", albums[i].url, albums[i].year, albums[i].name);
+    }
+
+    band->albums = albums;
+    band->album_count = album_list->count;
+
+    store_append(lines, size);
+    arena_free(&scratch);
+}
+
+RN_API void store_put_songs(const char *album_url, const SongInfoList *song_list)
+{
+    /*
+     * Function  : void store_put_songs(const char *album_url, const SongInfoList *song_list)
+     * Input     : album_url - pointer to the URL of the album
+     *             song_list - pointer to the songs of the album
+     * Output    : None
+     * Procedure : This function records the songs of an album in the store and appends them to the store file.
+     */
+
+    RocknationStore *store = get_store();
+    int id = store_url_id(album_url, "album-");
+    StoredAlbum *album = id >= 0 ? store_album(id, 1) : NULL;
+    SongInfo *songs = arena_alloc(&store->arena, (song_list->count > 0 ? song_list->count : 1) * sizeof(SongInfo));
+    Arena scratch;
+    arena_init(&scratch, ARENA_BLOCK_SIZE);
+    size_t capacity = 64;
+
+    for (int i = 0; i < song_list->count; i++)
+    {
+        const SongInfo *song = &song_list->songs[i];
+        capacity += 12 + strlen(song->url) + strlen(song->artist) + strlen(song->year) + strlen(song->album) + strlen(song->name);
+    }
+    char *lines = arena_alloc(&scratch, capacity);
+
+    if (album == NULL || songs == NULL || lines == NULL)
+    {
+        arena_free(&scratch);
+        return;
+    }
+
+    size_t size = snprintf(lines, capacity, "T\t%d\t%d\n", id, song_list->count);
+    for (int i = 0; i < song_list->count; i++)
+    {
+        const SongInfo *song = &song_list->songs[i];
+        songs[i].url = store_copy(song->url);
+        songs[i].artist = store_copy(song->artist);
+        songs[i].year = store_copy(song->year);
+        songs[i].album = store_copy(song->album);
+        songs[i].name = store_copy(song->name);
+        if (songs[i].url == NULL || songs[i].artist == NULL || songs[i].year == NULL || songs[i].album == NULL || songs[i].name == NULL)
+        {
+            arena_free(&scratch);
+            return;
+        }
+        size += snprintf(lines + size, capacity - size, "t\t%s\t%s\t%s\t%s\t%s\n",
+                         songs[i].url, songs[i].artist, songs[i].year, songs[i].album, songs[i].name);
+    }
+
+    album->songs = songs;
+    album->song_count = song_list->count;
+
+    store_append(lines, size);
+    arena_free(&scratch);
+}
+
+RN_API void store_put_song_page(const char *album_url, const SongPage *song_page)
+{
+    /*
+     * Function  : void store_put_song_page(const char *album_url, const SongPage *song_page)
+     * Input     : album_url - pointer to the URL of the album
+     *             song_page - pointer to an album page filled by get_song_page
+     * Output    : None
+     * Procedure : This function records the songs of an album page in the store, copying their fields out of the page, see store_put_songs.
+     */
+
+    Arena scratch;
+    arena_init(&scratch, ARENA_BLOCK_SIZE);
+    SongInfoList song_list;
+    init_song_list(&song_list, &scratch);
+    const char *text = song_page->page.memory;
+
+    for (int i = 0; i < song_page->count; i++)
+    {
+        const SongRef *ref = &song_page->songs[i];
+        SongInfo *song = append_song(&song_list);
+        char *name = arena_alloc(&scratch, ref->name.length + 1);
+
+        if (song == NULL || name == NULL)
+        {
+            arena_free(&scratch);
+            return;
+        }
+
+        song->url = arena_strndup(&scratch, text + ref->url.offset, ref->url.length);
+        song->artist = arena_strndup(&scratch, text + ref->artist.offset, ref->artist.length);
+        song->year = arena_strndup(&scratch, text + ref->year.offset, ref->year.length);
+        song->album = arena_strndup(&scratch, text + ref->album.offset, ref->album.length);
+        span_decode(text, ref->name, name, ref->name.length + 1);
+        song->name = name;
+        if (song->url == NULL || song->artist == NULL || song->year == NULL || song->album == NULL)
+        {
+            arena_free(&scratch);
+            return;
+        }
+    }
+
+    store_put_songs(album_url, &song_list);
+    arena_free(&scratch);
+}
+
+RN_API int store_fuzzy_search(const char *text, int k, BandInfoList *band_list)
+{
+    /*
+     * Function  : int store_fuzzy_search(const char *text, int k, BandInfoList *band_list)
+     * Input     : text - pointer to a band name, possibly misspelled, partial or not in ASCII
+     *             k - maximum number of bands to return
+     *             band_list - pointer to the BandInfoList structure receiving the bands, best match first
+     * Output    : Returns the number of bands found, or -1 on failure
+     * Procedure : This function finds the known bands whose names best match the text, without a request (see band_index_search). The fuzzy index is built from the snapshot and the store file the first time it is needed; bands found by later searches are added to it as they are stored.
+     */
+
+    RocknationStore *store = get_store();
+
+    if (!store->names_ready)
+    {
+        store->names_ready = 1;
+
+        const SnapshotHeader *header = store->snapshot.header;
+        for (uint32_t i = 0; header != NULL && i < header->band_count; i++)
+        {
+            const SnapshotBand *band = &store->snapshot.bands[i];
+            if (band->name != SNAPSHOT_NONE)
+            {
+                band_index_add(&store->names, (int)band->id, snapshot_string(&store->snapshot, band->name));
+            }
+        }
+
+        // Bands read from the store file after the snapshot replace their snapshot names
+        for (int i = 0; i < store->band_count; i++)
+        {
+            if (store->bands[i].band.name != NULL)
+            {
+                band_index_add(&store->names, store->bands[i].id, store->bands[i].band.name);
+            }
+        }
+    }
+
+    FuzzyMatch *matches = k > 0 ? arena_alloc(band_list->arena, k * sizeof(FuzzyMatch)) : NULL;
+    int count = matches != NULL ? band_index_search(&store->names, text, matches, k) : 0;
+
+    band_list->count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        BandInfo info;
+        BandInfo *band = store_lookup_band(matches[i].band_id, &info) == 0 ? append_band(band_list) : NULL;
+        if (band != NULL)
+        {
+            *band = info;
+        }
+    }
+
+    return count < 0 ? -1 : band_list->count;
+}
+
+RN_API void print_store_stats(void)
+{
+    /*
+     * Function  : void print_store_stats(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function prints to stderr how many lookups were answered from the local catalog store and how many went to the network.
+     */
+
+    RocknationStore *store = current_store();
+
+    if (store->hits + store->misses == 0)
+    {
+        return;
+    }
+
+    fprintf(stderr, "[store] %d answered locally, %d fetched (%s)\n",
+            store->hits, store->misses, store->path);
+}
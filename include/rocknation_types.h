@@ -5,9 +5,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <curl/curl.h>
-#include <pcre.h>
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
 #include <uriparser/Uri.h>
+#include "rocknation_alloc.h"
+#include "rocknation_arena.h"
 
 #define MAX_NAME_LENGTH 100
 #define MAX_URL_LENGTH 512
@@ -15,49 +20,120 @@
 #define MAX_GENRE_LENGTH 100
 #define MAX_SONG_NAME_LENGTH 50
 
+// Result lists grow as needed; their records and strings live in the arena of the request
 typedef struct
 {
-    char name[MAX_NAME_LENGTH];
-    char url[MAX_URL_LENGTH];
-    char genre[MAX_GENRE_LENGTH];
+    char *name;
+    char *url;
+    char *genre;
 } BandInfo;
 
 typedef struct
 {
-    BandInfo bands[10];
+    BandInfo *bands;
     int count;
+    int capacity;
+    Arena *arena;
 } BandInfoList;
 
+typedef void (*BandCallback)(const BandInfo *band, void *userdata);
+
 typedef struct
 {
-    char name[MAX_NAME_LENGTH];
-    char url[MAX_URL_LENGTH];
-    char year[MAX_YEAR_LENGTH];
+    char *name;
+    char *url;
+    char *year;
 } AlbumInfo;
 
 typedef struct
 {
-    AlbumInfo albums[50];
+    AlbumInfo *albums;
     int count;
+    int capacity;
+    Arena *arena;
 } AlbumInfoList;
 
 typedef struct
 {
-    char url[MAX_URL_LENGTH];
-    char artist[MAX_NAME_LENGTH];
-    char year[MAX_YEAR_LENGTH];
-    char album[MAX_NAME_LENGTH];
-    char name[MAX_SONG_NAME_LENGTH];
+    char *url;
+    char *artist;
+    char *year;
+    char *album;
+    char *name;
 } SongInfo;
 
 typedef struct
 {
-    SongInfo songs[50];
+    SongInfo *songs;
     int count;
+    int capacity;
+    Arena *arena;
 } SongInfoList;
 
+typedef void (*SongCallback)(const SongInfo *song, void *userdata);
+
 typedef struct
 {
     char *memory;
     size_t size;
+    size_t capacity; // Bytes allocated for memory
 } MemoryStruct;
+
+#define PAGE_BUFFER_SIZE (16 * 1024)
+
+// Part of a page, as an offset and length into the retained page buffer
+typedef struct
+{
+    size_t offset;
+    size_t length;
+} TextSpan;
+
+typedef struct
+{
+    TextSpan url;
+    TextSpan artist;
+    TextSpan year;
+    TextSpan album;
+    TextSpan name; // Still URL-encoded, see span_decode
+} SongRef;
+
+typedef struct
+{
+    MemoryStruct page; // Album page the spans point into
+    SongRef *songs;
+    int count;
+    int capacity;
+    Arena *arena;
+} SongPage;
+
+#define DOWNLOAD_BUFFER_SIZE (64 * 1024)
+#define FILE_WRITE_BUFFERS 4 // Buffers of a download being filled or written at once when the disk writer writes them
+
+typedef struct
+{
+    FILE *file;
+    char *buffer;    // Fixed-size staging buffer, flushed to file when full
+    size_t used;     // Bytes currently staged in buffer
+    size_t capacity; // Size of buffer (DOWNLOAD_BUFFER_SIZE)
+    size_t total;    // Total bytes written to file so far
+    int error;       // Set when a write to file failed
+    const char *output_file; // Final name of the file, only used once the download is complete
+    char *part_file;         // "<output_file>.part", where the data is written while downloading
+    curl_off_t resume_from;  // Bytes already in part_file when the download started
+    curl_off_t remote_size;  // Complete size of the file as reported by a Content-Range header
+    curl_off_t expected_size; // Content-Length of the response being received, -1 if unknown
+
+    // Set by attach_disk_writer: full buffers are written by the disk writer instead of the thread receiving the data
+    struct DiskWriter *disk;
+    int fd;                          // Descriptor of part_file for the positioned writes of the writer
+    curl_off_t queued;               // Bytes handed to the writer since part_file was opened or truncated
+    int allocated;                   // Set once the space of the response has been asked for
+    char *spare[FILE_WRITE_BUFFERS]; // Buffers free to stage data in
+    int spare_count;
+    int pending;                     // Requests of the file not completed yet, backlog included
+    int writing;                     // Set while the writer carries out a request of the file
+    struct FileWrite *backlog;       // Requests waiting for it, in file order
+    struct FileWrite *backlog_tail;
+    RnMutex lock;                    // Guards spare, pending, the backlog, total and error while the writer writes
+    RnCond written;                  // Signalled whenever a request has completed
+} FileStruct;
@@ -2,182 +2,323 @@
 #pragma once
 #include "rocknation_types.h"
 
-char hex_to_char(const char *hex);
-char *url_encode(const char *input);
-char *url_encode_spaces(char *input);
-char *url_decode(const char *input);
-char *get_filename_from_url(const char *url);
-char *replace_http(const char *url);
+#define DEFAULT_BASE_URL "https://rocknation.su"
+#define MAX_BASE_URL_LENGTH 128 // Leaves room in a MAX_URL_LENGTH buffer for the path of any catalog page
 
-char hex_to_char(const char *hex)
+RN_API char hex_to_char(const char *hex);
+RN_API size_t url_encode_into(const char *input, size_t length, char *dest, size_t dest_size);
+RN_API size_t url_encode_spaces_into(const char *input, size_t length, char *dest, size_t dest_size);
+RN_API size_t url_decode_into(const char *input, size_t length, char *dest, size_t dest_size);
+RN_API char *url_encode(const char *input);
+RN_API char *url_encode_spaces(char *input);
+RN_API char *url_decode(const char *input);
+RN_API char *get_filename_from_url(const char *url);
+RN_API char *replace_http(const char *url);
+static void read_base_url(void);
+RN_API const char *base_url(void);
+RN_API int is_site_url(const char *url);
+RN_API int init_memory_struct(MemoryStruct *mem);
+RN_API size_t span_copy(const char *text, TextSpan span, char *dest, size_t dest_size);
+RN_API size_t span_decode(const char *text, TextSpan span, char *dest, size_t dest_size);
+RN_API void init_band_list(BandInfoList *list, Arena *arena);
+RN_API void init_album_list(AlbumInfoList *list, Arena *arena);
+RN_API void init_song_list(SongInfoList *list, Arena *arena);
+RN_API void init_song_page(SongPage *page, Arena *arena);
+RN_API BandInfo *append_band(BandInfoList *list);
+RN_API AlbumInfo *append_album(AlbumInfoList *list);
+RN_API SongInfo *append_song(SongInfoList *list);
+RN_API SongRef *append_song_ref(SongPage *page);
+
+// Value of a hexadecimal digit plus one, indexed by byte; 0 for bytes that aren't one
+static const unsigned char url_hex_value[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16};
+
+// Bytes url_encode leaves as they are: letters, digits and "-_.~"
+static const char url_unreserved[256] = {
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1,
+    ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1,
+    ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1,
+    ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1,
+    ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1,
+    ['-'] = 1, ['_'] = 1, ['.'] = 1, ['~'] = 1};
+
+static const char url_hex_digits[] = "0123456789ABCDEF";
+
+RN_API char hex_to_char(const char *hex)
 {
     /* Function  : char hex_to_char(const char *hex)
      * Input     : hex - pointer to a two-character string representing a hexadecimal number
      * Output    : Returns the corresponding ASCII character value
-     * Procedure : This function converts a two-character hexadecimal string to its corresponding ASCII character. It iterates through each character of the input string, converting the hexadecimal digits to their decimal equivalent. The result is the ASCII value of the represented character. If the input is not a valid hexadecimal string, the behavior is undefined.
+     * Procedure : This function converts a two-character hexadecimal string to its corresponding ASCII character, looking both digits up in url_hex_value instead of classifying them with isdigit/isxdigit/tolower. If the input is not a valid hexadecimal string, the behavior is undefined.
      */
 
-    int value = 0;
+    return (char)(((url_hex_value[(unsigned char)hex[0]] - 1u) << 4) | (url_hex_value[(unsigned char)hex[1]] - 1u));
+}
 
-    // Iterate through each character in the two-character hexadecimal string
-    for (int i = 0; i < 2; i++)
-    {
-        char c = hex[i];
+static size_t find_decode_escape(const char *input, size_t length, size_t offset)
+{
+    /* Function  : static size_t find_decode_escape(const char *input, size_t length, size_t offset)
+     * Input     : input - pointer to the text being decoded
+     *             length - length of the text
+     *             offset - position to start searching from
+     * Output    : Returns the position of the next '%' or '+', or length if there is none
+     * Procedure : This function finds the next byte url_decode has to translate, so everything before it can be copied in one go. With SSE2 or AVX2 it compares 16 or 32 bytes at a time against both characters, like find_anchor in rocknation_scan.h; the rest is checked byte by byte.
+     */
+
+    size_t i = offset;
+
+#if defined(RN_SIMD_AVX2)
+    const __m256i percent = _mm256_set1_epi8('%');
+    const __m256i plus = _mm256_set1_epi8('+');
 
-        // Convert hexadecimal digits to their decimal equivalent
-        if (isdigit(c))
+    while (i + 32 <= length)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(input + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, percent),
+                                                                               _mm256_cmpeq_epi8(block, plus)));
+        if (mask != 0)
         {
-            value = value * 16 + (c - '0');
+            return i + __builtin_ctz(mask);
         }
-        else if (isxdigit(c))
+        i += 32;
+    }
+#elif defined(RN_SIMD_SSE2)
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+
+    while (i + 16 <= length)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(input + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, percent),
+                                                                         _mm_cmpeq_epi8(block, plus)));
+        if (mask != 0)
         {
-            value = value * 16 + (tolower(c) - 'a' + 10);
+#if defined(_MSC_VER)
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return i + bit;
+#else
+            return i + __builtin_ctz(mask);
+#endif
         }
+        i += 16;
+    }
+#endif
+
+    while (i < length && input[i] != '%' && input[i] != '+')
+    {
+        i++;
     }
 
-    // Return the corresponding ASCII character value
-    return (char)value;
+    return i;
 }
 
-char *url_encode(const char *input)
+RN_API size_t url_encode_into(const char *input, size_t length, char *dest, size_t dest_size)
 {
     /*
-     * Function  : char *url_encode(const char *input)
-     * Input     : input - pointer to the string to be URL-encoded
-     * Output    : Returns a newly allocated URL-encoded string
-     * Procedure : This function URL-encodes the input string, replacing special characters with their percent-encoded equivalents. The resulting string should be freed by the caller.
+     * Function  : size_t url_encode_into(const char *input, size_t length, char *dest, size_t dest_size)
+     * Input     : input - pointer to the text to be URL-encoded
+     *             length - length of the text
+     *             dest - pointer to the buffer receiving the encoded text (3 * length + 1 bytes always fit)
+     *             dest_size - size of the buffer
+     * Output    : Returns the length of the encoded text
+     * Procedure : This function URL-encodes the text into a caller-provided buffer, replacing every byte that isn't unreserved with its percent-encoded equivalent. Bytes are classified with the url_unreserved table and escapes are written from url_hex_digits, without formatting. If the buffer is too small the text is cut before the first byte that doesn't fit whole; it is always null-terminated.
      */
 
-    size_t len = strlen(input);
-    char *output = malloc(3 * len + 1); // Maximum possible length for URL encoding
+    size_t j = 0;
 
-    if (output)
+    for (size_t i = 0; i < length; i++)
     {
-        size_t j = 0;
-        for (size_t i = 0; i < len; i++)
+        unsigned char c = (unsigned char)input[i];
+
+        if (url_unreserved[c])
         {
-            if (isalnum((unsigned char)input[i]) || input[i] == '-' || input[i] == '_' || input[i] == '.' || input[i] == '~')
+            if (j + 1 >= dest_size)
             {
-                output[j++] = input[i];
+                break;
             }
-            else
+            dest[j++] = (char)c;
+        }
+        else
+        {
+            if (j + 3 >= dest_size)
             {
-                snprintf(output + j, 4, "%%%02X", (unsigned char)input[i]);
-                j += 3;
+                break;
             }
+            dest[j] = '%';
+            dest[j + 1] = url_hex_digits[c >> 4];
+            dest[j + 2] = url_hex_digits[c & 15];
+            j += 3;
         }
-        output[j] = '\0';
     }
 
-    return output;
+    dest[j] = '\0';
+    return j;
 }
 
-char *url_encode_spaces(char *input)
+RN_API size_t url_encode_spaces_into(const char *input, size_t length, char *dest, size_t dest_size)
 {
     /*
-     * Function  : char *url_encode_spaces(char *input)
-     * Input     : input - pointer to the string containing spaces to be URL-encoded
-     * Output    : Returns a newly allocated URL-encoded string with spaces replaced by "%20"
-     * Procedure : This function URL-encodes the input string, replacing spaces with "%20". The resulting string should be freed by the caller.
+     * Function  : size_t url_encode_spaces_into(const char *input, size_t length, char *dest, size_t dest_size)
+     * Input     : input - pointer to the text containing spaces to be URL-encoded
+     *             length - length of the text
+     *             dest - pointer to the buffer receiving the encoded text (3 * length + 1 bytes always fit)
+     *             dest_size - size of the buffer
+     * Output    : Returns the length of the encoded text
+     * Procedure : This function copies the text into a caller-provided buffer in a single pass, replacing spaces with "%20". The text between two spaces is found with memchr and copied with memcpy. If the buffer is too small the text is cut, never in the middle of a "%20"; it is always null-terminated.
      */
 
-    // Count the number of spaces in the input string
-    int spaceCount = 0;
-    for (int i = 0; input[i] != '\0'; i++)
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < length && j + 1 < dest_size)
     {
-        if (input[i] == ' ')
+        const char *space = memchr(input + i, ' ', length - i);
+        size_t run = (space != NULL ? (size_t)(space - input) : length) - i;
+
+        if (run > dest_size - 1 - j)
         {
-            spaceCount++;
+            run = dest_size - 1 - j;
         }
+        memcpy(dest + j, input + i, run);
+        i += run;
+        j += run;
+
+        if (space == NULL || input + i != space || j + 3 >= dest_size)
+        {
+            break;
+        }
+
+        dest[j] = '%';
+        dest[j + 1] = '2';
+        dest[j + 2] = '0';
+        i++;
+        j += 3;
     }
 
-    // Calculate the length of the new string with "%20"
-    int originalLength = strlen(input);
-    int newLength = originalLength + (spaceCount * 2); // Each space is replaced by "%20"
+    dest[j] = '\0';
+    return j;
+}
+
+RN_API size_t url_decode_into(const char *input, size_t length, char *dest, size_t dest_size)
+{
+    /*
+     * Function  : size_t url_decode_into(const char *input, size_t length, char *dest, size_t dest_size)
+     * Input     : input - pointer to the URL-encoded text
+     *             length - length of the text
+     *             dest - pointer to the buffer receiving the decoded text (length + 1 bytes always fit)
+     *             dest_size - size of the buffer
+     * Output    : Returns the length of the decoded text
+     * Procedure : This function URL-decodes the text into a caller-provided buffer, replacing percent-encoded sequences with their original characters and '+' with a space; a '%' not followed by two hexadecimal digits is copied as is. The text between two escapes is found with find_decode_escape and copied with memcpy, and the digits of an escape are looked up in url_hex_value. The result is truncated to fit and always null-terminated.
+     */
 
-    // Allocate memory for the new string
-    char *newString = (char *)malloc(newLength + 1); // +1 for the null terminator
+    size_t i = 0;
+    size_t j = 0;
 
-    if (newString == NULL)
+    while (i < length && j + 1 < dest_size)
     {
-        // Memory allocation failed
-        return NULL;
-    }
+        size_t next = find_decode_escape(input, length, i);
+        size_t run = next - i;
 
-    // Copy characters from the original string to the new string
-    int newIndex = 0;
-    for (int i = 0; input[i] != '\0'; i++)
-    {
-        if (input[i] == ' ')
+        if (run > dest_size - 1 - j)
+        {
+            run = dest_size - 1 - j;
+        }
+        memcpy(dest + j, input + i, run);
+        i += run;
+        j += run;
+
+        if (i != next || i >= length || j + 1 >= dest_size)
+        {
+            break;
+        }
+
+        if (input[i] == '+')
+        {
+            dest[j++] = ' ';
+            i++;
+        }
+        else if (i + 2 < length && url_hex_value[(unsigned char)input[i + 1]] && url_hex_value[(unsigned char)input[i + 2]])
         {
-            // Replace space with "%20"
-            newString[newIndex++] = '%';
-            newString[newIndex++] = '2';
-            newString[newIndex++] = '0';
+            dest[j++] = hex_to_char(input + i + 1);
+            i += 3;
         }
         else
         {
-            // Copy other characters as-is
-            newString[newIndex++] = input[i];
+            // Invalid encoding, copy as is
+            dest[j++] = input[i++];
         }
     }
 
-    // Add the null terminator at the end of the new string
-    newString[newIndex] = '\0';
+    dest[j] = '\0';
+    return j;
+}
+
+RN_API char *url_encode(const char *input)
+{
+    /*
+     * Function  : char *url_encode(const char *input)
+     * Input     : input - pointer to the string to be URL-encoded
+     * Output    : Returns a newly allocated URL-encoded string
+     * Procedure : This function URL-encodes the input string with url_encode_into, replacing special characters with their percent-encoded equivalents. The resulting string should be freed by the caller.
+     */
+
+    size_t len = strlen(input);
+    char *output = rn_malloc(3 * len + 1); // Maximum possible length for URL encoding
+
+    if (output)
+    {
+        url_encode_into(input, len, output, 3 * len + 1);
+    }
+
+    return output;
+}
+
+RN_API char *url_encode_spaces(char *input)
+{
+    /*
+     * Function  : char *url_encode_spaces(char *input)
+     * Input     : input - pointer to the string containing spaces to be URL-encoded
+     * Output    : Returns a newly allocated URL-encoded string with spaces replaced by "%20"
+     * Procedure : This function URL-encodes the input string with url_encode_spaces_into, replacing spaces with "%20". The resulting string should be freed by the caller; callers that have a buffer at hand should use url_encode_spaces_into directly.
+     */
+
+    size_t len = strlen(input);
+    char *output = rn_malloc(3 * len + 1); // Every byte could be a space
 
-    return newString;
+    if (output)
+    {
+        url_encode_spaces_into(input, len, output, 3 * len + 1);
+    }
+
+    return output;
 }
 
-char *url_decode(const char *input)
+RN_API char *url_decode(const char *input)
 {
     /*
      * Function  : char *url_decode(const char *input)
      * Input     : input - pointer to the URL-encoded string
      * Output    : Returns a newly allocated URL-decoded string
-     * Procedure : This function URL-decodes the input string, replacing percent-encoded sequences with their original characters. The resulting string should be freed by the caller.
+     * Procedure : This function URL-decodes the input string with url_decode_into, replacing percent-encoded sequences with their original characters. The resulting string should be freed by the caller.
      */
 
     size_t len = strlen(input);
-    char *output = malloc(len + 1); // Maximum possible length for URL decoding
+    char *output = rn_malloc(len + 1); // Maximum possible length for URL decoding
 
     if (output)
     {
-        size_t j = 0;
-        for (size_t i = 0; i < len; i++)
-        {
-            if (input[i] == '%')
-            {
-                if (i + 2 < len && isxdigit(input[i + 1]) && isxdigit(input[i + 2]))
-                {
-                    char hex[3];
-                    hex[0] = input[i + 1];
-                    hex[1] = input[i + 2];
-                    hex[2] = '\0';
-                    output[j++] = hex_to_char(hex);
-                    i += 2;
-                }
-                else
-                {
-                    // Invalid encoding, copy as is
-                    output[j++] = input[i];
-                }
-            }
-            else if (input[i] == '+')
-            {
-                output[j++] = ' ';
-            }
-            else
-            {
-                output[j++] = input[i];
-            }
-        }
-        output[j] = '\0';
+        url_decode_into(input, len, output, len + 1);
     }
 
     return output;
 }
 
-char *get_filename_from_url(const char *url)
+RN_API char *get_filename_from_url(const char *url)
 {
     /*
      * Function  : char *get_filename_from_url(const char *url)
@@ -206,19 +347,26 @@ char *get_filename_from_url(const char *url)
     }
 }
 
-char *replace_http(const char *url)
+RN_API char *replace_http(const char *url)
 {
     /*
      * Function  : char *replace_http(const char *url)
      * Input     : url - pointer to the URL to be checked and possibly modified
      * Output    : Returns a newly allocated string containing the modified URL (if replaced)
-     * Procedure : This function checks if the URL starts with "http://" and replaces it with "https://". The resulting string should be freed by the caller.
+     * Procedure : This function checks if the URL starts with "http://" and replaces it with "https://". URLs of a base URL set with ROCKNATION_BASE_URL (a mirror or a local test server, see base_url) are kept as they were given. The resulting string should be freed by the caller.
      */
 
+    const char *base = base_url();
+    size_t base_length = strlen(base);
+    if (strcmp(base, DEFAULT_BASE_URL) != 0 && strncmp(url, base, base_length) == 0 && (url[base_length] == '/' || url[base_length] == '\0'))
+    {
+        return rn_strdup(url);
+    }
+
     // Check if the URL starts with "http://" and replace it with "https://"
     if (strncmp(url, "http://", 7) == 0)
     {
-        char *https_url = (char *)malloc(strlen(url) + 1); // +1 for null terminator
+        char *https_url = (char *)rn_malloc(strlen(url) + 2); // +1 for the extra 's', +1 for null terminator
         if (https_url == NULL)
         {
             return NULL; // Memory allocation failed
@@ -227,5 +375,264 @@ char *replace_http(const char *url)
         strcat(https_url, url + 7); // Skip "http://"
         return https_url;
     }
-    return strdup(url); // Return a copy of the original URL if it doesn't start with "http://"
-}
\ No newline at end of file
+    return rn_strdup(url); // Return a copy of the original URL if it doesn't start with "http://"
+}
+
+// Read once for the whole process, see base_url
+RN_SHARED char rocknation_base_url[MAX_BASE_URL_LENGTH] = "";
+RN_SHARED RnOnce rocknation_base_url_once = RN_ONCE_INIT;
+
+static void read_base_url(void)
+{
+    /* Function  : static void read_base_url(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function reads ROCKNATION_BASE_URL into rocknation_base_url, falling back to DEFAULT_BASE_URL when it isn't set or is too long to build catalog URLs from (MAX_BASE_URL_LENGTH), and drops any trailing '/'.
+     */
+
+    const char *env = getenv("ROCKNATION_BASE_URL");
+    if (env == NULL || env[0] == '\0' || snprintf(rocknation_base_url, sizeof(rocknation_base_url), "%s", env) >= (int)sizeof(rocknation_base_url))
+    {
+        if (env != NULL && env[0] != '\0')
+        {
+            fprintf(stderr, "ROCKNATION_BASE_URL is longer than %d characters, using %s\n", MAX_BASE_URL_LENGTH - 1, DEFAULT_BASE_URL);
+        }
+        snprintf(rocknation_base_url, sizeof(rocknation_base_url), "%s", DEFAULT_BASE_URL);
+    }
+
+    size_t length = strlen(rocknation_base_url);
+    while (length > 0 && rocknation_base_url[length - 1] == '/')
+    {
+        rocknation_base_url[--length] = '\0';
+    }
+}
+
+RN_API const char *base_url(void)
+{
+    /*
+     * Function  : const char *base_url(void)
+     * Input     : None
+     * Output    : Returns the scheme and host every catalog URL is built from, without a trailing '/'
+     * Procedure : This function reads ROCKNATION_BASE_URL once for the whole process (see rn_once), so the catalog can be fetched from a mirror or a local test server, and falls back to DEFAULT_BASE_URL when it isn't set.
+     */
+
+    rn_once(&rocknation_base_url_once, read_base_url);
+    return rocknation_base_url;
+}
+
+RN_API int is_site_url(const char *url)
+{
+    /*
+     * Function  : int is_site_url(const char *url)
+     * Input     : url - pointer to the text to check
+     * Output    : Returns 1 if the text is a rocknation.su URL (or one of the base URL in use), 0 otherwise
+     * Procedure : This function tells URLs given on the command line apart from band names.
+     */
+
+    const char *base = base_url();
+    return strstr(url, "rocknation.su") != NULL || strncmp(url, base, strlen(base)) == 0;
+}
+
+RN_API int init_memory_struct(MemoryStruct *mem)
+{
+    /*
+     * Function  : int init_memory_struct(MemoryStruct *mem)
+     * Input     : mem - pointer to the MemoryStruct structure to initialize
+     * Output    : Returns 0 on success, -1 if the buffer couldn't be allocated
+     * Procedure : This function prepares an empty buffer for a page. It starts at PAGE_BUFFER_SIZE bytes, enough for most catalog pages, and WriteMemoryCallback doubles it when it fills up, so a page costs one allocation and a few reallocations at most instead of one reallocation per received chunk.
+     */
+
+    mem->memory = rn_malloc(PAGE_BUFFER_SIZE);
+    mem->size = 0;
+    mem->capacity = mem->memory != NULL ? PAGE_BUFFER_SIZE : 0;
+
+    if (mem->memory == NULL)
+    {
+        return -1;
+    }
+
+    mem->memory[0] = '\0';
+    return 0;
+}
+
+RN_API size_t span_copy(const char *text, TextSpan span, char *dest, size_t dest_size)
+{
+    /*
+     * Function  : size_t span_copy(const char *text, TextSpan span, char *dest, size_t dest_size)
+     * Input     : text - pointer to the page the span refers to
+     *             span - part of the page to copy
+     *             dest - pointer to the buffer receiving the text
+     *             dest_size - size of the buffer
+     * Output    : Returns the length of the copied text
+     * Procedure : This function copies the text of a span into a caller-provided buffer, truncating it to fit and null-terminating it. Nothing is allocated.
+     */
+
+    size_t length = span.length < dest_size - 1 ? span.length : dest_size - 1;
+
+    memcpy(dest, text + span.offset, length);
+    dest[length] = '\0';
+
+    return length;
+}
+
+RN_API size_t span_decode(const char *text, TextSpan span, char *dest, size_t dest_size)
+{
+    /*
+     * Function  : size_t span_decode(const char *text, TextSpan span, char *dest, size_t dest_size)
+     * Input     : text - pointer to the page the span refers to
+     *             span - part of the page to decode
+     *             dest - pointer to the buffer receiving the decoded text
+     *             dest_size - size of the buffer
+     * Output    : Returns the length of the decoded text
+     * Procedure : This function URL-decodes the text of a span straight into a caller-provided buffer, truncating it to fit and null-terminating it, with url_decode_into. Fields are kept encoded in the page and only decoded when they are needed.
+     */
+
+    return url_decode_into(text + span.offset, span.length, dest, dest_size);
+}
+
+RN_API void init_band_list(BandInfoList *list, Arena *arena)
+{
+    /*
+     * Function  : void init_band_list(BandInfoList *list, Arena *arena)
+     * Input     : list - pointer to the BandInfoList structure to initialize
+     *             arena - pointer to the Arena the bands and their strings are allocated from
+     * Output    : None
+     * Procedure : This function prepares an empty list of bands. Nothing is allocated until a band is appended, and everything is released together with the arena.
+     */
+
+    list->bands = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->arena = arena;
+}
+
+RN_API void init_album_list(AlbumInfoList *list, Arena *arena)
+{
+    /*
+     * Function  : void init_album_list(AlbumInfoList *list, Arena *arena)
+     * Input     : list - pointer to the AlbumInfoList structure to initialize
+     *             arena - pointer to the Arena the albums and their strings are allocated from
+     * Output    : None
+     * Procedure : This function prepares an empty list of albums, see init_band_list.
+     */
+
+    list->albums = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->arena = arena;
+}
+
+RN_API void init_song_list(SongInfoList *list, Arena *arena)
+{
+    /*
+     * Function  : void init_song_list(SongInfoList *list, Arena *arena)
+     * Input     : list - pointer to the SongInfoList structure to initialize
+     *             arena - pointer to the Arena the songs and their strings are allocated from
+     * Output    : None
+     * Procedure : This function prepares an empty list of songs, see init_band_list.
+     */
+
+    list->songs = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->arena = arena;
+}
+
+RN_API void init_song_page(SongPage *page, Arena *arena)
+{
+    /*
+     * Function  : void init_song_page(SongPage *page, Arena *arena)
+     * Input     : page - pointer to the SongPage structure to initialize
+     *             arena - pointer to the Arena the song references are allocated from
+     * Output    : None
+     * Procedure : This function prepares an empty SongPage for get_song_page. The page buffer itself is not part of the arena and is released by free_song_page.
+     */
+
+    page->page.memory = NULL;
+    page->page.size = 0;
+    page->page.capacity = 0;
+    page->songs = NULL;
+    page->count = 0;
+    page->capacity = 0;
+    page->arena = arena;
+}
+
+RN_API BandInfo *append_band(BandInfoList *list)
+{
+    /*
+     * Function  : BandInfo *append_band(BandInfoList *list)
+     * Input     : list - pointer to the BandInfoList structure
+     * Output    : Returns a pointer to the new, zeroed band, or NULL if the arena is out of memory
+     * Procedure : This function adds a band at the end of the list, growing its array in the arena when it is full.
+     */
+
+    BandInfo *bands = arena_reserve(list->arena, list->bands, &list->capacity, list->count, sizeof(BandInfo));
+    if (bands == NULL)
+    {
+        return NULL;
+    }
+
+    list->bands = bands;
+    memset(&bands[list->count], 0, sizeof(BandInfo));
+    return &bands[list->count++];
+}
+
+RN_API AlbumInfo *append_album(AlbumInfoList *list)
+{
+    /*
+     * Function  : AlbumInfo *append_album(AlbumInfoList *list)
+     * Input     : list - pointer to the AlbumInfoList structure
+     * Output    : Returns a pointer to the new, zeroed album, or NULL if the arena is out of memory
+     * Procedure : This function adds an album at the end of the list, see append_band.
+     */
+
+    AlbumInfo *albums = arena_reserve(list->arena, list->albums, &list->capacity, list->count, sizeof(AlbumInfo));
+    if (albums == NULL)
+    {
+        return NULL;
+    }
+
+    list->albums = albums;
+    memset(&albums[list->count], 0, sizeof(AlbumInfo));
+    return &albums[list->count++];
+}
+
+RN_API SongInfo *append_song(SongInfoList *list)
+{
+    /*
+     * Function  : SongInfo *append_song(SongInfoList *list)
+     * Input     : list - pointer to the SongInfoList structure
+     * Output    : Returns a pointer to the new, zeroed song, or NULL if the arena is out of memory
+     * Procedure : This function adds a song at the end of the list, see append_band.
+     */
+
+    SongInfo *songs = arena_reserve(list->arena, list->songs, &list->capacity, list->count, sizeof(SongInfo));
+    if (songs == NULL)
+    {
+        return NULL;
+    }
+
+    list->songs = songs;
+    memset(&songs[list->count], 0, sizeof(SongInfo));
+    return &songs[list->count++];
+}
+
+RN_API SongRef *append_song_ref(SongPage *page)
+{
+    /*
+     * Function  : SongRef *append_song_ref(SongPage *page)
+     * Input     : page - pointer to the SongPage structure
+     * Output    : Returns a pointer to the new, zeroed song reference, or NULL if the arena is out of memory
+     * Procedure : This function adds a song reference at the end of the page, see append_band.
+     */
+
+    SongRef *songs = arena_reserve(page->arena, page->songs, &page->capacity, page->count, sizeof(SongRef));
+    if (songs == NULL)
+    {
+        return NULL;
+    }
+
+    page->songs = songs;
+    memset(&songs[page->count], 0, sizeof(SongRef));
+    return &songs[page->count++];
+}
@@ -6,6 +6,9 @@
 #include "include/rocknation_types.h"
 #include "include/rocknation_utils.h"
 #include "include/rocknation_curl.h"
+#include "include/rocknation_multi.h"
+#include "include/rocknation_crawl.h"
+#include "include/rocknation_mirror.h"
 
 #ifdef _WIN32
 #include <direct.h>
@@ -19,45 +22,116 @@
 
 char program_name[256];
 
+int fileExists(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        fclose(file);
+        return 1;
+    }
+    return 0;
+}
+
 void print_usage()
 {
     puts("[USAGE]");
     printf("%s <option> <argument_to_option>\n", program_name);
     puts("[OPTIONS]");
     puts("\tsearch-band <BAND_NAME>");
-    puts("\tlist-albums <BAND_NAME/BAND_URL>");
-    puts("\t(Not Added yet) list-songs <ALBUM_URL>");
-    puts("\tdownload-song <URL> [OUTPUT_FILE]");
-    puts("\tdownload-album <URL> [OUTPUT_FOLDER]");
+    puts("\tfind-band <BAND_NAME>    Fuzzy search of the bands in the local catalog");
+    puts("\tlist-albums <BAND_NAME/BAND_URL> [--jobs N]");
+    puts("\tlist-songs <ALBUM_URL>");
+    puts("\tdownload-song <URL> [OUTPUT_FILE] [--segments N]");
+    puts("\tdownload-album <URL> [OUTPUT_FOLDER] [--jobs N]");
+    puts("\tmirror-band <BAND_NAME/BAND_URL> [OUTPUT_FOLDER] [--jobs N]    Download every album of a band, one folder per album");
+    puts("\tcrawl <FIRST_BAND_ID> <LAST_BAND_ID> [--jobs N] [--rate R] [--per-host N]    Fill the local catalog with every album and song of a range of bands");
+    puts("[FLAGS]");
+    puts("\t--timings    Print a per-phase timing breakdown of every request");
+    puts("\t--cache-ttl SECONDS    Use cached catalog pages younger than SECONDS without revalidating them");
+    puts("\t--offline    Answer catalog requests from the cache only");
+    puts("\t--no-cache    Don't use the catalog page cache");
+    puts("\t--refresh    Fetch bands, albums and songs from the site even if they are in the local catalog");
+}
+
+void printBand(const BandInfo *band, void *userdata)
+{
+    (void)userdata;
+    printf("[*]: %s\n\tGenre: %s\n\tUrl: %s\n-----\n", band->name, band->genre, band->url);
+    fflush(stdout);
 }
 
 void searchAndPrintBands(const char *searchQuery)
 {
     printf("Searching '%s'...\n", searchQuery);
+    fflush(stdout);
 
+    // Bands are printed as soon as they are parsed, while the page is still downloading
+    Arena arena;
+    arena_init(&arena, ARENA_BLOCK_SIZE);
     BandInfoList bandList;
-    search_band(searchQuery, &bandList);
+    init_band_list(&bandList, &arena);
+    search_band_streaming(searchQuery, &bandList, printBand, NULL);
 
-    if (bandList.count > 0)
+    if (bandList.count == 0)
     {
-        for (int i = 0; i < bandList.count; i++)
+        printf("[!] No search results for the query '%s'.\n", searchQuery);
+
+        // The site only finds exact names; a typo may still be close to a band seen before
+        if (store_fuzzy_search(searchQuery, 5, &bandList) > 0)
         {
-            printf("[*]: %s\n\tGenre: %s\n\tUrl: %s\n-----\n", bandList.bands[i].name, bandList.bands[i].genre, bandList.bands[i].url);
+            puts("Did you mean:");
+            for (int i = 0; i < bandList.count; i++)
+            {
+                printBand(&bandList.bands[i], NULL);
+            }
         }
     }
-    else
+
+    arena_free(&arena);
+}
+
+void findAndPrintBands(const char *searchQuery)
+{
+    Arena arena;
+    arena_init(&arena, ARENA_BLOCK_SIZE);
+    BandInfoList bandList;
+    init_band_list(&bandList, &arena);
+
+    if (store_fuzzy_search(searchQuery, 10, &bandList) <= 0)
     {
-        printf("[!] No search results for the query '%s'.\n", searchQuery);
+        printf("[!] No known band matches '%s'. Bands are known once a search has found them.\n", searchQuery);
     }
+
+    for (int i = 0; i < bandList.count; i++)
+    {
+        printBand(&bandList.bands[i], NULL);
+    }
+
+    arena_free(&arena);
 }
 
-void listAndPrintAlbums(const char *band)
+void listAndPrintAlbums(const char *band, int jobs)
 {
+    Arena arena;
+    arena_init(&arena, ARENA_BLOCK_SIZE);
     AlbumInfoList albumList;
+    init_album_list(&albumList, &arena);
 
-    if (strstr("rocknation.su", band) != NULL)
+    if (is_site_url(band))
+    {
+        if (jobs > 1)
+        {
+            get_albums_parallel(band, &albumList, jobs);
+        }
+        else
+        {
+            get_albums(band, &albumList);
+        }
+    }
+    else if (jobs > 1)
     {
-        get_albums(band, &albumList);
+        get_albums_by_name_parallel(band, &albumList, jobs);
     }
     else
     {
@@ -75,96 +149,325 @@ void listAndPrintAlbums(const char *band)
     {
         printf("[!] No album found for that band.\n");
     }
+
+    arena_free(&arena);
+}
+
+void printSong(const SongInfo *song, void *userdata)
+{
+    (void)userdata;
+    printf("Name: %s\nAlbum: %s\nArtist: %s\nYear: %s\nUrl: %s\n-----\n", song->name, song->album, song->artist, song->year, song->url);
+    fflush(stdout);
 }
 
 void listAndPrintSongs(const char *album_url)
 {
+    Arena arena;
+    arena_init(&arena, ARENA_BLOCK_SIZE);
     SongInfoList song_list;
+    init_song_list(&song_list, &arena);
 
-    if (strstr("rocknation.su", album_url) != NULL)
+    if (!is_site_url(album_url))
     {
         puts("That doesn't seems like a valid url");
     }
     else
     {
-        get_songs(album_url, &song_list);
-
-        printf("%s\n", song_list.songs[0].name);
+        // Songs are printed as soon as they are parsed, while the page is still downloading
+        get_songs_streaming(album_url, &song_list, printSong, NULL);
 
-        if (song_list.count > 0)
-        {
-            for (int i = 0; i < song_list.count; i++)
-            {
-                printf("Name: %s\nAlbum: %s\nArtist: %s\nYear: %s\nUrl: %s\n-----\n", song_list.songs[i].name, song_list.songs[i].album, song_list.songs[i].artist, song_list.songs[i].year, song_list.songs[i].url);
-            }
-        }
-        else
+        if (song_list.count == 0)
         {
             printf("OOPS!\nWe couldn't fetch that album.\n");
         }
     }
+
+    arena_free(&arena);
 }
 
 void downloadSong(const char *songUrl, const char *outputFile)
 {
-    char *encodedUrl = url_encode_spaces(songUrl);
+    char encodedUrl[3 * MAX_URL_LENGTH];
+    url_encode_spaces_into(songUrl, strlen(songUrl), encodedUrl, sizeof(encodedUrl));
     download_file(encodedUrl, outputFile);
-    free(encodedUrl);
 }
 
-void downloadAlbum(const char *albumUrl, const char *outputFolder)
+void downloadSongSegmented(const char *songUrl, const char *outputFile, int segments)
+{
+    char encodedUrl[3 * MAX_URL_LENGTH];
+    url_encode_spaces_into(songUrl, strlen(songUrl), encodedUrl, sizeof(encodedUrl));
+    download_file_segmented(encodedUrl, outputFile, segments);
+}
+
+void downloadAlbumParallel(SongPage *songPage, const char *outputFolder, int jobs)
+{
+#ifdef _WIN32
+    _mkdir(outputFolder);
+#else
+    mkdir(outputFolder, 0777);
+#endif
+
+    // One slot per song of the page, released with the arena of the page
+    DownloadJob *downloadJobs = arena_alloc(songPage->arena, songPage->count * sizeof(*downloadJobs));
+    char (*outputFilePaths)[256] = arena_alloc(songPage->arena, songPage->count * sizeof(*outputFilePaths));
+    char (*songNames)[MAX_SONG_NAME_LENGTH] = arena_alloc(songPage->arena, songPage->count * sizeof(*songNames));
+
+    if (downloadJobs == NULL || outputFilePaths == NULL || songNames == NULL)
+    {
+        fprintf(stderr, "Not enough memory to download the album\n");
+        return;
+    }
+
+    int jobCount = 0;
+    int skipped = 0;
+    int notStarted = 0;
+
+    for (int i = 0; i < songPage->count; i++)
+    {
+        SongRef *song = &songPage->songs[i];
+
+        span_decode(songPage->page.memory, song->name, songNames[jobCount], sizeof(songNames[jobCount]));
+
+        // A cut path could be another song's, so the song is left out and counted as failed
+        if (snprintf(outputFilePaths[jobCount], sizeof(outputFilePaths[jobCount]), "%s/%s", outputFolder, songNames[jobCount]) >= (int)sizeof(outputFilePaths[jobCount]))
+        {
+            printf("[!] Path too long for %s in %s\n", songNames[jobCount], outputFolder);
+            notStarted++;
+            continue;
+        }
+
+        // Files only get their final name once complete, so these are done already
+        if (fileExists(outputFilePaths[jobCount]))
+        {
+            printf("[?] Already downloaded: %s\n", outputFilePaths[jobCount]);
+            skipped++;
+            continue;
+        }
+
+        // Encoded straight from the page into the arena
+        size_t encodedSize = 3 * song->url.length + 1;
+        char *encodedUrl = arena_alloc(songPage->arena, encodedSize);
+        if (encodedUrl == NULL)
+        {
+            fprintf(stderr, "Not enough memory to download the album\n");
+            notStarted += songPage->count - i;
+            break;
+        }
+        url_encode_spaces_into(songPage->page.memory + song->url.offset, song->url.length, encodedUrl, encodedSize);
+
+        downloadJobs[jobCount].url = encodedUrl;
+        downloadJobs[jobCount].output_file = outputFilePaths[jobCount];
+        downloadJobs[jobCount].label = songNames[jobCount];
+        jobCount++;
+    }
+
+    int failed = download_files_parallel(downloadJobs, jobCount, jobs);
+    printf("[?] %d/%d songs downloaded, %d already there, %d failed.\n", jobCount - failed, songPage->count, skipped, failed + notStarted);
+}
+
+void downloadAlbum(const char *albumUrl, const char *outputFolder, int jobs)
 {
     printf("Hang on, we're downloading album\n");
 
-    SongInfoList songList;
-    get_songs(albumUrl, &songList);
+    // Fields stay in the album page and are only copied out for the song being downloaded
+    Arena arena;
+    arena_init(&arena, ARENA_BLOCK_SIZE);
+    SongPage songPage;
+    init_song_page(&songPage, &arena);
+    get_song_page(albumUrl, &songPage);
 
-    if (songList.count > 0)
+    if (songPage.count > 0 && outputFolder != NULL && jobs > 1)
+    {
+        downloadAlbumParallel(&songPage, outputFolder, jobs);
+    }
+    else if (songPage.count > 0)
     {
-        for (int i = 0; i < songList.count; i++)
+        // Created once for the whole album rather than before every song
+        if (outputFolder != NULL)
         {
-            printf("[?] Downloading...\n\t[*] Name: %s\n\t[*] Album: %s\n\t[*] Artist: %s\n-----\n", songList.songs[i].name, songList.songs[i].album, songList.songs[i].artist);
+            if (mkdir(outputFolder, 0777) == 0)
+            {
+                printf("[?] Seems like directory didn't exist yet, so we created it.\n");
+            }
+            else if (errno != EEXIST)
+            {
+                printf("[!] Error creating the directory.\n");
+            }
+        }
+
+        for (int i = 0; i < songPage.count; i++)
+        {
+            SongRef *song = &songPage.songs[i];
+            char songName[MAX_SONG_NAME_LENGTH];
+            char album[MAX_NAME_LENGTH];
+            char artist[MAX_NAME_LENGTH];
+
+            span_decode(songPage.page.memory, song->name, songName, sizeof(songName));
+            span_copy(songPage.page.memory, song->album, album, sizeof(album));
+            span_copy(songPage.page.memory, song->artist, artist, sizeof(artist));
+
+            printf("[?] Downloading...\n\t[*] Name: %s\n\t[*] Album: %s\n\t[*] Artist: %s\n-----\n", songName, album, artist);
 
             if (outputFolder != NULL)
             {
-#ifdef _WIN32
-                if (_mkdir(outputFolder) == 0)
-                {
-                    printf("[?] Seems like directory didn't exist yet, so we created it.\n");
-                }
-                else
+                char outputFilePath[256];
+                if (snprintf(outputFilePath, sizeof(outputFilePath), "%s/%s", outputFolder, songName) >= (int)sizeof(outputFilePath))
                 {
-                    printf("[!] Error creating the directory.\n");
+                    printf("[!] Path too long for %s in %s\n", songName, outputFolder);
+                    continue;
                 }
-#else
-                if (mkdir(outputFolder, 0777) == 0)
-                {
-                    printf("[?] Seems like directory didn't exist yet, so we created it.\n");
-                }
-                else
+
+                // Files only get their final name once complete, so this one is done already
+                if (fileExists(outputFilePath))
                 {
-                    printf("[!] Error creating the directory.\n");
+                    printf("[?] Already downloaded: %s\n", outputFilePath);
+                    continue;
                 }
-#endif
 
-                char outputFilePath[256] = "";
-                strcat(outputFilePath, outputFolder);
-                strcat(outputFilePath, "/");
-                strcat(outputFilePath, songList.songs[i].name);
-                downloadSong(songList.songs[i].url, outputFilePath);
+                char songUrl[MAX_URL_LENGTH];
+                span_copy(songPage.page.memory, song->url, songUrl, sizeof(songUrl));
+                downloadSong(songUrl, outputFilePath);
             }
             else
             {
                 print_usage();
-                return;
+                break;
             }
         }
     }
+
+    free_song_page(&songPage);
+    arena_free(&arena);
+}
+
+typedef struct
+{
+    int jobs;     // --jobs N: concurrent transfers (download-album and mirror-band tracks, list-albums pages)
+    int timings;  // --timings: print a per-phase timing breakdown of every request
+    int segments; // --segments N: byte ranges fetched in parallel by download-song
+    int cache;    // --no-cache: don't use the response cache for catalog pages
+    long ttl;     // --cache-ttl SECONDS: use cached catalog pages without revalidating them
+    int offline;  // --offline: answer catalog requests from the cache only
+    int refresh;  // --refresh: don't answer searches and listings from the local catalog store
+    double rate;  // --rate R: requests started per second by crawl
+    int per_host; // --per-host N: requests in flight to the same host during a crawl
+} CliOptions;
+
+void removeArguments(int *argc, char *argv[], int index, int count)
+{
+    // Shift the remaining arguments down so positional arguments keep their place
+    for (int j = index; j + count < *argc; j++)
+    {
+        argv[j] = argv[j + count];
+    }
+    *argc -= count;
+}
+
+CliOptions parseOptions(int *argc, char *argv[])
+{
+    CliOptions options = {1, 0, 1, 1, 0, 0, 0, CRAWL_RATE, CRAWL_PER_HOST};
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < *argc)
+        {
+            options.jobs = atoi(argv[i + 1]);
+            removeArguments(argc, argv, i, 2);
+            i--;
+        }
+        else if (strcmp(argv[i], "--segments") == 0 && i + 1 < *argc)
+        {
+            options.segments = atoi(argv[i + 1]);
+            removeArguments(argc, argv, i, 2);
+            i--;
+        }
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < *argc)
+        {
+            options.rate = atof(argv[i + 1]);
+            removeArguments(argc, argv, i, 2);
+            i--;
+        }
+        else if (strcmp(argv[i], "--per-host") == 0 && i + 1 < *argc)
+        {
+            options.per_host = atoi(argv[i + 1]);
+            removeArguments(argc, argv, i, 2);
+            i--;
+        }
+        else if (strcmp(argv[i], "--cache-ttl") == 0 && i + 1 < *argc)
+        {
+            options.ttl = atol(argv[i + 1]);
+            removeArguments(argc, argv, i, 2);
+            i--;
+        }
+        else if (strcmp(argv[i], "--timings") == 0)
+        {
+            options.timings = 1;
+            removeArguments(argc, argv, i, 1);
+            i--;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0)
+        {
+            options.cache = 0;
+            removeArguments(argc, argv, i, 1);
+            i--;
+        }
+        else if (strcmp(argv[i], "--offline") == 0)
+        {
+            options.offline = 1;
+            removeArguments(argc, argv, i, 1);
+            i--;
+        }
+        else if (strcmp(argv[i], "--refresh") == 0)
+        {
+            options.refresh = 1;
+            removeArguments(argc, argv, i, 1);
+            i--;
+        }
+    }
+
+    if (options.jobs < 1)
+    {
+        options.jobs = 1;
+    }
+
+    return options;
+}
+
+int crawlCatalog(int firstId, int lastId, const CliOptions *options)
+{
+    if (firstId < 1 || lastId < firstId)
+    {
+        printf("Invalid band id range: %d-%d\n", firstId, lastId);
+        return -1;
+    }
+
+    CrawlOptions crawlOptions = {options->jobs, options->per_host, options->rate, CRAWL_BURST};
+    printf("Crawling bands %d-%d (%d jobs, %d per host, %.1f requests/s)...\n", firstId, lastId,
+           crawlOptions.jobs, crawlOptions.per_host, crawlOptions.rate);
+    fflush(stdout);
+
+    return crawl_catalog(firstId, lastId, &crawlOptions);
+}
+
+int mirrorBand(const char *band, const char *outputFolder, int jobs)
+{
+    printf("Hang on, we're mirroring '%s' into %s (%d downloads at a time)\n", band, outputFolder, jobs);
+    fflush(stdout);
+
+    return mirror_band(band, outputFolder, jobs);
 }
 
 int main(int argc, char *argv[])
 {
-    strncpy(program_name, argv[0], strlen(argv[0]) + 1);
+    snprintf(program_name, sizeof(program_name), "%s", argv[0]);
+
+    CliOptions options = parseOptions(&argc, argv);
+    get_session()->timings = options.timings;
+    rocknation_cache.enabled = options.cache || options.offline;
+    rocknation_cache.ttl = options.ttl;
+    rocknation_cache.offline = options.offline;
+    rocknation_store.refresh = options.refresh;
+    rocknation_names.refresh = options.refresh;
 
     if (argc < 2)
     {
@@ -183,6 +486,17 @@ int main(int argc, char *argv[])
 
         searchAndPrintBands(argv[2]);
     }
+    else if (strcmp(argv[1], "find-band") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("Missing band Name.\n");
+            print_usage();
+            return 1;
+        }
+
+        findAndPrintBands(argv[2]);
+    }
     else if (strcmp(argv[1], "list-albums") == 0)
     {
         if (argc < 3)
@@ -191,7 +505,7 @@ int main(int argc, char *argv[])
             print_usage();
             return 1;
         }
-        listAndPrintAlbums(argv[2]);
+        listAndPrintAlbums(argv[2], options.jobs);
     }
     else if (strcmp(argv[1], "list-songs") == 0)
     {
@@ -212,7 +526,14 @@ int main(int argc, char *argv[])
             return 1;
         }
         const char *outputFile = (argc >= 4) ? argv[3] : NULL;
-        downloadSong(argv[2], outputFile);
+        if (options.segments > 1)
+        {
+            downloadSongSegmented(argv[2], outputFile, options.segments);
+        }
+        else
+        {
+            downloadSong(argv[2], outputFile);
+        }
     }
     else if (strcmp(argv[1], "download-album") == 0)
     {
@@ -223,7 +544,38 @@ int main(int argc, char *argv[])
             return 1;
         }
         const char *outputFolder = (argc >= 4) ? argv[3] : NULL;
-        downloadAlbum(argv[2], outputFolder);
+        downloadAlbum(argv[2], outputFolder, options.jobs);
+    }
+    else if (strcmp(argv[1], "mirror-band") == 0)
+    {
+        if (argc < 3)
+        {
+            printf("Missing band Name/URL.\n");
+            print_usage();
+            return 1;
+        }
+        if (options.offline)
+        {
+            printf("Mirroring needs the network, drop --offline.\n");
+            return 1;
+        }
+        const char *outputFolder = (argc >= 4) ? argv[3] : ".";
+        return mirrorBand(argv[2], outputFolder, options.jobs) == 0 ? 0 : 1;
+    }
+    else if (strcmp(argv[1], "crawl") == 0)
+    {
+        if (argc < 4)
+        {
+            printf("Missing band id range.\n");
+            print_usage();
+            return 1;
+        }
+        if (options.offline)
+        {
+            printf("Crawling needs the network, drop --offline.\n");
+            return 1;
+        }
+        return crawlCatalog(atoi(argv[2]), atoi(argv[3]), &options) == 0 ? 0 : 1;
     }
     else
     {
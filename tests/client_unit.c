@@ -0,0 +1,50 @@
+// client_unit.c
+// Second translation unit of test_client_threads.c. It includes the library again, so the test can check
+// that both see the same process-wide state, and looks bands, albums and songs up through the rn_*
+// functions, with clients created in the other translation unit.
+#include "client_unit.h"
+
+void unit_shared_objects(const void *objects[SHARED_OBJECTS])
+{
+    /*
+     * Function  : void unit_shared_objects(const void *objects[SHARED_OBJECTS])
+     * Input     : objects - array receiving the addresses
+     * Output    : None
+     * Procedure : This function is shared_objects as this translation unit sees them.
+     */
+
+    shared_objects(objects);
+}
+
+void unit_lookup(RocknationClient *client, LookupResult *result)
+{
+    /*
+     * Function  : void unit_lookup(RocknationClient *client, LookupResult *result)
+     * Input     : client - pointer to the client making the requests
+     *             result - pointer to the LookupResult to fill
+     * Output    : None
+     * Procedure : This function searches LOOKUP_TEXT, lists the albums of the first band found and the songs of its first album through the rn_* functions, and records what was found.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList bands;
+    AlbumInfoList albums;
+    SongInfoList songs;
+    init_band_list(&bands, &arena);
+    init_album_list(&albums, &arena);
+    init_song_list(&songs, &arena);
+
+    rn_search_band(client, LOOKUP_TEXT, &bands);
+    if (bands.count > 0)
+    {
+        rn_get_albums(client, bands.bands[0].url, &albums);
+    }
+    if (albums.count > 0)
+    {
+        rn_get_songs(client, albums.albums[0].url, &songs);
+    }
+
+    hash_lookup(&bands, &albums, &songs, result);
+    arena_free(&arena);
+}
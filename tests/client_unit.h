@@ -0,0 +1,87 @@
+// client_unit.h
+// What test_client_threads.c and client_unit.c, a second translation unit including the library, share:
+// the results of a lookup, and what each of them sees of the state shared by the whole process.
+#pragma once
+#include "../include/rocknation_client.h"
+
+#define SHARED_OBJECTS 5
+#define LOOKUP_TEXT "metal"
+
+typedef struct
+{
+    int bands;
+    int albums;
+    int songs;
+    unsigned long hash; // Of every URL and name found, see hash_lookup
+} LookupResult;
+
+void unit_shared_objects(const void *objects[SHARED_OBJECTS]);
+void unit_lookup(RocknationClient *client, LookupResult *result);
+
+static void hash_text_into(unsigned long *hash, const char *text);
+static void hash_lookup(const BandInfoList *bands, const AlbumInfoList *albums, const SongInfoList *songs, LookupResult *result);
+static void shared_objects(const void *objects[SHARED_OBJECTS]);
+
+static void hash_text_into(unsigned long *hash, const char *text)
+{
+    /* Function  : static void hash_text_into(unsigned long *hash, const char *text)
+     * Input     : hash - pointer to the hash to update
+     *             text - pointer to the text to mix in, or NULL
+     * Output    : None
+     * Procedure : This function mixes a text into a hash (djb2), so the results of two lookups can be compared by one number.
+     */
+
+    while (text != NULL && *text != '\0')
+    {
+        *hash = *hash * 33 + (unsigned char)*text++;
+    }
+    *hash = *hash * 33;
+}
+
+static void hash_lookup(const BandInfoList *bands, const AlbumInfoList *albums, const SongInfoList *songs, LookupResult *result)
+{
+    /* Function  : static void hash_lookup(const BandInfoList *bands, const AlbumInfoList *albums, const SongInfoList *songs, LookupResult *result)
+     * Input     : bands - pointer to the bands found by a search
+     *             albums - pointer to the albums of the first band
+     *             songs - pointer to the songs of the first album
+     *             result - pointer to the LookupResult to fill
+     * Output    : None
+     * Procedure : This function records the size of every list and the hash of every URL and name in them.
+     */
+
+    result->bands = bands->count;
+    result->albums = albums->count;
+    result->songs = songs->count;
+    result->hash = 5381;
+
+    for (int i = 0; i < bands->count; i++)
+    {
+        hash_text_into(&result->hash, bands->bands[i].url);
+        hash_text_into(&result->hash, bands->bands[i].name);
+    }
+    for (int i = 0; i < albums->count; i++)
+    {
+        hash_text_into(&result->hash, albums->albums[i].url);
+        hash_text_into(&result->hash, albums->albums[i].name);
+    }
+    for (int i = 0; i < songs->count; i++)
+    {
+        hash_text_into(&result->hash, songs->songs[i].url);
+        hash_text_into(&result->hash, songs->songs[i].name);
+    }
+}
+
+static void shared_objects(const void *objects[SHARED_OBJECTS])
+{
+    /* Function  : static void shared_objects(const void *objects[SHARED_OBJECTS])
+     * Input     : objects - array receiving the addresses
+     * Output    : None
+     * Procedure : This function gives the addresses of what the library shares across the whole process (see RN_SHARED), as the translation unit it is compiled in sees them.
+     */
+
+    objects[0] = &rocknation_curl_once;
+    objects[1] = get_pool();
+    objects[2] = get_disk_writer();
+    objects[3] = base_url();
+    objects[4] = &rocknation_alloc;
+}
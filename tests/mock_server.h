@@ -0,0 +1,769 @@
+// mock_server.h
+// Local HTTP server for the tests that go through the network code. One thread answers the GET and POST
+// requests of any number of keep-alive connections on 127.0.0.1, with the pages a route function picks, so
+// catalog requests can be pointed at it through ROCKNATION_BASE_URL. A route can also answer that the server
+// is busy, or that it failed. A paced server sends the bodies in pieces, a few connections at a time, like a slow server feeding
+// many downloads. The server counts the requests it answered, the connections it accepted and the most it had open at once,
+// and the bytes of body it sent. A request with a Range header gets that range of the page, like a file server
+// would, unless the server is told to ignore ranges. A server told to send ETags answers pages whole, each with
+// an ETag of its contents, and a request whose If-None-Match matches it with 304. A server given a gzip route
+// answers the requests accepting gzip with the compressed page it picks, when it has one, and counts them.
+//
+// route_fixture answers like the site with the fixture pages; tests answering some requests their own way
+// handle those first and hand the rest to it. same_albums and same_songs compare what a lookup gave with what
+// the pages hold.
+#pragma once
+#include "../include/rocknation_platform.h"
+#include "../include/rocknation_types.h"
+#include "test_util.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MOCK_MAX_CONNECTIONS 4096
+#define MOCK_REQUEST_SIZE 8192
+
+// Picks the body answering a request, and its size; NULL answers 404, MOCK_BUSY 503 and MOCK_ERROR 500
+typedef const char *(*MockRoute)(const char *method, const char *path, size_t *size, void *userdata);
+
+// Answer of a route for a server shedding load: 503 with Retry-After: 1
+static const char mock_busy[] = "";
+#define MOCK_BUSY mock_busy
+
+// Answer of a route for a server failing: 500
+static const char mock_error[] = "";
+#define MOCK_ERROR mock_error
+
+// Fixture pages answered by route_fixture; a NULL page answers 404
+typedef struct
+{
+    char *search;
+    size_t search_size;
+    char *discography;
+    size_t discography_size;
+    char *album;
+    size_t album_size;
+} FixturePages;
+
+typedef struct
+{
+    int fd;
+    size_t used;                      // Bytes of request read and not answered yet
+    const char *pending;              // Rest of the body being paced out
+    size_t left;                      // Bytes of it not sent yet
+    char request[MOCK_REQUEST_SIZE];
+} MockConnection;
+
+typedef struct
+{
+    int listen_fd;
+    int wake_fds[2];                  // Written by mock_server_stop to end the thread
+    int port;
+    MockRoute route;
+    void *userdata;
+    RnThread thread;
+    MockConnection *connections;
+    int count;
+    long requests;                    // Requests answered, updated atomically
+    long accepted;                    // Connections accepted, updated atomically
+    long peak;                        // Most connections open at once, updated atomically
+    long sent;                        // Bytes of body answered, updated atomically
+    long ignore_ranges;               // Set to answer every request whole, read atomically
+    long etags;                       // Set to send ETags and answer If-None-Match, read atomically
+    MockRoute gzip_route;             // Picks the gzip page answering a request accepting gzip, NULL for none, read atomically
+    long gzip_accepted;               // Requests accepting gzip, updated atomically
+    size_t piece;                     // Bytes of a paced piece, 0 to send bodies whole
+    int pieces_per_ms;                // Pieces sent per millisecond by a paced server
+    int next;                         // Connection getting the next piece
+    long pieces;                      // Pieces sent since paced
+    double paced_since;               // Time the current run of pieces started, from rn_clock
+} MockServer;
+
+static int mock_send(int fd, const char *data, size_t size);
+static int mock_answer(MockServer *server, MockConnection *connection);
+static void mock_pace(MockServer *server);
+static void mock_server_main(void *argument);
+static int mock_server_start(MockServer *server, MockRoute route, void *userdata);
+static int mock_server_start_paced(MockServer *server, MockRoute route, void *userdata, size_t piece, int pieces_per_ms);
+static void mock_server_stop(MockServer *server);
+static long mock_requests(MockServer *server);
+static long mock_accepted(MockServer *server);
+static long mock_peak(MockServer *server);
+static long mock_sent(MockServer *server);
+static void mock_ignore_ranges(MockServer *server, int ignore);
+static void mock_send_etags(MockServer *server, int send);
+static void mock_serve_gzip(MockServer *server, MockRoute gzip_route);
+static long mock_gzip_accepted(MockServer *server);
+static int mock_accepts_gzip(const char *request, const char *end);
+static void mock_etag(const char *request, const char *end, const char **body, size_t *size, char *status, size_t status_size);
+static int mock_range(const char *request, const char *end, const char **body, size_t *size, char *status, size_t status_size);
+static int load_fixture_pages(FixturePages *pages);
+static void free_fixture_pages(FixturePages *pages);
+static const char *route_fixture(const char *method, const char *path, size_t *size, void *userdata);
+static int same_albums(const AlbumInfoList *a, const AlbumInfoList *b);
+static int same_songs(const SongInfoList *a, const SongInfoList *b);
+
+static int mock_send(int fd, const char *data, size_t size)
+{
+    /* Function  : static int mock_send(int fd, const char *data, size_t size)
+     * Input     : fd - connected socket
+     *             data - pointer to the bytes to send
+     *             size - number of bytes
+     * Output    : Returns 0 once everything is sent, -1 if the peer went away
+     * Procedure : This function sends a whole buffer, however many calls it takes.
+     */
+
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return -1;
+        }
+        data += sent;
+        size -= (size_t)sent;
+    }
+
+    return 0;
+}
+
+static int mock_answer(MockServer *server, MockConnection *connection)
+{
+    /* Function  : static int mock_answer(MockServer *server, MockConnection *connection)
+     * Input     : server - pointer to the MockServer
+     *             connection - pointer to a connection that has just received data
+     * Output    : Returns 0 to keep the connection, -1 to close it
+     * Procedure : This function answers every complete request read so far on the connection (headers, and a body of Content-Length bytes), in order, and keeps what is left of the next one. A page asked for with a Range header gets only that range (see mock_range), unless the server sends ETags (see mock_etag). A request accepting gzip gets the page the gzip route picks, if any, with Content-Encoding: gzip. A paced server only sends the headers and leaves the body to mock_pace; the next request waits until it is out.
+     */
+
+    while (connection->left == 0)
+    {
+        connection->request[connection->used] = '\0';
+        char *end = strstr(connection->request, "\r\n\r\n");
+        if (end == NULL)
+        {
+            return connection->used < MOCK_REQUEST_SIZE - 1 ? 0 : -1;
+        }
+
+        size_t length = (size_t)(end + 4 - connection->request);
+        const char *content_length = strstr(connection->request, "Content-Length:");
+        if (content_length != NULL && content_length < end)
+        {
+            length += strtoul(content_length + 15, NULL, 10);
+        }
+        if (length >= MOCK_REQUEST_SIZE)
+        {
+            return -1;
+        }
+        if (connection->used < length)
+        {
+            return 0;
+        }
+
+        char method[16];
+        char path[1024];
+        if (sscanf(connection->request, "%15s %1023s", method, path) != 2)
+        {
+            return -1;
+        }
+
+        size_t size = 0;
+        char answer_status[128];
+        const char *body = NULL;
+        MockRoute gzip_route = RN_ATOMIC_LOAD(server->gzip_route);
+        int gzip = mock_accepts_gzip(connection->request, end);
+
+        if (gzip)
+        {
+            RN_ATOMIC_ADD(server->gzip_accepted, 1);
+        }
+        int encoded = gzip && gzip_route != NULL && (body = gzip_route(method, path, &size, server->userdata)) != NULL;
+        if (!encoded)
+        {
+            body = server->route(method, path, &size, server->userdata);
+        }
+        const char *status = body == MOCK_BUSY    ? "503 Service Unavailable\r\nRetry-After: 1"
+                             : body == MOCK_ERROR ? "500 Internal Server Error"
+                             : body != NULL       ? "200 OK"
+                                                  : "404 Not Found";
+        if (body == MOCK_BUSY || body == MOCK_ERROR)
+        {
+            body = NULL;
+        }
+        else if (encoded)
+        {
+            status = "200 OK\r\nContent-Encoding: gzip";
+        }
+        else if (body != NULL && RN_ATOMIC_LOAD(server->etags))
+        {
+            mock_etag(connection->request, end, &body, &size, answer_status, sizeof(answer_status));
+            status = answer_status;
+        }
+        else if (body != NULL && !RN_ATOMIC_LOAD(server->ignore_ranges) &&
+                 mock_range(connection->request, end, &body, &size, answer_status, sizeof(answer_status)))
+        {
+            status = answer_status;
+        }
+
+        char header[256];
+        int header_size = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: text/html\r\nContent-Length: %zu\r\n\r\n",
+                                   status, body != NULL ? size : 0);
+
+        // Counted before the client sees the answer, so a test finds its request counted once it is done
+        RN_ATOMIC_ADD(server->requests, 1);
+        if (body != NULL)
+        {
+            RN_ATOMIC_ADD(server->sent, (long)size);
+        }
+        if (mock_send(connection->fd, header, (size_t)header_size) != 0)
+        {
+            return -1;
+        }
+        if (body != NULL && server->piece > 0)
+        {
+            connection->pending = body;
+            connection->left = size;
+        }
+        else if (body != NULL && mock_send(connection->fd, body, size) != 0)
+        {
+            return -1;
+        }
+
+        memmove(connection->request, connection->request + length, connection->used - length);
+        connection->used -= length;
+    }
+
+    return 0;
+}
+
+static int mock_range(const char *request, const char *end, const char **body, size_t *size, char *status, size_t status_size)
+{
+    /* Function  : static int mock_range(const char *request, const char *end, const char **body, size_t *size, char *status, size_t status_size)
+     * Input     : request - pointer to the request
+     *             end - pointer to the end of its headers
+     *             body - pointer to the page answering it, replaced by the range of it to send
+     *             size - pointer to the size of the page, replaced by the size of the range
+     *             status - buffer receiving the status line and Content-Range header of the answer
+     *             status_size - size of the buffer
+     * Output    : Returns 1 if the request asks for a range and the answer was replaced, 0 otherwise
+     * Procedure : This function answers a "Range: bytes=a-" or "Range: bytes=a-b" header like a file server: 206 with the bytes from a to b (or to the end of the page), and their Content-Range, or 416 with the size of the page in Content-Range and no body when a is past its end.
+     */
+
+    const char *range = strstr(request, "\r\nRange: bytes=");
+    unsigned long long first;
+    unsigned long long last = *size > 0 ? *size - 1 : 0;
+
+    if (range == NULL || range > end || sscanf(range + 15, "%llu", &first) != 1)
+    {
+        return 0;
+    }
+
+    const char *dash = strchr(range + 15, '-');
+    if (dash != NULL && dash < end && isdigit((unsigned char)dash[1]))
+    {
+        unsigned long long asked = strtoull(dash + 1, NULL, 10);
+        last = asked < last ? asked : last;
+    }
+
+    if (first >= *size || first > last)
+    {
+        snprintf(status, status_size, "416 Range Not Satisfiable\r\nContent-Range: bytes */%zu", *size);
+        *body = NULL;
+        *size = 0;
+        return 1;
+    }
+
+    snprintf(status, status_size, "206 Partial Content\r\nContent-Range: bytes %llu-%llu/%zu", first, last, *size);
+    *body += first;
+    *size = (size_t)(last - first + 1);
+
+    return 1;
+}
+
+static void mock_etag(const char *request, const char *end, const char **body, size_t *size, char *status, size_t status_size)
+{
+    /* Function  : static void mock_etag(const char *request, const char *end, const char **body, size_t *size, char *status, size_t status_size)
+     * Input     : request - pointer to the request
+     *             end - pointer to the end of its headers
+     *             body - pointer to the page answering it, set to NULL when it isn't sent
+     *             size - pointer to the size of the page, set to 0 when it isn't sent
+     *             status - buffer receiving the status line and ETag header of the answer
+     *             status_size - size of the buffer
+     * Output    : None
+     * Procedure : This function tags the page with a hash of its contents (FNV-1a), so a page changed by the route gets a new ETag. A request sending the same ETag back in If-None-Match is answered "304 Not Modified" without the page.
+     */
+
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < *size; i++)
+    {
+        hash = (hash ^ (unsigned char)(*body)[i]) * 1099511628211ull;
+    }
+
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", hash);
+
+    const char *match = strstr(request, "\r\nIf-None-Match: ");
+    int unchanged = match != NULL && match < end && strncmp(match + 17, etag, strlen(etag)) == 0;
+
+    snprintf(status, status_size, "%s\r\nETag: %s", unchanged ? "304 Not Modified" : "200 OK", etag);
+    if (unchanged)
+    {
+        *body = NULL;
+        *size = 0;
+    }
+}
+
+static int mock_accepts_gzip(const char *request, const char *end)
+{
+    /* Function  : static int mock_accepts_gzip(const char *request, const char *end)
+     * Input     : request - pointer to the request
+     *             end - pointer to the end of its headers
+     * Output    : Returns 1 if the request has an Accept-Encoding header naming gzip, 0 otherwise
+     * Procedure : This function looks for gzip in the Accept-Encoding header of the request, whatever the case of the header name.
+     */
+
+    for (const char *line = strstr(request, "\r\n"); line != NULL && line < end; line = strstr(line + 2, "\r\n"))
+    {
+        if (strncasecmp(line + 2, "Accept-Encoding:", 16) == 0)
+        {
+            const char *line_end = strstr(line + 2, "\r\n");
+            const char *gzip = strstr(line + 2, "gzip");
+            return gzip != NULL && gzip < line_end;
+        }
+    }
+
+    return 0;
+}
+
+static void mock_pace(MockServer *server)
+{
+    /* Function  : static void mock_pace(MockServer *server)
+     * Input     : server - pointer to a paced MockServer
+     * Output    : None
+     * Procedure : This function sends the pieces due since the bodies started to be paced out, pieces_per_ms per millisecond, one piece per connection in turn, so only a few of them have data at any time. A connection whose body is out gets its next request answered; one that failed is shut down, and the thread closes it once poll reports it.
+     */
+
+    int waiting = 0;
+    for (int i = 0; i < server->count; i++)
+    {
+        waiting += server->connections[i].left > 0;
+    }
+    if (waiting == 0)
+    {
+        // The next body starts a new run, idle time doesn't count
+        server->paced_since = rn_clock();
+        server->pieces = 0;
+        return;
+    }
+
+    long due = (long)((rn_clock() - server->paced_since) * 1000.0 * server->pieces_per_ms) - server->pieces;
+    for (int visited = 0; due > 0 && visited < server->count; visited++)
+    {
+        server->next = (server->next + 1) % server->count;
+        MockConnection *connection = &server->connections[server->next];
+        if (connection->left == 0)
+        {
+            continue;
+        }
+
+        size_t size = connection->left < server->piece ? connection->left : server->piece;
+        if (mock_send(connection->fd, connection->pending, size) != 0)
+        {
+            connection->left = 0;
+            shutdown(connection->fd, SHUT_RDWR);
+            continue;
+        }
+        connection->pending += size;
+        connection->left -= size;
+        server->pieces++;
+        due--;
+        visited = 0;
+
+        if (connection->left == 0 && mock_answer(server, connection) != 0)
+        {
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+    }
+}
+
+static void mock_server_main(void *argument)
+{
+    /* Function  : static void mock_server_main(void *argument)
+     * Input     : argument - pointer to the MockServer
+     * Output    : None
+     * Procedure : This function is the thread of the server: it waits on the listening socket, the connections and the wake pipe, accepts new connections, answers what they send and drops the ones that close, until mock_server_stop writes to the pipe. A paced server wakes up every millisecond while bodies are being sent, to send the pieces due.
+     */
+
+    MockServer *server = (MockServer *)argument;
+    struct pollfd *fds = calloc(MOCK_MAX_CONNECTIONS + 2, sizeof(struct pollfd));
+
+    while (fds != NULL)
+    {
+        fds[0].fd = server->wake_fds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = server->count < MOCK_MAX_CONNECTIONS ? server->listen_fd : -1;
+        fds[1].events = POLLIN;
+        for (int i = 0; i < server->count; i++)
+        {
+            fds[i + 2].fd = server->connections[i].fd;
+            fds[i + 2].events = POLLIN;
+        }
+
+        int sending = 0;
+        for (int i = 0; i < server->count && server->piece > 0 && !sending; i++)
+        {
+            sending = server->connections[i].left > 0;
+        }
+
+        if (poll(fds, (nfds_t)server->count + 2, sending ? 1 : -1) < 0 || (fds[0].revents & POLLIN))
+        {
+            break;
+        }
+
+        // Connections first, as accepting moves them around
+        for (int i = server->count - 1; i >= 0; i--)
+        {
+            if (fds[i + 2].revents == 0)
+            {
+                continue;
+            }
+
+            MockConnection *connection = &server->connections[i];
+            ssize_t received = recv(connection->fd, connection->request + connection->used, MOCK_REQUEST_SIZE - 1 - connection->used, 0);
+            if (received > 0)
+            {
+                connection->used += (size_t)received;
+            }
+
+            if (received <= 0 || mock_answer(server, connection) != 0)
+            {
+                close(connection->fd);
+                server->connections[i] = server->connections[--server->count];
+            }
+        }
+
+        // Every connection waiting, so a client opening hundreds at once isn't served one per turn
+        int fd;
+        while ((fds[1].revents & POLLIN) && server->count < MOCK_MAX_CONNECTIONS && (fd = accept(server->listen_fd, NULL, NULL)) >= 0)
+        {
+            // Headers and body go out in separate sends, which mustn't wait for the delayed ACK of the client
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            server->connections[server->count].fd = fd;
+            server->connections[server->count].used = 0;
+            server->connections[server->count].left = 0;
+            server->count++;
+            RN_ATOMIC_ADD(server->accepted, 1);
+            if (server->count > RN_ATOMIC_LOAD(server->peak))
+            {
+                RN_ATOMIC_STORE(server->peak, (long)server->count);
+            }
+        }
+
+        if (server->piece > 0)
+        {
+            mock_pace(server);
+        }
+    }
+
+    free(fds);
+}
+
+static int mock_server_start(MockServer *server, MockRoute route, void *userdata)
+{
+    /* Function  : static int mock_server_start(MockServer *server, MockRoute route, void *userdata)
+     * Input     : server - pointer to the MockServer to start
+     *             route - function picking the answer to every request
+     *             userdata - pointer passed to route
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function listens on a free port of 127.0.0.1, stored in server->port, without blocking so the thread can accept until none is left, and starts the thread answering on it.
+     */
+
+    return mock_server_start_paced(server, route, userdata, 0, 0);
+}
+
+static int mock_server_start_paced(MockServer *server, MockRoute route, void *userdata, size_t piece, int pieces_per_ms)
+{
+    /* Function  : static int mock_server_start_paced(MockServer *server, MockRoute route, void *userdata, size_t piece, int pieces_per_ms)
+     * Input     : server - pointer to the MockServer to start
+     *             route - function picking the answer to every request
+     *             userdata - pointer passed to route
+     *             piece - bytes of body sent at once, 0 to send bodies whole
+     *             pieces_per_ms - pieces sent per millisecond, over all connections
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function is mock_server_start for a server that paces out the bodies (see mock_pace).
+     */
+
+    memset(server, 0, sizeof(*server));
+    server->route = route;
+    server->userdata = userdata;
+    server->piece = piece;
+    server->pieces_per_ms = pieces_per_ms;
+    server->connections = malloc(MOCK_MAX_CONNECTIONS * sizeof(MockConnection));
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_size = sizeof(address);
+
+    if (server->connections == NULL || server->listen_fd < 0 ||
+        bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, 1024) != 0 ||
+        fcntl(server->listen_fd, F_SETFL, O_NONBLOCK) != 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&address, &address_size) != 0 ||
+        pipe(server->wake_fds) != 0)
+    {
+        if (server->listen_fd >= 0)
+        {
+            close(server->listen_fd);
+        }
+        free(server->connections);
+        return -1;
+    }
+    server->port = ntohs(address.sin_port);
+
+    if (rn_thread_start(&server->thread, mock_server_main, server) != 0)
+    {
+        close(server->listen_fd);
+        close(server->wake_fds[0]);
+        close(server->wake_fds[1]);
+        free(server->connections);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void mock_server_stop(MockServer *server)
+{
+    /* Function  : static void mock_server_stop(MockServer *server)
+     * Input     : server - pointer to a started MockServer
+     * Output    : None
+     * Procedure : This function ends the thread of the server and closes its sockets; connections still open are dropped.
+     */
+
+    if (write(server->wake_fds[1], "", 1) < 0)
+    {
+        // The thread is gone already
+    }
+    rn_thread_join(server->thread);
+
+    for (int i = 0; i < server->count; i++)
+    {
+        close(server->connections[i].fd);
+    }
+    close(server->listen_fd);
+    close(server->wake_fds[0]);
+    close(server->wake_fds[1]);
+    free(server->connections);
+}
+
+static long mock_requests(MockServer *server)
+{
+    /* Function  : static long mock_requests(MockServer *server)
+     * Input     : server - pointer to a started MockServer
+     * Output    : Returns the number of requests answered so far
+     * Procedure : This function reads the counter of the server thread atomically.
+     */
+
+    return RN_ATOMIC_ADD(server->requests, 0);
+}
+
+static long mock_accepted(MockServer *server)
+{
+    /* Function  : static long mock_accepted(MockServer *server)
+     * Input     : server - pointer to a started MockServer
+     * Output    : Returns the number of connections accepted so far
+     * Procedure : This function reads the counter of the server thread atomically, so a test can tell connections kept alive from new ones.
+     */
+
+    return RN_ATOMIC_ADD(server->accepted, 0);
+}
+
+static long mock_peak(MockServer *server)
+{
+    /* Function  : static long mock_peak(MockServer *server)
+     * Input     : server - pointer to a started MockServer
+     * Output    : Returns the most connections that were open at once so far
+     * Procedure : This function reads the peak kept by the server thread atomically, so a test can tell transfers ran side by side.
+     */
+
+    return RN_ATOMIC_LOAD(server->peak);
+}
+
+static long mock_sent(MockServer *server)
+{
+    /* Function  : static long mock_sent(MockServer *server)
+     * Input     : server - pointer to a started MockServer
+     * Output    : Returns the bytes of body answered so far
+     * Procedure : This function reads the counter of the server thread atomically, so a test can tell how much of a file was sent again.
+     */
+
+    return RN_ATOMIC_ADD(server->sent, 0);
+}
+
+static void mock_ignore_ranges(MockServer *server, int ignore)
+{
+    /* Function  : static void mock_ignore_ranges(MockServer *server, int ignore)
+     * Input     : server - pointer to a started MockServer
+     *             ignore - 1 to answer every request whole, 0 to answer ranges
+     * Output    : None
+     * Procedure : This function makes the server ignore Range headers from the next request on, like a server without range support.
+     */
+
+    RN_ATOMIC_STORE(server->ignore_ranges, (long)ignore);
+}
+
+static void mock_send_etags(MockServer *server, int send)
+{
+    /* Function  : static void mock_send_etags(MockServer *server, int send)
+     * Input     : server - pointer to a started MockServer
+     *             send - 1 to tag pages and answer If-None-Match, 0 not to
+     * Output    : None
+     * Procedure : This function makes the server send ETags from the next request on, like a server a cached page can be revalidated against (see mock_etag).
+     */
+
+    RN_ATOMIC_STORE(server->etags, (long)send);
+}
+
+static void mock_serve_gzip(MockServer *server, MockRoute gzip_route)
+{
+    /* Function  : static void mock_serve_gzip(MockServer *server, MockRoute gzip_route)
+     * Input     : server - pointer to a started MockServer
+     *             gzip_route - function picking the gzip page answering a request, NULL to answer every request uncompressed
+     * Output    : None
+     * Procedure : This function makes the server answer the requests accepting gzip with the page gzip_route picks from the next request on; a request it has no page for is answered by the route of the server.
+     */
+
+    RN_ATOMIC_STORE(server->gzip_route, gzip_route);
+}
+
+static long mock_gzip_accepted(MockServer *server)
+{
+    /* Function  : static long mock_gzip_accepted(MockServer *server)
+     * Input     : server - pointer to a started MockServer
+     * Output    : Returns the number of requests accepting gzip so far
+     * Procedure : This function reads the counter of the server thread atomically, so a test can tell which requests asked for compression.
+     */
+
+    return RN_ATOMIC_ADD(server->gzip_accepted, 0);
+}
+
+static int load_fixture_pages(FixturePages *pages)
+{
+    /* Function  : static int load_fixture_pages(FixturePages *pages)
+     * Input     : pages - pointer to the FixturePages to fill
+     * Output    : Returns 0 if every page was read, -1 otherwise
+     * Procedure : This function reads search.html, discography.html and album.html. The pages must be released with free_fixture_pages, also when it fails.
+     */
+
+    pages->search = read_fixture("search.html", &pages->search_size);
+    pages->discography = read_fixture("discography.html", &pages->discography_size);
+    pages->album = read_fixture("album.html", &pages->album_size);
+
+    return pages->search != NULL && pages->discography != NULL && pages->album != NULL ? 0 : -1;
+}
+
+static void free_fixture_pages(FixturePages *pages)
+{
+    /* Function  : static void free_fixture_pages(FixturePages *pages)
+     * Input     : pages - pointer to FixturePages filled by load_fixture_pages
+     * Output    : None
+     * Procedure : This function frees the pages.
+     */
+
+    free(pages->search);
+    free(pages->discography);
+    free(pages->album);
+    pages->search = pages->discography = pages->album = NULL;
+}
+
+static const char *route_fixture(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_fixture(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the FixturePages
+     * Output    : Returns the page answering the request, or NULL for 404
+     * Procedure : This function answers like the site: the search results for a POST to the search, the discography for the first page of any band and an empty page after it, and the album page for any album. Paths are matched in any case, as the site does: some links of the fixture pages are in capitals.
+     */
+
+    const FixturePages *pages = (const FixturePages *)userdata;
+    char lower[256];
+    int id;
+    int page;
+
+    snprintf(lower, sizeof(lower), "%s", path);
+    for (char *c = lower; *c != '\0'; c++)
+    {
+        *c = (char)tolower((unsigned char)*c);
+    }
+
+    if (strcmp(method, "POST") == 0 && strncmp(lower, "/mp3/searchresult", 17) == 0)
+    {
+        *size = pages->search_size;
+        return pages->search;
+    }
+    if (sscanf(lower, "/mp3/band-%d/%d", &id, &page) == 2)
+    {
+        *size = page == 1 ? pages->discography_size : 0;
+        return page == 1 ? pages->discography : "";
+    }
+    if (sscanf(lower, "/mp3/album-%d", &id) == 1)
+    {
+        *size = pages->album_size;
+        return pages->album;
+    }
+
+    return NULL;
+}
+
+static int same_albums(const AlbumInfoList *a, const AlbumInfoList *b)
+{
+    /* Function  : static int same_albums(const AlbumInfoList *a, const AlbumInfoList *b)
+     * Input     : a, b - pointers to the lists to compare
+     * Output    : Returns 1 if both hold the same albums in the same order, 0 otherwise
+     * Procedure : This function compares the URL, name and year of every album.
+     */
+
+    int same = a->count == b->count;
+
+    for (int i = 0; same && i < a->count; i++)
+    {
+        same = strcmp(a->albums[i].url, b->albums[i].url) == 0 && strcmp(a->albums[i].name, b->albums[i].name) == 0 &&
+               strcmp(a->albums[i].year, b->albums[i].year) == 0;
+    }
+
+    return same;
+}
+
+static int same_songs(const SongInfoList *a, const SongInfoList *b)
+{
+    /* Function  : static int same_songs(const SongInfoList *a, const SongInfoList *b)
+     * Input     : a, b - pointers to the lists to compare
+     * Output    : Returns 1 if both hold the same songs in the same order, 0 otherwise
+     * Procedure : This function compares the URL, artist, year, album and name of every song.
+     */
+
+    int same = a->count == b->count;
+
+    for (int i = 0; same && i < a->count; i++)
+    {
+        const SongInfo *x = &a->songs[i];
+        const SongInfo *y = &b->songs[i];
+        same = strcmp(x->url, y->url) == 0 && strcmp(x->artist, y->artist) == 0 && strcmp(x->year, y->year) == 0 &&
+               strcmp(x->album, y->album) == 0 && strcmp(x->name, y->name) == 0;
+    }
+
+    return same;
+}
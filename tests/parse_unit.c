@@ -0,0 +1,58 @@
+// parse_unit.c
+// Second translation unit of test_pool_parse.c. It includes the library again and submits parse tasks to
+// the shared pool, started by the other translation unit, while its own thread parses with the default
+// patterns of this unit.
+#include "parse_unit.h"
+
+static void parse_task(void *argument);
+
+static void parse_task(void *argument)
+{
+    /* Function  : static void parse_task(void *argument)
+     * Input     : argument - pointer to the ParseResult of the task
+     * Output    : None
+     * Procedure : This function is the pool task parsing one page, compiled in this translation unit.
+     */
+
+    parse_into((ParseResult *)argument);
+}
+
+void unit_parse_on_pool(WorkPool *pool, ParseResult *tasks, int task_count, ParseResult *own, int own_count)
+{
+    /*
+     * Function  : void unit_parse_on_pool(WorkPool *pool, ParseResult *tasks, int task_count, ParseResult *own, int own_count)
+     * Input     : pool - pointer to a started WorkPool
+     *             tasks - pointer to the ParseResults parsed on the pool
+     *             task_count - number of them
+     *             own - pointer to the ParseResults parsed by the calling thread meanwhile
+     *             own_count - number of them
+     * Output    : None
+     * Procedure : This function submits a parse task for each of tasks (running it at once if it can't be queued), parses each of own on the calling thread while the pool works, and waits for the pool.
+     */
+
+    for (int i = 0; i < task_count; i++)
+    {
+        if (pool_submit(pool, parse_task, &tasks[i]) != 0)
+        {
+            parse_task(&tasks[i]);
+        }
+    }
+    for (int i = 0; i < own_count; i++)
+    {
+        parse_into(&own[i]);
+    }
+
+    pool_wait(pool);
+}
+
+const CompiledPattern *unit_default_patterns(void)
+{
+    /*
+     * Function  : const CompiledPattern *unit_default_patterns(void)
+     * Input     : None
+     * Output    : Returns the default patterns of this translation unit
+     * Procedure : This function gives the registry the threads of this unit that haven't bound a client or a worker parse with.
+     */
+
+    return pattern_registry;
+}
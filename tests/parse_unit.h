@@ -0,0 +1,62 @@
+// parse_unit.h
+// What test_pool_parse.c and parse_unit.c, a second translation unit including the library, share: the
+// results of parsing a discography page and the patterns each parse used.
+#pragma once
+#include "../include/rocknation_multi.h"
+
+typedef struct
+{
+    const char *page;
+    size_t size;
+    int albums;
+    unsigned long hash;              // Of every URL, year and name found, see parse_into
+    const CompiledPattern *patterns; // Patterns the parse used, as the translation unit of the parse sees them
+} ParseResult;
+
+void unit_parse_on_pool(WorkPool *pool, ParseResult *tasks, int task_count, ParseResult *own, int own_count);
+const CompiledPattern *unit_default_patterns(void);
+
+static void hash_text_into(unsigned long *hash, const char *text);
+static void parse_into(ParseResult *result);
+
+static void hash_text_into(unsigned long *hash, const char *text)
+{
+    /* Function  : static void hash_text_into(unsigned long *hash, const char *text)
+     * Input     : hash - pointer to the hash to update
+     *             text - pointer to the text to mix in, or NULL
+     * Output    : None
+     * Procedure : This function mixes a text into a hash (djb2), so the results of two parses can be compared by one number.
+     */
+
+    while (text != NULL && *text != '\0')
+    {
+        *hash = *hash * 33 + (unsigned char)*text++;
+    }
+    *hash = *hash * 33;
+}
+
+static void parse_into(ParseResult *result)
+{
+    /* Function  : static void parse_into(ParseResult *result)
+     * Input     : result - pointer to the ParseResult holding the page, filled with what was found
+     * Output    : None
+     * Procedure : This function parses the albums of the page with parse_albums and records how many were found, the hash of all of them and the patterns of the calling thread, as this translation unit sees them.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    AlbumInfoList albums;
+    init_album_list(&albums, &arena);
+
+    result->patterns = get_patterns();
+    result->albums = parse_albums(result->page, result->size, &albums);
+    result->hash = 5381;
+    for (int i = 0; i < albums.count; i++)
+    {
+        hash_text_into(&result->hash, albums.albums[i].url);
+        hash_text_into(&result->hash, albums.albums[i].year);
+        hash_text_into(&result->hash, albums.albums[i].name);
+    }
+
+    arena_free(&arena);
+}
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Builds and runs the test programs of tests/, from the root of the repository.
+# CC, CFLAGS and LIBS may be overridden; the names of programs to run (e.g. test_extract) may be given.
+cd "$(dirname "$0")/.." || exit 1
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+LIBS=${LIBS:--lcurl -lpcre2-8 -luriparser}
+OUT=${TMPDIR:-/tmp}/rocknation-tests
+FAILED=0
+
+mkdir -p "$OUT"
+
+# run LABEL SOURCE [FLAGS...] builds SOURCE into LABEL with the extra FLAGS and runs it
+run()
+{
+    label=$1
+    source=$2
+    shift 2
+    name=$(basename "$source" .c)
+
+    if [ -n "$SELECTED" ] && ! echo " $SELECTED " | grep -q " $name "; then
+        return
+    fi
+
+    echo "== $label"
+    if ! $CC $CFLAGS -Wall -Wextra -Wno-unused-parameter -Wno-unused-function "$@" "$source" -o "$OUT/$label" -pthread $LIBS; then
+        echo "$label: build failed"
+        FAILED=1
+    elif ! "$OUT/$label"; then
+        FAILED=1
+    fi
+}
+
+SELECTED="$*"
+
+run test_extract tests/test_extract.c
+run test_extract_regex_only tests/test_extract.c -DROCKNATION_REGEX_ONLY
+run test_scan tests/test_scan.c
+run test_scan_no_simd tests/test_scan.c -DROCKNATION_NO_SIMD
+if grep -q avx2 /proc/cpuinfo 2>/dev/null; then
+    run test_scan_avx2 tests/test_scan.c -mavx2
+fi
+run test_catalog tests/test_catalog.c
+run test_names tests/test_names.c
+run test_store tests/test_store.c
+run test_fuzzy tests/test_fuzzy.c
+run test_crawl tests/test_crawl.c
+run test_mirror tests/test_mirror.c
+run test_url tests/test_url.c
+run test_snapshot tests/test_snapshot.c
+run test_client_threads tests/test_client_threads.c tests/client_unit.c
+run test_disk tests/test_disk.c -Wl,--wrap=pwrite -Wl,--wrap=syscall
+run test_loop tests/test_loop.c
+run test_pool tests/test_pool.c
+run test_pool_parse tests/test_pool_parse.c tests/parse_unit.c
+run test_pool_parse_regex_only tests/test_pool_parse.c tests/parse_unit.c -DROCKNATION_REGEX_ONLY
+run test_arena tests/test_arena.c
+run test_download tests/test_download.c
+run test_parallel tests/test_parallel.c
+run test_session tests/test_session.c
+run test_pagination tests/test_pagination.c
+run test_resume tests/test_resume.c
+run test_cache tests/test_cache.c
+run test_compression tests/test_compression.c
+run test_song_page tests/test_song_page.c
+
+exit $FAILED
@@ -0,0 +1,245 @@
+// test_arena.c
+// Checks the arena allocator (rocknation_arena.h) and the result lists growing in it. Small allocations
+// must be aligned, apart from each other and carved from a single block. An allocation of a whole block
+// must take a new block, and one bigger than a block must get a block of its own, whole and writable, while
+// the memory handed out before it is left as it was. A size too big for any block must fail. The most recent
+// allocation must grow in place while its block has room, and any other one must be copied. A list of
+// ARENA_TEST_ALBUMS albums must keep every record and string, with a handful of heap allocations, and an arena
+// freed must be usable again. Prints the time to fill the list.
+#include "../include/rocknation_utils.h"
+#include "test_util.h"
+
+#define ARENA_TEST_BLOCK 4096
+#define ARENA_TEST_SMALL 100       // Small allocations of ARENA_TEST_SMALL_SIZE bytes, fitting in one block
+#define ARENA_TEST_SMALL_SIZE 24
+#define ARENA_TEST_OVERSIZE (ARENA_TEST_BLOCK * 10 + 7)
+#define ARENA_TEST_ALBUMS 5000
+
+static size_t heap_allocations(void);
+static int filled(const unsigned char *data, size_t size, unsigned char value);
+static void check_small(void);
+static void check_large(void);
+static void check_grow(void);
+static void check_albums(void);
+
+static size_t heap_allocations(void)
+{
+    /* Function  : static size_t heap_allocations(void)
+     * Input     : None
+     * Output    : Returns the number of heap allocations made through rn_malloc so far
+     * Procedure : This function reads the counter of the counting allocator, which takes every block of an arena.
+     */
+
+    return RN_ATOMIC_ADD(rocknation_alloc.allocations, 0);
+}
+
+static int filled(const unsigned char *data, size_t size, unsigned char value)
+{
+    /* Function  : static int filled(const unsigned char *data, size_t size, unsigned char value)
+     * Input     : data - pointer to the memory to check
+     *             size - number of bytes
+     *             value - byte every one of them must hold
+     * Output    : Returns 1 if every byte holds value, 0 otherwise
+     * Procedure : This function checks memory written with memset was not overwritten since.
+     */
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (data[i] != value)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void check_small(void)
+{
+    /* Function  : static void check_small(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function makes ARENA_TEST_SMALL small allocations, fills each with a byte of its own and checks they are aligned, that none overwrote another, that they were carved from one block and that allocated counts their rounded sizes.
+     */
+
+    Arena arena;
+    arena_init(&arena, ARENA_TEST_BLOCK);
+    unsigned char *pointers[ARENA_TEST_SMALL];
+    size_t before = heap_allocations();
+    int aligned = 1;
+
+    for (int i = 0; i < ARENA_TEST_SMALL; i++)
+    {
+        pointers[i] = arena_alloc(&arena, ARENA_TEST_SMALL_SIZE);
+        aligned = aligned && pointers[i] != NULL && (uintptr_t)pointers[i] % ARENA_ALIGNMENT == 0;
+        if (pointers[i] != NULL)
+        {
+            memset(pointers[i], i, ARENA_TEST_SMALL_SIZE);
+        }
+    }
+    check(aligned, "small allocations are aligned to ARENA_ALIGNMENT");
+
+    int apart = aligned;
+    for (int i = 0; apart && i < ARENA_TEST_SMALL; i++)
+    {
+        apart = filled(pointers[i], ARENA_TEST_SMALL_SIZE, (unsigned char)i);
+    }
+    check(apart, "small allocations don't overlap");
+    check(heap_allocations() == before + 1, "small allocations are carved from a single block");
+    check(arena.allocated == ARENA_TEST_SMALL * 32, "allocated counts the rounded sizes");
+
+    arena_free(&arena);
+    check(arena.blocks == NULL && arena.allocated == 0 && arena.last == NULL, "a freed arena is empty");
+}
+
+static void check_large(void)
+{
+    /* Function  : static void check_large(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function allocates more than a block from an arena already in use, then a small allocation and a whole block. It checks the oversize allocation took one block of the heap behind the current one, the small one fit in the room left in the current block, the whole block took one block of the heap and nothing was overwritten. It then checks an impossible size fails, allocated or grown to.
+     */
+
+    Arena arena;
+    arena_init(&arena, ARENA_TEST_BLOCK);
+    unsigned char *small = arena_alloc(&arena, 100);
+    check(small != NULL, "a small allocation is made");
+    if (small == NULL)
+    {
+        return;
+    }
+    memset(small, 0x11, 100);
+
+    size_t before = heap_allocations();
+    unsigned char *oversize = arena_alloc(&arena, ARENA_TEST_OVERSIZE);
+    check(oversize != NULL && heap_allocations() == before + 1 && arena.blocks->next != NULL &&
+              arena.blocks->next->capacity >= ARENA_TEST_OVERSIZE && (unsigned char *)arena.blocks->next->data == oversize,
+          "an allocation bigger than a block gets a block of its own behind the current one");
+
+    before = heap_allocations();
+    unsigned char *after = arena_alloc(&arena, 100);
+    check(after != NULL && heap_allocations() == before, "a small allocation after an oversize one uses the room left in the current block");
+
+    before = heap_allocations();
+    unsigned char *whole = arena_alloc(&arena, ARENA_TEST_BLOCK);
+    check(whole != NULL && heap_allocations() == before + 1, "an allocation of a whole block takes a new block");
+    if (whole == NULL || oversize == NULL || after == NULL)
+    {
+        arena_free(&arena);
+        return;
+    }
+    memset(oversize, 0x33, ARENA_TEST_OVERSIZE);
+    memset(after, 0x44, 100);
+    memset(whole, 0x22, ARENA_TEST_BLOCK);
+
+    check(filled(small, 100, 0x11) && filled(whole, ARENA_TEST_BLOCK, 0x22) && filled(oversize, ARENA_TEST_OVERSIZE, 0x33) &&
+              filled(after, 100, 0x44),
+          "large and oversize allocations don't overlap anything");
+
+    check(arena_alloc(&arena, SIZE_MAX) == NULL && arena_alloc(&arena, SIZE_MAX - ARENA_ALIGNMENT) == NULL, "a size no block can hold fails");
+    check(arena_grow(&arena, whole, ARENA_TEST_BLOCK, SIZE_MAX) == NULL && arena_grow(&arena, whole, ARENA_TEST_BLOCK, SIZE_MAX - 1) == NULL,
+          "growing the most recent allocation to a size no block can hold fails");
+
+    arena_free(&arena);
+}
+
+static void check_grow(void)
+{
+    /* Function  : static void check_grow(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function grows the most recent allocation within its block, then beyond it, then an older allocation, and checks which grew in place and that the contents were kept.
+     */
+
+    Arena arena;
+    arena_init(&arena, ARENA_TEST_BLOCK);
+    unsigned char *older = arena_alloc(&arena, 64);
+    unsigned char *last = arena_alloc(&arena, 64);
+    if (older == NULL || last == NULL)
+    {
+        check(0, "the allocations to grow are made");
+        arena_free(&arena);
+        return;
+    }
+    memset(older, 0x55, 64);
+    memset(last, 0x66, 64);
+
+    unsigned char *grown = arena_grow(&arena, last, 64, 1024);
+    check(grown == last && filled(grown, 64, 0x66), "the most recent allocation grows in place");
+
+    unsigned char *moved = arena_grow(&arena, grown, 1024, ARENA_TEST_BLOCK * 2);
+    check(moved != NULL && moved != grown && filled(moved, 64, 0x66), "an allocation outgrowing its block is copied");
+
+    unsigned char *copied = arena_grow(&arena, older, 64, 128);
+    check(copied != NULL && copied != older && filled(copied, 64, 0x55) && filled(older, 64, 0x55),
+          "an older allocation is copied and left as it was");
+
+    arena_free(&arena);
+}
+
+static void check_albums(void)
+{
+    /* Function  : static void check_albums(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function appends ARENA_TEST_ALBUMS albums with strings of their own to a list, checks every one of them afterwards and counts the heap allocations it took. The arena is then freed and filled again.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    char text[64];
+
+    for (int round = 0; round < 2; round++)
+    {
+        AlbumInfoList albums;
+        init_album_list(&albums, &arena);
+        size_t before = heap_allocations();
+        double started = rn_clock();
+        int appended = 1;
+
+        for (int i = 0; appended && i < ARENA_TEST_ALBUMS; i++)
+        {
+            AlbumInfo *album = append_album(&albums);
+            int length = snprintf(text, sizeof(text), "/mp3/album-%d", i);
+            appended = album != NULL;
+            if (appended)
+            {
+                album->url = arena_strndup(&arena, text, (size_t)length);
+                length = snprintf(text, sizeof(text), "Album %d", i);
+                album->name = arena_strndup(&arena, text, (size_t)length);
+                album->year = arena_strndup(&arena, "1984", 4);
+                appended = album->url != NULL && album->name != NULL && album->year != NULL;
+            }
+        }
+        double elapsed = rn_clock() - started;
+        size_t allocations = heap_allocations() - before;
+
+        int kept = appended && albums.count == ARENA_TEST_ALBUMS;
+        for (int i = 0; kept && i < albums.count; i++)
+        {
+            char url[32];
+            char name[32];
+            snprintf(url, sizeof(url), "/mp3/album-%d", i);
+            snprintf(name, sizeof(name), "Album %d", i);
+            kept = strcmp(albums.albums[i].url, url) == 0 && strcmp(albums.albums[i].name, name) == 0 && strcmp(albums.albums[i].year, "1984") == 0;
+        }
+        check(kept, round == 0 ? "every album appended is kept" : "every album appended to an arena freed before is kept");
+        check(allocations < 64, "the albums take a handful of heap allocations");
+
+        if (round == 0)
+        {
+            printf("%d albums appended in %.0f us, %zu heap allocations\n", ARENA_TEST_ALBUMS, elapsed * 1e6, allocations);
+        }
+        arena_free(&arena);
+    }
+}
+
+int main(void)
+{
+    check_small();
+    check_large();
+    check_grow();
+    check_albums();
+
+    return test_summary("test_arena");
+}
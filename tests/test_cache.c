@@ -0,0 +1,172 @@
+// test_cache.c
+// Checks the on-disk page cache (rocknation_cache.h, through fetch_page of rocknation_session.h) against a
+// local server (mock_server.h) sending ETags. A page younger than the TTL must be answered without a request;
+// once expired it must be revalidated with If-None-Match and, while unchanged, kept without the server
+// sending it again, and a page that changed must be downloaded again. A server failing must get the stale page
+// used instead, and offline mode must answer from the cache alone, failing for a page it doesn't hold, without
+// a request either way.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+typedef struct
+{
+    FixturePages fixture;
+    long version;  // Page answering /page.html: 1 for the album page, 2 for the discography, read atomically
+    long failing;  // Set to answer every request with 500, read atomically
+} CachePages;
+
+static const char *route_cache(const char *method, const char *path, size_t *size, void *userdata);
+static int fetch(const char *url, const char *page, size_t size);
+
+static const char *route_cache(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_cache(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the CachePages
+     * Output    : Returns the answer to the request, NULL for 404 or MOCK_ERROR for 500
+     * Procedure : This function answers /page.html and /other.html with the album page, or the discography once the page changed to version 2, and every request with 500 while the server is failing.
+     */
+
+    (void)method;
+
+    CachePages *pages = (CachePages *)userdata;
+
+    if (RN_ATOMIC_LOAD(pages->failing))
+    {
+        return MOCK_ERROR;
+    }
+    if (strcmp(path, "/page.html") == 0 && RN_ATOMIC_LOAD(pages->version) == 2)
+    {
+        *size = pages->fixture.discography_size;
+        return pages->fixture.discography;
+    }
+    if (strcmp(path, "/page.html") == 0 || strcmp(path, "/other.html") == 0)
+    {
+        *size = pages->fixture.album_size;
+        return pages->fixture.album;
+    }
+
+    return NULL;
+}
+
+static int fetch(const char *url, const char *page, size_t size)
+{
+    /* Function  : static int fetch(const char *url, const char *page, size_t size)
+     * Input     : url - pointer to the URL of the page
+     *             page - pointer to the page it must give, or NULL if it must fail
+     *             size - size of the page
+     * Output    : Returns 1 if fetch_page gave the page (or failed when it must), 0 otherwise
+     * Procedure : This function fetches the page with fetch_page and compares what it gives with what it must give.
+     */
+
+    MemoryStruct chunk;
+    init_memory_struct(&chunk);
+
+    int fetched = fetch_page(url, NULL, &chunk) == 0;
+    int same = page != NULL ? fetched && chunk.size == size && memcmp(chunk.memory, page, size) == 0 : !fetched;
+
+    free(chunk.memory);
+
+    return same;
+}
+
+int main(void)
+{
+    static CachePages pages;
+    pages.version = 1;
+    int ready = load_fixture_pages(&pages.fixture) == 0;
+    check(ready, "the fixture pages are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_cache, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free_fixture_pages(&pages.fixture);
+        return test_summary("test_cache");
+    }
+    mock_send_etags(&server, 1);
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "cache") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+
+    RocknationCache *cache = get_cache();
+    cache->enabled = 1;
+    cache->offline = 0;
+    cache->ttl = 3600;
+
+    const char *album = pages.fixture.album;
+    size_t album_size = pages.fixture.album_size;
+    const char *discography = pages.fixture.discography;
+    size_t discography_size = pages.fixture.discography_size;
+
+    char url[MAX_URL_LENGTH];
+    char other[MAX_URL_LENGTH];
+    char missing[MAX_URL_LENGTH];
+    char path[MAX_PATH_LENGTH];
+    snprintf(url, sizeof(url), "%s/page.html", base);
+    snprintf(other, sizeof(other), "%s/other.html", base);
+    snprintf(missing, sizeof(missing), "%s/missing.html", base);
+
+    // A page downloaded once is answered from the cache until the TTL is over
+    long requests = mock_requests(&server);
+    check(fetch(url, album, album_size) && cache->misses == 1 && mock_requests(&server) == requests + 1, "a page is downloaded");
+    cache_path(url, NULL, path, sizeof(path));
+    FILE *stored = fopen(path, "rb");
+    check(stored != NULL, "the page is stored in the cache directory");
+    if (stored != NULL)
+    {
+        fclose(stored);
+    }
+    check(fetch(url, album, album_size) && cache->hits == 1 && mock_requests(&server) == requests + 1, "a fresh page is answered without a request");
+
+    // Expired, it is revalidated: unchanged, the server doesn't send it again
+    cache->ttl = 0;
+    long sent = mock_sent(&server);
+    check(fetch(url, album, album_size) && cache->revalidated == 1 && mock_requests(&server) == requests + 2, "an expired page is revalidated");
+    check(mock_sent(&server) == sent, "an unchanged page isn't sent again");
+    check(fetch(url, album, album_size) && cache->revalidated == 2, "a revalidated page is still revalidated once expired");
+
+    // A page that changed is downloaded and stored again
+    RN_ATOMIC_STORE(pages.version, 2L);
+    check(fetch(url, discography, discography_size) && cache->misses == 2, "a page that changed is downloaded again");
+    check(fetch(url, discography, discography_size) && cache->revalidated == 3, "the new page is revalidated in turn");
+
+    // A server in trouble gets the stale page used
+    check(fetch(other, album, album_size) && cache->misses == 3, "another page is downloaded");
+    RN_ATOMIC_STORE(pages.failing, 1L);
+    int hits = cache->hits;
+    check(fetch(url, discography, discography_size) && fetch(other, album, album_size) && cache->hits == hits + 2, "a server failing gets the stale pages used");
+    check(fetch(missing, NULL, 0), "a page not in the cache fails with the server");
+    RN_ATOMIC_STORE(pages.failing, 0L);
+
+    // Offline, only the cache answers
+    cache->offline = 1;
+    requests = mock_requests(&server);
+    check(fetch(url, discography, discography_size) && fetch(other, album, album_size), "offline, the pages in the cache are answered");
+    check(fetch(missing, NULL, 0), "offline, a page not in the cache fails");
+    check(mock_requests(&server) == requests, "offline, nothing is requested");
+    cache->offline = 0;
+
+    print_cache_stats();
+
+    mock_server_stop(&server);
+
+    cache_path(url, NULL, path, sizeof(path));
+    remove(path);
+    cache_path(other, NULL, path, sizeof(path));
+    remove(path);
+    rmdir(directory);
+    free_fixture_pages(&pages.fixture);
+
+    return test_summary("test_cache");
+}
@@ -0,0 +1,92 @@
+// test_catalog.c
+// Checks the StringPool of rocknation_catalog.h, which keeps the names of the fuzzy index and of the store:
+// interning a string twice gives the same id and stores it once, adding always stores a new copy, and every
+// id still gives back its string once the text and the hash table have grown many times over.
+#include "../include/rocknation_catalog.h"
+#include "test_util.h"
+
+#define POOL_STRINGS 20000 // Enough to grow the text and the hash table past their initial sizes
+
+static void check_intern(void);
+static void check_growth(void);
+
+static void check_intern(void)
+{
+    /* Function  : static void check_intern(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function interns and adds a few strings, some of them prefixes of each other, and checks which ones share an id.
+     */
+
+    StringPool pool;
+    string_pool_init(&pool);
+    uint32_t band, again, prefix, added, empty;
+
+    int failed = string_pool_intern(&pool, "Black Sabbath", 13, &band) != 0;
+    failed |= string_pool_intern(&pool, "Black Sabbath, Paranoid", 13, &again) != 0;
+    failed |= string_pool_intern(&pool, "Black", 5, &prefix) != 0;
+    failed |= string_pool_add(&pool, "Black Sabbath", 13, &added) != 0;
+    failed |= string_pool_intern(&pool, "", 0, &empty) != 0;
+    check(!failed, "the strings are stored");
+
+    check(band == again && strcmp(pool.text + band, "Black Sabbath") == 0, "interning a string twice gives the same id");
+    check(prefix != band && strcmp(pool.text + prefix, "Black") == 0, "a prefix of an interned string is a string of its own");
+    check(added != band && strcmp(pool.text + added, "Black Sabbath") == 0, "adding a string stores a new copy");
+    check(pool.interned == 3 && pool.text[empty] == '\0', "the empty string is interned too");
+
+    string_pool_free(&pool);
+    check(pool.text == NULL && pool.size == 0 && pool.interned == 0, "a freed pool is empty");
+}
+
+static void check_growth(void)
+{
+    /* Function  : static void check_growth(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function interns POOL_STRINGS different strings, every one of them twice, then checks that each id still gives back its string and that nothing was stored twice.
+     */
+
+    StringPool pool;
+    string_pool_init(&pool);
+    uint32_t *ids = malloc(POOL_STRINGS * sizeof(uint32_t));
+    char text[64];
+    int failed = ids == NULL;
+
+    for (int round = 0; round < 2 && !failed; round++)
+    {
+        for (int i = 0; i < POOL_STRINGS && !failed; i++)
+        {
+            uint32_t id;
+            int length = snprintf(text, sizeof(text), "Band %d - Album %d", i, i % 37);
+            failed = string_pool_intern(&pool, text, (size_t)length, &id) != 0 || (round == 1 && id != ids[i]);
+            if (round == 0)
+            {
+                ids[i] = id;
+            }
+        }
+    }
+    check(!failed, "interning every string again gives back its id");
+
+    int same = !failed;
+    for (int i = 0; same && i < POOL_STRINGS; i++)
+    {
+        snprintf(text, sizeof(text), "Band %d - Album %d", i, i % 37);
+        same = strcmp(pool.text + ids[i], text) == 0;
+    }
+    check(same, "every id gives back its string after the pool grew");
+    check(pool.interned == POOL_STRINGS && pool.slot_count >= 2 * POOL_STRINGS, "every string is stored once, in a table at most half full");
+    check(pool.capacity > STRING_POOL_INITIAL_SIZE, "the text grew past its initial size");
+
+    printf("%d strings interned: %zu bytes of text, %zu slots\n", POOL_STRINGS, pool.size, pool.slot_count);
+
+    free(ids);
+    string_pool_free(&pool);
+}
+
+int main(void)
+{
+    check_intern();
+    check_growth();
+
+    return test_summary("test_catalog");
+}
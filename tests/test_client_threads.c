@@ -0,0 +1,267 @@
+// test_client_threads.c
+// Runs RocknationClients on many threads at once against a local server (mock_server.h) answering with the
+// saved pages, half of them through this translation unit and half through client_unit.c, which includes the
+// library again. Every lookup must find what the pages hold, the state shared by the whole process (libcurl
+// initialization, pool, disk writer, base URL, heap counters) must be one object in both translation units,
+// and the store records appended by every client at once must answer a new client, without a request, as
+// those of a single client do.
+// Prints the lookups per second of one thread and of all of them.
+#include "client_unit.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#include <dirent.h>
+
+#define CLIENT_THREADS 16
+#define CLIENT_ROUNDS 25
+
+typedef struct
+{
+    RocknationClient *client;
+    int index;
+    const LookupResult *expected;
+    int mismatches;
+} ClientThread;
+
+static void lookup(RocknationClient *client, LookupResult *result);
+static int same_lookup(const LookupResult *a, const LookupResult *b);
+static void client_thread_main(void *argument);
+static double run_threads(int count, const LookupResult *expected, int *mismatches);
+static void remove_directory(const char *path);
+
+static void lookup(RocknationClient *client, LookupResult *result)
+{
+    /* Function  : static void lookup(RocknationClient *client, LookupResult *result)
+     * Input     : client - pointer to the client making the requests
+     *             result - pointer to the LookupResult to fill
+     * Output    : None
+     * Procedure : This function is unit_lookup done the other way: the client is bound to the thread and the plain library functions are called.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList bands;
+    AlbumInfoList albums;
+    SongInfoList songs;
+    init_band_list(&bands, &arena);
+    init_album_list(&albums, &arena);
+    init_song_list(&songs, &arena);
+
+    RocknationClient *previous = rn_client_bind(client);
+    search_band(LOOKUP_TEXT, &bands);
+    if (bands.count > 0)
+    {
+        get_albums(bands.bands[0].url, &albums);
+    }
+    if (albums.count > 0)
+    {
+        get_songs(albums.albums[0].url, &songs);
+    }
+    rn_client_bind(previous);
+
+    hash_lookup(&bands, &albums, &songs, result);
+    arena_free(&arena);
+}
+
+static int same_lookup(const LookupResult *a, const LookupResult *b)
+{
+    /* Function  : static int same_lookup(const LookupResult *a, const LookupResult *b)
+     * Input     : a, b - pointers to the results to compare
+     * Output    : Returns 1 if they found the same bands, albums and songs, 0 otherwise
+     * Procedure : This function compares two lookups by their counts and hash.
+     */
+
+    return a->bands == b->bands && a->albums == b->albums && a->songs == b->songs && a->hash == b->hash;
+}
+
+static void client_thread_main(void *argument)
+{
+    /* Function  : static void client_thread_main(void *argument)
+     * Input     : argument - pointer to the ClientThread
+     * Output    : None
+     * Procedure : This function runs CLIENT_ROUNDS lookups with the client of the thread, through client_unit.c on odd threads, and counts those that don't find what is expected.
+     */
+
+    ClientThread *thread = (ClientThread *)argument;
+
+    for (int round = 0; round < CLIENT_ROUNDS; round++)
+    {
+        LookupResult result;
+        if (thread->index % 2 == 0)
+        {
+            lookup(thread->client, &result);
+        }
+        else
+        {
+            unit_lookup(thread->client, &result);
+        }
+        thread->mismatches += !same_lookup(&result, thread->expected);
+    }
+}
+
+static double run_threads(int count, const LookupResult *expected, int *mismatches)
+{
+    /* Function  : static double run_threads(int count, const LookupResult *expected, int *mismatches)
+     * Input     : count - number of threads
+     *             expected - pointer to what every lookup must find
+     *             mismatches - pointer receiving the number of lookups that didn't
+     * Output    : Returns the lookups per second of all the threads together
+     * Procedure : This function creates a client per thread here, runs the threads and destroys the clients once they are done.
+     */
+
+    ClientThread threads[CLIENT_THREADS];
+    RnThread handles[CLIENT_THREADS];
+
+    for (int i = 0; i < count; i++)
+    {
+        threads[i].client = rn_client_create();
+        threads[i].index = i;
+        threads[i].expected = expected;
+        threads[i].mismatches = 0;
+    }
+
+    double started = rn_clock();
+    for (int i = 0; i < count; i++)
+    {
+        rn_thread_start(&handles[i], client_thread_main, &threads[i]);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        rn_thread_join(handles[i]);
+    }
+    double elapsed = rn_clock() - started;
+
+    *mismatches = 0;
+    for (int i = 0; i < count; i++)
+    {
+        *mismatches += threads[i].mismatches;
+        rn_client_destroy(threads[i].client);
+    }
+
+    return elapsed > 0 ? count * CLIENT_ROUNDS / elapsed : 0;
+}
+
+static void remove_directory(const char *path)
+{
+    /* Function  : static void remove_directory(const char *path)
+     * Input     : path - path of a directory holding only files
+     * Output    : None
+     * Procedure : This function removes the cache directory of the test and the files the clients wrote in it.
+     */
+
+    DIR *directory = opendir(path);
+    struct dirent *entry;
+    char file[512];
+
+    while (directory != NULL && (entry = readdir(directory)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        {
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            remove(file);
+        }
+    }
+    if (directory != NULL)
+    {
+        closedir(directory);
+    }
+    rmdir(path);
+}
+
+int main(void)
+{
+    FixturePages pages;
+    if (load_fixture_pages(&pages) != 0)
+    {
+        check(0, "the saved pages are read");
+        return test_summary("test_client_threads");
+    }
+
+    MockServer server;
+    if (mock_server_start(&server, route_fixture, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        return test_summary("test_client_threads");
+    }
+
+    char directory[256];
+    char url[64];
+    if (make_test_directory(directory, sizeof(directory), "clients") != 0)
+    {
+        return 1;
+    }
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", url, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+
+    // One object for the whole process, whichever translation unit asks
+    const void *here[SHARED_OBJECTS];
+    const void *there[SHARED_OBJECTS];
+    unit_shared_objects(there);
+    shared_objects(here);
+    for (int i = 0; i < SHARED_OBJECTS; i++)
+    {
+        char message[96];
+        snprintf(message, sizeof(message), "both translation units see the same process-wide object %d", i);
+        check(here[i] != NULL && here[i] == there[i], message);
+    }
+
+    // What the saved pages hold
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList bands;
+    AlbumInfoList albums;
+    SongInfoList songs;
+    init_band_list(&bands, &arena);
+    init_album_list(&albums, &arena);
+    init_song_list(&songs, &arena);
+    parse_bands(pages.search, pages.search_size, &bands);
+    parse_albums(pages.discography, pages.discography_size, &albums);
+    parse_songs(pages.album, pages.album_size, &songs);
+    LookupResult expected;
+    hash_lookup(&bands, &albums, &songs, &expected);
+    arena_free(&arena);
+    check(expected.bands > 0 && expected.albums > 0 && expected.songs > 0, "the saved pages have bands, albums and songs");
+
+    // Every lookup goes to the server: no page cache, no answers from the store (records are still added)
+    get_cache()->enabled = 0;
+    rocknation_store.refresh = 1;
+
+    int mismatches;
+    double single_rate = run_threads(1, &expected, &mismatches);
+    check(mismatches == 0, "one client finds what the pages hold");
+    long requests_per_lookup = mock_requests(&server) / CLIENT_ROUNDS;
+
+    // What the records of that one client answer
+    rocknation_store.refresh = 0;
+    RocknationClient *client = rn_client_create();
+    LookupResult sequential;
+    unit_lookup(client, &sequential);
+    rn_client_destroy(client);
+    check(sequential.albums == expected.albums && sequential.songs == expected.songs, "the store answers the albums and songs of one client");
+
+    rocknation_store.refresh = 1;
+    long requests = mock_requests(&server);
+    double rate = run_threads(CLIENT_THREADS, &expected, &mismatches);
+    check(mismatches == 0, "every client finds what the pages hold while the others run");
+    check(mock_requests(&server) - requests == requests_per_lookup * CLIENT_THREADS * CLIENT_ROUNDS, "every lookup of every client reaches the server");
+
+    // The records every client appended at once answer a new client as those of one client did
+    rocknation_store.refresh = 0;
+    requests = mock_requests(&server);
+    client = rn_client_create();
+    LookupResult stored;
+    lookup(client, &stored);
+    rn_client_destroy(client);
+    check(same_lookup(&stored, &sequential), "a new client finds the same in the store after every client wrote to it");
+    check(mock_requests(&server) == requests, "the store answers it without a request");
+
+    printf("%ld requests per lookup: 1 client %.0f lookups/s, %d clients on their own threads %.0f lookups/s\n",
+           requests_per_lookup, single_rate, CLIENT_THREADS, rate);
+
+    mock_server_stop(&server);
+    remove_directory(directory);
+    free_fixture_pages(&pages);
+
+    return test_summary("test_client_threads");
+}
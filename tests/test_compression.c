@@ -0,0 +1,201 @@
+// test_compression.c
+// Checks that catalog pages travel compressed and songs don't, against a local server (mock_server.h) that
+// answers the requests accepting gzip with the fixture pages compressed (tests/fixtures/*.html.gz, made with
+// gzip -9n). A search, a discography and an album must give the same results compressed as uncompressed, the
+// session must count fewer bytes over the wire than decoded for them, and a song download must not ask for
+// compression. Prints the bytes saved.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define COMPRESSION_SONG_SIZE (128 * 1024)
+
+typedef struct
+{
+    FixturePages fixture;
+    FixturePages gzip; // The fixture pages compressed
+    char song[COMPRESSION_SONG_SIZE];
+} CompressionPages;
+
+static const char *route_compression(const char *method, const char *path, size_t *size, void *userdata);
+static const char *route_gzip(const char *method, const char *path, size_t *size, void *userdata);
+static int lookup(const char *base, int id, BandInfoList *bands, AlbumInfoList *albums, SongInfoList *songs);
+
+static const char *route_compression(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_compression(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the CompressionPages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers /song.mp3 with the song, and any other request through route_fixture.
+     */
+
+    CompressionPages *pages = (CompressionPages *)userdata;
+
+    if (strcmp(path, "/song.mp3") == 0)
+    {
+        *size = sizeof(pages->song);
+        return pages->song;
+    }
+
+    return route_fixture(method, path, size, &pages->fixture);
+}
+
+static const char *route_gzip(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_gzip(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the CompressionPages
+     * Output    : Returns the compressed page answering the request, or NULL to answer it uncompressed
+     * Procedure : This function answers the catalog pages route_fixture has with their compressed copy. The empty pages past the end of a discography and the song have none.
+     */
+
+    CompressionPages *pages = (CompressionPages *)userdata;
+    size_t plain_size = 0;
+    const char *plain = route_fixture(method, path, &plain_size, &pages->fixture);
+
+    if (plain == pages->fixture.search)
+    {
+        *size = pages->gzip.search_size;
+        return pages->gzip.search;
+    }
+    if (plain == pages->fixture.discography)
+    {
+        *size = pages->gzip.discography_size;
+        return pages->gzip.discography;
+    }
+    if (plain == pages->fixture.album)
+    {
+        *size = pages->gzip.album_size;
+        return pages->gzip.album;
+    }
+
+    return NULL;
+}
+
+static int lookup(const char *base, int id, BandInfoList *bands, AlbumInfoList *albums, SongInfoList *songs)
+{
+    /* Function  : static int lookup(const char *base, int id, BandInfoList *bands, AlbumInfoList *albums, SongInfoList *songs)
+     * Input     : base - pointer to the URL of the server
+     *             id - band and album id to look up, not looked up before so the store doesn't answer
+     *             bands, albums, songs - pointers to the lists receiving the results
+     * Output    : Returns 1 if every lookup found something, 0 otherwise
+     * Procedure : This function searches a band of its own, then gets the albums of a band and the songs of an album, with their messages silenced.
+     */
+
+    char text[32];
+    char url[sizeof("http://127.0.0.1:65535/mp3/album-") + 16];
+    snprintf(text, sizeof(text), "Band %d", id);
+
+    int saved = silence_stdout();
+    search_band(text, bands);
+    snprintf(url, sizeof(url), "%s/mp3/band-%d", base, id);
+    get_albums(url, albums);
+    snprintf(url, sizeof(url), "%s/mp3/album-%d", base, id);
+    get_songs(url, songs);
+    restore_stdout(saved);
+
+    return bands->count > 0 && albums->count > 0 && songs->count > 0;
+}
+
+int main(void)
+{
+    static CompressionPages pages;
+    for (size_t i = 0; i < sizeof(pages.song); i++)
+    {
+        pages.song[i] = (char)(i * 3 + 7);
+    }
+
+    pages.gzip.search = read_fixture("search.html.gz", &pages.gzip.search_size);
+    pages.gzip.discography = read_fixture("discography.html.gz", &pages.gzip.discography_size);
+    pages.gzip.album = read_fixture("album.html.gz", &pages.gzip.album_size);
+    int ready = load_fixture_pages(&pages.fixture) == 0 && pages.gzip.search != NULL && pages.gzip.discography != NULL && pages.gzip.album != NULL;
+    check(ready, "the fixture pages and their compressed copies are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_compression, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free_fixture_pages(&pages.fixture);
+        free_fixture_pages(&pages.gzip);
+        return test_summary("test_compression");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "compression") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    get_cache()->enabled = 0;
+
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList plain_bands, gzip_bands;
+    AlbumInfoList plain_albums, gzip_albums;
+    SongInfoList plain_songs, gzip_songs;
+    init_band_list(&plain_bands, &arena);
+    init_band_list(&gzip_bands, &arena);
+    init_album_list(&plain_albums, &arena);
+    init_album_list(&gzip_albums, &arena);
+    init_song_list(&plain_songs, &arena);
+    init_song_list(&gzip_songs, &arena);
+
+    RocknationSession *session = get_session();
+
+    // Uncompressed first: every byte over the wire is a byte of page
+    long accepted = mock_gzip_accepted(&server);
+    check(lookup(base, 1, &plain_bands, &plain_albums, &plain_songs), "the lookups succeed uncompressed");
+    check(mock_gzip_accepted(&server) - accepted == 4, "every catalog request accepts gzip");
+    check(session->page_wire_bytes == session->page_decoded_bytes, "uncompressed pages are as big over the wire as decoded");
+
+    // Compressed, the same results for fewer bytes
+    mock_serve_gzip(&server, route_gzip);
+    curl_off_t wire = session->page_wire_bytes;
+    curl_off_t decoded = session->page_decoded_bytes;
+    check(lookup(base, 2, &gzip_bands, &gzip_albums, &gzip_songs), "the lookups succeed compressed");
+    wire = session->page_wire_bytes - wire;
+    decoded = session->page_decoded_bytes - decoded;
+    check(plain_bands.count == gzip_bands.count && same_albums(&plain_albums, &gzip_albums) && same_songs(&plain_songs, &gzip_songs),
+          "compressed pages give the same results");
+    check(decoded == (curl_off_t)(pages.fixture.search_size + pages.fixture.discography_size + pages.fixture.album_size),
+          "the pages are decoded whole");
+    check(wire < decoded, "compressed pages take fewer bytes over the wire");
+
+    // A song isn't compressed, nor asked to be
+    char url[MAX_URL_LENGTH];
+    char output[sizeof(directory) + 32];
+    snprintf(url, sizeof(url), "%s/song.mp3", base);
+    snprintf(output, sizeof(output), "%s/song.mp3", directory);
+    accepted = mock_gzip_accepted(&server);
+    int saved = silence_stdout();
+    int downloaded = download_file(url, output);
+    restore_stdout(saved);
+    check(downloaded == 0 && mock_gzip_accepted(&server) == accepted, "a song download doesn't ask for compression");
+
+    printf("catalog pages: %lld bytes over the wire for %lld decoded, %.0f%% saved\n", (long long)wire, (long long)decoded,
+           decoded > 0 ? 100.0 - 100.0 * (double)wire / (double)decoded : 0.0);
+
+    arena_free(&arena);
+    mock_server_stop(&server);
+    store_close();
+
+    char path[sizeof(directory) + 32];
+    snprintf(path, sizeof(path), "%s/%s", directory, STORE_FILE);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/%s", directory, SNAPSHOT_FILE);
+    remove(path);
+    remove(output);
+    rmdir(directory);
+    free_fixture_pages(&pages.fixture);
+    free_fixture_pages(&pages.gzip);
+
+    return test_summary("test_compression");
+}
@@ -0,0 +1,321 @@
+// test_crawl.c
+// Checks the crawl (rocknation_crawl.h) against a local server (mock_server.h) answering with the fixture
+// pages: every band of a range gets a discography of its own, made from discography.html, and every album
+// page is album.html. A crawl must fill the catalog store with every album and song of the range and write
+// each band to the checkpoint. A band answered 503 once must be retried after the Retry-After the server
+// asked for. A band still answered 503 after CRAWL_RETRIES attempts must be left out of the checkpoint and
+// crawled by the next run, which must fetch nothing else. A line of the checkpoint cut short must be ignored,
+// and requests must not start faster than the rate limit. Prints the time of the first crawl and the rate the
+// requests of the rate limited one started at.
+#include "../include/rocknation_crawl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#include <strings.h>
+#include <unistd.h>
+
+#define CRAWL_BANDS 6        // Bands 1 to CRAWL_BANDS have albums, the bands after them have none
+#define CRAWL_BUSY_BAND 4    // Band whose first page answers 503 once
+#define CRAWL_FAILING_BAND 5 // Band whose first page answers 503 CRAWL_RETRIES times
+#define CRAWL_RATED_FIRST 101
+#define CRAWL_RATED_LAST 120
+#define CRAWL_TEST_RATE 40.0
+
+typedef struct
+{
+    FixturePages fixture;
+    char *discographies[CRAWL_BANDS + 1]; // Discography of each band, with album ids of its own
+    size_t discography_sizes[CRAWL_BANDS + 1];
+    int busy_answers[CRAWL_BANDS + 1]; // 503 answered so far to each band, only touched by the server
+} CrawlPages;
+
+static const char *route_crawl(const char *method, const char *path, size_t *size, void *userdata);
+static char *band_discography(const char *page, size_t size, int band, size_t *band_size);
+static int checkpoint_lines(const char *path, int id);
+static void check_band(const CrawlPages *pages, const SongInfoList *songs, int band);
+static int run_crawl(int first_id, int last_id, const CrawlOptions *options, double *elapsed);
+
+static const char *route_crawl(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_crawl(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the CrawlPages
+     * Output    : Returns the answer to the request, NULL for 404 or MOCK_BUSY for 503
+     * Procedure : This function answers the first page of the discography of bands 1 to CRAWL_BANDS with their own discography (after the 503 answers CRAWL_BUSY_BAND and CRAWL_FAILING_BAND get first) and any other page of a discography with an empty page. Albums are answered by route_fixture.
+     */
+
+    CrawlPages *pages = (CrawlPages *)userdata;
+    int id;
+    int page;
+
+    if (sscanf(path, "/mp3/band-%d/%d", &id, &page) == 2)
+    {
+        if (page != 1 || id < 1 || id > CRAWL_BANDS)
+        {
+            *size = 0;
+            return "";
+        }
+        if ((id == CRAWL_BUSY_BAND && pages->busy_answers[id] < 1) || (id == CRAWL_FAILING_BAND && pages->busy_answers[id] < CRAWL_RETRIES))
+        {
+            pages->busy_answers[id]++;
+            return MOCK_BUSY;
+        }
+        *size = pages->discography_sizes[id];
+        return pages->discographies[id];
+    }
+
+    return route_fixture(method, path, size, &pages->fixture);
+}
+
+static char *band_discography(const char *page, size_t size, int band, size_t *band_size)
+{
+    /* Function  : static char *band_discography(const char *page, size_t size, int band, size_t *band_size)
+     * Input     : page - pointer to discography.html
+     *             size - size of the page
+     *             band - band id, a single digit
+     *             band_size - pointer receiving the size of the new page
+     * Output    : Returns the discography of the band, to be freed by the caller, or NULL if it can't be allocated
+     * Procedure : This function copies the page with the band id put in front of every album id, whatever the case of the link, so no two bands share an album.
+     */
+
+    const char *marker = "/mp3/album-";
+    size_t marker_length = strlen(marker);
+    char *copy = malloc(size * 2 + 1);
+    size_t used = 0;
+
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        copy[used++] = page[i];
+        if (i + 1 >= marker_length && strncasecmp(page + i + 1 - marker_length, marker, marker_length) == 0)
+        {
+            copy[used++] = (char)('0' + band);
+        }
+    }
+    copy[used] = '\0';
+    *band_size = used;
+
+    return copy;
+}
+
+static int checkpoint_lines(const char *path, int id)
+{
+    /* Function  : static int checkpoint_lines(const char *path, int id)
+     * Input     : path - pointer to the path of the checkpoint file
+     *             id - band id
+     * Output    : Returns the number of lines of the checkpoint naming the band
+     * Procedure : This function reads the checkpoint file line by line.
+     */
+
+    FILE *file = fopen(path, "rb");
+    char line[64];
+    int count = 0;
+
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char *end;
+        long value = strtol(line, &end, 10);
+        count += end != line && *end == '\n' && value == id;
+    }
+
+    fclose(file);
+    return count;
+}
+
+static void check_band(const CrawlPages *pages, const SongInfoList *songs, int band)
+{
+    /* Function  : static void check_band(const CrawlPages *pages, const SongInfoList *songs, int band)
+     * Input     : pages - pointer to the CrawlPages
+     *             songs - pointer to the songs of album.html
+     *             band - band id
+     * Output    : None
+     * Procedure : This function checks the catalog store holds the discography of a band, as its page has it, and the songs of every one of its albums.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    AlbumInfoList albums;
+    AlbumInfoList stored;
+    SongInfoList stored_songs;
+    init_album_list(&albums, &arena);
+    init_album_list(&stored, &arena);
+    init_song_list(&stored_songs, &arena);
+
+    char url[MAX_URL_LENGTH];
+    char message[160];
+    snprintf(url, sizeof(url), "%s" STORE_BAND_PATH "%d", base_url(), band);
+    parse_albums(pages->discographies[band], pages->discography_sizes[band], &albums);
+
+    snprintf(message, sizeof(message), "the store holds the discography of band %d", band);
+    check(store_albums(url, &stored) == 0 && same_albums(&stored, &albums), message);
+
+    int complete = 1;
+    for (int i = 0; i < albums.count; i++)
+    {
+        stored_songs.count = 0;
+        complete = complete && store_songs(albums.albums[i].url, &stored_songs, NULL, NULL) == 0 && same_songs(&stored_songs, songs);
+    }
+    snprintf(message, sizeof(message), "the store holds the songs of every album of band %d", band);
+    check(complete, message);
+
+    arena_free(&arena);
+}
+
+static int run_crawl(int first_id, int last_id, const CrawlOptions *options, double *elapsed)
+{
+    /* Function  : static int run_crawl(int first_id, int last_id, const CrawlOptions *options, double *elapsed)
+     * Input     : first_id, last_id - range of band ids to crawl
+     *             options - pointer to the limits of the crawl
+     *             elapsed - pointer receiving the time the crawl took, or NULL
+     * Output    : Returns what crawl_catalog returns
+     * Procedure : This function runs a crawl with its progress lines silenced.
+     */
+
+    int saved = silence_stdout();
+    double started = rn_clock();
+    int failed = crawl_catalog(first_id, last_id, options);
+
+    if (elapsed != NULL)
+    {
+        *elapsed = rn_clock() - started;
+    }
+    restore_stdout(saved);
+
+    return failed;
+}
+
+int main(void)
+{
+    CrawlPages pages;
+    memset(&pages, 0, sizeof(pages));
+
+    int ready = load_fixture_pages(&pages.fixture) == 0;
+    for (int band = 1; ready && band <= CRAWL_BANDS; band++)
+    {
+        pages.discographies[band] = band_discography(pages.fixture.discography, pages.fixture.discography_size, band, &pages.discography_sizes[band]);
+        ready = pages.discographies[band] != NULL;
+    }
+    check(ready, "the fixture pages are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_crawl, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        return test_summary("test_crawl");
+    }
+
+    char directory[256];
+    char base[64];
+    char checkpoint[sizeof(directory) + 32];
+    if (make_test_directory(directory, sizeof(directory), "crawl") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    snprintf(checkpoint, sizeof(checkpoint), "%s/%s", directory, CRAWL_CHECKPOINT_FILE);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    get_cache()->enabled = 0;
+
+    // What the pages hold
+    Arena arena;
+    arena_init(&arena, 0);
+    AlbumInfoList albums;
+    SongInfoList songs;
+    init_album_list(&albums, &arena);
+    init_song_list(&songs, &arena);
+    parse_albums(pages.discographies[1], pages.discography_sizes[1], &albums);
+    parse_songs(pages.fixture.album, pages.fixture.album_size, &songs);
+    check(albums.count > 0 && songs.count > 0, "the fixture pages hold albums and songs");
+    long band_requests = albums.count + 2; // Two pages of discography and every album
+
+    // A crawl of the range, one band of which fails
+    CrawlOptions options = {4, 2, 0, CRAWL_BURST};
+    long requests = mock_requests(&server);
+    double elapsed = 0;
+    int failed = run_crawl(1, CRAWL_BANDS, &options, &elapsed);
+
+    check(failed == 1, "the crawl reports the band that failed");
+    check(mock_requests(&server) == requests + (CRAWL_BANDS - 1) * band_requests + 1 + CRAWL_RETRIES,
+          "the crawl requests every page once, and the pages answered 503 again");
+    check(elapsed >= 3.0 * 0.95, "the crawl waits as long as the server asked, longer after each failure");
+    printf("Crawl of %d bands, %ld requests, %d answered 503: %.1f s\n", CRAWL_BANDS, mock_requests(&server) - requests, 1 + CRAWL_RETRIES, elapsed);
+    for (int band = 1; band <= CRAWL_BANDS; band++)
+    {
+        if (band != CRAWL_FAILING_BAND)
+        {
+            check_band(&pages, &songs, band);
+        }
+    }
+    int listed = 1;
+    for (int band = 1; band <= CRAWL_BANDS; band++)
+    {
+        listed = listed && checkpoint_lines(checkpoint, band) == (band != CRAWL_FAILING_BAND);
+    }
+    check(listed, "the checkpoint lists every band crawled, and not the one that failed");
+
+    // The next run only crawls the band that failed
+    requests = mock_requests(&server);
+    failed = run_crawl(1, CRAWL_BANDS, &options, NULL);
+    check(failed == 0 && mock_requests(&server) == requests + band_requests, "the next run only crawls the band that failed");
+    check_band(&pages, &songs, CRAWL_FAILING_BAND);
+    check(checkpoint_lines(checkpoint, CRAWL_FAILING_BAND) == 1, "the band that failed is in the checkpoint once crawled");
+
+    // A checkpoint whose last line was cut short, by a crash say
+    FILE *file = fopen(checkpoint, "wb");
+    if (file != NULL)
+    {
+        fputs(CRAWL_MAGIC "\n1\n2", file);
+        fclose(file);
+    }
+    requests = mock_requests(&server);
+    failed = run_crawl(1, CRAWL_BANDS, &options, NULL);
+    check(failed == 0 && mock_requests(&server) == requests, "bands already in the store aren't fetched again");
+    int again = 1;
+    for (int band = 2; band <= CRAWL_BANDS; band++)
+    {
+        again = again && checkpoint_lines(checkpoint, band) == 1;
+    }
+    check(checkpoint_lines(checkpoint, 1) == 1 && again, "a line of the checkpoint cut short is ignored, and its band crawled again");
+    check(checkpoint_lines(checkpoint, 23) == 0, "a line cut short doesn't run into the band written after it");
+
+    // The rate limit, on bands without albums: one request each
+    CrawlOptions rated = {4, 2, CRAWL_TEST_RATE, 1.0};
+    int rated_bands = CRAWL_RATED_LAST - CRAWL_RATED_FIRST + 1;
+    requests = mock_requests(&server);
+    failed = run_crawl(CRAWL_RATED_FIRST, CRAWL_RATED_LAST, &rated, &elapsed);
+    check(failed == 0 && mock_requests(&server) == requests + rated_bands, "a rate limited crawl requests every band");
+    check(elapsed >= (rated_bands - 1) / CRAWL_TEST_RATE * 0.95, "requests don't start faster than the rate limit");
+    printf("%d requests at %.0f per second took %.2f s, %.1f per second\n", rated_bands, CRAWL_TEST_RATE, elapsed, rated_bands / elapsed);
+
+    arena_free(&arena);
+    mock_server_stop(&server);
+    check(pages.busy_answers[CRAWL_BUSY_BAND] == 1 && pages.busy_answers[CRAWL_FAILING_BAND] == CRAWL_RETRIES, "the server answered 503 as planned");
+    store_close();
+
+    char path[sizeof(directory) + 32];
+    snprintf(path, sizeof(path), "%s/%s", directory, STORE_FILE);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/%s", directory, SNAPSHOT_FILE);
+    remove(path);
+    remove(checkpoint);
+    rmdir(directory);
+    for (int band = 1; band <= CRAWL_BANDS; band++)
+    {
+        free(pages.discographies[band]);
+    }
+    free_fixture_pages(&pages.fixture);
+
+    return test_summary("test_crawl");
+}
@@ -0,0 +1,723 @@
+// test_disk.c
+// Checks the writes of downloads through the disk writer (rocknation_disk.h): several threads stream data
+// into many part files at once, in uneven chunks like transfers do, and commit them. Every file must come
+// out whole under its final name, and a part file must never have a hole: a write may only start where the
+// file ends, so a part file cut short by a crash is still a prefix of the download and resumes correctly.
+// Built with -Wl,--wrap=pwrite, so the writes of the pool writer are watched (and slowed down, to give a
+// later write of a file every chance to overtake an earlier one), and with -Wl,--wrap=syscall, so the
+// entries the io_uring writer submits and the completions it reaps are followed too: an operation of a
+// file may only be submitted linked behind the one before it, never beside one in flight. The same runs
+// go through the io_uring when there is one; the ring is also given every write and the commit of several
+// files at once, straight to the writer, and must chain those of a file and still carry them out in
+// order. With threads writing at once, the ring must take well under the system calls of the pool for the
+// same files. Prints the requests, system calls and throughput of both writers.
+#include "../include/rocknation_loop.h"
+#include "test_util.h"
+
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#define DISK_THREADS 4
+#define DISK_MAX_FILES 32
+#define DISK_MAX_FD 4096
+#define DISK_MAX_CHUNK 20000
+#define DISK_RING_SHARE 3 // The ring takes at most DISK_RING_SHARE quarters of the system calls of the pool when threads write at once
+#define ORDER_FILES 8
+#define ORDER_SIZE (1024 * 1024)
+#define ORDER_MIN_CHUNK 1024
+#define ORDER_MAX_REQUESTS (ORDER_SIZE / ORDER_MIN_CHUNK + 2) // Writes of a file and its commit
+
+typedef struct
+{
+    DiskWriter *writer;
+    const char *directory;
+    int first;    // First file of the thread
+    int count;    // Files of the thread
+    size_t size;  // Size of every file
+    unsigned seed;
+    int failures;
+} DiskProducer;
+
+typedef struct
+{
+    size_t next;      // Offset the next write must complete at
+    int out_of_order; // Requests that completed before one queued ahead of them
+    int failures;
+    int committed;
+} OrderedFile;
+
+typedef struct
+{
+    DiskRequest request;
+    OrderedFile *file;
+} OrderedRequest;
+
+typedef struct
+{
+    DiskRequest *request;
+    int fd;
+} RingOperation;
+
+// Watched by __wrap_pwrite
+static int fd_in_flight[DISK_MAX_FD];
+static int max_in_flight = 0;
+static long pool_calls = 0; // System calls of the last run of the pool writer
+static long holes = 0;
+static int pwrite_delay_us = 0;
+static long committed = 0;
+static DiskWriter *watched_ring = NULL; // Writer whose ring __wrap_syscall follows
+static int gate_open = 0;               // Lets gate_done return
+
+#ifdef DISK_URING
+// Operations of the watched ring in flight, kept by its thread, see watch_ring
+static DiskWriter *ring_writer = NULL;
+static unsigned ring_reaped = 0;
+static RingOperation ring_operations[DISK_RING_ENTRIES];
+static int ring_count = 0;
+static long ring_beside = 0;  // Operations submitted while one of the same file was in flight
+static long ring_crossed = 0; // Operations linked behind one of another file
+static long ring_linked = 0;  // Operations linked behind one of the same file
+#endif
+
+ssize_t __real_pwrite(int fd, const void *buffer, size_t length, off_t offset);
+ssize_t __wrap_pwrite(int fd, const void *buffer, size_t length, off_t offset);
+long __real_syscall(long number, ...);
+long __wrap_syscall(long number, ...);
+
+#ifdef DISK_URING
+static void watch_ring(DiskWriter *writer);
+#endif
+static void watch(DiskWriter *writer);
+static void note_in_flight(int fd, int change);
+
+static unsigned char pattern_byte(int file, size_t offset);
+static void file_path(const char *directory, int file, char *path, size_t size);
+static void file_done(long result, void *userdata);
+static void producer_main(void *argument);
+static int check_file(const char *directory, int file, size_t size);
+static void run_writer(const char *directory, int use_ring, int files, size_t size, int delay_us);
+static void ordered_done(long result, void *userdata);
+static void gate_done(long result, void *userdata);
+static void run_ordered(const char *directory);
+
+ssize_t __wrap_pwrite(int fd, const void *buffer, size_t length, off_t offset)
+{
+    /*
+     * Function  : ssize_t __wrap_pwrite(int fd, const void *buffer, size_t length, off_t offset)
+     * Input     : fd, buffer, length, offset - arguments of pwrite
+     * Output    : Returns what pwrite returns
+     * Procedure : This function stands in for every pwrite of the program. It counts a hole when the write starts past the end of the file, keeps the largest number of writes of one file in flight at once, and sleeps pwrite_delay_us before writing.
+     */
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && offset > info.st_size)
+    {
+        RN_ATOMIC_ADD(holes, 1);
+    }
+
+    note_in_flight(fd, 1);
+    if (pwrite_delay_us > 0)
+    {
+        usleep((useconds_t)pwrite_delay_us);
+    }
+    ssize_t written = __real_pwrite(fd, buffer, length, offset);
+    note_in_flight(fd, -1);
+
+    return written;
+}
+
+long __wrap_syscall(long number, ...)
+{
+    /*
+     * Function  : long __wrap_syscall(long number, ...)
+     * Input     : number, ... - arguments of syscall, up to six of them
+     * Output    : Returns what syscall returns
+     * Procedure : This function stands in for every syscall of the program, and follows the ring of the watched writer before each of its io_uring_enter calls (see watch_ring).
+     */
+
+    va_list arguments;
+    long argument[6];
+    va_start(arguments, number);
+    for (int i = 0; i < 6; i++)
+    {
+        argument[i] = va_arg(arguments, long);
+    }
+    va_end(arguments);
+
+#ifdef DISK_URING
+    DiskWriter *writer = __atomic_load_n(&watched_ring, __ATOMIC_ACQUIRE);
+    if (writer != NULL && number == __NR_io_uring_enter && (int)argument[0] == writer->ring_fd)
+    {
+        watch_ring(writer);
+    }
+#endif
+
+    return __real_syscall(number, argument[0], argument[1], argument[2], argument[3], argument[4], argument[5]);
+}
+
+#ifdef DISK_URING
+static void watch_ring(DiskWriter *writer)
+{
+    /* Function  : static void watch_ring(DiskWriter *writer)
+     * Input     : writer - pointer to the watched writer, about to call io_uring_enter on its thread
+     * Output    : None
+     * Procedure : This function ends the operations whose completions the writer reaped since its last call, and starts one on the file of every request entry about to be submitted. An entry must either be linked behind the entry before it, of the same file, or have no operation of its file in flight; a link to an entry of another file is counted too. The file is noted at submission, as a request may be reused once it is complete; an entry left over by an interrupted call is only counted once.
+     */
+
+    if (ring_writer == NULL)
+    {
+        ring_writer = writer;
+        ring_reaped = __atomic_load_n(writer->cq_head, __ATOMIC_ACQUIRE);
+    }
+
+    for (; ring_reaped != *writer->cq_head; ring_reaped++)
+    {
+        DiskRequest *request = (DiskRequest *)(uintptr_t)writer->cqes[ring_reaped & *writer->cq_mask].user_data;
+        for (int i = 0; request != NULL && i < ring_count; i++)
+        {
+            if (ring_operations[i].request == request)
+            {
+                note_in_flight(ring_operations[i].fd, -1);
+                ring_operations[i] = ring_operations[--ring_count];
+                break;
+            }
+        }
+    }
+
+    int previous_fd = -1;
+    int previous_linked = 0;
+
+    for (unsigned head = __atomic_load_n(writer->sq_head, __ATOMIC_ACQUIRE); head != *writer->sq_tail; head++)
+    {
+        struct io_uring_sqe *sqe = &writer->sqes[writer->sq_array[head & *writer->sq_mask]];
+        DiskRequest *request = (DiskRequest *)(uintptr_t)sqe->user_data;
+        int counted = request == NULL || ring_count == DISK_RING_ENTRIES;
+        for (int i = 0; !counted && i < ring_count; i++)
+        {
+            counted = ring_operations[i].request == request;
+        }
+
+        int fd = request != NULL ? request->fd : -1;
+        if (!counted)
+        {
+            int linked = previous_linked && previous_fd == fd;
+            ring_linked += linked;
+            if (!linked && fd >= 0 && fd < DISK_MAX_FD && fd_in_flight[fd] > 0)
+            {
+                ring_beside++;
+            }
+
+            note_in_flight(fd, 1);
+            ring_operations[ring_count].request = request;
+            ring_operations[ring_count].fd = fd;
+            ring_count++;
+        }
+
+        ring_crossed += previous_linked && previous_fd != fd;
+        previous_fd = fd;
+        previous_linked = (sqe->flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK)) != 0;
+    }
+}
+#endif
+
+static void watch(DiskWriter *writer)
+{
+    /* Function  : static void watch(DiskWriter *writer)
+     * Input     : writer - pointer to the writer to watch, or NULL to stop watching
+     * Output    : None
+     * Procedure : This function starts following the ring of a writer before anything is submitted to it, or stops once it is stopped, from the thread of the test. A writer of a later run may be allocated at the same address, so what was followed of the last one is forgotten; the counts of a run are kept until the next one starts. The completions reaped by the last turn of a writer come after its last io_uring_enter, so the operations still followed are over once it is stopped.
+     */
+
+#ifdef DISK_URING
+    for (int i = 0; i < ring_count; i++)
+    {
+        note_in_flight(ring_operations[i].fd, -1);
+    }
+    ring_writer = NULL;
+    ring_count = 0;
+    if (writer != NULL)
+    {
+        ring_beside = 0;
+        ring_crossed = 0;
+        ring_linked = 0;
+    }
+#endif
+    __atomic_store_n(&watched_ring, writer, __ATOMIC_RELEASE);
+}
+
+static void note_in_flight(int fd, int change)
+{
+    /* Function  : static void note_in_flight(int fd, int change)
+     * Input     : fd - file of an operation
+     *             change - 1 when the operation starts, -1 when it is over
+     * Output    : None
+     * Procedure : This function keeps the operations in flight on every file, and the most there ever were on one file at once in max_in_flight.
+     */
+
+    if (fd < 0 || fd >= DISK_MAX_FD)
+    {
+        return;
+    }
+
+    int in_flight = RN_ATOMIC_ADD(fd_in_flight[fd], change) + change;
+    int max = RN_ATOMIC_ADD(max_in_flight, 0);
+    while (in_flight > max && !__atomic_compare_exchange_n(&max_in_flight, &max, in_flight, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+static unsigned char pattern_byte(int file, size_t offset)
+{
+    /* Function  : static unsigned char pattern_byte(int file, size_t offset)
+     * Input     : file - number of the file
+     *             offset - position in the file
+     * Output    : Returns the byte the file holds at that position, never 0, so a hole can't pass for data
+     * Procedure : This function gives every file its own contents.
+     */
+
+    return (unsigned char)((offset * 131 + (size_t)file * 17) % 251 + 1);
+}
+
+static void file_path(const char *directory, int file, char *path, size_t size)
+{
+    /* Function  : static void file_path(const char *directory, int file, char *path, size_t size)
+     * Input     : directory - pointer to the directory of the test
+     *             file - number of the file
+     *             path - buffer receiving the final name of the file
+     *             size - size of path
+     * Output    : None
+     * Procedure : This function names the files of the test.
+     */
+
+    snprintf(path, size, "%s/song-%02d.mp3", directory, file);
+}
+
+static void file_done(long result, void *userdata)
+{
+    /* Function  : static void file_done(long result, void *userdata)
+     * Input     : result - 0 once the file has its final name, or a negative errno
+     *             userdata - unused
+     * Output    : None
+     * Procedure : This function is the completion callback of the commits, it counts the files committed.
+     */
+
+    if (result == 0)
+    {
+        RN_ATOMIC_ADD(committed, 1);
+    }
+}
+
+static void producer_main(void *argument)
+{
+    /* Function  : static void producer_main(void *argument)
+     * Input     : argument - pointer to the DiskProducer of the thread
+     * Output    : None
+     * Procedure : This function is a thread receiving several downloads at once, the way the event loop does: it opens a part file for each, with the Content-Length known so its space gets reserved, hands them chunks of random sizes in turn through WriteFileCallback, and commits every file once it is complete.
+     */
+
+    DiskProducer *producer = (DiskProducer *)argument;
+    FileStruct files[DISK_MAX_FILES];
+    size_t sent[DISK_MAX_FILES];
+    char names[DISK_MAX_FILES][512];
+    unsigned char chunk[DISK_MAX_CHUNK];
+    int open = 0;
+
+    for (int i = 0; i < producer->count; i++)
+    {
+        file_path(producer->directory, producer->first + i, names[i], sizeof(names[i]));
+        sent[i] = 0;
+        if (open_file_struct(&files[i], names[i]) != 0)
+        {
+            producer->failures++;
+            close_file_struct(&files[i], 0);
+            sent[i] = producer->size;
+            continue;
+        }
+        attach_disk_writer(&files[i], producer->writer);
+        files[i].expected_size = (curl_off_t)producer->size;
+        open++;
+    }
+
+    while (open > 0)
+    {
+        for (int i = 0; i < producer->count; i++)
+        {
+            if (sent[i] == producer->size)
+            {
+                continue;
+            }
+
+            size_t length = (size_t)rand_r(&producer->seed) % DISK_MAX_CHUNK + 1;
+            if (length > producer->size - sent[i])
+            {
+                length = producer->size - sent[i];
+            }
+            for (size_t j = 0; j < length; j++)
+            {
+                chunk[j] = pattern_byte(producer->first + i, sent[i] + j);
+            }
+
+            if (WriteFileCallback(chunk, 1, length, &files[i]) != length)
+            {
+                producer->failures++;
+            }
+            sent[i] += length;
+
+            if (sent[i] == producer->size)
+            {
+                if (commit_file_struct(&files[i], file_done, NULL) != 0)
+                {
+                    producer->failures++;
+                    close_file_struct(&files[i], 1);
+                }
+                open--;
+            }
+        }
+    }
+}
+
+static int check_file(const char *directory, int file, size_t size)
+{
+    /* Function  : static int check_file(const char *directory, int file, size_t size)
+     * Input     : directory - pointer to the directory of the test
+     *             file - number of the file
+     *             size - size the file must have
+     * Output    : Returns 1 if the file has its final name, its size and its contents, and no part file is left
+     * Procedure : This function reads a committed file back and removes it.
+     */
+
+    char path[512];
+    char part[520];
+    file_path(directory, file, path, sizeof(path));
+    snprintf(part, sizeof(part), "%s.part", path);
+
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL)
+    {
+        return 0;
+    }
+
+    size_t offset = 0;
+    int same = 1;
+    int byte;
+    while ((byte = fgetc(stream)) != EOF)
+    {
+        same = same && byte == pattern_byte(file, offset);
+        offset++;
+    }
+    fclose(stream);
+
+    struct stat info;
+    same = same && offset == size && stat(part, &info) != 0;
+    remove(path);
+
+    return same;
+}
+
+static void run_writer(const char *directory, int use_ring, int files, size_t size, int delay_us)
+{
+    /* Function  : static void run_writer(const char *directory, int use_ring, int files, size_t size, int delay_us)
+     * Input     : directory - pointer to the directory the files are written to
+     *             use_ring - non-zero to write through the io_uring when there is one, 0 for the pool
+     *             files - number of files, spread over DISK_THREADS threads
+     *             size - size of every file
+     *             delay_us - time every pwrite is held up, 0 to measure the throughput
+     * Output    : None
+     * Procedure : This function starts a writer of its own the chosen way, streams every file through it from DISK_THREADS threads, waits for the commits, checks the files, and prints what the writer did. The ring must take well under the system calls of the last run of the pool (DISK_RING_SHARE).
+     */
+
+    DiskWriter *writer = rn_calloc(1, sizeof(DiskWriter));
+    if (writer == NULL || disk_start(writer, use_ring) != 0)
+    {
+        check(0, "the disk writer starts");
+        free(writer);
+        return;
+    }
+
+    const char *kind = writer->ring ? "io_uring" : "pool";
+    DiskProducer producers[DISK_THREADS];
+    RnThread threads[DISK_THREADS];
+    char message[128];
+
+    holes = 0;
+    max_in_flight = 0;
+    committed = 0;
+    pwrite_delay_us = delay_us;
+    watch(writer->ring ? writer : NULL);
+
+    double started = rn_clock();
+    for (int i = 0; i < DISK_THREADS; i++)
+    {
+        producers[i].writer = writer;
+        producers[i].directory = directory;
+        producers[i].first = i * files / DISK_THREADS;
+        producers[i].count = (i + 1) * files / DISK_THREADS - producers[i].first;
+        producers[i].size = size;
+        producers[i].seed = 1234u + (unsigned)i;
+        producers[i].failures = 0;
+        rn_thread_start(&threads[i], producer_main, &producers[i]);
+    }
+    int failures = 0;
+    for (int i = 0; i < DISK_THREADS; i++)
+    {
+        rn_thread_join(threads[i]);
+        failures += producers[i].failures;
+    }
+    disk_wait(writer);
+    double elapsed = rn_clock() - started;
+
+    disk_stop(writer);
+    watch(NULL);
+    long requests = writer->requests[DISK_WRITE] + writer->requests[DISK_ALLOCATE] + writer->requests[DISK_COMMIT];
+    long calls = writer->calls;
+
+    int whole = 0;
+    for (int file = 0; file < files; file++)
+    {
+        whole += check_file(directory, file, size);
+    }
+
+    snprintf(message, sizeof(message), "%s writer: every file is streamed and committed", kind);
+    check(failures == 0 && committed == files, message);
+    snprintf(message, sizeof(message), "%s writer: every file is whole under its final name", kind);
+    check(whole == files, message);
+    snprintf(message, sizeof(message), "%s writer: no write starts past the end of its file", kind);
+    check(holes == 0, message);
+    if (writer->ring)
+    {
+#ifdef DISK_URING
+        check(ring_beside == 0 && ring_crossed == 0, "io_uring writer: the operations of a file are chained, never run beside each other");
+#endif
+        check(calls * 4 <= pool_calls * DISK_RING_SHARE, "io_uring writer: the requests of threads writing at once share their system calls");
+    }
+    else
+    {
+        check(max_in_flight <= 1, "pool writer: one write per file at a time");
+        pool_calls = calls;
+    }
+
+    if (delay_us == 0)
+    {
+        printf("%-8s %d files of %.1f MB from %d threads: %ld requests in %ld system calls, %.0f MB/s\n",
+               kind, files, size / (1024.0 * 1024.0), DISK_THREADS, requests, calls, bench_rate((double)files * size, elapsed));
+    }
+
+    free(writer);
+}
+
+static void ordered_done(long result, void *userdata)
+{
+    /* Function  : static void ordered_done(long result, void *userdata)
+     * Input     : result - bytes written, 0 for a commit, or a negative errno
+     *             userdata - pointer to the OrderedRequest
+     * Output    : None
+     * Procedure : This function is the completion callback of the requests of run_ordered. Every write of a file must complete at the offset the previous one ended at, and the commit once the whole file is written; it counts those that don't.
+     */
+
+    OrderedRequest *ordered = (OrderedRequest *)userdata;
+    OrderedFile *file = ordered->file;
+
+    if (ordered->request.operation == DISK_COMMIT)
+    {
+        file->out_of_order += file->next != ORDER_SIZE;
+        file->committed = result == 0;
+        return;
+    }
+
+    file->out_of_order += (size_t)ordered->request.offset != file->next;
+    file->failures += result != (long)ordered->request.length;
+    file->next = (size_t)ordered->request.offset + ordered->request.length;
+}
+
+static void gate_done(long result, void *userdata)
+{
+    /* Function  : static void gate_done(long result, void *userdata)
+     * Input     : result - unused
+     *             userdata - unused
+     * Output    : None
+     * Procedure : This function is the completion callback of the first request of run_ordered. It holds the thread of the ring up until gate_open is set, so every request queued in the meantime waits in the queue.
+     */
+
+    while (!__atomic_load_n(&gate_open, __ATOMIC_ACQUIRE))
+    {
+        usleep(100);
+    }
+}
+
+static void run_ordered(const char *directory)
+{
+    /* Function  : static void run_ordered(const char *directory)
+     * Input     : directory - pointer to the directory the files are written to
+     * Output    : None
+     * Procedure : This function starts an io_uring writer of its own and queues, at once and straight to it, the writes of ORDER_FILES part files in random chunks, taking the files in turn, followed by the commit of every file. The thread of the ring is held up in the callback of a first preallocation until everything is queued (see gate_done), so it finds all the requests queued at once. The ring must carry out the requests of a file in the order they were queued, so every file comes out whole and no write completes before the one ahead of it.
+     */
+
+    DiskWriter *writer = rn_calloc(1, sizeof(DiskWriter));
+    if (writer == NULL || disk_start(writer, 1) != 0)
+    {
+        check(0, "the disk writer starts");
+        free(writer);
+        return;
+    }
+    if (!writer->ring)
+    {
+        printf("io_uring  not available, order of the ring not checked\n");
+        disk_stop(writer);
+        free(writer);
+        return;
+    }
+
+    watch(writer);
+
+    OrderedFile files[ORDER_FILES];
+    char *data[ORDER_FILES];
+    char paths[ORDER_FILES][512];
+    char parts[ORDER_FILES][520];
+    OrderedRequest *requests[ORDER_FILES];
+    int counts[ORDER_FILES];
+    size_t sent[ORDER_FILES];
+    unsigned seed = 4321u;
+    int failures = 0;
+
+    for (int i = 0; i < ORDER_FILES; i++)
+    {
+        memset(&files[i], 0, sizeof(files[i]));
+        file_path(directory, i, paths[i], sizeof(paths[i]));
+        snprintf(parts[i], sizeof(parts[i]), "%s.part", paths[i]);
+        data[i] = malloc(ORDER_SIZE);
+        requests[i] = rn_calloc(ORDER_MAX_REQUESTS, sizeof(OrderedRequest));
+        counts[i] = 0;
+        sent[i] = 0;
+        for (size_t j = 0; data[i] != NULL && j < ORDER_SIZE; j++)
+        {
+            data[i][j] = (char)pattern_byte(i, j);
+        }
+    }
+
+    int fds[ORDER_FILES];
+    for (int i = 0; i < ORDER_FILES; i++)
+    {
+        fds[i] = data[i] != NULL && requests[i] != NULL ? open(parts[i], O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+        failures += fds[i] < 0;
+    }
+
+    DiskRequest gate;
+    memset(&gate, 0, sizeof(gate));
+    __atomic_store_n(&gate_open, 0, __ATOMIC_RELEASE);
+
+    if (failures == 0)
+    {
+        gate.operation = DISK_ALLOCATE;
+        gate.fd = fds[0];
+        gate.length = ORDER_SIZE;
+        gate.done = gate_done;
+        disk_submit(writer, &gate);
+
+        int left = ORDER_FILES;
+        while (left > 0)
+        {
+            for (int i = 0; i < ORDER_FILES; i++)
+            {
+                if (sent[i] == ORDER_SIZE)
+                {
+                    continue;
+                }
+
+                size_t length = (size_t)rand_r(&seed) % (DISK_MAX_CHUNK - ORDER_MIN_CHUNK) + ORDER_MIN_CHUNK;
+                if (length > ORDER_SIZE - sent[i])
+                {
+                    length = ORDER_SIZE - sent[i];
+                }
+
+                OrderedRequest *ordered = &requests[i][counts[i]++];
+                ordered->file = &files[i];
+                ordered->request.operation = DISK_WRITE;
+                ordered->request.fd = fds[i];
+                ordered->request.buffer = data[i] + sent[i];
+                ordered->request.length = length;
+                ordered->request.offset = (int64_t)sent[i];
+                ordered->request.done = ordered_done;
+                ordered->request.userdata = ordered;
+                disk_submit(writer, &ordered->request);
+                sent[i] += length;
+
+                if (sent[i] == ORDER_SIZE)
+                {
+                    // Queued right behind the writes, without waiting for them
+                    ordered = &requests[i][counts[i]++];
+                    ordered->file = &files[i];
+                    ordered->request.operation = DISK_COMMIT;
+                    ordered->request.fd = fds[i];
+                    ordered->request.path = parts[i];
+                    ordered->request.target = paths[i];
+                    ordered->request.done = ordered_done;
+                    ordered->request.userdata = ordered;
+                    disk_submit(writer, &ordered->request);
+                    left--;
+                }
+            }
+        }
+        __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        for (int i = 0; i < ORDER_FILES; i++)
+        {
+            if (fds[i] >= 0)
+            {
+                close(fds[i]);
+            }
+        }
+    }
+
+    double started = rn_clock();
+    disk_wait(writer);
+    double elapsed = rn_clock() - started;
+    disk_stop(writer);
+    watch(NULL);
+
+    int out_of_order = 0;
+    int whole = 0;
+    for (int i = 0; i < ORDER_FILES; i++)
+    {
+        out_of_order += files[i].out_of_order;
+        failures += files[i].failures + !files[i].committed;
+        whole += check_file(directory, i, ORDER_SIZE);
+        remove(parts[i]);
+        free(data[i]);
+        free(requests[i]);
+    }
+
+    check(failures == 0, "io_uring writer: every write and commit queued at once succeeds");
+    check(out_of_order == 0, "io_uring writer: the requests of a file complete in the order they were queued");
+#ifdef DISK_URING
+    check(ring_beside == 0 && ring_crossed == 0, "io_uring writer: the operations of a file are chained, never run beside each other, however many are queued");
+    check(ring_linked > 0, "io_uring writer: the requests of a file queued together are submitted as one chain");
+#endif
+    check(whole == ORDER_FILES, "io_uring writer: every file queued at once is whole under its final name");
+
+    printf("io_uring  %d files queued at once: %ld requests in %ld system calls, %.0f MB/s\n",
+           ORDER_FILES, writer->requests[DISK_WRITE] + writer->requests[DISK_COMMIT], writer->calls, bench_rate((double)ORDER_FILES * ORDER_SIZE, elapsed));
+
+    free(writer);
+}
+
+int main(void)
+{
+    char directory[256];
+
+    if (make_test_directory(directory, sizeof(directory), "disk") != 0)
+    {
+        return 1;
+    }
+
+    // Slowed down, so writes of a file could overtake each other if the writer let them
+    run_writer(directory, 0, 16, 1024 * 1024, 100);
+    run_writer(directory, 0, DISK_MAX_FILES, 4 * 1024 * 1024, 0);
+    run_writer(directory, 1, DISK_MAX_FILES, 4 * 1024 * 1024, 0);
+    run_ordered(directory);
+
+    rmdir(directory);
+
+    return test_summary("test_disk");
+}
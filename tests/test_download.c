@@ -0,0 +1,111 @@
+// test_download.c
+// Checks that download_file (rocknation_curl.h) streams a song to disk against a local server
+// (mock_server.h): songs of DOWNLOAD_TEST_SMALL and DOWNLOAD_TEST_LARGE bytes must land whole in their output
+// file, with no part file left, and the heap memory the library asks for while downloading must not grow
+// with the size of the song. A song the server doesn't have must leave no file behind. Prints the throughput
+// of the large download.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define DOWNLOAD_TEST_SMALL (1024 * 1024)
+#define DOWNLOAD_TEST_LARGE (16 * 1024 * 1024)
+#define DOWNLOAD_PATTERN 251 // Bytes of the payload repeat every DOWNLOAD_PATTERN + 1 bytes, not at a buffer size
+
+typedef struct
+{
+    char *payload; // DOWNLOAD_TEST_LARGE bytes, the small song is its start
+} DownloadPages;
+
+static const char *route_download(const char *method, const char *path, size_t *size, void *userdata);
+
+static const char *route_download(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_download(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the DownloadPages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers /small.mp3 and /large.mp3 with the start of the payload.
+     */
+
+    const DownloadPages *pages = (const DownloadPages *)userdata;
+
+    if (strcmp(path, "/small.mp3") == 0 || strcmp(path, "/large.mp3") == 0)
+    {
+        *size = path[1] == 's' ? DOWNLOAD_TEST_SMALL : DOWNLOAD_TEST_LARGE;
+        return pages->payload;
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    DownloadPages pages;
+    pages.payload = malloc(DOWNLOAD_TEST_LARGE);
+    for (size_t i = 0; pages.payload != NULL && i < DOWNLOAD_TEST_LARGE; i++)
+    {
+        pages.payload[i] = (char)(i % (DOWNLOAD_PATTERN + 1) + i / (1024 * 1024));
+    }
+
+    MockServer server;
+    if (pages.payload == NULL || mock_server_start(&server, route_download, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free(pages.payload);
+        return test_summary("test_download");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "download") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+
+    char url[MAX_URL_LENGTH];
+    char output[sizeof(directory) + 32];
+    char part[sizeof(output) + 8];
+    size_t small_bytes = 0;
+    size_t large_bytes = 0;
+    double elapsed = 0;
+
+    // The first download sets up the session and the disk writer, which stay for the rest of the run
+    snprintf(url, sizeof(url), "%s/small.mp3", base);
+    snprintf(output, sizeof(output), "%s/warm.mp3", directory);
+    check(run_download(download_file, url, output, &small_bytes, &elapsed) == 0 && same_file(output, pages.payload, DOWNLOAD_TEST_SMALL), "a first song is downloaded whole");
+    remove(output);
+
+    snprintf(output, sizeof(output), "%s/small.mp3", directory);
+    snprintf(part, sizeof(part), "%s.part", output);
+    check(run_download(download_file, url, output, &small_bytes, &elapsed) == 0 && same_file(output, pages.payload, DOWNLOAD_TEST_SMALL), "a small song is downloaded whole");
+    check(!file_exists(part), "no part file is left after a small song");
+    remove(output);
+
+    snprintf(url, sizeof(url), "%s/large.mp3", base);
+    snprintf(output, sizeof(output), "%s/large.mp3", directory);
+    snprintf(part, sizeof(part), "%s.part", output);
+    check(run_download(download_file, url, output, &large_bytes, &elapsed) == 0 && same_file(output, pages.payload, DOWNLOAD_TEST_LARGE), "a large song is downloaded whole");
+    check(!file_exists(part), "no part file is left after a large song");
+    check(large_bytes <= small_bytes + DOWNLOAD_BUFFER_SIZE,
+          "the heap memory of a download doesn't grow with the size of the song");
+    printf("%d MB downloaded in %.3f s, %.0f MB/s, %zu bytes of heap (%zu for %d MB)\n", DOWNLOAD_TEST_LARGE / (1024 * 1024), elapsed,
+           bench_rate(DOWNLOAD_TEST_LARGE, elapsed), large_bytes, small_bytes, DOWNLOAD_TEST_SMALL / (1024 * 1024));
+    remove(output);
+
+    snprintf(url, sizeof(url), "%s/missing.mp3", base);
+    snprintf(output, sizeof(output), "%s/missing.mp3", directory);
+    snprintf(part, sizeof(part), "%s.part", output);
+    check(run_download(download_file, url, output, &small_bytes, &elapsed) == -1, "a song the server doesn't have fails");
+    check(!file_exists(output) && !file_exists(part), "a song the server doesn't have leaves no file behind");
+
+    mock_server_stop(&server);
+    rmdir(directory);
+    free(pages.payload);
+
+    return test_summary("test_download");
+}
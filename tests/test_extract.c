@@ -0,0 +1,272 @@
+// test_extract.c
+// Checks the extraction patterns on the saved pages of tests/fixtures: the precompiled registry (JIT-compiled
+// when PCRE2 has a JIT), the PCRE2 interpreter and the streaming extractor fed the page in pieces must all find
+// the same matches, and parse_bands/parse_albums/parse_songs must return them. Then compares the throughput of
+// the registry with compiling the pattern for every page, as the code did before the registry. Built twice
+// by tests/run.sh: as is, and with ROCKNATION_REGEX_ONLY so the extractor runs PCRE2 partial matching instead
+// of the scanners of rocknation_scan.h.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+
+#define MAX_MATCHES 1024
+#define BENCH_SECONDS 0.2
+
+typedef struct
+{
+    PCRE2_SIZE offsets[MAX_MATCHES][12];
+    int count;
+    int groups;
+} MatchList;
+
+typedef struct
+{
+    const char *file;
+    PatternId pattern;
+} Fixture;
+
+static const Fixture fixtures[] = {
+    {"search.html", PATTERN_BAND},
+    {"discography.html", PATTERN_ALBUM},
+    {"album.html", PATTERN_SONG},
+};
+
+static int record_match(const char *subject, const PCRE2_SIZE *ovector, void *userdata);
+static void match_all(pcre2_code *code, uint32_t options, const char *page, size_t size, MatchList *list);
+static int same_matches(const MatchList *a, const MatchList *b);
+static void check_fixture(const Fixture *fixture, const char *page, size_t size);
+static void bench_fixture(const Fixture *fixture, const char *page, size_t size);
+
+static int record_match(const char *subject, const PCRE2_SIZE *ovector, void *userdata)
+{
+    /* Function  : static int record_match(const char *subject, const PCRE2_SIZE *ovector, void *userdata)
+     * Input     : subject - pointer to the page
+     *             ovector - pointer to the offsets of the match
+     *             userdata - pointer to the MatchList
+     * Output    : Returns 0 to carry on
+     * Procedure : This function is the MatchCallback of the extractor, keeping the offsets of every match.
+     */
+
+    MatchList *list = (MatchList *)userdata;
+    (void)subject;
+
+    if (list->count < MAX_MATCHES)
+    {
+        memcpy(list->offsets[list->count], ovector, sizeof(PCRE2_SIZE) * 2 * (list->groups + 1));
+    }
+    list->count++;
+
+    return 0;
+}
+
+static void match_all(pcre2_code *code, uint32_t options, const char *page, size_t size, MatchList *list)
+{
+    /* Function  : static void match_all(pcre2_code *code, uint32_t options, const char *page, size_t size, MatchList *list)
+     * Input     : code - compiled pattern
+     *             options - match options (PCRE2_NO_JIT to run the interpreter)
+     *             page - pointer to the page
+     *             size - size of the page
+     *             list - pointer to the MatchList receiving the matches
+     * Output    : None
+     * Procedure : This function collects every match of a pattern over a complete page with plain pcre2_match calls.
+     */
+
+    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(code, NULL);
+    size_t offset = 0;
+
+    list->count = 0;
+    while (offset < size && pcre2_match(code, (PCRE2_SPTR)page, size, offset, options, match_data, NULL) > 0)
+    {
+        PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(match_data);
+        record_match(page, ovector, list);
+        offset = ovector[1];
+    }
+
+    pcre2_match_data_free(match_data);
+}
+
+static int same_matches(const MatchList *a, const MatchList *b)
+{
+    /* Function  : static int same_matches(const MatchList *a, const MatchList *b)
+     * Input     : a, b - pointers to the MatchLists to compare
+     * Output    : Returns 1 if both hold the same matches with the same groups, 0 otherwise
+     * Procedure : This function compares two sets of matches offset by offset.
+     */
+
+    if (a->count != b->count || a->count > MAX_MATCHES)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < a->count; i++)
+    {
+        if (memcmp(a->offsets[i], b->offsets[i], sizeof(PCRE2_SIZE) * 2 * (a->groups + 1)) != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void check_fixture(const Fixture *fixture, const char *page, size_t size)
+{
+    /* Function  : static void check_fixture(const Fixture *fixture, const char *page, size_t size)
+     * Input     : fixture - pointer to the fixture and the pattern it is scanned with
+     *             page - pointer to the page
+     *             size - size of the page
+     * Output    : None
+     * Procedure : This function compares the matches of the PCRE2 interpreter, of the registry and of the extractor fed the page in pieces of several sizes (a growing buffer, like a download), then the lists built by the parse functions.
+     */
+
+    static MatchList reference, other;
+    char what[256];
+    CompiledPattern *compiled = get_pattern(fixture->pattern);
+    uint32_t groups = 0;
+
+    check(compiled != NULL, "the pattern compiles");
+    if (compiled == NULL)
+    {
+        return;
+    }
+
+    pcre2_pattern_info(compiled->code, PCRE2_INFO_CAPTURECOUNT, &groups);
+    reference.groups = other.groups = (int)groups;
+
+    match_all(compiled->code, PCRE2_NO_JIT, page, size, &reference);
+    snprintf(what, sizeof(what), "%s has matches", fixture->file);
+    check(reference.count > 0, what);
+
+    match_all(compiled->code, 0, page, size, &other);
+    snprintf(what, sizeof(what), "%s: the registry (jit=%d) matches like the interpreter", fixture->file, compiled->jit);
+    check(same_matches(&reference, &other), what);
+
+    const size_t steps[] = {1, 3, 17, 64, 1000, PAGE_BUFFER_SIZE, 0};
+    for (int s = 0; steps[s] != 0; s++)
+    {
+        StreamExtractor extractor;
+        extractor_init(&extractor, fixture->pattern, record_match, &other);
+        other.count = 0;
+
+        for (size_t received = steps[s]; received < size; received += steps[s])
+        {
+            extractor_feed(&extractor, page, received, 0);
+        }
+        extractor_feed(&extractor, page, size, 1);
+
+        snprintf(what, sizeof(what), "%s: the extractor fed %zu bytes at a time matches like the interpreter", fixture->file, steps[s]);
+        check(same_matches(&reference, &other) && extractor.matches == reference.count, what);
+    }
+
+    Arena arena;
+    arena_init(&arena, 0);
+    int parsed = 0;
+    int first = 1;
+
+    if (fixture->pattern == PATTERN_BAND)
+    {
+        BandInfoList bands;
+        init_band_list(&bands, &arena);
+        parsed = parse_bands(page, size, &bands);
+        first = bands.count > 0 && strncmp(bands.bands[0].name, page + reference.offsets[0][4], reference.offsets[0][5] - reference.offsets[0][4]) == 0;
+    }
+    else if (fixture->pattern == PATTERN_ALBUM)
+    {
+        AlbumInfoList albums;
+        init_album_list(&albums, &arena);
+        parsed = parse_albums(page, size, &albums);
+        first = albums.count > 0 && strncmp(albums.albums[0].name, page + reference.offsets[0][6], reference.offsets[0][7] - reference.offsets[0][6]) == 0;
+    }
+    else
+    {
+        SongInfoList songs;
+        init_song_list(&songs, &arena);
+        parsed = parse_songs(page, size, &songs);
+        first = songs.count > 0 && strncmp(songs.songs[0].url, page + reference.offsets[0][2], reference.offsets[0][3] - reference.offsets[0][2]) == 0;
+    }
+
+    snprintf(what, sizeof(what), "%s: the parse function returns every match", fixture->file);
+    check(parsed == reference.count && first, what);
+
+    arena_free(&arena);
+}
+
+static void bench_fixture(const Fixture *fixture, const char *page, size_t size)
+{
+    /* Function  : static void bench_fixture(const Fixture *fixture, const char *page, size_t size)
+     * Input     : fixture - pointer to the fixture and the pattern it is scanned with
+     *             page - pointer to the page
+     *             size - size of the page
+     * Output    : None
+     * Procedure : This function measures how fast the page is scanned: compiling the pattern for the page and matching it with the interpreter (the code before the registry), matching it with the precompiled registry, and running the extractor the parse functions use (the scanner of rocknation_scan.h for bands and albums, unless built with ROCKNATION_REGEX_ONLY).
+     */
+
+    CompiledPattern *compiled = get_pattern(fixture->pattern);
+    static MatchList list;
+    double rates[3];
+
+    for (int method = 0; method < 3; method++)
+    {
+        double started = rn_clock();
+        double elapsed = 0;
+        long pages = 0;
+
+        do
+        {
+            if (method == 0)
+            {
+                int errorcode;
+                PCRE2_SIZE erroroffset;
+                pcre2_code *code = pcre2_compile((PCRE2_SPTR)compiled->pattern, PCRE2_ZERO_TERMINATED, compiled->options, &errorcode, &erroroffset, NULL);
+                match_all(code, PCRE2_NO_JIT, page, size, &list);
+                pcre2_code_free(code);
+            }
+            else if (method == 1)
+            {
+                match_all(compiled->code, 0, page, size, &list);
+            }
+            else
+            {
+                StreamExtractor extractor;
+                extractor_init(&extractor, fixture->pattern, record_match, &list);
+                list.count = 0;
+                extractor_feed(&extractor, page, size, 1);
+            }
+            pages++;
+            elapsed = rn_clock() - started;
+        } while (elapsed < BENCH_SECONDS);
+
+        rates[method] = bench_rate((double)size * pages, elapsed);
+    }
+
+    printf("%-17s %5.1f KB  compiled per page %8.1f MB/s  registry %8.1f MB/s  extractor %8.1f MB/s\n",
+           fixture->file, size / 1024.0, rates[0], rates[1], rates[2]);
+}
+
+int main(void)
+{
+    uint32_t jit = 0;
+    pcre2_config(PCRE2_CONFIG_JIT, &jit);
+#ifdef ROCKNATION_REGEX_ONLY
+    printf("PCRE2 JIT %s, extractor on PCRE2 only\n", jit ? "available" : "not available");
+#else
+    printf("PCRE2 JIT %s, extractor on the scanners\n", jit ? "available" : "not available");
+#endif
+
+    for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++)
+    {
+        size_t size;
+        char *page = read_fixture(fixtures[i].file, &size);
+
+        check(page != NULL, fixtures[i].file);
+        if (page == NULL)
+        {
+            continue;
+        }
+
+        check_fixture(&fixtures[i], page, size);
+        bench_fixture(&fixtures[i], page, size);
+        free(page);
+    }
+
+    return test_summary("test_extract");
+}
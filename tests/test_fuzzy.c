@@ -0,0 +1,287 @@
+// test_fuzzy.c
+// Checks the trigram index of band names (rocknation_fuzzy.h): how names are normalized, and on a few known
+// names that exact names, typos, prefixes and Cyrillic names find their band first, that results are ranked
+// and cut to k, and that a band indexed again under a new name is no longer found under the old one. Then
+// indexes FUZZY_BENCH_NAMES names of words drawn with English letter frequencies and runs FUZZY_QUERIES
+// queries: a third with a letter replaced, a third with a letter dropped, a third the first 6 bytes of a
+// name. The 99th percentile CPU time of a query must stay under the 1 ms target, with some room for a slower
+// machine; the wall-clock time also counts the time the thread is preempted, so it is only printed. Prints
+// the time to build the index, the mean, median and 99th percentile time of a query, and how often the band
+// a typo was made from is among the first 5 results.
+#include "../include/rocknation_fuzzy.h"
+#include "test_util.h"
+
+#define FUZZY_BENCH_NAMES 300000
+#define FUZZY_QUERIES 2000
+#define FUZZY_TOP 5
+#define FUZZY_MIN_RECALL 0.9 // Share of typos whose band must be among the first FUZZY_TOP results
+#define FUZZY_TARGET_US 1000 // 99th percentile time of a query
+#define FUZZY_MARGIN 1.5     // How far past the target a slower machine may push its CPU time
+
+static void check_normalize(const char *text, const char *expected);
+static int first_match(BandIndex *index, const char *query, int *distance);
+static void check_known_names(void);
+static void random_name(unsigned int *state, char *name, size_t size);
+static int compare_times(const void *a, const void *b);
+static void bench_index(void);
+
+static void check_normalize(const char *text, const char *expected)
+{
+    /* Function  : static void check_normalize(const char *text, const char *expected)
+     * Input     : text - pointer to a name as typed
+     *             expected - pointer to its normalized form
+     * Output    : None
+     * Procedure : This function checks the normalized form of a name.
+     */
+
+    char normalized[FUZZY_MAX_LENGTH + 1];
+    char message[160];
+
+    fuzzy_normalize(text, strlen(text), normalized, sizeof(normalized));
+    snprintf(message, sizeof(message), "\"%s\" is normalized to \"%s\"", text, expected);
+    check(strcmp(normalized, expected) == 0, message);
+}
+
+static int first_match(BandIndex *index, const char *query, int *distance)
+{
+    /* Function  : static int first_match(BandIndex *index, const char *query, int *distance)
+     * Input     : index - pointer to the BandIndex
+     *             query - pointer to the query
+     *             distance - pointer receiving the edit distance of the best match, or NULL
+     * Output    : Returns the band id of the best match, or -1 if nothing matched
+     * Procedure : This function runs a query and keeps its best match.
+     */
+
+    FuzzyMatch matches[FUZZY_TOP];
+
+    if (band_index_search(index, query, matches, FUZZY_TOP) <= 0)
+    {
+        return -1;
+    }
+    if (distance != NULL)
+    {
+        *distance = matches[0].distance;
+    }
+
+    return matches[0].band_id;
+}
+
+static void check_known_names(void)
+{
+    /* Function  : static void check_known_names(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function indexes a few real band names and checks what queries find among them.
+     */
+
+    static const char *names[] = {"Iron Maiden", "Metallica", "Megadeth", "Iron Savior", "Judas Priest", "AC/DC",
+                                  "Black Sabbath", "Blind Guardian", "Ария", "Кипелов", "The Iron Maidens"};
+    int count = (int)(sizeof(names) / sizeof(names[0]));
+    BandIndex index;
+    band_index_init(&index);
+
+    int added = 0;
+    for (int i = 0; i < count; i++)
+    {
+        added += band_index_add(&index, i + 1, names[i]) == 0;
+    }
+    check(added == count && index.count == count, "every name is indexed");
+
+    int distance = -1;
+    check(first_match(&index, "Iron Maiden", &distance) == 1 && distance == 0, "an exact name comes first, at distance 0");
+    check(first_match(&index, "iron maidn", &distance) == 1 && distance == 1, "a name with a letter missing finds its band");
+    check(first_match(&index, "Metalica", NULL) == 2, "a misspelled name finds its band");
+    check(first_match(&index, "megadet", NULL) == 3, "a name with its last letter missing finds its band");
+    check(first_match(&index, "Judas", NULL) == 5, "a prefix finds its band");
+    check(first_match(&index, "ac dc", &distance) == 6 && distance == 0, "punctuation doesn't matter");
+    check(first_match(&index, "АРИЯ", &distance) == 9 && distance == 0, "Cyrillic capitals match their lowercase");
+    check(first_match(&index, "кипелв", NULL) == 10, "a misspelled Cyrillic name finds its band");
+    check(first_match(&index, "zzzz", NULL) == -1, "a query sharing nothing with any name finds nothing");
+    check(first_match(&index, " !? ", NULL) == -1, "a query without letters finds nothing");
+
+    // Ranked best first and cut to k
+    FuzzyMatch matches[FUZZY_TOP];
+    int found = band_index_search(&index, "iron", matches, 3);
+    int ranked = found == 3;
+    for (int i = 1; i < found; i++)
+    {
+        ranked = ranked && matches[i - 1].score >= matches[i].score;
+    }
+    check(ranked, "a query returns k matches, best first");
+
+    // A band indexed again under a new name
+    check(band_index_add(&index, 7, "Heaven and Hell") == 0, "a band is indexed again under a new name");
+    check(first_match(&index, "Black Sabbath", NULL) != 7, "a band isn't found under its old name");
+    check(first_match(&index, "heaven and hell", &distance) == 7 && distance == 0, "a band is found under its new name");
+    check(band_index_add(&index, 7, "HEAVEN AND HELL!") == 0 && index.count == count + 1, "the same name in another form adds nothing");
+
+    band_index_free(&index);
+    check(index.count == 0 && first_match(&index, "iron", NULL) == -1, "a freed index is empty");
+}
+
+static void random_name(unsigned int *state, char *name, size_t size)
+{
+    /* Function  : static void random_name(unsigned int *state, char *name, size_t size)
+     * Input     : state - pointer to the state of the generator
+     *             name - pointer to the buffer receiving the name
+     *             size - size of the buffer
+     * Output    : None
+     * Procedure : This function makes up a band name of one to three words of 3 to 9 letters drawn with English letter frequencies.
+     */
+
+    // Letters repeated about as often as they are used in English
+    static const char letters[] = "eeeeeeeeeeeetttttttttaaaaaaaaoooooooiiiiiiinnnnnnnsssssshhhhhhrrrrrrddddllllcccuuummmwwffggyyppbbvk";
+    size_t used = 0;
+    int words = 1 + (int)(test_random(state) % 3);
+
+    for (int w = 0; w < words && used + 11 < size; w++)
+    {
+        int length = 3 + (int)(test_random(state) % 7);
+        if (w > 0)
+        {
+            name[used++] = ' ';
+        }
+        for (int i = 0; i < length; i++)
+        {
+            name[used++] = letters[test_random(state) % (sizeof(letters) - 1)];
+        }
+    }
+    name[used] = '\0';
+}
+
+static int compare_times(const void *a, const void *b)
+{
+    /* Function  : static int compare_times(const void *a, const void *b)
+     * Input     : a, b - pointers to two query times
+     * Output    : Returns a negative, zero or positive number as a is shorter, as long or longer than b
+     * Procedure : This function orders query times for qsort, to read the percentiles.
+     */
+
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_index(void)
+{
+    /* Function  : static void bench_index(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function indexes FUZZY_BENCH_NAMES made-up names and times FUZZY_QUERIES typo and prefix queries, checking the band a typo was made from is usually among the first results and the 99th percentile time against the target.
+     */
+
+    unsigned int state = 88172645u;
+    char (*names)[64] = malloc((size_t)FUZZY_BENCH_NAMES * sizeof(*names));
+    double *times = malloc(FUZZY_QUERIES * sizeof(double));
+    double *cpu_times = malloc(FUZZY_QUERIES * sizeof(double)); // The same without the time the thread was preempted
+    BandIndex index;
+    band_index_init(&index);
+
+    if (names == NULL || times == NULL || cpu_times == NULL)
+    {
+        free(names);
+        free(times);
+        free(cpu_times);
+        check(0, "the names of the benchmark are allocated");
+        return;
+    }
+
+    for (int i = 0; i < FUZZY_BENCH_NAMES; i++)
+    {
+        random_name(&state, names[i], sizeof(names[i]));
+    }
+
+    double started = rn_clock();
+    int added = 0;
+    for (int i = 0; i < FUZZY_BENCH_NAMES; i++)
+    {
+        added += band_index_add(&index, i, names[i]) == 0;
+    }
+    double build = rn_clock() - started;
+    check(added == FUZZY_BENCH_NAMES, "every name of the benchmark is indexed");
+
+    int typos = 0;
+    int recalled = 0;
+    int prefixes_found = 0;
+    double total = 0;
+    for (int q = 0; q < FUZZY_QUERIES; q++)
+    {
+        int id = (int)(test_random(&state) % FUZZY_BENCH_NAMES);
+        char query[64];
+        size_t length = strlen(names[id]);
+        size_t at = 1 + test_random(&state) % (length - 2);
+        int kind = q % 3;
+
+        memcpy(query, names[id], length + 1);
+        if (kind == 0)
+        {
+            query[at] = query[at] == 'x' ? 'q' : 'x';
+        }
+        else if (kind == 1)
+        {
+            memmove(query + at, query + at + 1, length - at);
+        }
+        else
+        {
+            query[6] = '\0';
+        }
+
+        FuzzyMatch matches[FUZZY_TOP];
+        double query_started = rn_clock();
+        double cpu_started = thread_cpu();
+        int found = band_index_search(&index, query, matches, FUZZY_TOP);
+        cpu_times[q] = thread_cpu() - cpu_started;
+        times[q] = rn_clock() - query_started;
+        total += times[q];
+
+        // Made-up names can repeat, and any band of the same name will do
+        int hit = 0;
+        for (int i = 0; i < found; i++)
+        {
+            hit = hit || strcmp(names[matches[i].band_id], names[id]) == 0;
+        }
+        if (kind < 2)
+        {
+            typos++;
+            recalled += hit;
+        }
+        else
+        {
+            prefixes_found += found > 0;
+        }
+    }
+
+    double recall = typos > 0 ? (double)recalled / typos : 0;
+    check(recall >= FUZZY_MIN_RECALL, "the band a typo was made from is usually among the first results");
+    check(prefixes_found == FUZZY_QUERIES - typos, "every prefix of a name finds something");
+
+    qsort(times, FUZZY_QUERIES, sizeof(double), compare_times);
+    qsort(cpu_times, FUZZY_QUERIES, sizeof(double), compare_times);
+    double p99 = times[FUZZY_QUERIES * 99 / 100] * 1e6;
+    double cpu_p99 = cpu_times[FUZZY_QUERIES * 99 / 100] * 1e6;
+    check(cpu_p99 < FUZZY_TARGET_US * FUZZY_MARGIN, "99% of queries are answered within the target");
+    printf("%d names indexed in %.0f ms (%d distinct trigrams)\n", FUZZY_BENCH_NAMES, build * 1000, index.posting_count);
+    printf("%d queries, top %d: mean %.0f us, p50 %.0f us, p99 %.0f us (%.0f us of CPU, target %d us), top-%d recall on typos %.1f%%\n",
+           FUZZY_QUERIES, FUZZY_TOP, total * 1e6 / FUZZY_QUERIES, times[FUZZY_QUERIES / 2] * 1e6, p99, cpu_p99, FUZZY_TARGET_US, FUZZY_TOP,
+           recall * 100);
+
+    band_index_free(&index);
+    free(names);
+    free(times);
+    free(cpu_times);
+}
+
+int main(void)
+{
+    check_normalize("AC/DC", "ac dc");
+    check_normalize("  Iron   Maiden!! ", "iron maiden");
+    check_normalize("Guns N' Roses", "guns n roses");
+    check_normalize("АРИЯ", "ария");
+    check_normalize("Ёлка", "ёлка");
+    check_normalize("Motörhead", "motörhead");
+
+    check_known_names();
+    bench_index();
+
+    return test_summary("test_fuzzy");
+}
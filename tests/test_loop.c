@@ -0,0 +1,570 @@
+// test_loop.c
+// Runs transfers of the event loop (rocknation_loop.h) against a local server (mock_server.h). Downloads
+// started with download_file_async must all land whole in their files, and pages fetched with
+// fetch_page_async must come back with their contents and status, however many run at once, and a
+// completion posted from another thread must be delivered with the loop freed as soon as it has run,
+// while the poster may still be in loop_post. Then measures
+// what the loop costs: LOOP_TRANSFERS transfers with 10, 100 and 1000 of them in flight at once, through the
+// EventLoop and through a plain curl_multi_perform loop for comparison. Prints the CPU time of the thread
+// driving them per transfer (the server runs on its own thread and isn't counted), the turns and the
+// transfers per second. Against a server answering at full speed nearly every transfer has something to
+// do on every turn, so looking only at the ready sockets saves nothing and the loop pays for its epoll
+// calls. The same runs against a paced server, which feeds a few connections at a time like a slow server
+// feeding many downloads, show what it saves once most transfers are waiting.
+#include "../include/rocknation_loop.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#include <sys/resource.h>
+
+#define LOOP_DOWNLOADS 200
+#define LOOP_PAGES 50
+#define LOOP_FILE_SIZE (256 * 1024)   // Size of a download
+#define LOOP_SMALL_SIZE (16 * 1024)   // Size of a transfer of the benchmark
+#define LOOP_TRANSFERS 5000           // Transfers of every run of the benchmark
+#define LOOP_PACED_TRANSFERS 1000     // Transfers of every run against the paced server
+#define LOOP_PIECE (4 * 1024)         // Bytes the paced server sends at once
+#define LOOP_PIECES_PER_MS 4          // Pieces the paced server sends per millisecond
+#define LOOP_PATTERN 251              // Files start at different places of the payload, see route_file
+#define LOOP_POSTS 200                // Loops each given a completion from another thread
+
+typedef struct
+{
+    char payload[LOOP_FILE_SIZE + LOOP_PATTERN];
+    char pages[LOOP_PAGES][32];
+} LoopFiles;
+
+typedef struct
+{
+    int done;
+    int failures;
+} LoopOutcome;
+
+typedef struct
+{
+    int number;  // Number of the page requested
+    long status; // Status it came back with, -1 until then
+    int same;    // Set if it held what the server sent
+} PageCheck;
+
+typedef struct
+{
+    EventLoop *loop;
+    LoopTransfer *transfer; // Held on loop, posted by the thread
+} PostedWork;
+
+typedef struct
+{
+    EventLoop *loop; // NULL for the curl_multi_perform run
+    CURLM *multi;
+    char base[64];
+    int transfers; // Transfers to run
+    int started;
+    int finished;
+    int failures;
+    size_t bytes;
+} BenchRun;
+
+static const char *route_file(const char *method, const char *path, size_t *size, void *userdata);
+static size_t discard_callback(char *data, size_t size, size_t nmemb, void *userdata);
+static void download_done(const char *output_file, int result, void *userdata);
+static void page_done(MemoryStruct *chunk, long status, void *userdata);
+static int check_download(const LoopFiles *files, const char *path, int number);
+static void post_main(void *argument);
+static void posted_done(CURL *curl, CURLcode result, void *userdata);
+static void start_transfer(BenchRun *run, CURL *curl);
+static void bench_done(CURL *curl, CURLcode result, void *userdata);
+static void settle_transfer(BenchRun *run, CURL *curl, CURLcode result);
+static void run_bench(const char *base, int transfers, int in_flight, int use_loop, double *cpu_us, double *rate, long *turns);
+static void compare_bench(const char *base, int transfers);
+static int raise_file_limit(int in_flight);
+
+static const char *route_file(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_file(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the LoopFiles
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers "/file/<n>" with LOOP_FILE_SIZE bytes and "/small/<n>" with LOOP_SMALL_SIZE bytes of the payload starting at n % LOOP_PATTERN, so every file has contents of its own, and "/page/<n>" with a short page naming n.
+     */
+
+    const LoopFiles *files = (const LoopFiles *)userdata;
+    int number;
+
+    if (sscanf(path, "/file/%d", &number) == 1 && number >= 0)
+    {
+        *size = LOOP_FILE_SIZE;
+        return files->payload + number % LOOP_PATTERN;
+    }
+    if (sscanf(path, "/small/%d", &number) == 1 && number >= 0)
+    {
+        *size = LOOP_SMALL_SIZE;
+        return files->payload + number % LOOP_PATTERN;
+    }
+    if (sscanf(path, "/page/%d", &number) == 1 && number >= 0 && number < LOOP_PAGES)
+    {
+        *size = strlen(files->pages[number]);
+        return files->pages[number];
+    }
+
+    return NULL;
+}
+
+static size_t discard_callback(char *data, size_t size, size_t nmemb, void *userdata)
+{
+    /* Function  : static size_t discard_callback(char *data, size_t size, size_t nmemb, void *userdata)
+     * Input     : data - pointer to the received bytes
+     *             size, nmemb - size of the received bytes
+     *             userdata - pointer to the BenchRun
+     * Output    : Returns the number of bytes taken, all of them
+     * Procedure : This function counts the bytes of a transfer of the benchmark and drops them, so only the cost of driving transfers is measured.
+     */
+
+    ((BenchRun *)userdata)->bytes += size * nmemb;
+    return size * nmemb;
+}
+
+static void download_done(const char *output_file, int result, void *userdata)
+{
+    /* Function  : static void download_done(const char *output_file, int result, void *userdata)
+     * Input     : output_file - pointer to the name of the file
+     *             result - 0 on success, -1 on failure
+     *             userdata - pointer to the LoopOutcome
+     * Output    : None
+     * Procedure : This function is the callback of download_file_async, it counts the downloads settled and those that failed.
+     */
+
+    LoopOutcome *outcome = (LoopOutcome *)userdata;
+    outcome->done++;
+    outcome->failures += result != 0;
+}
+
+static void page_done(MemoryStruct *chunk, long status, void *userdata)
+{
+    /* Function  : static void page_done(MemoryStruct *chunk, long status, void *userdata)
+     * Input     : chunk - pointer to the received page
+     *             status - HTTP status of the page
+     *             userdata - pointer to the PageCheck of the request
+     * Output    : None
+     * Procedure : This function is the callback of fetch_page_async, it records the status of the page and whether it is the one requested.
+     */
+
+    PageCheck *page = (PageCheck *)userdata;
+    char expected[32];
+    snprintf(expected, sizeof(expected), "<html>page %d</html>", page->number);
+    page->status = status;
+    page->same = chunk->size == strlen(expected) && memcmp(chunk->memory, expected, chunk->size) == 0;
+}
+
+static int check_download(const LoopFiles *files, const char *path, int number)
+{
+    /* Function  : static int check_download(const LoopFiles *files, const char *path, int number)
+     * Input     : files - pointer to the LoopFiles served
+     *             path - path of the downloaded file
+     *             number - number of the file in its URL
+     * Output    : Returns 1 if the file holds what the server sent and no part file is left, 0 otherwise
+     * Procedure : This function reads a downloaded file back and removes it.
+     */
+
+    char part[600];
+    snprintf(part, sizeof(part), "%s.part", path);
+
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL)
+    {
+        return 0;
+    }
+
+    char *data = malloc(LOOP_FILE_SIZE + 1);
+    size_t size = data != NULL ? fread(data, 1, LOOP_FILE_SIZE + 1, stream) : 0;
+    fclose(stream);
+    remove(path);
+
+    int same = data != NULL && size == LOOP_FILE_SIZE && memcmp(data, files->payload + number % LOOP_PATTERN, size) == 0;
+    free(data);
+
+    FILE *leftover = fopen(part, "rb");
+    if (leftover != NULL)
+    {
+        fclose(leftover);
+        return 0;
+    }
+
+    return same;
+}
+
+static void post_main(void *argument)
+{
+    /* Function  : static void post_main(void *argument)
+     * Input     : argument - pointer to the PostedWork
+     * Output    : None
+     * Procedure : This function is a thread finishing work for a loop, as the disk writer does: it posts the completion held for it.
+     */
+
+    PostedWork *work = (PostedWork *)argument;
+    loop_post(work->loop, work->transfer, CURLE_OK);
+}
+
+static void posted_done(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void posted_done(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - NULL, the completion has no transfer
+     *             result - result given to loop_post
+     *             userdata - pointer to the number of completions delivered
+     * Output    : None
+     * Procedure : This function counts a posted completion delivered with its result.
+     */
+
+    *(int *)userdata += curl == NULL && result == CURLE_OK;
+}
+
+static void start_transfer(BenchRun *run, CURL *curl)
+{
+    /* Function  : static void start_transfer(BenchRun *run, CURL *curl)
+     * Input     : run - pointer to the BenchRun
+     *             curl - pointer to a new easy handle, or one whose transfer is over
+     * Output    : None
+     * Procedure : This function points the handle at the next small file and hands it to the loop or the multi handle of the run. A handle whose transfer failed to start counts as finished and failed.
+     */
+
+    char url[128];
+    snprintf(url, sizeof(url), "%s/small/%d", run->base, run->started++);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)run);
+
+    int added = run->loop != NULL ? loop_add(run->loop, curl, bench_done, run) : (curl_multi_add_handle(run->multi, curl) == CURLM_OK ? 0 : -1);
+    if (added != 0)
+    {
+        run->finished++;
+        run->failures++;
+        curl_easy_cleanup(curl);
+    }
+}
+
+static void bench_done(CURL *curl, CURLcode result, void *userdata)
+{
+    /* Function  : static void bench_done(CURL *curl, CURLcode result, void *userdata)
+     * Input     : curl - pointer to the easy handle of the transfer
+     *             result - result of the transfer
+     *             userdata - pointer to the BenchRun
+     * Output    : None
+     * Procedure : This function is the completion callback of the transfers of the EventLoop run.
+     */
+
+    settle_transfer((BenchRun *)userdata, curl, result);
+}
+
+static void settle_transfer(BenchRun *run, CURL *curl, CURLcode result)
+{
+    /* Function  : static void settle_transfer(BenchRun *run, CURL *curl, CURLcode result)
+     * Input     : run - pointer to the BenchRun
+     *             curl - pointer to the easy handle of a transfer that is over
+     *             result - result of the transfer
+     * Output    : None
+     * Procedure : This function counts a transfer and starts the next one on the same handle, keeping as many transfers in flight until all those of the run were started.
+     */
+
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    run->finished++;
+    run->failures += result != CURLE_OK || code != 200;
+
+    if (run->started < run->transfers)
+    {
+        start_transfer(run, curl);
+        return;
+    }
+
+    curl_easy_cleanup(curl);
+}
+
+static void run_bench(const char *base, int transfers, int in_flight, int use_loop, double *cpu_us, double *rate, long *turns)
+{
+    /* Function  : static void run_bench(const char *base, int transfers, int in_flight, int use_loop, double *cpu_us, double *rate, long *turns)
+     * Input     : base - pointer to the URL of the server
+     *             transfers - transfers to run
+     *             in_flight - transfers in flight at once
+     *             use_loop - non-zero to drive them with an EventLoop, 0 with curl_multi_perform
+     *             cpu_us - pointer receiving the CPU time of the thread per transfer, in microseconds
+     *             rate - pointer receiving the transfers per second
+     *             turns - pointer receiving the times the thread waited
+     * Output    : None
+     * Procedure : This function runs transfers of a small file, in_flight of them at once, and checks they all succeeded with every byte.
+     */
+
+    BenchRun run;
+    EventLoop loop;
+    memset(&run, 0, sizeof(run));
+    snprintf(run.base, sizeof(run.base), "%s", base);
+    run.transfers = transfers;
+    *turns = 0;
+
+    if (use_loop)
+    {
+        if (loop_init(&loop) != 0)
+        {
+            check(0, "the event loop starts");
+            return;
+        }
+        run.loop = &loop;
+    }
+    else
+    {
+        run.multi = curl_multi_init();
+    }
+
+    double started = rn_clock();
+    double cpu = thread_cpu();
+
+    for (int i = 0; i < in_flight && i < transfers; i++)
+    {
+        CURL *curl = curl_easy_init();
+        if (curl == NULL)
+        {
+            run.started++;
+            run.finished++;
+            run.failures++;
+            continue;
+        }
+        start_transfer(&run, curl);
+    }
+
+    if (use_loop)
+    {
+        loop_run(&loop);
+        *turns = loop.turns;
+    }
+    else
+    {
+        int running = 1;
+        while (run.finished < run.started)
+        {
+            curl_multi_perform(run.multi, &running);
+
+            CURLMsg *message;
+            int left;
+            while ((message = curl_multi_info_read(run.multi, &left)) != NULL)
+            {
+                if (message->msg == CURLMSG_DONE)
+                {
+                    CURL *curl = message->easy_handle;
+                    CURLcode result = message->data.result;
+                    curl_multi_remove_handle(run.multi, curl);
+                    settle_transfer(&run, curl, result);
+                }
+            }
+
+            if (run.finished < run.started)
+            {
+                curl_multi_poll(run.multi, NULL, 0, 1000, NULL);
+                (*turns)++;
+            }
+        }
+    }
+
+    cpu = thread_cpu() - cpu;
+    double elapsed = rn_clock() - started;
+
+    if (use_loop)
+    {
+        loop_free(&loop);
+    }
+    else
+    {
+        curl_multi_cleanup(run.multi);
+    }
+
+    char message[128];
+    snprintf(message, sizeof(message), "%d transfers in flight through %s all succeed with every byte", in_flight, use_loop ? "the event loop" : "curl_multi_perform");
+    check(run.finished == transfers && run.failures == 0 && run.bytes == (size_t)transfers * LOOP_SMALL_SIZE, message);
+
+    *cpu_us = cpu * 1e6 / transfers;
+    *rate = elapsed > 0 ? transfers / elapsed : 0;
+}
+
+static void compare_bench(const char *base, int transfers)
+{
+    /* Function  : static void compare_bench(const char *base, int transfers)
+     * Input     : base - pointer to the URL of the server
+     *             transfers - transfers of every run
+     * Output    : None
+     * Procedure : This function runs the benchmark with 10, 100 and 1000 transfers in flight, through the event loop and through curl_multi_perform, and prints one line per count.
+     */
+
+    static const int in_flight[] = {10, 100, 1000};
+
+    for (size_t i = 0; i < sizeof(in_flight) / sizeof(in_flight[0]); i++)
+    {
+        if (!raise_file_limit(in_flight[i]))
+        {
+            printf("%5d in flight: skipped, not enough file descriptors\n", in_flight[i]);
+            continue;
+        }
+
+        double loop_cpu, loop_rate, multi_cpu, multi_rate;
+        long loop_turns, multi_turns;
+        run_bench(base, transfers, in_flight[i], 1, &loop_cpu, &loop_rate, &loop_turns);
+        run_bench(base, transfers, in_flight[i], 0, &multi_cpu, &multi_rate, &multi_turns);
+        printf("%5d in flight: event loop %6.1f us (%ld turns, %.0f/s), curl_multi_perform %6.1f us (%ld turns, %.0f/s)\n",
+               in_flight[i], loop_cpu, loop_turns, loop_rate, multi_cpu, multi_turns, multi_rate);
+    }
+}
+
+static int raise_file_limit(int in_flight)
+{
+    /* Function  : static int raise_file_limit(int in_flight)
+     * Input     : in_flight - transfers that will be in flight at once
+     * Output    : Returns 1 if the process may open enough descriptors, 0 otherwise
+     * Procedure : This function raises the limit of open descriptors as far as allowed: every transfer in flight holds a socket here and one in the server.
+     */
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    {
+        return 0;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+
+    return limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur >= (rlim_t)in_flight * 2 + 64;
+}
+
+int main(void)
+{
+    LoopFiles *files = malloc(sizeof(LoopFiles));
+    if (files == NULL)
+    {
+        return 1;
+    }
+    for (int i = 0; i < LOOP_FILE_SIZE + LOOP_PATTERN; i++)
+    {
+        files->payload[i] = (char)(i * 131 % 251 + 1);
+    }
+    for (int i = 0; i < LOOP_PAGES; i++)
+    {
+        snprintf(files->pages[i], sizeof(files->pages[i]), "<html>page %d</html>", i);
+    }
+
+    MockServer server;
+    if (mock_server_start(&server, route_file, files) != 0)
+    {
+        check(0, "the local server starts");
+        return test_summary("test_loop");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "loop") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    get_cache()->enabled = 0;
+
+    // Every download at once, each into its own file through the disk writer
+    EventLoop loop;
+    check(loop_init(&loop) == 0, "the event loop starts");
+    LoopOutcome downloads = {0, 0};
+    char url[128];
+    char path[512];
+    int started = 0;
+    int saved = silence_stdout();
+    for (int i = 0; i < LOOP_DOWNLOADS; i++)
+    {
+        snprintf(url, sizeof(url), "%s/file/%d", base, i);
+        snprintf(path, sizeof(path), "%s/song-%03d.mp3", directory, i);
+        started += download_file_async(&loop, url, path, download_done, &downloads) == 0;
+    }
+    loop_run(&loop);
+    restore_stdout(saved);
+    check(started == LOOP_DOWNLOADS && downloads.done == LOOP_DOWNLOADS && downloads.failures == 0, "every download started on the loop succeeds");
+    check(loop.events > 0 && loop.completed >= LOOP_DOWNLOADS, "the loop is driven by socket events");
+
+    int whole = 0;
+    for (int i = 0; i < LOOP_DOWNLOADS; i++)
+    {
+        snprintf(path, sizeof(path), "%s/song-%03d.mp3", directory, i);
+        whole += check_download(files, path, i);
+    }
+    check(whole == LOOP_DOWNLOADS, "every downloaded file holds what the server sent, under its final name");
+
+    // Every page at once, and one the server doesn't have
+    MemoryStruct chunks[LOOP_PAGES + 1];
+    PageCheck checks[LOOP_PAGES + 1];
+    started = 0;
+    for (int i = 0; i <= LOOP_PAGES; i++)
+    {
+        init_memory_struct(&chunks[i]);
+        checks[i].number = i;
+        checks[i].status = -1;
+        checks[i].same = 0;
+        snprintf(url, sizeof(url), "%s/page/%d", base, i);
+        started += fetch_page_async(&loop, url, NULL, &chunks[i], page_done, &checks[i]) != NULL;
+    }
+    loop_run(&loop);
+    int fetched = 0;
+    for (int i = 0; i < LOOP_PAGES; i++)
+    {
+        fetched += checks[i].status == 200 && checks[i].same;
+    }
+    check(started == LOOP_PAGES + 1 && fetched == LOOP_PAGES, "every page fetched on the loop comes back with its contents");
+    check(checks[LOOP_PAGES].status == 404, "a missing page comes back with its status");
+    for (int i = 0; i <= LOOP_PAGES; i++)
+    {
+        free(chunks[i].memory);
+    }
+    loop_free(&loop);
+
+    // The loop is freed as soon as it delivered the completion, while the thread may still be in loop_post
+    int delivered = 0;
+    for (int i = 0; i < LOOP_POSTS; i++)
+    {
+        EventLoop posting;
+        PostedWork work;
+        RnThread thread;
+        if (loop_init(&posting) != 0)
+        {
+            break;
+        }
+        work.loop = &posting;
+        work.transfer = loop_hold(&posting, posted_done, &delivered);
+        if (work.transfer == NULL || rn_thread_start(&thread, post_main, &work) != 0)
+        {
+            loop_free(&posting);
+            break;
+        }
+        loop_run(&posting);
+        loop_free(&posting);
+        rn_thread_join(thread);
+    }
+    check(delivered == LOOP_POSTS, "every completion posted from another thread is delivered");
+
+    // What driving the transfers costs the thread
+    printf("%d transfers of %d KB, CPU time of the driving thread per transfer:\n", LOOP_TRANSFERS, LOOP_SMALL_SIZE / 1024);
+    compare_bench(base, LOOP_TRANSFERS);
+    mock_server_stop(&server);
+
+    // The same against a server sending LOOP_PIECES_PER_MS pieces per millisecond over all its connections
+    if (mock_server_start_paced(&server, route_file, files, LOOP_PIECE, LOOP_PIECES_PER_MS) != 0)
+    {
+        check(0, "the paced server starts");
+    }
+    else
+    {
+        snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+        printf("%d transfers of %d KB from a server sending %d pieces of %d KB per ms:\n", LOOP_PACED_TRANSFERS, LOOP_SMALL_SIZE / 1024, LOOP_PIECES_PER_MS, LOOP_PIECE / 1024);
+        compare_bench(base, LOOP_PACED_TRANSFERS);
+        mock_server_stop(&server);
+    }
+
+    rmdir(directory);
+    free(files);
+
+    return test_summary("test_loop");
+}
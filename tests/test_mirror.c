@@ -0,0 +1,432 @@
+// test_mirror.c
+// Checks mirror-band (rocknation_mirror.h) against a local server (mock_server.h) answering with the fixture
+// pages, cut to MIRROR_TEST_ALBUMS albums, and with songs of MIRROR_SONG_SIZE bytes of their own. Song URLs
+// always name http://rocknation.su, so that is the base URL of the test and the server is its HTTP proxy:
+// URLs of the base URL are fetched as they are, and every request reaches the server. A mirror must
+// write every song of every album in its folder, whole, and leave nothing else there; downloads must start
+// before the last album page is requested. A second run must find everything there and request nothing, a
+// run after a few songs were deleted must download only those, and a run by name must find the band by a
+// search. A mirror whose album folders don't fit MAX_PATH_LENGTH must fail without writing anything, and so
+// must a mirror whose discography or album pages the server fails to answer.
+// Prints the end-to-end throughput of the first mirror.
+#include "../include/rocknation_mirror.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#define MIRROR_TEST_ALBUMS 12
+#define MIRROR_SONG_SIZE (16 * 1024)
+#define MIRROR_PATTERN 251 // Songs start at different offsets of the payload, so every track has contents of its own
+#define MIRROR_TEST_JOBS 8
+#define MIRROR_DELETED 3   // Songs deleted before the run that must download them again
+#define MIRROR_BASE_URL "http://rocknation.su" // Base URL of the test, reached through the server
+#define MIRROR_SONG_PREFIX "/upload/mp3/"
+#define MIRROR_FAILING_BAND 8   // Band whose discography pages answer 500
+#define MIRROR_BROKEN_BAND 7    // Band mirrored while album pages answer 500
+
+typedef struct
+{
+    FixturePages fixture;    // Fixture pages, with the discography cut
+    char *payload;
+    int failing_albums;      // Set while album pages answer 500
+    int answered;            // Requests answered, only touched by the server
+    int first_song_request;  // Number of the first song request, 0 until then
+    int last_album_request;  // Number of the last album page request
+} MirrorPages;
+
+static const char *route_mirror(const char *method, const char *path, size_t *size, void *userdata);
+static char *cut_discography(const char *page, size_t size, int albums, size_t *cut_size);
+static void drop_repeated_songs(SongInfoList *songs);
+static int check_album_files(const char *output, const AlbumInfo *album, const SongInfoList *songs, const char *payload);
+static int check_mirror_files(const char *output, const AlbumInfoList *albums, const SongInfoList *songs, const char *payload);
+static int run_mirror(const char *band, const char *output, double *elapsed);
+static void remove_tree(const char *path);
+
+static const char *route_mirror(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_mirror(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - URL of the request, sent to the server as a proxy
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the MirrorPages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers a song with MIRROR_SONG_SIZE bytes of the payload starting at its track number, every page of MIRROR_FAILING_BAND with 500, and album pages with 500 while failing_albums is set. Other requests are answered by route_fixture. It notes which requests were the first for a song and the last for an album page.
+     */
+
+    MirrorPages *pages = (MirrorPages *)userdata;
+
+    pages->answered++;
+
+    if (strncmp(path, MIRROR_BASE_URL, strlen(MIRROR_BASE_URL)) == 0)
+    {
+        path += strlen(MIRROR_BASE_URL);
+    }
+    if (strncmp(path, MIRROR_SONG_PREFIX, strlen(MIRROR_SONG_PREFIX)) == 0)
+    {
+        const char *file = strrchr(path, '/') + 1;
+        if (pages->first_song_request == 0)
+        {
+            pages->first_song_request = pages->answered;
+        }
+        *size = MIRROR_SONG_SIZE;
+        return pages->payload + atoi(file) % MIRROR_PATTERN;
+    }
+
+    if (strncasecmp(path, "/mp3/band-", 10) == 0 && atoi(path + 10) == MIRROR_FAILING_BAND)
+    {
+        return MOCK_ERROR;
+    }
+    if (strncasecmp(path, "/mp3/album-", 11) == 0)
+    {
+        pages->last_album_request = pages->answered;
+        if (pages->failing_albums)
+        {
+            return MOCK_ERROR;
+        }
+    }
+
+    return route_fixture(method, path, size, &pages->fixture);
+}
+
+static char *cut_discography(const char *page, size_t size, int albums, size_t *cut_size)
+{
+    /* Function  : static char *cut_discography(const char *page, size_t size, int albums, size_t *cut_size)
+     * Input     : page - pointer to discography.html
+     *             size - size of the page
+     *             albums - number of albums to keep
+     *             cut_size - pointer receiving the size of the new page
+     * Output    : Returns the discography with its first albums only, to be freed by the caller, or NULL if it can't be allocated
+     * Procedure : This function copies the page up to the line of the album after the last one kept, whatever the case of its link, and closes the page.
+     */
+
+    const char *marker = "href=\"/mp3/album-";
+    const char *ending = "</ul>\n</div>\n</body>\n</html>\n";
+    size_t marker_length = strlen(marker);
+    size_t end = size;
+    int seen = 0;
+
+    for (size_t i = 0; i + marker_length <= size; i++)
+    {
+        if (strncasecmp(page + i, marker, marker_length) == 0 && ++seen > albums)
+        {
+            end = i;
+            while (end > 0 && page[end - 1] != '\n')
+            {
+                end--;
+            }
+            break;
+        }
+    }
+
+    char *copy = malloc(end + strlen(ending) + 1);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+    memcpy(copy, page, end);
+    strcpy(copy + end, ending);
+    *cut_size = end + strlen(ending);
+
+    return copy;
+}
+
+static void drop_repeated_songs(SongInfoList *songs)
+{
+    /* Function  : static void drop_repeated_songs(SongInfoList *songs)
+     * Input     : songs - pointer to the songs of an album page
+     * Output    : None
+     * Procedure : This function keeps the first of the songs linked more than once by the page, in order, as the mirror downloads each song once.
+     */
+
+    int kept = 0;
+
+    for (int i = 0; i < songs->count; i++)
+    {
+        int seen = 0;
+        for (int j = 0; j < kept && !seen; j++)
+        {
+            seen = strcmp(songs->songs[j].url, songs->songs[i].url) == 0;
+        }
+        if (!seen)
+        {
+            songs->songs[kept++] = songs->songs[i];
+        }
+    }
+    songs->count = kept;
+}
+
+static int check_album_files(const char *output, const AlbumInfo *album, const SongInfoList *songs, const char *payload)
+{
+    /* Function  : static int check_album_files(const char *output, const AlbumInfo *album, const SongInfoList *songs, const char *payload)
+     * Input     : output - pointer to the output folder of the mirror
+     *             album - pointer to the album
+     *             songs - pointer to the songs of album.html, each once
+     *             payload - pointer to the payload the songs are served from
+     * Output    : Returns 1 if the folder of the album holds every song, whole, and nothing else, 0 otherwise
+     * Procedure : This function names the folder and the files like the mirror does (see mirror_file_name), compares every song with what the server sent for it, and counts the entries of the folder.
+     */
+
+    char title[MAX_NAME_LENGTH];
+    char folder_name[MAX_NAME_LENGTH];
+    char folder[MAX_PATH_LENGTH];
+    snprintf(title, sizeof(title), "%s - %s", album->year, album->name);
+    mirror_file_name(title, folder_name, sizeof(folder_name));
+    snprintf(folder, sizeof(folder), "%s/%s", output, folder_name);
+
+    char *data = malloc(MIRROR_SONG_SIZE + 1);
+    int complete = data != NULL;
+
+    for (int i = 0; complete && i < songs->count; i++)
+    {
+        char file_name[MAX_SONG_NAME_LENGTH];
+        char path[MAX_PATH_LENGTH + MAX_SONG_NAME_LENGTH];
+        mirror_file_name(songs->songs[i].name, file_name, sizeof(file_name));
+        snprintf(path, sizeof(path), "%s/%s", folder, file_name);
+
+        FILE *file = fopen(path, "rb");
+        size_t read = file != NULL ? fread(data, 1, MIRROR_SONG_SIZE + 1, file) : 0;
+        complete = read == MIRROR_SONG_SIZE && memcmp(data, payload + atoi(songs->songs[i].name) % MIRROR_PATTERN, MIRROR_SONG_SIZE) == 0;
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+    }
+    free(data);
+
+    DIR *directory = opendir(folder);
+    struct dirent *entry;
+    int entries = 0;
+    while (directory != NULL && (entry = readdir(directory)) != NULL)
+    {
+        entries += strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+    }
+    if (directory != NULL)
+    {
+        closedir(directory);
+    }
+
+    return complete && entries == songs->count;
+}
+
+static int check_mirror_files(const char *output, const AlbumInfoList *albums, const SongInfoList *songs, const char *payload)
+{
+    /* Function  : static int check_mirror_files(const char *output, const AlbumInfoList *albums, const SongInfoList *songs, const char *payload)
+     * Input     : output - pointer to the output folder of the mirror
+     *             albums - pointer to the albums of the cut discography
+     *             songs - pointer to the songs of album.html, each once
+     *             payload - pointer to the payload the songs are served from
+     * Output    : Returns 1 if every album is mirrored whole, 0 otherwise
+     * Procedure : This function runs check_album_files on every album.
+     */
+
+    int complete = 1;
+
+    for (int i = 0; complete && i < albums->count; i++)
+    {
+        complete = check_album_files(output, &albums->albums[i], songs, payload);
+    }
+
+    return complete;
+}
+
+static int run_mirror(const char *band, const char *output, double *elapsed)
+{
+    /* Function  : static int run_mirror(const char *band, const char *output, double *elapsed)
+     * Input     : band - pointer to the name or URL of the band
+     *             output - pointer to the output folder
+     *             elapsed - pointer receiving the time the mirror took, or NULL
+     * Output    : Returns what mirror_band returns
+     * Procedure : This function runs a mirror with its progress lines and report silenced.
+     */
+
+    int saved = silence_stdout();
+    double started = rn_clock();
+    int result = mirror_band(band, output, MIRROR_TEST_JOBS);
+
+    if (elapsed != NULL)
+    {
+        *elapsed = rn_clock() - started;
+    }
+    restore_stdout(saved);
+
+    return result;
+}
+
+static void remove_tree(const char *path)
+{
+    /* Function  : static void remove_tree(const char *path)
+     * Input     : path - pointer to the path of a directory
+     * Output    : None
+     * Procedure : This function removes a directory and everything in it.
+     */
+
+    DIR *directory = opendir(path);
+    struct dirent *entry;
+
+    while (directory != NULL && (entry = readdir(directory)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char child[MAX_PATH_LENGTH + 256];
+        struct stat info;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (lstat(child, &info) == 0 && S_ISDIR(info.st_mode))
+        {
+            remove_tree(child);
+        }
+        else
+        {
+            remove(child);
+        }
+    }
+    if (directory != NULL)
+    {
+        closedir(directory);
+    }
+    rmdir(path);
+}
+
+int main(void)
+{
+    MirrorPages pages;
+    memset(&pages, 0, sizeof(pages));
+    int ready = load_fixture_pages(&pages.fixture) == 0;
+    char *discography = pages.fixture.discography;
+    pages.fixture.discography = NULL;
+    pages.payload = malloc(MIRROR_SONG_SIZE + MIRROR_PATTERN);
+    if (discography != NULL)
+    {
+        pages.fixture.discography = cut_discography(discography, pages.fixture.discography_size, MIRROR_TEST_ALBUMS, &pages.fixture.discography_size);
+        free(discography);
+    }
+    for (int i = 0; pages.payload != NULL && i < MIRROR_SONG_SIZE + MIRROR_PATTERN; i++)
+    {
+        pages.payload[i] = (char)(i * 7 + i / 256);
+    }
+
+    ready = ready && pages.fixture.discography != NULL && pages.payload != NULL;
+    check(ready, "the fixture pages are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_mirror, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        return test_summary("test_mirror");
+    }
+
+    char directory[256];
+    char base[64];
+    char cache[sizeof(directory) + 16];
+    char output[sizeof(directory) + 16];
+    if (make_test_directory(directory, sizeof(directory), "mirror") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    snprintf(cache, sizeof(cache), "%s/cache", directory);
+    snprintf(output, sizeof(output), "%s/out", directory);
+    setenv("ROCKNATION_BASE_URL", MIRROR_BASE_URL, 1);
+    setenv("ROCKNATION_CACHE_DIR", cache, 1);
+    setenv("http_proxy", base, 1);
+    unsetenv("no_proxy");
+    unsetenv("NO_PROXY");
+    get_cache()->enabled = 0;
+
+    // What the pages hold
+    Arena arena;
+    arena_init(&arena, 0);
+    AlbumInfoList albums;
+    SongInfoList songs;
+    init_album_list(&albums, &arena);
+    init_song_list(&songs, &arena);
+    parse_albums(pages.fixture.discography, pages.fixture.discography_size, &albums);
+    parse_songs(pages.fixture.album, pages.fixture.album_size, &songs);
+    int links = songs.count;
+    drop_repeated_songs(&songs);
+    check(albums.count > 0 && songs.count > 0 && songs.count < links, "the cut discography holds albums, the album page links its songs more than once");
+    long song_total = (long)albums.count * songs.count;
+
+    // Pages the server fails to answer, before the albums are in the store. Neither run downloads or writes anything.
+    char url[MAX_URL_LENGTH];
+    char failed_output[sizeof(directory) + 16];
+    snprintf(failed_output, sizeof(failed_output), "%s/failed", directory);
+    snprintf(url, sizeof(url), MIRROR_BASE_URL STORE_BAND_PATH "%d", MIRROR_FAILING_BAND);
+    long requests = mock_requests(&server);
+    int result = run_mirror(url, failed_output, NULL);
+    check(result == -1 && mock_requests(&server) == requests + 1, "a mirror whose discography page answers 500 fails");
+
+    pages.failing_albums = 1;
+    snprintf(url, sizeof(url), MIRROR_BASE_URL STORE_BAND_PATH "%d", MIRROR_BROKEN_BAND);
+    requests = mock_requests(&server);
+    result = run_mirror(url, failed_output, NULL);
+    pages.failing_albums = 0;
+    check(result == -1 && mock_requests(&server) == requests + 2 + albums.count, "a mirror whose album pages answer 500 fails");
+
+    // A first mirror downloads everything
+    snprintf(url, sizeof(url), MIRROR_BASE_URL STORE_BAND_PATH "1");
+    requests = mock_requests(&server);
+    double elapsed = 0;
+    result = run_mirror(url, output, &elapsed);
+    check(result == 0, "the mirror succeeds");
+    check(mock_requests(&server) == requests + 2 + albums.count + song_total, "the mirror requests every page once and every song once, however many times it is linked");
+    check(check_mirror_files(output, &albums, &songs, pages.payload), "every song is in the folder of its album, whole, and nothing else is");
+    printf("Mirror of %d albums, %ld songs of %d KB with %d downloads at once: %.2f s, %.0f songs/s, %.1f MB/s\n", albums.count,
+           song_total, MIRROR_SONG_SIZE / 1024, MIRROR_TEST_JOBS, elapsed, song_total / elapsed,
+           bench_rate((double)song_total * MIRROR_SONG_SIZE, elapsed));
+
+    // Everything is there already
+    requests = mock_requests(&server);
+    result = run_mirror(url, output, NULL);
+    check(result == 0 && mock_requests(&server) == requests, "a second mirror finds everything there and requests nothing");
+
+    // An interrupted mirror
+    for (int i = 0; i < MIRROR_DELETED; i++)
+    {
+        char title[MAX_NAME_LENGTH];
+        char folder_name[MAX_NAME_LENGTH];
+        char file_name[MAX_SONG_NAME_LENGTH];
+        char path[MAX_PATH_LENGTH + MAX_SONG_NAME_LENGTH];
+        snprintf(title, sizeof(title), "%s - %s", albums.albums[i].year, albums.albums[i].name);
+        mirror_file_name(title, folder_name, sizeof(folder_name));
+        mirror_file_name(songs.songs[i].name, file_name, sizeof(file_name));
+        snprintf(path, sizeof(path), "%s/%s/%s", output, folder_name, file_name);
+        remove(path);
+    }
+    requests = mock_requests(&server);
+    result = run_mirror(url, output, NULL);
+    check(result == 0 && mock_requests(&server) == requests + MIRROR_DELETED, "a mirror run again downloads only the songs missing");
+    check(check_mirror_files(output, &albums, &songs, pages.payload), "the songs missing are back, whole");
+
+    // By name: the search finds the band, whose discography isn't in the store under its id yet
+    requests = mock_requests(&server);
+    result = run_mirror("Celtic Helloween", output, NULL);
+    check(result == 0 && mock_requests(&server) == requests + 3, "a mirror by name searches for the band and downloads nothing again");
+
+    // Album folders that don't fit MAX_PATH_LENGTH
+    char component[241];
+    char deep[sizeof(directory) + 4 * sizeof(component)];
+    memset(component, 'x', sizeof(component) - 1);
+    component[sizeof(component) - 1] = '\0';
+    snprintf(deep, sizeof(deep), "%s/%s/%s/%s/%s", directory, component, component, component, component);
+    requests = mock_requests(&server);
+    result = run_mirror(url, deep, NULL);
+    check(result == -1 && mock_requests(&server) == requests, "a mirror whose folders don't fit MAX_PATH_LENGTH fails without downloading");
+
+    arena_free(&arena);
+    mock_server_stop(&server);
+    check(pages.first_song_request > 0 && pages.first_song_request < pages.last_album_request,
+          "songs are downloaded before the last album page is requested");
+    store_close();
+
+    remove_tree(directory);
+    free_fixture_pages(&pages.fixture);
+    free(pages.payload);
+
+    return test_summary("test_mirror");
+}
@@ -0,0 +1,503 @@
+// test_names.c
+// Checks the name cache (rocknation_names.h) against a reference model: NAMES_OPERATIONS random puts, lookups
+// and forgets over NAMES_POOL names, three times the capacity, so entries are evicted all along. Every lookup
+// must give what the model gives, and every NAMES_CHECK_EVERY operations the hash table and the recency list
+// must hold exactly the names of the model, from the least to the most recently used. The cache is then
+// written and read back, entries older than the ttl must be dropped (also after a reload), and removing
+// names from the middle of a probe run, one wrapping around the end of the table, must leave the rest of the
+// run reachable. Against a local server (mock_server.h), get_albums_by_name must keep the cached URL of a band
+// whose discography page fails, without searching, and forget it only once its discography is read to the end
+// without any album. Prints the time of a lookup.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#include <unistd.h>
+
+#define NAMES_POOL (NAME_CACHE_CAPACITY * 3)
+#define NAMES_OPERATIONS 200000
+#define NAMES_CHECK_EVERY 997
+#define NAMES_PROBE_RUN 4 // Names of a probe run sharing a home slot
+#define NAMES_BENCH_LOOKUPS 1000000
+#define NAMES_MOVED_BAND 3 // Band whose discography answers 500, then an empty page
+
+typedef struct
+{
+    int present[NAMES_POOL];
+    int version[NAMES_POOL]; // Version in the URL the name was last put with
+    long used[NAMES_POOL];   // Tick of the last put or hit, larger is more recent
+    int count;
+    long tick;
+    int evictions;
+} NameModel;
+
+typedef struct
+{
+    FixturePages fixture;
+    int failing; // Set while the discography of NAMES_MOVED_BAND answers 500
+} NamePages;
+
+static void pool_name(int id, char *name, size_t size);
+static void pool_url(int id, int version, char *url, size_t size);
+static void model_put(NameModel *model, int id, int version);
+static void check_model(const NameModel *model, const char *what);
+static void run_operations(NameModel *model);
+static void check_expiry(void);
+static int home_slot(const char *name);
+static void check_probe_runs(void);
+static void bench_lookups(void);
+static const char *route_names(const char *method, const char *path, size_t *size, void *userdata);
+static void check_failed_fetch(void);
+
+static void pool_name(int id, char *name, size_t size)
+{
+    /* Function  : static void pool_name(int id, char *name, size_t size)
+     * Input     : id - number of the name in the pool
+     *             name - pointer to the buffer receiving the name
+     *             size - size of the buffer
+     * Output    : None
+     * Procedure : This function names a band of the pool, already in normalized form so the cache keeps it as it is.
+     */
+
+    snprintf(name, size, "band %d", id);
+}
+
+static void pool_url(int id, int version, char *url, size_t size)
+{
+    /* Function  : static void pool_url(int id, int version, char *url, size_t size)
+     * Input     : id - number of the name in the pool
+     *             version - number telling the puts of the same name apart
+     *             url - pointer to the buffer receiving the URL
+     *             size - size of the buffer
+     * Output    : None
+     * Procedure : This function builds the URL a name of the pool is put with.
+     */
+
+    snprintf(url, size, "https://rocknation.su/mp3/band-%d?v=%d", id, version);
+}
+
+static void model_put(NameModel *model, int id, int version)
+{
+    /* Function  : static void model_put(NameModel *model, int id, int version)
+     * Input     : model - pointer to the NameModel
+     *             id - number of the name put
+     *             version - version of its URL
+     * Output    : None
+     * Procedure : This function is name_cache_put on the model: a new name evicts the least recently used one when NAME_CACHE_CAPACITY names are there already.
+     */
+
+    if (!model->present[id] && model->count == NAME_CACHE_CAPACITY)
+    {
+        int oldest = -1;
+        for (int i = 0; i < NAMES_POOL; i++)
+        {
+            if (model->present[i] && (oldest < 0 || model->used[i] < model->used[oldest]))
+            {
+                oldest = i;
+            }
+        }
+        model->present[oldest] = 0;
+        model->count--;
+        model->evictions++;
+    }
+
+    if (!model->present[id])
+    {
+        model->present[id] = 1;
+        model->count++;
+    }
+    model->version[id] = version;
+    model->used[id] = ++model->tick;
+}
+
+static void check_model(const NameModel *model, const char *what)
+{
+    /* Function  : static void check_model(const NameModel *model, const char *what)
+     * Input     : model - pointer to the NameModel the cache should match
+     *             what - description of the moment of the check
+     * Output    : None
+     * Procedure : This function compares the whole cache with the model without touching the recency of its entries: every used slot of the hash table must be where a lookup of its name lands, every name of the model must be found with its URL, and the recency list must hold the names of the model from the least to the most recently used.
+     */
+
+    NameCache *names = get_name_cache();
+    char name[MAX_NAME_LENGTH + 1];
+    char url[MAX_URL_LENGTH];
+    char message[160];
+    int same = names != NULL && names->count == model->count;
+
+    int used_slots = 0;
+    for (int slot = 0; same && slot < NAME_CACHE_SLOTS; slot++)
+    {
+        int entry = names->slots[slot] - 1;
+        if (entry < 0)
+        {
+            continue;
+        }
+        used_slots++;
+        same = entry < names->count && name_cache_slot(names, names->entries[entry].name) == slot;
+    }
+    same = same && used_slots == model->count;
+
+    for (int id = 0; same && id < NAMES_POOL; id++)
+    {
+        pool_name(id, name, sizeof(name));
+        int entry = names->slots[name_cache_slot(names, name)] - 1;
+        if (!model->present[id])
+        {
+            same = entry < 0;
+            continue;
+        }
+        pool_url(id, model->version[id], url, sizeof(url));
+        same = entry >= 0 && strcmp(names->entries[entry].url, url) == 0;
+    }
+
+    int listed = 0;
+    long previous = 0;
+    for (int entry = same ? names->oldest : -1; entry >= 0 && listed <= names->count; entry = names->entries[entry].newer)
+    {
+        int id;
+        if (sscanf(names->entries[entry].name, "band %d", &id) != 1 || id < 0 || id >= NAMES_POOL || !model->present[id] || model->used[id] <= previous)
+        {
+            same = 0;
+            break;
+        }
+        previous = model->used[id];
+        listed++;
+    }
+    same = same && listed == model->count && (model->count == 0 || names->entries[names->newest].newer == -1);
+
+    snprintf(message, sizeof(message), "%s, the cache holds the %d names of the model in their order", what, model->count);
+    check(same, message);
+}
+
+static void run_operations(NameModel *model)
+{
+    /* Function  : static void run_operations(NameModel *model)
+     * Input     : model - pointer to an empty NameModel, matching an empty cache
+     * Output    : None
+     * Procedure : This function runs NAMES_OPERATIONS random operations on the cache and on the model: puts (some of names already there, with a new URL), lookups and forgets, checking every lookup and, now and then, the whole cache.
+     */
+
+    unsigned int state = 2463534242u;
+    char name[MAX_NAME_LENGTH + 1];
+    char url[MAX_URL_LENGTH];
+    char expected[MAX_URL_LENGTH];
+    int wrong_lookups = 0;
+    int evictions = get_name_cache()->evictions;
+
+    for (int i = 1; i <= NAMES_OPERATIONS; i++)
+    {
+        unsigned int roll = test_random(&state);
+        int id = (int)(test_random(&state) % NAMES_POOL);
+        pool_name(id, name, sizeof(name));
+
+        if (roll % 100 < 45)
+        {
+            pool_url(id, i, url, sizeof(url));
+            name_cache_put(name, url);
+            model_put(model, id, i);
+        }
+        else if (roll % 100 < 90)
+        {
+            int found = name_cache_lookup(name, url, sizeof(url)) == 0;
+            if (model->present[id])
+            {
+                pool_url(id, model->version[id], expected, sizeof(expected));
+                wrong_lookups += !found || strcmp(url, expected) != 0;
+                model->used[id] = ++model->tick;
+            }
+            else
+            {
+                wrong_lookups += found;
+            }
+        }
+        else
+        {
+            name_cache_forget(name);
+            if (model->present[id])
+            {
+                model->present[id] = 0;
+                model->count--;
+            }
+        }
+
+        if (i % NAMES_CHECK_EVERY == 0)
+        {
+            check_model(model, "during the random operations");
+        }
+    }
+
+    check(wrong_lookups == 0, "every lookup gives what the model gives");
+    check(get_name_cache()->evictions - evictions == model->evictions, "names are evicted exactly when the model evicts them");
+    check_model(model, "after the random operations");
+
+    // Written out and read back, with the same order
+    name_cache_close();
+    NameCache *names = get_name_cache();
+    check(names != NULL && !names->dirty, "the reloaded cache has nothing to write");
+    check_model(model, "after a reload");
+}
+
+static void check_expiry(void)
+{
+    /* Function  : static void check_expiry(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function puts a name resolved longer than the ttl ago and one resolved within it, and checks that only the first one is dropped on lookup, the same after the cache was written and read back.
+     */
+
+    char url[MAX_URL_LENGTH];
+    NameCache *names = get_name_cache();
+    long ttl = names->ttl;
+    names->ttl = 60;
+
+    name_cache_put("stale band", "https://rocknation.su/mp3/band-stale");
+    name_cache_put("fresh band", "https://rocknation.su/mp3/band-fresh");
+    names->entries[names->slots[name_cache_slot(names, "stale band")] - 1].stored -= 120;
+    names->entries[names->slots[name_cache_slot(names, "fresh band")] - 1].stored -= 30;
+    name_cache_put("stale band again", "https://rocknation.su/mp3/band-stale-again");
+    names->entries[names->slots[name_cache_slot(names, "stale band again")] - 1].stored -= 120;
+
+    int count = names->count;
+    int expired = names->expired;
+    check(name_cache_lookup("Stale  Band", url, sizeof(url)) == -1, "a name older than the ttl needs a search");
+    check(names->expired == expired + 1 && names->count == count - 1 && names->slots[name_cache_slot(names, "stale band")] == 0, "an expired name is counted and dropped");
+    check(name_cache_lookup("Fresh Band", url, sizeof(url)) == 0 && strcmp(url, "https://rocknation.su/mp3/band-fresh") == 0, "a name within the ttl is resolved locally");
+
+    // The time a name was resolved survives a reload
+    name_cache_close();
+    names = get_name_cache();
+    names->ttl = 60;
+    check(name_cache_lookup("stale band again", url, sizeof(url)) == -1, "a name older than the ttl is still expired after a reload");
+    check(name_cache_lookup("fresh band", url, sizeof(url)) == 0, "a name within the ttl is still resolved after a reload");
+
+    name_cache_forget("fresh band");
+    names->ttl = ttl;
+}
+
+static int home_slot(const char *name)
+{
+    /* Function  : static int home_slot(const char *name)
+     * Input     : name - pointer to a normalized name
+     * Output    : Returns the slot of the hash table the name hashes to
+     * Procedure : This function computes where a probe for the name starts, as name_cache_slot does.
+     */
+
+    return (int)(hash_string(name, strlen(name)) & (NAME_CACHE_SLOTS - 1));
+}
+
+static void check_probe_runs(void)
+{
+    /* Function  : static void check_probe_runs(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function fills the last slot of the hash table and the first ones with names hashing to the last slot and to slot 0, interleaved, so their probe run wraps around the end of the table and mixes two home slots. Names are then forgotten from the start, the middle and the end of the run, and every other name must still be found after each removal.
+     */
+
+    char run[NAMES_PROBE_RUN * 2][MAX_NAME_LENGTH + 1];
+    int homes[2] = {NAME_CACHE_SLOTS - 1, 0};
+    int found[2] = {0, 0};
+    char name[MAX_NAME_LENGTH + 1];
+
+    for (int i = 0; (found[0] < NAMES_PROBE_RUN || found[1] < NAMES_PROBE_RUN) && i < 10000000; i++)
+    {
+        snprintf(name, sizeof(name), "probe %d", i);
+        for (int h = 0; h < 2; h++)
+        {
+            if (home_slot(name) == homes[h] && found[h] < NAMES_PROBE_RUN)
+            {
+                snprintf(run[found[h] * 2 + h], sizeof(run[0]), "%s", name);
+                found[h]++;
+            }
+        }
+    }
+    check(found[0] == NAMES_PROBE_RUN && found[1] == NAMES_PROBE_RUN, "names sharing a home slot are found");
+    if (found[0] < NAMES_PROBE_RUN || found[1] < NAMES_PROBE_RUN)
+    {
+        return;
+    }
+
+    // Clear everything so the run starts at its home slot
+    name_cache_close();
+    remove(get_name_cache()->path);
+    name_cache_close();
+    NameCache *names = get_name_cache();
+
+    char url[MAX_URL_LENGTH];
+    for (int i = 0; i < NAMES_PROBE_RUN * 2; i++)
+    {
+        snprintf(url, sizeof(url), "https://rocknation.su/mp3/%d", i);
+        name_cache_put(run[i], url);
+    }
+    check(names->slots[NAME_CACHE_SLOTS - 1] != 0 && names->slots[NAMES_PROBE_RUN * 2 - 2] != 0, "the probe run wraps around the end of the table");
+
+    static const int forgotten[] = {0, 3, NAMES_PROBE_RUN * 2 - 1, 4};
+    int gone[NAMES_PROBE_RUN * 2] = {0};
+    int reachable = 1;
+    for (size_t f = 0; f < sizeof(forgotten) / sizeof(forgotten[0]); f++)
+    {
+        name_cache_forget(run[forgotten[f]]);
+        gone[forgotten[f]] = 1;
+
+        for (int i = 0; i < NAMES_PROBE_RUN * 2; i++)
+        {
+            char expected[MAX_URL_LENGTH];
+            snprintf(expected, sizeof(expected), "https://rocknation.su/mp3/%d", i);
+            int entry = names->slots[name_cache_slot(names, run[i])] - 1;
+            reachable = reachable && (gone[i] ? entry < 0 : entry >= 0 && strcmp(names->entries[entry].url, expected) == 0);
+        }
+    }
+    check(reachable, "removing names from a probe run leaves the rest of it reachable");
+    check(names->count == NAMES_PROBE_RUN * 2 - 4, "removed names are no longer counted");
+
+    int used_slots = 0;
+    for (int slot = 0; slot < NAME_CACHE_SLOTS; slot++)
+    {
+        used_slots += names->slots[slot] != 0;
+    }
+    check(used_slots == names->count, "removals leave no stale slot behind");
+}
+
+static void bench_lookups(void)
+{
+    /* Function  : static void bench_lookups(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function fills the cache and measures name_cache_lookup of names it holds, normalization included.
+     */
+
+    char name[MAX_NAME_LENGTH + 1];
+    char url[MAX_URL_LENGTH];
+
+    for (int id = 0; id < NAME_CACHE_CAPACITY; id++)
+    {
+        pool_name(id, name, sizeof(name));
+        pool_url(id, 0, url, sizeof(url));
+        name_cache_put(name, url);
+    }
+
+    int hits = 0;
+    double started = rn_clock();
+    for (int i = 0; i < NAMES_BENCH_LOOKUPS; i++)
+    {
+        pool_name(i % NAME_CACHE_CAPACITY, name, sizeof(name));
+        hits += name_cache_lookup(name, url, sizeof(url)) == 0;
+    }
+    double elapsed = rn_clock() - started;
+
+    check(hits == NAMES_BENCH_LOOKUPS, "every name of a full cache is resolved locally");
+    printf("%d lookups in a cache of %d names: %.0f ns each\n", NAMES_BENCH_LOOKUPS, NAME_CACHE_CAPACITY, elapsed * 1e9 / NAMES_BENCH_LOOKUPS);
+}
+
+static const char *route_names(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_names(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the NamePages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers every page of the discography of NAMES_MOVED_BAND with 500 while failing is set, and with an empty page after it. Other requests are answered by route_fixture.
+     */
+
+    NamePages *pages = (NamePages *)userdata;
+    int id;
+    int page;
+
+    if (sscanf(path, "/mp3/band-%d/%d", &id, &page) == 2 && id == NAMES_MOVED_BAND)
+    {
+        *size = 0;
+        return pages->failing ? MOCK_ERROR : "";
+    }
+
+    return route_fixture(method, path, size, &pages->fixture);
+}
+
+static void check_failed_fetch(void)
+{
+    /* Function  : static void check_failed_fetch(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function resolves a name cached with the URL of NAMES_MOVED_BAND through get_albums_by_name. While its discography answers 500 the entry must stay and no search be made; once the discography is an empty page fetched with status 200, the entry must be replaced by the first band of a search.
+     */
+
+    NamePages pages;
+    memset(&pages, 0, sizeof(pages));
+
+    MockServer server;
+    if (load_fixture_pages(&pages.fixture) != 0 || mock_server_start(&server, route_names, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free_fixture_pages(&pages.fixture);
+        return;
+    }
+
+    char base[64];
+    char moved[MAX_URL_LENGTH];
+    char url[MAX_URL_LENGTH];
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    snprintf(moved, sizeof(moved), "%s/mp3/band-%d", base, NAMES_MOVED_BAND);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    get_cache()->enabled = 0;
+
+    Arena arena;
+    arena_init(&arena, 0);
+    AlbumInfoList albums;
+    init_album_list(&albums, &arena);
+
+    name_cache_put("moved band", moved);
+    pages.failing = 1;
+    long requests = mock_requests(&server);
+    int saved = silence_stdout();
+    get_albums_by_name("moved band", &albums);
+    restore_stdout(saved);
+    check(albums.count == 0 && mock_requests(&server) == requests + 1, "a cached URL whose discography fails is fetched once, without a search");
+    check(name_cache_lookup("moved band", url, sizeof(url)) == 0 && strcmp(url, moved) == 0, "a failed fetch keeps the cached URL");
+
+    pages.failing = 0;
+    requests = mock_requests(&server);
+    get_albums_by_name("moved band", &albums);
+    check(albums.count > 0 && mock_requests(&server) == requests + 4, "a cached URL without albums is searched again");
+    check(name_cache_lookup("moved band", url, sizeof(url)) == 0 && strcmp(url, moved) != 0, "a cached URL whose discography has no album is replaced");
+
+    arena_free(&arena);
+    mock_server_stop(&server);
+    store_close();
+    free_fixture_pages(&pages.fixture);
+}
+
+int main(void)
+{
+    char directory[256];
+    if (make_test_directory(directory, sizeof(directory), "names") != 0)
+    {
+        return 1;
+    }
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+
+    NameModel *model = calloc(1, sizeof(NameModel));
+    check(model != NULL && get_name_cache() != NULL, "the name cache opens");
+    if (model == NULL || get_name_cache() == NULL)
+    {
+        free(model);
+        return test_summary("test_names");
+    }
+
+    run_operations(model);
+    check_expiry();
+    check_probe_runs();
+    bench_lookups();
+    check_failed_fetch();
+
+    name_cache_close();
+    remove(get_name_cache()->path);
+    name_cache_close();
+
+    char path[sizeof(directory) + 32];
+    snprintf(path, sizeof(path), "%s/%s", directory, STORE_FILE);
+    remove(path);
+    rmdir(directory);
+    free(model);
+
+    return test_summary("test_names");
+}
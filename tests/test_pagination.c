@@ -0,0 +1,232 @@
+// test_pagination.c
+// Checks get_albums_parallel (rocknation_multi.h) against a local server (mock_server.h) answering bands
+// with PAGINATION_PAGES pages of discography, each with albums of its own, and an empty page after them. With
+// a window of PAGINATION_WINDOW pages the albums must come back in page order, the same ones get_albums
+// gives, and must be stored. No more than the window may be requested past the end, nor be open at once. A
+// band one of whose pages fails must not be taken as complete nor stored. Prints the time of both lookups.
+#include "../include/rocknation_multi.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define PAGINATION_PAGES 6          // Pages of albums of every band, a single digit
+#define PAGINATION_WINDOW 4
+#define PAGINATION_FAILING_BAND 3   // Band whose page PAGINATION_FAILING_PAGE fails
+#define PAGINATION_FAILING_PAGE 3
+
+typedef struct
+{
+    FixturePages fixture;
+    char *pages[PAGINATION_PAGES + 1]; // Discography of every page, from 1
+    size_t page_sizes[PAGINATION_PAGES + 1];
+    long last_page;                    // Highest page requested, updated atomically
+} PaginationPages;
+
+static const char *route_pagination(const char *method, const char *path, size_t *size, void *userdata);
+static char *page_discography(const char *page, size_t size, int number, size_t *page_size);
+static int lookup(const char *url, AlbumInfoList *albums, int window, double *elapsed);
+
+static const char *route_pagination(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_pagination(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the PaginationPages
+     * Output    : Returns the answer to the request, NULL for 404 or MOCK_ERROR for 500
+     * Procedure : This function answers pages 1 to PAGINATION_PAGES of the discography of any band with their own albums, and any page after them with an empty page; page PAGINATION_FAILING_PAGE of PAGINATION_FAILING_BAND fails. It keeps the highest page requested. Anything else is answered by route_fixture.
+     */
+
+    PaginationPages *pages = (PaginationPages *)userdata;
+    int id;
+    int page;
+
+    if (sscanf(path, "/mp3/band-%d/%d", &id, &page) == 2)
+    {
+        if (page > RN_ATOMIC_LOAD(pages->last_page))
+        {
+            RN_ATOMIC_STORE(pages->last_page, (long)page);
+        }
+        if (id == PAGINATION_FAILING_BAND && page == PAGINATION_FAILING_PAGE)
+        {
+            return MOCK_ERROR;
+        }
+        if (page < 1 || page > PAGINATION_PAGES)
+        {
+            *size = 0;
+            return "";
+        }
+        *size = pages->page_sizes[page];
+        return pages->pages[page];
+    }
+
+    return route_fixture(method, path, size, &pages->fixture);
+}
+
+static char *page_discography(const char *page, size_t size, int number, size_t *page_size)
+{
+    /* Function  : static char *page_discography(const char *page, size_t size, int number, size_t *page_size)
+     * Input     : page - pointer to discography.html
+     *             size - size of the page
+     *             number - number of the page, a single digit
+     *             page_size - pointer receiving the size of the new page
+     * Output    : Returns the page, to be freed by the caller, or NULL if it can't be allocated
+     * Procedure : This function copies the page with its number put in front of every album id, whatever the case of the link, so no two pages share an album and their order shows in the result.
+     */
+
+    const char *marker = "/mp3/album-";
+    size_t marker_length = strlen(marker);
+    char *copy = malloc(size * 2 + 1);
+    size_t used = 0;
+
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        copy[used++] = page[i];
+        if (i + 1 >= marker_length && strncasecmp(page + i + 1 - marker_length, marker, marker_length) == 0)
+        {
+            copy[used++] = (char)('0' + number);
+        }
+    }
+    copy[used] = '\0';
+    *page_size = used;
+
+    return copy;
+}
+
+static int lookup(const char *url, AlbumInfoList *albums, int window, double *elapsed)
+{
+    /* Function  : static int lookup(const char *url, AlbumInfoList *albums, int window, double *elapsed)
+     * Input     : url - pointer to the URL of the band
+     *             albums - pointer to the list receiving the albums
+     *             window - pages requested at once, 0 for get_albums
+     *             elapsed - pointer receiving the time the lookup took
+     * Output    : Returns what the lookup returns
+     * Procedure : This function runs get_albums_parallel, or get_albums without a window, with its messages silenced and measures it.
+     */
+
+    int saved = silence_stdout();
+    double started = rn_clock();
+    int result = window > 0 ? get_albums_parallel(url, albums, window) : get_albums(url, albums);
+
+    *elapsed = rn_clock() - started;
+    restore_stdout(saved);
+
+    return result;
+}
+
+int main(void)
+{
+    static PaginationPages pages;
+    int ready = load_fixture_pages(&pages.fixture) == 0;
+    for (int i = 1; ready && i <= PAGINATION_PAGES; i++)
+    {
+        pages.pages[i] = page_discography(pages.fixture.discography, pages.fixture.discography_size, i, &pages.page_sizes[i]);
+        ready = pages.pages[i] != NULL;
+    }
+    check(ready, "the fixture pages are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_pagination, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        for (int i = 1; i <= PAGINATION_PAGES; i++)
+        {
+            free(pages.pages[i]);
+        }
+        free_fixture_pages(&pages.fixture);
+        return test_summary("test_pagination");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "pagination") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    get_cache()->enabled = 0;
+
+    Arena arena;
+    arena_init(&arena, 0);
+    AlbumInfoList parallel;
+    AlbumInfoList serial;
+    AlbumInfoList stored;
+    init_album_list(&parallel, &arena);
+    init_album_list(&serial, &arena);
+    init_album_list(&stored, &arena);
+
+    char band[sizeof(base) + 32];
+    double parallel_time = 0;
+    double serial_time = 0;
+
+    // Several pages at once, the server never saw a connection before
+    snprintf(band, sizeof(band), "%s/mp3/band-1", base);
+    long before = mock_requests(&server);
+    check(lookup(band, &parallel, PAGINATION_WINDOW, &parallel_time) == 0, "the discography is read a window at a time");
+    long requested = mock_requests(&server) - before;
+    check(mock_peak(&server) > 1 && mock_peak(&server) <= PAGINATION_WINDOW, "the pages are requested side by side, no more than the window at once");
+    check(requested > PAGINATION_PAGES && requested <= PAGINATION_PAGES + PAGINATION_WINDOW &&
+              RN_ATOMIC_LOAD(pages.last_page) < PAGINATION_PAGES + 1 + PAGINATION_WINDOW,
+          "no more than the window is requested past the end");
+
+    int ordered = parallel.count > 0 && parallel.count % PAGINATION_PAGES == 0;
+    int per_page = ordered ? parallel.count / PAGINATION_PAGES : 0;
+    for (int i = 0; ordered && i < parallel.count; i++)
+    {
+        const char *id = strstr(parallel.albums[i].url, "album-");
+        ordered = id == NULL || id[6] == (char)('1' + i / per_page);
+    }
+    check(ordered, "the albums come back in page order");
+
+    // The same discography a page at a time
+    snprintf(band, sizeof(band), "%s/mp3/band-2", base);
+    check(lookup(band, &serial, 0, &serial_time) == 0, "the discography is read a page at a time");
+    check(same_albums(&parallel, &serial), "both give the same albums");
+
+    snprintf(band, sizeof(band), "%s/mp3/band-1", base);
+    before = mock_requests(&server);
+    check(store_albums(band, &stored) == 0 && same_albums(&stored, &parallel), "the discography read a window at a time is stored");
+    double stored_time = 0;
+    check(lookup(band, &stored, PAGINATION_WINDOW, &stored_time) == 0 && mock_requests(&server) == before, "a stored discography is answered without a request");
+
+    // A window beyond MAX_PARALLEL_JOBS is capped
+    snprintf(band, sizeof(band), "%s/mp3/band-4", base);
+    before = mock_requests(&server);
+    double capped_time = 0;
+    check(lookup(band, &stored, MAX_PARALLEL_JOBS * 4, &capped_time) == 0 && same_albums(&stored, &parallel) &&
+              mock_requests(&server) - before <= PAGINATION_PAGES + MAX_PARALLEL_JOBS,
+          "a window beyond MAX_PARALLEL_JOBS is capped");
+
+    // A page failing leaves the discography incomplete
+    snprintf(band, sizeof(band), "%s/mp3/band-%d", base, PAGINATION_FAILING_BAND);
+    double failing_time = 0;
+    check(lookup(band, &stored, PAGINATION_WINDOW, &failing_time) == -1, "a discography with a page failing is incomplete");
+    check(stored.count <= (PAGINATION_FAILING_PAGE - 1) * per_page, "no album after the failing page is kept");
+    check(store_albums(band, &stored) != 0, "a discography with a page failing isn't stored");
+
+    printf("%d pages: %.3f s one after the other, %.3f s %d at a time\n", PAGINATION_PAGES, serial_time, parallel_time, PAGINATION_WINDOW);
+
+    arena_free(&arena);
+    mock_server_stop(&server);
+    store_close();
+
+    char path[sizeof(directory) + 32];
+    snprintf(path, sizeof(path), "%s/%s", directory, STORE_FILE);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/%s", directory, SNAPSHOT_FILE);
+    remove(path);
+    rmdir(directory);
+    for (int i = 1; i <= PAGINATION_PAGES; i++)
+    {
+        free(pages.pages[i]);
+    }
+    free_fixture_pages(&pages.fixture);
+
+    return test_summary("test_pagination");
+}
@@ -0,0 +1,197 @@
+// test_parallel.c
+// Checks download_files_parallel (rocknation_multi.h) against a local server (mock_server.h): PARALLEL_SONGS
+// songs of different sizes and one the server doesn't have are downloaded PARALLEL_JOBS at a time. Only the
+// missing song must fail, and it must leave no file behind. The server must see several connections open at
+// once but never more than PARALLEL_JOBS. Every song must match the one download_file gives, byte for byte.
+// Prints the time of both.
+#include "../include/rocknation_multi.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define PARALLEL_SONGS 12
+#define PARALLEL_JOBS 4
+#define PARALLEL_SONG_SIZE (300 * 1024) // Size of the first song, each one after it is PARALLEL_SONG_STEP bytes longer
+#define PARALLEL_SONG_STEP (37 * 1024 + 1)
+#define PARALLEL_PAYLOAD (PARALLEL_SONG_SIZE + PARALLEL_SONGS * PARALLEL_SONG_STEP + PARALLEL_SONGS)
+
+typedef struct
+{
+    char *payload;
+} ParallelPages;
+
+static size_t song_size(int song);
+static const char *route_parallel(const char *method, const char *path, size_t *size, void *userdata);
+static int same_files(const char *path, const char *other);
+static int run_parallel(DownloadJob *jobs, int count, double *elapsed);
+
+static size_t song_size(int song)
+{
+    /* Function  : static size_t song_size(int song)
+     * Input     : song - number of the song
+     * Output    : Returns the size of the song
+     * Procedure : This function gives every song a size of its own, none of them a multiple of the download buffer.
+     */
+
+    return PARALLEL_SONG_SIZE + (size_t)song * PARALLEL_SONG_STEP;
+}
+
+static const char *route_parallel(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_parallel(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the ParallelPages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers /song-<n>.mp3, n below PARALLEL_SONGS, with song_size(n) bytes of the payload starting at byte n.
+     */
+
+    const ParallelPages *pages = (const ParallelPages *)userdata;
+    int song;
+
+    if (sscanf(path, "/song-%d.mp3", &song) == 1 && song >= 0 && song < PARALLEL_SONGS)
+    {
+        *size = song_size(song);
+        return pages->payload + song;
+    }
+
+    return NULL;
+}
+
+static int same_files(const char *path, const char *other)
+{
+    /* Function  : static int same_files(const char *path, const char *other)
+     * Input     : path, other - pointers to the paths of the files to compare
+     * Output    : Returns 1 if both files exist and hold the same bytes, 0 otherwise
+     * Procedure : This function reads the first file whole and compares the second one with it.
+     */
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    int same = data != NULL && fread(data, 1, (size_t)size, file) == (size_t)size && same_file(other, data, (size_t)size);
+
+    fclose(file);
+    free(data);
+
+    return same;
+}
+
+static int run_parallel(DownloadJob *jobs, int count, double *elapsed)
+{
+    /* Function  : static int run_parallel(DownloadJob *jobs, int count, double *elapsed)
+     * Input     : jobs - pointer to the jobs to run
+     *             count - number of jobs
+     *             elapsed - pointer receiving the time the downloads took
+     * Output    : Returns what download_files_parallel returns
+     * Procedure : This function runs the downloads PARALLEL_JOBS at a time with their progress silenced.
+     */
+
+    int saved = silence_stdout();
+    double started = rn_clock();
+    int failed = download_files_parallel(jobs, count, PARALLEL_JOBS);
+
+    *elapsed = rn_clock() - started;
+    restore_stdout(saved);
+
+    return failed;
+}
+
+int main(void)
+{
+    ParallelPages pages;
+    pages.payload = malloc(PARALLEL_PAYLOAD);
+    for (size_t i = 0; pages.payload != NULL && i < PARALLEL_PAYLOAD; i++)
+    {
+        pages.payload[i] = (char)(i * 13 + i / 4099);
+    }
+
+    MockServer server;
+    if (pages.payload == NULL || mock_server_start(&server, route_parallel, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free(pages.payload);
+        return test_summary("test_parallel");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "parallel") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+
+    // Every song, and the missing one last
+    char urls[PARALLEL_SONGS + 1][MAX_URL_LENGTH];
+    char outputs[PARALLEL_SONGS + 1][sizeof(directory) + 32];
+    char serial[PARALLEL_SONGS][sizeof(directory) + 32];
+    char labels[PARALLEL_SONGS + 1][32];
+    DownloadJob jobs[PARALLEL_SONGS + 1];
+    for (int i = 0; i <= PARALLEL_SONGS; i++)
+    {
+        snprintf(urls[i], sizeof(urls[i]), "%s/song-%d.mp3", base, i < PARALLEL_SONGS ? i : 999);
+        snprintf(outputs[i], sizeof(outputs[i]), "%s/parallel-%d.mp3", directory, i);
+        snprintf(labels[i], sizeof(labels[i]), "song %d", i);
+        jobs[i].url = urls[i];
+        jobs[i].output_file = outputs[i];
+        jobs[i].label = labels[i];
+    }
+
+    double parallel_time = 0;
+    check(run_parallel(jobs, PARALLEL_SONGS + 1, &parallel_time) == 1, "only the song the server doesn't have fails");
+    check(mock_peak(&server) > 1 && mock_peak(&server) <= PARALLEL_JOBS, "the songs are downloaded side by side, no more than the jobs at once");
+
+    int whole = 1;
+    for (int i = 0; i < PARALLEL_SONGS; i++)
+    {
+        whole = whole && same_file(outputs[i], pages.payload + i, song_size(i));
+    }
+    check(whole, "every song downloaded side by side is whole");
+
+    char part[sizeof(outputs[0]) + 8];
+    snprintf(part, sizeof(part), "%s.part", outputs[PARALLEL_SONGS]);
+    check(!file_exists(outputs[PARALLEL_SONGS]) && !file_exists(part), "the song the server doesn't have leaves no file behind");
+
+    // The same songs one after the other
+    double serial_time = 0;
+    int saved = silence_stdout();
+    double started = rn_clock();
+    int downloaded = 1;
+    for (int i = 0; i < PARALLEL_SONGS; i++)
+    {
+        snprintf(serial[i], sizeof(serial[i]), "%s/serial-%d.mp3", directory, i);
+        downloaded = download_file(urls[i], serial[i]) == 0 && downloaded;
+    }
+    serial_time = rn_clock() - started;
+    restore_stdout(saved);
+    check(downloaded, "every song is downloaded one after the other");
+
+    int same = 1;
+    for (int i = 0; i < PARALLEL_SONGS; i++)
+    {
+        same = same && same_files(serial[i], outputs[i]);
+    }
+    check(same, "the songs downloaded side by side are the ones downloaded one after the other");
+
+    printf("%d songs: %.3f s one after the other, %.3f s %d at a time\n", PARALLEL_SONGS, serial_time, parallel_time, PARALLEL_JOBS);
+
+    mock_server_stop(&server);
+    for (int i = 0; i < PARALLEL_SONGS; i++)
+    {
+        remove(outputs[i]);
+        remove(serial[i]);
+    }
+    rmdir(directory);
+    free(pages.payload);
+
+    return test_summary("test_parallel");
+}
@@ -0,0 +1,487 @@
+// test_pool.c
+// Checks the work-stealing pool (rocknation_pool.h). POOL_SUBMITTERS threads submit POOL_TASKS tasks at once,
+// every POOL_CHILD_EVERY of which submits a child task from its worker: every task must run exactly once, and
+// pool_wait must only return once all of them ran. A batch submitted by one task lands in the deque of its
+// worker, so the other workers must steal from it. The counters of the pool must add up: completed and
+// submitted agree, both latency histograms hold every task, and the percentiles are bounded by the maxima. A
+// pool stopped while tasks are still queued behind busy workers must run them all before pool_stop returns.
+// Prints the cost of a task.
+#include "../include/rocknation_pool.h"
+#include "test_util.h"
+
+#define POOL_TEST_THREADS 4
+#define POOL_SUBMITTERS 4
+#define POOL_TASKS 200000   // Submitted from outside the pool, over all submitters
+#define POOL_CHILD_EVERY 16 // Every so many tasks submit a child task from their worker
+#define POOL_BATCH 256      // Tasks of the batch submitted by one task, to be stolen
+#define POOL_BATCH_SLEEP 200 // Microseconds every task of the batch runs
+#define POOL_QUEUED 64      // Tasks queued behind the busy workers when the pool is stopped
+
+typedef struct
+{
+    WorkPool *pool;
+    int *runs;     // Times every task ran, updated atomically
+    int first;     // First task of the submitter
+    int count;     // Tasks of the submitter
+    int children;  // First id of the children, 0 if tasks submit none
+    int batch;     // First id of the batch
+    int *workers;  // Worker that ran every task of the batch
+    int gate;      // Set once the workers blocked at shutdown may return
+    long rejected; // Tasks that couldn't be submitted, updated atomically
+} PoolRun;
+
+typedef struct
+{
+    PoolRun *run;
+    int id;
+} PoolItem;
+
+static PoolItem *items;
+
+static void count_task(void *argument);
+static void batch_task(void *argument);
+static void spawn_batch(void *argument);
+static void blocked_task(void *argument);
+static void submit_tasks(void *argument);
+static void stop_pool(void *argument);
+static long histogram_total(const long *histogram);
+static void check_exactly_once(void);
+static void check_steals(void);
+static void check_counters(void);
+static void check_shutdown(void);
+
+static void count_task(void *argument)
+{
+    /* Function  : static void count_task(void *argument)
+     * Input     : argument - pointer to the PoolItem of the task
+     * Output    : None
+     * Procedure : This function counts a run of the task and, every POOL_CHILD_EVERY tasks, submits a child task from the worker (or runs it at once if it can't be queued).
+     */
+
+    PoolItem *item = (PoolItem *)argument;
+    PoolRun *run = item->run;
+
+    RN_ATOMIC_ADD(run->runs[item->id], 1);
+
+    if (run->children > 0 && item->id < run->children && item->id % POOL_CHILD_EVERY == 0)
+    {
+        PoolItem *child = &items[run->children + item->id / POOL_CHILD_EVERY];
+        if (pool_submit(run->pool, count_task, child) != 0)
+        {
+            RN_ATOMIC_ADD(run->rejected, 1);
+            count_task(child);
+        }
+    }
+}
+
+static void batch_task(void *argument)
+{
+    /* Function  : static void batch_task(void *argument)
+     * Input     : argument - pointer to the PoolItem of the task
+     * Output    : None
+     * Procedure : This function counts a run of a task of the batch, notes the worker running it and sleeps POOL_BATCH_SLEEP microseconds, so the batch takes long enough for idle workers to steal from it.
+     */
+
+    PoolItem *item = (PoolItem *)argument;
+    PoolRun *run = item->run;
+
+    RN_ATOMIC_ADD(run->runs[item->id], 1);
+    run->workers[item->id - run->batch] = current_worker != NULL ? current_worker->index : -1;
+    usleep(POOL_BATCH_SLEEP);
+}
+
+static void spawn_batch(void *argument)
+{
+    /* Function  : static void spawn_batch(void *argument)
+     * Input     : argument - pointer to the PoolRun
+     * Output    : None
+     * Procedure : This function submits the POOL_BATCH tasks of the batch from a worker, so they all go to its own deque.
+     */
+
+    PoolRun *run = (PoolRun *)argument;
+
+    for (int i = 0; i < POOL_BATCH; i++)
+    {
+        if (pool_submit(run->pool, batch_task, &items[run->batch + i]) != 0)
+        {
+            RN_ATOMIC_ADD(run->rejected, 1);
+            batch_task(&items[run->batch + i]);
+        }
+    }
+}
+
+static void blocked_task(void *argument)
+{
+    /* Function  : static void blocked_task(void *argument)
+     * Input     : argument - pointer to the PoolItem of the task
+     * Output    : None
+     * Procedure : This function counts a run of the task and keeps its worker busy until the gate of the run is opened.
+     */
+
+    PoolItem *item = (PoolItem *)argument;
+
+    RN_ATOMIC_ADD(item->run->runs[item->id], 1);
+    while (!RN_ATOMIC_LOAD(item->run->gate))
+    {
+        usleep(100);
+    }
+}
+
+static void submit_tasks(void *argument)
+{
+    /* Function  : static void submit_tasks(void *argument)
+     * Input     : argument - pointer to the PoolRun of a submitter
+     * Output    : None
+     * Procedure : This function is a submitting thread: it submits its share of the tasks, running itself the ones the pool can't take, as callers of pool_submit do.
+     */
+
+    PoolRun *run = (PoolRun *)argument;
+
+    for (int i = run->first; i < run->first + run->count; i++)
+    {
+        if (pool_submit(run->pool, count_task, &items[i]) != 0)
+        {
+            RN_ATOMIC_ADD(run->rejected, 1);
+            count_task(&items[i]);
+        }
+    }
+}
+
+static void stop_pool(void *argument)
+{
+    /* Function  : static void stop_pool(void *argument)
+     * Input     : argument - pointer to a started WorkPool
+     * Output    : None
+     * Procedure : This function is a thread calling pool_stop.
+     */
+
+    pool_stop((WorkPool *)argument);
+}
+
+static long histogram_total(const long *histogram)
+{
+    /* Function  : static long histogram_total(const long *histogram)
+     * Input     : histogram - pointer to POOL_LATENCY_BUCKETS counters
+     * Output    : Returns the sum of the counters
+     * Procedure : This function adds up a latency histogram of the pool.
+     */
+
+    long total = 0;
+
+    for (int i = 0; i < POOL_LATENCY_BUCKETS; i++)
+    {
+        total += histogram[i];
+    }
+
+    return total;
+}
+
+static void check_exactly_once(void)
+{
+    /* Function  : static void check_exactly_once(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function has POOL_SUBMITTERS threads submit POOL_TASKS tasks to a pool of POOL_TEST_THREADS workers at once, with the children the tasks submit, waits for the pool and checks that every task ran exactly once. Prints the time per task.
+     */
+
+    int total = POOL_TASKS + POOL_TASKS / POOL_CHILD_EVERY;
+    int *runs = calloc((size_t)total, sizeof(int));
+    WorkPool *pool = calloc(1, sizeof(WorkPool));
+    PoolRun shared = {0};
+    PoolRun submitters[POOL_SUBMITTERS];
+    RnThread threads[POOL_SUBMITTERS];
+    items = calloc((size_t)total, sizeof(PoolItem));
+
+    if (runs == NULL || pool == NULL || items == NULL || pool_start(pool, POOL_TEST_THREADS) != 0)
+    {
+        check(0, "the pool starts");
+        free(runs);
+        free(pool);
+        free(items);
+        return;
+    }
+
+    shared.pool = pool;
+    shared.runs = runs;
+    shared.children = POOL_TASKS;
+    for (int i = 0; i < total; i++)
+    {
+        items[i].run = &shared;
+        items[i].id = i;
+    }
+
+    double started = rn_clock();
+    int running = 0;
+    for (int i = 0; i < POOL_SUBMITTERS; i++)
+    {
+        submitters[i] = shared;
+        submitters[i].first = i * (POOL_TASKS / POOL_SUBMITTERS);
+        submitters[i].count = i == POOL_SUBMITTERS - 1 ? POOL_TASKS - submitters[i].first : POOL_TASKS / POOL_SUBMITTERS;
+        if (rn_thread_start(&threads[i], submit_tasks, &submitters[i]) != 0)
+        {
+            submit_tasks(&submitters[i]);
+            continue;
+        }
+        running |= 1 << i;
+    }
+    for (int i = 0; i < POOL_SUBMITTERS; i++)
+    {
+        if (running & (1 << i))
+        {
+            rn_thread_join(threads[i]);
+        }
+    }
+    pool_wait(pool);
+    double elapsed = rn_clock() - started;
+
+    int wrong = 0;
+    for (int i = 0; i < total; i++)
+    {
+        wrong += runs[i] != 1;
+    }
+    long rejected = shared.rejected;
+    for (int i = 0; i < POOL_SUBMITTERS; i++)
+    {
+        rejected += submitters[i].rejected;
+    }
+
+    check(wrong == 0, "every task submitted from several threads at once runs exactly once");
+    check(pool->completed == pool->submitted && pool->submitted == total - rejected, "pool_wait returns once every submitted task has run");
+    check(pool->queued == 0, "no task is left queued");
+    printf("%d tasks from %d threads on %d workers: %.0f ns each, %ld stolen\n", total, POOL_SUBMITTERS, POOL_TEST_THREADS,
+           elapsed * 1e9 / total, pool->steals);
+
+    pool_stop(pool);
+    free(runs);
+    free(pool);
+    free(items);
+    items = NULL;
+}
+
+static void check_steals(void)
+{
+    /* Function  : static void check_steals(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function has one task submit a batch of slow tasks to the deque of its own worker, and checks that the other workers steal from it: the pool counts steals, and the batch runs on more than one worker, each task once.
+     */
+
+    int *runs = calloc(POOL_BATCH, sizeof(int));
+    int *workers = calloc(POOL_BATCH, sizeof(int));
+    WorkPool *pool = calloc(1, sizeof(WorkPool));
+    PoolRun run = {0};
+    items = calloc(POOL_BATCH, sizeof(PoolItem));
+
+    if (runs == NULL || workers == NULL || pool == NULL || items == NULL || pool_start(pool, POOL_TEST_THREADS) != 0)
+    {
+        check(0, "the pool starts");
+        free(runs);
+        free(workers);
+        free(pool);
+        free(items);
+        return;
+    }
+
+    run.pool = pool;
+    run.runs = runs;
+    run.workers = workers;
+    for (int i = 0; i < POOL_BATCH; i++)
+    {
+        items[i].run = &run;
+        items[i].id = i;
+    }
+
+    check(pool_submit(pool, spawn_batch, &run) == 0, "a task is submitted");
+    pool_wait(pool);
+
+    int wrong = 0;
+    int used[POOL_MAX_THREADS] = {0};
+    int used_count = 0;
+    for (int i = 0; i < POOL_BATCH; i++)
+    {
+        wrong += runs[i] != 1;
+        if (workers[i] >= 0 && workers[i] < POOL_MAX_THREADS && !used[workers[i]]++)
+        {
+            used_count++;
+        }
+    }
+
+    check(wrong == 0 && run.rejected == 0, "every task of the batch runs exactly once");
+    check(pool->steals > 0, "idle workers steal from the deque of a busy one");
+    check(used_count > 1, "the batch submitted to one deque runs on several workers");
+
+    pool_stop(pool);
+    free(runs);
+    free(workers);
+    free(pool);
+    free(items);
+    items = NULL;
+}
+
+static void check_counters(void)
+{
+    /* Function  : static void check_counters(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function checks the bucket of a few latencies, then runs the slow batch again and checks the statistics of the pool: both histograms hold every task, the slowest run is at least POOL_BATCH_SLEEP, and the percentiles are ordered and bounded by the maxima. The deques recorded their pushes and their longest length.
+     */
+
+    check(latency_bucket(0) == 0 && latency_bucket(1e-6) == 1 && latency_bucket(3e-6) == 2 && latency_bucket(1024e-6) == 11,
+          "latencies go to the bucket of their number of binary digits in microseconds");
+    check(latency_bucket(1e9) == POOL_LATENCY_BUCKETS - 1, "a huge latency goes to the last bucket");
+
+    int *runs = calloc(POOL_BATCH, sizeof(int));
+    int *workers = calloc(POOL_BATCH, sizeof(int));
+    WorkPool *pool = calloc(1, sizeof(WorkPool));
+    PoolRun run = {0};
+    items = calloc(POOL_BATCH, sizeof(PoolItem));
+
+    if (runs == NULL || workers == NULL || pool == NULL || items == NULL || pool_start(pool, POOL_TEST_THREADS) != 0)
+    {
+        check(0, "the pool starts");
+        free(runs);
+        free(workers);
+        free(pool);
+        free(items);
+        return;
+    }
+
+    run.pool = pool;
+    run.runs = runs;
+    run.workers = workers;
+    for (int i = 0; i < POOL_BATCH; i++)
+    {
+        items[i].run = &run;
+        items[i].id = i;
+    }
+
+    pool_submit(pool, spawn_batch, &run);
+    pool_wait(pool);
+    pool_stop(pool);
+
+    long pushes = 0;
+    int max_length = 0;
+    for (int i = 0; i < pool->thread_count; i++)
+    {
+        pushes += pool->workers[i].deque.pushes;
+        if (pool->workers[i].deque.max_length > max_length)
+        {
+            max_length = pool->workers[i].deque.max_length;
+        }
+    }
+
+    double wait_p50 = latency_percentile(pool->wait_histogram, pool->completed, 0.5, pool->wait_max);
+    double wait_p99 = latency_percentile(pool->wait_histogram, pool->completed, 0.99, pool->wait_max);
+    double run_p50 = latency_percentile(pool->run_histogram, pool->completed, 0.5, pool->run_max);
+    double run_p99 = latency_percentile(pool->run_histogram, pool->completed, 0.99, pool->run_max);
+
+    check(pool->completed == POOL_BATCH + 1 && pool->submitted == pool->completed, "the pool counts every task it ran");
+    check(histogram_total(pool->wait_histogram) == pool->completed && histogram_total(pool->run_histogram) == pool->completed,
+          "both latency histograms hold every task");
+    check(pool->run_max >= POOL_BATCH_SLEEP / 1e6 && pool->run_total >= POOL_BATCH * POOL_BATCH_SLEEP / 1e6, "run times include the time the tasks slept");
+    check(wait_p50 <= wait_p99 && wait_p99 <= pool->wait_max && run_p50 <= run_p99 && run_p99 <= pool->run_max,
+          "percentiles are ordered and bounded by the largest latency");
+    check(run_p50 * 2 >= POOL_BATCH_SLEEP / 1e6, "the median run is at most twice what its bucket says");
+    check(pushes == pool->submitted && max_length > 1, "the deques record their pushes and their longest length");
+
+    free(runs);
+    free(workers);
+    free(pool);
+    free(items);
+    items = NULL;
+}
+
+static void check_shutdown(void)
+{
+    /* Function  : static void check_shutdown(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function keeps every worker of a pool busy with a blocked task, queues POOL_QUEUED more tasks behind them and stops the pool from another thread while they are still queued; the workers are then let go. pool_stop must return only once every task ran, each once.
+     */
+
+    int total = POOL_TEST_THREADS + POOL_QUEUED;
+    int *runs = calloc((size_t)total, sizeof(int));
+    WorkPool *pool = calloc(1, sizeof(WorkPool));
+    PoolRun run = {0};
+    items = calloc((size_t)total, sizeof(PoolItem));
+
+    if (runs == NULL || pool == NULL || items == NULL || pool_start(pool, POOL_TEST_THREADS) != 0)
+    {
+        check(0, "the pool starts");
+        free(runs);
+        free(pool);
+        free(items);
+        return;
+    }
+
+    run.pool = pool;
+    run.runs = runs;
+    for (int i = 0; i < total; i++)
+    {
+        items[i].run = &run;
+        items[i].id = i;
+    }
+
+    for (int i = 0; i < POOL_TEST_THREADS; i++)
+    {
+        pool_submit(pool, blocked_task, &items[i]);
+    }
+
+    // Every worker is held by a blocked task before the rest is queued
+    double deadline = rn_clock() + 5.0;
+    int blocked = 0;
+    while (blocked < POOL_TEST_THREADS && rn_clock() < deadline)
+    {
+        blocked = 0;
+        for (int i = 0; i < POOL_TEST_THREADS; i++)
+        {
+            blocked += RN_ATOMIC_LOAD(runs[i]) == 1;
+        }
+        usleep(100);
+    }
+
+    for (int i = POOL_TEST_THREADS; i < total; i++)
+    {
+        pool_submit(pool, count_task, &items[i]);
+    }
+
+    rn_mutex_lock(&pool->lock);
+    long queued = pool->queued;
+    rn_mutex_unlock(&pool->lock);
+    check(blocked == POOL_TEST_THREADS && queued == POOL_QUEUED, "tasks are still queued behind the busy workers when the pool is stopped");
+
+    RnThread stopper;
+    int stopping = rn_thread_start(&stopper, stop_pool, pool) == 0;
+    usleep(20000);
+    RN_ATOMIC_STORE(run.gate, 1);
+    if (stopping)
+    {
+        rn_thread_join(stopper);
+    }
+    else
+    {
+        pool_stop(pool);
+    }
+
+    int wrong = 0;
+    for (int i = 0; i < total; i++)
+    {
+        wrong += runs[i] != 1;
+    }
+    check(wrong == 0 && pool->completed == total && pool->queued == 0 && !pool->running, "pool_stop runs every queued task once before it returns");
+
+    free(runs);
+    free(pool);
+    free(items);
+    items = NULL;
+}
+
+int main(void)
+{
+    check_exactly_once();
+    check_steals();
+    check_counters();
+    check_shutdown();
+
+    return test_summary("test_pool");
+}
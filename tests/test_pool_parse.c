@@ -0,0 +1,115 @@
+// test_pool_parse.c
+// Parses discography pages on the shared pool (rocknation_pool.h) from two translation units: the pool is
+// started by this one, and parse_unit.c, which includes the library again, submits POOL_PARSE_TASKS parse
+// tasks to it while its own thread parses POOL_PARSE_OWN pages with the default patterns of that unit. Every
+// parse must find the albums this unit finds, and every task must parse with the patterns of the worker it
+// ran on, as the unit that submitted it sees them, never with the default patterns of a unit: those belong
+// to the threads of the unit that haven't bound anything, which match with them at the same time.
+#include "parse_unit.h"
+#include "test_util.h"
+
+#define POOL_PARSE_TASKS 2000
+#define POOL_PARSE_OWN 500
+
+static int worker_patterns(const WorkPool *pool, const CompiledPattern *patterns);
+static int same_parse(const ParseResult *result, const ParseResult *expected);
+
+static int worker_patterns(const WorkPool *pool, const CompiledPattern *patterns)
+{
+    /* Function  : static int worker_patterns(const WorkPool *pool, const CompiledPattern *patterns)
+     * Input     : pool - pointer to the started WorkPool
+     *             patterns - pointer to the patterns a parse used
+     * Output    : Returns 1 if they are the patterns of one of the workers of the pool, 0 otherwise
+     * Procedure : This function compares the patterns with those of every worker.
+     */
+
+    for (int i = 0; i < pool->thread_count; i++)
+    {
+        if (patterns == pool->workers[i].patterns)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int same_parse(const ParseResult *result, const ParseResult *expected)
+{
+    /* Function  : static int same_parse(const ParseResult *result, const ParseResult *expected)
+     * Input     : result - pointer to the ParseResult to check
+     *             expected - pointer to the ParseResult of this unit
+     * Output    : Returns 1 if both found the same albums, 0 otherwise
+     * Procedure : This function compares the number of albums found and their hash.
+     */
+
+    return result->albums == expected->albums && result->hash == expected->hash;
+}
+
+int main(void)
+{
+    ParseResult expected;
+    expected.page = read_fixture("discography.html", &expected.size);
+    if (expected.page == NULL)
+    {
+        check(0, "the discography page is read");
+        return test_summary("test_pool_parse");
+    }
+
+    // This unit starts the shared pool, so its workers bind themselves here first
+    WorkPool *pool = get_pool();
+    check(pool != NULL, "the shared pool starts");
+    parse_into(&expected);
+    check(expected.albums > 0, "the page has albums");
+
+    ParseResult *tasks = calloc(POOL_PARSE_TASKS, sizeof(ParseResult));
+    ParseResult *own = calloc(POOL_PARSE_OWN, sizeof(ParseResult));
+    if (pool == NULL || tasks == NULL || own == NULL)
+    {
+        free(tasks);
+        free(own);
+        free((char *)expected.page);
+        return test_summary("test_pool_parse");
+    }
+    for (int i = 0; i < POOL_PARSE_TASKS; i++)
+    {
+        tasks[i].page = expected.page;
+        tasks[i].size = expected.size;
+    }
+    for (int i = 0; i < POOL_PARSE_OWN; i++)
+    {
+        own[i].page = expected.page;
+        own[i].size = expected.size;
+    }
+
+    unit_parse_on_pool(pool, tasks, POOL_PARSE_TASKS, own, POOL_PARSE_OWN);
+
+    int found = 1;
+    int on_workers = 1;
+    for (int i = 0; i < POOL_PARSE_TASKS; i++)
+    {
+        found = found && same_parse(&tasks[i], &expected);
+        on_workers = on_workers && worker_patterns(pool, tasks[i].patterns);
+    }
+    check(found, "every page parsed on the pool from the other unit finds the albums");
+    check(on_workers, "every task of the other unit parses with the patterns of its worker");
+
+    found = 1;
+    int own_default = 1;
+    for (int i = 0; i < POOL_PARSE_OWN; i++)
+    {
+        found = found && same_parse(&own[i], &expected);
+        own_default = own_default && own[i].patterns == unit_default_patterns();
+    }
+    check(found, "every page parsed by the thread of the other unit meanwhile finds the albums");
+    check(own_default && unit_default_patterns() != expected.patterns,
+          "the thread of the other unit parses with the default patterns of that unit");
+
+    printf("%d pages parsed on the pool from the other unit, %d by its thread meanwhile\n", POOL_PARSE_TASKS, POOL_PARSE_OWN);
+
+    free(tasks);
+    free(own);
+    free((char *)expected.page);
+
+    return test_summary("test_pool_parse");
+}
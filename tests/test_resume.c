@@ -0,0 +1,174 @@
+// test_resume.c
+// Checks that downloads continue where they stopped, against a local server (mock_server.h) answering Range
+// requests. download_file must resume a part file left over from an interrupted download by asking only for
+// the missing bytes, take a part file already complete as done, start over when the server ignores the Range
+// header and keep the part file when the server fails. download_file_segmented must put together a song of
+// RESUME_SONG_SIZE bytes from RESUME_SEGMENTS ranges byte for byte, resume a part file instead of splitting
+// it and fall back to a single stream when the server has no ranges. No part or segment file may be left
+// behind by a download that succeeded.
+#include "../include/rocknation_multi.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define RESUME_SONG_SIZE (2 * 1024 * 1024 + 4099)
+#define RESUME_PARTIAL (777 * 1024 + 13) // Bytes of the song an interrupted download left in the part file
+#define RESUME_SEGMENTS 4
+
+typedef struct
+{
+    char *song;
+} ResumePages;
+
+static const char *route_resume(const char *method, const char *path, size_t *size, void *userdata);
+static int write_part(const char *path, const char *data, size_t size);
+static int download_segments(const char *url, const char *output);
+
+static const char *route_resume(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_resume(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the ResumePages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers /song.mp3 with the song; the server cuts out the range asked for.
+     */
+
+    const ResumePages *pages = (const ResumePages *)userdata;
+
+    if (strcmp(path, "/song.mp3") == 0)
+    {
+        *size = RESUME_SONG_SIZE;
+        return pages->song;
+    }
+
+    return NULL;
+}
+
+static int write_part(const char *path, const char *data, size_t size)
+{
+    /* Function  : static int write_part(const char *path, const char *data, size_t size)
+     * Input     : path - pointer to the path of the part file
+     *             data - pointer to the bytes the interrupted download received
+     *             size - number of bytes
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function leaves a part file like an interrupted download would.
+     */
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    int written = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && written ? 0 : -1;
+}
+
+static int download_segments(const char *url, const char *output)
+{
+    /* Function  : static int download_segments(const char *url, const char *output)
+     * Input     : url - pointer to the URL to download
+     *             output - pointer to the path of the output file
+     * Output    : Returns what download_file_segmented returns
+     * Procedure : This function downloads the song in RESUME_SEGMENTS ranges, for run_download.
+     */
+
+    return download_file_segmented(url, output, RESUME_SEGMENTS);
+}
+
+int main(void)
+{
+    ResumePages pages;
+    pages.song = malloc(RESUME_SONG_SIZE);
+    for (size_t i = 0; pages.song != NULL && i < RESUME_SONG_SIZE; i++)
+    {
+        pages.song[i] = (char)(i * 7 + i / 65537);
+    }
+
+    MockServer server;
+    if (pages.song == NULL || mock_server_start(&server, route_resume, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free(pages.song);
+        return test_summary("test_resume");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "resume") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+
+    char url[MAX_URL_LENGTH];
+    char output[sizeof(directory) + 32];
+    char part[sizeof(output) + 8];
+    char segment[sizeof(output) + 8];
+    snprintf(url, sizeof(url), "%s/song.mp3", base);
+    snprintf(output, sizeof(output), "%s/song.mp3", directory);
+    snprintf(part, sizeof(part), "%s.part", output);
+    snprintf(segment, sizeof(segment), "%s.seg", output);
+
+    // An interrupted download asks only for what is missing
+    long sent = mock_sent(&server);
+    check(write_part(part, pages.song, RESUME_PARTIAL) == 0 && run_download(download_file, url, output, NULL, NULL) == 0, "a part file is resumed");
+    check(same_file(output, pages.song, RESUME_SONG_SIZE) && !file_exists(part), "the resumed song is whole and its part file is gone");
+    check(mock_sent(&server) - sent == RESUME_SONG_SIZE - RESUME_PARTIAL, "only the missing bytes are sent");
+    remove(output);
+
+    // A part file that is whole already gets a 416, and is done
+    sent = mock_sent(&server);
+    check(write_part(part, pages.song, RESUME_SONG_SIZE) == 0 && run_download(download_file, url, output, NULL, NULL) == 0, "a whole part file is taken as done");
+    check(same_file(output, pages.song, RESUME_SONG_SIZE) && !file_exists(part) && mock_sent(&server) == sent, "a whole part file is kept without a byte sent");
+    remove(output);
+
+    // A server ignoring the Range header sends the whole song, which must not be appended to the part file
+    mock_ignore_ranges(&server, 1);
+    long requests = mock_requests(&server);
+    check(write_part(part, pages.song + 1, RESUME_PARTIAL) == 0 && run_download(download_file, url, output, NULL, NULL) == 0, "a download the server can't resume starts over");
+    check(same_file(output, pages.song, RESUME_SONG_SIZE) && !file_exists(part), "the song started over is whole");
+    check(mock_requests(&server) - requests == 2, "the song is asked for once more from the first byte");
+    mock_ignore_ranges(&server, 0);
+    remove(output);
+
+    // A server failing leaves the part file for the next attempt
+    char missing[MAX_URL_LENGTH];
+    snprintf(missing, sizeof(missing), "%s/missing.mp3", base);
+    check(write_part(part, pages.song, RESUME_PARTIAL) == 0 && run_download(download_file, missing, output, NULL, NULL) == -1, "a resume the server fails fails");
+    check(!file_exists(output) && same_file(part, pages.song, RESUME_PARTIAL), "the part file is kept as it was");
+    remove(part);
+
+    // The song in ranges side by side: a probe for the first byte, then every range once
+    sent = mock_sent(&server);
+    requests = mock_requests(&server);
+    check(run_download(download_segments, url, output, NULL, NULL) == 0, "a song is downloaded in ranges");
+    check(same_file(output, pages.song, RESUME_SONG_SIZE), "the ranges put together are the song byte for byte");
+    check(!file_exists(part) && !file_exists(segment), "no part or segment file is left");
+    check(mock_requests(&server) - requests == RESUME_SEGMENTS + 1 && mock_sent(&server) - sent == RESUME_SONG_SIZE + 1,
+          "every byte is sent once, after a probe of one byte");
+    remove(output);
+
+    // A part file is resumed rather than split
+    sent = mock_sent(&server);
+    check(write_part(part, pages.song, RESUME_PARTIAL) == 0 && run_download(download_segments, url, output, NULL, NULL) == 0, "a part file left before ranges is resumed");
+    check(same_file(output, pages.song, RESUME_SONG_SIZE) && !file_exists(part) && !file_exists(segment) &&
+              mock_sent(&server) - sent == RESUME_SONG_SIZE - RESUME_PARTIAL,
+          "only the missing bytes of it are sent");
+    remove(output);
+
+    // No ranges, no split
+    mock_ignore_ranges(&server, 1);
+    check(run_download(download_segments, url, output, NULL, NULL) == 0 && same_file(output, pages.song, RESUME_SONG_SIZE) && !file_exists(segment),
+          "a server without ranges gets a single stream");
+    mock_ignore_ranges(&server, 0);
+    remove(output);
+
+    mock_server_stop(&server);
+    rmdir(directory);
+    free(pages.song);
+
+    return test_summary("test_resume");
+}
@@ -0,0 +1,375 @@
+// test_scan.c
+// Checks the hand-written scanners of rocknation_scan.h (scan_band, scan_album) against the PCRE2 patterns
+// they stand for: on the saved pages of tests/fixtures with 0 to 63 bytes put in front of every link, so
+// every link crosses the 16 and 32-byte blocks of find_anchor at every position; on every prefix of a link,
+// for the partial matches of a page still downloading; and on random pages made of pieces of links. Checks
+// that pattern_match only runs them where they beat PCRE2, then compares their throughput. Built by
+// tests/run.sh as is, with ROCKNATION_NO_SIMD (byte by byte) and, on CPUs that have it, with -mavx2.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+
+#include <strings.h>
+
+#define PADDINGS 64
+#define FUZZ_PAGES 20000
+#define BENCH_SIZE (16 * 1024 * 1024)
+
+typedef struct
+{
+    const char *file;
+    PatternId pattern;
+} Fixture;
+
+static const Fixture fixtures[] = {
+    {"search.html", PATTERN_BAND},
+    {"discography.html", PATTERN_ALBUM},
+};
+
+// Pieces the random pages are made of: parts of links in both cases, and text that looks like them
+static const char *fragments[] = {
+    "<a href=\"/mp3/band-", "<A HREF=\"/MP3/BAND-", "<a href=\"/mp3/album-", "<a hreF=\"/mp3/Album-", "12", "7",
+    "\">", "Iron Maiden", "AC/DC", "</a></td><td>", "</A></TD><TD>", "Heavy Metal", "</td>", "1984", " - ",
+    "Name ", "x", "\n", "\r", "<", "</a>", "</", "\"", "/", "-", "\xc3\xa9", "<a href=\"/mp3/", " ",
+};
+
+static int compare_match(PatternId pattern, const char *data, size_t size, size_t offset, int final, const char *what);
+static int compare_all(PatternId pattern, const char *data, size_t size, int final, const char *what);
+static void check_padded(const Fixture *fixture, const char *page, size_t size);
+static void check_prefixes(const Fixture *fixture, const char *page, size_t size);
+static void check_random_pages(void);
+static void check_choice(void);
+static void bench_scanners(void);
+
+static int compare_match(PatternId pattern, const char *data, size_t size, size_t offset, int final, const char *what)
+{
+    /* Function  : static int compare_match(PatternId pattern, const char *data, size_t size, size_t offset, int final, const char *what)
+     * Input     : pattern - pattern the scanner stands for
+     *             data - pointer to the text
+     *             size - length of the text
+     *             offset - position to search from
+     *             final - non-zero if the text is complete
+     *             what - description of the text, printed on a mismatch
+     * Output    : Returns the end of the match, 0 if there is none (or a partial match), -1 if the scanner and PCRE2 disagree
+     * Procedure : This function searches once with the scanner and once with the PCRE2 interpreter (with PCRE2_PARTIAL_HARD when the text isn't final, as the extractor does), and compares the outcome, the offsets and groups of a match, and the start of a partial match.
+     */
+
+    CompiledPattern *compiled = get_pattern(pattern);
+    pcre2_match_data *match_data = compiled->match_data;
+    uint32_t options = PCRE2_NO_JIT | (final ? 0 : PCRE2_PARTIAL_HARD);
+    PCRE2_SIZE scanned[8];
+
+    int expected = pcre2_match(compiled->code, (PCRE2_SPTR)data, size, offset, options, match_data, NULL);
+    PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(match_data);
+    int found = compiled->scan(data, size, offset, final, scanned);
+
+    int same = expected == found;
+    if (same && expected == PCRE2_ERROR_PARTIAL)
+    {
+        same = ovector[0] == scanned[0];
+    }
+    for (int i = 0; same && expected > 0 && i < 8; i++)
+    {
+        same = ovector[i] == scanned[i];
+    }
+
+    if (!same)
+    {
+        printf("%s: offset %zu, final %d: PCRE2 returned %d at %zu, the scanner %d at %zu\n",
+               what, offset, final, expected, expected >= 0 || expected == PCRE2_ERROR_PARTIAL ? (size_t)ovector[0] : 0,
+               found, found >= 0 || found == PCRE2_ERROR_PARTIAL ? (size_t)scanned[0] : 0);
+        check(0, what);
+        return -1;
+    }
+
+    return expected > 0 ? (int)ovector[1] : 0;
+}
+
+static int compare_all(PatternId pattern, const char *data, size_t size, int final, const char *what)
+{
+    /* Function  : static int compare_all(PatternId pattern, const char *data, size_t size, int final, const char *what)
+     * Input     : pattern - pattern the scanner stands for
+     *             data - pointer to the text
+     *             size - length of the text
+     *             final - non-zero if the text is complete
+     *             what - description of the text, printed on a mismatch
+     * Output    : Returns the number of matches, or -1 on the first disagreement
+     * Procedure : This function walks through every match of the text like the extractor does, comparing the scanner with PCRE2 at each step.
+     */
+
+    size_t offset = 0;
+    int matches = 0;
+    int end;
+
+    while (offset <= size && (end = compare_match(pattern, data, size, offset, final, what)) > 0)
+    {
+        offset = (size_t)end;
+        matches++;
+    }
+
+    return end < 0 ? -1 : matches;
+}
+
+static void check_padded(const Fixture *fixture, const char *page, size_t size)
+{
+    /* Function  : static void check_padded(const Fixture *fixture, const char *page, size_t size)
+     * Input     : fixture - pointer to the fixture and the pattern it is scanned with
+     *             page - pointer to the page
+     *             size - size of the page
+     * Output    : None
+     * Procedure : This function scans the page with 0 to 63 bytes of filler put in front of every link. find_anchor reads blocks of 16 or 32 bytes from where the search starts, which is the end of the previous match, so across the paddings every link starts at every position of a block and its anchor straddles every block boundary. The filler holds '<' and the start of an anchor, which must not be taken for a link.
+     */
+
+    size_t anchors = 0;
+    for (size_t i = 0; i + SCAN_ANCHOR_LENGTH <= size; i++)
+    {
+        anchors += strncasecmp(page + i, SCAN_ANCHOR, SCAN_ANCHOR_LENGTH) == 0;
+    }
+
+    char *padded = malloc(size + (anchors + 1) * PADDINGS);
+    char what[128];
+    int matches = -1;
+
+    for (int padding = 0; padding < PADDINGS && padded != NULL; padding++)
+    {
+        size_t length = 0;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            if (i + SCAN_ANCHOR_LENGTH <= size && strncasecmp(page + i, SCAN_ANCHOR, SCAN_ANCHOR_LENGTH) == 0)
+            {
+                for (int k = 0; k < padding; k++)
+                {
+                    padded[length++] = "<a href=\"/mp3/x"[k % 15];
+                }
+            }
+            padded[length++] = page[i];
+        }
+
+        snprintf(what, sizeof(what), "%s with %d bytes before every link", fixture->file, padding);
+        int found = compare_all(fixture->pattern, padded, length, 1, what);
+        if (found < 0)
+        {
+            break;
+        }
+
+        if (matches < 0)
+        {
+            matches = found;
+        }
+        snprintf(what, sizeof(what), "%s with %d bytes before every link has as many matches as the page", fixture->file, padding);
+        check(found == matches && found > 0, what);
+    }
+
+    free(padded);
+}
+
+static void check_prefixes(const Fixture *fixture, const char *page, size_t size)
+{
+    /* Function  : static void check_prefixes(const Fixture *fixture, const char *page, size_t size)
+     * Input     : fixture - pointer to the fixture and the pattern it is scanned with
+     *             page - pointer to the page
+     *             size - size of the page
+     * Output    : None
+     * Procedure : This function cuts the page at every byte of its first two links, as a download would, and compares the partial matches of the scanner and of PCRE2 (and the outcome when the cut page is final).
+     */
+
+    CompiledPattern *compiled = get_pattern(fixture->pattern);
+    size_t offset = 0;
+    char what[128];
+
+    for (int link = 0; link < 2; link++)
+    {
+        if (pcre2_match(compiled->code, (PCRE2_SPTR)page, size, offset, PCRE2_NO_JIT, compiled->match_data, NULL) <= 0)
+        {
+            break;
+        }
+
+        PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(compiled->match_data);
+        size_t start = ovector[0];
+        size_t end = ovector[1];
+
+        for (size_t cut = start; cut <= end + 1 && cut <= size; cut++)
+        {
+            snprintf(what, sizeof(what), "%s cut at %zu", fixture->file, cut);
+            if (compare_match(fixture->pattern, page, cut, offset, 0, what) < 0 ||
+                compare_match(fixture->pattern, page, cut, offset, 1, what) < 0)
+            {
+                return;
+            }
+        }
+
+        offset = end;
+    }
+}
+
+static void check_random_pages(void)
+{
+    /* Function  : static void check_random_pages(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function builds random pages out of the pieces in fragments, and compares every match of both scanners over the whole page and over a random prefix of it, complete or still downloading.
+     */
+
+    unsigned int state = 12345;
+    char page[1024];
+    long pages = 0;
+
+    for (int i = 0; i < FUZZ_PAGES; i++)
+    {
+        size_t size = 0;
+        int pieces = 1 + test_random(&state) % 25;
+
+        for (int f = 0; f < pieces; f++)
+        {
+            const char *fragment = fragments[test_random(&state) % (sizeof(fragments) / sizeof(fragments[0]))];
+            size_t length = strlen(fragment);
+
+            if (size + length >= sizeof(page))
+            {
+                break;
+            }
+            memcpy(page + size, fragment, length);
+            size += length;
+        }
+
+        size_t prefix = size > 0 ? test_random(&state) % size : 0;
+        for (PatternId pattern = PATTERN_BAND; pattern <= PATTERN_ALBUM; pattern++)
+        {
+            for (int final = 0; final < 2; final++)
+            {
+                if (compare_all(pattern, page, size, final, "random page") < 0 ||
+                    compare_all(pattern, page, prefix, final, "random page prefix") < 0)
+                {
+                    printf("%.*s\n", (int)size, page);
+                    return;
+                }
+            }
+        }
+        pages++;
+    }
+
+    check(pages == FUZZ_PAGES, "random pages");
+}
+
+static void check_choice(void)
+{
+    /* Function  : static void check_choice(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function checks that pattern_match runs the scanners only where they beat PCRE2, when it has no JIT. The offsets it gives back tell which one ran, as those of a scanner are kept apart from the match data of PCRE2.
+     */
+
+    const char *link = "<a href=\"/mp3/album-1\">1999 - Album</a>";
+    char what[128];
+
+    for (PatternId pattern = PATTERN_BAND; pattern <= PATTERN_ALBUM; pattern++)
+    {
+        PCRE2_SIZE *ovector = NULL;
+        pattern_match(pattern, link, strlen(link), 0, 0, &ovector);
+        CompiledPattern *compiled = get_pattern(pattern);
+        int scanned = ovector == compiled->scan_ovector;
+
+        snprintf(what, sizeof(what), "pattern_match runs the %s scanner only where it beats PCRE2 (jit=%d)",
+                 pattern == PATTERN_BAND ? "band" : "album", compiled->jit);
+        check(scanned == !compiled->jit, what);
+    }
+}
+
+static void bench_scanners(void)
+{
+    /* Function  : static void bench_scanners(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function builds a large page that is mostly markup around album links, and prints how fast the scanners, the precompiled PCRE2 patterns and the PCRE2 interpreter (what runs where PCRE2 has no JIT) go through it, best of 3 runs.
+     */
+
+    char *page = malloc(BENCH_SIZE);
+    size_t size = 0;
+
+    if (page == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; size + 400 < BENCH_SIZE; i++)
+    {
+        size += (size_t)snprintf(page + size, BENCH_SIZE - size,
+                                 "<div class=\"x\"><span>filler text for the page layout %d</span><p>Lorem ipsum dolor sit amet, <b>bold</b> and <i>it</i></p></div>\n"
+                                 "<li><a href=\"/mp3/album-%d\">19%02d - Album %d</a></li>\n",
+                                 i, i, i % 100, i);
+    }
+
+    for (PatternId pattern = PATTERN_BAND; pattern <= PATTERN_ALBUM; pattern++)
+    {
+        CompiledPattern *compiled = get_pattern(pattern);
+        double best[3] = {0, 0, 0};
+
+        for (int method = 0; method < 3; method++)
+        {
+            for (int run = 0; run < 3; run++)
+            {
+                double started = rn_clock();
+                size_t offset = 0;
+                PCRE2_SIZE ovector[8];
+
+                if (method == 0)
+                {
+                    while (compiled->scan(page, size, offset, 1, ovector) > 0)
+                    {
+                        offset = ovector[1];
+                    }
+                }
+                else
+                {
+                    uint32_t options = method == 1 ? 0 : PCRE2_NO_JIT;
+                    while (pcre2_match(compiled->code, (PCRE2_SPTR)page, size, offset, options, compiled->match_data, NULL) > 0)
+                    {
+                        offset = pcre2_get_ovector_pointer(compiled->match_data)[1];
+                    }
+                }
+
+                double rate = bench_rate((double)size, rn_clock() - started);
+                best[method] = rate > best[method] ? rate : best[method];
+            }
+        }
+
+        printf("%-5s pattern over %zu MB: scanner %5.2f GB/s, PCRE2 (jit=%d) %5.2f GB/s, PCRE2 interpreter %5.2f GB/s, pattern_match uses %s\n",
+               pattern == PATTERN_BAND ? "band" : "album", size >> 20, best[0] / 1024, compiled->jit, best[1] / 1024, best[2] / 1024,
+               compiled->jit ? "PCRE2" : "the scanner");
+    }
+
+    free(page);
+}
+
+int main(void)
+{
+#if defined(RN_SIMD_AVX2)
+    printf("find_anchor: AVX2\n");
+#elif defined(RN_SIMD_SSE2)
+    printf("find_anchor: SSE2\n");
+#else
+    printf("find_anchor: byte by byte\n");
+#endif
+
+    for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++)
+    {
+        size_t size;
+        char *page = read_fixture(fixtures[i].file, &size);
+
+        check(page != NULL, fixtures[i].file);
+        if (page == NULL)
+        {
+            continue;
+        }
+
+        check_padded(&fixtures[i], page, size);
+        check_prefixes(&fixtures[i], page, size);
+        free(page);
+    }
+
+    check_random_pages();
+    check_choice();
+    bench_scanners();
+
+    return test_summary("test_scan");
+}
@@ -0,0 +1,128 @@
+// test_session.c
+// Checks that the session (rocknation_session.h) keeps one connection alive across a search, both pages of a
+// discography, an album page and a song download, against a local server (mock_server.h) answering with the
+// fixture pages. The server must accept a single connection for all of them, and the session must count
+// every request, the one connection it opened and a timing for each phase. Once the session is cleaned up
+// the next request must open a new connection. Prints the timing breakdown of the session.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define SESSION_SONG_SIZE (256 * 1024)
+
+typedef struct
+{
+    FixturePages fixture;
+    char song[SESSION_SONG_SIZE];
+} SessionPages;
+
+static const char *route_session(const char *method, const char *path, size_t *size, void *userdata);
+
+static const char *route_session(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_session(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the SessionPages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers /song.mp3 with the song, and any other request through route_fixture.
+     */
+
+    SessionPages *pages = (SessionPages *)userdata;
+
+    if (strcmp(path, "/song.mp3") == 0)
+    {
+        *size = sizeof(pages->song);
+        return pages->song;
+    }
+
+    return route_fixture(method, path, size, &pages->fixture);
+}
+
+int main(void)
+{
+    static SessionPages pages;
+    for (size_t i = 0; i < sizeof(pages.song); i++)
+    {
+        pages.song[i] = (char)(i * 5 + 1);
+    }
+
+    int ready = load_fixture_pages(&pages.fixture) == 0;
+    check(ready, "the fixture pages are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_session, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free_fixture_pages(&pages.fixture);
+        return test_summary("test_session");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "session") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    get_cache()->enabled = 0;
+
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList bands;
+    AlbumInfoList albums;
+    SongInfoList songs;
+    init_band_list(&bands, &arena);
+    init_album_list(&albums, &arena);
+    init_song_list(&songs, &arena);
+
+    char url[MAX_URL_LENGTH];
+    char band[sizeof(base) + 32];
+    char output[sizeof(directory) + 32];
+    snprintf(output, sizeof(output), "%s/song.mp3", directory);
+
+    int saved = silence_stdout();
+    search_band("Test Band", &bands);
+    snprintf(band, sizeof(band), "%s/mp3/band-1", base);
+    get_albums(band, &albums);
+    snprintf(url, sizeof(url), "%s/mp3/album-1", base);
+    get_songs(url, &songs);
+    snprintf(url, sizeof(url), "%s/song.mp3", base);
+    int downloaded = download_file(url, output);
+    restore_stdout(saved);
+
+    RocknationSession *session = get_session();
+    check(bands.count > 0 && albums.count > 0 && songs.count > 0 && downloaded == 0, "the lookups and the download succeed");
+    check(mock_requests(&server) == 5, "a search, two pages of discography, an album page and a song are requested");
+    check(mock_accepted(&server) == 1, "every request goes over the same connection");
+    check(session->requests == 5 && session->connects == 1, "the session counts every request and the one connection it opened");
+    check(session->total_us > 0 && session->total_us >= session->wait_us + session->transfer_us, "the session adds up the time of every phase");
+
+    fprintf(stderr, "[timing] printed by test_session:\n");
+    print_session_timings();
+
+    // A session cleaned up closes its connection, the next one opens a new one
+    session_cleanup();
+    saved = silence_stdout();
+    downloaded = download_file(url, output);
+    restore_stdout(saved);
+    check(downloaded == 0 && mock_accepted(&server) == 2, "a new session opens a new connection");
+
+    arena_free(&arena);
+    mock_server_stop(&server);
+    store_close();
+
+    char path[sizeof(directory) + 32];
+    snprintf(path, sizeof(path), "%s/%s", directory, STORE_FILE);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/%s", directory, SNAPSHOT_FILE);
+    remove(path);
+    remove(output);
+    rmdir(directory);
+    free_fixture_pages(&pages.fixture);
+
+    return test_summary("test_session");
+}
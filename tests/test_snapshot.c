@@ -0,0 +1,275 @@
+// test_snapshot.c
+// Checks the binary snapshot of the local catalog store (rocknation_snapshot.h) against the store file it is
+// built from. Writes a store file of STORE_BANDS bands into a temporary cache directory, and runs the same
+// lookups with the whole file parsed, with the snapshot mapped, with the snapshot and lines appended after
+// it, and with a damaged snapshot that must be ignored. Every way must give the same results. Prints the time
+// to open the store and answer the first lookup, with and without the snapshot, and to build the snapshot.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+
+#include <sys/stat.h>
+
+#define STORE_BANDS 100000
+#define STORE_LOOKUPS 2000
+
+static unsigned long results_hash;
+
+static void hash_text(const char *text);
+static int write_store_file(const char *path, int bands);
+static int append_store_file(const char *path, int id);
+static double open_store(void);
+static unsigned long run_lookups(int bands);
+static int cut_file(const char *path, long size);
+
+static void hash_text(const char *text)
+{
+    /* Function  : static void hash_text(const char *text)
+     * Input     : text - pointer to a field of a lookup result, or NULL
+     * Output    : None
+     * Procedure : This function mixes a field into results_hash (djb2), so whole runs of lookups can be compared by one number.
+     */
+
+    while (text != NULL && *text != '\0')
+    {
+        results_hash = results_hash * 33 + (unsigned char)*text++;
+    }
+    results_hash = results_hash * 33;
+}
+
+static int write_store_file(const char *path, int bands)
+{
+    /* Function  : static int write_store_file(const char *path, int bands)
+     * Input     : path - path of the store file to write
+     *             bands - number of bands
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function writes a store file in the format read by store_load: every band with a discography of 5 albums, the songs of one album in 25, and a search for one band in 10.
+     */
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(file, "%s\n", STORE_MAGIC);
+    for (int band = 0; band < bands; band++)
+    {
+        fprintf(file, "B\t%d\tBand %d\tGenre %d\n", band, band, band % 40);
+        fprintf(file, "A\t%d\t5\n", band);
+        for (int album = band * 5; album < band * 5 + 5; album++)
+        {
+            fprintf(file, "a\t%s/mp3/album-%d\t%d\tAlbum %d\n", base_url(), album, 1980 + album % 5, album);
+        }
+    }
+    for (int album = 0; album < bands * 5; album += 25)
+    {
+        fprintf(file, "T\t%d\t12\n", album);
+        for (int song = 0; song < 12; song++)
+        {
+            fprintf(file, "t\thttp://rocknation.su/upload/mp3/Band%%20%d/%d%%20-%%20Album%%20%d/%02d.%%20Song%%20%d.mp3\tBand%%20%d\t%d\tAlbum%%20%d\tSong %d\n",
+                    album / 5, 1980 + album % 5, album, song + 1, song, album / 5, 1980 + album % 5, album, song);
+        }
+    }
+    for (int band = 0; band < bands; band += 10)
+    {
+        fprintf(file, "S\tband %d\t%d %d %d\n", band, band, band + 1, band + 2);
+    }
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int append_store_file(const char *path, int id)
+{
+    /* Function  : static int append_store_file(const char *path, int id)
+     * Input     : path - path of the store file
+     *             id - id of the band to add
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function appends a band, its discography and a search for it to the store file, as a run that found a new band would.
+     */
+
+    FILE *file = fopen(path, "a");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(file, "B\t%d\tBand %d\tGenre new\n", id, id);
+    fprintf(file, "A\t%d\t1\n", id);
+    fprintf(file, "a\t%s/mp3/album-%d\t2024\tAlbum new\n", base_url(), id * 5);
+    fprintf(file, "S\tband %d\t%d\n", id, id);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static double open_store(void)
+{
+    /* Function  : static double open_store(void)
+     * Input     : None
+     * Output    : Returns the time in ms to open the store and answer a first lookup
+     * Procedure : This function measures what a run pays before its first answer: reading the store file, or mapping the snapshot and reading what was appended after it.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    AlbumInfoList albums;
+    init_album_list(&albums, &arena);
+
+    char url[MAX_URL_LENGTH];
+    snprintf(url, sizeof(url), "%s/mp3/band-%d", base_url(), STORE_BANDS / 2);
+
+    double started = rn_clock();
+    get_store();
+    store_albums(url, &albums);
+    double elapsed = rn_clock() - started;
+
+    arena_free(&arena);
+    return elapsed * 1e3;
+}
+
+static unsigned long run_lookups(int bands)
+{
+    /* Function  : static unsigned long run_lookups(int bands)
+     * Input     : bands - number of bands in the store file
+     * Output    : Returns the hash of every result, see hash_text
+     * Procedure : This function runs STORE_LOOKUPS discography, album and search lookups spread over the store, plus lookups of ids that aren't in it, and hashes every field of the results.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    char url[MAX_URL_LENGTH];
+    results_hash = 5381;
+
+    for (int i = 0; i < STORE_LOOKUPS; i++)
+    {
+        int id = (int)(((long)i * 7919) % (bands + 50));
+
+        AlbumInfoList albums;
+        init_album_list(&albums, &arena);
+        snprintf(url, sizeof(url), "%s/mp3/band-%d", base_url(), id);
+        if (store_albums(url, &albums) == 0)
+        {
+            for (int j = 0; j < albums.count; j++)
+            {
+                hash_text(albums.albums[j].url);
+                hash_text(albums.albums[j].year);
+                hash_text(albums.albums[j].name);
+            }
+        }
+
+        SongInfoList songs;
+        init_song_list(&songs, &arena);
+        snprintf(url, sizeof(url), "%s/mp3/album-%d", base_url(), id / 5 * 25);
+        if (store_songs(url, &songs, NULL, NULL) == 0)
+        {
+            for (int j = 0; j < songs.count; j++)
+            {
+                hash_text(songs.songs[j].url);
+                hash_text(songs.songs[j].artist);
+                hash_text(songs.songs[j].year);
+                hash_text(songs.songs[j].album);
+                hash_text(songs.songs[j].name);
+            }
+        }
+
+        BandInfoList found;
+        init_band_list(&found, &arena);
+        snprintf(url, sizeof(url), "BAND %d", id / 10 * 10);
+        if (store_search(url, &found, NULL, NULL) == 0)
+        {
+            for (int j = 0; j < found.count; j++)
+            {
+                hash_text(found.bands[j].name);
+                hash_text(found.bands[j].url);
+                hash_text(found.bands[j].genre);
+            }
+        }
+    }
+
+    arena_free(&arena);
+    return results_hash;
+}
+
+static int cut_file(const char *path, long size)
+{
+    /* Function  : static int cut_file(const char *path, long size)
+     * Input     : path - path of the file
+     *             size - size to cut it to
+     * Output    : Returns 0 on success, -1 on failure
+     * Procedure : This function truncates a file, standing in for a snapshot damaged by a crash or a full disk.
+     */
+
+    return truncate(path, size);
+}
+
+int main(void)
+{
+    char directory[256];
+    char store_path[sizeof(directory) + 32];
+    char snapshot_path[sizeof(directory) + 32];
+
+    if (make_test_directory(directory, sizeof(directory), "snapshot") != 0)
+    {
+        return 1;
+    }
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    snprintf(store_path, sizeof(store_path), "%s/%s", directory, STORE_FILE);
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", directory, SNAPSHOT_FILE);
+
+    check(write_store_file(store_path, STORE_BANDS) == 0, "the store file is written");
+    struct stat info;
+    double store_size = stat(store_path, &info) == 0 ? info.st_size / (1024.0 * 1024.0) : 0;
+
+    // The whole store file, as before the snapshot existed
+    double parse_time = open_store();
+    check(get_store()->snapshot.data == NULL, "there is no snapshot at first");
+    unsigned long expected = run_lookups(STORE_BANDS);
+    check(get_store()->hits > 0, "lookups are answered from the store");
+
+    double started = rn_clock();
+    store_close();
+    double build_time = (rn_clock() - started) * 1e3;
+    check(stat(snapshot_path, &info) == 0, "closing the store writes the snapshot");
+
+    // The snapshot alone
+    double map_time = open_store();
+    check(get_store()->snapshot.data != NULL && get_store()->pending == 0, "the next run maps the snapshot");
+    check(run_lookups(STORE_BANDS) == expected, "the snapshot gives the same results as the store file");
+    store_close();
+
+    // The snapshot and lines appended after it
+    check(append_store_file(store_path, STORE_BANDS + 7) == 0, "lines are appended to the store file");
+    open_store();
+    check(get_store()->snapshot.data != NULL && get_store()->pending > 0, "the snapshot is used with the lines appended after it");
+    unsigned long appended = run_lookups(STORE_BANDS + 10);
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList found;
+    init_band_list(&found, &arena);
+    char text[64];
+    snprintf(text, sizeof(text), "band %d", STORE_BANDS + 7);
+    check(store_search(text, &found, NULL, NULL) == 0 && found.count == 1 && strcmp(found.bands[0].genre, "Genre new") == 0, "a band appended after the snapshot is found");
+    arena_free(&arena);
+    store_close();
+
+    // The same lines without the snapshot; the whole file is then past the snapshot, so closing rebuilds it
+    remove(snapshot_path);
+    open_store();
+    check(run_lookups(STORE_BANDS + 10) == appended, "the snapshot and appended lines give the same results as the store file");
+    store_close();
+
+    // A damaged snapshot
+    check(stat(snapshot_path, &info) == 0 && cut_file(snapshot_path, info.st_size / 2) == 0, "the rebuilt snapshot is cut");
+    open_store();
+    check(get_store()->snapshot.data == NULL, "a damaged snapshot is ignored");
+    check(run_lookups(STORE_BANDS + 10) == appended, "without the damaged snapshot the store file gives the same results");
+    store_close();
+
+    printf("%d bands, %.1f MB store file: first answer %.2f ms parsing it, %.2f ms with the snapshot; snapshot built in %.0f ms\n",
+           STORE_BANDS, store_size, parse_time, map_time, build_time);
+
+    remove(snapshot_path);
+    remove(store_path);
+    rmdir(directory);
+
+    return test_summary("test_snapshot");
+}
@@ -0,0 +1,239 @@
+// test_song_page.c
+// Checks get_song_page (rocknation_curl.h) against a local server (mock_server.h) answering the fixture album
+// page, and a long album with its songs repeated SONG_PAGE_COPIES times. The spans of every song must read
+// back, with span_copy and span_decode, as the songs get_songs gives. Listing an album must take a handful
+// of heap allocations however many songs it has: the long album may take no more than SONG_PAGE_SLACK more
+// than the short one, and far fewer than one per song. Prints the allocations of both lookups.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define SONG_PAGE_COPIES 4 // Times the songs of the fixture album are repeated in the long album
+#define SONG_PAGE_SLACK 4  // Allocations the long album may take beyond the short one, as its buffers double a few more times
+
+typedef struct
+{
+    FixturePages fixture;
+    char *long_album;
+    size_t long_album_size;
+} SongPagePages;
+
+static const char *route_song_page(const char *method, const char *path, size_t *size, void *userdata);
+static char *repeat_songs(const char *page, size_t size, int copies, size_t *long_size);
+static size_t heap_calls(void);
+static int same_refs(const SongPage *page, const SongInfoList *songs);
+static int list_album(const char *url, SongPage *page, size_t *calls);
+
+static const char *route_song_page(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_song_page(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the SongPagePages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers /mp3/album-<n> with the long album for n of 100 and more, and anything else through route_fixture.
+     */
+
+    SongPagePages *pages = (SongPagePages *)userdata;
+    int id;
+
+    if (sscanf(path, "/mp3/album-%d", &id) == 1 && id >= 100)
+    {
+        *size = pages->long_album_size;
+        return pages->long_album;
+    }
+
+    return route_fixture(method, path, size, &pages->fixture);
+}
+
+static char *repeat_songs(const char *page, size_t size, int copies, size_t *long_size)
+{
+    /* Function  : static char *repeat_songs(const char *page, size_t size, int copies, size_t *long_size)
+     * Input     : page - pointer to album.html
+     *             size - size of the page
+     *             copies - times the songs are repeated
+     *             long_size - pointer receiving the size of the new page
+     * Output    : Returns the new page, to be freed by the caller, or NULL if it can't be made
+     * Procedure : This function copies the page with the rows of its song table, from the first row to the end of the last, repeated copies times.
+     */
+
+    const char *first = strstr(page, "<tr>");
+    const char *last = NULL;
+    for (const char *row = first; row != NULL; row = strstr(row + 1, "</tr>"))
+    {
+        last = row;
+    }
+    if (first == NULL || last == NULL || last < first)
+    {
+        return NULL;
+    }
+    last += strlen("</tr>");
+
+    size_t head = (size_t)(first - page);
+    size_t rows = (size_t)(last - first);
+    size_t tail = size - head - rows;
+    char *copy = malloc(head + rows * copies + tail + 1);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(copy, page, head);
+    for (int i = 0; i < copies; i++)
+    {
+        memcpy(copy + head + rows * i, first, rows);
+    }
+    memcpy(copy + head + rows * copies, last, tail);
+    *long_size = head + rows * copies + tail;
+    copy[*long_size] = '\0';
+
+    return copy;
+}
+
+static size_t heap_calls(void)
+{
+    /* Function  : static size_t heap_calls(void)
+     * Input     : None
+     * Output    : Returns the number of heap allocations and reallocations made by the library so far
+     * Procedure : This function reads the counters of the counting allocator.
+     */
+
+    return RN_ATOMIC_ADD(rocknation_alloc.allocations, 0) + RN_ATOMIC_ADD(rocknation_alloc.reallocations, 0);
+}
+
+static int same_refs(const SongPage *page, const SongInfoList *songs)
+{
+    /* Function  : static int same_refs(const SongPage *page, const SongInfoList *songs)
+     * Input     : page - pointer to a SongPage filled by get_song_page
+     *             songs - pointer to the songs get_songs gives for the same page
+     * Output    : Returns 1 if the spans of every song read back as the song, 0 otherwise
+     * Procedure : This function reads the URL, artist, year and album of every song with span_copy, and its name with span_decode, and compares them with the song.
+     */
+
+    const char *text = page->page.memory;
+    char field[MAX_URL_LENGTH];
+    int same = page->count == songs->count;
+
+    for (int i = 0; same && i < page->count; i++)
+    {
+        const SongRef *ref = &page->songs[i];
+        const SongInfo *song = &songs->songs[i];
+
+        span_copy(text, ref->url, field, sizeof(field));
+        same = strcmp(field, song->url) == 0;
+        span_copy(text, ref->artist, field, sizeof(field));
+        same = same && strcmp(field, song->artist) == 0;
+        span_copy(text, ref->year, field, sizeof(field));
+        same = same && strcmp(field, song->year) == 0;
+        span_copy(text, ref->album, field, sizeof(field));
+        same = same && strcmp(field, song->album) == 0;
+        span_decode(text, ref->name, field, sizeof(field));
+        same = same && strcmp(field, song->name) == 0;
+    }
+
+    return same;
+}
+
+static int list_album(const char *url, SongPage *page, size_t *calls)
+{
+    /* Function  : static int list_album(const char *url, SongPage *page, size_t *calls)
+     * Input     : url - pointer to the URL of the album
+     *             page - pointer to a SongPage prepared with init_song_page
+     *             calls - pointer receiving the heap allocations the lookup made
+     * Output    : Returns what get_song_page returns
+     * Procedure : This function runs get_song_page with its messages silenced and counts its heap allocations.
+     */
+
+    size_t before = heap_calls();
+    int saved = silence_stdout();
+    int result = get_song_page(url, page);
+
+    restore_stdout(saved);
+    *calls = heap_calls() - before;
+
+    return result;
+}
+
+int main(void)
+{
+    static SongPagePages pages;
+    int ready = load_fixture_pages(&pages.fixture) == 0 &&
+                (pages.long_album = repeat_songs(pages.fixture.album, pages.fixture.album_size, SONG_PAGE_COPIES, &pages.long_album_size)) != NULL;
+    check(ready, "the fixture pages are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_song_page, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        free(pages.long_album);
+        free_fixture_pages(&pages.fixture);
+        return test_summary("test_song_page");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "song-page") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    get_cache()->enabled = 0;
+
+    Arena arena;
+    arena_init(&arena, 0);
+    SongInfoList songs;
+    SongInfoList long_songs;
+    init_song_list(&songs, &arena);
+    init_song_list(&long_songs, &arena);
+
+    // The songs copied out, which also sets up the session and the store for the lookups after them
+    char url[MAX_URL_LENGTH];
+    int saved = silence_stdout();
+    snprintf(url, sizeof(url), "%s/mp3/album-1", base);
+    get_songs(url, &songs);
+    snprintf(url, sizeof(url), "%s/mp3/album-100", base);
+    get_songs(url, &long_songs);
+    restore_stdout(saved);
+    check(songs.count > 0 && long_songs.count > songs.count * 2, "the songs of both albums are found");
+
+    Arena page_arena;
+    arena_init(&page_arena, 0);
+    SongPage page;
+    SongPage long_page;
+    init_song_page(&page, &page_arena);
+    init_song_page(&long_page, &page_arena);
+    size_t calls = 0;
+    size_t long_calls = 0;
+
+    snprintf(url, sizeof(url), "%s/mp3/album-2", base);
+    check(list_album(url, &page, &calls) == 0 && same_refs(&page, &songs), "the spans of the album read back as its songs");
+    snprintf(url, sizeof(url), "%s/mp3/album-101", base);
+    check(list_album(url, &long_page, &long_calls) == 0 && same_refs(&long_page, &long_songs), "the spans of the long album read back as its songs");
+
+    check(long_calls <= calls + SONG_PAGE_SLACK, "a long album takes about as many heap allocations as a short one");
+    check(long_calls < (size_t)long_page.count / 4, "an album takes far fewer heap allocations than it has songs");
+    printf("%d songs: %zu heap allocations, %d songs: %zu\n", page.count, calls, long_page.count, long_calls);
+
+    free_song_page(&page);
+    free_song_page(&long_page);
+    check(page.count == 0 && page.page.memory == NULL, "a freed song page is empty");
+
+    arena_free(&page_arena);
+    arena_free(&arena);
+    mock_server_stop(&server);
+    store_close();
+
+    char path[sizeof(directory) + 32];
+    snprintf(path, sizeof(path), "%s/%s", directory, STORE_FILE);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/%s", directory, SNAPSHOT_FILE);
+    remove(path);
+    rmdir(directory);
+    free(pages.long_album);
+    free_fixture_pages(&pages.fixture);
+
+    return test_summary("test_song_page");
+}
@@ -0,0 +1,282 @@
+// test_store.c
+// Checks the local catalog store (rocknation_store.h) through the lookups that fill it, against a local
+// server (mock_server.h) answering with the fixture pages: a search, a discography of two pages and an album
+// must come back from the network with what the pages hold, and then from the store without a request, in
+// the same run and after the store file was read back. A discography whose second page is an error must not
+// be stored, --refresh must go to the network again, the last record of a discography must win, and a record
+// appended after a line cut short by an interrupted run must still be read. Prints the time of the lookups
+// answered from the store.
+#include "../include/rocknation_curl.h"
+#include "test_util.h"
+#include "mock_server.h"
+
+#define STORE_BAND 1        // Band whose discography ends with a page without albums
+#define STORE_BROKEN_BAND 2 // Band whose second page of discography answers 404
+#define STORE_ALBUM 5
+#define STORE_LOOKUPS 10000
+
+static const char *route_catalog(const char *method, const char *path, size_t *size, void *userdata);
+static int same_bands(const BandInfoList *a, const BandInfoList *b);
+static void check_url_ids(void);
+static void check_lookups(MockServer *server, const BandInfoList *bands, const AlbumInfoList *albums, const SongInfoList *songs, const char *what);
+static void bench_store(void);
+
+static const char *route_catalog(const char *method, const char *path, size_t *size, void *userdata)
+{
+    /* Function  : static const char *route_catalog(const char *method, const char *path, size_t *size, void *userdata)
+     * Input     : method - method of the request
+     *             path - path of the request
+     *             size - pointer receiving the size of the answer
+     *             userdata - pointer to the FixturePages
+     * Output    : Returns the answer to the request, or NULL for 404
+     * Procedure : This function answers like route_fixture, except for the second page of the discography of STORE_BROKEN_BAND, which answers 404.
+     */
+
+    int id;
+    int page;
+
+    if (sscanf(path, "/mp3/band-%d/%d", &id, &page) == 2 && id == STORE_BROKEN_BAND && page != 1)
+    {
+        return NULL;
+    }
+
+    return route_fixture(method, path, size, userdata);
+}
+
+static int same_bands(const BandInfoList *a, const BandInfoList *b)
+{
+    /* Function  : static int same_bands(const BandInfoList *a, const BandInfoList *b)
+     * Input     : a, b - pointers to the lists to compare
+     * Output    : Returns 1 if both hold the same bands in the same order, 0 otherwise
+     * Procedure : This function compares the id, name and genre of every band. URLs are compared by id, as the store builds them from it.
+     */
+
+    int same = a->count == b->count;
+
+    for (int i = 0; same && i < a->count; i++)
+    {
+        same = store_url_id(a->bands[i].url, "band-") == store_url_id(b->bands[i].url, "band-") &&
+               strcmp(a->bands[i].name, b->bands[i].name) == 0 && strcmp(a->bands[i].genre, b->bands[i].genre) == 0;
+    }
+
+    return same;
+}
+
+static void check_url_ids(void)
+{
+    /* Function  : static void check_url_ids(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function checks the ids records are keyed by, taken from band and album URLs.
+     */
+
+    check(store_url_id("https://rocknation.su/mp3/band-123", "band-") == 123, "the id of a band URL");
+    check(store_url_id("https://rocknation.su/mp3/band-123/2", "band-") == 123, "the page of a band URL is ignored");
+    check(store_url_id("https://rocknation.su/MP3/BAND-123", "band-") == 123, "the id of a band URL in capitals");
+    check(store_url_id("http://127.0.0.1:8080/mp3/album-77", "album-") == 77, "the id of an album URL, on any host");
+    check(store_url_id("https://rocknation.su/mp3/album-77", "band-") == -1, "an album URL has no band id");
+    check(store_url_id("https://rocknation.su/mp3/band-", "band-") == -1, "a band URL without digits has no id");
+    check(store_url_id("https://rocknation.su/band-12", "band-") == -1, "a URL outside /mp3/ has no id");
+}
+
+static void check_lookups(MockServer *server, const BandInfoList *bands, const AlbumInfoList *albums, const SongInfoList *songs, const char *what)
+{
+    /* Function  : static void check_lookups(MockServer *server, const BandInfoList *bands, const AlbumInfoList *albums, const SongInfoList *songs, const char *what)
+     * Input     : server - pointer to the MockServer
+     *             bands, albums, songs - pointers to what the fixture pages hold
+     *             what - description of the state of the store
+     * Output    : None
+     * Procedure : This function runs the search (in another case), the discography and the album again, and checks they are answered from the store with what the pages hold, without a request.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList band_list;
+    AlbumInfoList album_list;
+    SongInfoList song_list;
+    init_band_list(&band_list, &arena);
+    init_album_list(&album_list, &arena);
+    init_song_list(&song_list, &arena);
+
+    char url[MAX_URL_LENGTH];
+    char message[160];
+    long requests = mock_requests(server);
+    int hits = get_store()->hits;
+
+    search_band("TEST band", &band_list);
+    snprintf(url, sizeof(url), "%s/mp3/band-%d", base_url(), STORE_BAND);
+    get_albums(url, &album_list);
+    snprintf(url, sizeof(url), "%s/mp3/album-%d", base_url(), STORE_ALBUM);
+    get_songs(url, &song_list);
+
+    snprintf(message, sizeof(message), "%s, the search, discography and album come from the store without a request", what);
+    check(mock_requests(server) == requests && get_store()->hits == hits + 3, message);
+    snprintf(message, sizeof(message), "%s, the store gives back what the pages hold", what);
+    check(same_bands(&band_list, bands) && same_albums(&album_list, albums) && same_songs(&song_list, songs), message);
+
+    arena_free(&arena);
+}
+
+static void bench_store(void)
+{
+    /* Function  : static void bench_store(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function measures the search, discography and album lookups answered from the store.
+     */
+
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList band_list;
+    AlbumInfoList album_list;
+    SongInfoList song_list;
+    init_band_list(&band_list, &arena);
+    init_album_list(&album_list, &arena);
+    init_song_list(&song_list, &arena);
+
+    char band_url[MAX_URL_LENGTH];
+    char album_url[MAX_URL_LENGTH];
+    snprintf(band_url, sizeof(band_url), "%s/mp3/band-%d", base_url(), STORE_BAND);
+    snprintf(album_url, sizeof(album_url), "%s/mp3/album-%d", base_url(), STORE_ALBUM);
+
+    int answered = 0;
+    double times[3] = {0, 0, 0};
+    int counts[3] = {0, 0, 0};
+    for (int i = 0; i < STORE_LOOKUPS; i++)
+    {
+        double started = rn_clock();
+        answered += store_search("test band", &band_list, NULL, NULL) == 0;
+        double searched = rn_clock();
+        answered += store_albums(band_url, &album_list) == 0;
+        double listed = rn_clock();
+        answered += store_songs(album_url, &song_list, NULL, NULL) == 0;
+        times[0] += searched - started;
+        times[1] += listed - searched;
+        times[2] += rn_clock() - listed;
+        counts[0] = band_list.count;
+        counts[1] = album_list.count;
+        counts[2] = song_list.count;
+
+        // The lists grow in the arena otherwise
+        band_list.count = 0;
+        album_list.count = 0;
+        song_list.count = 0;
+    }
+
+    check(answered == STORE_LOOKUPS * 3, "every lookup of the benchmark is answered from the store");
+    printf("Lookups answered from the store: search %.2f us (%d bands), discography %.2f us (%d albums), album %.2f us (%d songs)\n",
+           times[0] * 1e6 / STORE_LOOKUPS, counts[0], times[1] * 1e6 / STORE_LOOKUPS, counts[1], times[2] * 1e6 / STORE_LOOKUPS, counts[2]);
+
+    arena_free(&arena);
+}
+
+int main(void)
+{
+    FixturePages pages;
+    int ready = load_fixture_pages(&pages) == 0;
+    check(ready, "the fixture pages are read");
+
+    MockServer server;
+    if (!ready || mock_server_start(&server, route_catalog, &pages) != 0)
+    {
+        check(0, "the local server starts");
+        return test_summary("test_store");
+    }
+
+    char directory[256];
+    char base[64];
+    if (make_test_directory(directory, sizeof(directory), "store") != 0)
+    {
+        return 1;
+    }
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.port);
+    setenv("ROCKNATION_BASE_URL", base, 1);
+    setenv("ROCKNATION_CACHE_DIR", directory, 1);
+    get_cache()->enabled = 0;
+
+    check_url_ids();
+
+    // What the pages hold
+    Arena arena;
+    arena_init(&arena, 0);
+    BandInfoList bands;
+    AlbumInfoList albums;
+    SongInfoList songs;
+    init_band_list(&bands, &arena);
+    init_album_list(&albums, &arena);
+    init_song_list(&songs, &arena);
+    parse_bands(pages.search, pages.search_size, &bands);
+    parse_albums(pages.discography, pages.discography_size, &albums);
+    parse_songs(pages.album, pages.album_size, &songs);
+    check(bands.count > 0 && albums.count > 0 && songs.count > 0, "the fixture pages hold bands, albums and songs");
+
+    // From the network, filling the store
+    BandInfoList band_list;
+    AlbumInfoList album_list;
+    SongInfoList song_list;
+    init_band_list(&band_list, &arena);
+    init_album_list(&album_list, &arena);
+    init_song_list(&song_list, &arena);
+    char url[MAX_URL_LENGTH];
+
+    long requests = mock_requests(&server);
+    search_band("Test Band", &band_list);
+    snprintf(url, sizeof(url), "%s/mp3/band-%d", base, STORE_BAND);
+    get_albums(url, &album_list);
+    snprintf(url, sizeof(url), "%s/mp3/album-%d", base, STORE_ALBUM);
+    get_songs(url, &song_list);
+    check(mock_requests(&server) == requests + 4, "the first lookups go to the network, two pages for the discography");
+    check(same_bands(&band_list, &bands) && same_albums(&album_list, &albums) && same_songs(&song_list, &songs), "the lookups from the network give what the pages hold");
+
+    // A discography cut short by an error page is returned but not stored
+    AlbumInfoList broken;
+    init_album_list(&broken, &arena);
+    snprintf(url, sizeof(url), "%s/mp3/band-%d", base, STORE_BROKEN_BAND);
+    get_albums(url, &broken);
+    check(same_albums(&broken, &albums), "the albums of a discography cut short are returned");
+    check(store_albums(url, &broken) == -1, "a discography cut short by an error page isn't stored");
+
+    check_lookups(&server, &bands, &albums, &songs, "in the same run");
+    store_close();
+    check_lookups(&server, &bands, &albums, &songs, "after the store file is read back");
+
+    // --refresh goes to the network again, and the result is still stored
+    get_store()->refresh = 1;
+    requests = mock_requests(&server);
+    snprintf(url, sizeof(url), "%s/mp3/band-%d", base, STORE_BAND);
+    get_albums(url, &album_list);
+    check(mock_requests(&server) == requests + 2 && same_albums(&album_list, &albums), "--refresh fetches the discography again");
+    get_store()->refresh = 0;
+
+    // The last record of a discography wins, also once read back
+    AlbumInfoList shorter = albums;
+    shorter.count = 3;
+    store_put_albums(url, &shorter);
+    check(store_albums(url, &album_list) == 0 && same_albums(&album_list, &shorter), "a discography stored again replaces the one before");
+    store_close();
+    check(store_albums(url, &album_list) == 0 && same_albums(&album_list, &shorter), "the discography stored last wins when the store file is read back");
+
+    // A line cut short by an interrupted run doesn't swallow the record appended after it
+    char path[sizeof(directory) + 32];
+    snprintf(path, sizeof(path), "%s/%s", directory, STORE_FILE);
+    store_close();
+    FILE *file = fopen(path, "ab");
+    check(file != NULL && fputs("a\thttp://rocknation.su/mp3/album-", file) >= 0 && fclose(file) == 0, "a line cut short is added to the store file");
+    store_put_albums(url, &albums);
+    store_close();
+    check(store_albums(url, &album_list) == 0 && same_albums(&album_list, &albums), "a record appended after a line cut short is read back");
+
+    bench_store();
+
+    arena_free(&arena);
+    mock_server_stop(&server);
+    store_close();
+
+    remove(path);
+    snprintf(path, sizeof(path), "%s/%s", directory, SNAPSHOT_FILE);
+    remove(path);
+    rmdir(directory);
+    free_fixture_pages(&pages);
+
+    return test_summary("test_store");
+}
@@ -0,0 +1,373 @@
+// test_url.c
+// Checks the table-driven URL functions of rocknation_utils.h against the code they replaced, kept below as
+// reference_*: random strings must encode and decode to the same result, every pair of hex digits must
+// decode alike, and output cut short by a small buffer must be a prefix of the whole result. Then compares
+// the time per call of the old and new functions on song URLs and names.
+#include "../include/rocknation_utils.h"
+#include "test_util.h"
+
+#define FUZZ_CASES 100000
+#define BENCH_CALLS 200000
+
+static char reference_hex_to_char(const char *hex);
+static char *reference_url_encode(const char *input);
+static char *reference_url_encode_spaces(char *input);
+static char *reference_url_decode(const char *input);
+static int is_prefix(const char *part, const char *whole, size_t dest_size, size_t slack);
+static void check_random_strings(void);
+static void check_hex_pairs(void);
+static void bench_url(void);
+
+static char reference_hex_to_char(const char *hex)
+{
+    /* Function  : static char reference_hex_to_char(const char *hex)
+     * Input     : hex - pointer to a two-character string representing a hexadecimal number
+     * Output    : Returns the corresponding ASCII character value
+     * Procedure : This function is hex_to_char as it was before the lookup tables, kept to compare against. It converts a two-character hexadecimal string to its corresponding ASCII character. It iterates through each character of the input string, converting the hexadecimal digits to their decimal equivalent. The result is the ASCII value of the represented character. If the input is not a valid hexadecimal string, the behavior is undefined.
+     */
+
+    int value = 0;
+
+    // Iterate through each character in the two-character hexadecimal string
+    for (int i = 0; i < 2; i++)
+    {
+        char c = hex[i];
+
+        // Convert hexadecimal digits to their decimal equivalent
+        if (isdigit(c))
+        {
+            value = value * 16 + (c - '0');
+        }
+        else if (isxdigit(c))
+        {
+            value = value * 16 + (tolower(c) - 'a' + 10);
+        }
+    }
+
+    // Return the corresponding ASCII character value
+    return (char)value;
+}
+
+static char *reference_url_encode(const char *input)
+{
+    /* Function  : static char *reference_url_encode(const char *input)
+     * Input     : input - pointer to the string to be URL-encoded
+     * Output    : Returns a newly allocated URL-encoded string
+     * Procedure : This function is url_encode as it was before the lookup tables, kept to compare against. It URL-encodes the input string, replacing special characters with their percent-encoded equivalents. The resulting string should be freed by the caller.
+     */
+
+    size_t len = strlen(input);
+    char *output = rn_malloc(3 * len + 1); // Maximum possible length for URL encoding
+
+    if (output)
+    {
+        size_t j = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (isalnum((unsigned char)input[i]) || input[i] == '-' || input[i] == '_' || input[i] == '.' || input[i] == '~')
+            {
+                output[j++] = input[i];
+            }
+            else
+            {
+                snprintf(output + j, 4, "%%%02X", (unsigned char)input[i]);
+                j += 3;
+            }
+        }
+        output[j] = '\0';
+    }
+
+    return output;
+}
+
+static char *reference_url_encode_spaces(char *input)
+{
+    /* Function  : static char *reference_url_encode_spaces(char *input)
+     * Input     : input - pointer to the string containing spaces to be URL-encoded
+     * Output    : Returns a newly allocated URL-encoded string with spaces replaced by "%20"
+     * Procedure : This function is url_encode_spaces as it was before the single pass, kept to compare against. It URL-encodes the input string, replacing spaces with "%20". The resulting string should be freed by the caller.
+     */
+
+    // Count the number of spaces in the input string
+    int spaceCount = 0;
+    for (int i = 0; input[i] != '\0'; i++)
+    {
+        if (input[i] == ' ')
+        {
+            spaceCount++;
+        }
+    }
+
+    // Calculate the length of the new string with "%20"
+    int originalLength = strlen(input);
+    int newLength = originalLength + (spaceCount * 2); // Each space is replaced by "%20"
+
+    // Allocate memory for the new string
+    char *newString = (char *)rn_malloc(newLength + 1); // +1 for the null terminator
+
+    if (newString == NULL)
+    {
+        // Memory allocation failed
+        return NULL;
+    }
+
+    // Copy characters from the original string to the new string
+    int newIndex = 0;
+    for (int i = 0; input[i] != '\0'; i++)
+    {
+        if (input[i] == ' ')
+        {
+            // Replace space with "%20"
+            newString[newIndex++] = '%';
+            newString[newIndex++] = '2';
+            newString[newIndex++] = '0';
+        }
+        else
+        {
+            // Copy other characters as-is
+            newString[newIndex++] = input[i];
+        }
+    }
+
+    // Add the null terminator at the end of the new string
+    newString[newIndex] = '\0';
+
+    return newString;
+}
+
+static char *reference_url_decode(const char *input)
+{
+    /* Function  : static char *reference_url_decode(const char *input)
+     * Input     : input - pointer to the URL-encoded string
+     * Output    : Returns a newly allocated URL-decoded string
+     * Procedure : This function is url_decode as it was before the lookup tables, kept to compare against. It URL-decodes the input string, replacing percent-encoded sequences with their original characters. The resulting string should be freed by the caller.
+     */
+
+    size_t len = strlen(input);
+    char *output = rn_malloc(len + 1); // Maximum possible length for URL decoding
+
+    if (output)
+    {
+        size_t j = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (input[i] == '%')
+            {
+                if (i + 2 < len && isxdigit(input[i + 1]) && isxdigit(input[i + 2]))
+                {
+                    char hex[3];
+                    hex[0] = input[i + 1];
+                    hex[1] = input[i + 2];
+                    hex[2] = '\0';
+                    output[j++] = reference_hex_to_char(hex);
+                    i += 2;
+                }
+                else
+                {
+                    // Invalid encoding, copy as is
+                    output[j++] = input[i];
+                }
+            }
+            else if (input[i] == '+')
+            {
+                output[j++] = ' ';
+            }
+            else
+            {
+                output[j++] = input[i];
+            }
+        }
+        output[j] = '\0';
+    }
+
+    return output;
+}
+
+
+static int is_prefix(const char *part, const char *whole, size_t dest_size, size_t slack)
+{
+    /* Function  : static int is_prefix(const char *part, const char *whole, size_t dest_size, size_t slack)
+     * Input     : part - output written into a buffer of dest_size bytes
+     *             whole - output of the same call with a large enough buffer
+     *             dest_size - size of the small buffer
+     *             slack - bytes the output may stop short of the full buffer (an escape is never split)
+     * Output    : Returns 1 if part is a prefix of whole that fills the buffer as far as it should, 0 otherwise
+     * Procedure : This function checks the truncation rule of the *_into functions.
+     */
+
+    size_t length = strlen(part);
+    size_t expected = strlen(whole) < dest_size - 1 ? strlen(whole) : dest_size - 1;
+
+    return strncmp(part, whole, length) == 0 && length <= expected && length + slack >= expected;
+}
+
+static void check_random_strings(void)
+{
+    /* Function  : static void check_random_strings(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function encodes and decodes random strings, mostly made of characters that matter to URLs (spaces, '%', '+', hex digits, reserved and non-ASCII bytes), with the old and new functions, and checks that the results are the same and that a small buffer receives a prefix of the result.
+     */
+
+    const char alphabet[] = "ab %+0F9gZ-_.~/\xe9\x80";
+    unsigned int state = 88172645u;
+    char input[256];
+    char buffer[1024];
+    long mismatches = 0;
+
+    for (int i = 0; i < FUZZ_CASES; i++)
+    {
+        size_t length = test_random(&state) % 200;
+        for (size_t k = 0; k < length; k++)
+        {
+            input[k] = test_random(&state) % 4 == 0 ? (char)(test_random(&state) % 255 + 1) : alphabet[test_random(&state) % (sizeof(alphabet) - 1)];
+        }
+        input[length] = '\0';
+
+        char *expected = reference_url_encode(input);
+        char *found = url_encode(input);
+        mismatches += strcmp(expected, found) != 0;
+        free(expected);
+        free(found);
+
+        expected = reference_url_encode_spaces(input);
+        found = url_encode_spaces(input);
+        mismatches += strcmp(expected, found) != 0;
+        size_t dest_size = test_random(&state) % (length + 2) + 1;
+        url_encode_spaces_into(input, length, buffer, dest_size);
+        mismatches += !is_prefix(buffer, found, dest_size, 2);
+        free(expected);
+        free(found);
+
+        expected = reference_url_decode(input);
+        found = url_decode(input);
+        mismatches += strcmp(expected, found) != 0;
+        url_decode_into(input, length, buffer, dest_size);
+        mismatches += !is_prefix(buffer, found, dest_size, 0);
+        free(expected);
+        free(found);
+    }
+
+    if (mismatches > 0)
+    {
+        printf("%ld mismatches over %d random strings\n", mismatches, FUZZ_CASES);
+    }
+    check(mismatches == 0, "random strings encode and decode like the old functions");
+}
+
+static void check_hex_pairs(void)
+{
+    /* Function  : static void check_hex_pairs(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function checks that hex_to_char decodes every pair of hex digits, in both cases, like the old function.
+     */
+
+    int same = 1;
+
+    for (int high = 0; high < 256; high++)
+    {
+        for (int low = 0; low < 256; low++)
+        {
+            char hex[3] = {(char)high, (char)low, '\0'};
+
+            if (isxdigit(high) && isxdigit(low) && reference_hex_to_char(hex) != hex_to_char(hex))
+            {
+                same = 0;
+            }
+        }
+    }
+
+    check(same, "hex_to_char decodes every pair of hex digits like the old function");
+}
+
+static void bench_url(void)
+{
+    /* Function  : static void bench_url(void)
+     * Input     : None
+     * Output    : None
+     * Procedure : This function times BENCH_CALLS calls of the old and new functions on a song URL and an escaped song name, as the album and download paths use them, and prints the time per call. The *_into rows compare the old allocating function with writing into a buffer on the stack.
+     */
+
+    static const char *labels[] = {"hex_to_char", "url_encode (78 B)", "url_encode_into", "url_encode_spaces", "url_encode_spaces_into",
+                                   "url_decode (90 B URL)", "url_decode_into (URL)", "url_decode_into (name)"};
+    const char *encoded = "http://rocknation.su/upload/mp3/Iron%20Maiden/1984%20-%20Powerslave/01.%20Aces%20High.mp3";
+    const char *decoded = "http://rocknation.su/upload/mp3/Iron Maiden/1984 - Powerslave/01. Aces High.mp3";
+    const char *name = "01.%20Aces%20High%20%28Live%20at%20Long%20Beach%20Arena%29.mp3";
+    char buffer[1024];
+    volatile size_t sink = 0;
+
+    for (int operation = 0; operation < 8; operation++)
+    {
+        double times[2];
+
+        for (int reference = 1; reference >= 0; reference--)
+        {
+            double started = rn_clock();
+
+            for (int call = 0; call < BENCH_CALLS; call++)
+            {
+                char *output = NULL;
+
+                if (operation == 0)
+                {
+                    sink += reference ? reference_hex_to_char(encoded + 40 + call % 10) : hex_to_char(encoded + 40 + call % 10);
+                }
+                else if (operation <= 2)
+                {
+                    if (reference || operation == 1)
+                    {
+                        output = reference ? reference_url_encode(decoded) : url_encode(decoded);
+                    }
+                    else
+                    {
+                        sink += url_encode_into(decoded, strlen(decoded), buffer, sizeof(buffer));
+                    }
+                }
+                else if (operation <= 4)
+                {
+                    if (reference || operation == 3)
+                    {
+                        output = reference ? reference_url_encode_spaces((char *)decoded) : url_encode_spaces((char *)decoded);
+                    }
+                    else
+                    {
+                        sink += url_encode_spaces_into(decoded, strlen(decoded), buffer, sizeof(buffer));
+                    }
+                }
+                else
+                {
+                    const char *input = operation == 7 ? name : encoded;
+
+                    if (reference || operation == 5)
+                    {
+                        output = reference ? reference_url_decode(input) : url_decode(input);
+                    }
+                    else
+                    {
+                        sink += url_decode_into(input, strlen(input), buffer, sizeof(buffer));
+                    }
+                }
+
+                if (output != NULL)
+                {
+                    sink += (size_t)output[5];
+                    free(output);
+                }
+            }
+
+            times[reference] = (rn_clock() - started) / BENCH_CALLS * 1e9;
+        }
+
+        printf("%-24s old %7.1f ns  new %7.1f ns  (%.1fx)\n", labels[operation], times[1], times[0], times[1] / times[0]);
+    }
+}
+
+int main(void)
+{
+    check_random_strings();
+    check_hex_pairs();
+    bench_url();
+
+    return test_summary("test_url");
+}
@@ -0,0 +1,288 @@
+// test_util.h
+#pragma once
+#include "../include/rocknation_platform.h"
+#include "../include/rocknation_alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FIXTURE_DIR "tests/fixtures/"
+
+// A download to run with run_download, download_file (rocknation_curl.h) or a wrapper around another one
+typedef int (*TestDownloadFunction)(const char *url, const char *output);
+
+// Number of failed checks of the program
+static int test_failures = 0;
+
+static void check(int condition, const char *what);
+static int test_summary(const char *name);
+static char *read_fixture(const char *name, size_t *size);
+static double bench_rate(double bytes, double seconds);
+static int make_test_directory(char *directory, size_t size, const char *name);
+static int silence_stdout(void);
+static void restore_stdout(int saved);
+static unsigned int test_random(unsigned int *state);
+static double thread_cpu(void);
+static int same_file(const char *path, const char *data, size_t size);
+static int file_exists(const char *path);
+static int run_download(TestDownloadFunction download, const char *url, const char *output, size_t *heap_bytes, double *elapsed);
+
+static void check(int condition, const char *what)
+{
+    /* Function  : static void check(int condition, const char *what)
+     * Input     : condition - result of the check, non-zero if it passed
+     *             what - description of what was checked
+     * Output    : None
+     * Procedure : This function records a failed check and prints what it was, so a run shows every failure and not only the first one.
+     */
+
+    if (!condition)
+    {
+        printf("FAIL: %s\n", what);
+        test_failures++;
+    }
+}
+
+static int test_summary(const char *name)
+{
+    /* Function  : static int test_summary(const char *name)
+     * Input     : name - name of the test program
+     * Output    : Returns the exit status of the program: 0 if every check passed, 1 otherwise
+     * Procedure : This function prints the outcome of the program, which tests/run.sh reports.
+     */
+
+    if (test_failures > 0)
+    {
+        printf("%s: %d checks failed\n", name, test_failures);
+        return 1;
+    }
+
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+static char *read_fixture(const char *name, size_t *size)
+{
+    /* Function  : static char *read_fixture(const char *name, size_t *size)
+     * Input     : name - file name of a saved page in tests/fixtures
+     *             size - pointer receiving the size of the page
+     * Output    : Returns the null-terminated page, to be freed by the caller, or NULL if it can't be read
+     * Procedure : This function reads a fixture page. Tests are run from the root of the repository (see tests/run.sh).
+     */
+
+    char path[256];
+    snprintf(path, sizeof(path), FIXTURE_DIR "%s", name);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("Can't open %s\n", path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = length >= 0 ? malloc((size_t)length + 1) : NULL;
+    if (data == NULL || fread(data, 1, (size_t)length, file) != (size_t)length)
+    {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+
+    data[length] = '\0';
+    *size = (size_t)length;
+    fclose(file);
+
+    return data;
+}
+
+static double bench_rate(double bytes, double seconds)
+{
+    /* Function  : static double bench_rate(double bytes, double seconds)
+     * Input     : bytes - bytes processed
+     *             seconds - time it took
+     * Output    : Returns the throughput in MB/s
+     * Procedure : This function turns a measurement into MB/s, guarding against a zero duration.
+     */
+
+    return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+static int make_test_directory(char *directory, size_t size, const char *name)
+{
+    /* Function  : static int make_test_directory(char *directory, size_t size, const char *name)
+     * Input     : directory - buffer receiving the path of the directory
+     *             size - size of the buffer
+     *             name - name of the test, part of the name of the directory
+     * Output    : Returns 0 on success, -1 if the directory can't be created
+     * Procedure : This function creates an empty directory of its own for the files of a test, named "rocknation-<name>-XXXXXX" under $TMPDIR (/tmp if it isn't set).
+     */
+
+    const char *tmp = getenv("TMPDIR");
+    if (tmp == NULL)
+    {
+        tmp = "/tmp";
+    }
+
+    snprintf(directory, size, "%s/rocknation-%s-XXXXXX", tmp, name);
+    if (mkdtemp(directory) == NULL)
+    {
+        printf("Can't create a directory under %s\n", tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int silence_stdout(void)
+{
+    /* Function  : static int silence_stdout(void)
+     * Input     : None
+     * Output    : Returns a copy of the standard output to give to restore_stdout, or -1 if it is left as it is
+     * Procedure : This function points the standard output at /dev/null, so the progress lines of the code under test don't bury the results of the checks.
+     */
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+
+    if (saved < 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0)
+    {
+        if (saved >= 0)
+        {
+            close(saved);
+        }
+        saved = -1;
+    }
+    if (null >= 0)
+    {
+        close(null);
+    }
+
+    return saved;
+}
+
+static void restore_stdout(int saved)
+{
+    /* Function  : static void restore_stdout(int saved)
+     * Input     : saved - descriptor returned by silence_stdout
+     * Output    : None
+     * Procedure : This function points the standard output back where it was before silence_stdout.
+     */
+
+    if (saved < 0)
+    {
+        return;
+    }
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static unsigned int test_random(unsigned int *state)
+{
+    /* Function  : static unsigned int test_random(unsigned int *state)
+     * Input     : state - pointer to the state of the generator, seeded by the caller with any value but 0
+     * Output    : Returns the next pseudo-random number
+     * Procedure : This function is a xorshift generator, so every run of a test with the same seed makes the same choices.
+     */
+
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double thread_cpu(void)
+{
+    /* Function  : static double thread_cpu(void)
+     * Input     : None
+     * Output    : Returns the CPU time used by the calling thread, in seconds
+     * Procedure : This function reads the CPU clock of the thread, so neither the work of other threads nor the time the thread spends preempted is counted.
+     */
+
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int same_file(const char *path, const char *data, size_t size)
+{
+    /* Function  : static int same_file(const char *path, const char *data, size_t size)
+     * Input     : path - pointer to the path of the file
+     *             data - pointer to the bytes it must hold
+     *             size - number of bytes
+     * Output    : Returns 1 if the file holds exactly those bytes, 0 otherwise
+     * Procedure : This function reads the file back and compares it with the data.
+     */
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    char buffer[64 * 1024];
+    size_t offset = 0;
+    size_t read;
+    int same = 1;
+
+    while (same && (read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        same = offset + read <= size && memcmp(buffer, data + offset, read) == 0;
+        offset += read;
+    }
+    fclose(file);
+
+    return same && offset == size;
+}
+
+static int file_exists(const char *path)
+{
+    /* Function  : static int file_exists(const char *path)
+     * Input     : path - pointer to the path to check
+     * Output    : Returns 1 if something exists at the path, 0 otherwise
+     * Procedure : This function asks stat about the path.
+     */
+
+    struct stat info;
+    return stat(path, &info) == 0;
+}
+
+static int run_download(TestDownloadFunction download, const char *url, const char *output, size_t *heap_bytes, double *elapsed)
+{
+    /* Function  : static int run_download(TestDownloadFunction download, const char *url, const char *output, size_t *heap_bytes, double *elapsed)
+     * Input     : download - function running the download
+     *             url - pointer to the URL to download
+     *             output - pointer to the path of the output file
+     *             heap_bytes - pointer receiving the bytes the library asked the heap for meanwhile, or NULL
+     *             elapsed - pointer receiving the time the download took, or NULL
+     * Output    : Returns what the download returns
+     * Procedure : This function runs the download with its messages silenced and measures it.
+     */
+
+    size_t before = RN_ATOMIC_ADD(rocknation_alloc.bytes, 0);
+    int saved = silence_stdout();
+    double started = rn_clock();
+    int result = download(url, output);
+
+    if (elapsed != NULL)
+    {
+        *elapsed = rn_clock() - started;
+    }
+    restore_stdout(saved);
+    if (heap_bytes != NULL)
+    {
+        *heap_bytes = RN_ATOMIC_ADD(rocknation_alloc.bytes, 0) - before;
+    }
+
+    return result;
+}